@@ -33,6 +33,8 @@
         'circular_queue_impl.h',
         'constants.cc',
         'constants.h',
+        'crc32c.cc',
+        'crc32c.h',
         'crt_interceptors.cc',
         'crt_interceptors.h',
         'crt_interceptors_macros.h',
@@ -59,6 +61,8 @@
         'heaps/zebra_block_heap.h',
         'iat_patcher.cc',
         'iat_patcher.h',
+        'lock_free_circular_queue.h',
+        'lock_free_circular_queue_impl.h',
         'logger.cc',
         'logger.h',
         'memory_interceptors.cc',
@@ -93,6 +97,8 @@
         'reporter.h',
         'runtime.cc',
         'runtime.h',
+        'runtime_stats.cc',
+        'runtime_stats.h',
         'runtime_util.cc',
         'runtime_util.h',
         'scoped_page_protections.cc',
@@ -102,6 +108,8 @@
         'shadow_impl.h',
         'shadow_marker.cc',
         'shadow_marker.h',
+        'shadow_simd.cc',
+        'shadow_simd.h',
         'stack_capture_cache.cc',
         'stack_capture_cache.h',
         'system_interceptors.cc',
@@ -174,9 +182,11 @@
         'block_unittest.cc',
         'block_utils_unittest.cc',
         'circular_queue_unittest.cc',
+        'crc32c_unittest.cc',
         'error_info_unittest.cc',
         'heap_checker_unittest.cc',
         'iat_patcher_unittest.cc',
+        'lock_free_circular_queue_unittest.cc',
         'logger_unittest.cc',
         'memory_interceptors_patcher_unittest.cc',
         'memory_interceptors_unittest.cc',
@@ -186,9 +196,11 @@
         'rtl_impl_unittest.cc',
         'rtl_unittest.cc',
         'rtl_utils_unittest.cc',
+        'runtime_stats_unittest.cc',
         'runtime_unittest.cc',
         'scoped_page_protections_unittest.cc',
         'shadow_marker_unittest.cc',
+        'shadow_simd_unittest.cc',
         'shadow_unittest.cc',
         'stack_capture_cache_unittest.cc',
         'system_interceptors_unittest.cc',
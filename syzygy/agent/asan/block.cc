@@ -16,8 +16,8 @@
 
 #include <algorithm>
 
-#include "base/hash.h"
 #include "base/logging.h"
+#include "syzygy/agent/asan/crc32c.h"
 #include "syzygy/agent/asan/runtime.h"
 #include "syzygy/agent/asan/shadow.h"
 #include "syzygy/agent/asan/stack_capture_cache.h"
@@ -109,6 +109,44 @@ uint32_t CombineUInt32IntoBlockChecksum(uint32_t val) {
   return checksum;
 }
 
+// The size of the body samples, and the distance between the start of
+// consecutive samples, used by the sampled checksum strategy.
+const uint32_t kBlockChecksumSampleSize = 64;
+const uint32_t kBlockChecksumSampleStride = 1024;
+
+// The strategy used to checksum the quarantined and freed blocks.
+::common::QuarantineChecksumStrategy g_checksum_strategy =
+    ::common::kQuarantineChecksumFullBody;
+
+// Checksums the header and trailer regions of a block.
+uint32_t ChecksumBlockHeaderAndTrailer(const BlockInfo& block_info) {
+  uint32_t checksum = Crc32c(0, block_info.header,
+                             block_info.TotalHeaderSize());
+  return Crc32c(checksum, block_info.trailer_padding,
+                block_info.TotalTrailerSize());
+}
+
+// Checksums the header and trailer regions of a block, as well as regularly
+// spaced samples of its body. The end of the body is always sampled.
+uint32_t ChecksumBlockSampled(const BlockInfo& block_info) {
+  uint32_t checksum = Crc32c(0, block_info.header,
+                             block_info.TotalHeaderSize());
+  const uint8_t* body = block_info.RawBody();
+  uint32_t offset = 0;
+  for (; offset < block_info.body_size; offset += kBlockChecksumSampleStride) {
+    uint32_t size = std::min(kBlockChecksumSampleSize,
+                             block_info.body_size - offset);
+    checksum = Crc32c(checksum, body + offset, size);
+  }
+  if (block_info.body_size > kBlockChecksumSampleSize) {
+    checksum = Crc32c(checksum,
+                      body + block_info.body_size - kBlockChecksumSampleSize,
+                      kBlockChecksumSampleSize);
+  }
+  return Crc32c(checksum, block_info.trailer_padding,
+                block_info.TotalTrailerSize());
+}
+
 // Global callback invoked by exception handlers when exceptions occur. This is
 // a testing seam.
 OnExceptionCallback g_on_exception_callback;
@@ -431,21 +469,29 @@ void BlockSetChecksum(const BlockInfo& block_info) {
     case ALLOCATED_BLOCK:
     case QUARANTINED_FLOODED_BLOCK: {
       // Only checksum the header and trailer regions.
-      checksum = base::SuperFastHash(
-          reinterpret_cast<const char*>(block_info.header),
-          block_info.TotalHeaderSize());
-      checksum ^= base::SuperFastHash(
-          reinterpret_cast<const char*>(block_info.trailer_padding),
-          block_info.TotalTrailerSize());
+      checksum = ChecksumBlockHeaderAndTrailer(block_info);
       break;
     }
 
     // The checksum is the calculated in the same way in these two cases.
     case QUARANTINED_BLOCK:
     case FREED_BLOCK: {
-      checksum = base::SuperFastHash(
-          reinterpret_cast<const char*>(block_info.header),
-          block_info.block_size);
+      switch (g_checksum_strategy) {
+        case ::common::kQuarantineChecksumFullBody: {
+          checksum = Crc32c(0, block_info.header, block_info.block_size);
+          break;
+        }
+        case ::common::kQuarantineChecksumSampledBody: {
+          checksum = ChecksumBlockSampled(block_info);
+          break;
+        }
+        default: {
+          DCHECK_EQ(::common::kQuarantineChecksumHeaderOnly,
+                    g_checksum_strategy);
+          checksum = ChecksumBlockHeaderAndTrailer(block_info);
+          break;
+        }
+      }
       break;
     }
   }
@@ -935,6 +981,15 @@ void BlockAnalyze(BlockState block_state,
   }
 }
 
+void SetBlockChecksumStrategy(::common::QuarantineChecksumStrategy strategy) {
+  DCHECK_GT(::common::kQuarantineChecksumStrategyMax, strategy);
+  g_checksum_strategy = strategy;
+}
+
+::common::QuarantineChecksumStrategy GetBlockChecksumStrategy() {
+  return g_checksum_strategy;
+}
+
 void SetOnExceptionCallback(OnExceptionCallback callback) {
   g_on_exception_callback = callback;
 }
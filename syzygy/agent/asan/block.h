@@ -88,6 +88,7 @@
 #include "base/callback.h"
 #include "base/logging.h"
 #include "syzygy/agent/asan/constants.h"
+#include "syzygy/common/asan_parameters.h"
 
 namespace agent {
 
@@ -433,6 +434,16 @@ bool BlockChecksumIsValid(const BlockInfo& block_info);
 // @param block_info The block to be checksummed.
 // @note The pages containing the block must be writable and readable.
 void BlockSetChecksum(const BlockInfo& block_info);
+
+// Sets the strategy used to checksum the quarantined and freed blocks. The
+// default is to checksum them entirely.
+// @param strategy The strategy to use.
+// @note This must not be changed while there are blocks in the quarantine, as
+//     their checksums would no longer be valid.
+void SetBlockChecksumStrategy(::common::QuarantineChecksumStrategy strategy);
+
+// @returns the strategy used to checksum the quarantined and freed blocks.
+::common::QuarantineChecksumStrategy GetBlockChecksumStrategy();
 // @}
 
 // Determines if the body of a block is a valid flood-filled body.
@@ -14,16 +14,19 @@
 
 #include "syzygy/agent/asan/block.h"
 
+#include <intrin.h>
 #include <memory>
 #include <set>
 #include <vector>
 
 #include "windows.h"
 
+#include "base/strings/stringprintf.h"
 #include "gtest/gtest.h"
 #include "syzygy/agent/asan/page_protection_helpers.h"
 #include "syzygy/agent/asan/runtime.h"
 #include "syzygy/agent/asan/unittest_util.h"
+#include "syzygy/testing/metrics.h"
 
 namespace agent {
 namespace asan {
@@ -713,6 +716,127 @@ TEST_F(BlockTest, ChecksumDetectsTampering) {
   ASSERT_NO_FATAL_FAILURE(runtime.TearDown());
 }
 
+namespace {
+
+// Determines if the checksum of a block changes when one of its bytes is
+// modified. The byte is restored before returning.
+bool ChecksumCoversByte(const BlockInfo& block_info, uint8_t* byte) {
+  uint32_t checksum = BlockCalculateChecksum(block_info);
+  ++(*byte);
+  bool covered = BlockCalculateChecksum(block_info) != checksum;
+  --(*byte);
+  return covered;
+}
+
+// Restores the default block checksum strategy when going out of scope.
+class ScopedBlockChecksumStrategy {
+ public:
+  explicit ScopedBlockChecksumStrategy(
+      ::common::QuarantineChecksumStrategy strategy) {
+    SetBlockChecksumStrategy(strategy);
+  }
+  ~ScopedBlockChecksumStrategy() {
+    SetBlockChecksumStrategy(::common::kDefaultQuarantineChecksumStrategy);
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ScopedBlockChecksumStrategy);
+};
+
+}  // namespace
+
+TEST_F(BlockTest, ChecksumStrategies) {
+  EXPECT_EQ(::common::kDefaultQuarantineChecksumStrategy,
+            GetBlockChecksumStrategy());
+
+  BlockLayout layout = {};
+  EXPECT_TRUE(BlockPlanLayout(kShadowRatio, kShadowRatio, 4000, 0, 0,
+                              &layout));
+  std::unique_ptr<uint8_t[]> data(new uint8_t[layout.block_size]);
+  ::memset(data.get(), 0, layout.block_size);
+  BlockInfo info = {};
+  BlockInitialize(layout, data.get(), &info);
+  info.header->state = QUARANTINED_BLOCK;
+
+  // The CRC32C detects every single byte modification, so these are exact.
+  uint8_t* sampled_byte = info.RawBody() + 1024 + 10;
+  uint8_t* unsampled_byte = info.RawBody() + 512;
+  uint8_t* last_byte = info.RawBody() + info.body_size - 1;
+
+  {
+    ScopedBlockChecksumStrategy strategy(::common::kQuarantineChecksumFullBody);
+    EXPECT_TRUE(ChecksumCoversByte(info, info.RawHeader()));
+    EXPECT_TRUE(ChecksumCoversByte(info, info.RawBody()));
+    EXPECT_TRUE(ChecksumCoversByte(info, sampled_byte));
+    EXPECT_TRUE(ChecksumCoversByte(info, unsampled_byte));
+    EXPECT_TRUE(ChecksumCoversByte(info, last_byte));
+    EXPECT_TRUE(ChecksumCoversByte(info, info.RawTrailer()));
+  }
+
+  {
+    ScopedBlockChecksumStrategy strategy(
+        ::common::kQuarantineChecksumSampledBody);
+    EXPECT_TRUE(ChecksumCoversByte(info, info.RawHeader()));
+    EXPECT_TRUE(ChecksumCoversByte(info, info.RawBody()));
+    EXPECT_TRUE(ChecksumCoversByte(info, sampled_byte));
+    EXPECT_FALSE(ChecksumCoversByte(info, unsampled_byte));
+    EXPECT_TRUE(ChecksumCoversByte(info, last_byte));
+    EXPECT_TRUE(ChecksumCoversByte(info, info.RawTrailer()));
+  }
+
+  {
+    ScopedBlockChecksumStrategy strategy(
+        ::common::kQuarantineChecksumHeaderOnly);
+    EXPECT_TRUE(ChecksumCoversByte(info, info.RawHeader()));
+    EXPECT_FALSE(ChecksumCoversByte(info, info.RawBody()));
+    EXPECT_FALSE(ChecksumCoversByte(info, sampled_byte));
+    EXPECT_FALSE(ChecksumCoversByte(info, last_byte));
+    EXPECT_TRUE(ChecksumCoversByte(info, info.RawTrailer()));
+  }
+
+  // Allocated blocks never have their body checksummed.
+  info.header->state = ALLOCATED_BLOCK;
+  EXPECT_FALSE(ChecksumCoversByte(info, info.RawBody()));
+}
+
+TEST_F(BlockTest, ChecksumStrategiesPerfTest) {
+  static const char* kStrategyNames[] = { "FullBody", "SampledBody",
+                                          "HeaderOnly" };
+  static_assert(arraysize(kStrategyNames) ==
+                    ::common::kQuarantineChecksumStrategyMax,
+                "Strategy names out of date.");
+  static const uint32_t kBodySizes[] = { 64, 1024, 64 * 1024 };
+  static const size_t kIterations = 1000;
+
+  for (size_t i = 0; i < arraysize(kBodySizes); ++i) {
+    BlockLayout layout = {};
+    EXPECT_TRUE(BlockPlanLayout(kShadowRatio, kShadowRatio, kBodySizes[i], 0,
+                                0, &layout));
+    std::unique_ptr<uint8_t[]> data(new uint8_t[layout.block_size]);
+    ::memset(data.get(), 0, layout.block_size);
+    BlockInfo info = {};
+    BlockInitialize(layout, data.get(), &info);
+    info.header->state = QUARANTINED_BLOCK;
+
+    for (uint32_t strategy = 0;
+         strategy < ::common::kQuarantineChecksumStrategyMax; ++strategy) {
+      ScopedBlockChecksumStrategy scoped_strategy(
+          static_cast<::common::QuarantineChecksumStrategy>(strategy));
+      uint64_t tnet = ::__rdtsc();
+      for (size_t j = 0; j < kIterations; ++j)
+        BlockSetChecksum(info);
+      tnet = ::__rdtsc() - tnet;
+
+      // Report the throughput in bytes of block per thousand cycles.
+      double throughput = 1000.0 * layout.block_size * kIterations / tnet;
+      testing::EmitMetric(
+          base::StringPrintf("Syzygy.Asan.BlockChecksum.%s.%d",
+                             kStrategyNames[strategy], kBodySizes[i]),
+          throughput);
+    }
+  }
+}
+
 TEST_F(BlockTest, BlockBodyIsFloodFilled) {
   static char dummy_body[3] = { 0x00, 0x00, 0x00 };
   BlockInfo dummy_info = {};
@@ -0,0 +1,119 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/crc32c.h"
+
+#include <intrin.h>
+#include <nmmintrin.h>
+#include <string.h>
+
+#include "base/lazy_instance.h"
+#include "base/logging.h"
+#include "base/macros.h"
+
+namespace agent {
+namespace asan {
+
+namespace {
+
+// The CPUID feature bit indicating the support of SSE4.2.
+static const int kCpuidSse42Bit = 1 << 20;  // CPUID.1.ECX.
+
+// The reversed CRC32C (Castagnoli) polynomial.
+static const uint32_t kCrc32cPolynomial = 0x82F63B78;
+
+// The lookup table used by the software implementation.
+struct Crc32cTable {
+  Crc32cTable() {
+    for (uint32_t i = 0; i < arraysize(entries); ++i) {
+      uint32_t crc = i;
+      for (size_t j = 0; j < 8; ++j)
+        crc = (crc >> 1) ^ ((crc & 1) ? kCrc32cPolynomial : 0);
+      entries[i] = crc;
+    }
+  }
+
+  uint32_t entries[256];
+};
+
+base::LazyInstance<Crc32cTable>::Leaky g_crc32c_table =
+    LAZY_INSTANCE_INITIALIZER;
+
+typedef uint32_t (*Crc32cFunction)(uint32_t crc, const void* data, size_t size);
+
+Crc32cFunction GetCrc32cFunction() {
+  // This is racy but benign, as every thread computes the same value.
+  static Crc32cFunction crc32c_function = nullptr;
+  if (crc32c_function == nullptr) {
+    crc32c_function = Crc32cIsHardwareAccelerated() ? &Crc32cHardware
+                                                    : &Crc32cSoftware;
+  }
+  return crc32c_function;
+}
+
+}  // namespace
+
+bool Crc32cIsHardwareAccelerated() {
+  int info[4] = {};
+  ::__cpuid(info, 1);
+  return (info[2] & kCpuidSse42Bit) != 0;
+}
+
+uint32_t Crc32c(uint32_t crc, const void* data, size_t size) {
+  return GetCrc32cFunction()(crc, data, size);
+}
+
+uint32_t Crc32cSoftware(uint32_t crc, const void* data, size_t size) {
+  DCHECK(data != nullptr || size == 0);
+  const uint32_t* table = g_crc32c_table.Get().entries;
+  const uint8_t* cursor = reinterpret_cast<const uint8_t*>(data);
+  const uint8_t* end = cursor + size;
+  crc = ~crc;
+  for (; cursor < end; ++cursor)
+    crc = (crc >> 8) ^ table[(crc ^ *cursor) & 0xFF];
+  return ~crc;
+}
+
+uint32_t Crc32cHardware(uint32_t crc, const void* data, size_t size) {
+  DCHECK(data != nullptr || size == 0);
+  const uint8_t* cursor = reinterpret_cast<const uint8_t*>(data);
+  const uint8_t* end = cursor + size;
+  crc = ~crc;
+
+  // Process the data a word at a time, with unaligned loads. These are as fast
+  // as aligned ones on the CPUs that support SSE4.2.
+#ifdef _WIN64
+  uint64_t crc64 = crc;
+  for (; static_cast<size_t>(end - cursor) >= sizeof(uint64_t);
+       cursor += sizeof(uint64_t)) {
+    uint64_t word = 0;
+    ::memcpy(&word, cursor, sizeof(word));
+    crc64 = ::_mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+#endif
+  for (; static_cast<size_t>(end - cursor) >= sizeof(uint32_t);
+       cursor += sizeof(uint32_t)) {
+    uint32_t word = 0;
+    ::memcpy(&word, cursor, sizeof(word));
+    crc = ::_mm_crc32_u32(crc, word);
+  }
+  for (; cursor < end; ++cursor)
+    crc = ::_mm_crc32_u8(crc, *cursor);
+
+  return ~crc;
+}
+
+}  // namespace asan
+}  // namespace agent
@@ -0,0 +1,51 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a CRC32C (Castagnoli) implementation used to checksum the blocks.
+// The CRC32 instruction introduced with SSE4.2 is used when the CPU supports
+// it, and a table driven implementation producing the same values is used
+// otherwise.
+
+#ifndef SYZYGY_AGENT_ASAN_CRC32C_H_
+#define SYZYGY_AGENT_ASAN_CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace agent {
+namespace asan {
+
+// @returns true if the CPU supports the SSE4.2 CRC32 instruction.
+bool Crc32cIsHardwareAccelerated();
+
+// Extends a CRC32C with the given data. Checksumming a buffer in several
+// pieces yields the same value as checksumming it at once.
+// @param crc The CRC32C of the preceding data, 0 if there is none.
+// @param data The data to checksum.
+// @param size The size of the data, in bytes.
+// @returns the CRC32C of the preceding data followed by @p data.
+uint32_t Crc32c(uint32_t crc, const void* data, size_t size);
+
+// @name The individual implementations of Crc32c. These are exposed for
+//     testing.
+// @{
+uint32_t Crc32cSoftware(uint32_t crc, const void* data, size_t size);
+// @pre The CPU must support SSE4.2.
+uint32_t Crc32cHardware(uint32_t crc, const void* data, size_t size);
+// @}
+
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_CRC32C_H_
@@ -0,0 +1,65 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/crc32c.h"
+
+#include "base/rand_util.h"
+#include "gtest/gtest.h"
+
+namespace agent {
+namespace asan {
+
+namespace {
+
+// The standard check value of the CRC32C, over the ASCII digits 1 to 9.
+const char kCheckData[] = "123456789";
+const uint32_t kCheckValue = 0xE3069283;
+
+}  // namespace
+
+TEST(Crc32cTest, Software) {
+  EXPECT_EQ(0u, Crc32cSoftware(0, nullptr, 0));
+  EXPECT_EQ(kCheckValue, Crc32cSoftware(0, kCheckData, 9));
+}
+
+TEST(Crc32cTest, Hardware) {
+  if (!Crc32cIsHardwareAccelerated())
+    return;
+  EXPECT_EQ(0u, Crc32cHardware(0, nullptr, 0));
+  EXPECT_EQ(kCheckValue, Crc32cHardware(0, kCheckData, 9));
+}
+
+TEST(Crc32cTest, Incremental) {
+  for (size_t i = 0; i <= 9; ++i) {
+    uint32_t crc = Crc32c(0, kCheckData, i);
+    EXPECT_EQ(kCheckValue, Crc32c(crc, kCheckData + i, 9 - i));
+  }
+}
+
+TEST(Crc32cTest, ImplementationsAgree) {
+  if (!Crc32cIsHardwareAccelerated())
+    return;
+
+  uint8_t buffer[257] = {};
+  base::RandBytes(buffer, sizeof(buffer));
+  for (size_t begin = 0; begin < 16; ++begin) {
+    for (size_t end = begin; end < sizeof(buffer); ++end) {
+      ASSERT_EQ(Crc32cSoftware(begin, buffer + begin, end - begin),
+                Crc32cHardware(begin, buffer + begin, end - begin));
+    }
+  }
+}
+
+}  // namespace asan
+}  // namespace agent
@@ -17,8 +17,10 @@
 #include <windows.h>
 
 #include "base/bind.h"
+#include "base/strings/stringprintf.h"
 #include "gtest/gtest.h"
 #include "syzygy/agent/asan/unittest_util.h"
+#include "syzygy/testing/metrics.h"
 
 namespace agent {
 namespace asan {
@@ -652,5 +654,55 @@ TEST_F(CrtInterceptorsTest, AsanCheckStrncat) {
   ResetLog();
 }
 
+TEST_F(CrtInterceptorsTest, RangeInterceptorsPerfTest) {
+  // The sizes for which the overhead of the interceptors is measured. The
+  // ranges of up to 128 bytes and the longer ones are checked differently.
+  static const size_t kSizes[] = { 1, 8, 16, 32, 64, 128, 256, 4096, 65536 };
+  static const size_t kMaxSize = 65536;
+  static const size_t kIterations = 100;
+
+  ScopedAsanAlloc<uint8_t> src(this, kMaxSize);
+  ASSERT_TRUE(src.get() != NULL);
+  ScopedAsanAlloc<uint8_t> dst(this, kMaxSize);
+  ASSERT_TRUE(dst.get() != NULL);
+  ::memset(src.get(), 'a', kMaxSize);
+
+  for (size_t size : kSizes) {
+    uint64_t tmemcpy = 0;
+    uint64_t tmemset = 0;
+    uint64_t tmemchr = 0;
+    uint64_t tstrlen = 0;
+
+    // Terminate the string so that strlen goes over the whole range.
+    src[size - 1] = 0;
+    for (size_t i = 0; i < kIterations; ++i) {
+      uint64_t t0 = ::__rdtsc();
+      memcpyFunction(dst.get(), src.get(), size);
+      uint64_t t1 = ::__rdtsc();
+      memsetFunction(dst.get(), 0, size);
+      uint64_t t2 = ::__rdtsc();
+      EXPECT_EQ(NULL, memchrFunction(src.get(), 'b', size));
+      uint64_t t3 = ::__rdtsc();
+      EXPECT_EQ(size - 1, strlenFunction(src.GetAs<const char>()));
+      uint64_t t4 = ::__rdtsc();
+
+      tmemcpy += t1 - t0;
+      tmemset += t2 - t1;
+      tmemchr += t3 - t2;
+      tstrlen += t4 - t3;
+    }
+    src[size - 1] = 'a';
+
+    testing::EmitMetric(base::StringPrintf(
+        "Syzygy.Asan.CrtInterceptors.memcpy.%i", size), tmemcpy);
+    testing::EmitMetric(base::StringPrintf(
+        "Syzygy.Asan.CrtInterceptors.memset.%i", size), tmemset);
+    testing::EmitMetric(base::StringPrintf(
+        "Syzygy.Asan.CrtInterceptors.memchr.%i", size), tmemchr);
+    testing::EmitMetric(base::StringPrintf(
+        "Syzygy.Asan.CrtInterceptors.strlen.%i", size), tstrlen);
+  }
+}
+
 }  // namespace asan
 }  // namespace agent
@@ -661,7 +661,7 @@ void PopulateAsanParameters(const AsanErrorInfo& error_info,
 
   // Any new parameter added to the parameters structure should also be added
   // here.
-  static_assert(15 == ::common::kAsanParametersVersion,
+  static_assert(19 == ::common::kAsanParametersVersion,
                 "Pointers in the params must be linked up here.");
   crashdata::Dictionary* param_dict = crashdata::DictAddDict("asan-parameters",
                                                              dict);
@@ -701,6 +701,18 @@ void PopulateAsanParameters(const AsanErrorInfo& error_info,
   crashdata::LeafSetReal(
       error_info.asan_parameters.quarantine_flood_fill_rate,
       crashdata::DictAddLeaf("quarantine-flood-fill-rate", param_dict));
+  crashdata::LeafSetUInt(error_info.asan_parameters.enable_thread_caches,
+                         crashdata::DictAddLeaf("enable-thread-caches",
+                                                param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.quarantine_checksum_strategy,
+      crashdata::DictAddLeaf("quarantine-checksum-strategy", param_dict));
+  crashdata::LeafSetUInt(error_info.asan_parameters.stats_reporting_period,
+                         crashdata::DictAddLeaf("stats-reporting-period",
+                                                param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.background_heap_check_period,
+      crashdata::DictAddLeaf("background-heap-check-period", param_dict));
 }
 
 }  // namespace
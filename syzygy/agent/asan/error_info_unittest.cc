@@ -749,7 +749,11 @@ TEST_F(AsanErrorInfoTest, PopulateErrorInfo) {
       "    \"zebra-block-heap-size\": 16777216,\n"
       "    \"zebra-block-heap-quarantine-ratio\": 2.5000000000000000E-01,\n"
       "    \"large-allocation-threshold\": 20480,\n"
-      "    \"quarantine-flood-fill-rate\": 5.0000000000000000E-01\n"
+      "    \"quarantine-flood-fill-rate\": 5.0000000000000000E-01,\n"
+      "    \"enable-thread-caches\": 0,\n"
+      "    \"quarantine-checksum-strategy\": 0,\n"
+      "    \"stats-reporting-period\": 0,\n"
+      "    \"background-heap-check-period\": 0\n"
       "  }\n"
       "}";
   AsanErrorShadowMemory shadow_memory = {};
@@ -898,7 +902,11 @@ TEST_F(AsanErrorInfoTest, PopulateErrorInfoWithMemoryRanges) {
       "    \"zebra-block-heap-size\": 16777216,\n"
       "    \"zebra-block-heap-quarantine-ratio\": 2.5000000000000000E-01,\n"
       "    \"large-allocation-threshold\": 20480,\n"
-      "    \"quarantine-flood-fill-rate\": 5.0000000000000000E-01\n"
+      "    \"quarantine-flood-fill-rate\": 5.0000000000000000E-01,\n"
+      "    \"enable-thread-caches\": 0,\n"
+      "    \"quarantine-checksum-strategy\": 0,\n"
+      "    \"stats-reporting-period\": 0,\n"
+      "    \"background-heap-check-period\": 0\n"
       "  }\n"
       "}";
   AsanErrorShadowMemory shadow_memory = {};
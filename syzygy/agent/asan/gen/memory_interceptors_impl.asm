@@ -33,11 +33,13 @@ EXTERN C asan_check_strings_memory_accesses:PROC
 EXTERN C asan_redirect_stub_entry:PROC
 EXTERN C asan_redirect_clang_stub_entry:PROC
 
-; Declare the error handling funtion.
+; Declare the error handling functions.
 EXTERN C asan_report_bad_memory_access:PROC
+EXTERN C asan_report_bad_range_access:PROC
 
 ; Declares the symbols that this compiland exports.
 PUBLIC asan_no_check
+PUBLIC asan_range_no_check
 PUBLIC asan_string_no_check
 PUBLIC asan_redirect_tail
 PUBLIC asan_redirect_tail_clang
@@ -122,6 +124,14 @@ PUBLIC asan_check_repz_1_byte_stos_access  ; Probe #76.
 PUBLIC asan_check_4_byte_stos_access  ; Probe #77.
 PUBLIC asan_check_2_byte_stos_access  ; Probe #78.
 PUBLIC asan_check_1_byte_stos_access  ; Probe #79.
+PUBLIC asan_check_range_read_access_2gb  ; Probe #80.
+PUBLIC asan_check_range_write_access_2gb  ; Probe #81.
+PUBLIC asan_check_range_read_access_no_flags_2gb  ; Probe #82.
+PUBLIC asan_check_range_write_access_no_flags_2gb  ; Probe #83.
+PUBLIC asan_check_range_read_access_4gb  ; Probe #84.
+PUBLIC asan_check_range_write_access_4gb  ; Probe #85.
+PUBLIC asan_check_range_read_access_no_flags_4gb  ; Probe #86.
+PUBLIC asan_check_range_write_access_no_flags_4gb  ; Probe #87.
 
 ; Create a new text segment to house the memory interceptors.
 .probes SEGMENT PAGE PUBLIC READ EXECUTE 'CODE'
@@ -138,6 +148,17 @@ asan_no_check PROC
   ret 4
 asan_no_check ENDP
 
+; On entry, the first address of the range to check is in EDX, and the stack
+; has the size of the range followed by the previous contents of EDX. On exit
+; both have been popped off the stack and EDX has been restored.
+ALIGN 16
+asan_range_no_check PROC
+  ; Restore EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ; And return.
+  ret 8
+asan_range_no_check ENDP
+
 ; No state is saved for string instructions.
 ALIGN 16
 asan_string_no_check PROC
@@ -5102,6 +5123,698 @@ skip_neg_direction_79 LABEL NEAR
   ret
 asan_check_1_byte_stos_access ENDP
 
+; On entry, the first address of the range to check is in EDX, and the stack
+; has the size of the range followed by the previous contents of EDX. On exit
+; both have been popped off the stack and EDX has been restored. This function
+; modifies no other registers, in particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_read_access_2gb PROC  ; Probe #80.
+  ; Save the EFLAGS.
+  push eax
+  lahf
+  seto al
+  push ebx
+  push ecx
+  push edx
+  ; Compute the address of the last byte of the range in ECX.
+  mov ecx, edx
+  add ecx, DWORD PTR[esp + 20]
+  dec ecx
+  ; Convert the first and the last addresses of the range to shadow indices.
+  ; The check fails if any of them is above the 2GB threshold.
+  sar edx, 3
+  js report_failure_80
+  sar ecx, 3
+  js report_failure_80
+check_range_loop_80 LABEL NEAR
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+  ; This is a label to the previous shadow memory reference. It will be
+  ; referenced by the table at the end of the 'asan_probes' procedure.
+shadow_reference_56 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_80
+  ; The shadow bytes before the last one must be fully accessible.
+  test bl, bl
+  jnz report_failure_80
+  inc edx
+  jmp check_range_loop_80
+check_range_last_80 LABEL NEAR
+  test bl, bl
+  jz check_range_done_80
+  js report_failure_80
+  ; The last shadow byte is partially accessible, check that the last byte of
+  ; the range is in its accessible prefix.
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 20]
+  dec ecx
+  and ecx, 7
+  cmp ecx, ebx
+  jae report_failure_80
+check_range_done_80 LABEL NEAR
+  ; Remove the memory location from the stack and restore the registers.
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 12]
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ret 8
+report_failure_80 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 0
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove the size and the memory location from the stack.
+  ret 8
+asan_check_range_read_access_2gb ENDP
+
+; On entry, the first address of the range to check is in EDX, and the stack
+; has the size of the range followed by the previous contents of EDX. On exit
+; both have been popped off the stack and EDX has been restored. This function
+; modifies no other registers, in particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_write_access_2gb PROC  ; Probe #81.
+  ; Save the EFLAGS.
+  push eax
+  lahf
+  seto al
+  push ebx
+  push ecx
+  push edx
+  ; Compute the address of the last byte of the range in ECX.
+  mov ecx, edx
+  add ecx, DWORD PTR[esp + 20]
+  dec ecx
+  ; Convert the first and the last addresses of the range to shadow indices.
+  ; The check fails if any of them is above the 2GB threshold.
+  sar edx, 3
+  js report_failure_81
+  sar ecx, 3
+  js report_failure_81
+check_range_loop_81 LABEL NEAR
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+  ; This is a label to the previous shadow memory reference. It will be
+  ; referenced by the table at the end of the 'asan_probes' procedure.
+shadow_reference_57 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_81
+  ; The shadow bytes before the last one must be fully accessible.
+  test bl, bl
+  jnz report_failure_81
+  inc edx
+  jmp check_range_loop_81
+check_range_last_81 LABEL NEAR
+  test bl, bl
+  jz check_range_done_81
+  js report_failure_81
+  ; The last shadow byte is partially accessible, check that the last byte of
+  ; the range is in its accessible prefix.
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 20]
+  dec ecx
+  and ecx, 7
+  cmp ecx, ebx
+  jae report_failure_81
+check_range_done_81 LABEL NEAR
+  ; Remove the memory location from the stack and restore the registers.
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 12]
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ret 8
+report_failure_81 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 1
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove the size and the memory location from the stack.
+  ret 8
+asan_check_range_write_access_2gb ENDP
+
+; On entry, the first address of the range to check is in EDX, and the stack
+; has the size of the range followed by the previous contents of EDX. On exit
+; both have been popped off the stack and EDX has been restored. This function
+; may modify EFLAGS, but preserves all other registers.
+ALIGN 16
+asan_check_range_read_access_no_flags_2gb PROC  ; Probe #82.
+  push ebx
+  push ecx
+  push edx
+  ; Compute the address of the last byte of the range in ECX.
+  mov ecx, edx
+  add ecx, DWORD PTR[esp + 16]
+  dec ecx
+  ; Convert the first and the last addresses of the range to shadow indices.
+  ; The check fails if any of them is above the 2GB threshold.
+  sar edx, 3
+  js report_failure_82
+  sar ecx, 3
+  js report_failure_82
+check_range_loop_82 LABEL NEAR
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+  ; This is a label to the previous shadow memory reference. It will be
+  ; referenced by the table at the end of the 'asan_probes' procedure.
+shadow_reference_58 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_82
+  ; The shadow bytes before the last one must be fully accessible.
+  test bl, bl
+  jnz report_failure_82
+  inc edx
+  jmp check_range_loop_82
+check_range_last_82 LABEL NEAR
+  test bl, bl
+  jz check_range_done_82
+  js report_failure_82
+  ; The last shadow byte is partially accessible, check that the last byte of
+  ; the range is in its accessible prefix.
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 16]
+  dec ecx
+  and ecx, 7
+  cmp ecx, ebx
+  jae report_failure_82
+check_range_done_82 LABEL NEAR
+  ; Remove the memory location from the stack and restore the registers.
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_82 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 0
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove the size and the memory location from the stack.
+  ret 8
+asan_check_range_read_access_no_flags_2gb ENDP
+
+; On entry, the first address of the range to check is in EDX, and the stack
+; has the size of the range followed by the previous contents of EDX. On exit
+; both have been popped off the stack and EDX has been restored. This function
+; may modify EFLAGS, but preserves all other registers.
+ALIGN 16
+asan_check_range_write_access_no_flags_2gb PROC  ; Probe #83.
+  push ebx
+  push ecx
+  push edx
+  ; Compute the address of the last byte of the range in ECX.
+  mov ecx, edx
+  add ecx, DWORD PTR[esp + 16]
+  dec ecx
+  ; Convert the first and the last addresses of the range to shadow indices.
+  ; The check fails if any of them is above the 2GB threshold.
+  sar edx, 3
+  js report_failure_83
+  sar ecx, 3
+  js report_failure_83
+check_range_loop_83 LABEL NEAR
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+  ; This is a label to the previous shadow memory reference. It will be
+  ; referenced by the table at the end of the 'asan_probes' procedure.
+shadow_reference_59 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_83
+  ; The shadow bytes before the last one must be fully accessible.
+  test bl, bl
+  jnz report_failure_83
+  inc edx
+  jmp check_range_loop_83
+check_range_last_83 LABEL NEAR
+  test bl, bl
+  jz check_range_done_83
+  js report_failure_83
+  ; The last shadow byte is partially accessible, check that the last byte of
+  ; the range is in its accessible prefix.
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 16]
+  dec ecx
+  and ecx, 7
+  cmp ecx, ebx
+  jae report_failure_83
+check_range_done_83 LABEL NEAR
+  ; Remove the memory location from the stack and restore the registers.
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_83 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 1
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove the size and the memory location from the stack.
+  ret 8
+asan_check_range_write_access_no_flags_2gb ENDP
+
+; On entry, the first address of the range to check is in EDX, and the stack
+; has the size of the range followed by the previous contents of EDX. On exit
+; both have been popped off the stack and EDX has been restored. This function
+; modifies no other registers, in particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_read_access_4gb PROC  ; Probe #84.
+  ; Save the EFLAGS.
+  push eax
+  lahf
+  seto al
+  push ebx
+  push ecx
+  push edx
+  ; Compute the address of the last byte of the range in ECX.
+  mov ecx, edx
+  add ecx, DWORD PTR[esp + 20]
+  dec ecx
+  ; Convert the first and the last addresses of the range to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_84 LABEL NEAR
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+  ; This is a label to the previous shadow memory reference. It will be
+  ; referenced by the table at the end of the 'asan_probes' procedure.
+shadow_reference_60 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_84
+  ; The shadow bytes before the last one must be fully accessible.
+  test bl, bl
+  jnz report_failure_84
+  inc edx
+  jmp check_range_loop_84
+check_range_last_84 LABEL NEAR
+  test bl, bl
+  jz check_range_done_84
+  js report_failure_84
+  ; The last shadow byte is partially accessible, check that the last byte of
+  ; the range is in its accessible prefix.
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 20]
+  dec ecx
+  and ecx, 7
+  cmp ecx, ebx
+  jae report_failure_84
+check_range_done_84 LABEL NEAR
+  ; Remove the memory location from the stack and restore the registers.
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 12]
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ret 8
+report_failure_84 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 0
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove the size and the memory location from the stack.
+  ret 8
+asan_check_range_read_access_4gb ENDP
+
+; On entry, the first address of the range to check is in EDX, and the stack
+; has the size of the range followed by the previous contents of EDX. On exit
+; both have been popped off the stack and EDX has been restored. This function
+; modifies no other registers, in particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_write_access_4gb PROC  ; Probe #85.
+  ; Save the EFLAGS.
+  push eax
+  lahf
+  seto al
+  push ebx
+  push ecx
+  push edx
+  ; Compute the address of the last byte of the range in ECX.
+  mov ecx, edx
+  add ecx, DWORD PTR[esp + 20]
+  dec ecx
+  ; Convert the first and the last addresses of the range to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_85 LABEL NEAR
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+  ; This is a label to the previous shadow memory reference. It will be
+  ; referenced by the table at the end of the 'asan_probes' procedure.
+shadow_reference_61 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_85
+  ; The shadow bytes before the last one must be fully accessible.
+  test bl, bl
+  jnz report_failure_85
+  inc edx
+  jmp check_range_loop_85
+check_range_last_85 LABEL NEAR
+  test bl, bl
+  jz check_range_done_85
+  js report_failure_85
+  ; The last shadow byte is partially accessible, check that the last byte of
+  ; the range is in its accessible prefix.
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 20]
+  dec ecx
+  and ecx, 7
+  cmp ecx, ebx
+  jae report_failure_85
+check_range_done_85 LABEL NEAR
+  ; Remove the memory location from the stack and restore the registers.
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 12]
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ret 8
+report_failure_85 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore the EFLAGS.
+  add al, 7Fh
+  sahf
+  pop eax
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 1
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove the size and the memory location from the stack.
+  ret 8
+asan_check_range_write_access_4gb ENDP
+
+; On entry, the first address of the range to check is in EDX, and the stack
+; has the size of the range followed by the previous contents of EDX. On exit
+; both have been popped off the stack and EDX has been restored. This function
+; may modify EFLAGS, but preserves all other registers.
+ALIGN 16
+asan_check_range_read_access_no_flags_4gb PROC  ; Probe #86.
+  push ebx
+  push ecx
+  push edx
+  ; Compute the address of the last byte of the range in ECX.
+  mov ecx, edx
+  add ecx, DWORD PTR[esp + 16]
+  dec ecx
+  ; Convert the first and the last addresses of the range to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_86 LABEL NEAR
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+  ; This is a label to the previous shadow memory reference. It will be
+  ; referenced by the table at the end of the 'asan_probes' procedure.
+shadow_reference_62 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_86
+  ; The shadow bytes before the last one must be fully accessible.
+  test bl, bl
+  jnz report_failure_86
+  inc edx
+  jmp check_range_loop_86
+check_range_last_86 LABEL NEAR
+  test bl, bl
+  jz check_range_done_86
+  js report_failure_86
+  ; The last shadow byte is partially accessible, check that the last byte of
+  ; the range is in its accessible prefix.
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 16]
+  dec ecx
+  and ecx, 7
+  cmp ecx, ebx
+  jae report_failure_86
+check_range_done_86 LABEL NEAR
+  ; Remove the memory location from the stack and restore the registers.
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_86 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 0
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove the size and the memory location from the stack.
+  ret 8
+asan_check_range_read_access_no_flags_4gb ENDP
+
+; On entry, the first address of the range to check is in EDX, and the stack
+; has the size of the range followed by the previous contents of EDX. On exit
+; both have been popped off the stack and EDX has been restored. This function
+; may modify EFLAGS, but preserves all other registers.
+ALIGN 16
+asan_check_range_write_access_no_flags_4gb PROC  ; Probe #87.
+  push ebx
+  push ecx
+  push edx
+  ; Compute the address of the last byte of the range in ECX.
+  mov ecx, edx
+  add ecx, DWORD PTR[esp + 16]
+  dec ecx
+  ; Convert the first and the last addresses of the range to shadow indices.
+  shr edx, 3
+  shr ecx, 3
+check_range_loop_87 LABEL NEAR
+  movzx ebx, BYTE PTR[edx + asan_memory_interceptors_shadow_memory]
+  ; This is a label to the previous shadow memory reference. It will be
+  ; referenced by the table at the end of the 'asan_probes' procedure.
+shadow_reference_63 LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_87
+  ; The shadow bytes before the last one must be fully accessible.
+  test bl, bl
+  jnz report_failure_87
+  inc edx
+  jmp check_range_loop_87
+check_range_last_87 LABEL NEAR
+  test bl, bl
+  jz check_range_done_87
+  js report_failure_87
+  ; The last shadow byte is partially accessible, check that the last byte of
+  ; the range is in its accessible prefix.
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + 16]
+  dec ecx
+  and ecx, 7
+  cmp ecx, ebx
+  jae report_failure_87
+check_range_done_87 LABEL NEAR
+  ; Remove the memory location from the stack and restore the registers.
+  add esp, 4
+  pop ecx
+  pop ebx
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_87 LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push 1
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove the size and the memory location from the stack.
+  ret 8
+asan_check_range_write_access_no_flags_4gb ENDP
+
 .probes ENDS
 
 ; Start writing to the read-only .rdata segment.
@@ -5168,6 +5881,14 @@ asan_shadow_references LABEL FAR
   DWORD shadow_reference_53 - 4
   DWORD shadow_reference_54 - 4
   DWORD shadow_reference_55 - 4
+  DWORD shadow_reference_56 - 4
+  DWORD shadow_reference_57 - 4
+  DWORD shadow_reference_58 - 4
+  DWORD shadow_reference_59 - 4
+  DWORD shadow_reference_60 - 4
+  DWORD shadow_reference_61 - 4
+  DWORD shadow_reference_62 - 4
+  DWORD shadow_reference_63 - 4
   DWORD 0
 
 .rdata ENDS
@@ -103,11 +103,13 @@ EXTERN C asan_check_strings_memory_accesses:PROC
 EXTERN C asan_redirect_stub_entry:PROC
 EXTERN C asan_redirect_clang_stub_entry:PROC
 
-; Declare the error handling funtion.
+; Declare the error handling functions.
 EXTERN C asan_report_bad_memory_access:PROC
+EXTERN C asan_report_bad_range_access:PROC
 
 ; Declares the symbols that this compiland exports.
 PUBLIC asan_no_check
+PUBLIC asan_range_no_check
 PUBLIC asan_string_no_check
 PUBLIC asan_redirect_tail
 PUBLIC asan_redirect_tail_clang
@@ -164,6 +166,17 @@ asan_no_check PROC
   ret 4
 asan_no_check ENDP
 
+; On entry, the first address of the range to check is in EDX, and the stack
+; has the size of the range followed by the previous contents of EDX. On exit
+; both have been popped off the stack and EDX has been restored.
+ALIGN 16
+asan_range_no_check PROC
+  ; Restore EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ; And return.
+  ret 8
+asan_range_no_check ENDP
+
 ; No state is saved for string instructions.
 ALIGN 16
 asan_string_no_check PROC
@@ -286,6 +299,21 @@ _4GB_CHECK = """\
   shr edx, 3"""
 
 
+_2GB_RANGE_CHECK = """\
+  ; Convert the first and the last addresses of the range to shadow indices.
+  ; The check fails if any of them is above the 2GB threshold.
+  sar edx, 3
+  js report_failure_{probe_index}
+  sar ecx, 3
+  js report_failure_{probe_index}"""
+
+
+_4GB_RANGE_CHECK = """\
+  ; Convert the first and the last addresses of the range to shadow indices.
+  shr edx, 3
+  shr ecx, 3"""
+
+
 # The common part of the fast path shared between the different
 # implementations of the hooks.
 #
@@ -364,6 +392,84 @@ _ERROR_PATH ="""\
   ret 4"""
 
 
+# The fast path of the range probes.
+#
+# Checks all the shadow bytes covering the range [EDX, EDX + size). Every
+# shadow byte but the last one must be zero, and the last byte of the range
+# must be accessible according to the last shadow byte. This expects the
+# previous values of EBX and ECX to be saved on the stack, and the memory
+# location to be at [ESP]. The size of the range is at [ESP + {size_offset}].
+# Jumps to the error path if any byte of the range isn't accessible.
+_RANGE_FAST_PATH = """\
+  ; Compute the address of the last byte of the range in ECX.
+  mov ecx, edx
+  add ecx, DWORD PTR[esp + {size_offset}]
+  dec ecx
+  {range_check}
+check_range_loop_{probe_index} LABEL NEAR
+  movzx ebx, BYTE PTR[edx + {shadow}]
+  ; This is a label to the previous shadow memory reference. It will be
+  ; referenced by the table at the end of the 'asan_probes' procedure.
+shadow_reference_{shadow_index!s} LABEL NEAR
+  cmp edx, ecx
+  jae check_range_last_{probe_index}
+  ; The shadow bytes before the last one must be fully accessible.
+  test bl, bl
+  jnz report_failure_{probe_index}
+  inc edx
+  jmp check_range_loop_{probe_index}
+check_range_last_{probe_index} LABEL NEAR
+  test bl, bl
+  jz check_range_done_{probe_index}
+  js report_failure_{probe_index}
+  ; The last shadow byte is partially accessible, check that the last byte of
+  ; the range is in its accessible prefix.
+  mov ecx, DWORD PTR[esp]
+  add ecx, DWORD PTR[esp + {size_offset}]
+  dec ecx
+  and ecx, 7
+  cmp ecx, ebx
+  jae report_failure_{probe_index}
+check_range_done_{probe_index} LABEL NEAR
+  ; Remove the memory location from the stack and restore the registers.
+  add esp, 4
+  pop ecx
+  pop ebx"""
+
+
+# The error path of the range probes.
+#
+# It expects to have the previous value of EDX at [ESP + 8], the size of the
+# range at [ESP + 4] and the address of the faulty instruction at [ESP]. The
+# memory location is expected in EDX. The reporting function locates the first
+# bad byte of the range.
+_RANGE_ERROR_PATH ="""\
+  ; Restore original value of EDX, and put memory location on stack.
+  xchg edx, DWORD PTR[esp + 8]
+  ; Create an Asan registers context on the stack.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / size / Original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Push ARG4: the address of Asan context on stack.
+  push esp
+  ; Push ARG3: the size of the range.
+  push DWORD PTR[esp + 44]
+  ; Push ARG2: the access type.
+  push {access_mode_value}
+  ; Push ARG1: the memory location.
+  push DWORD PTR[esp + 56]
+  call asan_report_bad_range_access
+  ; Remove 4 x ARG on stack.
+  add esp, 16
+  ; Restore original registers.
+  popad
+  popfd
+  ; Return and remove the size and the memory location from the stack.
+  ret 8"""
+
+
 # Collects the above macros and bundles them up in a dictionary so they can be
 # easily expanded by the string format functions.
 _MACROS = {
@@ -372,6 +478,8 @@ _MACROS = {
   "AsanFastPath": _FAST_PATH,
   "AsanSlowPath": _SLOW_PATH,
   "AsanErrorPath": _ERROR_PATH,
+  "AsanRangeFastPath": _RANGE_FAST_PATH,
+  "AsanRangeErrorPath": _RANGE_ERROR_PATH,
 }
 
 
@@ -595,6 +703,114 @@ _STRING_REDIRECT_FUNCTION_DECL = """\
 PUBLIC asan_redirect{prefix}{access_size}_byte_{func}_access"""
 
 
+# Generates the Asan range check access functions. These check a range of
+# memory spanned by several accesses, e.g. the fields of a structure accessed
+# through the same base register.
+#
+# The name of the generated method will be
+# asan_check_range_(@p access_mode_str)_(@p mem_model)().
+#
+# Args:
+#   access_mode_str: The string representing the access mode (read_access
+#       or write_access).
+#   access_mode_value: The internal value representing this kind of
+#       access.
+#   probe_index: The index of the probe function. Used to mangle internal labels
+#       so that they are unique to this probes implementation.
+_CHECK_RANGE_FUNCTION = """\
+; On entry, the first address of the range to check is in EDX, and the stack
+; has the size of the range followed by the previous contents of EDX. On exit
+; both have been popped off the stack and EDX has been restored. This function
+; modifies no other registers, in particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_{access_mode_str}_{mem_model} PROC  ; Probe #{probe_index}.
+  {AsanSaveEflags}
+  push ebx
+  push ecx
+  push edx
+  {AsanRangeFastPath}
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 12]
+  {AsanRestoreEflags}
+  ret 8
+report_failure_{probe_index} LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  {AsanRestoreEflags}
+  {AsanRangeErrorPath}
+asan_check_range_{access_mode_str}_{mem_model} ENDP
+"""
+
+
+# Declare the range check access function public label.
+_CHECK_RANGE_FUNCTION_DECL = """\
+PUBLIC asan_check_range_{access_mode_str}_{mem_model}  ; Probe #{probe_index}."""
+
+
+# Generates a variant of the Asan range check access functions that don't save
+# the flags.
+#
+# The name of the generated method will be
+# asan_check_range_(@p access_mode_str)_no_flags_(@p mem_model)().
+#
+# Args:
+#   access_mode_str: The string representing the access mode (read_access
+#       or write_access).
+#   access_mode_value: The internal value representing this kind of access.
+#   probe_index: The index of the probe function. Used to mangle internal labels
+#       so that they are unique to this probes implementation.
+# Note: Calling this function may alter the EFLAGS register only.
+_CHECK_RANGE_FUNCTION_NO_FLAGS = """\
+; On entry, the first address of the range to check is in EDX, and the stack
+; has the size of the range followed by the previous contents of EDX. On exit
+; both have been popped off the stack and EDX has been restored. This function
+; may modify EFLAGS, but preserves all other registers.
+ALIGN 16
+asan_check_range_{access_mode_str}_no_flags_{mem_model} PROC  \
+; Probe #{probe_index}.
+  push ebx
+  push ecx
+  push edx
+  {AsanRangeFastPath}
+  ; Restore original EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ret 8
+report_failure_{probe_index} LABEL NEAR
+  ; Restore memory location in EDX.
+  pop edx
+  pop ecx
+  pop ebx
+  {AsanRangeErrorPath}
+asan_check_range_{access_mode_str}_no_flags_{mem_model} ENDP
+"""
+
+
+# Declare the range check access function public label.
+_CHECK_RANGE_FUNCTION_NO_FLAGS_DECL = """\
+PUBLIC asan_check_range_{access_mode_str}_no_flags_{mem_model}  \
+; Probe #{probe_index}."""
+
+
+# Generates the Asan range accessor redirector stubs.
+#
+# The name of the generated method will be
+# asan_redirect_range_(@p access_mode_str)(@p suffix)().
+#
+# Args:
+#   access_mode_str: The string representing the access mode (read_access
+#       or write_access).
+#   suffix: The suffix - if any - for this function name
+_RANGE_REDIRECT_FUNCTION = """\
+asan_redirect_range_{access_mode_str}{suffix} LABEL PROC
+  call asan_redirect_tail"""
+
+# Declare the public label.
+_RANGE_REDIRECT_FUNCTION_DECL = """\
+PUBLIC asan_redirect_range_{access_mode_str}{suffix}"""
+
+
 class MacroAssembler(string.Formatter):
   """A formatter specialization to inject the AsanXXX macros and make
   them easier to use."""
@@ -649,6 +865,14 @@ _MEMORY_MODELS = [
 ]
 
 
+# Memory models for the generated range accessors, and the associated address
+# range checks to insert.
+_RANGE_MEMORY_MODELS = [
+    ('2gb', _2GB_RANGE_CHECK.lstrip()),
+    ('4gb', _4GB_RANGE_CHECK.lstrip()),
+]
+
+
 # The string accessors generated.
 _STRING_ACCESSORS = [
     ("cmps", "_repz_", "ecx", _ASAN_READ_ACCESS, _ASAN_READ_ACCESS, 4, 1),
@@ -746,6 +970,40 @@ def _IterateOverInterceptors(parts,
   return (probe_index, shadow_index.count())
 
 
+def _IterateOverRangeInterceptors(parts,
+                                  formatter,
+                                  format,
+                                  format_no_flags,
+                                  probe_index=0,
+                                  shadow_index=0):
+  """Helper for _GenerateInterceptorsAsmFile."""
+  f = formatter
+
+  # See _IterateOverInterceptors for the use of this counter.
+  shadow_index = ToStringCounter(shadow_index)
+
+  # The offset of the size of the range relative to ESP once the registers
+  # have been saved by the probes. The variants saving the flags also have EAX
+  # on the stack.
+  for mem_model, range_check in _RANGE_MEMORY_MODELS:
+    for fmt, size_offset in ((format, 20), (format_no_flags, 16)):
+      for access, access_name in _ACCESS_MODES:
+        formatted_range_check = f.format(range_check, probe_index=probe_index)
+        parts.append(f.format(fmt,
+                              access_mode_str=access,
+                              access_mode_value=access_name,
+                              mem_model=mem_model,
+                              probe_index=probe_index,
+                              range_check=formatted_range_check,
+                              shadow=_SHADOW,
+                              shadow_index=shadow_index,
+                              size_offset=size_offset))
+        probe_index += 1
+
+  # Return the probe and shadow memory reference counts.
+  return (probe_index, shadow_index.count())
+
+
 def _IterateOverStringInterceptors(parts, formatter, format, probe_index=0):
   """Helper for _GenerateInterceptorsAsmFile."""
   for (fn, p, c, dst_mode, src_mode, size, compare) in _STRING_ACCESSORS:
@@ -781,6 +1039,9 @@ def _GenerateInterceptorsAsmFile():
       probe_index=probe_index, shadow_index=shadow_index)
   probe_index = _IterateOverStringInterceptors(parts, f, _CHECK_STRINGS_DECL,
       probe_index=probe_index)
+  (probe_index, shadow_index) = _IterateOverRangeInterceptors(parts, f,
+      _CHECK_RANGE_FUNCTION_DECL, _CHECK_RANGE_FUNCTION_NO_FLAGS_DECL,
+      probe_index=probe_index, shadow_index=shadow_index)
   parts.append('')
 
   # Place all of the probe functions in a custom segment.
@@ -810,6 +1071,11 @@ def _GenerateInterceptorsAsmFile():
   probe_index = _IterateOverStringInterceptors(parts, f, _CHECK_STRINGS,
       probe_index=probe_index)
 
+  # Generate the range accessors.
+  (probe_index, shadow_index) = _IterateOverRangeInterceptors(parts, f,
+      _CHECK_RANGE_FUNCTION, _CHECK_RANGE_FUNCTION_NO_FLAGS,
+      probe_index=probe_index, shadow_index=shadow_index)
+
   # Close the custom segment housing the probges.
   parts.append(f.format(_INTERCEPTORS_SEGMENT_FOOTER))
 
@@ -863,6 +1129,13 @@ def _GenerateRedirectorsAsmFile(target_cpu):
                             access_size=size,
                             compare=compare))
 
+    # Declare the range redirectors.
+    for suffix in ("", "_no_flags"):
+      for access, access_name in _ACCESS_MODES:
+        parts.append(f.format(_RANGE_REDIRECT_FUNCTION_DECL,
+                              access_mode_str=access,
+                              suffix=suffix))
+
   # Generate the Clang-Asan probes
   for access_size in _ACCESS_SIZES:
     for access, access_name in _CLANG_ACCESS_MODES:
@@ -894,6 +1167,13 @@ def _GenerateRedirectorsAsmFile(target_cpu):
                             access_size=size,
                             compare=compare))
 
+    # Generate the range redirectors.
+    for suffix in ("", "_no_flags"):
+      for access, access_name in _ACCESS_MODES:
+        parts.append(f.format(_RANGE_REDIRECT_FUNCTION,
+                              access_mode_str=access,
+                              suffix=suffix))
+
   # Generate the Clang-Asan accessor redirectors
   for access_size in _ACCESS_SIZES:
     for access, access_name in _CLANG_ACCESS_MODES:
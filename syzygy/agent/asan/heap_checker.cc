@@ -14,49 +14,119 @@
 
 #include "syzygy/agent/asan/heap_checker.h"
 
+#include <windows.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "base/memory/ref_counted.h"
+#include "syzygy/agent/asan/heap_manager.h"
 #include "syzygy/agent/asan/page_protection_helpers.h"
 #include "syzygy/agent/asan/runtime.h"
 #include "syzygy/agent/asan/shadow.h"
+#include "syzygy/common/align.h"
 
 namespace agent {
 namespace asan {
 
-HeapChecker::HeapChecker(Shadow* shadow)
-    : shadow_(shadow) {
-  DCHECK_NE(static_cast<Shadow*>(nullptr), shadow);
-}
+namespace {
 
-bool HeapChecker::IsHeapCorrupt(CorruptRangesVector* corrupt_ranges) {
-  DCHECK_NE(static_cast<CorruptRangesVector*>(nullptr), corrupt_ranges);
+// The chunks of memory checked in parallel are aligned to the allocation
+// granularity, as the heaps never straddle it.
+const uint64_t kChunkAlignment = 64 * 1024;
 
-  corrupt_ranges->clear();
+const uint8_t* ToPointer(uint64_t address) {
+  // This truncates the end of the memory of 4GB 32-bit processes to 0, which
+  // the ShadowWalker interprets as the end of all memory.
+  return reinterpret_cast<const uint8_t*>(static_cast<uintptr_t>(address));
+}
 
-  // Grab the page protection lock. This prevents multiple heap checkers from
-  // running simultaneously, and also prevents page protections from being
-  // modified from underneath us.
-  ::common::AutoRecursiveLock scoped_lock(block_protect_lock);
+uint64_t ToAddress(const void* pointer) {
+  return reinterpret_cast<uintptr_t>(pointer);
+}
 
-  // Walk over all of the addressable memory to find the corrupt blocks.
-  // Allow memory_size to overflow to 0 for 4GB 32-bit processes.
-  // TODO(sebmarchand): Iterates over the heap slabs once we have switched to
-  //     a new memory allocator.
-  GetCorruptRangesInSlab(
-      reinterpret_cast<const uint8_t*>(Shadow::kAddressLowerBound),
-      reinterpret_cast<const uint8_t*>(shadow_->memory_size()),
-      corrupt_ranges);
+// @returns true if the shadow of @p address can be read.
+bool IsShadowReadable(const Shadow* shadow, uint64_t address) {
+  // On 32-bit the shadow is always fully committed.
+#ifdef _WIN64
+  MEMORY_BASIC_INFORMATION memory_info = {};
+  if (::VirtualQuery(shadow->GetShadowMemoryForAddress(ToPointer(address)),
+                     &memory_info, sizeof(memory_info)) == 0) {
+    return false;
+  }
+  return memory_info.State == MEM_COMMIT;
+#else
+  return true;
+#endif
+}
 
-  return !corrupt_ranges->empty();
+// Moves @p address past the end of the blocks that contain it but start below
+// it. These blocks are checked along with the range of memory preceding
+// @p address, and the blocks nested in them mustn't be reported.
+// @param shadow The shadow memory to query.
+// @param address The address to adjust.
+// @param upper_bound The address past which the adjustment stops.
+// @returns the adjusted address.
+uint64_t SkipStraddlingBlocks(const Shadow* shadow,
+                              uint64_t address,
+                              uint64_t upper_bound) {
+  BlockInfo block_info = {};
+  while (address < upper_bound && IsShadowReadable(shadow, address) &&
+         shadow->BlockInfoFromShadow(ToPointer(address), &block_info) &&
+         ToAddress(block_info.header) < address) {
+    address = ToAddress(block_info.RawHeader() + block_info.block_size);
+  }
+  return address;
 }
 
-void HeapChecker::GetCorruptRangesInSlab(const uint8_t* lower_bound,
-                                         const uint8_t* upper_bound,
-                                         CorruptRangesVector* corrupt_ranges) {
-  DCHECK_NE(static_cast<const uint8_t*>(nullptr), lower_bound);
-  DCHECK(upper_bound == nullptr || lower_bound <= upper_bound);
-  DCHECK_NE(static_cast<CorruptRangesVector*>(nullptr), corrupt_ranges);
+// @returns true if some of the pages of a block are protected.
+bool BlockHasProtectedPages(const Shadow* shadow, const BlockInfo& block_info) {
+  for (size_t offset = 0; offset < block_info.block_pages_size;
+       offset += GetPageSize()) {
+    if (shadow->PageIsProtected(block_info.block_pages + offset))
+      return true;
+  }
+  return false;
+}
+
+// The result of checking a chunk of memory.
+struct ChunkResult {
+  ChunkResult()
+      : has_blocks(false),
+        first_block_is_corrupt(false),
+        last_block_is_corrupt(false) {}
+
+  HeapChecker::CorruptRangesVector corrupt_ranges;
+  // These are used to merge the corrupt ranges that straddle chunks.
+  bool has_blocks;
+  bool first_block_is_corrupt;
+  bool last_block_is_corrupt;
+};
+
+// Checks the blocks starting in a range of memory.
+// @param shadow The shadow memory to query.
+// @param lower_bound The lower bound of the range (inclusive).
+// @param upper_bound The upper bound of the range (exclusive).
+// @param restore_protections If true the page protections of the blocks are
+//     restored after they're checked, otherwise they're left removed so that
+//     the minidump generation has free access to block contents.
+// @param result Will receive the result.
+// @note The block_protect_lock must be held, possibly by the thread on behalf
+//     of which this is run.
+void CheckChunk(Shadow* shadow,
+                uint64_t lower_bound,
+                uint64_t upper_bound,
+                bool restore_protections,
+                ChunkResult* result) {
+  DCHECK_NE(static_cast<ChunkResult*>(nullptr), result);
+
+  lower_bound = SkipStraddlingBlocks(shadow, lower_bound, upper_bound);
+  if (lower_bound >= upper_bound)
+    return;
 
   // An overflowed |upper_bound| is handled correctly by the ShadowWalker.
-  ShadowWalker shadow_walker(shadow_, lower_bound, upper_bound);
+  ShadowWalker shadow_walker(shadow, ToPointer(lower_bound),
+                             ToPointer(upper_bound));
 
   AsanCorruptBlockRange* current_corrupt_range = nullptr;
 
@@ -64,11 +134,23 @@ void HeapChecker::GetCorruptRangesInSlab(const uint8_t* lower_bound,
   BlockInfo block_info = {};
   while (shadow_walker.Next(&block_info)) {
     // Remove the protections on this block so its checksum can be safely
-    // validated. We leave the protections permanently removed so that the
-    // minidump generation has free access to block contents.
-    BlockProtectNone(block_info, shadow_);
+    // validated.
+    bool was_protected =
+        restore_protections && BlockHasProtectedPages(shadow, block_info);
+    BlockProtectNoneUnlocked(block_info, shadow);
 
+    // The protections of the corrupt blocks are left removed, as their header
+    // can't be trusted to infer them.
     bool current_block_is_corrupt = IsBlockCorrupt(block_info);
+    if (was_protected && !current_block_is_corrupt)
+      BlockProtectAuto(block_info, shadow);
+
+    if (!result->has_blocks) {
+      result->has_blocks = true;
+      result->first_block_is_corrupt = current_block_is_corrupt;
+    }
+    result->last_block_is_corrupt = current_block_is_corrupt;
+
     // If the current block is corrupt and |current_corrupt_range| is nullptr
     // then this means that the current block is at the beginning of a corrupt
     // range.
@@ -79,8 +161,8 @@ void HeapChecker::GetCorruptRangesInSlab(const uint8_t* lower_bound,
       corrupt_range.block_count = 0;
       corrupt_range.block_info = nullptr;
       corrupt_range.block_info_count = 0;
-      corrupt_ranges->push_back(corrupt_range);
-      current_corrupt_range = &corrupt_ranges->back();
+      result->corrupt_ranges.push_back(corrupt_range);
+      current_corrupt_range = &result->corrupt_ranges.back();
     } else if (!current_block_is_corrupt && current_corrupt_range != nullptr) {
       current_corrupt_range = nullptr;
     }
@@ -100,5 +182,326 @@ void HeapChecker::GetCorruptRangesInSlab(const uint8_t* lower_bound,
   }
 }
 
+// Appends the corrupt ranges of a chunk to those of the preceding chunks,
+// merging the range that straddles them if any.
+// @param result The result of the chunk.
+// @param range_is_open Indicates if the last block of the preceding chunks is
+//     corrupt. Updated to reflect the last block of this chunk.
+// @param corrupt_ranges The corrupt ranges of the preceding chunks.
+void MergeChunkResult(const ChunkResult& result,
+                      bool* range_is_open,
+                      HeapChecker::CorruptRangesVector* corrupt_ranges) {
+  DCHECK_NE(static_cast<bool*>(nullptr), range_is_open);
+  DCHECK_NE(static_cast<HeapChecker::CorruptRangesVector*>(nullptr),
+            corrupt_ranges);
+
+  // The chunks without blocks don't break the contiguity of the ranges.
+  if (!result.has_blocks)
+    return;
+
+  auto range = result.corrupt_ranges.begin();
+  if (*range_is_open && result.first_block_is_corrupt) {
+    DCHECK(range != result.corrupt_ranges.end());
+    AsanCorruptBlockRange* previous_range = &corrupt_ranges->back();
+    const uint8_t* range_end =
+        reinterpret_cast<const uint8_t*>(range->address) + range->length;
+    previous_range->length =
+        range_end - reinterpret_cast<const uint8_t*>(previous_range->address);
+    previous_range->block_count += range->block_count;
+    ++range;
+  }
+  corrupt_ranges->insert(corrupt_ranges->end(), range,
+                         result.corrupt_ranges.end());
+  *range_is_open = result.last_block_is_corrupt;
+}
+
+// The state shared by the threads taking part in a parallel heap check. This
+// is reference counted as the helper threads aren't joined: they might not
+// get to run before the check is over, e.g. if the loader lock is held, in
+// which case they simply find no work left to do.
+class ParallelHeapCheck : public base::RefCountedThreadSafe<ParallelHeapCheck> {
+ public:
+  ParallelHeapCheck(Shadow* shadow,
+                    uint64_t lower_bound,
+                    uint64_t upper_bound,
+                    uint64_t chunk_size)
+      : shadow_(shadow),
+        lower_bound_(lower_bound),
+        upper_bound_(upper_bound),
+        chunk_size_(chunk_size),
+        chunk_count_(0),
+        next_chunk_(0),
+        remaining_chunks_(0),
+        done_event_(true, false) {
+    DCHECK_NE(static_cast<Shadow*>(nullptr), shadow);
+    DCHECK_LT(lower_bound, upper_bound);
+    DCHECK_LT(0u, chunk_size);
+    uint64_t chunk_count = (upper_bound - lower_bound - 1) / chunk_size + 1;
+    DCHECK_GE(static_cast<uint64_t>(
+                  std::numeric_limits<base::subtle::Atomic32>::max()),
+              chunk_count);
+    chunk_count_ = static_cast<size_t>(chunk_count);
+    results_.resize(chunk_count_);
+    remaining_chunks_ = static_cast<base::subtle::Atomic32>(chunk_count_);
+  }
+
+  size_t chunk_count() const { return chunk_count_; }
+
+  // Checks chunks until they have all been claimed.
+  void Run() {
+    while (true) {
+      size_t chunk = static_cast<size_t>(
+          base::subtle::NoBarrier_AtomicIncrement(&next_chunk_, 1) - 1);
+      if (chunk >= chunk_count_)
+        return;
+
+      uint64_t lower_bound = lower_bound_ + chunk * chunk_size_;
+      uint64_t upper_bound =
+          std::min(lower_bound + chunk_size_, upper_bound_);
+      CheckChunk(shadow_, lower_bound, upper_bound, false, &results_[chunk]);
+
+      if (base::subtle::Barrier_AtomicIncrement(&remaining_chunks_, -1) == 0)
+        done_event_.Signal();
+    }
+  }
+
+  // Waits for all of the chunks to be checked, and merges their results.
+  // @param corrupt_ranges Will receive the corrupt ranges.
+  void Wait(HeapChecker::CorruptRangesVector* corrupt_ranges) {
+    done_event_.Wait();
+    bool range_is_open = false;
+    for (const auto& result : results_)
+      MergeChunkResult(result, &range_is_open, corrupt_ranges);
+  }
+
+ private:
+  friend class base::RefCountedThreadSafe<ParallelHeapCheck>;
+  ~ParallelHeapCheck() {}
+
+  Shadow* shadow_;
+  uint64_t lower_bound_;
+  uint64_t upper_bound_;
+  uint64_t chunk_size_;
+  size_t chunk_count_;
+
+  // The results of the chunks. Each one is only written by the thread that
+  // claimed the chunk.
+  std::vector<ChunkResult> results_;
+
+  // The index of the next chunk to claim.
+  base::subtle::Atomic32 next_chunk_;
+
+  // The number of chunks that haven't been checked yet.
+  base::subtle::Atomic32 remaining_chunks_;
+
+  // Signaled when all of the chunks have been checked.
+  base::WaitableEvent done_event_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelHeapCheck);
+};
+
+// A helper thread taking part in a parallel heap check. It deletes itself once
+// done.
+class HeapCheckHelperThread : public base::PlatformThread::Delegate {
+ public:
+  explicit HeapCheckHelperThread(ParallelHeapCheck* check) : check_(check) {}
+
+  // Implementation of PlatformThread::Delegate:
+  void ThreadMain() override {
+    base::PlatformThread::SetName("SyzyASAN Heap Checker Thread");
+    check_->Run();
+    delete this;
+  }
+
+ private:
+  scoped_refptr<ParallelHeapCheck> check_;
+
+  DISALLOW_COPY_AND_ASSIGN(HeapCheckHelperThread);
+};
+
+size_t GetProcessorCount() {
+  SYSTEM_INFO system_info = {};
+  ::GetSystemInfo(&system_info);
+  return std::max<size_t>(1, system_info.dwNumberOfProcessors);
+}
+
+}  // namespace
+
+HeapChecker::HeapChecker(Shadow* shadow)
+    : shadow_(shadow),
+      max_thread_count_(kDefaultMaxThreadCount),
+      chunk_size_(0),
+      next_slice_address_(Shadow::kAddressLowerBound) {
+  DCHECK_NE(static_cast<Shadow*>(nullptr), shadow);
+}
+
+bool HeapChecker::IsHeapCorrupt(CorruptRangesVector* corrupt_ranges) {
+  // Walk over all of the addressable memory to find the corrupt blocks.
+  // TODO(sebmarchand): Iterates over the heap slabs once we have switched to
+  //     a new memory allocator.
+  return IsRangeCorrupt(
+      ToPointer(Shadow::kAddressLowerBound),
+      ToPointer(shadow_->memory_size()),
+      corrupt_ranges);
+}
+
+bool HeapChecker::IsRangeCorrupt(const void* lower_bound,
+                                 const void* upper_bound,
+                                 CorruptRangesVector* corrupt_ranges) {
+  DCHECK_NE(static_cast<CorruptRangesVector*>(nullptr), corrupt_ranges);
+
+  corrupt_ranges->clear();
+
+  // Allow |upper_bound| to overflow to 0 for 4GB 32-bit processes.
+  uint64_t lower = ToAddress(lower_bound);
+  uint64_t upper = ToAddress(upper_bound);
+  if (upper == 0)
+    upper = shadow_->memory_size();
+  DCHECK_LE(lower, upper);
+  if (lower == upper)
+    return false;
+
+  uint64_t chunk_size = chunk_size_;
+  if (chunk_size == 0) {
+    chunk_size = ::common::AlignUp64((upper - lower) / kDefaultChunkCount,
+                                     kChunkAlignment);
+    chunk_size = std::max(chunk_size, kChunkAlignment);
+  }
+
+  // Grab the page protection lock. This prevents multiple heap checkers from
+  // running simultaneously, and also prevents page protections from being
+  // modified from underneath us. The helper threads run under the protection
+  // of this lock, which is held until they have finished their work.
+  ::common::AutoRecursiveLock scoped_lock(block_protect_lock);
+
+  scoped_refptr<ParallelHeapCheck> check(
+      new ParallelHeapCheck(shadow_, lower, upper, chunk_size));
+  size_t thread_count = std::min(
+      std::min(max_thread_count_, GetProcessorCount()), check->chunk_count());
+
+  // The calling thread takes part in the check, so it completes even if the
+  // helper threads can't be created or don't get to run.
+  for (size_t i = 1; i < thread_count; ++i) {
+    HeapCheckHelperThread* helper = new HeapCheckHelperThread(check.get());
+    if (!base::PlatformThread::CreateNonJoinable(0, helper)) {
+      delete helper;
+      break;
+    }
+  }
+  check->Run();
+  check->Wait(corrupt_ranges);
+
+  return !corrupt_ranges->empty();
+}
+
+bool HeapChecker::IsNextSliceCorrupt(size_t slice_size,
+                                     CorruptRangesVector* corrupt_ranges) {
+  DCHECK_LT(0u, slice_size);
+  DCHECK_NE(static_cast<CorruptRangesVector*>(nullptr), corrupt_ranges);
+
+  corrupt_ranges->clear();
+
+  uint64_t memory_upper_bound = shadow_->memory_size();
+  if (next_slice_address_ >= memory_upper_bound)
+    next_slice_address_ = Shadow::kAddressLowerBound;
+  uint64_t lower_bound = next_slice_address_;
+  uint64_t upper_bound = std::min(
+      lower_bound + ::common::AlignUp(slice_size, kShadowRatio),
+      memory_upper_bound);
+  next_slice_address_ = upper_bound;
+
+  CheckRangeAndRestoreProtections(lower_bound, upper_bound, corrupt_ranges);
+  return !corrupt_ranges->empty();
+}
+
+bool HeapChecker::RecheckCorruptRanges(
+    const CorruptRangesVector& suspect_ranges,
+    CorruptRangesVector* corrupt_ranges) {
+  DCHECK_NE(static_cast<CorruptRangesVector*>(nullptr), corrupt_ranges);
+
+  corrupt_ranges->clear();
+  for (const auto& range : suspect_ranges) {
+    uint64_t lower_bound = ToAddress(range.address);
+    CheckRangeAndRestoreProtections(lower_bound, lower_bound + range.length,
+                                    corrupt_ranges);
+  }
+  return !corrupt_ranges->empty();
+}
+
+void HeapChecker::CheckRangeAndRestoreProtections(
+    uint64_t lower_bound,
+    uint64_t upper_bound,
+    CorruptRangesVector* corrupt_ranges) {
+  DCHECK_NE(static_cast<CorruptRangesVector*>(nullptr), corrupt_ranges);
+
+  ::common::AutoRecursiveLock scoped_lock(block_protect_lock);
+  ChunkResult result;
+  CheckChunk(shadow_, lower_bound, upper_bound, true, &result);
+  corrupt_ranges->insert(corrupt_ranges->end(), result.corrupt_ranges.begin(),
+                         result.corrupt_ranges.end());
+}
+
+BackgroundHeapChecker::BackgroundHeapChecker(
+    HeapManagerInterface* heap_manager,
+    Shadow* shadow,
+    size_t slice_size,
+    base::TimeDelta period,
+    const CorruptionCallback& corruption_callback)
+    : heap_manager_(heap_manager),
+      heap_checker_(shadow),
+      slice_size_(slice_size),
+      period_(period),
+      corruption_callback_(corruption_callback),
+      stop_event_(false, false),
+      quantum_count_(0) {
+  DCHECK_NE(static_cast<HeapManagerInterface*>(nullptr), heap_manager);
+  DCHECK_LT(0u, slice_size);
+}
+
+BackgroundHeapChecker::~BackgroundHeapChecker() {
+  DCHECK(thread_handle_.is_null());
+}
+
+bool BackgroundHeapChecker::Start() {
+  DCHECK(thread_handle_.is_null());
+  return base::PlatformThread::CreateWithPriority(
+      0, this, &thread_handle_, base::ThreadPriority::BACKGROUND);
+}
+
+void BackgroundHeapChecker::Stop() {
+  DCHECK(!thread_handle_.is_null());
+  stop_event_.Signal();
+  base::PlatformThread::Join(thread_handle_);
+  thread_handle_ = base::PlatformThreadHandle();
+}
+
+size_t BackgroundHeapChecker::quantum_count() const {
+  return static_cast<size_t>(base::subtle::Acquire_Load(&quantum_count_));
+}
+
+void BackgroundHeapChecker::ThreadMain() {
+  base::PlatformThread::SetName("SyzyASAN Background Heap Checker Thread");
+  while (!stop_event_.TimedWait(period_))
+    CheckNextSlice();
+}
+
+void BackgroundHeapChecker::CheckNextSlice() {
+  HeapChecker::CorruptRangesVector corrupt_ranges;
+  HeapChecker::CorruptRangesVector slice_corrupt_ranges;
+  {
+    AutoHeapManagerLock heap_manager_lock(heap_manager_);
+
+    // The suspect ranges of the previous quantum are reported if they're still
+    // corrupt now.
+    heap_checker_.RecheckCorruptRanges(suspect_ranges_, &corrupt_ranges);
+    heap_checker_.IsNextSliceCorrupt(slice_size_, &slice_corrupt_ranges);
+  }
+  suspect_ranges_.swap(slice_corrupt_ranges);
+
+  if (!corrupt_ranges.empty())
+    corruption_callback_.Run(corrupt_ranges);
+  base::subtle::Barrier_AtomicIncrement(&quantum_count_, 1);
+}
+
 }  // namespace asan
 }  // namespace agent
@@ -12,14 +12,20 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 //
-// Declares HeapChecker, a class that checks a heap for corruption.
+// Declares HeapChecker, a class that checks a heap for corruption, and
+// BackgroundHeapChecker, which continuously checks the heap a slice at a time.
 
 #ifndef SYZYGY_AGENT_ASAN_HEAP_CHECKER_H_
 #define SYZYGY_AGENT_ASAN_HEAP_CHECKER_H_
 
 #include <vector>
 
+#include "base/atomicops.h"
+#include "base/callback.h"
 #include "base/logging.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/threading/platform_thread.h"
+#include "base/time/time.h"
 #include "syzygy/agent/asan/error_info.h"
 #include "syzygy/agent/common/stack_capture.h"
 
@@ -28,6 +34,7 @@ namespace asan {
 
 // Forward declarations.
 class AsanRuntime;
+class HeapManagerInterface;
 class Shadow;
 
 // A class to analyze the heap and to check if it's corrupt.
@@ -35,39 +42,163 @@ class HeapChecker {
  public:
   typedef std::vector<AsanCorruptBlockRange> CorruptRangesVector;
 
+  // The default maximum number of threads used by IsHeapCorrupt, including
+  // the calling thread. This is further capped by the number of processors.
+  static const size_t kDefaultMaxThreadCount = 4;
+
+  // The number of chunks into which the memory is split by default when it is
+  // checked in parallel. Having more chunks than threads balances the load, as
+  // the blocks are far from evenly spread across the address space.
+  static const size_t kDefaultChunkCount = 64;
+
   // Constructor.
   // @param shadow The shadow memory to query.
   explicit HeapChecker(Shadow* shadow);
 
   // Checks if the heap is corrupt and returns the information about the
   // corrupt ranges. This permanently removes all page protections as it
-  // walks through memory.
+  // walks through memory. The memory is split in chunks that are checked by
+  // a small pool of threads.
   // @param corrupt_ranges Will receive the information about the corrupt
   //     ranges.
   // @returns true if the heap is corrupt, false otherwise.
   bool IsHeapCorrupt(CorruptRangesVector* corrupt_ranges);
 
-  // TODO(sebmarchand): Add a testing seam that controls the range of memory
-  //     that is walked by HeapChecker to keep unittest times to something
-  //     reasonable.
+  // Same as IsHeapCorrupt, but only checks the blocks starting in the given
+  // range of memory.
+  // @param lower_bound The lower bound of the range (inclusive).
+  // @param upper_bound The upper bound of the range (exclusive). An
+  //     overflowed value of 0 indicates the end of all memory.
+  // @param corrupt_ranges Will receive the information about the corrupt
+  //     ranges.
+  // @returns true if the range contains corrupt blocks, false otherwise.
+  bool IsRangeCorrupt(const void* lower_bound,
+                      const void* upper_bound,
+                      CorruptRangesVector* corrupt_ranges);
+
+  // Incrementally checks the heap. Each call checks the blocks starting in the
+  // slice of memory following the one checked by the previous call, wrapping
+  // around at the end of memory. Unlike IsHeapCorrupt this restores the page
+  // protections of the checked blocks, so it can be used in a live process.
+  // @param slice_size The size of the slice of memory to check.
+  // @param corrupt_ranges Will receive the information about the corrupt
+  //     ranges in the slice.
+  // @returns true if the slice contains corrupt blocks, false otherwise.
+  // @note The caller is responsible for preventing the heaps from being
+  //     modified during the call, e.g. with an AutoHeapManagerLock.
+  bool IsNextSliceCorrupt(size_t slice_size,
+                          CorruptRangesVector* corrupt_ranges);
+
+  // Checks again the blocks of ranges that were previously reported as
+  // corrupt, restoring their page protections.
+  // @param suspect_ranges The ranges to check.
+  // @param corrupt_ranges Will receive the information about the ranges that
+  //     are still corrupt.
+  // @returns true if some of the ranges are still corrupt, false otherwise.
+  bool RecheckCorruptRanges(const CorruptRangesVector& suspect_ranges,
+                            CorruptRangesVector* corrupt_ranges);
+
+  // @name Accessors and mutators.
+  // @{
+  size_t max_thread_count() const { return max_thread_count_; }
+  void set_max_thread_count(size_t max_thread_count) {
+    DCHECK_LT(0u, max_thread_count);
+    max_thread_count_ = max_thread_count;
+  }
+  // A chunk size of 0 splits the memory in kDefaultChunkCount chunks.
+  size_t chunk_size() const { return chunk_size_; }
+  void set_chunk_size(size_t chunk_size) { chunk_size_ = chunk_size; }
+  // @}
 
  private:
-  // Get the information about the corrupt ranges in a heap slab.
-  // @param lower_bound The lower bound for this slab (inclusive).
-  // @param upper_bound The upper bound for this slab (exclusive). An
-  //     overflowed value of 0 indicates the end of all memory.
-  // @param corrupt_ranges Will receive the information about the corrupt ranges
-  //     in this slab.
-  void GetCorruptRangesInSlab(const uint8_t* lower_bound,
-                              const uint8_t* upper_bound,
-                              CorruptRangesVector* corrupt_ranges);
+  // Check the blocks starting in a range of memory on the calling thread.
+  // @param lower_bound The lower bound of the range (inclusive).
+  // @param upper_bound The upper bound of the range (exclusive).
+  // @param corrupt_ranges Will receive the information about the corrupt
+  //     ranges. They are appended to the existing ones.
+  void CheckRangeAndRestoreProtections(uint64_t lower_bound,
+                                       uint64_t upper_bound,
+                                       CorruptRangesVector* corrupt_ranges);
 
   // The shadow memory that will be analyzed.
   Shadow* shadow_;
 
+  // The maximum number of threads used to check the heap.
+  size_t max_thread_count_;
+
+  // The size of the chunks of memory checked in parallel.
+  size_t chunk_size_;
+
+  // The address where the next slice of an incremental check begins.
+  uint64_t next_slice_address_;
+
   DISALLOW_COPY_AND_ASSIGN(HeapChecker);
 };
 
+// A background thread that continuously checks the heap, a slice at a time.
+// Ranges found to be corrupt are only reported if they're still corrupt when
+// checked again on the next time quantum, which filters out the blocks that
+// were caught in the middle of a state transition.
+class BackgroundHeapChecker : public base::PlatformThread::Delegate {
+ public:
+  typedef base::Callback<void(const HeapChecker::CorruptRangesVector&)>
+      CorruptionCallback;
+
+  // Constructor.
+  // @param heap_manager The heap manager to lock while checking a slice.
+  // @param shadow The shadow memory to query.
+  // @param slice_size The size of the slice of memory checked per quantum.
+  // @param period The time quantum.
+  // @param corruption_callback The callback invoked with the corrupt ranges.
+  //     This is invoked on the background thread, without any lock held.
+  BackgroundHeapChecker(HeapManagerInterface* heap_manager,
+                        Shadow* shadow,
+                        size_t slice_size,
+                        base::TimeDelta period,
+                        const CorruptionCallback& corruption_callback);
+  ~BackgroundHeapChecker() override;
+
+  // Starts the thread. Must not be called if the thread is already running.
+  // @returns true if successful, false if the thread failed to be launched.
+  bool Start();
+
+  // Stops the thread and waits until it exits cleanly. Must be called before
+  // the destruction of this object.
+  void Stop();
+
+  // @returns the number of time quanta that have elapsed so far.
+  size_t quantum_count() const;
+
+ private:
+  // Implementation of PlatformThread::Delegate:
+  void ThreadMain() override;
+
+  // Checks the next slice of the heap, and the ranges that were suspect
+  // after the previous quantum.
+  void CheckNextSlice();
+
+  HeapManagerInterface* heap_manager_;
+  HeapChecker heap_checker_;
+  size_t slice_size_;
+  base::TimeDelta period_;
+  CorruptionCallback corruption_callback_;
+
+  // The ranges found to be corrupt during the previous quantum. Only accessed
+  // on the background thread.
+  HeapChecker::CorruptRangesVector suspect_ranges_;
+
+  // Signaled to stop the thread.
+  base::WaitableEvent stop_event_;
+
+  // The number of elapsed time quanta.
+  base::subtle::Atomic32 quantum_count_;
+
+  // Handle to the thread, used to join the thread when stopping.
+  base::PlatformThreadHandle thread_handle_;
+
+  DISALLOW_COPY_AND_ASSIGN(BackgroundHeapChecker);
+};
+
 }  // namespace asan
 }  // namespace agent
 
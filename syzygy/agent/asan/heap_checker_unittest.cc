@@ -14,8 +14,11 @@
 
 #include "syzygy/agent/asan/heap_checker.h"
 
+#include "base/bind.h"
 #include "base/rand_util.h"
+#include "base/synchronization/lock.h"
 #include "gtest/gtest.h"
+#include "syzygy/agent/asan/heap_manager.h"
 #include "syzygy/agent/asan/logger.h"
 #include "syzygy/agent/asan/page_protection_helpers.h"
 #include "syzygy/agent/asan/runtime.h"
@@ -30,6 +33,58 @@ typedef public testing::TestWithAsanRuntime HeapCheckerTest;
 
 using testing::FakeAsanBlock;
 
+// A heap manager that only supports being locked.
+class LockOnlyHeapManager : public HeapManagerInterface {
+ public:
+  LockOnlyHeapManager() : lock_count(0) {}
+
+  // @name HeapManagerInterface implementation.
+  // @{
+  HeapId CreateHeap() override { NOTREACHED(); return 0; }
+  bool DestroyHeap(HeapId heap) override { NOTREACHED(); return false; }
+  void* Allocate(HeapId heap, uint32_t bytes) override {
+    NOTREACHED();
+    return nullptr;
+  }
+  bool Free(HeapId heap, void* alloc) override { NOTREACHED(); return false; }
+  uint32_t Size(HeapId heap, const void* alloc) override {
+    NOTREACHED();
+    return 0;
+  }
+  void Lock(HeapId heap) override { NOTREACHED(); }
+  void Unlock(HeapId heap) override { NOTREACHED(); }
+  void BestEffortLockAll() override {
+    lock.Acquire();
+    ++lock_count;
+  }
+  void UnlockAll() override { lock.Release(); }
+  // @}
+
+  base::Lock lock;
+  size_t lock_count;  // Under lock.
+};
+
+// Collects the corrupt ranges reported by a BackgroundHeapChecker.
+struct CorruptionReports {
+  CorruptionReports() : reported(true, false) {}
+
+  void OnCorruption(const HeapChecker::CorruptRangesVector& corrupt_ranges) {
+    base::AutoLock auto_lock(lock);
+    ranges.insert(ranges.end(), corrupt_ranges.begin(), corrupt_ranges.end());
+    reported.Signal();
+  }
+
+  base::Lock lock;
+  HeapChecker::CorruptRangesVector ranges;  // Under lock.
+  base::WaitableEvent reported;
+};
+
+// Returns a slice size such that the incremental checks cover the memory in
+// four slices.
+size_t GetQuarterMemorySize(const Shadow* shadow) {
+  return static_cast<size_t>(shadow->memory_size() / 4);
+}
+
 }  // namespace
 
 TEST_F(HeapCheckerTest, HeapCheckerHandlesPageProtections) {
@@ -204,5 +259,146 @@ TEST_F(HeapCheckerTest, IsHeapCorrupt) {
   ::free(global_alloc);
 }
 
+TEST_F(HeapCheckerTest, IsRangeCorruptMergesChunks) {
+  const size_t kAllocSize = 100;
+
+  BlockLayout block_layout = {};
+  EXPECT_TRUE(BlockPlanLayout(kShadowRatio, kShadowRatio, kAllocSize, 0, 0,
+                              &block_layout));
+
+  const size_t kNumberOfBlocks = 6;
+  size_t total_alloc_size = block_layout.block_size * kNumberOfBlocks;
+  uint8_t* global_alloc =
+      reinterpret_cast<uint8_t*>(::malloc(total_alloc_size));
+
+  BlockHeader* block_headers[kNumberOfBlocks];
+  for (size_t i = 0; i < kNumberOfBlocks; ++i) {
+    BlockInfo block_info = {};
+    BlockInitialize(block_layout, global_alloc + i * block_layout.block_size,
+                    &block_info);
+    runtime_->shadow()->PoisonAllocatedBlock(block_info);
+    BlockSetChecksum(block_info);
+    block_headers[i] = block_info.header;
+  }
+
+  // Corrupt the blocks 1 to 3 and the last one.
+  block_headers[1]->magic++;
+  block_headers[2]->magic++;
+  block_headers[3]->magic++;
+  block_headers[kNumberOfBlocks - 1]->magic++;
+
+  // Split the range in chunks ending in the middle of the blocks, at their
+  // boundaries, and spanning several of them. The result must be the same
+  // regardless of the chunk size and of the number of threads.
+  const size_t kChunkSizes[] = {
+      kShadowRatio, block_layout.block_size / 2, block_layout.block_size,
+      ::common::AlignUp(3 * block_layout.block_size / 2, kShadowRatio),
+      0};
+  const size_t kThreadCounts[] = {1, HeapChecker::kDefaultMaxThreadCount};
+  for (size_t chunk_size : kChunkSizes) {
+    for (size_t thread_count : kThreadCounts) {
+      HeapChecker heap_checker(runtime_->shadow());
+      heap_checker.set_chunk_size(chunk_size);
+      heap_checker.set_max_thread_count(thread_count);
+
+      HeapChecker::CorruptRangesVector corrupt_ranges;
+      EXPECT_TRUE(heap_checker.IsRangeCorrupt(
+          global_alloc, global_alloc + total_alloc_size, &corrupt_ranges));
+      ASSERT_EQ(2u, corrupt_ranges.size());
+      EXPECT_EQ(block_headers[1], corrupt_ranges[0].address);
+      EXPECT_EQ(3 * block_layout.block_size, corrupt_ranges[0].length);
+      EXPECT_EQ(3u, corrupt_ranges[0].block_count);
+      EXPECT_EQ(block_headers[kNumberOfBlocks - 1], corrupt_ranges[1].address);
+      EXPECT_EQ(block_layout.block_size, corrupt_ranges[1].length);
+      EXPECT_EQ(1u, corrupt_ranges[1].block_count);
+    }
+  }
+
+  block_headers[1]->magic--;
+  block_headers[2]->magic--;
+  block_headers[3]->magic--;
+  block_headers[kNumberOfBlocks - 1]->magic--;
+
+  runtime_->shadow()->Unpoison(global_alloc, total_alloc_size);
+  ::free(global_alloc);
+}
+
+TEST_F(HeapCheckerTest, IsNextSliceCorrupt) {
+  FakeAsanBlock fake_large_block(
+      runtime_->shadow(), kShadowRatioLog, runtime_->stack_cache());
+  fake_large_block.InitializeBlock(2 * static_cast<uint32_t>(GetPageSize()));
+  base::RandBytes(fake_large_block.block_info.body, 2 * GetPageSize());
+  fake_large_block.MarkBlockAsQuarantined();
+  BlockProtectAll(fake_large_block.block_info, runtime_->shadow());
+
+  FakeAsanBlock fake_block(
+      runtime_->shadow(), kShadowRatioLog, runtime_->stack_cache());
+  fake_block.InitializeBlock(100);
+  fake_block.block_info.header->magic = ~fake_block.block_info.header->magic;
+
+  // Check all of the memory, a slice at a time.
+  HeapChecker heap_checker(runtime_->shadow());
+  HeapChecker::CorruptRangesVector corrupt_ranges;
+  HeapChecker::CorruptRangesVector slice_corrupt_ranges;
+  for (size_t i = 0; i < 4; ++i) {
+    heap_checker.IsNextSliceCorrupt(GetQuarterMemorySize(runtime_->shadow()),
+                                    &slice_corrupt_ranges);
+    corrupt_ranges.insert(corrupt_ranges.end(), slice_corrupt_ranges.begin(),
+                          slice_corrupt_ranges.end());
+  }
+  ASSERT_EQ(1u, corrupt_ranges.size());
+  EXPECT_EQ(fake_block.block_info.header, corrupt_ranges[0].address);
+  EXPECT_EQ(1u, corrupt_ranges[0].block_count);
+
+  // The protections of the valid block have been restored.
+  EXPECT_TRUE(runtime_->shadow()->PageIsProtected(
+      fake_large_block.block_info.block_pages));
+
+  // The corruption is still there when checked again.
+  HeapChecker::CorruptRangesVector rechecked_ranges;
+  EXPECT_TRUE(
+      heap_checker.RecheckCorruptRanges(corrupt_ranges, &rechecked_ranges));
+  ASSERT_EQ(1u, rechecked_ranges.size());
+  EXPECT_EQ(fake_block.block_info.header, rechecked_ranges[0].address);
+
+  fake_block.block_info.header->magic = ~fake_block.block_info.header->magic;
+  EXPECT_FALSE(
+      heap_checker.RecheckCorruptRanges(corrupt_ranges, &rechecked_ranges));
+
+  BlockProtectNone(fake_large_block.block_info, runtime_->shadow());
+}
+
+TEST_F(HeapCheckerTest, BackgroundHeapChecker) {
+  FakeAsanBlock fake_block(
+      runtime_->shadow(), kShadowRatioLog, runtime_->stack_cache());
+  fake_block.InitializeBlock(100);
+  fake_block.block_info.header->magic = ~fake_block.block_info.header->magic;
+
+  LockOnlyHeapManager heap_manager;
+  CorruptionReports reports;
+  BackgroundHeapChecker background_checker(
+      &heap_manager, runtime_->shadow(),
+      GetQuarterMemorySize(runtime_->shadow()),
+      base::TimeDelta::FromMilliseconds(1),
+      base::Bind(&CorruptionReports::OnCorruption,
+                 base::Unretained(&reports)));
+  ASSERT_TRUE(background_checker.Start());
+  EXPECT_TRUE(reports.reported.TimedWait(base::TimeDelta::FromSeconds(30)));
+  background_checker.Stop();
+
+  // The corruption is only reported once it has been confirmed, on the
+  // quantum following the one that found it.
+  EXPECT_LE(2u, background_checker.quantum_count());
+  {
+    base::AutoLock auto_lock(heap_manager.lock);
+    EXPECT_LE(2u, heap_manager.lock_count);
+  }
+  base::AutoLock auto_lock(reports.lock);
+  ASSERT_FALSE(reports.ranges.empty());
+  EXPECT_EQ(fake_block.block_info.header, reports.ranges[0].address);
+
+  fake_block.block_info.header->magic = ~fake_block.block_info.header->magic;
+}
+
 }  // namespace asan
 }  // namespace agent
@@ -19,8 +19,10 @@
 
 #include "base/bind.h"
 #include "base/rand_util.h"
+#include "base/time/time.h"
 #include "syzygy/agent/asan/page_protection_helpers.h"
 #include "syzygy/agent/asan/runtime.h"
+#include "syzygy/agent/asan/runtime_stats.h"
 #include "syzygy/agent/asan/shadow.h"
 #include "syzygy/agent/asan/timed_try.h"
 #include "syzygy/agent/asan/heaps/internal_heap.h"
@@ -28,6 +30,7 @@
 #include "syzygy/agent/asan/heaps/simple_block_heap.h"
 #include "syzygy/agent/asan/heaps/win_heap.h"
 #include "syzygy/agent/asan/heaps/zebra_block_heap.h"
+#include "syzygy/common/align.h"
 #include "syzygy/common/asan_parameters.h"
 
 namespace agent {
@@ -84,6 +87,13 @@ void* DoUnguardedAllocation(BlockHeapInterface* heap_interface,
 
 }  // namespace
 
+BlockHeapManager::ThreadCache::ThreadCache()
+    : heap(nullptr), heap_id(0), pending_block_count(0), next(nullptr) {
+  ::memset(chunks, 0, sizeof(chunks));
+  ::memset(chunk_counts, 0, sizeof(chunk_counts));
+  ::memset(pending_blocks, 0, sizeof(pending_blocks));
+}
+
 BlockHeapManager::BlockHeapManager(Shadow* shadow,
                                    StackCaptureCache* stack_cache,
                                    MemoryNotifierInterface* memory_notifier)
@@ -98,7 +108,12 @@ BlockHeapManager::BlockHeapManager(Shadow* shadow,
       zebra_block_heap_id_(0),
       large_block_heap_id_(0),
       locked_heaps_(nullptr),
-      enable_page_protections_(true) {
+      enable_page_protections_(true),
+      thread_cache_tls_(TLS_OUT_OF_INDEXES),
+      thread_caches_(nullptr),
+      deferred_free_thread_running_(0),
+      deferred_trim_queue_(kDeferredTrimQueueCapacity),
+      deferred_free_work_pending_(0) {
   DCHECK_NE(static_cast<Shadow*>(nullptr), shadow);
   DCHECK_NE(static_cast<StackCaptureCache*>(nullptr), stack_cache);
   DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
@@ -109,6 +124,10 @@ BlockHeapManager::BlockHeapManager(Shadow* shadow,
   CHECK_NE(TLS_OUT_OF_INDEXES, allocation_filter_flag_tls_);
   // And disable it by default.
   set_allocation_filter_flag(false);
+
+  // The thread caches are also stored in Thread Local Storage.
+  thread_cache_tls_ = ::TlsAlloc();
+  CHECK_NE(TLS_OUT_OF_INDEXES, thread_cache_tls_);
 }
 
 BlockHeapManager::~BlockHeapManager() {
@@ -172,6 +191,10 @@ bool BlockHeapManager::DestroyHeap(HeapId heap_id) {
     iter->second.is_dying = true;
   }
 
+  // Give the chunks held by the thread caches back to the heap, and make sure
+  // that none of its blocks is left outside of the quarantine.
+  FlushThreadCaches(heap);
+
   // Destroy the heap and flush its quarantine. This is done outside of the
   // lock to both reduce contention and to ensure that we can re-enter the
   // block heap manager if corruption is found during the heap tear down.
@@ -195,6 +218,7 @@ void* BlockHeapManager::Allocate(HeapId heap_id, uint32_t bytes) {
   // Some allocations can pass through without instrumentation.
   if (parameters_.allocation_guard_rate < 1.0 &&
       base::RandDouble() >= parameters_.allocation_guard_rate) {
+    RuntimeStats::Instance()->Increment(RuntimeStats::kUnguardedAllocations);
     return DoUnguardedAllocation(GetHeapFromId(heap_id), shadow_, bytes);
   }
 
@@ -220,10 +244,18 @@ void* BlockHeapManager::Allocate(HeapId heap_id, uint32_t bytes) {
     heaps[heap_count++] = zebra_block_heap_id_;
   }
 
-  // Use the selected heaps to try to satisfy the allocation.
+  // Use the selected heaps to try to satisfy the allocation. The allocations
+  // that can only be served by the heap that was passed in may come from the
+  // thread cache.
   void* alloc = nullptr;
   BlockLayout block_layout = {};
-  for (int i = static_cast<int>(heap_count) - 1; i >= 0; --i) {
+  if (heap_count == 1) {
+    ThreadCache* cache = GetThreadCache();
+    if (cache != nullptr)
+      alloc = AllocateFromThreadCache(cache, heap_id, bytes, &block_layout);
+  }
+  for (int i = static_cast<int>(heap_count) - 1;
+       alloc == nullptr && i >= 0; --i) {
     BlockHeapInterface* heap = GetHeapFromId(heaps[i]);
     alloc = heap->AllocateBlock(
         bytes,
@@ -256,6 +288,8 @@ void* BlockHeapManager::Allocate(HeapId heap_id, uint32_t bytes) {
   block.trailer->heap_id = heap_id;
 
   BlockSetChecksum(block);
+  RuntimeStats::Instance()->IncrementAllocations(
+      GetHeapFromId(heap_id)->GetHeapType());
   if (enable_page_protections_)
     BlockProtectRedzones(block, shadow_);
 
@@ -330,6 +364,15 @@ bool BlockHeapManager::Free(HeapId heap_id, void* alloc) {
 
   // Update the block checksum.
   BlockSetChecksum(block_info);
+  RuntimeStats::Instance()->Increment(RuntimeStats::kQuarantinedBlocks);
+
+  // The small blocks headed for the shared quarantine are batched in the
+  // thread cache.
+  if (quarantine == &shared_quarantine_) {
+    ThreadCache* cache = GetThreadCache();
+    if (cache != nullptr && QuarantineInThreadCache(cache, block_info))
+      return true;
+  }
 
   CompactBlockInfo compact = {};
   ConvertBlockInfo(block_info, &compact);
@@ -442,6 +485,22 @@ void BlockHeapManager::set_parameters(
 }
 
 void BlockHeapManager::TearDownHeapManager() {
+  // Empty and delete the thread caches. This is done before tearing down the
+  // heaps, as the caches hold blocks and chunks belonging to them.
+  {
+    base::AutoLock lock(thread_caches_lock_);
+    while (thread_caches_ != nullptr) {
+      ThreadCache* cache = thread_caches_;
+      thread_caches_ = cache->next;
+      {
+        base::AutoLock cache_lock(cache->lock);
+        FlushThreadCacheBlocksUnlocked(cache);
+        FlushThreadCacheChunksUnlocked(cache);
+      }
+      DeleteThreadCache(cache);
+    }
+  }
+
   base::AutoLock lock(lock_);
 
   // This would indicate that we have outstanding heap locks being
@@ -475,6 +534,12 @@ void BlockHeapManager::TearDownHeapManager() {
     ::TlsFree(allocation_filter_flag_tls_);
     allocation_filter_flag_tls_ = TLS_OUT_OF_INDEXES;
   }
+
+  // Free the thread cache slot (TLS). The caches have been deleted above.
+  if (thread_cache_tls_ != TLS_OUT_OF_INDEXES) {
+    ::TlsFree(thread_cache_tls_);
+    thread_cache_tls_ = TLS_OUT_OF_INDEXES;
+  }
 }
 
 HeapId BlockHeapManager::GetHeapId(
@@ -627,6 +692,10 @@ void BlockHeapManager::PropagateParameters() {
     large_block_heap_id_ = GetHeapId(result);
   }
 
+  // Empty the thread caches if they have been disabled.
+  if (initialized_ && !parameters_.enable_thread_caches)
+    FlushAllThreadCaches();
+
   // TODO(chrisha|sebmarchand): Clean up existing blocks that exceed the
   //     maximum block size? This will require an entirely new TrimQuarantine
   //     function. Since this is never changed at runtime except in our
@@ -659,19 +728,57 @@ void BlockHeapManager::DisableDeferredFreeThread() {
   {
     base::AutoLock lock(deferred_free_thread_lock_);
     deferred_free_thread_old.swap(deferred_free_thread_);
+    base::subtle::NoBarrier_Store(&deferred_free_thread_running_, 0);
   }
 
   // Stop the thread and wait for it to exit.
   if (deferred_free_thread_old)
     deferred_free_thread_old->Stop();
 
+  // Drop the pending work, the quarantines get trimmed synchronously from now
+  // on.
+  BlockQuarantineInterface* quarantine = nullptr;
+  while (deferred_trim_queue_.pop(&quarantine)) {}
+  base::subtle::NoBarrier_Store(&deferred_free_work_pending_, 0);
+
   // Set the overbudget size to 0 to remove the hysteresis.
   shared_quarantine_.SetOverbudgetSize(0);
 }
 
 bool BlockHeapManager::IsDeferredFreeThreadRunning() {
-  base::AutoLock lock(deferred_free_thread_lock_);
-  return deferred_free_thread_ != nullptr;
+  return base::subtle::Acquire_Load(&deferred_free_thread_running_) != 0;
+}
+
+void BlockHeapManager::ReleaseThreadCache() {
+  if (thread_cache_tls_ == TLS_OUT_OF_INDEXES)
+    return;
+  ThreadCache* cache =
+      reinterpret_cast<ThreadCache*>(::TlsGetValue(thread_cache_tls_));
+  if (cache == nullptr)
+    return;
+  ::TlsSetValue(thread_cache_tls_, nullptr);
+
+  // Unlink the cache first, this ensures that no other thread can reach it.
+  {
+    base::AutoLock lock(thread_caches_lock_);
+    ThreadCache** link = &thread_caches_;
+    while (*link != cache) {
+      DCHECK_NE(static_cast<ThreadCache*>(nullptr), *link);
+      link = &(*link)->next;
+    }
+    *link = cache->next;
+  }
+
+  {
+    base::AutoLock lock(cache->lock);
+    FlushThreadCacheBlocksUnlocked(cache);
+    FlushThreadCacheChunksUnlocked(cache);
+  }
+  DeleteThreadCache(cache);
+}
+
+void BlockHeapManager::FlushAllThreadCaches() {
+  FlushThreadCaches(nullptr);
 }
 
 HeapType BlockHeapManager::GetHeapTypeUnlocked(HeapId heap_id) {
@@ -759,12 +866,32 @@ void BlockHeapManager::TrimQuarantine(TrimColor stop_color,
   DCHECK(initialized_);
   DCHECK_NE(static_cast<BlockQuarantineInterface*>(nullptr), quarantine);
 
+  base::TimeTicks start = base::TimeTicks::Now();
+  size_t trimmed = 0;
+
   // Trim the quarantine to the required color.
   if (parameters_.quarantine_size == 0) {
     BlockQuarantineInterface::ObjectVector blocks_to_free;
     quarantine->Empty(&blocks_to_free);
-    for (const auto& block : blocks_to_free)
-      FreeBlock(block);
+    trimmed = blocks_to_free.size();
+    for (size_t i = 0; i < blocks_to_free.size(); i += kTrimBatchSize) {
+      size_t count = blocks_to_free.size() - i;
+      if (count > kTrimBatchSize)
+        count = kTrimBatchSize;
+      FreeBlockBatch(blocks_to_free.data() + i, count);
+    }
+  } else if (quarantine == zebra_block_heap_) {
+    // The zebra heap quarantines whole slabs, which are often contiguous.
+    // Free them in batches so that their protection changes get coalesced.
+    CompactBlockInfo blocks_to_free[kTrimBatchSize] = {};
+    while (true) {
+      size_t count = zebra_block_heap_->PopBatch(blocks_to_free,
+                                                 kTrimBatchSize);
+      FreeBlockBatch(blocks_to_free, count);
+      trimmed += count;
+      if (count < kTrimBatchSize)
+        break;
+    }
   } else {
     CompactBlockInfo compact = {};
     while (true) {
@@ -772,10 +899,17 @@ void BlockHeapManager::TrimQuarantine(TrimColor stop_color,
       if (!result.pop_successful)
         break;
       FreeBlock(compact);
+      ++trimmed;
       if (result.trim_color <= stop_color)
         break;
     }
   }
+
+  RuntimeStats* stats = RuntimeStats::Instance();
+  stats->Increment(RuntimeStats::kQuarantineTrims);
+  stats->Add(RuntimeStats::kQuarantineTrimmedBlocks, trimmed);
+  stats->Add(RuntimeStats::kQuarantineTrimMicroseconds,
+             (base::TimeTicks::Now() - start).InMicroseconds());
 }
 
 void BlockHeapManager::FreeBlock(const BlockQuarantineInterface::Object& obj) {
@@ -784,6 +918,24 @@ void BlockHeapManager::FreeBlock(const BlockQuarantineInterface::Object& obj) {
   CHECK(FreePotentiallyCorruptBlock(&expanded));
 }
 
+void BlockHeapManager::FreeBlockBatch(
+    const BlockQuarantineInterface::Object* objs, size_t count) {
+  DCHECK(objs != nullptr || count == 0);
+  DCHECK_GE(kTrimBatchSize, count);
+
+  BlockInfo expanded[kTrimBatchSize] = {};
+  for (size_t i = 0; i < count; ++i)
+    ConvertBlockInfo(objs[i], &expanded[i]);
+
+  // Once the blocks are unprotected the calls to BlockProtectNone done while
+  // freeing them are cheap.
+  if (enable_page_protections_)
+    BlockProtectNoneBatch(expanded, count, shadow_);
+
+  for (size_t i = 0; i < count; ++i)
+    CHECK(FreePotentiallyCorruptBlock(&expanded[i]));
+}
+
 namespace {
 
 // A tiny helper function that checks if a quarantined filled block has a valid
@@ -1027,23 +1179,58 @@ void BlockHeapManager::TrimOrScheduleIfNecessary(
 
   // Signal the deferred thread to wake up and/or trim synchronously, as needed.
   if (trim_status & TrimStatusBits::ASYNC_TRIM_REQUIRED)
-    DeferredFreeThreadSignalWork();
+    DeferredFreeThreadSignalWork(quarantine);
   if (trim_status & TrimStatusBits::SYNC_TRIM_REQUIRED)
     TrimQuarantine(TrimColor::YELLOW, quarantine);
 }
 
-void BlockHeapManager::DeferredFreeThreadSignalWork() {
-  DCHECK(IsDeferredFreeThreadRunning());
+void BlockHeapManager::DeferredFreeThreadSignalWork(
+    BlockQuarantineInterface* quarantine) {
+  DCHECK_NE(static_cast<BlockQuarantineInterface*>(nullptr), quarantine);
+
+  // If the queue is full the request is dropped. This is harmless as the
+  // quarantine requests synchronous trimming once it's way over budget.
+  deferred_trim_queue_.push(quarantine);
+
+  // Only signal the thread if it hasn't been signaled since it last started
+  // processing the queue.
+  if (base::subtle::Acquire_CompareAndSwap(&deferred_free_work_pending_, 0,
+                                           1) != 0) {
+    return;
+  }
   base::AutoLock lock(deferred_free_thread_lock_);
-  deferred_free_thread_->SignalWork();
+  if (deferred_free_thread_)
+    deferred_free_thread_->SignalWork();
 }
 
 void BlockHeapManager::DeferredFreeDoWork() {
   DCHECK_EQ(GetDeferredFreeThreadId(), base::PlatformThread::CurrentId());
-  // As of now, only the shared quarantine gets trimmed asynchronously. This
-  // will bring it back in the GREEN color.
-  BlockQuarantineInterface* shared_quarantine = &shared_quarantine_;
-  TrimQuarantine(TrimColor::GREEN, shared_quarantine);
+
+  // Clear the pending flag before draining the queue, so that the quarantines
+  // pushed after this point cause the thread to be signaled again.
+  base::subtle::NoBarrier_Store(&deferred_free_work_pending_, 0);
+  base::subtle::MemoryBarrier();
+
+  // Bring the quarantines back in the GREEN color, trimming each of them once
+  // per batch.
+  static const size_t kBatchSize = 16;
+  BlockQuarantineInterface* quarantines[kBatchSize] = {};
+  size_t count = 0;
+  bool trimmed = false;
+  while ((count = deferred_trim_queue_.PopBatch(quarantines, kBatchSize)) > 0) {
+    BlockQuarantineInterface** end = quarantines + count;
+    std::sort(quarantines, end);
+    end = std::unique(quarantines, end);
+    for (BlockQuarantineInterface** it = quarantines; it != end; ++it)
+      TrimQuarantine(TrimColor::GREEN, *it);
+    trimmed = true;
+  }
+
+  // The shared quarantine is the default target of the asynchronous trimming.
+  if (!trimmed) {
+    BlockQuarantineInterface* shared_quarantine = &shared_quarantine_;
+    TrimQuarantine(TrimColor::GREEN, shared_quarantine);
+  }
 }
 
 base::PlatformThreadId BlockHeapManager::GetDeferredFreeThreadId() {
@@ -1064,6 +1251,191 @@ void BlockHeapManager::EnableDeferredFreeThreadWithCallback(
   base::AutoLock lock(deferred_free_thread_lock_);
   deferred_free_thread_.reset(new DeferredFreeThread(deferred_free_callback));
   deferred_free_thread_->Start();
+  base::subtle::Release_Store(&deferred_free_thread_running_, 1);
+}
+
+BlockHeapManager::ThreadCache* BlockHeapManager::GetThreadCache() {
+  if (!parameters_.enable_thread_caches ||
+      thread_cache_tls_ == TLS_OUT_OF_INDEXES) {
+    return nullptr;
+  }
+
+  ThreadCache* cache =
+      reinterpret_cast<ThreadCache*>(::TlsGetValue(thread_cache_tls_));
+  if (cache != nullptr)
+    return cache;
+
+  // The caches are bookkeeping, so they live in the internal heap.
+  void* alloc = internal_heap_->Allocate(sizeof(ThreadCache));
+  if (alloc == nullptr)
+    return nullptr;
+  cache = new(alloc) ThreadCache();
+  ::TlsSetValue(thread_cache_tls_, cache);
+
+  base::AutoLock lock(thread_caches_lock_);
+  cache->next = thread_caches_;
+  thread_caches_ = cache;
+  return cache;
+}
+
+void* BlockHeapManager::AllocateFromThreadCache(ThreadCache* cache,
+                                                HeapId heap_id,
+                                                uint32_t bytes,
+                                                BlockLayout* layout) {
+  DCHECK_NE(static_cast<ThreadCache*>(nullptr), cache);
+  DCHECK_NE(static_cast<BlockLayout*>(nullptr), layout);
+
+  // Plan the block the same way the heap would.
+  uint32_t min_right_redzone_size =
+      parameters_.trailer_padding_size + sizeof(BlockTrailer);
+  if (!BlockPlanLayout(kShadowRatio, kShadowRatio, bytes, 0,
+                       min_right_redzone_size, layout)) {
+    return nullptr;
+  }
+  if (layout->block_size > kThreadCacheMaxBlockSize)
+    return nullptr;
+
+  // Grow the right redzone so that the block fills its size class exactly,
+  // this way any chunk of the class can hold it.
+  uint32_t class_size = static_cast<uint32_t>(::common::AlignUp(
+      layout->block_size, kThreadCacheSizeClassGranularity));
+  if (class_size != layout->block_size) {
+    min_right_redzone_size += class_size - layout->block_size;
+    if (!BlockPlanLayout(kShadowRatio, kShadowRatio, bytes, 0,
+                         min_right_redzone_size, layout) ||
+        layout->block_size != class_size) {
+      return nullptr;
+    }
+  }
+  size_t size_class = class_size / kThreadCacheSizeClassGranularity - 1;
+  DCHECK_LT(size_class, kThreadCacheSizeClassCount);
+
+  BlockHeapInterface* heap = GetHeapFromId(heap_id);
+
+  base::AutoLock lock(cache->lock);
+  if (cache->heap == nullptr) {
+    // The heaps keeping track of their reservations in the shadow memory
+    // can't hand out chunks ahead of time.
+    if ((heap->GetHeapFeatures() &
+         HeapInterface::kHeapReportsReservations) != 0) {
+      return nullptr;
+    }
+    cache->heap = heap;
+    cache->heap_id = heap_id;
+  } else if (cache->heap != heap) {
+    return nullptr;
+  }
+
+  size_t& chunk_count = cache->chunk_counts[size_class];
+  if (chunk_count == 0) {
+    // Refill the magazine under a single acquisition of the heap lock.
+    heap->Lock();
+    for (; chunk_count < kThreadCacheMagazineSize; ++chunk_count) {
+      void* chunk = heap->Allocate(class_size);
+      if (chunk == nullptr)
+        break;
+      DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(chunk) % kShadowRatio);
+      cache->chunks[size_class][chunk_count] = chunk;
+    }
+    heap->Unlock();
+
+    // The chunks sitting in the cache can't be accessed.
+    for (size_t i = 0; i < chunk_count; ++i) {
+      shadow_->Poison(cache->chunks[size_class][i], class_size,
+                      kAsanReservedMarker);
+    }
+  }
+
+  if (chunk_count == 0)
+    return nullptr;
+  return cache->chunks[size_class][--chunk_count];
+}
+
+bool BlockHeapManager::QuarantineInThreadCache(ThreadCache* cache,
+                                               const BlockInfo& block_info) {
+  DCHECK_NE(static_cast<ThreadCache*>(nullptr), cache);
+
+  if (block_info.block_size > kThreadCacheMaxBlockSize)
+    return false;
+
+  base::AutoLock lock(cache->lock);
+  if (cache->pending_block_count == kThreadCacheMagazineSize)
+    FlushThreadCacheBlocksUnlocked(cache);
+  DCHECK_LT(cache->pending_block_count, kThreadCacheMagazineSize);
+
+  // The block isn't in the quarantine yet, so it can't be trimmed before it
+  // gets protected.
+  if (enable_page_protections_)
+    BlockProtectAll(block_info, shadow_);
+
+  ConvertBlockInfo(block_info,
+                   &cache->pending_blocks[cache->pending_block_count++]);
+  return true;
+}
+
+void BlockHeapManager::FlushThreadCacheBlocksUnlocked(ThreadCache* cache) {
+  DCHECK_NE(static_cast<ThreadCache*>(nullptr), cache);
+  cache->lock.AssertAcquired();
+
+  // Only the blocks headed for the shared quarantine go through the caches.
+  // They are pushed as a single batch, which takes each of the shard locks at
+  // most once.
+  BlockQuarantineInterface* quarantine = &shared_quarantine_;
+  bool pushed[kThreadCacheMagazineSize] = {};
+  TrimStatus trim_status = quarantine->PushBatch(
+      cache->pending_blocks, cache->pending_block_count, pushed);
+  for (size_t i = 0; i < cache->pending_block_count; ++i) {
+    if (pushed[i])
+      continue;
+    BlockInfo block_info = {};
+    ConvertBlockInfo(cache->pending_blocks[i], &block_info);
+    FreePristineBlock(&block_info);
+  }
+  cache->pending_block_count = 0;
+
+  // Trim the quarantine once for the whole batch.
+  TrimOrScheduleIfNecessary(trim_status, quarantine);
+}
+
+void BlockHeapManager::FlushThreadCacheChunksUnlocked(ThreadCache* cache) {
+  DCHECK_NE(static_cast<ThreadCache*>(nullptr), cache);
+  cache->lock.AssertAcquired();
+
+  if (cache->heap == nullptr)
+    return;
+
+  cache->heap->Lock();
+  for (size_t i = 0; i < kThreadCacheSizeClassCount; ++i) {
+    uint32_t class_size = static_cast<uint32_t>(
+        (i + 1) * kThreadCacheSizeClassGranularity);
+    for (size_t j = 0; j < cache->chunk_counts[i]; ++j) {
+      shadow_->Unpoison(cache->chunks[i][j], class_size);
+      cache->heap->Free(cache->chunks[i][j]);
+    }
+    cache->chunk_counts[i] = 0;
+  }
+  cache->heap->Unlock();
+
+  cache->heap = nullptr;
+  cache->heap_id = 0;
+}
+
+void BlockHeapManager::DeleteThreadCache(ThreadCache* cache) {
+  DCHECK_NE(static_cast<ThreadCache*>(nullptr), cache);
+  DCHECK_EQ(0u, cache->pending_block_count);
+  cache->~ThreadCache();
+  internal_heap_->Free(cache);
+}
+
+void BlockHeapManager::FlushThreadCaches(BlockHeapInterface* heap) {
+  base::AutoLock lock(thread_caches_lock_);
+  for (ThreadCache* cache = thread_caches_; cache != nullptr;
+       cache = cache->next) {
+    base::AutoLock cache_lock(cache->lock);
+    FlushThreadCacheBlocksUnlocked(cache);
+    if (heap == nullptr || cache->heap == heap)
+      FlushThreadCacheChunksUnlocked(cache);
+  }
 }
 
 HeapId BlockHeapManager::GetCorruptBlockHeapId(const BlockInfo* block_info) {
@@ -28,6 +28,7 @@
 #include "syzygy/agent/asan/error_info.h"
 #include "syzygy/agent/asan/heap.h"
 #include "syzygy/agent/asan/heap_manager.h"
+#include "syzygy/agent/asan/lock_free_circular_queue.h"
 #include "syzygy/agent/asan/quarantine.h"
 #include "syzygy/agent/asan/registry_cache.h"
 #include "syzygy/agent/asan/stack_capture_cache.h"
@@ -140,6 +141,21 @@ class BlockHeapManager : public HeapManagerInterface {
   // @returns true if the deferred thread is currently running.
   bool IsDeferredFreeThreadRunning();
 
+  // Releases the thread cache of the calling thread, if it has one. The blocks
+  // it holds are pushed to the quarantine and its free chunks are returned to
+  // their heap. This is meant to be called when a thread exits.
+  void ReleaseThreadCache();
+
+  // Flushes the thread caches of all the threads. Their pending blocks enter
+  // the quarantine, and their free chunks are returned to their heap.
+  void FlushAllThreadCaches();
+
+  // @returns the current size of the shared quarantine, in bytes. This is only
+  //     a snapshot while blocks are being freed.
+  size_t GetSharedQuarantineSize() const {
+    return shared_quarantine_.GetSize();
+  }
+
  protected:
   // This allows the runtime access to our internals, necessary for crash
   // processing.
@@ -175,6 +191,49 @@ class BlockHeapManager : public HeapManagerInterface {
 
   using StackId = agent::common::StackCapture::StackId;
 
+  // @name Thread cache constants. The allocations whose blocks fit in
+  //     kThreadCacheMaxBlockSize bytes are served from size classes spaced
+  //     kThreadCacheSizeClassGranularity bytes apart, and every magazine holds
+  //     up to kThreadCacheMagazineSize entries.
+  // @{
+  static const uint32_t kThreadCacheSizeClassGranularity = 16;
+  static const uint32_t kThreadCacheMaxBlockSize = 512;
+  static const size_t kThreadCacheSizeClassCount =
+      kThreadCacheMaxBlockSize / kThreadCacheSizeClassGranularity;
+  static const size_t kThreadCacheMagazineSize = 16;
+  // @}
+
+  // A per-thread cache sitting in front of a heap and of the shared
+  // quarantine. It serves the small allocations of its thread from magazines
+  // of free chunks, which are refilled in batches under a single acquisition
+  // of the heap lock. It also accumulates the small blocks freed by its thread
+  // and only pushes them to the quarantine when its magazine fills up. The
+  // pending blocks are already marked as freed, checksummed and protected, so
+  // they enjoy the same guarantees as the blocks in the quarantine.
+  struct ThreadCache {
+    ThreadCache();
+
+    // Protects the cache. It is only contended when another thread flushes
+    // the cache.
+    base::Lock lock;
+
+    // The heap the chunks come from. A cache is bound to the first heap its
+    // thread allocates from, the allocations from other heaps bypass it.
+    BlockHeapInterface* heap;  // Under lock.
+    HeapId heap_id;  // Under lock.
+
+    // The magazines of free chunks, by size class.
+    void* chunks[kThreadCacheSizeClassCount][kThreadCacheMagazineSize];
+    size_t chunk_counts[kThreadCacheSizeClassCount];  // Under lock.
+
+    // The freed blocks waiting to enter the shared quarantine.
+    CompactBlockInfo pending_blocks[kThreadCacheMagazineSize];  // Under lock.
+    size_t pending_block_count;  // Under lock.
+
+    // The next cache in the list of all the caches.
+    ThreadCache* next;  // Under thread_caches_lock_.
+  };
+
   // Causes the heap manager to tear itself down. If the heap manager
   // encounters corrupt blocks while tearing itself dow it will report an
   // error. This will in turn cause the asan runtime to call back into itself
@@ -265,6 +324,14 @@ class BlockHeapManager : public HeapManagerInterface {
   // @param obj The object to be freed.
   void FreeBlock(const BlockQuarantineInterface::Object& obj);
 
+  // Free a batch of blocks. The page protections of the blocks are removed
+  // at once, coalescing the changes for the contiguous blocks, before they are
+  // individually freed.
+  // @param objs The objects to be freed.
+  // @param count The number of objects. Must be at most kTrimBatchSize.
+  void FreeBlockBatch(const BlockQuarantineInterface::Object* objs,
+                      size_t count);
+
   // Free a block that might be corrupt. If the block is corrupt first reports
   // an error before safely releasing the block.
   // @param block_info The information about this block.
@@ -343,12 +410,15 @@ class BlockHeapManager : public HeapManagerInterface {
   void TrimOrScheduleIfNecessary(TrimStatus trim_status,
                                  BlockQuarantineInterface* quarantine);
 
-  // Used by TrimOrScheduleIfNecessary to signal the deferred free thread that
-  // the quarantine needs trimming (ie. asynchronous trimming).
-  void DeferredFreeThreadSignalWork();
+  // Used by TrimOrScheduleIfNecessary to hand a quarantine that needs trimming
+  // over to the deferred free thread (ie. asynchronous trimming), and to
+  // signal the thread. This doesn't take any lock unless the thread needs to
+  // be woken up.
+  // @param quarantine The quarantine to be trimmed.
+  void DeferredFreeThreadSignalWork(BlockQuarantineInterface* quarantine);
 
-  // Invoked by the deferred free thread when it is signaled that the quarantine
-  // needs trimming.
+  // Invoked by the deferred free thread when it is signaled that quarantines
+  // need trimming.
   void DeferredFreeDoWork();
 
   // Implementation of EnableDeferredFreeThread that takes the callback. Used
@@ -362,6 +432,52 @@ class BlockHeapManager : public HeapManagerInterface {
   // @returns the thread ID.
   base::PlatformThreadId GetDeferredFreeThreadId();
 
+  // @returns the thread cache of the calling thread, creating it if needed.
+  //     Returns nullptr if the thread caches are disabled.
+  ThreadCache* GetThreadCache();
+
+  // Tries to serve an allocation from a thread cache.
+  // @param cache The thread cache of the calling thread.
+  // @param heap_id The heap from which the allocation is requested.
+  // @param bytes The size of the allocation.
+  // @param layout Receives the layout of the block.
+  // @returns the block on success, nullptr if the allocation can't be served
+  //     by the cache.
+  void* AllocateFromThreadCache(ThreadCache* cache,
+                                HeapId heap_id,
+                                uint32_t bytes,
+                                BlockLayout* layout);
+
+  // Tries to keep a freed block in a thread cache rather than pushing it to
+  // the quarantine right away.
+  // @param cache The thread cache of the calling thread.
+  // @param block_info The freed block. It must be ready to enter the
+  //     quarantine.
+  // @returns true if the block has been taken by the cache, false otherwise.
+  bool QuarantineInThreadCache(ThreadCache* cache, const BlockInfo& block_info);
+
+  // Pushes the pending blocks of a thread cache to the quarantine.
+  // @param cache The thread cache to flush.
+  // @note This must be called under cache->lock.
+  void FlushThreadCacheBlocksUnlocked(ThreadCache* cache);
+
+  // Returns the free chunks of a thread cache to their heap, and unbinds the
+  // cache from it.
+  // @param cache The thread cache to flush.
+  // @note This must be called under cache->lock.
+  void FlushThreadCacheChunksUnlocked(ThreadCache* cache);
+
+  // Pushes the pending blocks of all the thread caches to the quarantine, and
+  // returns the free chunks of the caches bound to a given heap.
+  // @param heap The heap whose chunks are returned, or nullptr to return the
+  //     chunks of all the caches.
+  void FlushThreadCaches(BlockHeapInterface* heap);
+
+  // Destroys a thread cache and returns its memory to the internal heap. The
+  // cache must have been unlinked and flushed.
+  // @param cache The thread cache to destroy.
+  void DeleteThreadCache(ThreadCache* cache);
+
   // Helper function for finding the heap ID associated with a corrupt block.
   // This is best effort, and can return 0 when no heap can be found with
   // certainty.
@@ -437,18 +553,44 @@ class BlockHeapManager : public HeapManagerInterface {
   // Indicates if we use page protection to prevent invalid accesses to a block.
   bool enable_page_protections_;
 
+  // Stores the ThreadCache TLS slot.
+  DWORD thread_cache_tls_;
+
+  // The list of all the thread caches. Under thread_caches_lock_.
+  base::Lock thread_caches_lock_;
+  ThreadCache* thread_caches_;
+
   // The registry cache that we use to store the allocation stack ID of the
   // corrupt block for which we've already reported an error. This isn't used
   // in processes where registry access is blocked (ie, Chrome renderers).
   std::unique_ptr<RegistryCache> corrupt_block_registry_cache_;
 
  private:
+  // The capacity of |deferred_trim_queue_|.
+  static const size_t kDeferredTrimQueueCapacity = 64;
+
+  // The maximum number of blocks freed by a call to FreeBlockBatch.
+  static const size_t kTrimBatchSize = 16;
+
   // Background thread that takes care of trimming the quarantine
   // asynchronously.
   base::Lock deferred_free_thread_lock_;
   // Under deferred_free_thread_lock_.
   std::unique_ptr<DeferredFreeThread> deferred_free_thread_;
 
+  // Mirrors whether |deferred_free_thread_| is set, so that it can be checked
+  // without taking deferred_free_thread_lock_.
+  base::subtle::Atomic32 deferred_free_thread_running_;
+
+  // The quarantines waiting to be trimmed by the deferred free thread. The
+  // same quarantine may appear several times.
+  LockFreeCircularQueue<BlockQuarantineInterface*> deferred_trim_queue_;
+
+  // Set when the deferred free thread has been signaled and hasn't started
+  // processing |deferred_trim_queue_| yet. This limits the signaling, which
+  // requires deferred_free_thread_lock_, to once per wake up of the thread.
+  base::subtle::Atomic32 deferred_free_work_pending_;
+
   DISALLOW_COPY_AND_ASSIGN(BlockHeapManager);
 };
 
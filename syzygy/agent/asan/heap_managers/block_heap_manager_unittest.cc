@@ -14,6 +14,7 @@
 
 #include "syzygy/agent/asan/heap_managers/block_heap_manager.h"
 
+#include <memory>
 #include <vector>
 
 #include "base/bind.h"
@@ -45,6 +46,7 @@
 #include "syzygy/assm/buffer_serializer.h"
 #include "syzygy/common/asan_parameters.h"
 #include "syzygy/testing/laa.h"
+#include "syzygy/testing/metrics.h"
 
 namespace agent {
 namespace asan {
@@ -1192,6 +1194,91 @@ TEST_F(BlockHeapManagerTest, DoubleFree) {
   EXPECT_EQ(mem, errors_[0].location);
 }
 
+TEST_F(BlockHeapManagerTest, ThreadCacheDefersQuarantine) {
+  const uint32_t kAllocSize = 100;
+  const size_t kAllocCount = 4;
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.quarantine_size = 2 * kAllocCount * GetAllocSize(kAllocSize);
+  parameters.enable_thread_caches = true;
+  heap_manager_->set_parameters(parameters);
+
+  ScopedHeap heap(heap_manager_);
+  std::vector<void*> blocks;
+  for (size_t i = 0; i < kAllocCount; ++i) {
+    void* mem = heap.Allocate(kAllocSize);
+    ASSERT_NE(static_cast<void*>(nullptr), mem);
+    ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(mem, kAllocSize));
+    blocks.push_back(mem);
+  }
+
+  // The freed blocks are poisoned right away, but they wait in the thread
+  // cache before entering the quarantine.
+  for (void* mem : blocks) {
+    EXPECT_TRUE(heap.Free(mem));
+    ASSERT_NO_FATAL_FAILURE(VerifyFreedAccess(mem, kAllocSize));
+    EXPECT_FALSE(heap.InQuarantine(mem));
+  }
+
+  heap_manager_->FlushAllThreadCaches();
+  for (void* mem : blocks)
+    EXPECT_TRUE(heap.InQuarantine(mem));
+}
+
+TEST_F(BlockHeapManagerTest, ThreadCacheReleasedOnThreadExit) {
+  const uint32_t kAllocSize = 100;
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.quarantine_size = 2 * GetAllocSize(kAllocSize);
+  parameters.enable_thread_caches = true;
+  heap_manager_->set_parameters(parameters);
+
+  ScopedHeap heap(heap_manager_);
+  void* mem = heap.Allocate(kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), mem);
+  EXPECT_TRUE(heap.Free(mem));
+  EXPECT_FALSE(heap.InQuarantine(mem));
+
+  heap_manager_->ReleaseThreadCache();
+  EXPECT_TRUE(heap.InQuarantine(mem));
+
+  // A new cache gets created on demand.
+  mem = heap.Allocate(kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), mem);
+  ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(mem, kAllocSize));
+  EXPECT_TRUE(heap.Free(mem));
+}
+
+TEST_F(BlockHeapManagerTest, ThreadCacheDoubleFree) {
+  const uint32_t kAllocSize = 100;
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.quarantine_size = 2 * GetAllocSize(kAllocSize);
+  parameters.enable_thread_caches = true;
+  heap_manager_->set_parameters(parameters);
+
+  ScopedHeap heap(heap_manager_);
+  void* mem = heap.Allocate(kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), mem);
+  EXPECT_TRUE(heap.Free(mem));
+  EXPECT_FALSE(heap.Free(mem));
+
+  EXPECT_EQ(1u, errors_.size());
+  EXPECT_EQ(DOUBLE_FREE, errors_[0].error_type);
+  EXPECT_EQ(mem, errors_[0].location);
+}
+
+TEST_F(BlockHeapManagerTest, ThreadCacheBypassedForLargeAllocations) {
+  const uint32_t kAllocSize = 4096;
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.quarantine_size = 2 * GetAllocSize(kAllocSize);
+  parameters.enable_thread_caches = true;
+  heap_manager_->set_parameters(parameters);
+
+  ScopedHeap heap(heap_manager_);
+  void* mem = heap.Allocate(kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), mem);
+  EXPECT_TRUE(heap.Free(mem));
+  EXPECT_TRUE(heap.InQuarantine(mem));
+}
+
 TEST_F(BlockHeapManagerTest, SubsampledAllocationGuards) {
   ::common::AsanParameters parameters = heap_manager_->parameters();
   parameters.allocation_guard_rate = 0.5;
@@ -1924,6 +2011,69 @@ TEST_F(BlockHeapManagerTest, FreeCorruptedBlockWorks) {
   EXPECT_TRUE(heap_manager_->Free(wh, alloc));
 }
 
+namespace {
+
+// Allocates and frees small blocks in a loop, for benchmarking purposes.
+class AllocFreeRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  AllocFreeRunner(BlockHeapManager* heap_manager, HeapId heap_id)
+      : heap_manager_(heap_manager), heap_id_(heap_id) {
+    DCHECK_NE(static_cast<BlockHeapManager*>(nullptr), heap_manager);
+  }
+
+  void Run() override {
+    static const size_t kIterations = 10000;
+    static const size_t kBatchSize = 8;
+    void* allocs[kBatchSize] = {};
+    for (size_t i = 0; i < kIterations; ++i) {
+      for (size_t j = 0; j < kBatchSize; ++j)
+        allocs[j] = heap_manager_->Allocate(heap_id_, 16 + 8 * j);
+      for (size_t j = 0; j < kBatchSize; ++j)
+        heap_manager_->Free(heap_id_, allocs[j]);
+    }
+    // This is normally done by the runtime when the thread exits.
+    heap_manager_->ReleaseThreadCache();
+  }
+
+ private:
+  BlockHeapManager* heap_manager_;
+  HeapId heap_id_;
+
+  DISALLOW_COPY_AND_ASSIGN(AllocFreeRunner);
+};
+
+}  // namespace
+
+TEST_F(BlockHeapManagerTest, ThreadCachePerfTest) {
+  static const size_t kThreadCount = 4;
+
+  for (size_t caches = 0; caches < 2; ++caches) {
+    ::common::AsanParameters parameters = heap_manager_->parameters();
+    parameters.enable_thread_caches = caches != 0;
+    heap_manager_->set_parameters(parameters);
+
+    ScopedHeap heap(heap_manager_);
+    AllocFreeRunner runner(heap_manager_, heap.Id());
+    std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+    for (size_t i = 0; i < kThreadCount; ++i) {
+      threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+          new base::DelegateSimpleThread(&runner, "AllocFreeRunner")));
+    }
+
+    uint64_t tnet = ::__rdtsc();
+    for (auto& thread : threads)
+      thread->Start();
+    for (auto& thread : threads)
+      thread->Join();
+    tnet = ::__rdtsc() - tnet;
+
+    testing::EmitMetric(caches != 0 ?
+                            "Syzygy.Asan.BlockHeapManager.ThreadCachesOn" :
+                            "Syzygy.Asan.BlockHeapManager.ThreadCachesOff",
+                        tnet);
+  }
+}
+
 }  // namespace heap_managers
 }  // namespace asan
 }  // namespace agent
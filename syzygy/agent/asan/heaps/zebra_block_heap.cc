@@ -16,6 +16,7 @@
 
 #include <algorithm>
 
+#include "base/atomicops.h"
 #include "syzygy/common/align.h"
 #include "syzygy/common/asan_parameters.h"
 
@@ -44,7 +45,9 @@ ZebraBlockHeap::ZebraBlockHeap(size_t heap_size,
                   HeapAllocator<size_t>(internal_heap)),
       quarantine_(slab_count_,
                   HeapAllocator<size_t>(internal_heap)),
-      memory_notifier_(memory_notifier) {
+      memory_notifier_(memory_notifier),
+      claims_in_flight_(0),
+      lock_count_(0) {
   DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
 
   // Allocate the chunk of memory directly from the OS.
@@ -80,7 +83,7 @@ uint32_t ZebraBlockHeap::GetHeapFeatures() const {
 }
 
 void* ZebraBlockHeap::Allocate(uint32_t bytes) {
-  SlabInfo* slab_info = AllocateImpl(bytes);
+  SlabInfo* slab_info = AllocateImpl(bytes, nullptr);
   if (slab_info == NULL)
     return NULL;
   return slab_info->info.header;
@@ -93,20 +96,23 @@ bool ZebraBlockHeap::Free(void* alloc) {
   size_t slab_index = GetSlabIndex(alloc);
   if (slab_index == kInvalidSlabIndex)
     return false;
+
+  // Check the state first, the info of a free slab may be concurrently
+  // modified by the thread claiming it.
+  if (slab_info_[slab_index].state == kFreeSlab)
+    return false;
   if (slab_info_[slab_index].info.header != alloc)
     return false;
 
   // Memory must be released from the quarantine before calling Free.
   DCHECK_NE(kQuarantinedSlab, slab_info_[slab_index].state);
 
-  if (slab_info_[slab_index].state == kFreeSlab)
-    return false;
-
-  // Make the slab available for allocations.
+  // Make the slab available for allocations. Pushing it publishes the cleared
+  // info to the thread that will claim it.
   slab_info_[slab_index].state = kFreeSlab;
   ::memset(&slab_info_[slab_index].info, 0,
            sizeof(slab_info_[slab_index].info));
-  free_slabs_.push(slab_index);
+  CHECK(free_slabs_.push(slab_index));
   return true;
 }
 
@@ -140,14 +146,30 @@ uint32_t ZebraBlockHeap::GetAllocationSize(const void* alloc) {
 
 void ZebraBlockHeap::Lock() {
   lock_.Acquire();
+
+  // Turn the new claims away, then wait for the lock-free claims that are
+  // already in flight. These never block, so this terminates.
+  base::subtle::Barrier_AtomicIncrement(&lock_count_, 1);
+  while (base::subtle::Acquire_Load(&claims_in_flight_) != 0)
+    ::SwitchToThread();
 }
 
 void ZebraBlockHeap::Unlock() {
+  base::subtle::Barrier_AtomicIncrement(&lock_count_, -1);
   lock_.Release();
 }
 
 bool ZebraBlockHeap::TryLock() {
-  return lock_.Try();
+  if (!lock_.Try())
+    return false;
+
+  // Don't wait for the claims in flight, the caller retries as it sees fit.
+  base::subtle::Barrier_AtomicIncrement(&lock_count_, 1);
+  if (base::subtle::Acquire_Load(&claims_in_flight_) != 0) {
+    Unlock();
+    return false;
+  }
+  return true;
 }
 
 void* ZebraBlockHeap::AllocateBlock(uint32_t size,
@@ -185,19 +207,13 @@ void* ZebraBlockHeap::AllocateBlock(uint32_t size,
   if (right_redzone_size - GetPageSize() >= kShadowRatio)
     return nullptr;
 
-  // Allocate space for the block, and update the slab info to reflect the right
-  // redzone.
+  // Allocate space for the block. The slab info reflects the right redzone as
+  // soon as the slab is published as allocated.
   void* alloc = nullptr;
-  SlabInfo* slab_info = AllocateImpl(static_cast<uint32_t>(GetPageSize()));
-  if (slab_info != nullptr) {
-    slab_info->info.block_size = layout->block_size;
-    slab_info->info.header_size = layout->header_size +
-        layout->header_padding_size;
-    slab_info->info.trailer_size = layout->trailer_size +
-        layout->trailer_padding_size;
-    slab_info->info.is_nested = false;
+  SlabInfo* slab_info =
+      AllocateImpl(static_cast<uint32_t>(GetPageSize()), layout);
+  if (slab_info != nullptr)
     alloc = slab_info->info.header;
-  }
 
   DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(alloc) % kShadowRatio);
   return alloc;
@@ -248,6 +264,22 @@ PopResult ZebraBlockHeap::Pop(CompactBlockInfo* info) {
   return result;
 }
 
+size_t ZebraBlockHeap::PopBatch(CompactBlockInfo* infos, size_t max_count) {
+  DCHECK(infos != nullptr || max_count == 0);
+  ::common::AutoRecursiveLock lock(lock_);
+  size_t count = 0;
+  while (count < max_count && !QuarantineInvariantIsSatisfied()) {
+    size_t slab_index = quarantine_.front();
+    DCHECK_NE(kInvalidSlabIndex, slab_index);
+    quarantine_.pop();
+
+    DCHECK_EQ(kQuarantinedSlab, slab_info_[slab_index].state);
+    slab_info_[slab_index].state = kAllocatedSlab;
+    infos[count++] = slab_info_[slab_index].info;
+  }
+  return count;
+}
+
 void ZebraBlockHeap::Empty(ObjectVector* infos) {
   ::common::AutoRecursiveLock lock(lock_);
   while (!quarantine_.empty()) {
@@ -273,18 +305,35 @@ void ZebraBlockHeap::set_quarantine_ratio(float quarantine_ratio) {
   quarantine_ratio_ = quarantine_ratio;
 }
 
-ZebraBlockHeap::SlabInfo* ZebraBlockHeap::AllocateImpl(uint32_t bytes) {
+ZebraBlockHeap::SlabInfo* ZebraBlockHeap::AllocateImpl(
+    uint32_t bytes, const BlockLayout* layout) {
   CHECK_LE(bytes, (1u << 30));
   if (bytes == 0 || bytes > GetPageSize())
     return NULL;
-  ::common::AutoRecursiveLock lock(lock_);
 
-  if (free_slabs_.empty())
-    return NULL;
+  // Announce the claim before looking at the lock. Either Lock sees it and
+  // waits for it, or the claim sees the heap locked and takes the lock
+  // itself. This keeps a locked heap quiescent.
+  base::subtle::Barrier_AtomicIncrement(&claims_in_flight_, 1);
+  if (base::subtle::Acquire_Load(&lock_count_) != 0) {
+    base::subtle::Barrier_AtomicIncrement(&claims_in_flight_, -1);
+    ::common::AutoRecursiveLock lock(lock_);
+    return ClaimSlab(bytes, layout);
+  }
 
-  size_t slab_index = free_slabs_.front();
+  SlabInfo* slab_info = ClaimSlab(bytes, layout);
+  base::subtle::Barrier_AtomicIncrement(&claims_in_flight_, -1);
+  return slab_info;
+}
+
+ZebraBlockHeap::SlabInfo* ZebraBlockHeap::ClaimSlab(
+    uint32_t bytes, const BlockLayout* layout) {
+  // Claim a free slab. This doesn't require the lock, as the slab is owned by
+  // this thread until it is marked as allocated.
+  size_t slab_index = kInvalidSlabIndex;
+  if (!free_slabs_.pop(&slab_index))
+    return NULL;
   DCHECK_NE(kInvalidSlabIndex, slab_index);
-  free_slabs_.pop();
   uint8_t* slab_address = GetSlabAddress(slab_index);
   DCHECK_NE(static_cast<uint8_t*>(nullptr), slab_address);
 
@@ -292,14 +341,25 @@ ZebraBlockHeap::SlabInfo* ZebraBlockHeap::AllocateImpl(uint32_t bytes) {
   uint8_t* alloc = slab_address + GetPageSize() - bytes;
   alloc = ::common::AlignDown(alloc, kShadowRatio);
 
-  // Update the slab info.
+  // Fill in the whole slab info. The state is updated last, as the readers
+  // holding the lock ignore the info of free slabs.
   SlabInfo* slab_info = &slab_info_[slab_index];
-  slab_info->state = kAllocatedSlab;
+  DCHECK_EQ(kFreeSlab, slab_info->state);
   slab_info->info.header = reinterpret_cast<BlockHeader*>(alloc);
-  slab_info->info.block_size = static_cast<uint32_t>(bytes);
-  slab_info->info.header_size = 0;
-  slab_info->info.trailer_size = 0;
+  if (layout == nullptr) {
+    slab_info->info.block_size = static_cast<uint32_t>(bytes);
+    slab_info->info.header_size = 0;
+    slab_info->info.trailer_size = 0;
+  } else {
+    slab_info->info.block_size = layout->block_size;
+    slab_info->info.header_size = layout->header_size +
+        layout->header_padding_size;
+    slab_info->info.trailer_size = layout->trailer_size +
+        layout->trailer_padding_size;
+  }
   slab_info->info.is_nested = false;
+  base::subtle::MemoryBarrier();
+  slab_info->state = kAllocatedSlab;
 
   return slab_info;
 }
@@ -25,11 +25,13 @@
 #include <queue>
 #include <vector>
 
+#include "base/atomicops.h"
 #include "base/logging.h"
 #include "syzygy/agent/asan/allocators.h"
 #include "syzygy/agent/asan/circular_queue.h"
 #include "syzygy/agent/asan/constants.h"
 #include "syzygy/agent/asan/heap.h"
+#include "syzygy/agent/asan/lock_free_circular_queue.h"
 #include "syzygy/agent/asan/memory_notifier.h"
 #include "syzygy/agent/asan/quarantine.h"
 #include "syzygy/common/recursive_lock.h"
@@ -67,6 +69,11 @@ namespace heaps {
 // |-header-|                |-body-|                            |-trailer-|
 //
 // Calling Free on a quarantined address is an invalid operation.
+//
+// The free slabs are claimed without taking the heap lock, so allocations
+// don't contend with each other, nor with the quarantine operations. Locking
+// the heap with Lock or TryLock still excludes these claims: the claims in
+// flight are drained, and the new ones wait for the lock.
 class ZebraBlockHeap : public BlockHeapInterface,
                        public BlockQuarantineInterface {
  public:
@@ -132,6 +139,15 @@ class ZebraBlockHeap : public BlockHeapInterface,
   virtual void Unlock(size_t id) { }
   // @}
 
+  // Pops a batch of blocks from the quarantine, until the quarantine invariant
+  // is satisfied. This is equivalent to repeatedly calling Pop, but takes the
+  // lock only once.
+  // @param infos Will receive the popped blocks. Must have room for
+  //     @p max_count blocks.
+  // @param max_count The maximum number of blocks to pop.
+  // @returns the number of popped blocks.
+  size_t PopBatch(CompactBlockInfo* infos, size_t max_count);
+
   // Get the ratio of the memory used by the quarantine.
   float quarantine_ratio() const { return quarantine_ratio_; }
 
@@ -154,8 +170,20 @@ class ZebraBlockHeap : public BlockHeapInterface,
   };
 
   // Performs an allocation, and returns a pointer to the SlabInfo where the
-  // allocation was made.
-  SlabInfo* AllocateImpl(uint32_t bytes);
+  // allocation was made. The slab info is complete when it is published.
+  // @param bytes The size of the allocation, which is pushed to the end of the
+  //     even page of the slab.
+  // @param layout The layout of the block being allocated, or nullptr for a
+  //     raw allocation of @p bytes.
+  // @returns the info of the allocated slab, or NULL on failure.
+  SlabInfo* AllocateImpl(uint32_t bytes, const BlockLayout* layout);
+
+  // Claims a free slab for an allocation. This is the part of AllocateImpl
+  // that runs without the lock when the heap isn't locked.
+  // @param bytes The size of the allocation.
+  // @param layout The layout of the block being allocated, or nullptr.
+  // @returns the info of the allocated slab, or NULL if no slab is free.
+  SlabInfo* ClaimSlab(uint32_t bytes, const BlockLayout* layout);
 
   // Checks if the quarantine invariant is satisfied.
   // @returns true if the quarantine invariant is satisfied, false otherwise.
@@ -188,9 +216,12 @@ class ZebraBlockHeap : public BlockHeapInterface,
   float quarantine_ratio_;
 
   typedef CircularQueue<size_t, HeapAllocator<size_t>> SlabIndexQueue;
+  typedef LockFreeCircularQueue<size_t, HeapAllocator<size_t>>
+      FreeSlabIndexQueue;
 
-  // Holds the indices of free slabs. Under lock_.
-  SlabIndexQueue free_slabs_;
+  // Holds the indices of free slabs. This is lock-free, and the info of a slab
+  // popped from here belongs to the claiming thread until it is allocated.
+  FreeSlabIndexQueue free_slabs_;
 
   // Holds the indices of the quarantined slabs. Under lock_.
   SlabIndexQueue quarantine_;
@@ -198,7 +229,8 @@ class ZebraBlockHeap : public BlockHeapInterface,
   typedef std::vector<SlabInfo,
                       HeapAllocator<SlabInfo>> SlabInfoVector;
 
-  // Holds the information related to slabs. Under lock_.
+  // Holds the information related to slabs. Under lock_, except for the free
+  // slabs that are being claimed.
   SlabInfoVector slab_info_;
 
   // The interface that will be notified of internal memory use. Has its own
@@ -208,6 +240,13 @@ class ZebraBlockHeap : public BlockHeapInterface,
   // The global lock for this allocator.
   ::common::RecursiveLock lock_;
 
+  // The number of lock-free slab claims in progress.
+  volatile base::subtle::Atomic32 claims_in_flight_;
+
+  // The number of times the heap is held by Lock or TryLock. The slabs are
+  // claimed under lock_ while this is non-zero.
+  volatile base::subtle::Atomic32 lock_count_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(ZebraBlockHeap);
 };
@@ -15,10 +15,12 @@
 #include "syzygy/agent/asan/heaps/zebra_block_heap.h"
 
 #include <algorithm>
+#include <memory>
 #include <set>
 #include <utility>
 #include <vector>
 
+#include "base/threading/simple_thread.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/agent/asan/unittest_util.h"
@@ -46,6 +48,8 @@ testing::DummyHeap dummy_heap;
 class TestZebraBlockHeap : public ZebraBlockHeap {
  public:
   using ZebraBlockHeap::QuarantineInvariantIsSatisfied;
+  using ZebraBlockHeap::claims_in_flight_;
+  using ZebraBlockHeap::free_slabs_;
   using ZebraBlockHeap::heap_address_;
   using ZebraBlockHeap::slab_count_;
 
@@ -71,6 +75,26 @@ class TestZebraBlockHeap : public ZebraBlockHeap {
   }
 };
 
+// Allocates a given number of slabs from a zebra heap.
+class AllocateSlabsDelegate : public base::DelegateSimpleThread::Delegate {
+ public:
+  AllocateSlabsDelegate(ZebraBlockHeap* heap, size_t count)
+      : heap_(heap), count_(count) {
+  }
+
+  void Run() override {
+    for (size_t i = 0; i < count_; ++i)
+      allocs_.push_back(heap_->Allocate(0xFF));
+  }
+
+  const std::vector<void*>& allocs() const { return allocs_; }
+
+ private:
+  ZebraBlockHeap* heap_;
+  size_t count_;
+  std::vector<void*> allocs_;
+};
+
 }  // namespace
 
 TEST(ZebraBlockHeapTest, GetHeapTypeIsValid) {
@@ -447,6 +471,140 @@ TEST(ZebraBlockHeapTest, PushPopInvariant) {
     EXPECT_TRUE(h.FreeBlock(blocks[i]));
 }
 
+TEST(ZebraBlockHeapTest, PopBatch) {
+  TestZebraBlockHeap h;
+  h.set_quarantine_ratio(0);
+  BlockLayout layout = {};
+  BlockInfo block = {};
+
+  // Quarantine a few blocks. The quarantine invariant is broken as soon as
+  // a block is quarantined.
+  const size_t kBlockCount = 10;
+  std::vector<CompactBlockInfo> blocks;
+  for (size_t i = 0; i < kBlockCount; ++i) {
+    void* alloc = h.AllocateBlock(0xFF, 0, 0, &layout);
+    ASSERT_NE(static_cast<void*>(nullptr), alloc);
+    BlockInitialize(layout, alloc, &block);
+    CompactBlockInfo compact = {};
+    ConvertBlockInfo(block, &compact);
+    EXPECT_TRUE(h.Push(compact).push_successful);
+    blocks.push_back(compact);
+  }
+  EXPECT_EQ(kBlockCount, h.GetCountForTesting());
+
+  // The blocks are popped in FIFO order, no more than requested at a time.
+  CompactBlockInfo popped[kBlockCount] = {};
+  EXPECT_EQ(4u, h.PopBatch(popped, 4));
+  EXPECT_EQ(6u, h.PopBatch(popped + 4, kBlockCount));
+  EXPECT_EQ(0u, h.PopBatch(popped, kBlockCount));
+  EXPECT_EQ(0u, h.GetCountForTesting());
+  for (size_t i = 0; i < kBlockCount; ++i) {
+    EXPECT_EQ(0, ::memcmp(&blocks[i], &popped[i], sizeof(popped[i])));
+    EXPECT_TRUE(h.IsAllocated(popped[i].header));
+  }
+
+  // The popped blocks are contiguous, as they were allocated in order from a
+  // fresh heap.
+  for (size_t i = 1; i < kBlockCount; ++i) {
+    EXPECT_EQ(reinterpret_cast<uint8_t*>(popped[i - 1].header) +
+                  ZebraBlockHeap::kSlabSize,
+              reinterpret_cast<uint8_t*>(popped[i].header));
+  }
+
+  // Nothing is popped while the invariant holds.
+  h.set_quarantine_ratio(1);
+  ASSERT_TRUE(h.Push(blocks[0]).push_successful);
+  EXPECT_EQ(0u, h.PopBatch(popped, kBlockCount));
+  std::vector<CompactBlockInfo> objects;
+  h.Empty(&objects);
+
+  for (const auto& compact : blocks)
+    EXPECT_TRUE(h.Free(compact.header));
+}
+
+TEST(ZebraBlockHeapTest, ConcurrentAllocations) {
+  const size_t kThreadCount = 4;
+  TestZebraBlockHeap h;
+  size_t slabs_per_thread = h.slab_count_ / kThreadCount;
+
+  std::vector<std::unique_ptr<AllocateSlabsDelegate>> delegates;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    delegates.push_back(std::unique_ptr<AllocateSlabsDelegate>(
+        new AllocateSlabsDelegate(&h, slabs_per_thread)));
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(delegates.back().get(),
+                                       "zebra_block_heap_test")));
+  }
+  for (auto& thread : threads)
+    thread->Start();
+  for (auto& thread : threads)
+    thread->Join();
+
+  // Every slab has been handed out exactly once.
+  std::set<void*> allocs;
+  for (const auto& delegate : delegates) {
+    for (void* alloc : delegate->allocs()) {
+      ASSERT_NE(static_cast<void*>(nullptr), alloc);
+      EXPECT_TRUE(allocs.insert(alloc).second);
+      EXPECT_TRUE(h.IsAllocated(alloc));
+    }
+  }
+  EXPECT_EQ(kThreadCount * slabs_per_thread, allocs.size());
+
+  for (void* alloc : allocs)
+    EXPECT_TRUE(h.Free(alloc));
+}
+
+TEST(ZebraBlockHeapTest, LockedHeapAllocatesOnLockingThread) {
+  TestZebraBlockHeap h;
+  h.Lock();
+
+  // The claims of the thread holding the lock go through the lock.
+  void* alloc = h.Allocate(67);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+  EXPECT_EQ(67u, h.GetAllocationSize(alloc));
+
+  BlockLayout layout = {};
+  void* block = h.AllocateBlock(0xFF, 0, 0, &layout);
+  ASSERT_NE(static_cast<void*>(nullptr), block);
+  EXPECT_EQ(layout.block_size, h.GetAllocationSize(block));
+
+  EXPECT_TRUE(h.TryLock());
+  h.Unlock();
+  h.Unlock();
+
+  EXPECT_TRUE(h.Free(alloc));
+  EXPECT_TRUE(h.Free(block));
+}
+
+TEST(ZebraBlockHeapTest, LockExcludesClaims) {
+  TestZebraBlockHeap h;
+  size_t free_slab_count = h.free_slabs_.size();
+
+  // A claim started by another thread waits for the heap to be unlocked.
+  h.Lock();
+  AllocateSlabsDelegate delegate(&h, 1);
+  base::DelegateSimpleThread thread(&delegate, "zebra_block_heap_test");
+  thread.Start();
+  ::Sleep(50);
+  EXPECT_EQ(free_slab_count, h.free_slabs_.size());
+  h.Unlock();
+  thread.Join();
+  EXPECT_EQ(free_slab_count - 1, h.free_slabs_.size());
+  ASSERT_EQ(1u, delegate.allocs().size());
+  EXPECT_TRUE(h.IsAllocated(delegate.allocs()[0]));
+
+  // The heap can't be try-locked while a lock-free claim is in flight.
+  h.claims_in_flight_ = 1;
+  EXPECT_FALSE(h.TryLock());
+  h.claims_in_flight_ = 0;
+  EXPECT_TRUE(h.TryLock());
+  h.Unlock();
+
+  EXPECT_TRUE(h.Free(delegate.allocs()[0]));
+}
+
 TEST(ZebraBlockHeapTest, MemoryNotifierIsCalled) {
   testing::MockMemoryNotifier mock_notifier;
 
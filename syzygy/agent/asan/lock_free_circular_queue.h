@@ -0,0 +1,152 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A bounded lock-free circular queue, supporting multiple producers and
+// multiple consumers.
+// Each cell of the ring carries a sequence number indicating the lap of the
+// ring in which it can next be written or read. Producers and consumers claim
+// cells by advancing the tail and the head with a compare-and-swap, and then
+// publish them by updating their sequence numbers. A batch of consecutive
+// cells can be claimed with a single compare-and-swap.
+// The queue will refuse to push elements when it is full. As for
+// CircularQueue the underlying container reserves the memory only once, and
+// can use a MemoryNotifierAllocator:
+//
+// LockFreeCircularQueue<int, MemoryNotifierAllocator<int>> q(
+//     capacity, MemoryNotifierAllocator<int>(&notifier));
+
+#ifndef SYZYGY_AGENT_ASAN_LOCK_FREE_CIRCULAR_QUEUE_H_
+#define SYZYGY_AGENT_ASAN_LOCK_FREE_CIRCULAR_QUEUE_H_
+
+#include <memory>
+#include <vector>
+
+#include "base/atomicops.h"
+#include "base/macros.h"
+
+namespace agent {
+namespace asan {
+
+// A bounded lock-free multi-producer/multi-consumer circular queue.
+// @tparam T the type of the elements. This must be cheap to copy.
+// @tparam Alloc the type of the allocator used by the underlying container.
+template<typename T, typename Alloc = std::allocator<T>>
+class LockFreeCircularQueue {
+ public:
+  // Constructor.
+  // @param max_capacity Maximum number of elements the queue can store. This
+  //     is rounded up to a power of two.
+  explicit LockFreeCircularQueue(size_t max_capacity);
+
+  // Constructor.
+  // @param max_capacity Maximum number of elements the queue can store. This
+  //     is rounded up to a power of two.
+  // @param alloc The allocator to use with this container.
+  LockFreeCircularQueue(size_t max_capacity, const Alloc& alloc);
+
+  // Inserts an element in the back/tail of the queue if possible.
+  // @param elem The element to be inserted.
+  // @returns true if the operation succeeded and the element was inserted,
+  //     false if the queue is full.
+  bool push(const T& elem);
+
+  // Removes an element from the front/head of the queue if possible.
+  // @param elem Will receive the removed element.
+  // @returns true if an element was popped from the front/head, false if the
+  //     queue is empty.
+  bool pop(T* elem);
+
+  // Inserts a batch of elements in the back/tail of the queue. The elements
+  // pushed by a batch may be interleaved with those of concurrent pushes.
+  // @param elems The elements to be inserted.
+  // @param count The number of elements.
+  // @returns the number of elements that were inserted, starting with the
+  //     first one. This is less than @p count if the queue became full.
+  size_t PushBatch(const T* elems, size_t count);
+
+  // Removes a batch of elements from the front/head of the queue.
+  // @param elems Will receive the removed elements. Must have room for
+  //     @p count elements.
+  // @param count The maximum number of elements to remove.
+  // @returns the number of elements that were removed.
+  size_t PopBatch(T* elems, size_t count);
+
+  // Gives the current number of elements in the queue. This is only a
+  // snapshot when the queue is used concurrently.
+  // @returns the number of elements currently stored in the queue.
+  size_t size() const;
+
+  // Tests if the queue is empty. This is only a snapshot when the queue is
+  // used concurrently.
+  // @returns true if the queue is empty, false otherwise.
+  bool empty() const;
+
+  // @returns the maximum number of elements the queue can handle.
+  size_t max_capacity() const;
+
+ private:
+  // A cell of the ring. Its sequence number is equal to its position when it
+  // can be written and to its position plus one when it can be read, the
+  // positions increasing by the capacity of the ring on every lap.
+  struct Cell {
+    base::subtle::AtomicWord sequence;
+    T value;
+  };
+
+  typedef typename Alloc::template rebind<Cell>::other CellAlloc;
+  typedef std::vector<Cell, CellAlloc> Container;
+
+  // Claims consecutive cells that are ready to be written or read.
+  // @param position The position to advance, either |tail_| or |head_|.
+  // @param ready_offset The offset between the position of a cell and its
+  //     sequence number when it is ready.
+  // @param count The maximum number of cells to claim.
+  // @param first Will receive the position of the first claimed cell.
+  // @returns the number of claimed cells, 0 if the queue is full or empty.
+  size_t ClaimCells(base::subtle::AtomicWord* position,
+                    base::subtle::AtomicWord ready_offset,
+                    size_t count,
+                    base::subtle::AtomicWord* first);
+
+  // Initializes the ring.
+  // @param max_capacity The requested capacity.
+  void Init(size_t max_capacity);
+
+  // The queue underlying container.
+  Container buffer_;
+
+  // The capacity minus one, used to map the positions to the cells.
+  size_t mask_;
+
+  // The positions are kept on their own cache lines to avoid false sharing
+  // between the producers and the consumers.
+  uint8_t padding0_[64];
+
+  // The position of the next element to pop.
+  base::subtle::AtomicWord head_;
+  uint8_t padding1_[64 - sizeof(base::subtle::AtomicWord)];
+
+  // The position of the next element to push.
+  base::subtle::AtomicWord tail_;
+  uint8_t padding2_[64 - sizeof(base::subtle::AtomicWord)];
+
+  DISALLOW_COPY_AND_ASSIGN(LockFreeCircularQueue);
+};
+
+}  // namespace asan
+}  // namespace agent
+
+#include "syzygy/agent/asan/lock_free_circular_queue_impl.h"
+
+#endif  // SYZYGY_AGENT_ASAN_LOCK_FREE_CIRCULAR_QUEUE_H_
@@ -0,0 +1,178 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Internal implementation details for lock_free_circular_queue.h. Not meant
+// to be included directly.
+
+#ifndef SYZYGY_AGENT_ASAN_LOCK_FREE_CIRCULAR_QUEUE_IMPL_H_
+#define SYZYGY_AGENT_ASAN_LOCK_FREE_CIRCULAR_QUEUE_IMPL_H_
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace agent {
+namespace asan {
+
+template<typename T, typename Alloc>
+LockFreeCircularQueue<T, Alloc>::LockFreeCircularQueue(size_t max_capacity)
+    : mask_(0u), head_(0), tail_(0) {
+  Init(max_capacity);
+}
+
+template<typename T, typename Alloc>
+LockFreeCircularQueue<T, Alloc>::LockFreeCircularQueue(
+    size_t max_capacity, const Alloc& alloc)
+    : buffer_(CellAlloc(alloc)),
+      mask_(0u),
+      head_(0),
+      tail_(0) {
+  Init(max_capacity);
+}
+
+template<typename T, typename Alloc>
+bool LockFreeCircularQueue<T, Alloc>::push(const T& elem) {
+  return PushBatch(&elem, 1) == 1;
+}
+
+template<typename T, typename Alloc>
+bool LockFreeCircularQueue<T, Alloc>::pop(T* elem) {
+  DCHECK_NE(static_cast<T*>(nullptr), elem);
+  return PopBatch(elem, 1) == 1;
+}
+
+template<typename T, typename Alloc>
+size_t LockFreeCircularQueue<T, Alloc>::PushBatch(const T* elems,
+                                                  size_t count) {
+  DCHECK(elems != nullptr || count == 0);
+  size_t pushed = 0;
+  while (pushed < count) {
+    base::subtle::AtomicWord first = 0;
+    size_t claimed = ClaimCells(&tail_, 0, count - pushed, &first);
+    if (claimed == 0)
+      break;
+
+    // Write the elements, and make them visible to the consumers.
+    for (size_t i = 0; i < claimed; ++i) {
+      Cell& cell = buffer_[(first + i) & mask_];
+      cell.value = elems[pushed + i];
+      base::subtle::Release_Store(&cell.sequence, first + i + 1);
+    }
+    pushed += claimed;
+  }
+  return pushed;
+}
+
+template<typename T, typename Alloc>
+size_t LockFreeCircularQueue<T, Alloc>::PopBatch(T* elems, size_t count) {
+  DCHECK(elems != nullptr || count == 0);
+  size_t popped = 0;
+  while (popped < count) {
+    base::subtle::AtomicWord first = 0;
+    size_t claimed = ClaimCells(&head_, 1, count - popped, &first);
+    if (claimed == 0)
+      break;
+
+    // Read the elements, and hand the cells back to the producers for the
+    // next lap of the ring.
+    for (size_t i = 0; i < claimed; ++i) {
+      Cell& cell = buffer_[(first + i) & mask_];
+      elems[popped + i] = cell.value;
+      base::subtle::Release_Store(&cell.sequence, first + i + mask_ + 1);
+    }
+    popped += claimed;
+  }
+  return popped;
+}
+
+template<typename T, typename Alloc>
+size_t LockFreeCircularQueue<T, Alloc>::size() const {
+  // Read the head first, as the tail can only move further away from it.
+  base::subtle::AtomicWord head = base::subtle::Acquire_Load(&head_);
+  base::subtle::AtomicWord tail = base::subtle::Acquire_Load(&tail_);
+  base::subtle::AtomicWord size = tail - head;
+  if (size < 0)
+    return 0;
+  return std::min(static_cast<size_t>(size), max_capacity());
+}
+
+template<typename T, typename Alloc>
+bool LockFreeCircularQueue<T, Alloc>::empty() const {
+  return size() == 0;
+}
+
+template<typename T, typename Alloc>
+size_t LockFreeCircularQueue<T, Alloc>::max_capacity() const {
+  return buffer_.size();
+}
+
+template<typename T, typename Alloc>
+size_t LockFreeCircularQueue<T, Alloc>::ClaimCells(
+    base::subtle::AtomicWord* position,
+    base::subtle::AtomicWord ready_offset,
+    size_t count,
+    base::subtle::AtomicWord* first) {
+  DCHECK_NE(static_cast<base::subtle::AtomicWord*>(nullptr), position);
+  DCHECK_LT(0u, count);
+  DCHECK_NE(static_cast<base::subtle::AtomicWord*>(nullptr), first);
+
+  count = std::min(count, max_capacity());
+  while (true) {
+    base::subtle::AtomicWord current = base::subtle::NoBarrier_Load(position);
+
+    // Count the consecutive cells that are ready. A cell lagging behind means
+    // that the queue is full (or empty), while a cell ahead means that
+    // |current| is stale.
+    size_t ready = 0;
+    base::subtle::AtomicWord lag = 0;
+    for (; ready < count; ++ready) {
+      const Cell& cell = buffer_[(current + ready) & mask_];
+      lag = base::subtle::Acquire_Load(&cell.sequence) -
+            (current + ready + ready_offset);
+      if (lag != 0)
+        break;
+    }
+
+    if (ready == 0) {
+      if (lag < 0)
+        return 0;
+      continue;
+    }
+
+    if (base::subtle::NoBarrier_CompareAndSwap(position, current,
+                                               current + ready) == current) {
+      *first = current;
+      return ready;
+    }
+  }
+}
+
+template<typename T, typename Alloc>
+void LockFreeCircularQueue<T, Alloc>::Init(size_t max_capacity) {
+  DCHECK_LT(0u, max_capacity);
+  size_t capacity = 1;
+  while (capacity < max_capacity)
+    capacity <<= 1;
+
+  buffer_.resize(capacity);
+  mask_ = capacity - 1;
+  for (size_t i = 0; i < capacity; ++i)
+    buffer_[i].sequence = static_cast<base::subtle::AtomicWord>(i);
+  base::subtle::MemoryBarrier();
+}
+
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_LOCK_FREE_CIRCULAR_QUEUE_IMPL_H_
@@ -0,0 +1,237 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/lock_free_circular_queue.h"
+
+#include <memory>
+#include <vector>
+
+#include "base/threading/simple_thread.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "syzygy/agent/asan/allocators.h"
+#include "syzygy/agent/asan/unittest_util.h"
+
+namespace agent {
+namespace asan {
+
+namespace {
+
+using testing::MockMemoryNotifier;
+
+using ::testing::_;
+using ::testing::AtLeast;
+
+typedef LockFreeCircularQueue<uint32_t> TestQueue;
+
+// The number of values pushed by each producer of the concurrent tests.
+const uint32_t kValuesPerProducer = 10000;
+
+// Pushes a range of values, in batches of increasing sizes.
+class Producer : public base::DelegateSimpleThread::Delegate {
+ public:
+  Producer(TestQueue* queue, uint32_t first_value)
+      : queue_(queue), first_value_(first_value) {}
+
+  void Run() override {
+    uint32_t values[7] = {};
+    uint32_t next_value = first_value_;
+    uint32_t end_value = first_value_ + kValuesPerProducer;
+    size_t batch_size = 1;
+    while (next_value < end_value) {
+      size_t count = std::min<size_t>(batch_size, end_value - next_value);
+      for (size_t i = 0; i < count; ++i)
+        values[i] = next_value + static_cast<uint32_t>(i);
+      size_t pushed = queue_->PushBatch(values, count);
+      next_value += static_cast<uint32_t>(pushed);
+      batch_size = batch_size % arraysize(values) + 1;
+    }
+  }
+
+ private:
+  TestQueue* queue_;
+  uint32_t first_value_;
+};
+
+// Pops values until a given number of them has been popped by all of the
+// consumers, and records them.
+class Consumer : public base::DelegateSimpleThread::Delegate {
+ public:
+  Consumer(TestQueue* queue, base::subtle::Atomic32* remaining)
+      : queue_(queue), remaining_(remaining) {}
+
+  void Run() override {
+    uint32_t values[5] = {};
+    while (base::subtle::NoBarrier_Load(remaining_) > 0) {
+      size_t popped = queue_->PopBatch(values, arraysize(values));
+      if (popped == 0)
+        continue;
+      popped_.insert(popped_.end(), values, values + popped);
+      base::subtle::NoBarrier_AtomicIncrement(
+          remaining_, -static_cast<base::subtle::Atomic32>(popped));
+    }
+  }
+
+  const std::vector<uint32_t>& popped() const { return popped_; }
+
+ private:
+  TestQueue* queue_;
+  base::subtle::Atomic32* remaining_;
+  std::vector<uint32_t> popped_;
+};
+
+}  // namespace
+
+TEST(LockFreeCircularQueue, MaxCapacity) {
+  TestQueue q(128);
+  EXPECT_EQ(128u, q.max_capacity());
+
+  // The capacity is rounded up to a power of two.
+  TestQueue q2(100);
+  EXPECT_EQ(128u, q2.max_capacity());
+}
+
+TEST(LockFreeCircularQueue, PushAndPopUpdateSize) {
+  TestQueue q(128);
+  EXPECT_TRUE(q.empty());
+
+  for (uint32_t i = 0; i < q.max_capacity(); ++i) {
+    EXPECT_EQ(i, q.size());
+    EXPECT_TRUE(q.push(i));
+    EXPECT_EQ(i + 1, q.size());
+  }
+  EXPECT_FALSE(q.push(0));
+
+  for (uint32_t i = 0; i < q.max_capacity(); ++i) {
+    uint32_t value = 0;
+    EXPECT_TRUE(q.pop(&value));
+    EXPECT_EQ(i, value);
+    EXPECT_EQ(q.max_capacity() - i - 1, q.size());
+  }
+  uint32_t value = 0;
+  EXPECT_FALSE(q.pop(&value));
+  EXPECT_TRUE(q.empty());
+}
+
+TEST(LockFreeCircularQueue, ComplyWithFIFO) {
+  TestQueue q(128);
+
+  uint32_t initial = 10;
+  for (uint32_t i = 0; i < initial; ++i)
+    EXPECT_TRUE(q.push(i));
+
+  // Go around the ring many times.
+  for (uint32_t i = initial; i < 1000 * q.max_capacity(); ++i) {
+    EXPECT_TRUE(q.push(i));
+    uint32_t value = 0;
+    EXPECT_TRUE(q.pop(&value));
+    EXPECT_EQ(i - initial, value);
+  }
+}
+
+TEST(LockFreeCircularQueue, Batches) {
+  TestQueue q(16);
+  uint32_t values[24] = {};
+  for (uint32_t i = 0; i < arraysize(values); ++i)
+    values[i] = i;
+
+  // A batch is truncated when the queue becomes full.
+  EXPECT_EQ(10u, q.PushBatch(values, 10));
+  EXPECT_EQ(6u, q.PushBatch(values + 10, 14));
+  EXPECT_EQ(0u, q.PushBatch(values + 16, 8));
+  EXPECT_EQ(16u, q.size());
+
+  // Likewise when it becomes empty.
+  uint32_t popped[24] = {};
+  EXPECT_EQ(4u, q.PopBatch(popped, 4));
+  EXPECT_EQ(4u, q.PushBatch(values + 16, 4));
+  EXPECT_EQ(16u, q.PopBatch(popped + 4, 20));
+  EXPECT_EQ(0u, q.PopBatch(popped + 20, 4));
+  EXPECT_TRUE(q.empty());
+
+  for (uint32_t i = 0; i < 20; ++i)
+    EXPECT_EQ(i, popped[i]);
+}
+
+TEST(LockFreeCircularQueue, ConcurrentProducersAndConsumers) {
+  const size_t kThreadCount = 4;
+  TestQueue q(64);
+  base::subtle::Atomic32 remaining = kThreadCount * kValuesPerProducer;
+
+  std::vector<std::unique_ptr<Producer>> producers;
+  std::vector<std::unique_ptr<Consumer>> consumers;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    producers.push_back(std::unique_ptr<Producer>(new Producer(
+        &q, static_cast<uint32_t>(i) * kValuesPerProducer)));
+    consumers.push_back(
+        std::unique_ptr<Consumer>(new Consumer(&q, &remaining)));
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(producers.back().get(), "Producer")));
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(consumers.back().get(), "Consumer")));
+  }
+  for (auto& thread : threads)
+    thread->Start();
+  for (auto& thread : threads)
+    thread->Join();
+  EXPECT_TRUE(q.empty());
+
+  // Every value has been popped exactly once, and the values pushed by a
+  // given producer have been popped in order by each consumer.
+  std::vector<bool> seen(kThreadCount * kValuesPerProducer, false);
+  for (const auto& consumer : consumers) {
+    uint32_t last_values[kThreadCount] = {};
+    bool has_last_value[kThreadCount] = {};
+    for (uint32_t value : consumer->popped()) {
+      ASSERT_LT(value, seen.size());
+      EXPECT_FALSE(seen[value]);
+      seen[value] = true;
+
+      size_t producer = value / kValuesPerProducer;
+      if (has_last_value[producer])
+        EXPECT_LT(last_values[producer], value);
+      last_values[producer] = value;
+      has_last_value[producer] = true;
+    }
+  }
+  for (bool value_seen : seen)
+    EXPECT_TRUE(value_seen);
+}
+
+TEST(LockFreeCircularQueue, MemoryNotifierIsCalled) {
+  MockMemoryNotifier mock_notifier;
+
+  // Should be called by the underlying container.
+  EXPECT_CALL(mock_notifier,
+    NotifyInternalUse(_, _))
+    .Times(AtLeast(1));
+
+  // Ensure no calls to NotifyFutureHeapUse.
+  EXPECT_CALL(mock_notifier,
+    NotifyFutureHeapUse(_, _))
+    .Times(0);
+
+  // Should be called by the underlying container.
+  EXPECT_CALL(mock_notifier,
+    NotifyReturnedToOS(_, _))
+    .Times(AtLeast(1));
+
+  LockFreeCircularQueue<int, MemoryNotifierAllocator<int>> q(
+      100000,
+      MemoryNotifierAllocator<int>(&mock_notifier));
+}
+
+}  // namespace asan
+}  // namespace agent
@@ -108,6 +108,23 @@ const MemoryAccessorVariants kMemoryAccessorVariants[] = {
         ASAN_STRING_INTERCEPT_FUNCTIONS(ENUM_STRING_INTERCEPT_FUNCTION_VARIANTS)
 
 #undef ENUM_STRING_INTERCEPT_FUNCTION_VARIANTS
+
+#define ENUM_RANGE_INTERCEPT_FUNCTION_VARIANTS(access_mode_str,              \
+                                               access_mode_value)            \
+  { "asan_check_range_" #access_mode_str,                                    \
+    asan_redirect_range_##access_mode_str, asan_range_no_check,              \
+    asan_check_range_##access_mode_str##_2gb,                                \
+    asan_check_range_##access_mode_str##_4gb                                 \
+  },                                                                         \
+  { "asan_check_range_" #access_mode_str "_no_flags",                        \
+    asan_redirect_range_##access_mode_str##_no_flags, asan_range_no_check,   \
+    asan_check_range_##access_mode_str##_no_flags_2gb,                       \
+    asan_check_range_##access_mode_str##_no_flags_4gb                        \
+  },
+
+        ASAN_RANGE_INTERCEPT_FUNCTIONS(ENUM_RANGE_INTERCEPT_FUNCTION_VARIANTS)
+
+#undef ENUM_RANGE_INTERCEPT_FUNCTION_VARIANTS
 };
 
 const size_t kNumMemoryAccessorVariants = arraysize(kMemoryAccessorVariants);
@@ -263,6 +280,26 @@ void asan_report_bad_memory_access(void* location,
                                             asan_context);
 }
 
+// Reports a bad access to a range of memory. The reported location is the
+// first poisoned byte of the range, so that the error gets classified relative
+// to the block that this byte belongs to.
+void asan_report_bad_range_access(void* location,
+                                  AccessMode access_mode,
+                                  size_t range_size,
+                                  const AsanContext& asan_context) {
+  uint8_t* bad_location = reinterpret_cast<uint8_t*>(location);
+  if (memory_interceptor_shadow_ != nullptr) {
+    const void* poisoned = memory_interceptor_shadow_->FindFirstPoisonedByte(
+        location, range_size);
+    if (poisoned != nullptr)
+      bad_location = reinterpret_cast<uint8_t*>(const_cast<void*>(poisoned));
+  }
+  size_t access_size =
+      range_size - (bad_location - reinterpret_cast<uint8_t*>(location));
+  return agent::asan::ReportBadMemoryAccess(bad_location, access_mode,
+                                            access_size, asan_context);
+}
+
 }  // extern "C"
 
 }  // namespace asan
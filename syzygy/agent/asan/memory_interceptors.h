@@ -161,6 +161,12 @@ extern const size_t kNumClangMemoryAccessorVariants;
   F(stos, _, 1, AsanWriteAccess, AsanUnknownAccess, 2, 0)        \
   F(stos, _, 1, AsanWriteAccess, AsanUnknownAccess, 1, 0)
 
+// List of the range accessor function variants this file implements. These
+// check a whole range of memory at once, its size is passed on the stack.
+#define ASAN_RANGE_INTERCEPT_FUNCTIONS(F) \
+    F(read_access, AsanReadAccess) \
+    F(write_access, AsanWriteAccess)
+
 #endif  // !defined(_WIN64)
 
 // List of the Asan-Clang memory accessor functions.
@@ -188,6 +194,9 @@ extern "C" {
 #ifndef _WIN64
 // The no-op memory access checker.
 void asan_no_check();
+
+// The no-op range access checker.
+void asan_range_no_check();
 #endif
 
 // The Clang no-op memory access checker.
@@ -227,6 +236,20 @@ ASAN_MEM_INTERCEPT_FUNCTIONS(DECLARE_MEM_INTERCEPT_FUNCTIONS)
 ASAN_STRING_INTERCEPT_FUNCTIONS(DECLARE_STRING_INTERCEPT_FUNCTIONS)
 
 #undef DECLARE_STRING_INTERCEPT_FUNCTIONS
+
+#define DECLARE_RANGE_INTERCEPT_FUNCTIONS(access_mode_str, access_mode_value) \
+  void asan_redirect_range_##access_mode_str();                            \
+  void asan_check_range_##access_mode_str##_2gb();                         \
+  void asan_check_range_##access_mode_str##_4gb();                         \
+  void asan_redirect_range_##access_mode_str##_no_flags();                 \
+  void asan_check_range_##access_mode_str##_no_flags_2gb();                \
+  void asan_check_range_##access_mode_str##_no_flags_4gb();
+
+// Declare all the range interceptor functions. Note that these functions have
+// a custom calling convention, and can't be invoked directly.
+ASAN_RANGE_INTERCEPT_FUNCTIONS(DECLARE_RANGE_INTERCEPT_FUNCTIONS)
+
+#undef DECLARE_RANGE_INTERCEPT_FUNCTIONS
 #endif  // !defined(_WIN64)
 
 #ifndef _WIN64
@@ -107,6 +107,30 @@ ASAN_STRING_INTERCEPT_FUNCTIONS(DEFINE_STRING_REDIRECT_FUNCTION_TABLE)
 
 #undef DEFINE_STRING_REDIRECT_FUNCTION_TABLE
 };
+
+static const TestMemoryInterceptors::RangeInterceptFunction
+    range_intercept_functions[] = {
+#define DEFINE_RANGE_INTERCEPT_FUNCTION_TABLE(access_mode_str, access_mode) \
+  { asan_check_range_##access_mode_str##_2gb, false },                      \
+  { asan_check_range_##access_mode_str##_4gb, false },                      \
+  { asan_check_range_##access_mode_str##_no_flags_2gb, true },              \
+  { asan_check_range_##access_mode_str##_no_flags_4gb, true },
+
+ASAN_RANGE_INTERCEPT_FUNCTIONS(DEFINE_RANGE_INTERCEPT_FUNCTION_TABLE)
+
+#undef DEFINE_RANGE_INTERCEPT_FUNCTION_TABLE
+};
+
+static const TestMemoryInterceptors::RangeInterceptFunction
+    range_redirect_functions[] = {
+#define DEFINE_RANGE_REDIRECT_FUNCTION_TABLE(access_mode_str, access_mode) \
+  { asan_redirect_range_##access_mode_str, false },                        \
+  { asan_redirect_range_##access_mode_str##_no_flags, true },
+
+ASAN_RANGE_INTERCEPT_FUNCTIONS(DEFINE_RANGE_REDIRECT_FUNCTION_TABLE)
+
+#undef DEFINE_RANGE_REDIRECT_FUNCTION_TABLE
+};
 #endif
 
 static const TestMemoryInterceptors::ClangInterceptFunction
@@ -361,6 +385,39 @@ TEST_F(MemoryInterceptorsTest, TestStringRedirectors2G) {
       .WillRepeatedly(Return(MEMORY_ACCESSOR_MODE_2G));
   TestStringOverrunAccess(string_redirect_functions);
 }
+
+TEST_F(MemoryInterceptorsTest, TestRangeValidAccess) {
+  TestRangeValidAccess(range_intercept_functions);
+}
+
+TEST_F(MemoryInterceptorsTest, TestRangeOverrunAccess) {
+  TestRangeOverrunAccess(range_intercept_functions);
+}
+
+TEST_F(MemoryInterceptorsTest, TestRangeUnderrunAccess) {
+  TestRangeUnderrunAccess(range_intercept_functions);
+}
+
+TEST_F(MemoryInterceptorsTest, TestRangeRedirectorsNoop) {
+  EXPECT_CALL(*this, OnRedirectorInvocation(_))
+      // Each function is tested on four valid ranges.
+      .Times(4 * arraysize(range_redirect_functions))
+      .WillRepeatedly(Return(MEMORY_ACCESSOR_MODE_NOOP));
+
+  TestRangeValidAccess(range_redirect_functions);
+}
+
+TEST_F(MemoryInterceptorsTest, TestRangeRedirectors2G) {
+  EXPECT_CALL(*this, OnRedirectorInvocation(_))
+      // Each function is tested on four valid ranges, two overrun ranges and
+      // one underrun range.
+      .Times(7 * arraysize(range_redirect_functions))
+      .WillRepeatedly(Return(MEMORY_ACCESSOR_MODE_2G));
+
+  TestRangeValidAccess(range_redirect_functions);
+  TestRangeOverrunAccess(range_redirect_functions);
+  TestRangeUnderrunAccess(range_redirect_functions);
+}
 #endif
 
 }  // namespace asan
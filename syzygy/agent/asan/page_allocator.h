@@ -15,8 +15,13 @@
 // Defines PageAllocator. This is a simple allocator that grabs pages of
 // memory of a fixed specified size and hands out fixed size regions from head
 // to tail within that page. Regions of pages that have been freed are kept
-// track of in a simple linked list, and returned regions are aggressively
-// reused before a new page is allocated.
+// track of in simple lock-free linked lists, and returned regions are
+// aggressively reused before a new page is allocated. Objects are also carved
+// out of the active page without taking a lock, so the lock is only taken
+// when the pool grows. There are no per-thread caches: the only user of the
+// allocator, the node caches of ShardedQuarantine, already calls it under the
+// lock of the shard that owns it, and the small-block traffic from each thread
+// is batched upstream by the BlockHeapManager thread caches.
 //
 // Since memory is not actively recovered at runtime this allocator will always
 // use as much memory as the 'high waterline'. Thus, it is not suitable for
@@ -26,6 +31,7 @@
 #ifndef SYZYGY_AGENT_ASAN_PAGE_ALLOCATOR_H_
 #define SYZYGY_AGENT_ASAN_PAGE_ALLOCATOR_H_
 
+#include "base/atomicops.h"
 #include "base/synchronization/lock.h"
 
 namespace agent {
@@ -36,6 +42,7 @@ struct PageAllocatorStatistics;
 namespace detail {
 template<bool kKeepStats> struct PageAllocatorStatisticsHelper;
 template<size_t kObjectSize, size_t kPageSize> struct PageAllocatorPage;
+template<typename ObjectType> class PageAllocatorFreeList;
 }  // namespace detail
 
 
@@ -66,6 +73,7 @@ class PageAllocator {
  public:
   typedef detail::PageAllocatorPage<kObjectSize, kPageSize> Page;
   typedef typename Page::Object Object;
+  typedef detail::PageAllocatorFreeList<Object> FreeList;
 
   // Constructor.
   PageAllocator();
@@ -145,29 +153,52 @@ class PageAllocator {
   //     specified size class will be checked.
   // @returns true if the given object is the first object in a range that was
   //     freed by the allocator.
-  // @note Handles locking, so no locks must already be held.
+  // @note Handles locking, so no locks must already be held. The free lists
+  //     are lock-free, so the result is only exact if the allocator isn't
+  //     concurrently used.
   bool IsInFreeList(const void* object, size_t count);
 
+  // Determines if an object lies in one of the pages of this allocator, at
+  // an object boundary.
+  // @param object The object to be checked.
+  // @returns true if the object belongs to this allocator.
+  // @note Handles locking, so no locks must already be held.
+  bool IsObjectInPages(const Object* object);
+
   // Pops the top item from the given free list.
   // @param count The size class.
   // @returns a pointer to the popped item, NULL if there was none.
-  // @note Handles locking, so no free_lock_ should be already held.
+  // @note This is lock-free.
   Object* FreePop(size_t count);
 
   // Pushes the given object to the specified free list. Directives as to
   // statistics keeping are provided directly here to minimize the number of
-  // times the statistics lock needs to be taken.
+  // times the statistics need to be updated.
   // @param object The objects to free.
   // @param count The number of objects to free.
   // @param decr_alloc_groups If true then decrements allocated_groups.
   // @param decr_alloc_objects If true then decrements allocated_object.
-  // @note Handles locking, so no free_lock_ should be already held.
+  // @note This is lock-free.
   void FreePush(Object* object, size_t count,
                 bool decr_alloc_groups, bool decr_alloc_objects);
 
-  // Reserves a new page of objects, modifying current_page_ and
-  // current_object_. Any remaining unallocated objects are stuffed into the
-  // appropriate freed list. There may be no more than kMaxObjectCount of them.
+  // Carves objects out of the active page.
+  // @param count The number of objects to allocate.
+  // @returns a pointer to the allocated objects, NULL if the active page
+  //     doesn't have enough room left.
+  // @note This is lock-free.
+  Object* AllocateFromPage(size_t count);
+
+  // @returns the address of object_, for use with the atomic operations.
+  volatile base::subtle::AtomicWord* ObjectCursor();
+
+  // @returns the current value of object_. This is only a snapshot, unless
+  //     lock_ is held and a page is active.
+  Object* LoadObjectCursor();
+
+  // Reserves a new page of objects, modifying page_ and object_. Any
+  // remaining unallocated objects are stuffed into the appropriate freed list.
+  // There may be no more than kMaxObjectCount of them.
   // @returns true if the allocation was successful, false otherwise.
   // @note Assumes the lock_ has already been acquired.
   bool AllocatePageLocked();
@@ -182,17 +213,15 @@ class PageAllocator {
   // The currently active page. Under lock_.
   Page* page_;
 
-  // The next object to be allocated in the current page. Under lock_.
+  // The next object to be allocated in the current page. This is advanced
+  // with a compare-and-swap, and only replaced under lock_. It is set to
+  // nullptr while the active page is being replaced.
   Object* object_;
 
-  // A singly linked list of freed objects, one per possible size category.
-  // These are under the corresponding free_lock_.
-  Object* free_[kMaxObjectCount];
-
-  // Locks for the freed lists. This keeps contention down while freeing.
-  base::Lock free_lock_[kMaxObjectCount];
+  // The lock-free lists of freed objects, one per possible size category.
+  FreeList free_[kMaxObjectCount];
 
-  // The global lock for the allocator.
+  // The global lock for the allocator. This is only taken to grow the pool.
   base::Lock lock_;
 
   // For keeping statistics. If kKeepStats == 0 this is an empty struct with
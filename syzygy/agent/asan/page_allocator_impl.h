@@ -22,6 +22,7 @@
 
 #include <algorithm>
 
+#include "base/atomicops.h"
 #include "base/logging.h"
 #include "syzygy/agent/asan/constants.h"
 #include "syzygy/common/align.h"
@@ -33,8 +34,6 @@ namespace detail {
 
 // Empty statistics helper.
 template<> struct PageAllocatorStatisticsHelper<false> {
-  void Lock() { }
-  void Unlock() { }
   template<size_t PageAllocatorStatistics::*stat> void Increment(size_t) { }
   template<size_t PageAllocatorStatistics::*stat> void Decrement(size_t) { }
   void GetStatistics(PageAllocatorStatistics* stats) const {
@@ -43,34 +42,53 @@ template<> struct PageAllocatorStatisticsHelper<false> {
   }
 };
 
-// Actual statistics helper.
+// Actual statistics helper. The counters are updated atomically so that
+// keeping statistics doesn't serialize the allocator. A snapshot of the
+// counters taken while the allocator is in use may be slightly inconsistent.
 template<> struct PageAllocatorStatisticsHelper<true> {
+  static_assert(sizeof(size_t) == sizeof(base::subtle::AtomicWord),
+                "Statistics can't be updated atomically.");
+
   PageAllocatorStatisticsHelper() {
     ::memset(&stats, 0, sizeof(stats));
   }
 
-  void Lock() { lock.Acquire(); }
-  void Unlock() { lock.Release(); }
-
   template<size_t PageAllocatorStatistics::*member>
   void Increment(size_t amount) {
-    lock.AssertAcquired();
-    stats.*member += amount;
+    base::subtle::NoBarrier_AtomicIncrement(
+        Counter<member>(), static_cast<base::subtle::AtomicWord>(amount));
   }
 
   template<size_t PageAllocatorStatistics::*member>
   void Decrement(size_t amount) {
-    lock.AssertAcquired();
-    stats.*member -= amount;
+    base::subtle::NoBarrier_AtomicIncrement(
+        Counter<member>(), -static_cast<base::subtle::AtomicWord>(amount));
   }
 
   void GetStatistics(PageAllocatorStatistics* stats) const {
-    lock.AssertAcquired();
     DCHECK_NE(static_cast<PageAllocatorStatistics*>(nullptr), stats);
-    *stats = this->stats;
+    stats->page_count = Load<&PageAllocatorStatistics::page_count>();
+    stats->allocated_groups =
+        Load<&PageAllocatorStatistics::allocated_groups>();
+    stats->allocated_objects =
+        Load<&PageAllocatorStatistics::allocated_objects>();
+    stats->freed_groups = Load<&PageAllocatorStatistics::freed_groups>();
+    stats->freed_objects = Load<&PageAllocatorStatistics::freed_objects>();
+  }
+
+  template<size_t PageAllocatorStatistics::*member>
+  volatile base::subtle::AtomicWord* Counter() {
+    return reinterpret_cast<volatile base::subtle::AtomicWord*>(
+        &(stats.*member));
+  }
+
+  template<size_t PageAllocatorStatistics::*member>
+  size_t Load() const {
+    return static_cast<size_t>(base::subtle::NoBarrier_Load(
+        reinterpret_cast<const volatile base::subtle::AtomicWord*>(
+            &(stats.*member))));
   }
 
-  base::Lock lock;
   PageAllocatorStatistics stats;
 };
 
@@ -87,6 +105,101 @@ struct PageAllocatorObject {
 };
 
 
+// A lock-free LIFO list of freed objects, chained via their next_free field.
+// The head pointer is packed with a tag that is bumped on every pop. This
+// protects against the ABA problem, where an object is popped, reused and
+// pushed back between the moment another thread reads the head and the
+// moment it tries to swap it. The pages of an allocator are only released
+// by its destructor, so reading the link of an object that was concurrently
+// popped is always safe: the compare-and-swap will simply fail.
+template<typename ObjectType>
+class PageAllocatorFreeList {
+ public:
+  PageAllocatorFreeList() : head_(0) { }
+
+  // @returns the object at the top of the list. This is only a snapshot when
+  //     the list is used concurrently.
+  ObjectType* head() const { return Unpack(Load()); }
+
+  // @returns true if the list is empty. This is only a snapshot when the list
+  //     is used concurrently.
+  bool empty() const { return head() == nullptr; }
+
+  // Pushes an object at the top of the list.
+  // @param object The object to push.
+  void Push(ObjectType* object) {
+    DCHECK_NE(static_cast<ObjectType*>(nullptr), object);
+    LONGLONG head = Load();
+    while (true) {
+      object->next_free = Unpack(head);
+      LONGLONG prev = ::InterlockedCompareExchange64(
+          &head_, Pack(object, Tag(head)), head);
+      if (prev == head)
+        return;
+      head = prev;
+    }
+  }
+
+  // Pops the object at the top of the list.
+  // @returns the popped object, nullptr if the list is empty.
+  ObjectType* Pop() {
+    LONGLONG head = Load();
+    while (true) {
+      ObjectType* object = Unpack(head);
+      if (object == nullptr)
+        return nullptr;
+      LONGLONG prev = ::InterlockedCompareExchange64(
+          &head_, Pack(object->next_free, Tag(head) + 1), head);
+      if (prev == head) {
+        object->next_free = nullptr;
+        return object;
+      }
+      head = prev;
+    }
+  }
+
+ private:
+  // The number of bits of the head used by the pointer. The user-mode
+  // addresses fit in 48 bits on 64-bit Windows.
+#ifdef _WIN64
+  static const size_t kPointerBits = 48;
+#else
+  static const size_t kPointerBits = 32;
+#endif
+  static const ULONGLONG kPointerMask = (1ULL << kPointerBits) - 1;
+
+  static LONGLONG Pack(ObjectType* object, ULONGLONG tag) {
+    ULONGLONG address = reinterpret_cast<uintptr_t>(object);
+    DCHECK_EQ(address, address & kPointerMask);
+    return static_cast<LONGLONG>(address | (tag << kPointerBits));
+  }
+
+  static ObjectType* Unpack(LONGLONG head) {
+    return reinterpret_cast<ObjectType*>(
+        static_cast<uintptr_t>(static_cast<ULONGLONG>(head) & kPointerMask));
+  }
+
+  static ULONGLONG Tag(LONGLONG head) {
+    return static_cast<ULONGLONG>(head) >> kPointerBits;
+  }
+
+  LONGLONG Load() const {
+#ifdef _WIN64
+    return head_;
+#else
+    // A 64-bit read isn't atomic on x86, but a no-op compare-and-swap is.
+    return ::InterlockedCompareExchange64(
+        const_cast<volatile LONGLONG*>(&head_), 0, 0);
+#endif
+  }
+
+  // The tagged head of the list. This must be 8-byte aligned for the
+  // interlocked operations to be atomic.
+  __declspec(align(8)) volatile LONGLONG head_;
+
+  DISALLOW_COPY_AND_ASSIGN(PageAllocatorFreeList);
+};
+
 template<size_t kMinPageSize>
 struct PageAllocatorPageSize {
   // The kPageSize calculation below presumes a 64KB allocation
@@ -156,9 +269,6 @@ PageAllocator()
   static_assert(sizeof(Object) < kObjectSize + 4, "Object is too large.");
   static_assert(kPageSize <= sizeof(Page), "Page is too small.");
   static_assert(sizeof(Page) % kUsualPageSize == 0, "Invalid page size.");
-
-  // Clear the freelists.
-  ::memset(free_, 0, sizeof(free_));
 }
 
 template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
@@ -227,52 +337,42 @@ Allocate(size_t count, size_t* received) {
   // first one that's big enough, and stuff the leftover objects into another
   // freed list.
   for (size_t n = count; n <= kMaxObjectCount; ++n) {
-    // This is racy and can end up lying to us. However, it's faster to first
-    // check this outside of the lock. We do this properly afterwards.
-    if (free_[n - 1] == nullptr)
+    // This is racy and can end up lying to us. However, it's cheaper to first
+    // check this before attempting to pop.
+    if (free_[n - 1].empty())
       continue;
 
-    // Unlink the objects from the free list of size n. This actually acquires
-    // the appropriate free-list lock.
+    // Unlink the objects from the free list of size n.
     object = FreePop(n);
     if (object == nullptr)
       continue;
 
     // Update statistics.
-    stats_.Lock();
     stats_.Increment<&PageAllocatorStatistics::allocated_groups>(1);
     stats_.Increment<&PageAllocatorStatistics::allocated_objects>(n);
-    stats_.Unlock();
 
     *received = n;
     return object;
   }
 
-  // Get the object from a page. Try the active page first and allocate a new
-  // one if need be.
-  {
+  // Get the object from the active page. This only takes the lock if a new
+  // page needs to be allocated.
+  object = AllocateFromPage(count);
+  if (object == nullptr) {
     base::AutoLock lock(lock_);
 
-    // If the current page is not big enough for the requested allocation then
-    // get a new page.
-    if (page_ == nullptr || page_->end() - object_ < count) {
+    // Another thread may have allocated a new page in the meantime. The
+    // concurrent lock-free allocations may also exhaust a freshly allocated
+    // page, hence the loop.
+    while ((object = AllocateFromPage(count)) == nullptr) {
       if (!AllocatePageLocked())
         return nullptr;
     }
-
-    DCHECK_NE(static_cast<Page*>(nullptr), page_);
-    DCHECK_LT(object_, page_->end());
-
-    // Grab a copy of the cursor and advance it.
-    object = object_;
-    object_ += count;
   }
 
   // Update statistics.
-  stats_.Lock();
   stats_.Increment<&PageAllocatorStatistics::allocated_groups>(1);
   stats_.Increment<&PageAllocatorStatistics::allocated_objects>(count);
-  stats_.Unlock();
 
   *received = count;
   return object;
@@ -303,10 +403,7 @@ template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
 void PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
 GetStatistics(PageAllocatorStatistics* stats) {
   DCHECK_NE(static_cast<PageAllocatorStatistics*>(nullptr), stats);
-
-  stats_.Lock();
   stats_.GetStatistics(stats);
-  stats_.Unlock();
 }
 
 template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
@@ -346,8 +443,8 @@ WasOnceAllocated(const void* object, size_t count) {
     }
 
     // If the allocation hasn't yet been handed out then this page does not own
-    // it.
-    if (page == page_ && object_end > object_)
+    // it. The cursor can't be reset while lock_ is held.
+    if (page == page_ && object_end > LoadObjectCursor())
       return false;
 
     // Determine if it's aligned as expected.
@@ -386,13 +483,15 @@ IsInFreeList(const void* object, size_t count) {
 
   // Iterate over the applicable size classes.
   for (size_t n = n_min; n <= n_max; ++n) {
-    base::AutoLock lock(free_lock_[n - 1]);
-
-    // Walk the list for this size class.
-    Object* free = free_[n - 1];
+    // Walk the list for this size class. The objects in the list may
+    // concurrently be handed out and overwritten, so validate each link
+    // before following it.
+    Object* free = free_[n - 1].head();
     while (free) {
       if (free == object)
         return true;
+      if (!IsObjectInPages(free))
+        break;
 
       // Jump to the next freed object in this size class.
       free = free->next_free;
@@ -412,20 +511,13 @@ PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
   DCHECK_LT(0u, count);
   DCHECK_GE(kMaxObjectCount, count);
 
-  Object* object = nullptr;
-  {
-    base::AutoLock lock(free_lock_[count - 1]);
-    object = free_[count - 1];
-    if (object)
-      free_[count - 1] = object->next_free;
-  }
-  object->next_free = nullptr;
+  Object* object = free_[count - 1].Pop();
+  if (object == nullptr)
+    return nullptr;
 
   // Update statistics.
-  stats_.Lock();
   stats_.Decrement<&PageAllocatorStatistics::freed_groups>(1);
   stats_.Decrement<&PageAllocatorStatistics::freed_objects>(count);
-  stats_.Unlock();
 
   return object;
 }
@@ -439,21 +531,49 @@ void PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
   DCHECK_LT(0u, count);
   DCHECK_GE(kMaxObjectCount, count);
 
-  {
-    base::AutoLock lock(free_lock_[count - 1]);
-    object->next_free = free_[count - 1];
-    free_[count - 1] = object;
-  }
+  free_[count - 1].Push(object);
 
   // Update statistics.
-  stats_.Lock();
   if (decr_alloc_groups)
     stats_.Decrement<&PageAllocatorStatistics::allocated_groups>(1);
   if (decr_alloc_objects)
     stats_.Decrement<&PageAllocatorStatistics::allocated_objects>(count);
   stats_.Increment<&PageAllocatorStatistics::freed_groups>(1);
   stats_.Increment<&PageAllocatorStatistics::freed_objects>(count);
-  stats_.Unlock();
+}
+
+template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
+         bool kKeepStats>
+typename
+PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::Object*
+PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
+    AllocateFromPage(size_t count) {
+  DCHECK_LT(0u, count);
+  DCHECK_GE(kMaxObjectCount, count);
+
+  while (true) {
+    // The cursor is published after page_, so reading it first ensures that
+    // the page read afterwards is the one it points into.
+    Object* object = LoadObjectCursor();
+    if (object == nullptr)
+      return nullptr;
+    const Page* page = page_;
+    DCHECK_NE(static_cast<const Page*>(nullptr), page);
+    if (object < page->objects || object > page->end()) {
+      // The active page was replaced between the two reads.
+      continue;
+    }
+    if (static_cast<size_t>(page->end() - object) < count)
+      return nullptr;
+
+    // Advance the cursor. This fails if another thread moved it first, or if
+    // the active page is being replaced.
+    base::subtle::AtomicWord prev = base::subtle::NoBarrier_CompareAndSwap(
+        ObjectCursor(), reinterpret_cast<base::subtle::AtomicWord>(object),
+        reinterpret_cast<base::subtle::AtomicWord>(object + count));
+    if (prev == reinterpret_cast<base::subtle::AtomicWord>(object))
+      return object;
+  }
 }
 
 template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
@@ -462,20 +582,6 @@ bool PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
     AllocatePageLocked() {
   lock_.AssertAcquired();
 
-  // If there are remaining objects stuff them into the appropriately sized
-  // free list.
-  // NOTE: If this is a point of contention it could be moved to be outside
-  //     the scoped of lock_.
-  if (page_ && object_ < page_->end()) {
-    size_t n = page_->end() - object_;
-    DCHECK_LT(0u, n);
-    DCHECK_GE(kMaxObjectCount, n);
-
-    // These are objects that have never been allocated, so don't affect the
-    // number of allocated groups or objects.
-    FreePush(object_, n, false, false);
-  }
-
   Page* slab_end = slab_ + Page::kPagesPerSlab;
 
   // Grab a new slab if needed.
@@ -500,21 +606,76 @@ bool PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
   // Update the slab cursor.
   ++slab_cursor_;
 
+  // Detach the cursor from the active page. From here on the concurrent
+  // lock-free allocations fail, and fall back to waiting on lock_.
+  Object* object = reinterpret_cast<Object*>(
+      base::subtle::NoBarrier_AtomicExchange(ObjectCursor(), 0));
+
+  // If there are remaining objects stuff them into the appropriately sized
+  // free list.
+  if (page_ && object < page_->end()) {
+    DCHECK_NE(static_cast<Object*>(nullptr), object);
+    size_t n = page_->end() - object;
+    DCHECK_LT(0u, n);
+    DCHECK_GE(kMaxObjectCount, n);
+
+    // These are objects that have never been allocated, so don't affect the
+    // number of allocated groups or objects.
+    FreePush(object, n, false, false);
+  }
+
   // Keep a pointer to the previous page, and set up the next object pointer.
+  // The cursor is published last, as the lock-free allocations rely on it
+  // pointing into page_.
   page->prev_page = page_;
   page_ = page;
-  object_ = page->objects;
   ++page_count_;
+  base::subtle::Release_Store(
+      ObjectCursor(), reinterpret_cast<base::subtle::AtomicWord>(page->objects));
 
   // Update statistics.
-  // NOTE: This can also be moved out from under lock_.
-  stats_.Lock();
   stats_.Increment<&PageAllocatorStatistics::page_count>(1);
-  stats_.Unlock();
 
   return true;
 }
 
+template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
+         bool kKeepStats>
+volatile base::subtle::AtomicWord*
+PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
+    ObjectCursor() {
+  static_assert(sizeof(Object*) == sizeof(base::subtle::AtomicWord),
+                "The cursor can't be updated atomically.");
+  return reinterpret_cast<volatile base::subtle::AtomicWord*>(&object_);
+}
+
+template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
+         bool kKeepStats>
+typename
+PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::Object*
+PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
+    LoadObjectCursor() {
+  return reinterpret_cast<Object*>(base::subtle::Acquire_Load(ObjectCursor()));
+}
+
+template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
+         bool kKeepStats>
+bool PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
+    IsObjectInPages(const Object* object) {
+  base::AutoLock lock(lock_);
+
+  const Page* page = page_;
+  while (page) {
+    if (object >= page->objects && object < page->end()) {
+      size_t offset = reinterpret_cast<const uint8_t*>(object) -
+                      reinterpret_cast<const uint8_t*>(page->objects);
+      return (offset % sizeof(Object)) == 0;
+    }
+    page = page->prev_page;
+  }
+  return false;
+}
+
 template<typename ObjectType, size_t kMaxObjectCount, size_t kPageSize,
          bool kKeepStats>
 ObjectType*
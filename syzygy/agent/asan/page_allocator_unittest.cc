@@ -14,6 +14,10 @@
 
 #include "syzygy/agent/asan/page_allocator.h"
 
+#include <memory>
+#include <vector>
+
+#include "base/threading/simple_thread.h"
 #include "gtest/gtest.h"
 
 namespace agent {
@@ -48,7 +52,7 @@ class TestPageAllocator
 
     size_t free_objects = 0;
     for (size_t n = n_min; n <= n_max; ++n) {
-      Object* free = free_[n - 1];
+      Object* free = free_[n - 1].head();
       while (free) {
         free_objects += n;
         free = free->next_free;
@@ -86,6 +90,48 @@ class TestTypedPageAllocator
 typedef TestPageAllocator<16, 1, 4096> TestPageAllocator255;
 typedef TestPageAllocator<16, 10, 4096> TestPageAllocatorMulti255;
 
+// Allocates and frees objects of varying sizes, checking that they aren't
+// handed out to another thread while in use.
+class AllocateAndFreeDelegate : public base::DelegateSimpleThread::Delegate {
+ public:
+  static const size_t kIterations = 2000;
+  static const size_t kLiveAllocations = 16;
+
+  AllocateAndFreeDelegate(TestPageAllocatorMulti255* pa, uint8_t tag)
+      : pa_(pa), tag_(tag), corrupt_(false) {
+  }
+
+  void Run() override {
+    struct Allocation {
+      uint8_t* object;
+      size_t count;
+    };
+    std::vector<Allocation> allocations(kLiveAllocations);
+    for (size_t i = 0; i < kIterations; ++i) {
+      Allocation& allocation = allocations[i % kLiveAllocations];
+      if (allocation.object != nullptr) {
+        for (size_t j = 0; j < allocation.count * 16; ++j)
+          corrupt_ |= allocation.object[j] != tag_;
+        pa_->Free(allocation.object, allocation.count);
+      }
+      size_t count = (i % 10) + 1;
+      allocation.object = reinterpret_cast<uint8_t*>(
+          pa_->Allocate(count, &allocation.count));
+      ASSERT_NE(static_cast<uint8_t*>(nullptr), allocation.object);
+      ::memset(allocation.object, tag_, allocation.count * 16);
+    }
+    for (const auto& allocation : allocations)
+      pa_->Free(allocation.object, allocation.count);
+  }
+
+  bool corrupt() const { return corrupt_; }
+
+ private:
+  TestPageAllocatorMulti255* pa_;
+  uint8_t tag_;
+  bool corrupt_;
+};
+
 }  // namespace
 
 TEST(PageAllocatorTest, Constructor) {
@@ -93,14 +139,14 @@ TEST(PageAllocatorTest, Constructor) {
   EXPECT_EQ(255, TestPageAllocator255::Page::kObjectsPerPage);
   EXPECT_TRUE(pa.page_ == nullptr);
   EXPECT_TRUE(pa.object_ == nullptr);
-  EXPECT_TRUE(pa.free_[0] == nullptr);
+  EXPECT_TRUE(pa.free_[0].empty());
 
   TestPageAllocatorMulti255 mpa;
   EXPECT_EQ(255, TestPageAllocatorMulti255::Page::kObjectsPerPage);
   EXPECT_TRUE(mpa.page_ == nullptr);
   EXPECT_TRUE(mpa.object_ == nullptr);
   for (size_t i = 0; i < arraysize(mpa.free_); ++i)
-    EXPECT_TRUE(mpa.free_[i] == nullptr);
+    EXPECT_TRUE(mpa.free_[i].empty());
 }
 
 TEST(PageAllocatorTest, AllocatePage) {
@@ -401,6 +447,33 @@ TEST(PageAllocatorTest, MultiSlabsPagesBiggerThanAllGranularity) {
     pa.Allocate(1);
 }
 
+TEST(PageAllocatorTest, ConcurrentAllocsAndFrees) {
+  const size_t kThreadCount = 4;
+  TestPageAllocatorMulti255 pa;
+
+  std::vector<std::unique_ptr<AllocateAndFreeDelegate>> delegates;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    delegates.push_back(std::unique_ptr<AllocateAndFreeDelegate>(
+        new AllocateAndFreeDelegate(&pa, static_cast<uint8_t>(i + 1))));
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(delegates.back().get(),
+                                       "page_allocator_test")));
+  }
+  for (auto& thread : threads)
+    thread->Start();
+  for (auto& thread : threads)
+    thread->Join();
+
+  for (const auto& delegate : delegates)
+    EXPECT_FALSE(delegate->corrupt());
+
+  // Everything has been returned to the free lists.
+  EXPECT_EQ(0u, pa.stats().allocated_groups);
+  EXPECT_EQ(0u, pa.stats().allocated_objects);
+  EXPECT_EQ(pa.FreeObjects(0), pa.stats().freed_objects);
+}
+
 TEST(TypedPageAllocatorTest, SingleEndToEnd) {
   TypedPageAllocator<size_t, 1, 1000, true> pa;
   for (size_t i = 0; i < 1600; ++i) {
@@ -14,9 +14,42 @@
 
 #include "syzygy/agent/asan/page_protection_helpers.h"
 
+#include <algorithm>
+#include <utility>
+#include <vector>
+
 namespace agent {
 namespace asan {
 
+namespace {
+
+// Determines if any of the given pages is marked as protected in the shadow.
+bool AnyPageIsProtected(const uint8_t* pages, size_t size,
+                        const Shadow* shadow) {
+  const uint8_t* pages_end = pages + size;
+  for (; pages < pages_end; pages += GetPageSize()) {
+    if (shadow->PageIsProtected(pages))
+      return true;
+  }
+  return false;
+}
+
+// Unprotects a range of pages and updates the shadow accordingly.
+// @returns false if the protections couldn't be modified.
+bool TryProtectNone(uint8_t* pages, size_t size, Shadow* shadow) {
+  DWORD old_protection = 0;
+  if (!::VirtualProtect(pages, size, PAGE_READWRITE, &old_protection))
+    return false;
+  shadow->MarkPagesUnprotected(pages, size);
+  return true;
+}
+
+void ProtectNone(uint8_t* pages, size_t size, Shadow* shadow) {
+  CHECK(TryProtectNone(pages, size, shadow));
+}
+
+}  // namespace
+
 // TODO(chrisha): Move the page protections bits out of the shadow to an entire
 //     class that lives here. Or move all of this to shadow.
 
@@ -65,14 +98,76 @@ void BlockProtectNone(const BlockInfo& block_info, Shadow* shadow) {
     return;
 
   ::common::AutoRecursiveLock lock(block_protect_lock);
+  BlockProtectNoneUnlocked(block_info, shadow);
+}
+
+void BlockProtectNoneUnlocked(const BlockInfo& block_info, Shadow* shadow) {
+  DCHECK_NE(static_cast<Shadow*>(nullptr), shadow);
+  if (block_info.block_pages_size == 0)
+    return;
+
   DCHECK_NE(static_cast<uint8_t*>(nullptr), block_info.block_pages);
-  DWORD old_protection = 0;
-  DWORD ret = ::VirtualProtect(block_info.block_pages,
-                               block_info.block_pages_size,
-                               PAGE_READWRITE, &old_protection);
-  CHECK_NE(0u, ret);
-  shadow->MarkPagesUnprotected(block_info.block_pages,
-                               block_info.block_pages_size);
+
+  // The page bits of the shadow are only modified under block_protect_lock,
+  // and pages that aren't marked as protected are always accessible. This
+  // avoids a system call when a block gets unprotected several times on its
+  // way out of the quarantine.
+  if (!AnyPageIsProtected(block_info.block_pages,
+                          block_info.block_pages_size, shadow)) {
+    return;
+  }
+
+  ProtectNone(block_info.block_pages, block_info.block_pages_size, shadow);
+}
+
+void BlockProtectNoneBatch(const BlockInfo* block_infos,
+                           size_t count,
+                           Shadow* shadow) {
+  DCHECK(block_infos != nullptr || count == 0);
+  DCHECK_NE(static_cast<Shadow*>(nullptr), shadow);
+
+  // Gather the page ranges that actually need to be unprotected.
+  typedef std::pair<uint8_t*, size_t> PageRange;
+  std::vector<PageRange> ranges;
+  ranges.reserve(count);
+
+  ::common::AutoRecursiveLock lock(block_protect_lock);
+  for (size_t i = 0; i < count; ++i) {
+    const BlockInfo& block_info = block_infos[i];
+    if (block_info.block_pages_size == 0)
+      continue;
+    DCHECK_NE(static_cast<uint8_t*>(nullptr), block_info.block_pages);
+    if (!AnyPageIsProtected(block_info.block_pages,
+                            block_info.block_pages_size, shadow)) {
+      continue;
+    }
+    ranges.push_back(
+        PageRange(block_info.block_pages, block_info.block_pages_size));
+  }
+  if (ranges.empty())
+    return;
+
+  // Coalesce the contiguous ranges and unprotect each run at once. A run can
+  // only be unprotected at once if it lies in a single reservation, so fall
+  // back to unprotecting its ranges one at a time if that fails.
+  std::sort(ranges.begin(), ranges.end());
+  size_t run_begin = 0;
+  while (run_begin < ranges.size()) {
+    size_t run_end = run_begin + 1;
+    size_t run_size = ranges[run_begin].second;
+    while (run_end < ranges.size() &&
+           ranges[run_begin].first + run_size == ranges[run_end].first) {
+      run_size += ranges[run_end].second;
+      ++run_end;
+    }
+
+    if (run_end - run_begin == 1 ||
+        !TryProtectNone(ranges[run_begin].first, run_size, shadow)) {
+      for (size_t i = run_begin; i < run_end; ++i)
+        ProtectNone(ranges[i].first, ranges[i].second, shadow);
+    }
+    run_begin = run_end;
+  }
 }
 
 void BlockProtectRedzones(const BlockInfo& block_info, Shadow* shadow) {
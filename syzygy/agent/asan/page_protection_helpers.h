@@ -50,12 +50,30 @@ bool GetBlockInfo(const Shadow* shadow,
 
 // Unprotects all pages fully covered by the given block. All pages
 // intersecting but not fully covered by the block will be left in their
-// current state.
+// current state. This is a noop if the shadow reports that none of these pages
+// are protected.
 // @param block_info The block whose protections are to be modified.
 // @param shadow The shadow to update.
 // @note Under block_protect_lock.
 void BlockProtectNone(const BlockInfo& block_info, Shadow* shadow);
 
+// Same as BlockProtectNone, for a batch of blocks. The protection changes of
+// blocks whose pages are contiguous are coalesced, which is much cheaper than
+// unprotecting them one at a time.
+// @param block_infos The blocks whose protections are to be modified.
+// @param count The number of blocks.
+// @param shadow The shadow to update.
+// @note Under block_protect_lock.
+void BlockProtectNoneBatch(const BlockInfo* block_infos,
+                           size_t count,
+                           Shadow* shadow);
+
+// Same as BlockProtectNone, but doesn't acquire block_protect_lock. This is
+// meant for the helper threads of a thread that holds the lock on their behalf.
+// @param block_info The block whose protections are to be modified.
+// @param shadow The shadow to update.
+void BlockProtectNoneUnlocked(const BlockInfo& block_info, Shadow* shadow);
+
 // Protects all entire pages that are spanned by the redzones of the
 // block. All pages intersecting the body of the block will be explicitly
 // unprotected. All pages not intersecting the body but only partially
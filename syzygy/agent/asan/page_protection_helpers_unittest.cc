@@ -305,5 +305,48 @@ TEST_F(PageProtectionHelpersTest, BlockProtectAuto) {
   ASSERT_EQ(TRUE, ::VirtualFree(alloc, 0, MEM_RELEASE));
 }
 
+TEST_F(PageProtectionHelpersTest, BlockProtectNoneBatch) {
+  const size_t kBlockCount = 5;
+  BlockLayout layout = {};
+  const uint32_t kPageSize = static_cast<uint32_t>(GetPageSize());
+  EXPECT_TRUE(BlockPlanLayout(kPageSize, kPageSize, kPageSize, kPageSize,
+                              kPageSize, &layout));
+  uint8_t* alloc = reinterpret_cast<uint8_t*>(::VirtualAlloc(
+      NULL, kBlockCount * layout.block_size, MEM_COMMIT, PAGE_READWRITE));
+  ASSERT_TRUE(alloc != NULL);
+
+  // Lay out contiguous blocks, listed out of order.
+  BlockInfo block_infos[kBlockCount] = {};
+  for (size_t i = 0; i < kBlockCount; ++i) {
+    size_t position = (i * 3) % kBlockCount;
+    BlockInitialize(layout, alloc + position * layout.block_size,
+                    &block_infos[i]);
+  }
+
+  // Unprotect all the blocks at once.
+  for (const auto& block_info : block_infos)
+    BlockProtectAll(block_info, &shadow_);
+  BlockProtectNoneBatch(block_infos, kBlockCount, &shadow_);
+  for (const auto& block_info : block_infos) {
+    EXPECT_FALSE(shadow_.PageIsProtected(block_info.block_pages));
+    EXPECT_NO_FATAL_FAILURE(
+        TestAccessUnderProtection(block_info, kProtectNone));
+  }
+
+  // Only some of the blocks are protected.
+  BlockProtectAll(block_infos[1], &shadow_);
+  BlockProtectRedzones(block_infos[3], &shadow_);
+  BlockProtectNoneBatch(block_infos, kBlockCount, &shadow_);
+  for (const auto& block_info : block_infos) {
+    EXPECT_NO_FATAL_FAILURE(
+        TestAccessUnderProtection(block_info, kProtectNone));
+  }
+
+  // An empty batch is a noop.
+  BlockProtectNoneBatch(nullptr, 0, &shadow_);
+
+  ASSERT_EQ(TRUE, ::VirtualFree(alloc, 0, MEM_RELEASE));
+}
+
 }  // namespace asan
 }  // namespace agent
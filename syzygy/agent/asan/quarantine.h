@@ -89,6 +89,27 @@ class QuarantineInterface {
   // @returns a PushResult.
   virtual PushResult Push(const Object& object) = 0;
 
+  // Places a batch of allocations in the quarantine. Unlike Push this routine
+  // implements its own locking, which allows implementations to amortize it
+  // over the batch.
+  // @param objects The objects to place in the quarantine.
+  // @param count The number of objects.
+  // @param pushed Is filled in with the success of each individual push. Must
+  //     have room for |count| entries.
+  // @returns the trim status accumulated over the batch.
+  virtual TrimStatus PushBatch(const Object* objects,
+                               size_t count,
+                               bool* pushed) {
+    TrimStatus trim_status = TRIM_NOT_REQUIRED;
+    for (size_t i = 0; i < count; ++i) {
+      AutoQuarantineLock quarantine_lock(this, objects[i]);
+      PushResult result = Push(objects[i]);
+      pushed[i] = result.push_successful;
+      trim_status |= result.trim_status;
+    }
+    return trim_status;
+  }
+
   // Potentially removes an object from the quarantine to maintain the
   // invariant. This routine must be thread-safe, and implement its own locking.
   // @param object Is filled in with a copy of the removed object.
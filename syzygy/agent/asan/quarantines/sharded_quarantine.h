@@ -20,6 +20,7 @@
 #include "base/synchronization/lock.h"
 #include "syzygy/agent/asan/page_allocator.h"
 #include "syzygy/agent/asan/quarantines/size_limited_quarantine.h"
+#include "syzygy/agent/asan/runtime_stats.h"
 
 namespace agent {
 namespace asan {
@@ -68,8 +69,14 @@ class ShardedQuarantine
   size_t GetLockIdImpl(const Object& object) override;
   void LockImpl(size_t id) override;
   void UnlockImpl(size_t id) override;
+  void PushBatchImpl(const Object* objects,
+                     size_t count,
+                     bool* pushed) override;
   // @}
 
+  // The number of objects whose shards are computed at once by PushBatchImpl.
+  static const size_t kPushBatchChunkSize = 64;
+
   // The internal type used for storing objects. This augments them with a
   // 'next' pointer for chaining them together in the cache. These live in
   // a simple page-allocator.
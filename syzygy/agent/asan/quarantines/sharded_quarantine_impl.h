@@ -20,6 +20,8 @@
 
 #include "string.h"
 
+#include <algorithm>
+
 namespace agent {
 namespace asan {
 namespace quarantines {
@@ -157,6 +159,10 @@ size_t ShardedQuarantine<OT, SFT, HFT, SF>::GetLockIdImpl(
 template<typename OT, typename SFT, typename HFT, size_t SF>
 void ShardedQuarantine<OT, SFT, HFT, SF>::LockImpl(size_t id) {
   DCHECK_LT(id, kShardingFactor);
+  if (locks_[id].Try())
+    return;
+  RuntimeStats::Instance()->Increment(
+      RuntimeStats::kQuarantineLockContentions);
   locks_[id].Acquire();
 }
 
@@ -167,6 +173,41 @@ void ShardedQuarantine<OT, SFT, HFT, SF>::UnlockImpl(size_t id) {
   locks_[id].Release();
 }
 
+template<typename OT, typename SFT, typename HFT, size_t SF>
+void ShardedQuarantine<OT, SFT, HFT, SF>::PushBatchImpl(const Object* objects,
+                                                         size_t count,
+                                                         bool* pushed) {
+  DCHECK_NE(static_cast<const Object*>(NULL), objects);
+  DCHECK_NE(static_cast<bool*>(NULL), pushed);
+
+  // Group the objects by shard so that each shard lock is only acquired once
+  // per chunk of objects. kShardingFactor is used to mark the objects that
+  // have already been handled.
+  size_t shards[kPushBatchChunkSize];
+  for (size_t offset = 0; offset < count; offset += kPushBatchChunkSize) {
+    size_t chunk_size = std::min(kPushBatchChunkSize, count - offset);
+    for (size_t i = 0; i < chunk_size; ++i) {
+      shards[i] = kShardingFactor;
+      if (pushed[offset + i])
+        shards[i] = GetLockIdImpl(objects[offset + i]);
+    }
+
+    for (size_t i = 0; i < chunk_size; ++i) {
+      size_t shard = shards[i];
+      if (shard == kShardingFactor)
+        continue;
+      LockImpl(shard);
+      for (size_t j = i; j < chunk_size; ++j) {
+        if (shards[j] != shard)
+          continue;
+        pushed[offset + j] = PushImpl(objects[offset + j]);
+        shards[j] = kShardingFactor;
+      }
+      UnlockImpl(shard);
+    }
+  }
+}
+
 }  // namespace quarantines
 }  // namespace asan
 }  // namespace agent
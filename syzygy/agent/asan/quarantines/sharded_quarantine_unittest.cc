@@ -74,9 +74,12 @@ class TestShardedQuarantine
     return count;
   }
 
+  TestShardedQuarantine() : lock_count_(0) { }
+
   void LockImpl(size_t lock_id) override {
     Super::LockImpl(lock_id);
     lock_set_.insert(lock_id);
+    ++lock_count_;
   }
   void UnlockImpl(size_t lock_id) override {
     lock_set_.erase(lock_id);
@@ -84,6 +87,7 @@ class TestShardedQuarantine
   }
 
   std::set<size_t> lock_set_;
+  size_t lock_count_;
 };
 
 }  // namespace
@@ -205,6 +209,42 @@ TEST(ShardedQuarantineTest, LockUnlock) {
   EXPECT_TRUE(q.lock_set_.empty());
 }
 
+TEST(ShardedQuarantineTest, PushBatch) {
+  TestShardedQuarantine q;
+  q.set_max_object_size(10);
+
+  // Spread the objects over all the shards, with some of them too big to be
+  // quarantined.
+  const size_t kBatchSize = 4 * TestShardedQuarantine::kShardingFactor;
+  DummyObject objects[kBatchSize];
+  size_t expected_size = 0;
+  size_t expected_count = 0;
+  for (size_t i = 0; i < kBatchSize; ++i) {
+    objects[i].size = (i % 3 == 0) ? 20 : 1 + i % 10;
+    objects[i].hash = i;
+    if (objects[i].size <= q.max_object_size()) {
+      expected_size += objects[i].size;
+      ++expected_count;
+    }
+  }
+
+  bool pushed[kBatchSize] = {};
+  EXPECT_EQ(TRIM_NOT_REQUIRED, q.PushBatch(objects, kBatchSize, pushed));
+  for (size_t i = 0; i < kBatchSize; ++i)
+    EXPECT_EQ(objects[i].size <= q.max_object_size(), pushed[i]);
+  EXPECT_EQ(expected_size, q.GetSizeForTesting());
+  EXPECT_EQ(expected_count, q.GetCountForTesting());
+
+  // Each shard should have been locked exactly once, and released.
+  EXPECT_EQ(TestShardedQuarantine::kShardingFactor, q.lock_count_);
+  EXPECT_TRUE(q.lock_set_.empty());
+
+  size_t total_count = 0;
+  for (size_t i = 0; i < TestShardedQuarantine::kShardingFactor; ++i)
+    total_count += q.ShardCount(i);
+  EXPECT_EQ(expected_count, total_count);
+}
+
 }  // namespace quarantines
 }  // namespace asan
 }  // namespace agent
@@ -18,10 +18,10 @@
 #ifndef SYZYGY_AGENT_ASAN_QUARANTINES_SIZE_LIMITED_QUARANTINE_H_
 #define SYZYGY_AGENT_ASAN_QUARANTINES_SIZE_LIMITED_QUARANTINE_H_
 
+#include <windows.h>
 #include <utility>
 
 #include "base/atomicops.h"
-#include "base/synchronization/lock.h"
 #include "syzygy/agent/asan/quarantine.h"
 
 namespace agent {
@@ -29,87 +29,97 @@ namespace asan {
 namespace quarantines {
 
 // Provides both the size of the quarantine and the number of elements it
-// contains. Both of these are accessed behind a lock, to ensure their
-// consistency. Hence, the lock must be acquired (by calling Lock) before any
-// other operation is performed. The lock should be returned (by calling Unlock)
-// as soon as possible to minimize the locked time.
+// contains. These are spread over per-CPU stripes that are updated with atomic
+// operations, so that the threads pushing to and popping from the quarantine
+// don't serialize on them. The totals are obtained by summing the stripes,
+// which isn't atomic: they are only approximate while the quarantine is being
+// modified.
+// Summing the stripes is too slow for every push and pop, so a stripe whose
+// size drifts by more than kMaxStripeSize is folded into a shared total. That
+// total alone is an approximation of the size, within kMaxSizeError of the
+// sum of the stripes.
 // Note that since pushing/popping the quarantine are not atomic operations, the
 // size/count can become negative in transition, hence the need to have them as
 // signed integer (only their eventual consistency is guaranteed).
 class QuarantineSizeCount {
  public:
-  // Default constructor that sets the size and count to 0.
-  QuarantineSizeCount() : size_(0), count_(0) {}
+  // The number of stripes. CPUs beyond that share stripes.
+  static const size_t kStripeCount = 16;
+
+  // The size by which a stripe can drift before being folded into the total.
+  static const SSIZE_T kMaxStripeSize = 64 * 1024;
 
-  // Must be called before any other operation to acquire the lock.
-  void Lock() { lock_.Acquire(); }
+  // The maximum difference between the approximate size and the size.
+  static const SSIZE_T kMaxSizeError =
+      static_cast<SSIZE_T>(kStripeCount) * kMaxStripeSize;
 
-  // Releases the lock.
-  void Unlock() {
-    lock_.AssertAcquired();
-    lock_.Release();
+  // Default constructor that sets the size and count to 0.
+  QuarantineSizeCount() : total_size_(0) {
+    ::memset(stripes_, 0, sizeof(stripes_));
   }
 
-  // @returns the size.
+  // @returns the size. This sums all the stripes.
   SSIZE_T size() const {
-    lock_.AssertAcquired();
-    return size_;
+    SSIZE_T size = base::subtle::NoBarrier_Load(&total_size_);
+    for (size_t i = 0; i < kStripeCount; ++i)
+      size += base::subtle::NoBarrier_Load(&stripes_[i].size);
+    return size;
+  }
+
+  // @returns an approximation of the size, within kMaxSizeError of it.
+  SSIZE_T approximate_size() const {
+    return base::subtle::NoBarrier_Load(&total_size_);
   }
 
   // @returns the count.
   SSIZE_T count() const {
-    lock_.AssertAcquired();
-    return count_;
+    SSIZE_T count = 0;
+    for (size_t i = 0; i < kStripeCount; ++i)
+      count += base::subtle::NoBarrier_Load(&stripes_[i].count);
+    return count;
   }
 
   // Increments the size and count.
   // @param size_delta The delta by which the size is incremented.
   // @param count_delta The delta by which the count is incremented.
-  // @returns the new size.
+  // @returns the new approximate size.
   SSIZE_T Increment(SSIZE_T size_delta, SSIZE_T count_delta) {
-    lock_.AssertAcquired();
-    size_ += size_delta;
-    count_ += count_delta;
-    return size_;
+    Stripe* stripe = &stripes_[::GetCurrentProcessorNumber() % kStripeCount];
+    SSIZE_T stripe_size =
+        base::subtle::NoBarrier_AtomicIncrement(&stripe->size, size_delta);
+    base::subtle::NoBarrier_AtomicIncrement(&stripe->count, count_delta);
+    if (stripe_size <= kMaxStripeSize && stripe_size >= -kMaxStripeSize)
+      return approximate_size();
+
+    // Fold the stripe into the total. Whatever the other threads added to it
+    // in the meantime is folded along.
+    stripe_size = base::subtle::NoBarrier_AtomicExchange(&stripe->size, 0);
+    return base::subtle::NoBarrier_AtomicIncrement(&total_size_, stripe_size);
   }
 
   // Decrements the size and count.
   // @param size_delta The delta by which the size is decremented.
   // @param count_delta The delta by which the count is decremented.
-  // @returns the new size.
+  // @returns the new approximate size.
   SSIZE_T Decrement(SSIZE_T size_delta, SSIZE_T count_delta) {
-    lock_.AssertAcquired();
-    size_ -= size_delta;
-    count_ -= count_delta;
-    return size_;
+    return Increment(-size_delta, -count_delta);
   }
 
  private:
-  // The current size of the quarantine.
-  SSIZE_T size_;
-  // The number of elements in the quarantine.
-  SSIZE_T count_;
-  // Single lock that's used for both |size_| and |count_|.
-  base::Lock lock_;
-};
-
-// An automatic lock on QuarantineSizeCount.
-class ScopedQuarantineSizeCountLock {
- public:
-  // Constructor. Automatically lock the quarantine.
-  explicit ScopedQuarantineSizeCountLock(QuarantineSizeCount& size_count)
-      : size_count_(size_count) {
-    size_count_.Lock();
-  }
+  // A stripe of the counters. It is padded to a cache line to avoid false
+  // sharing between the CPUs.
+  struct Stripe {
+    base::subtle::AtomicWord size;
+    base::subtle::AtomicWord count;
+    uint8_t padding[64 - 2 * sizeof(base::subtle::AtomicWord)];
+  };
 
-  // Destructor. Automatically unlock the quarantine.
-  ~ScopedQuarantineSizeCountLock() { size_count_.Unlock(); }
+  Stripe stripes_[kStripeCount];
 
- private:
-  // The QuarantineSizeCount that this holds.
-  QuarantineSizeCount& size_count_;
+  // The size folded from the stripes.
+  base::subtle::AtomicWord total_size_;
 
-  DISALLOW_COPY_AND_ASSIGN(ScopedQuarantineSizeCountLock);
+  DISALLOW_COPY_AND_ASSIGN(QuarantineSizeCount);
 };
 
 // A partial implementation of a size-limited quarantine. This quarantine
@@ -117,13 +127,18 @@ class ScopedQuarantineSizeCountLock {
 // less than a certain threshold, and all objects within it must be smaller
 // than another given threshold.
 //
-// Provides implementations of QuarantineInterface Push/Pop/Empty methods.
-// Expects the derived class to provide implementations for a few methods:
+// Provides implementations of QuarantineInterface Push/PushBatch/Pop/Empty
+// methods. Expects the derived class to provide implementations for a few
+// methods:
 //
 //   bool PushImpl(const ObjectType& object);
 //   bool PopImpl(ObjectType* object);
 //   void EmptyImpl(ObjectVector* object);
 //
+// The derived class may also provide a more efficient implementation of:
+//
+//   void PushBatchImpl(const ObjectType* objects, size_t count, bool* pushed);
+//
 // Calculates the sizes of objects using the provided SizeFunctor. This
 // must satisfy the following interface:
 //
@@ -191,12 +206,18 @@ class SizeLimitedQuarantineImpl : public QuarantineInterface<ObjectType> {
   // @returns the maximum quarantine size.
   size_t max_quarantine_size() const { return max_quarantine_size_; }
 
+  // @returns the current size of the quarantine. This is only a snapshot
+  //     when the quarantine is being modified.
+  size_t GetSize() const {
+    SSIZE_T size = size_count_.size();
+    return size < 0 ? 0 : static_cast<size_t>(size);
+  }
+
   // @returns the current size of the quarantine.
   // @note that this function could be racing with a push/pop operation and
   // return a stale value. It is only used in tests.
   size_t GetSizeForTesting() {
-    ScopedQuarantineSizeCountLock size_count_lock(size_count_);
-    return size_count_.size();
+    return GetSize();
   }
 
   // @returns the current overbudget size.
@@ -228,6 +249,9 @@ class SizeLimitedQuarantineImpl : public QuarantineInterface<ObjectType> {
   // return a stale value. It is only used in in tests.
   // @{
   virtual PushResult Push(const Object& object);
+  virtual TrimStatus PushBatch(const Object* objects,
+                               size_t count,
+                               bool* pushed);
   virtual PopResult Pop(Object* object);
   virtual void Empty(ObjectVector* objects);
   virtual size_t GetCountForTesting();
@@ -247,6 +271,27 @@ class SizeLimitedQuarantineImpl : public QuarantineInterface<ObjectType> {
   virtual void UnlockImpl(size_t id) = 0;
   // @}
 
+  // Pushes a batch of objects. The default implementation pushes them one by
+  // one under their lock.
+  // @param objects The objects to push.
+  // @param count The number of objects.
+  // @param pushed Indicates which objects must be pushed on input, and which
+  //     ones have been successfully pushed on output.
+  virtual void PushBatchImpl(const Object* objects, size_t count, bool* pushed);
+
+  // Gets a size of the quarantine that is accurate enough to give its color.
+  // The stripes are only summed when the approximate size is close to the
+  // boundary of a color.
+  // @param approximate_size The approximate size of the quarantine.
+  // @returns the size, clamped at 0.
+  size_t GetSizeForColor(SSIZE_T approximate_size) const;
+
+  // Computes the trimming required after the size of the quarantine changed.
+  // @param old_size The size of the quarantine before the change.
+  // @param new_size The size of the quarantine after the change.
+  // @returns the trim status.
+  TrimStatus GetTrimStatus(size_t old_size, size_t new_size) const;
+
   // Parameters controlling the quarantine invariant.
   size_t max_object_size_;
   size_t max_quarantine_size_;
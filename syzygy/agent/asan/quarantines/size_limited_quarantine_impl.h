@@ -33,27 +33,108 @@ PushResult SizeLimitedQuarantineImpl<OT, SFT>::Push(const Object& object) {
 
   // This will contain the size of quarantine after the implementation of push,
   // whether successful or not.
-  size_t new_size = 0;
-  {
-    // Note that if a thread gets preempted here, the size/count will be wrong,
-    // until the thread resumes (the size will eventually become consistent).
-    ScopedQuarantineSizeCountLock size_count_lock(size_count_);
-    new_size = size_count_.Increment(size, 1);
-  }
+  // Note that if a thread gets preempted here, the size/count will be wrong,
+  // until the thread resumes (the size will eventually become consistent).
+  size_t new_size = GetSizeForColor(size_count_.Increment(size, 1));
 
   // This is the size of the quarantine before the call to PushImpl and is
   // needed to calculate the old color and infer potential transitions.
-  size_t old_size = new_size - size;
+  size_t old_size = new_size > size ? new_size - size : 0;
   if (PushImpl(object)) {
     result.push_successful = true;
   } else {
     // Decrementing here is not guaranteed to give the same size as before the
     // increment, as the whole sequence is not atomic. Trimming might still be
     // required and will be signaled if need be.
-    ScopedQuarantineSizeCountLock size_count_lock(size_count_);
-    new_size = size_count_.Decrement(size, 1);
+    new_size = GetSizeForColor(size_count_.Decrement(size, 1));
+  }
+
+  result.trim_status = GetTrimStatus(old_size, new_size);
+  return result;
+}
+
+template <typename OT, typename SFT>
+TrimStatus SizeLimitedQuarantineImpl<OT, SFT>::PushBatch(const Object* objects,
+                                                         size_t count,
+                                                         bool* pushed) {
+  DCHECK_NE(static_cast<const Object*>(nullptr), objects);
+  DCHECK_NE(static_cast<bool*>(nullptr), pushed);
+
+  // Account for the whole batch at once.
+  size_t batch_size = 0;
+  size_t batch_count = 0;
+  for (size_t i = 0; i < count; ++i) {
+    size_t size = size_functor_(objects[i]);
+    pushed[i] = max_object_size_ == kUnboundedSize || size <= max_object_size_;
+    if (pushed[i]) {
+      batch_size += size;
+      ++batch_count;
+    }
+  }
+  if (batch_count == 0)
+    return TRIM_NOT_REQUIRED;
+
+  size_t new_size =
+      GetSizeForColor(size_count_.Increment(batch_size, batch_count));
+  size_t old_size = new_size > batch_size ? new_size - batch_size : 0;
+
+  PushBatchImpl(objects, count, pushed);
+
+  // Remove the objects that couldn't be pushed.
+  size_t failed_size = 0;
+  size_t failed_count = 0;
+  for (size_t i = 0; i < count; ++i) {
+    size_t size = size_functor_(objects[i]);
+    if (!pushed[i] &&
+        (max_object_size_ == kUnboundedSize || size <= max_object_size_)) {
+      failed_size += size;
+      ++failed_count;
+    }
+  }
+  if (failed_count != 0) {
+    new_size =
+        GetSizeForColor(size_count_.Decrement(failed_size, failed_count));
   }
 
+  return GetTrimStatus(old_size, new_size);
+}
+
+template <typename OT, typename SFT>
+void SizeLimitedQuarantineImpl<OT, SFT>::PushBatchImpl(const Object* objects,
+                                                       size_t count,
+                                                       bool* pushed) {
+  for (size_t i = 0; i < count; ++i) {
+    if (!pushed[i])
+      continue;
+    size_t id = GetLockIdImpl(objects[i]);
+    LockImpl(id);
+    pushed[i] = PushImpl(objects[i]);
+    UnlockImpl(id);
+  }
+}
+
+template <typename OT, typename SFT>
+size_t SizeLimitedQuarantineImpl<OT, SFT>::GetSizeForColor(
+    SSIZE_T approximate_size) const {
+  // The approximation is good enough if the size can only have one color.
+  const SSIZE_T kMaxSizeError = QuarantineSizeCount::kMaxSizeError;
+  size_t low = approximate_size > kMaxSizeError ?
+      approximate_size - kMaxSizeError : 0;
+  size_t high = approximate_size > -kMaxSizeError ?
+      approximate_size + kMaxSizeError : 0;
+  SSIZE_T size = approximate_size;
+  if (GetQuarantineColor(low) != GetQuarantineColor(high))
+    size = size_count_.size();
+
+  // The size can transiently be negative, see QuarantineSizeCount.
+  return size < 0 ? 0 : static_cast<size_t>(size);
+}
+
+template <typename OT, typename SFT>
+TrimStatus SizeLimitedQuarantineImpl<OT, SFT>::GetTrimStatus(
+    size_t old_size, size_t new_size) const {
+  TrimStatus trim_status = TRIM_NOT_REQUIRED;
+
   // Note that because GetQuarantineColor can return the wrong color (see note
   // in its implementation), this function might miss a transition to RED/BLACK
   // which would result in not signaling the asynchronous thread (under
@@ -69,19 +150,19 @@ PushResult SizeLimitedQuarantineImpl<OT, SFT>::Push(const Object& object) {
     // stated above, this ensures that regardless of the transition, the
     // quarantine will eventually get trimmed (no "run away" situation should be
     // possible).
-    result.trim_status |= TrimStatusBits::SYNC_TRIM_REQUIRED;
+    trim_status |= TrimStatusBits::SYNC_TRIM_REQUIRED;
     if (old_color < TrimColor::RED) {
       // If going from GREEN/YELLOW to BLACK, also schedule asynchronous
       // trimming (this is by design to improve the performance).
-      result.trim_status |= TrimStatusBits::ASYNC_TRIM_REQUIRED;
+      trim_status |= TrimStatusBits::ASYNC_TRIM_REQUIRED;
     }
   } else if (new_color == TrimColor::RED) {
     if (old_color < TrimColor::RED) {
       // If going from GREEN/YELLOW to RED, schedule asynchronous trimming.
-      result.trim_status |= TrimStatusBits::ASYNC_TRIM_REQUIRED;
+      trim_status |= TrimStatusBits::ASYNC_TRIM_REQUIRED;
     }
   }
-  return result;
+  return trim_status;
 }
 
 template <typename OT, typename SFT>
@@ -99,9 +180,10 @@ PopResult SizeLimitedQuarantineImpl<OT, SFT>::Pop(Object* object) {
     // which might cause either an over popping or an under popping. Either way,
     // that is acceptable as the extra or missing pop operations are not harmful
     // and the size will eventually get consistency.
-    ScopedQuarantineSizeCountLock size_count_lock(size_count_);
-    if (GetQuarantineColor(size_count_.size()) == TrimColor::GREEN)
+    if (GetQuarantineColor(GetSizeForColor(size_count_.approximate_size())) ==
+        TrimColor::GREEN) {
       return result;
+    }
   }
 
   if (!PopImpl(object))
@@ -110,9 +192,7 @@ PopResult SizeLimitedQuarantineImpl<OT, SFT>::Pop(Object* object) {
   // Note that if a thread gets preempted here, the size/count will be wrong,
   // until the thread resumes.
   size_t size = size_functor_(*object);
-  ScopedQuarantineSizeCountLock size_count_lock(size_count_);
-
-  size_t new_size = size_count_.Decrement(size, 1);
+  size_t new_size = GetSizeForColor(size_count_.Decrement(size, 1));
 
   // Return success and the new quarantine color.
   result.pop_successful = true;
@@ -139,13 +219,11 @@ void SizeLimitedQuarantineImpl<OT, SFT>::Empty(
     net_size += size;
   }
 
-  ScopedQuarantineSizeCountLock size_count_lock(size_count_);
   size_count_.Decrement(net_size, objects->size());
 }
 
 template <typename OT, typename SFT>
 size_t SizeLimitedQuarantineImpl<OT, SFT>::GetCountForTesting() {
-  ScopedQuarantineSizeCountLock size_count_lock(size_count_);
   return size_count_.count();
 }
 
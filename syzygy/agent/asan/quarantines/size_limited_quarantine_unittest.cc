@@ -14,6 +14,8 @@
 
 #include "syzygy/agent/asan/quarantines/size_limited_quarantine.h"
 
+#include <cstdlib>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -56,6 +58,8 @@ class TestQuarantine
   TestQuarantine() { }
   virtual ~TestQuarantine() { }
 
+  QuarantineSizeCount* size_count() { return &size_count_; }
+
  protected:
   // @name SizeLimitedQuarantine interface.
   // @{
@@ -123,6 +127,28 @@ TEST(SizeLimitedQuarantineTest, MaxObjectSizeEnforced) {
   }
 }
 
+TEST(SizeLimitedQuarantineTest, PushBatch) {
+  TestQuarantine q;
+  q.set_max_object_size(10);
+  q.set_max_quarantine_size(20);
+
+  DummyObject objects[] = {DummyObject(5), DummyObject(11), DummyObject(10)};
+  bool pushed[arraysize(objects)] = {};
+  EXPECT_EQ(TRIM_NOT_REQUIRED,
+            q.PushBatch(objects, arraysize(objects), pushed));
+  EXPECT_TRUE(pushed[0]);
+  EXPECT_FALSE(pushed[1]);
+  EXPECT_TRUE(pushed[2]);
+  EXPECT_EQ(15u, q.GetSizeForTesting());
+  EXPECT_EQ(2u, q.GetCountForTesting());
+
+  // Going over budget in a single batch requires trimming.
+  EXPECT_NE(TRIM_NOT_REQUIRED,
+            q.PushBatch(objects, arraysize(objects), pushed));
+  EXPECT_EQ(30u, q.GetSizeForTesting());
+  EXPECT_EQ(4u, q.GetCountForTesting());
+}
+
 TEST(SizeLimitedQuarantineTest, InvariantEnforced) {
   TestQuarantine q;
   DummyObject o(10);
@@ -166,6 +192,63 @@ TEST(SizeLimitedQuarantineTest, EmptyWorks) {
   EXPECT_THAT(os, testing::ElementsAre(o, o, o));
 }
 
+TEST(SizeLimitedQuarantineTest, SizeCountStripesAreFolded) {
+  QuarantineSizeCount size_count;
+  const SSIZE_T kSize = QuarantineSizeCount::kMaxStripeSize / 3;
+  for (SSIZE_T i = 1; i <= 100; ++i) {
+    SSIZE_T approximate_size = size_count.Increment(kSize, 1);
+    EXPECT_EQ(i * kSize, size_count.size());
+    EXPECT_EQ(i, size_count.count());
+    EXPECT_GE(QuarantineSizeCount::kMaxSizeError,
+              std::abs(size_count.size() - approximate_size));
+  }
+  EXPECT_LT(0, size_count.approximate_size());
+
+  for (SSIZE_T i = 99; i >= 0; --i) {
+    SSIZE_T approximate_size = size_count.Decrement(kSize, 1);
+    EXPECT_EQ(i * kSize, size_count.size());
+    EXPECT_EQ(i, size_count.count());
+    EXPECT_GE(QuarantineSizeCount::kMaxSizeError,
+              std::abs(size_count.size() - approximate_size));
+  }
+}
+
+TEST(SizeLimitedQuarantineTest, ApproximateSizeGivesTheRightColor) {
+  const size_t kMaxSize = 4 * QuarantineSizeCount::kMaxSizeError;
+  const size_t kObjectSize = 4096;
+  TestQuarantine q;
+  q.set_max_quarantine_size(kMaxSize);
+
+  // Synchronous trimming is requested exactly once the quarantine is over
+  // budget, even though the stripes are only summed near the limit.
+  DummyObject o(kObjectSize);
+  for (size_t i = 1; i <= 2 * kMaxSize / kObjectSize; ++i) {
+    PushResult result = q.Push(o);
+    EXPECT_TRUE(result.push_successful);
+    EXPECT_EQ(i * kObjectSize > kMaxSize,
+              (result.trim_status & TrimStatusBits::SYNC_TRIM_REQUIRED) != 0);
+  }
+
+  // Popping stops as soon as the quarantine is within budget.
+  while (q.Pop(&o).pop_successful) {}
+  EXPECT_EQ(kMaxSize, q.GetSizeForTesting());
+}
+
+TEST(SizeLimitedQuarantineTest, NegativeSizeIsClampedAtZero) {
+  TestQuarantine q;
+  q.set_max_quarantine_size(1000);
+
+  // A pop accounted for before its push makes the size transiently negative.
+  q.size_count()->Decrement(100, 1);
+  EXPECT_EQ(0u, q.GetSizeForTesting());
+  PushResult result = q.Push(DummyObject(10));
+  EXPECT_TRUE(result.push_successful);
+  EXPECT_EQ(0u, result.trim_status);
+  EXPECT_EQ(0u, q.GetSizeForTesting());
+  q.size_count()->Increment(100, 1);
+  EXPECT_EQ(10u, q.GetSizeForTesting());
+}
+
 TEST(SizeLimitedQuarantineTest, GetQuarantineColor) {
   const size_t kMaxSize = 1000;
   const size_t kOverbudgetSize = 10;
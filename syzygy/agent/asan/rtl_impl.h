@@ -111,6 +111,16 @@ typedef void(WINAPI* AsanExperimentCallback)(const char* experiment_name,
 void WINAPI asan_EnumExperiments(AsanExperimentCallback callback);
 // @}
 
+// Retrieves the runtime statistics, as a JSON object. This is meant to be
+// polled by the instrumented process, e.g. to report them with its own
+// metrics.
+// @param buffer The buffer receiving the null terminated JSON object. This
+//     is truncated if it's too small. May be null if @p buffer_size is zero.
+// @param buffer_size The size of @p buffer.
+// @returns the size of the buffer required to hold the whole JSON object,
+//     including its null terminator.
+size_t WINAPI asan_GetRuntimeStats(char* buffer, size_t buffer_size);
+
 int asan_CrashForException(EXCEPTION_POINTERS* exception);
 
 // This functions allows manually initializing the crash reporter used by the
@@ -14,6 +14,8 @@
 
 #include <windows.h>
 
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "syzygy/agent/asan/heap_checker.h"
 #include "syzygy/agent/asan/rtl_impl.h"
@@ -743,5 +745,33 @@ TEST_F(AsanRtlTest, EnumFeatures) {
   EXPECT_EQ(2U, experiments.size());
 }
 
+TEST_F(AsanRtlTest, GetRuntimeStats) {
+  typedef size_t(WINAPI * GetRuntimeStatsFn)(char* buffer, size_t size);
+
+  GetRuntimeStatsFn get_runtime_stats_fn =
+      reinterpret_cast<GetRuntimeStatsFn>(
+          ::GetProcAddress(asan_rtl_, "asan_GetRuntimeStats"));
+  ASSERT_TRUE(get_runtime_stats_fn != nullptr);
+
+  // Query the required size first.
+  size_t size = get_runtime_stats_fn(nullptr, 0);
+  ASSERT_LT(1U, size);
+
+  // Leave some room in case the statistics grow in between the calls.
+  std::vector<char> buffer(2 * size);
+  size_t new_size = get_runtime_stats_fn(buffer.data(), buffer.size());
+  ASSERT_GE(buffer.size(), new_size);
+  EXPECT_EQ(new_size - 1, ::strlen(buffer.data()));
+  EXPECT_EQ('{', buffer.front());
+  EXPECT_TRUE(::strstr(buffer.data(), "\"shadow_committed_size\":") !=
+              nullptr);
+
+  // A truncated copy is still null terminated.
+  char small_buffer[4] = {};
+  EXPECT_LT(sizeof(small_buffer),
+            get_runtime_stats_fn(small_buffer, sizeof(small_buffer)));
+  EXPECT_EQ(3U, ::strlen(small_buffer));
+}
+
 }  // namespace asan
 }  // namespace agent
@@ -78,6 +78,10 @@ enum CrashReporterType {
 // http://msdn.microsoft.com/en-us/library/windows/hardware/ff543026(v=vs.85).aspx
 // See winerror.h for more details.
 static const DWORD kAsanFacility = 0x68B;  // No more than 11 bits.
+
+// The size of the slice of memory checked by the background heap checker
+// every period.
+const size_t kBackgroundHeapCheckSliceSize = 16 * 1024 * 1024;
 static const DWORD kAsanStatus = 0x5AD0;   // No more than 16 bits.
 static const DWORD kAsanException =
     (3 << 30) |              // Severity = error.
@@ -531,12 +535,23 @@ bool AsanRuntime::SetUp(const std::wstring& flags_command_line) {
   // Set some early crash keys.
   SetEarlyCrashKeysIfPossible(this);
 
+  if (!SetUpStatsReporting())
+    return false;
+  if (!SetUpBackgroundHeapChecker())
+    return false;
+
   return true;
 }
 
 void AsanRuntime::TearDown() {
   base::AutoLock auto_lock(lock_);
 
+  // The background heap checker uses the heap manager and the logger.
+  TearDownBackgroundHeapChecker();
+
+  // The statistics are reported a last time before the components go away.
+  TearDownStatsReporting();
+
   // The WindowsHeapAdapter will only have been initialized if the heap manager
   // was successfully created and initialized.
   if (heap_manager_.get() != nullptr)
@@ -770,6 +785,102 @@ void AsanRuntime::TearDownHeapManager() {
   heap_manager_.reset();
 }
 
+bool AsanRuntime::SetUpStatsReporting() {
+  DCHECK_EQ(static_cast<RuntimeStatsReportingThread*>(nullptr),
+            stats_reporting_thread_.get());
+  if (params_.stats_reporting_period == 0)
+    return true;
+
+  stats_reporting_thread_.reset(new RuntimeStatsReportingThread(
+      base::Bind(&AsanRuntime::LogRuntimeStats, base::Unretained(this)),
+      base::TimeDelta::FromSeconds(params_.stats_reporting_period)));
+  if (!stats_reporting_thread_->Start()) {
+    LOG(ERROR) << "Unable to start the stats reporting thread.";
+    stats_reporting_thread_.reset();
+    return false;
+  }
+  return true;
+}
+
+void AsanRuntime::TearDownStatsReporting() {
+  if (stats_reporting_thread_.get() != nullptr) {
+    stats_reporting_thread_->Stop();
+    stats_reporting_thread_.reset();
+  }
+
+  if (logger_.get() != nullptr && heap_manager_.get() != nullptr)
+    LogRuntimeStats();
+}
+
+bool AsanRuntime::SetUpBackgroundHeapChecker() {
+  DCHECK_EQ(static_cast<BackgroundHeapChecker*>(nullptr),
+            background_heap_checker_.get());
+  if (params_.background_heap_check_period == 0)
+    return true;
+
+  background_heap_checker_.reset(new BackgroundHeapChecker(
+      heap_manager_.get(), shadow(), kBackgroundHeapCheckSliceSize,
+      base::TimeDelta::FromMilliseconds(params_.background_heap_check_period),
+      base::Bind(&AsanRuntime::OnBackgroundHeapCorruption,
+                 base::Unretained(this))));
+  if (!background_heap_checker_->Start()) {
+    LOG(ERROR) << "Unable to start the background heap checker.";
+    background_heap_checker_.reset();
+    return false;
+  }
+  return true;
+}
+
+void AsanRuntime::TearDownBackgroundHeapChecker() {
+  if (background_heap_checker_.get() != nullptr) {
+    background_heap_checker_->Stop();
+    background_heap_checker_.reset();
+  }
+}
+
+void AsanRuntime::OnBackgroundHeapCorruption(
+    const HeapChecker::CorruptRangesVector& corrupt_ranges) {
+  DCHECK(!corrupt_ranges.empty());
+
+  AsanErrorInfo error_info = {};
+  error_info.location = corrupt_ranges.front().address;
+  ::RtlCaptureContext(&error_info.context);
+  error_info.error_type = CORRUPT_HEAP;
+  error_info.access_mode = ASAN_UNKNOWN_ACCESS;
+
+  // Report the ranges found by the background checker rather than checking
+  // the whole heap again. The heaps are locked while the blocks are inspected.
+  {
+    ::common::AutoRecursiveLock lock(block_protect_lock);
+    AutoHeapManagerLock heap_manager_lock(heap_manager_.get());
+    std::vector<uint8_t> buffer(CalculateCorruptHeapInfoSize(corrupt_ranges));
+    WriteCorruptHeapInfo(corrupt_ranges, buffer.size(), buffer.data(),
+                         &error_info);
+    OnErrorImpl(&error_info);
+  }
+
+  DCHECK(!asan_error_callback_.is_null());
+  asan_error_callback_.Run(&error_info);
+}
+
+void AsanRuntime::GetRuntimeStats(RuntimeStats::Snapshot* snapshot) {
+  DCHECK_NE(static_cast<RuntimeStats::Snapshot*>(nullptr), snapshot);
+  RuntimeStats::Instance()->GetSnapshot(snapshot);
+  if (heap_manager_.get() != nullptr)
+    snapshot->quarantine_size = heap_manager_->GetSharedQuarantineSize();
+  if (shadow_.get() != nullptr)
+    snapshot->shadow_committed_size = shadow_->GetCommittedSize();
+}
+
+void AsanRuntime::LogRuntimeStats() {
+  DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger_.get());
+  RuntimeStats::Snapshot snapshot = {};
+  GetRuntimeStats(&snapshot);
+  std::string json;
+  RuntimeStats::SnapshotToJson(snapshot, &json);
+  logger_->Write("SyzyASAN runtime stats: " + json);
+}
+
 bool AsanRuntime::GetAsanFlagsEnvVar(std::wstring* env_var_wstr) {
   std::unique_ptr<base::Environment> env(base::Environment::Create());
   if (env.get() == NULL) {
@@ -792,13 +903,13 @@ void AsanRuntime::PropagateParams() {
   // This function has to be kept in sync with the AsanParameters struct. These
   // checks will ensure that this is the case.
 #ifdef _WIN64
-  static_assert(sizeof(::common::AsanParameters) == 64,
+  static_assert(sizeof(::common::AsanParameters) == 76,
                 "Must propagate parameters.");
 #else
-  static_assert(sizeof(::common::AsanParameters) == 60,
+  static_assert(sizeof(::common::AsanParameters) == 72,
                 "Must propagate parameters.");
 #endif
-  static_assert(::common::kAsanParametersVersion == 15,
+  static_assert(::common::kAsanParametersVersion == 19,
                 "Must update parameters version.");
 
   // Push the configured parameter values to the appropriate endpoints.
@@ -811,6 +922,18 @@ void AsanRuntime::PropagateParams() {
   logger_->set_log_as_text(params_.log_as_text);
   // exit_on_failure is used locally by AsanRuntime.
   logger_->set_minidump_on_failure(params_.minidump_on_failure);
+
+  // The checksum strategy must be set before any block gets quarantined.
+  if (params_.quarantine_checksum_strategy <
+      ::common::kQuarantineChecksumStrategyMax) {
+    SetBlockChecksumStrategy(static_cast<::common::QuarantineChecksumStrategy>(
+        params_.quarantine_checksum_strategy));
+  } else {
+    LOG(ERROR) << "Ignoring invalid quarantine checksum strategy "
+               << params_.quarantine_checksum_strategy << ".";
+  }
+  // stats_reporting_period is used locally by AsanRuntime.
+  // background_heap_check_period is used locally by AsanRuntime.
 }
 
 size_t AsanRuntime::CalculateCorruptHeapInfoSize(
@@ -1007,6 +1130,11 @@ void AsanRuntime::AddThreadId(uint32_t thread_id) {
   thread_ids_.insert(thread_id);
 }
 
+void AsanRuntime::ReleaseThreadResources() {
+  heap_manager_->ReleaseThreadCache();
+  stack_cache_->ReleaseThreadArena();
+}
+
 bool AsanRuntime::ThreadIdIsValid(uint32_t thread_id) {
   base::AutoLock lock(thread_ids_lock_);
   return thread_ids_.find(thread_id) != thread_ids_.end();
@@ -28,6 +28,7 @@
 #include "syzygy/agent/asan/heap_checker.h"
 #include "syzygy/agent/asan/memory_notifier.h"
 #include "syzygy/agent/asan/reporter.h"
+#include "syzygy/agent/asan/runtime_stats.h"
 #include "syzygy/agent/asan/heap_managers/block_heap_manager.h"
 #include "syzygy/agent/common/stack_capture.h"
 #include "syzygy/common/asan_parameters.h"
@@ -158,6 +159,10 @@ class AsanRuntime {
   // @param thread_id The thread ID that has been observed.
   void AddThreadId(uint32_t thread_id);
 
+  // Releases the resources held on behalf of the calling thread. This is
+  // meant to be called when a thread exits.
+  void ReleaseThreadResources();
+
   // Determines if a thread ID has already been seen.
   // @param thread_id The thread ID to be queried.
   // @returns true if a given thread ID is valid for this process.
@@ -197,6 +202,14 @@ class AsanRuntime {
   // @returns the list of enabled features.
   AsanFeatureSet GetEnabledFeatureSet();
 
+  // Takes a snapshot of the runtime statistics, along with the gauges
+  // describing the current state of the runtime. This is thread safe.
+  // @param snapshot Will receive the statistics.
+  void GetRuntimeStats(RuntimeStats::Snapshot* snapshot);
+
+  // Writes the runtime statistics to the logger, as a JSON object.
+  void LogRuntimeStats();
+
   // Initialize the crash reporter used by the runtime.
   //
   // This function should only be called once during the runtime's lifetime,
@@ -281,6 +294,26 @@ class AsanRuntime {
   // Tear down the heap manager.
   void TearDownHeapManager();
 
+  // Starts reporting the runtime statistics periodically, if requested.
+  // @returns true on success, false otherwise.
+  bool SetUpStatsReporting();
+
+  // Stops reporting the runtime statistics, and reports them a last time.
+  void TearDownStatsReporting();
+
+  // Starts checking the heap in the background, if requested.
+  // @returns true on success, false otherwise.
+  bool SetUpBackgroundHeapChecker();
+
+  // Stops checking the heap in the background.
+  void TearDownBackgroundHeapChecker();
+
+  // Reports the heap corruption found by the background heap checker. This is
+  // invoked on the background thread.
+  // @param corrupt_ranges The corrupt ranges. Must not be empty.
+  void OnBackgroundHeapCorruption(
+      const HeapChecker::CorruptRangesVector& corrupt_ranges);
+
   // The unhandled exception filter registered by this runtime. This is used
   // to catch unhandled exceptions so we can augment them with information
   // about the corrupt heap.
@@ -344,6 +377,14 @@ class AsanRuntime {
   // Indicates if the crash reporter has been initialized.
   bool crash_reporter_initialized_;
 
+  // The thread periodically reporting the runtime statistics. This is null
+  // when the periodic reports are disabled.
+  std::unique_ptr<RuntimeStatsReportingThread> stats_reporting_thread_;
+
+  // The thread checking the heap in the background. This is null when the
+  // background checks are disabled.
+  std::unique_ptr<BackgroundHeapChecker> background_heap_checker_;
+
   DISALLOW_COPY_AND_ASSIGN(AsanRuntime);
 };
 
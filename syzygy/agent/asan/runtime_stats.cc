@@ -0,0 +1,143 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/runtime_stats.h"
+
+#include "base/lazy_instance.h"
+#include "base/strings/stringprintf.h"
+
+namespace agent {
+namespace asan {
+
+namespace {
+
+// The names of the counters, indexed by RuntimeStats::Counter.
+const char* const kCounterNames[] = {
+    "unguarded_allocations",
+    "quarantined_blocks",
+    "quarantine_trims",
+    "quarantine_trimmed_blocks",
+    "quarantine_trim_us",
+    "quarantine_lock_contentions",
+    "stack_cache_hits",
+    "stack_cache_misses",
+};
+static_assert(arraysize(kCounterNames) == RuntimeStats::kCounterMax,
+              "Runtime stats counter names out of date.");
+
+// The process-wide instance.
+base::LazyInstance<RuntimeStats>::Leaky g_runtime_stats =
+    LAZY_INSTANCE_INITIALIZER;
+
+}  // namespace
+
+RuntimeStats::RuntimeStats() {
+  ::memset(stripes_, 0, sizeof(stripes_));
+}
+
+uint64_t RuntimeStats::Get(Counter counter) const {
+  DCHECK_GT(kCounterMax, counter);
+  return Sum(counter);
+}
+
+uint64_t RuntimeStats::GetAllocations(HeapType heap_type) const {
+  DCHECK_GT(kHeapTypeMax, heap_type);
+  return Sum(kCounterMax + heap_type);
+}
+
+void RuntimeStats::GetSnapshot(Snapshot* snapshot) const {
+  DCHECK_NE(static_cast<Snapshot*>(nullptr), snapshot);
+  ::memset(snapshot, 0, sizeof(*snapshot));
+  for (size_t i = 0; i < kCounterMax; ++i)
+    snapshot->counters[i] = Sum(i);
+  for (size_t i = 0; i < kHeapTypeMax; ++i)
+    snapshot->allocations[i] = Sum(kCounterMax + i);
+}
+
+void RuntimeStats::SnapshotToJson(const Snapshot& snapshot,
+                                  std::string* json) {
+  DCHECK_NE(static_cast<std::string*>(nullptr), json);
+
+  // The output is flat and only made of integers, so this is simple enough
+  // not to warrant a full blown JSON writer. This also keeps the allocations
+  // to a minimum, as this runs alongside the instrumented code.
+  json->assign("{");
+  for (size_t i = 0; i < kCounterMax; ++i) {
+    base::StringAppendF(json, "\"%s\":%llu,", kCounterNames[i],
+                        snapshot.counters[i]);
+  }
+  for (size_t i = 0; i < kHeapTypeMax; ++i) {
+    // Skip the heap types that are gone.
+    if (static_cast<HeapType>(i) == kReserved)
+      continue;
+    base::StringAppendF(json, "\"allocations_%s\":%llu,", kHeapTypes[i],
+                        snapshot.allocations[i]);
+  }
+  base::StringAppendF(json, "\"quarantine_size\":%llu,",
+                      snapshot.quarantine_size);
+  base::StringAppendF(json, "\"shadow_committed_size\":%llu}",
+                      snapshot.shadow_committed_size);
+}
+
+const char* RuntimeStats::GetCounterName(Counter counter) {
+  DCHECK_GT(kCounterMax, counter);
+  return kCounterNames[counter];
+}
+
+RuntimeStats* RuntimeStats::Instance() {
+  return g_runtime_stats.Pointer();
+}
+
+uint64_t RuntimeStats::Sum(size_t index) const {
+  DCHECK_GT(kValueCount, index);
+  uint64_t sum = 0;
+  for (size_t i = 0; i < kStripeCount; ++i) {
+    // 64-bit reads aren't atomic on 32-bit, so read through a no-op
+    // compare-and-swap.
+    sum += static_cast<uint64_t>(::InterlockedCompareExchange64(
+        const_cast<volatile LONGLONG*>(&stripes_[i].values[index]), 0, 0));
+  }
+  return sum;
+}
+
+RuntimeStatsReportingThread::RuntimeStatsReportingThread(
+    const Callback& callback, base::TimeDelta period)
+    : callback_(callback), period_(period), stop_event_(false, false) {
+}
+
+RuntimeStatsReportingThread::~RuntimeStatsReportingThread() {
+  DCHECK(thread_handle_.is_null());
+}
+
+bool RuntimeStatsReportingThread::Start() {
+  DCHECK(thread_handle_.is_null());
+  return base::PlatformThread::CreateWithPriority(
+      0, this, &thread_handle_, base::ThreadPriority::BACKGROUND);
+}
+
+void RuntimeStatsReportingThread::Stop() {
+  DCHECK(!thread_handle_.is_null());
+  stop_event_.Signal();
+  base::PlatformThread::Join(thread_handle_);
+  thread_handle_ = base::PlatformThreadHandle();
+}
+
+void RuntimeStatsReportingThread::ThreadMain() {
+  base::PlatformThread::SetName("SyzyASAN Stats Reporting Thread");
+  while (!stop_event_.TimedWait(period_))
+    callback_.Run();
+}
+
+}  // namespace asan
+}  // namespace agent
@@ -0,0 +1,208 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A registry of counters describing the activity of the runtime, meant to be
+// cheap enough to be left enabled in production. The counters are updated
+// from the hot paths of the runtime and aggregated when they are read. A
+// snapshot of the counters, along with gauges sampled from the components of
+// the runtime, can be serialized to JSON.
+
+#ifndef SYZYGY_AGENT_ASAN_RUNTIME_STATS_H_
+#define SYZYGY_AGENT_ASAN_RUNTIME_STATS_H_
+
+#include <windows.h>
+
+#include <string>
+
+#include "base/callback.h"
+#include "base/logging.h"
+#include "base/macros.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/threading/platform_thread.h"
+#include "base/time/time.h"
+#include "syzygy/agent/asan/heap.h"
+
+namespace agent {
+namespace asan {
+
+// The counters of the runtime. These are spread over per-CPU stripes, as for
+// QuarantineSizeCount, so that the threads updating them don't contend on a
+// shared cache line. The totals are obtained by summing the stripes, so they
+// are only approximate while the counters are being updated. Per-thread
+// counters, folded back in by AsanRuntime::ReleaseThreadResources, would add
+// a TLS lookup to every update and require a registry of the live threads'
+// counters, walked under a lock by every read; a fixed number of stripes
+// avoids both.
+class RuntimeStats {
+ public:
+  // The counters that are kept.
+  enum Counter {
+    // The number of allocations that were served without a block.
+    kUnguardedAllocations,
+    // The number of blocks that were freed into the quarantine.
+    kQuarantinedBlocks,
+    // The number of times a quarantine was trimmed, the number of blocks
+    // evicted by these trims and the time that they took.
+    kQuarantineTrims,
+    kQuarantineTrimmedBlocks,
+    kQuarantineTrimMicroseconds,
+    // The number of times a quarantine lock was already held when it was
+    // requested.
+    kQuarantineLockContentions,
+    // The number of stack traces that were found in the stack cache, and
+    // that had to be added to it.
+    kStackCacheHits,
+    kStackCacheMisses,
+
+    // This must be last.
+    kCounterMax,
+  };
+
+  // A snapshot of the counters, along with the gauges describing the current
+  // state of the runtime.
+  struct Snapshot {
+    // The counters, indexed by Counter.
+    uint64_t counters[kCounterMax];
+    // The number of guarded allocations, indexed by heap type.
+    uint64_t allocations[kHeapTypeMax];
+
+    // @name Gauges. These aren't filled by GetSnapshot.
+    // @{
+    // The current size of the quarantines, in bytes.
+    uint64_t quarantine_size;
+    // The amount of shadow memory that is committed, in bytes.
+    uint64_t shadow_committed_size;
+    // @}
+  };
+
+  // The number of stripes. CPUs beyond that share stripes.
+  static const size_t kStripeCount = 16;
+
+  RuntimeStats();
+
+  // Increments a counter.
+  // @param counter The counter to increment.
+  void Increment(Counter counter) { Add(counter, 1); }
+
+  // Adds a value to a counter.
+  // @param counter The counter to update.
+  // @param value The value to add.
+  void Add(Counter counter, uint64_t value) {
+    DCHECK_GT(kCounterMax, counter);
+    AddImpl(counter, value);
+  }
+
+  // Increments the number of allocations served by a given heap type.
+  // @param heap_type The type of the heap that served the allocation.
+  void IncrementAllocations(HeapType heap_type) {
+    DCHECK_GT(kHeapTypeMax, heap_type);
+    AddImpl(kCounterMax + heap_type, 1);
+  }
+
+  // @param counter The counter to read.
+  // @returns the current value of @p counter.
+  uint64_t Get(Counter counter) const;
+
+  // @param heap_type The type of heap to query.
+  // @returns the number of allocations served by @p heap_type.
+  uint64_t GetAllocations(HeapType heap_type) const;
+
+  // Reads all the counters. The gauges of the snapshot are zeroed.
+  // @param snapshot Will receive the counters.
+  void GetSnapshot(Snapshot* snapshot) const;
+
+  // Serializes a snapshot to a flat JSON object.
+  // @param snapshot The snapshot to serialize.
+  // @param json Will receive the JSON object.
+  static void SnapshotToJson(const Snapshot& snapshot, std::string* json);
+
+  // @returns the name of a counter, as used in the JSON output.
+  static const char* GetCounterName(Counter counter);
+
+  // @returns the process-wide instance used by the runtime.
+  static RuntimeStats* Instance();
+
+ private:
+  // The number of values in each stripe: the counters, followed by the
+  // allocations per heap type.
+  static const size_t kValueCount = kCounterMax + kHeapTypeMax;
+
+  // A stripe of the counters. It is padded to a multiple of the cache line
+  // size to avoid false sharing between the CPUs.
+  struct Stripe {
+    volatile LONGLONG values[kValueCount];
+    uint8_t padding[64 - (kValueCount * sizeof(LONGLONG)) % 64];
+  };
+
+  // Adds a value to the counter at a given index of the stripes.
+  void AddImpl(size_t index, uint64_t value) {
+    Stripe* stripe = &stripes_[::GetCurrentProcessorNumber() % kStripeCount];
+    ::InterlockedExchangeAdd64(&stripe->values[index],
+                               static_cast<LONGLONG>(value));
+  }
+
+  // Sums the counter at a given index of the stripes.
+  uint64_t Sum(size_t index) const;
+
+  Stripe stripes_[kStripeCount];
+
+  DISALLOW_COPY_AND_ASSIGN(RuntimeStats);
+};
+
+// A background thread that periodically invokes a callback, used to report
+// the runtime statistics. As for the DeferredFreeThread, it must be stopped
+// before the callback becomes invalid.
+class RuntimeStatsReportingThread : public base::PlatformThread::Delegate {
+ public:
+  typedef base::Closure Callback;
+
+  // @param callback The callback invoked on every period.
+  // @param period The delay between two invocations of @p callback.
+  RuntimeStatsReportingThread(const Callback& callback,
+                              base::TimeDelta period);
+  ~RuntimeStatsReportingThread() override;
+
+  // Starts the thread. Must not be called if the thread has already been
+  // started.
+  // @returns true if successful, false if the thread failed to be launched.
+  bool Start();
+
+  // Stops the thread and waits until it exits. Must be called before the
+  // destruction of this object if it has been started.
+  void Stop();
+
+ private:
+  // Implementation of PlatformThread::Delegate:
+  void ThreadMain() override;
+
+  // The callback invoked on every period.
+  Callback callback_;
+
+  // The delay between two invocations of |callback_|.
+  base::TimeDelta period_;
+
+  // Signaled to stop the thread.
+  base::WaitableEvent stop_event_;
+
+  // Handle to the thread, used to join the thread when stopping. This is null
+  // while the thread isn't running.
+  base::PlatformThreadHandle thread_handle_;
+
+  DISALLOW_COPY_AND_ASSIGN(RuntimeStatsReportingThread);
+};
+
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_RUNTIME_STATS_H_
@@ -0,0 +1,156 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/runtime_stats.h"
+
+#include <memory>
+#include <vector>
+
+#include "base/bind.h"
+#include "base/json/json_reader.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/threading/simple_thread.h"
+#include "base/values.h"
+#include "gtest/gtest.h"
+
+namespace agent {
+namespace asan {
+
+namespace {
+
+// Increments some counters a given number of times.
+class IncrementDelegate : public base::DelegateSimpleThread::Delegate {
+ public:
+  IncrementDelegate(RuntimeStats* stats, size_t count)
+      : stats_(stats), count_(count) {
+  }
+
+  void Run() override {
+    for (size_t i = 0; i < count_; ++i) {
+      stats_->Increment(RuntimeStats::kQuarantinedBlocks);
+      stats_->Add(RuntimeStats::kQuarantineTrimmedBlocks, 2);
+      stats_->IncrementAllocations(kWinHeap);
+    }
+  }
+
+ private:
+  RuntimeStats* stats_;
+  size_t count_;
+};
+
+void SignalEvent(base::WaitableEvent* event) {
+  event->Signal();
+}
+
+}  // namespace
+
+TEST(RuntimeStatsTest, Counters) {
+  RuntimeStats stats;
+  for (size_t i = 0; i < RuntimeStats::kCounterMax; ++i) {
+    EXPECT_EQ(0u, stats.Get(static_cast<RuntimeStats::Counter>(i)));
+    EXPECT_NE(static_cast<const char*>(nullptr),
+              RuntimeStats::GetCounterName(
+                  static_cast<RuntimeStats::Counter>(i)));
+  }
+  for (size_t i = 0; i < kHeapTypeMax; ++i)
+    EXPECT_EQ(0u, stats.GetAllocations(static_cast<HeapType>(i)));
+
+  stats.Increment(RuntimeStats::kStackCacheHits);
+  stats.Increment(RuntimeStats::kStackCacheHits);
+  stats.Add(RuntimeStats::kQuarantineTrimMicroseconds, 0x100000000ull);
+  stats.IncrementAllocations(kZebraBlockHeap);
+
+  EXPECT_EQ(2u, stats.Get(RuntimeStats::kStackCacheHits));
+  EXPECT_EQ(0u, stats.Get(RuntimeStats::kStackCacheMisses));
+  EXPECT_EQ(0x100000000ull,
+            stats.Get(RuntimeStats::kQuarantineTrimMicroseconds));
+  EXPECT_EQ(1u, stats.GetAllocations(kZebraBlockHeap));
+  EXPECT_EQ(0u, stats.GetAllocations(kWinHeap));
+
+  RuntimeStats::Snapshot snapshot = {};
+  snapshot.quarantine_size = 42;
+  stats.GetSnapshot(&snapshot);
+  EXPECT_EQ(2u, snapshot.counters[RuntimeStats::kStackCacheHits]);
+  EXPECT_EQ(1u, snapshot.allocations[kZebraBlockHeap]);
+  EXPECT_EQ(0u, snapshot.quarantine_size);
+}
+
+TEST(RuntimeStatsTest, ConcurrentIncrements) {
+  const size_t kThreadCount = 8;
+  const size_t kIncrementCount = 10000;
+
+  RuntimeStats stats;
+  IncrementDelegate delegate(&stats, kIncrementCount);
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(&delegate, "increment")));
+    threads.back()->Start();
+  }
+  for (auto& thread : threads)
+    thread->Join();
+
+  EXPECT_EQ(kThreadCount * kIncrementCount,
+            stats.Get(RuntimeStats::kQuarantinedBlocks));
+  EXPECT_EQ(2 * kThreadCount * kIncrementCount,
+            stats.Get(RuntimeStats::kQuarantineTrimmedBlocks));
+  EXPECT_EQ(kThreadCount * kIncrementCount, stats.GetAllocations(kWinHeap));
+}
+
+TEST(RuntimeStatsTest, SnapshotToJson) {
+  RuntimeStats stats;
+  stats.Add(RuntimeStats::kUnguardedAllocations, 3);
+  stats.IncrementAllocations(kLargeBlockHeap);
+
+  RuntimeStats::Snapshot snapshot = {};
+  stats.GetSnapshot(&snapshot);
+  snapshot.quarantine_size = 1024;
+  snapshot.shadow_committed_size = 4096;
+
+  std::string json;
+  RuntimeStats::SnapshotToJson(snapshot, &json);
+  std::unique_ptr<base::Value> value(base::JSONReader::Read(json).release());
+  ASSERT_TRUE(value.get() != nullptr);
+  base::DictionaryValue* dict = nullptr;
+  ASSERT_TRUE(value->GetAsDictionary(&dict));
+
+  int i = 0;
+  EXPECT_TRUE(dict->GetInteger("unguarded_allocations", &i));
+  EXPECT_EQ(3, i);
+  EXPECT_TRUE(dict->GetInteger("stack_cache_misses", &i));
+  EXPECT_EQ(0, i);
+  EXPECT_TRUE(dict->GetInteger("allocations_LargeBlockHeap", &i));
+  EXPECT_EQ(1, i);
+  EXPECT_TRUE(dict->GetInteger("quarantine_size", &i));
+  EXPECT_EQ(1024, i);
+  EXPECT_TRUE(dict->GetInteger("shadow_committed_size", &i));
+  EXPECT_EQ(4096, i);
+  // The removed heap type is skipped, and the two gauges are appended.
+  size_t expected_size = RuntimeStats::kCounterMax + kHeapTypeMax - 1 + 2;
+  EXPECT_EQ(expected_size, dict->size());
+}
+
+TEST(RuntimeStatsReportingThreadTest, ReportsPeriodically) {
+  base::WaitableEvent event(false, false);
+  RuntimeStatsReportingThread thread(
+      base::Bind(&SignalEvent, base::Unretained(&event)),
+      base::TimeDelta::FromMilliseconds(1));
+  ASSERT_TRUE(thread.Start());
+  event.Wait();
+  event.Wait();
+  thread.Stop();
+}
+
+}  // namespace asan
+}  // namespace agent
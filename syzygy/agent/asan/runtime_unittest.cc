@@ -44,6 +44,7 @@ class TestAsanRuntime : public AsanRuntime {
   using AsanRuntime::GenerateRandomFeatureSet;
   using AsanRuntime::PropagateFeatureSet;
   using AsanRuntime::PropagateParams;
+  using AsanRuntime::background_heap_checker_;
   using AsanRuntime::heap_manager_;
 };
 
@@ -100,6 +101,9 @@ TEST_F(AsanRuntimeTest, SetUpAndTearDown) {
   // Make sure the singleton pointer matches the runtime we created.
   ASSERT_EQ(reinterpret_cast<AsanRuntime*>(&asan_runtime_),
             AsanRuntime::runtime());
+  // The heap isn't checked in the background by default.
+  EXPECT_EQ(static_cast<BackgroundHeapChecker*>(nullptr),
+            asan_runtime_.background_heap_checker_.get());
   ASSERT_NO_FATAL_FAILURE(asan_runtime_.TearDown());
 }
 
@@ -154,6 +158,28 @@ TEST_F(AsanRuntimeTest, SetCompressionReportingPeriod) {
   ASSERT_NO_FATAL_FAILURE(asan_runtime_.TearDown());
 }
 
+TEST_F(AsanRuntimeTest, BackgroundHeapChecker) {
+  current_command_line_.AppendSwitchASCII(
+      ::common::kParamBackgroundHeapCheckPeriod, "1");
+  ASSERT_NO_FATAL_FAILURE(
+      asan_runtime_.SetUp(current_command_line_.GetCommandLineString()));
+  BackgroundHeapChecker* checker =
+      asan_runtime_.background_heap_checker_.get();
+  ASSERT_NE(static_cast<BackgroundHeapChecker*>(nullptr), checker);
+
+  // Wait for a few slices to be checked. The heap isn't corrupt.
+  asan_runtime_.SetErrorCallBack(base::Bind(&TestCallback));
+  callback_called = false;
+  for (size_t i = 0; i < 1000 && checker->quantum_count() < 3; ++i)
+    ::Sleep(10);
+  EXPECT_LE(3u, checker->quantum_count());
+  EXPECT_FALSE(callback_called);
+
+  ASSERT_NO_FATAL_FAILURE(asan_runtime_.TearDown());
+  EXPECT_EQ(static_cast<BackgroundHeapChecker*>(nullptr),
+            asan_runtime_.background_heap_checker_.get());
+}
+
 TEST_F(AsanRuntimeTest, SetBottomFramesToSkip) {
   size_t frames_to_skip = common::StackCapture::bottom_frames_to_skip() + 1;
   std::string new_frames_to_skip_str = base::SizeTToString(frames_to_skip);
@@ -15,6 +15,7 @@
 #include "syzygy/agent/asan/shadow.h"
 
 #include <windows.h>
+#include <intrin.h>
 #include <algorithm>
 
 #include "base/strings/stringprintf.h"
@@ -35,9 +36,9 @@ base::Lock shadow_instance_lock;
 // TODO(loskutov): eliminate this by enforcing Shadow to be a singleton.
 const Shadow* shadow_instance = nullptr;
 
-// The exception handler, intended to map the pages for shadow and page_bits
-// on demand. When a page fault happens, the operating systems calls
-// this handler, and if the page is inside shadow or page_bits, it gets
+// The exception handler, intended to map the pages for shadow, page_bits and
+// summary on demand. When a page fault happens, the operating systems calls
+// this handler, and if the page is inside one of these arrays, it gets
 // commited seamlessly for the caller, and then execution continues.
 // Otherwise, the OS keeps searching for an appropriate handler.
 LONG NTAPI ShadowExceptionHandler(PEXCEPTION_POINTERS exception_pointers) {
@@ -48,8 +49,8 @@ LONG NTAPI ShadowExceptionHandler(PEXCEPTION_POINTERS exception_pointers) {
     return EXCEPTION_CONTINUE_SEARCH;
   }
 
-  // Only handle access violations that land within the shadow memory
-  // or the page bits.
+  // Only handle access violations that land within the shadow memory,
+  // the page bits or the summary.
 
   void* addr = reinterpret_cast<void*>(
       exception_pointers->ExceptionRecord->ExceptionInformation[1]);
@@ -62,9 +63,12 @@ LONG NTAPI ShadowExceptionHandler(PEXCEPTION_POINTERS exception_pointers) {
   bool is_outside_of_page_bits = shadow_instance == nullptr ||
       addr < shadow_instance->page_bits() ||
       addr >= shadow_instance->page_bits() + shadow_instance->page_bits_size();
+  bool is_outside_of_summary = shadow_instance == nullptr ||
+      addr < shadow_instance->summary() ||
+      addr >= shadow_instance->summary() + shadow_instance->summary_size();
 
   // Check valid shadow range.
-  if (is_outside_of_shadow && is_outside_of_page_bits)
+  if (is_outside_of_shadow && is_outside_of_page_bits && is_outside_of_summary)
     return EXCEPTION_CONTINUE_SEARCH;
 
   // This is an access violation while trying to read from the shadow. Commit
@@ -79,6 +83,41 @@ LONG NTAPI ShadowExceptionHandler(PEXCEPTION_POINTERS exception_pointers) {
 }
 #endif  // defined _WIN64
 
+// The largest number of shadow bytes that are tested by
+// ShadowBytesAreZero. This covers ranges of up to 128 bytes of memory, which
+// are the bulk of the ranges checked by the CRT interceptors.
+const size_t kSmallRangeShadowBytes = 16;
+
+// Reads a possibly unaligned value from the shadow.
+template <typename ValueType>
+ValueType ReadShadowValue(const uint8_t* shadow) {
+  ValueType value;
+  ::memcpy(&value, shadow, sizeof(value));
+  return value;
+}
+
+// Tests whether a short run of shadow bytes are all zero, without going
+// through the vectorized kernels. The run is covered by two overlapping
+// reads of the largest size that fits in it, so no byte outside of it gets
+// read.
+// @param shadow The first shadow byte of the run.
+// @param count The number of shadow bytes in the run, between 1 and
+//     kSmallRangeShadowBytes.
+// @returns true iff all the shadow bytes of the run are zero.
+bool ShadowBytesAreZero(const uint8_t* shadow, size_t count) {
+  DCHECK_LT(0u, count);
+  DCHECK_GE(kSmallRangeShadowBytes, count);
+  if (count >= sizeof(uint64_t)) {
+    return (ReadShadowValue<uint64_t>(shadow) |
+            ReadShadowValue<uint64_t>(shadow + count - sizeof(uint64_t))) == 0;
+  }
+  if (count >= sizeof(uint32_t)) {
+    return (ReadShadowValue<uint32_t>(shadow) |
+            ReadShadowValue<uint32_t>(shadow + count - sizeof(uint32_t))) == 0;
+  }
+  return (shadow[0] | shadow[count - 1] | shadow[count / 2]) == 0;
+}
+
 static const size_t kPageSize = GetPageSize();
 
 // Converts an address to a page index and bit mask.
@@ -103,17 +142,21 @@ extern "C" {
 uint8_t asan_memory_interceptors_shadow_memory[1] = {};
 }
 
-Shadow::Shadow() : own_memory_(false), shadow_(nullptr), length_(0) {
+Shadow::Shadow()
+    : own_memory_(false), shadow_(nullptr), length_(0), kernels_(nullptr),
+      summary_(nullptr), summary_length_(0) {
   Init(RequiredLength());
 }
 
 Shadow::Shadow(size_t length)
-    : own_memory_(false), shadow_(nullptr), length_(0) {
+    : own_memory_(false), shadow_(nullptr), length_(0), kernels_(nullptr),
+      summary_(nullptr), summary_length_(0) {
   Init(length);
 }
 
 Shadow::Shadow(void* shadow, size_t length)
-    : own_memory_(false), shadow_(nullptr), length_(0) {
+    : own_memory_(false), shadow_(nullptr), length_(0), kernels_(nullptr),
+      summary_(nullptr), summary_length_(0) {
   Init(false, shadow, length);
 }
 
@@ -129,6 +172,7 @@ Shadow::~Shadow() {
   if (own_memory_)
     CHECK(::VirtualFree(shadow_, 0, MEM_RELEASE));
   CHECK(::VirtualFree(page_bits_, 0, MEM_RELEASE));
+  CHECK(::VirtualFree(summary_, 0, MEM_RELEASE));
   own_memory_ = false;
   shadow_ = nullptr;
   length_ = 0;
@@ -165,6 +209,9 @@ void Shadow::SetUp() {
   Poison(shadow_, length_, kAsanMemoryMarker);
   // Poison the protection bits array.
   Poison(page_bits_, page_bits_length_, kAsanMemoryMarker);
+  // Poison the shadow summary.
+  Poison(summary_, ::common::AlignUp(summary_length_, kShadowRatio),
+         kAsanMemoryMarker);
 #endif
 }
 
@@ -184,6 +231,8 @@ void Shadow::TearDown() {
   Unpoison(shadow_, length_);
   // Unpoison the protection bits array.
   Unpoison(page_bits_, page_bits_length_);
+  // Unpoison the shadow summary.
+  Unpoison(summary_, ::common::AlignUp(summary_length_, kShadowRatio));
 #endif
 }
 
@@ -201,6 +250,12 @@ bool Shadow::IsClean() const {
       reinterpret_cast<uintptr_t>(page_bits_ + page_bits_length_) >>
           kShadowRatioLog;
 
+  const size_t summary_begin =
+      reinterpret_cast<uintptr_t>(summary_) >> kShadowRatioLog;
+  const size_t summary_end =
+      (reinterpret_cast<uintptr_t>(summary_ + summary_length_) +
+          kShadowRatio - 1) >> kShadowRatioLog;
+
   void const* self = nullptr;
   size_t self_size = 0;
   GetPointerAndSize(&self, &self_size);
@@ -234,6 +289,7 @@ bool Shadow::IsClean() const {
     for (; i < next_i; ++i) {
       if ((i >= shadow_begin && i < shadow_end) ||
           (i >= page_bits_begin && i < page_bits_end) ||
+          (i >= summary_begin && i < summary_end) ||
           (i >= this_begin && i < this_end)) {
         if (shadow_[i] != kAsanMemoryMarker)
           return false;
@@ -287,6 +343,8 @@ void Shadow::Init(size_t length) {
 }
 
 void Shadow::Init(bool own_memory, void* shadow, size_t length) {
+  kernels_ = &simd::GetShadowKernels(simd::GetBestInstructionSet());
+
 #ifdef _WIN64
   {
     base::AutoLock lock(shadow_instance_lock);
@@ -325,15 +383,32 @@ void Shadow::Init(bool own_memory, void* shadow, size_t length) {
                                                     MEM_RESERVE,
                                                     PAGE_NOACCESS));
 #endif
+
+  // Initialize the shadow summary. A freshly allocated shadow is entirely
+  // addressable, but there's no telling what a shadow we don't own contains.
+  summary_length_ = ((length - 1) >> kShadowSummaryRatioLog) + 1;
+#ifndef _WIN64
+  summary_ = static_cast<uint8_t*>(::VirtualAlloc(nullptr, summary_length_,
+                                                  MEM_COMMIT,
+                                                  PAGE_READWRITE));
+#else
+  summary_ = static_cast<uint8_t*>(::VirtualAlloc(nullptr, summary_length_,
+                                                  MEM_RESERVE,
+                                                  PAGE_NOACCESS));
+#endif
+  if (!own_memory)
+    ::memset(summary_, kSummaryAllFlags, summary_length_);
 }
 
 void Shadow::Reset() {
 #ifndef _WIN64
   ::memset(shadow_, 0, length_);
   ::memset(page_bits_, 0, page_bits_length_);
+  ::memset(summary_, 0, summary_length_);
 #else
   ::VirtualFree(shadow_, length_, MEM_DECOMMIT);
   ::VirtualFree(page_bits_, page_bits_length_, MEM_DECOMMIT);
+  ::VirtualFree(summary_, summary_length_, MEM_DECOMMIT);
 #endif
 
   SetShadowMemory(0, kShadowRatio * length_, kHeapAddressableMarker);
@@ -352,7 +427,8 @@ void Shadow::Poison(const void* addr, size_t size, ShadowMarker shadow_val) {
 
   size >>= kShadowRatioLog;
   DCHECK_GT(length_, index + size);
-  ::memset(shadow_ + index, shadow_val, size);
+  kernels_->fill(shadow_ + index, shadow_ + index + size, shadow_val);
+  UpdateSummary(index, index + size, shadow_val);
 }
 
 void Shadow::Unpoison(const void* addr, size_t size) {
@@ -365,72 +441,13 @@ void Shadow::Unpoison(const void* addr, size_t size) {
   index >>= kShadowRatioLog;
   size >>= kShadowRatioLog;
   DCHECK_GT(length_, index + size);
-  ::memset(shadow_ + index, kHeapAddressableMarker, size);
+  ClearShadow(index, index + size);
+  UpdateSummary(index, index + size, kHeapAddressableMarker);
 
   if (remainder != 0)
     shadow_[index + size] = remainder;
 }
 
-namespace {
-
-static const uint8_t kFreedMarker8 = kHeapFreedMarker;
-static const uint16_t kFreedMarker16 =
-    (static_cast<const uint16_t>(kFreedMarker8) << 8) | kFreedMarker8;
-static const uint32_t kFreedMarker32 =
-    (static_cast<const uint32_t>(kFreedMarker16) << 16) | kFreedMarker16;
-static const uint64_t kFreedMarker64 =
-    (static_cast<const uint64_t>(kFreedMarker32) << 32) | kFreedMarker32;
-
-// Marks the given range of shadow bytes as freed, preserving left and right
-// redzone bytes.
-inline void MarkAsFreedImpl8(uint8_t* cursor, uint8_t* cursor_end) {
-  for (; cursor != cursor_end; ++cursor) {
-    // Preserve block beginnings/ends/redzones as they were originally.
-    // This is necessary to preserve information about nested blocks.
-    if (ShadowMarkerHelper::IsActiveLeftRedzone(*cursor) ||
-        ShadowMarkerHelper::IsActiveRightRedzone(*cursor)) {
-      continue;
-    }
-
-    // Anything else gets marked as freed.
-    *cursor = kHeapFreedMarker;
-  }
-}
-
-// Marks the given range of shadow bytes as freed, preserving left and right
-// redzone bytes. |cursor| and |cursor_end| must be 8-byte aligned.
-inline void MarkAsFreedImplAligned64(uint64_t* cursor, uint64_t* cursor_end) {
-  DCHECK(::common::IsAligned(cursor, sizeof(uint64_t)));
-  DCHECK(::common::IsAligned(cursor_end, sizeof(uint64_t)));
-
-  for (; cursor != cursor_end; ++cursor) {
-    // If the block of shadow memory is entirely green then mark as freed.
-    // Otherwise go check its contents byte by byte.
-    if (*cursor == 0) {
-      *cursor = kFreedMarker64;
-    } else {
-      MarkAsFreedImpl8(reinterpret_cast<uint8_t*>(cursor),
-                       reinterpret_cast<uint8_t*>(cursor + 1));
-    }
-  }
-}
-
-inline void MarkAsFreedImpl64(uint8_t* cursor, uint8_t* cursor_end) {
-  if (cursor_end - cursor >= 2 * sizeof(uint64_t)) {
-    uint8_t* cursor_aligned = ::common::AlignUp(cursor, sizeof(uint64_t));
-    uint8_t* cursor_end_aligned =
-        ::common::AlignDown(cursor_end, sizeof(uint64_t));
-    MarkAsFreedImpl8(cursor, cursor_aligned);
-    MarkAsFreedImplAligned64(reinterpret_cast<uint64_t*>(cursor_aligned),
-                             reinterpret_cast<uint64_t*>(cursor_end_aligned));
-    MarkAsFreedImpl8(cursor_end_aligned, cursor_end);
-  } else {
-    MarkAsFreedImpl8(cursor, cursor_end);
-  }
-}
-
-}  // namespace
-
 void Shadow::MarkAsFreed(const void* addr, size_t size) {
   DCHECK_LE(kAddressLowerBound, reinterpret_cast<uintptr_t>(addr));
   DCHECK(::common::IsAligned(addr, kShadowRatio));
@@ -446,8 +463,9 @@ void Shadow::MarkAsFreed(const void* addr, size_t size) {
   uint8_t* cursor_end = static_cast<uint8_t*>(cursor) + length;
 
   // This isn't as simple as a memset because we need to preserve left and
-  // right redzone padding bytes that may be found in the range.
-  MarkAsFreedImpl64(cursor, cursor_end);
+  // right redzone padding bytes that may be found in the range. As the block
+  // start and end markers are preserved the summary remains valid.
+  kernels_->mark_as_freed(cursor, cursor_end);
 }
 
 bool Shadow::IsAccessible(const void* addr) const {
@@ -476,27 +494,37 @@ bool Shadow::IsRangeAccessible(const void* addr, size_t size) const {
 
   uintptr_t start_addr = reinterpret_cast<uintptr_t>(addr);
   uintptr_t start = start_addr;
+  size_t start_offs = start_addr & (kShadowRatio - 1);
   start >>= kShadowRatioLog;
 
   DCHECK_EQ(reinterpret_cast<uintptr_t>(addr),
-            (start << kShadowRatioLog) + (start_addr & (kShadowRatio - 1)));
+            (start << kShadowRatioLog) + start_offs);
   if (start > length_)
     return false;
 
+  uintptr_t end = reinterpret_cast<uintptr_t>(addr) + size;
+  // Overflow on addr + size.
+  if (start_addr > end)
+    return false;
+
+  // Short ranges whose shadow bytes are all zero are accessible, which can be
+  // established with a couple of reads. Anything else goes through the
+  // complete check below.
+  uintptr_t last = (end - 1) >> kShadowRatioLog;
+  if (last < length_ && last - start < kSmallRangeShadowBytes &&
+      ShadowBytesAreZero(&shadow_[start], last - start + 1)) {
+    return true;
+  }
+
   // Validate that the start point is accessible.
   uint8_t shadow = shadow_[start];
   if (shadow != 0U) {
     if (ShadowMarkerHelper::IsRedzone(shadow))
       return false;
-    if (start < shadow)
+    if (start_offs >= shadow)
       return false;
   }
 
-  uintptr_t end = reinterpret_cast<uintptr_t>(addr) + size;
-  // Overflow on addr + size.
-  if (start_addr > end)
-    return false;
-
   size_t end_offs = end & (kShadowRatio - 1);
   end >>= kShadowRatioLog;
   if (end > length_)
@@ -504,8 +532,10 @@ bool Shadow::IsRangeAccessible(const void* addr, size_t size) const {
 
   // Now run over the shadow bytes from start to end, which all need to be
   // zero.
-  if (!internal::IsZeroBufferImpl<uint64_t>(&shadow_[start], &shadow_[end]))
-      return false;
+  if (kernels_->find_first_non_zero(&shadow_[start], &shadow_[end]) !=
+      &shadow_[end]) {
+    return false;
+  }
 
   // Finally test the end point if there's a tail offset.
   if (end_offs == 0U)
@@ -560,12 +590,16 @@ const void* Shadow::FindFirstPoisonedByte(const void* addr, size_t size) const {
   if (end > length_)
     return out_addr;
 
-  for (size_t curr = start; curr < end; ++curr, out_addr += kShadowRatio) {
-    shadow = shadow_[curr];
+  // Skip over the accessible shadow bytes, and look at the first one that
+  // isn't.
+  const uint8_t* curr =
+      kernels_->find_first_non_zero(&shadow_[start], &shadow_[end]);
+  out_addr += (curr - &shadow_[start]) * kShadowRatio;
+  if (curr != &shadow_[end]) {
+    shadow = *curr;
     if (ShadowMarkerHelper::IsRedzone(shadow))
       return out_addr;
-    if (shadow != 0)
-      return out_addr + shadow;
+    return out_addr + shadow;
   }
 
   // Finally test the end point if there's a tail offset.
@@ -686,6 +720,13 @@ void Shadow::PoisonAllocatedBlock(const BlockInfo& info) {
   ::memset(cursor, kHeapRightPaddingMarker, right_redzone_bytes - 1);
   ::memset(cursor + right_redzone_bytes - 1, trailer_marker, 1);
 
+  // Update the summary. This clears the regions entirely covered by the block
+  // before flagging the ones holding its start and end markers.
+  ClearSummaryFlags(index, index + block_bytes, kSummaryAllFlags);
+  SetSummaryFlags(index, index + 1, kSummaryMayContainBlockStart);
+  SetSummaryFlags(index + block_bytes - 1, index + block_bytes,
+                  kSummaryMayContainBlockEnd);
+
   SetShadowMemory(info.header,
                   info.TotalHeaderSize(),
                   kHeapLeftPaddingMarker);
@@ -727,6 +768,18 @@ bool Shadow::IsBeginningOfBlockBody(const void* addr) const {
   return false;
 }
 
+bool Shadow::MayContainBlockStart(size_t index) const {
+  DCHECK_GT(length_, index);
+  return (summary_[index >> kShadowSummaryRatioLog] &
+      kSummaryMayContainBlockStart) != 0;
+}
+
+bool Shadow::MayContainBlockEnd(size_t index) const {
+  DCHECK_GT(length_, index);
+  return (summary_[index >> kShadowSummaryRatioLog] &
+      kSummaryMayContainBlockEnd) != 0;
+}
+
 bool Shadow::PageIsProtected(const void* addr) const {
   // Since the page bit is read very frequently this is not performed
   // under a lock. The values change quite rarely, so this will almost always
@@ -861,6 +914,100 @@ size_t Shadow::GetAllocSize(const uint8_t* mem) const {
   return block_info.block_size;
 }
 
+size_t Shadow::GetCommittedSize() const {
+#ifndef _WIN64
+  // The shadow is entirely committed upfront.
+  return length_;
+#else
+  size_t committed = 0;
+  const uint8_t* cursor = shadow_;
+  const uint8_t* shadow_end = shadow_ + length_;
+  MEMORY_BASIC_INFORMATION info = {};
+  while (cursor < shadow_end) {
+    if (::VirtualQuery(cursor, &info, sizeof(info)) == 0)
+      break;
+    const uint8_t* region_end =
+        static_cast<const uint8_t*>(info.BaseAddress) + info.RegionSize;
+    region_end = std::min(region_end, shadow_end);
+    if (info.State == MEM_COMMIT)
+      committed += region_end - cursor;
+    cursor = region_end;
+  }
+  return committed;
+#endif
+}
+
+void Shadow::ClearShadow(size_t begin, size_t end) {
+  DCHECK_LE(begin, end);
+  DCHECK_GE(length_, end);
+
+#ifdef _WIN64
+  // Only decommit the memory that we reserved ourselves, as the exception
+  // handler is then guaranteed to commit it back on demand.
+  if (own_memory_) {
+    uint8_t* pages_begin = ::common::AlignUp(shadow_ + begin, kPageSize);
+    uint8_t* pages_end = ::common::AlignDown(shadow_ + end, kPageSize);
+    if (pages_begin < pages_end &&
+        static_cast<size_t>(pages_end - pages_begin) >=
+            kShadowDecommitMinPageCount * kPageSize) {
+      kernels_->fill(shadow_ + begin, pages_begin, kHeapAddressableMarker);
+      CHECK(::VirtualFree(pages_begin, pages_end - pages_begin,
+                          MEM_DECOMMIT));
+      kernels_->fill(pages_end, shadow_ + end, kHeapAddressableMarker);
+      return;
+    }
+  }
+#endif
+
+  kernels_->fill(shadow_ + begin, shadow_ + end, kHeapAddressableMarker);
+}
+
+void Shadow::UpdateSummary(size_t begin, size_t end, uint8_t marker) {
+  uint8_t flags = 0;
+  if (ShadowMarkerHelper::IsBlockStart(marker))
+    flags |= static_cast<uint8_t>(kSummaryMayContainBlockStart);
+  if (ShadowMarkerHelper::IsBlockEnd(marker))
+    flags |= static_cast<uint8_t>(kSummaryMayContainBlockEnd);
+
+  ClearSummaryFlags(begin, end,
+                    static_cast<uint8_t>(kSummaryAllFlags & ~flags));
+  if (flags != 0)
+    SetSummaryFlags(begin, end, flags);
+}
+
+void Shadow::SetSummaryFlags(size_t begin, size_t end, uint8_t flags) {
+  DCHECK_LE(begin, end);
+  DCHECK_GE(length_, end);
+  if (begin == end)
+    return;
+
+  size_t region_end = ((end - 1) >> kShadowSummaryRatioLog) + 1;
+  for (size_t i = begin >> kShadowSummaryRatioLog; i < region_end; ++i) {
+    // Avoid the interlocked operation when the flags are already set, which is
+    // the common case for regions holding many blocks.
+    if ((summary_[i] & flags) != flags) {
+      ::_InterlockedOr8(reinterpret_cast<volatile char*>(summary_ + i),
+                        static_cast<char>(flags));
+    }
+  }
+}
+
+void Shadow::ClearSummaryFlags(size_t begin, size_t end, uint8_t flags) {
+  DCHECK_LE(begin, end);
+  DCHECK_GE(length_, end);
+
+  // Only the regions entirely contained in the range are cleared.
+  size_t region_begin =
+      (begin + (1 << kShadowSummaryRatioLog) - 1) >> kShadowSummaryRatioLog;
+  size_t region_end = end >> kShadowSummaryRatioLog;
+  for (size_t i = region_begin; i < region_end; ++i) {
+    if ((summary_[i] & flags) != 0) {
+      ::_InterlockedAnd8(reinterpret_cast<volatile char*>(summary_ + i),
+                         static_cast<char>(~flags));
+    }
+  }
+}
+
 bool Shadow::ScanLeftForBracketingBlockStart(size_t cursor,
                                              size_t* location) const {
   DCHECK_NE(static_cast<size_t*>(NULL), location);
@@ -889,6 +1036,14 @@ bool Shadow::ScanLeftForBracketingBlockStart(size_t cursor,
         return false;
     }
 #endif
+    // Skip over the regions that don't contain any block start marker.
+    if (!MayContainBlockStart(left)) {
+      left = ::common::AlignDown(left, 1 << kShadowSummaryRatioLog);
+      if (left <= kLowerBound)
+        return false;
+      --left;
+      continue;
+    }
     if (ShadowMarkerHelper::IsBlockStart(shadow_[left])) {
       *location = left;
       return true;
@@ -986,13 +1141,25 @@ bool Shadow::ScanRightForBracketingBlockEnd(size_t cursor,
                                             size_t* location) const {
   DCHECK_NE(static_cast<size_t*>(NULL), location);
 
+  static const size_t kRegionSize = 1 << kShadowSummaryRatioLog;
+
   const uint8_t* shadow_end = shadow_ + length_;
   const uint8_t* pos = shadow_ + cursor;
   while (pos < shadow_end) {
+    // Skip over the regions that don't contain any block end marker.
+    size_t index = pos - shadow_;
+    const uint8_t* region_end = std::min(
+        shadow_ + ::common::AlignDown(index, kRegionSize) + kRegionSize,
+        shadow_end);
+    if (!MayContainBlockEnd(index)) {
+      pos = region_end;
+      continue;
+    }
+
     // Skips past as many addressable and freed bytes as possible.
-    pos = ScanRightForPotentialHeaderBytes(pos, shadow_end);
-    if (pos == shadow_end)
-      return false;
+    pos = ScanRightForPotentialHeaderBytes(pos, region_end);
+    if (pos == region_end)
+      continue;
 
     // When the above loop exits early then somewhere in the next 8 bytes
     // there's non-addressable data that isn't 'freed'. Look byte by byte to
@@ -1133,6 +1300,18 @@ bool ShadowWalker::Next(BlockInfo* info) {
 
     // Scan this committed portion of the shadow.
     while (shadow_cursor_ < end_of_region) {
+      // Skip over the summary regions that don't contain any block start
+      // marker.
+      size_t index = shadow_cursor_ - shadow_->shadow();
+      if (!shadow_->MayContainBlockStart(index)) {
+        static const size_t kRegionSize = 1 << Shadow::kShadowSummaryRatioLog;
+        shadow_cursor_ = std::min(
+            shadow_->shadow() + ::common::AlignDown(index, kRegionSize) +
+                kRegionSize,
+            end_of_region);
+        continue;
+      }
+
       uint8_t marker = *shadow_cursor_;
 
       // Update the nesting depth when block end markers are encountered.
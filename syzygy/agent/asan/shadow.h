@@ -68,6 +68,7 @@
 #include "syzygy/agent/asan/block.h"
 #include "syzygy/agent/asan/constants.h"
 #include "syzygy/agent/asan/shadow_marker.h"
+#include "syzygy/agent/asan/shadow_simd.h"
 
 namespace agent {
 namespace asan {
@@ -89,6 +90,29 @@ class Shadow {
   // shadow bytes will be reported in all.
   static const size_t kShadowContextLines = 4;
 
+  // The shadow summary keeps a few bits of information for each region of
+  // 2^kShadowSummaryRatioLog shadow bytes, which lets the scans looking for
+  // block markers skip whole regions. The bits are conservative: a set bit
+  // means that the region may contain the marker, a cleared one that it
+  // definitely doesn't.
+  static const size_t kShadowSummaryRatioLog = 12;
+
+  // On 64-bit the shadow is only committed as it gets touched. Uncommitted
+  // shadow pages read back as zero, i.e. as entirely addressable memory, so
+  // the shadow pages that get cleaned up entirely are decommitted. This keeps
+  // the committed shadow proportional to the live heap rather than to the
+  // address space. To avoid committing and decommitting the same pages over
+  // and over only ranges of at least this many shadow pages are decommitted.
+  static const size_t kShadowDecommitMinPageCount = 16;
+
+  // The bits of information kept in the shadow summary.
+  enum ShadowSummaryFlags : uint8_t {
+    kSummaryMayContainBlockStart = 1 << 0,
+    kSummaryMayContainBlockEnd = 1 << 1,
+    kSummaryAllFlags =
+        kSummaryMayContainBlockStart | kSummaryMayContainBlockEnd,
+  };
+
   // Default constructor. Creates a shadow memory of the appropriate size
   // depending on the addressable memory for this process.
   // @note The allocation may fail, in which case 'shadow()' will return
@@ -272,6 +296,12 @@ class Shadow {
   // @note Grabs a global shadow lock.
   void MarkPagesUnprotected(const void* addr, size_t size);
 
+  // Determines how much of the shadow memory is actually committed. This
+  // walks the shadow with VirtualQuery, so this isn't meant to be called on
+  // a hot path.
+  // @returns the number of bytes of committed shadow memory.
+  size_t GetCommittedSize() const;
+
   // Returns the size of memory represented by the shadow. This is a 64-bit
   // result to prevent overflow for 4GB 32-bit processes.
   const uint64_t memory_size() const {
@@ -291,6 +321,21 @@ class Shadow {
   // Returns the length of the page bits array.
   size_t const page_bits_size() const { return page_bits_length_; }
 
+  // Read only accessor of the shadow summary.
+  const uint8_t* summary() const { return summary_; }
+
+  // Returns the length of the shadow summary array.
+  size_t summary_size() const { return summary_length_; }
+
+  // @name Queries the shadow summary.
+  // @param index The index of a shadow byte.
+  // @returns false if the summary region containing shadow_[index] is known
+  //     not to contain a block start (end) marker, true otherwise.
+  // @{
+  bool MayContainBlockStart(size_t index) const;
+  bool MayContainBlockEnd(size_t index) const;
+  // @}
+
   // Determines if the shadow memory is clean. That is, it reflects the
   // state of shadow memory immediately after construction and a call to
   // SetUp.
@@ -328,6 +373,29 @@ class Shadow {
                             std::string* output,
                             size_t bug_index) const;
 
+  // Sets the shadow bytes [begin, end) to kHeapAddressableMarker. On 64-bit
+  // the large enough runs of whole shadow pages are decommitted rather than
+  // written to, as they read back as zero.
+  // @param begin The index of the first shadow byte to clear.
+  // @param end The index past the last shadow byte to clear.
+  void ClearShadow(size_t begin, size_t end);
+
+  // Updates the shadow summary after the shadow bytes [begin, end) have all
+  // been set to @p marker.
+  // @param begin The index of the first shadow byte that was set.
+  // @param end The index past the last shadow byte that was set.
+  // @param marker The marker that was written.
+  void UpdateSummary(size_t begin, size_t end, uint8_t marker);
+
+  // Sets @p flags in the summary of every region overlapping the shadow bytes
+  // [begin, end).
+  void SetSummaryFlags(size_t begin, size_t end, uint8_t flags);
+
+  // Clears @p flags in the summary of every region entirely contained in the
+  // shadow bytes [begin, end). The regions that are partially covered are
+  // left untouched, as other markers may live in their remaining bytes.
+  void ClearSummaryFlags(size_t begin, size_t end, uint8_t flags);
+
   // Scans to the left of the provided cursor, looking for the presence of a
   // block start marker that brackets the cursor.
   // @param cursor The position in shadow memory from which to start the scan.
@@ -361,6 +429,10 @@ class Shadow {
   // The length of the underlying shadow.
   size_t length_;
 
+  // The kernels used to fill and scan ranges of shadow bytes. They use the
+  // most capable instruction set of the CPU.
+  const simd::ShadowKernels* kernels_;
+
   // A lock under which page protection bits are modified.
   base::Lock page_bits_lock_;
 
@@ -373,6 +445,14 @@ class Shadow {
   // The length of page_bits_. Under page_bits_lock_.
   size_t page_bits_length_;
 
+  // The shadow summary, with one byte of ShadowSummaryFlags per region of
+  // shadow memory. It is stored like the shadow, and is updated with
+  // interlocked operations as the regions may be shared by several blocks.
+  uint8_t* summary_;
+
+  // The length of summary_.
+  size_t summary_length_;
+
 #ifdef _WIN64
   // The exception handler handle to be able to remove it on object destruction.
   HANDLE exception_handler_;
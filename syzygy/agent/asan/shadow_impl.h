@@ -18,6 +18,23 @@
 #ifndef SYZYGY_AGENT_ASAN_SHADOW_IMPL_H_
 #define SYZYGY_AGENT_ASAN_SHADOW_IMPL_H_
 
+namespace internal {
+
+// Returns true iff one of the elements packed in a word is zero. This tests
+// all the elements at once, with the usual borrow propagation trick.
+// @tparam type The type of the elements.
+// @param word The word to test.
+// @returns true iff at least one of the elements in @p word is zero.
+template <typename type>
+bool HasNullElement(uint64_t word) {
+  static_assert(sizeof(type) <= sizeof(uint32_t), "Unsupported element size.");
+  const uint64_t kLowBits = ~0ULL / ((1ULL << (sizeof(type) * 8)) - 1);
+  const uint64_t kHighBits = kLowBits << (sizeof(type) * 8 - 1);
+  return ((word - kLowBits) & ~word & kHighBits) != 0;
+}
+
+}  // namespace internal
+
 template <typename type>
 bool Shadow::GetNullTerminatedArraySize(const void* addr,
                                         size_t max_size,
@@ -26,29 +43,44 @@ bool Shadow::GetNullTerminatedArraySize(const void* addr,
   DCHECK_NE(reinterpret_cast<size_t*>(NULL), size);
 
   uintptr_t index = reinterpret_cast<uintptr_t>(addr);
-  const type* addr_value = reinterpret_cast<const type*>(addr);
-  index >>= 3;
+  const uint8_t* cursor = reinterpret_cast<const uint8_t*>(addr);
+  index >>= kShadowRatioLog;
   *size = 0;
 
   if (index > length_)
     return false;
 
-  // Scan the input array 8 bytes at a time until we've found a NULL value or
-  // we've reached the end of an accessible memory block.
-  // TODO(sebmarchand): Look into doing this more efficiently.
+  // Scan the shadow and the array together, one group of kShadowRatio bytes
+  // at a time, until we've found a NULL value or we've reached the end of an
+  // accessible memory block.
   while (true) {
-    uint8_t shadow = shadow_[index++];
+    uint8_t shadow = shadow_[index];
     if (ShadowMarkerHelper::IsRedzone(shadow))
       return false;
 
-    uint8_t max_index = shadow ? shadow : kShadowRatio;
-    DCHECK_EQ(0U, max_index % sizeof(type));
-    max_index /= sizeof(type);
-    while (max_index-- > 0) {
+    const uint8_t* group = reinterpret_cast<const uint8_t*>(
+        index << kShadowRatioLog);
+    const uint8_t* group_end = group + (shadow ? shadow : kShadowRatio);
+    ++index;
+
+    // A fully accessible group that doesn't reach |max_size| is tested for a
+    // NULL value with a single read.
+    if (shadow == 0 && cursor == group &&
+        (max_size == 0 || *size + kShadowRatio < max_size)) {
+      uint64_t word = *reinterpret_cast<const uint64_t*>(cursor);
+      if (!internal::HasNullElement<type>(word)) {
+        *size += kShadowRatio;
+        cursor += kShadowRatio;
+        continue;
+      }
+    }
+
+    // Otherwise fall back to testing the values one at a time.
+    while (cursor < group_end) {
       (*size) += sizeof(type);
-      if (*size == max_size || *addr_value == 0)
+      if (*size == max_size || *reinterpret_cast<const type*>(cursor) == 0)
         return true;
-      addr_value++;
+      cursor += sizeof(type);
     }
 
     if (shadow != 0)
@@ -0,0 +1,351 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/shadow_simd.h"
+
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <intrin.h>
+#include <string.h>
+
+#include "base/logging.h"
+#include "syzygy/agent/asan/shadow_marker.h"
+#include "syzygy/common/align.h"
+
+namespace agent {
+namespace asan {
+namespace simd {
+
+namespace {
+
+// The CPUID feature bits used to detect the supported instruction sets.
+static const int kCpuidSse2Bit = 1 << 26;      // CPUID.1.EDX.
+static const int kCpuidOsxsaveBit = 1 << 27;   // CPUID.1.ECX.
+static const int kCpuidAvxBit = 1 << 28;       // CPUID.1.ECX.
+static const int kCpuidAvx2Bit = 1 << 5;       // CPUID.(EAX=7,ECX=0).EBX.
+
+// The XCR0 bits indicating that the OS saves the SSE and AVX registers.
+static const uint64_t kXcr0SseAndAvxState = 0x6;
+
+// @returns the index of the lowest bit set in @p mask.
+// @pre @p mask must not be zero.
+inline size_t LowestBitSet(uint32_t mask) {
+  DCHECK_NE(0U, mask);
+  unsigned long index = 0;
+  ::_BitScanForward(&index, mask);
+  return index;
+}
+
+// @returns true if @p marker must be preserved when marking memory as freed.
+// This mirrors ShadowMarkerHelper::IsActiveLeftRedzone and
+// ShadowMarkerHelper::IsActiveRightRedzone.
+inline bool IsPreservedWhenFreed(uint8_t marker) {
+  return marker == kHeapLeftPaddingMarker ||
+         marker == kHeapRightPaddingMarker ||
+         marker == kHeapBlockEndMarker ||
+         (marker & 0xF0) == kHeapBlockStartMarker0;
+}
+
+// @name Scalar kernels.
+// @{
+void FillScalar(uint8_t* begin, uint8_t* end, uint8_t value) {
+  DCHECK_LE(begin, end);
+  ::memset(begin, value, end - begin);
+}
+
+const uint8_t* FindFirstNonZeroScalar(const uint8_t* begin,
+                                      const uint8_t* end) {
+  DCHECK_LE(begin, end);
+
+  // Walk to the first aligned word, then compare a word at a time.
+  const uint8_t* cursor = begin;
+  const uint8_t* aligned_end = ::common::AlignDown(end, sizeof(uint64_t));
+  if (cursor < aligned_end) {
+    const uint8_t* aligned = ::common::AlignUp(cursor, sizeof(uint64_t));
+    for (; cursor != aligned; ++cursor) {
+      if (*cursor != 0)
+        return cursor;
+    }
+    for (; cursor != aligned_end; cursor += sizeof(uint64_t)) {
+      if (*reinterpret_cast<const uint64_t*>(cursor) != 0)
+        break;
+    }
+  }
+
+  for (; cursor != end; ++cursor) {
+    if (*cursor != 0)
+      return cursor;
+  }
+  return end;
+}
+
+void MarkAsFreedScalar(uint8_t* begin, uint8_t* end) {
+  DCHECK_LE(begin, end);
+  for (uint8_t* cursor = begin; cursor != end; ++cursor) {
+    if (!IsPreservedWhenFreed(*cursor))
+      *cursor = kHeapFreedMarker;
+  }
+}
+// @}
+
+// @name SSE2 kernels. The ranges shorter than a vector are handled by the
+// scalar kernels. The longer ones start and end with an unaligned access, and
+// use aligned accesses in between; the accesses may overlap as the kernels are
+// idempotent.
+// @{
+static const size_t kSse2Width = sizeof(__m128i);
+
+void FillSse2(uint8_t* begin, uint8_t* end, uint8_t value) {
+  DCHECK_LE(begin, end);
+  if (static_cast<size_t>(end - begin) < kSse2Width)
+    return FillScalar(begin, end, value);
+
+  const __m128i fill = _mm_set1_epi8(static_cast<char>(value));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(begin), fill);
+  uint8_t* cursor = ::common::AlignUp(begin + 1, kSse2Width);
+  for (; cursor + kSse2Width <= end; cursor += kSse2Width)
+    _mm_store_si128(reinterpret_cast<__m128i*>(cursor), fill);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(end - kSse2Width), fill);
+}
+
+// @returns a mask with a bit set for each non-zero byte of @p value.
+inline uint32_t NonZeroMaskSse2(__m128i value) {
+  __m128i is_zero = _mm_cmpeq_epi8(value, _mm_setzero_si128());
+  return ~static_cast<uint32_t>(_mm_movemask_epi8(is_zero)) & 0xFFFF;
+}
+
+const uint8_t* FindFirstNonZeroSse2(const uint8_t* begin,
+                                    const uint8_t* end) {
+  DCHECK_LE(begin, end);
+  if (static_cast<size_t>(end - begin) < kSse2Width)
+    return FindFirstNonZeroScalar(begin, end);
+
+  uint32_t mask = NonZeroMaskSse2(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin)));
+  if (mask != 0)
+    return begin + LowestBitSet(mask);
+
+  const uint8_t* cursor = ::common::AlignUp(begin + 1, kSse2Width);
+  for (; cursor + kSse2Width <= end; cursor += kSse2Width) {
+    mask = NonZeroMaskSse2(
+        _mm_load_si128(reinterpret_cast<const __m128i*>(cursor)));
+    if (mask != 0)
+      return cursor + LowestBitSet(mask);
+  }
+
+  // The bytes before the tail are known to be zero, so the first non-zero
+  // byte of the tail is the first one of the range.
+  cursor = end - kSse2Width;
+  mask = NonZeroMaskSse2(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(cursor)));
+  if (mask != 0)
+    return cursor + LowestBitSet(mask);
+  return end;
+}
+
+// @returns the shadow bytes @p value marked as freed.
+inline __m128i MarkAsFreedSse2(__m128i value) {
+  const __m128i kLeftPadding = _mm_set1_epi8(
+      static_cast<char>(kHeapLeftPaddingMarker));
+  const __m128i kRightPadding = _mm_set1_epi8(
+      static_cast<char>(kHeapRightPaddingMarker));
+  const __m128i kBlockEnd = _mm_set1_epi8(
+      static_cast<char>(kHeapBlockEndMarker));
+  const __m128i kBlockStart = _mm_set1_epi8(
+      static_cast<char>(kHeapBlockStartMarker0));
+  const __m128i kFirstNibble = _mm_set1_epi8(static_cast<char>(0xF0));
+  const __m128i kFreed = _mm_set1_epi8(static_cast<char>(kHeapFreedMarker));
+
+  __m128i keep = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(value, kLeftPadding),
+                   _mm_cmpeq_epi8(value, kRightPadding)),
+      _mm_or_si128(_mm_cmpeq_epi8(value, kBlockEnd),
+                   _mm_cmpeq_epi8(_mm_and_si128(value, kFirstNibble),
+                                  kBlockStart)));
+  return _mm_or_si128(_mm_and_si128(keep, value),
+                      _mm_andnot_si128(keep, kFreed));
+}
+
+void MarkAsFreedSse2(uint8_t* begin, uint8_t* end) {
+  DCHECK_LE(begin, end);
+  if (static_cast<size_t>(end - begin) < kSse2Width)
+    return MarkAsFreedScalar(begin, end);
+
+  __m128i* head = reinterpret_cast<__m128i*>(begin);
+  _mm_storeu_si128(head, MarkAsFreedSse2(_mm_loadu_si128(head)));
+  uint8_t* cursor = ::common::AlignUp(begin + 1, kSse2Width);
+  for (; cursor + kSse2Width <= end; cursor += kSse2Width) {
+    __m128i* vector = reinterpret_cast<__m128i*>(cursor);
+    _mm_store_si128(vector, MarkAsFreedSse2(_mm_load_si128(vector)));
+  }
+  __m128i* tail = reinterpret_cast<__m128i*>(end - kSse2Width);
+  _mm_storeu_si128(tail, MarkAsFreedSse2(_mm_loadu_si128(tail)));
+}
+// @}
+
+// @name AVX2 kernels. They follow the structure of the SSE2 ones, and clear
+// the upper halves of the registers on exit to avoid the AVX to SSE transition
+// penalty in the surrounding code.
+// @{
+static const size_t kAvx2Width = sizeof(__m256i);
+
+void FillAvx2(uint8_t* begin, uint8_t* end, uint8_t value) {
+  DCHECK_LE(begin, end);
+  if (static_cast<size_t>(end - begin) < kAvx2Width)
+    return FillSse2(begin, end, value);
+
+  const __m256i fill = _mm256_set1_epi8(static_cast<char>(value));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(begin), fill);
+  uint8_t* cursor = ::common::AlignUp(begin + 1, kAvx2Width);
+  for (; cursor + kAvx2Width <= end; cursor += kAvx2Width)
+    _mm256_store_si256(reinterpret_cast<__m256i*>(cursor), fill);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(end - kAvx2Width), fill);
+  _mm256_zeroupper();
+}
+
+// @returns a mask with a bit set for each non-zero byte of @p value.
+inline uint32_t NonZeroMaskAvx2(__m256i value) {
+  __m256i is_zero = _mm256_cmpeq_epi8(value, _mm256_setzero_si256());
+  return ~static_cast<uint32_t>(_mm256_movemask_epi8(is_zero));
+}
+
+const uint8_t* FindFirstNonZeroAvx2(const uint8_t* begin,
+                                    const uint8_t* end) {
+  DCHECK_LE(begin, end);
+  if (static_cast<size_t>(end - begin) < kAvx2Width)
+    return FindFirstNonZeroSse2(begin, end);
+
+  const uint8_t* result = end;
+  const uint8_t* cursor = ::common::AlignUp(begin + 1, kAvx2Width);
+  uint32_t mask = NonZeroMaskAvx2(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin)));
+  if (mask != 0) {
+    result = begin + LowestBitSet(mask);
+  } else {
+    for (; cursor + kAvx2Width <= end; cursor += kAvx2Width) {
+      mask = NonZeroMaskAvx2(
+          _mm256_load_si256(reinterpret_cast<const __m256i*>(cursor)));
+      if (mask != 0)
+        break;
+    }
+    if (mask != 0) {
+      result = cursor + LowestBitSet(mask);
+    } else {
+      cursor = end - kAvx2Width;
+      mask = NonZeroMaskAvx2(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cursor)));
+      if (mask != 0)
+        result = cursor + LowestBitSet(mask);
+    }
+  }
+
+  _mm256_zeroupper();
+  return result;
+}
+
+// @returns the shadow bytes @p value marked as freed.
+inline __m256i MarkAsFreedAvx2(__m256i value) {
+  const __m256i kLeftPadding = _mm256_set1_epi8(
+      static_cast<char>(kHeapLeftPaddingMarker));
+  const __m256i kRightPadding = _mm256_set1_epi8(
+      static_cast<char>(kHeapRightPaddingMarker));
+  const __m256i kBlockEnd = _mm256_set1_epi8(
+      static_cast<char>(kHeapBlockEndMarker));
+  const __m256i kBlockStart = _mm256_set1_epi8(
+      static_cast<char>(kHeapBlockStartMarker0));
+  const __m256i kFirstNibble = _mm256_set1_epi8(static_cast<char>(0xF0));
+  const __m256i kFreed = _mm256_set1_epi8(
+      static_cast<char>(kHeapFreedMarker));
+
+  __m256i keep = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(value, kLeftPadding),
+                      _mm256_cmpeq_epi8(value, kRightPadding)),
+      _mm256_or_si256(_mm256_cmpeq_epi8(value, kBlockEnd),
+                      _mm256_cmpeq_epi8(_mm256_and_si256(value, kFirstNibble),
+                                        kBlockStart)));
+  return _mm256_or_si256(_mm256_and_si256(keep, value),
+                         _mm256_andnot_si256(keep, kFreed));
+}
+
+void MarkAsFreedAvx2(uint8_t* begin, uint8_t* end) {
+  DCHECK_LE(begin, end);
+  if (static_cast<size_t>(end - begin) < kAvx2Width)
+    return MarkAsFreedSse2(begin, end);
+
+  __m256i* head = reinterpret_cast<__m256i*>(begin);
+  _mm256_storeu_si256(head, MarkAsFreedAvx2(_mm256_loadu_si256(head)));
+  uint8_t* cursor = ::common::AlignUp(begin + 1, kAvx2Width);
+  for (; cursor + kAvx2Width <= end; cursor += kAvx2Width) {
+    __m256i* vector = reinterpret_cast<__m256i*>(cursor);
+    _mm256_store_si256(vector, MarkAsFreedAvx2(_mm256_load_si256(vector)));
+  }
+  __m256i* tail = reinterpret_cast<__m256i*>(end - kAvx2Width);
+  _mm256_storeu_si256(tail, MarkAsFreedAvx2(_mm256_loadu_si256(tail)));
+  _mm256_zeroupper();
+}
+// @}
+
+// The kernels, indexed by instruction set.
+const ShadowKernels kShadowKernels[kInstructionSetMax] = {
+  { &FillScalar, &FindFirstNonZeroScalar, &MarkAsFreedScalar },
+  { &FillSse2, &FindFirstNonZeroSse2, &MarkAsFreedSse2 },
+  { &FillAvx2, &FindFirstNonZeroAvx2, &MarkAsFreedAvx2 },
+};
+
+}  // namespace
+
+bool IsInstructionSetSupported(InstructionSet instruction_set) {
+  DCHECK_GT(kInstructionSetMax, instruction_set);
+
+  if (instruction_set == kScalarInstructionSet)
+    return true;
+
+  int info[4] = {};
+  ::__cpuid(info, 0);
+  int max_leaf = info[0];
+  ::__cpuid(info, 1);
+  if ((info[3] & kCpuidSse2Bit) == 0)
+    return false;
+  if (instruction_set == kSse2InstructionSet)
+    return true;
+
+  // AVX2 requires the OS to save the upper halves of the YMM registers.
+  DCHECK_EQ(kAvx2InstructionSet, instruction_set);
+  if ((info[2] & kCpuidOsxsaveBit) == 0 || (info[2] & kCpuidAvxBit) == 0)
+    return false;
+  if ((::_xgetbv(0) & kXcr0SseAndAvxState) != kXcr0SseAndAvxState)
+    return false;
+  if (max_leaf < 7)
+    return false;
+  ::__cpuidex(info, 7, 0);
+  return (info[1] & kCpuidAvx2Bit) != 0;
+}
+
+InstructionSet GetBestInstructionSet() {
+  if (IsInstructionSetSupported(kAvx2InstructionSet))
+    return kAvx2InstructionSet;
+  if (IsInstructionSetSupported(kSse2InstructionSet))
+    return kSse2InstructionSet;
+  return kScalarInstructionSet;
+}
+
+const ShadowKernels& GetShadowKernels(InstructionSet instruction_set) {
+  DCHECK_GT(kInstructionSetMax, instruction_set);
+  DCHECK(IsInstructionSetSupported(instruction_set));
+  return kShadowKernels[instruction_set];
+}
+
+}  // namespace simd
+}  // namespace asan
+}  // namespace agent
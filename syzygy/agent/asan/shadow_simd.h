@@ -0,0 +1,71 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the vectorized kernels used by the shadow memory to fill and scan
+// ranges of shadow bytes. Every kernel comes in a scalar, an SSE2 and an AVX2
+// flavour, and the best flavour supported by the CPU and the OS is selected at
+// runtime.
+
+#ifndef SYZYGY_AGENT_ASAN_SHADOW_SIMD_H_
+#define SYZYGY_AGENT_ASAN_SHADOW_SIMD_H_
+
+#include <stdint.h>
+
+namespace agent {
+namespace asan {
+namespace simd {
+
+// The instruction sets for which the kernels are implemented, from the least
+// to the most capable.
+enum InstructionSet {
+  kScalarInstructionSet,
+  kSse2InstructionSet,
+  kAvx2InstructionSet,
+  kInstructionSetMax,
+};
+
+// The kernels operating on a range of shadow bytes [begin, end). None of them
+// reads or writes outside of this range, and none of them has any alignment
+// requirement.
+struct ShadowKernels {
+  // Sets every shadow byte of the range to @p value.
+  void (*fill)(uint8_t* begin, uint8_t* end, uint8_t value);
+
+  // @returns a pointer to the first non-zero shadow byte of the range, or
+  //     @p end if they are all zero.
+  const uint8_t* (*find_first_non_zero)(const uint8_t* begin,
+                                        const uint8_t* end);
+
+  // Marks every shadow byte of the range as freed, except for the active
+  // left and right redzone markers, which are preserved so that the nested
+  // blocks remain intact.
+  void (*mark_as_freed)(uint8_t* begin, uint8_t* end);
+};
+
+// @returns true if both the CPU and the OS support @p instruction_set.
+bool IsInstructionSetSupported(InstructionSet instruction_set);
+
+// @returns the most capable instruction set supported by the CPU and the OS.
+InstructionSet GetBestInstructionSet();
+
+// @param instruction_set The instruction set used by the kernels.
+// @returns the kernels implemented with @p instruction_set.
+// @pre @p instruction_set must be supported.
+const ShadowKernels& GetShadowKernels(InstructionSet instruction_set);
+
+}  // namespace simd
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_SHADOW_SIMD_H_
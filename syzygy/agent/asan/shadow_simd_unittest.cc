@@ -0,0 +1,158 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/shadow_simd.h"
+
+#include "base/macros.h"
+#include "base/rand_util.h"
+#include "gtest/gtest.h"
+#include "syzygy/agent/asan/shadow_marker.h"
+
+namespace agent {
+namespace asan {
+namespace simd {
+
+namespace {
+
+// The buffer used by the tests. It is large enough for ranges spanning
+// several AVX2 vectors with any head and tail alignment.
+const size_t kBufferSize = 160;
+
+// A sample of markers, with the ones preserved when marking memory as freed.
+const uint8_t kMarkers[] = {
+    kHeapAddressableMarker,
+    kHeapPartiallyAddressableByte3,
+    kHeapPartiallyAddressableByte7,
+    kHeapBlockStartMarker0,
+    kHeapBlockStartMarker7,
+    kHeapBlockEndMarker,
+    kHeapLeftPaddingMarker,
+    kHeapRightPaddingMarker,
+    kHeapFreedMarker,
+    kAsanMemoryMarker,
+    kHeapHistoricBlockStartMarker0,
+};
+
+void FillWithRandomMarkers(uint8_t* buffer, size_t size) {
+  for (size_t i = 0; i < size; ++i)
+    buffer[i] = kMarkers[base::RandInt(0, arraysize(kMarkers) - 1)];
+}
+
+class ShadowSimdTest : public testing::TestWithParam<InstructionSet> {
+ public:
+  void SetUp() override {
+    if (!IsInstructionSetSupported(GetParam()))
+      return;
+    kernels_ = &GetShadowKernels(GetParam());
+    scalar_kernels_ = &GetShadowKernels(kScalarInstructionSet);
+  }
+
+ protected:
+  const ShadowKernels* kernels_ = nullptr;
+  const ShadowKernels* scalar_kernels_ = nullptr;
+
+  ALIGNAS(32) uint8_t buffer_[kBufferSize];
+  ALIGNAS(32) uint8_t expected_[kBufferSize];
+};
+
+}  // namespace
+
+TEST(ShadowSimdSupportTest, BestInstructionSetIsSupported) {
+  EXPECT_TRUE(IsInstructionSetSupported(kScalarInstructionSet));
+  EXPECT_TRUE(IsInstructionSetSupported(GetBestInstructionSet()));
+}
+
+TEST_P(ShadowSimdTest, Fill) {
+  if (kernels_ == nullptr)
+    return;
+
+  for (size_t begin = 0; begin < 32; ++begin) {
+    for (size_t end = begin; end < kBufferSize; ++end) {
+      ::memset(buffer_, 0xCC, kBufferSize);
+      ::memset(expected_, 0xCC, kBufferSize);
+      ::memset(expected_ + begin, kHeapFreedMarker, end - begin);
+      kernels_->fill(buffer_ + begin, buffer_ + end, kHeapFreedMarker);
+      ASSERT_EQ(0, ::memcmp(expected_, buffer_, kBufferSize));
+    }
+  }
+}
+
+TEST_P(ShadowSimdTest, FindFirstNonZero) {
+  if (kernels_ == nullptr)
+    return;
+
+  ::memset(buffer_, 0xCC, kBufferSize);
+  for (size_t begin = 0; begin < 32; ++begin) {
+    for (size_t end = begin; end < kBufferSize; ++end) {
+      // The bytes outside of the range must be ignored.
+      ::memset(buffer_ + begin, 0, end - begin);
+      EXPECT_EQ(buffer_ + end,
+                kernels_->find_first_non_zero(buffer_ + begin, buffer_ + end));
+
+      // A non-zero byte anywhere in the range must be detected.
+      for (size_t i = begin; i < end; ++i) {
+        buffer_[i] = kHeapPartiallyAddressableByte1;
+        ASSERT_EQ(buffer_ + i,
+                  kernels_->find_first_non_zero(buffer_ + begin,
+                                                buffer_ + end));
+        buffer_[i] = 0;
+      }
+      ::memset(buffer_ + begin, 0xCC, end - begin);
+    }
+  }
+}
+
+TEST_P(ShadowSimdTest, MarkAsFreed) {
+  if (kernels_ == nullptr)
+    return;
+
+  for (size_t begin = 0; begin < 32; ++begin) {
+    for (size_t end = begin; end < kBufferSize; ++end) {
+      FillWithRandomMarkers(buffer_, kBufferSize);
+      ::memcpy(expected_, buffer_, kBufferSize);
+      scalar_kernels_->mark_as_freed(expected_ + begin, expected_ + end);
+      kernels_->mark_as_freed(buffer_ + begin, buffer_ + end);
+      ASSERT_EQ(0, ::memcmp(expected_, buffer_, kBufferSize));
+    }
+  }
+}
+
+TEST_P(ShadowSimdTest, MarkAsFreedPreservesRedzones) {
+  if (kernels_ == nullptr)
+    return;
+
+  for (size_t i = 0; i < arraysize(kMarkers); ++i) {
+    ::memset(buffer_, kMarkers[i], kBufferSize);
+    kernels_->mark_as_freed(buffer_, buffer_ + kBufferSize);
+
+    ShadowMarker marker = static_cast<ShadowMarker>(kMarkers[i]);
+    uint8_t expected = kHeapFreedMarker;
+    if (ShadowMarkerHelper::IsActiveLeftRedzone(marker) ||
+        ShadowMarkerHelper::IsActiveRightRedzone(marker)) {
+      expected = kMarkers[i];
+    }
+    for (size_t j = 0; j < kBufferSize; ++j)
+      ASSERT_EQ(expected, buffer_[j]);
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(InstructionSets,
+                        ShadowSimdTest,
+                        testing::Values(kScalarInstructionSet,
+                                        kSse2InstructionSet,
+                                        kAvx2InstructionSet));
+
+}  // namespace simd
+}  // namespace asan
+}  // namespace agent
@@ -15,7 +15,9 @@
 #include "syzygy/agent/asan/shadow.h"
 
 #include <memory>
+#include <vector>
 
+#include "base/macros.h"
 #include "base/rand_util.h"
 #include "base/strings/stringprintf.h"
 #include "gtest/gtest.h"
@@ -91,6 +93,8 @@ class TestShadow : public Shadow {
   using Shadow::Reset;
   using Shadow::ScanLeftForBracketingBlockStart;
   using Shadow::ScanRightForBracketingBlockEnd;
+  using Shadow::SetSummaryFlags;
+  using Shadow::kernels_;
   using Shadow::shadow_;
 };
 
@@ -287,6 +291,91 @@ TEST_F(ShadowTest, IsAccessibleRange) {
   test_shadow.Unpoison(aligned_test_array, aligned_array_length);
 }
 
+TEST_F(ShadowTest, IsAccessibleRangeWithPoisonedGroup) {
+  // Ranges of up to 128 bytes are checked without the vectorized kernels,
+  // longer ones with them. Both need to catch a poisoned group anywhere in the
+  // range, and not only at its ends.
+  const size_t kRangeSize = 256;
+  ALIGNAS(8) uint8_t buf[kRangeSize + 2 * kShadowRatio] = {};
+  uint8_t* data = buf + kShadowRatio;
+  test_shadow.Poison(buf, sizeof(buf), kAsanReservedMarker);
+  test_shadow.Unpoison(data, kRangeSize);
+
+  for (size_t size = 1; size <= kRangeSize; ++size) {
+    for (size_t offset = 0; offset < kShadowRatio && offset < size; ++offset) {
+      EXPECT_TRUE(test_shadow.IsRangeAccessible(data + offset, size - offset));
+
+      // Poison every group of the range in turn.
+      for (size_t hole = offset & ~(kShadowRatio - 1); hole < size;
+           hole += kShadowRatio) {
+        test_shadow.Poison(data + hole, kShadowRatio, kHeapFreedMarker);
+        EXPECT_FALSE(
+            test_shadow.IsRangeAccessible(data + offset, size - offset));
+        test_shadow.Unpoison(data + hole, kShadowRatio);
+      }
+    }
+  }
+
+  // A partially accessible group at the start of the range.
+  test_shadow.Unpoison(data, kShadowRatio / 2);
+  EXPECT_TRUE(test_shadow.IsRangeAccessible(data, kShadowRatio / 2));
+  EXPECT_FALSE(test_shadow.IsRangeAccessible(data, kShadowRatio / 2 + 1));
+  EXPECT_FALSE(test_shadow.IsRangeAccessible(data + kShadowRatio / 2, 1));
+
+  test_shadow.Unpoison(buf, sizeof(buf));
+}
+
+TEST_F(ShadowTest, GetNullTerminatedArraySizeUnaligned) {
+  const size_t kArraySize = 64;
+  ALIGNAS(8) uint8_t buf[kArraySize + 2 * kShadowRatio] = {};
+  uint8_t* data = buf + kShadowRatio;
+  test_shadow.Poison(buf, sizeof(buf), kAsanReservedMarker);
+  test_shadow.Unpoison(data, kArraySize);
+  ::memset(data, 'a', kArraySize);
+
+  // Null-terminated strings of every length, at every alignment. This goes
+  // through both the groups that are tested at once and the ones that are
+  // tested a character at a time.
+  for (size_t start = 0; start < kShadowRatio; ++start) {
+    for (size_t end = start; end < kArraySize; ++end) {
+      data[end] = 0;
+      size_t size = 0;
+      EXPECT_TRUE(test_shadow.GetNullTerminatedArraySize<uint8_t>(
+          data + start, 0U, &size));
+      EXPECT_EQ(end - start + 1, size);
+
+      // The maximum size stops the scan before the null character.
+      if (end > start) {
+        EXPECT_TRUE(test_shadow.GetNullTerminatedArraySize<uint8_t>(
+            data + start, end - start, &size));
+        EXPECT_EQ(end - start, size);
+      }
+      data[end] = 'a';
+    }
+
+    // Without a null character the scan stops at the end of the accessible
+    // memory.
+    size_t size = 0;
+    EXPECT_FALSE(test_shadow.GetNullTerminatedArraySize<uint8_t>(
+        data + start, 0U, &size));
+    EXPECT_EQ(kArraySize - start, size);
+  }
+
+  // Wide strings.
+  uint16_t* wide_data = reinterpret_cast<uint16_t*>(data);
+  for (size_t end = 0; end < kArraySize / sizeof(uint16_t); ++end) {
+    wide_data[end] = 0;
+    size_t size = 0;
+    EXPECT_TRUE(test_shadow.GetNullTerminatedArraySize<uint16_t>(
+        wide_data, 0U, &size));
+    EXPECT_EQ((end + 1) * sizeof(uint16_t), size);
+    // This has a null byte, but isn't a null character.
+    wide_data[end] = 0x6100;
+  }
+
+  test_shadow.Unpoison(buf, sizeof(buf));
+}
+
 TEST_F(ShadowTest, FindFirstPoisonedByte) {
   ScopedAlignedArray scoped_test_array;
   const uint8_t* aligned_test_array = scoped_test_array.get_aligned_array();
@@ -432,6 +521,7 @@ TEST_F(ShadowTest, ScanLeftAndRight) {
   test_shadow.shadow_[offset + 0] = kHeapBlockStartMarker0;
   test_shadow.shadow_[offset + 1] = kHeapAddressableMarker;
   test_shadow.shadow_[offset + 2] = kHeapBlockEndMarker;
+  test_shadow.SetSummaryFlags(offset, offset + 3, Shadow::kSummaryAllFlags);
 
   EXPECT_TRUE(test_shadow.ScanLeftForBracketingBlockStart(offset + 0, &l));
   EXPECT_EQ(offset, l);
@@ -459,6 +549,10 @@ TEST_F(ShadowTest, ScanRightPerfTest) {
   test_shadow.shadow_[offset + 0] = kHeapBlockStartMarker0;
   // The end of the block.
   test_shadow.shadow_[offset + length - 1] = kHeapBlockEndMarker;
+  test_shadow.SetSummaryFlags(offset, offset + 1,
+                              Shadow::kSummaryMayContainBlockStart);
+  test_shadow.SetSummaryFlags(offset + length - 1, offset + length,
+                              Shadow::kSummaryMayContainBlockEnd);
 
   uint64_t tnet = 0;
   for (size_t i = 0; i < 100; ++i) {
@@ -475,6 +569,85 @@ TEST_F(ShadowTest, ScanRightPerfTest) {
   ::memset(test_shadow.shadow_ + offset, 0, length);
 }
 
+TEST_F(ShadowTest, ScanLeftPerfTest) {
+  size_t offset = test_shadow.length() / 2;
+  size_t length = 1 * 1024 * 1024;
+
+  ::memset(test_shadow.shadow_ + offset, 0, length);
+
+  test_shadow.shadow_[offset + 0] = kHeapBlockStartMarker0;
+  // The end of the block.
+  test_shadow.shadow_[offset + length - 1] = kHeapBlockEndMarker;
+  test_shadow.SetSummaryFlags(offset, offset + 1,
+                              Shadow::kSummaryMayContainBlockStart);
+  test_shadow.SetSummaryFlags(offset + length - 1, offset + length,
+                              Shadow::kSummaryMayContainBlockEnd);
+
+  uint64_t tnet = 0;
+  for (size_t i = 0; i < 100; ++i) {
+    size_t l = 0;
+    uint64_t t0 = ::__rdtsc();
+    test_shadow.ScanLeftForBracketingBlockStart(offset + length - 2, &l);
+    uint64_t t1 = ::__rdtsc();
+    tnet += t1 - t0;
+  }
+  testing::EmitMetric("Syzygy.Asan.Shadow.ScanLeftForBracketingBlockStart",
+                      tnet);
+
+  // Reset the shadow memory.
+  ::memset(test_shadow.shadow_ + offset, 0, length);
+}
+
+TEST_F(ShadowTest, SummaryTracksBlockMarkers) {
+  static const size_t kRegionSize = 1 << Shadow::kShadowSummaryRatioLog;
+
+  // Use a block spanning several summary regions, starting at the beginning
+  // of one of them.
+  BlockLayout layout = {};
+  EXPECT_TRUE(BlockPlanLayout(GetPageSize(), kShadowRatio,
+                              8 * kRegionSize * kShadowRatio, 0, 0, &layout));
+  std::vector<uint8_t> data(layout.block_size + kRegionSize * kShadowRatio);
+  uint8_t* block = ::common::AlignUp(data.data(), kRegionSize * kShadowRatio);
+  BlockInfo info = {};
+  BlockInitialize(layout, block, &info);
+
+  size_t begin = reinterpret_cast<uintptr_t>(block) >> kShadowRatioLog;
+  size_t end = begin + (layout.block_size >> kShadowRatioLog);
+  test_shadow.Unpoison(block, layout.block_size);
+  EXPECT_FALSE(test_shadow.MayContainBlockStart(begin));
+  EXPECT_FALSE(test_shadow.MayContainBlockEnd(end - 1));
+
+  // Only the regions holding the markers are flagged.
+  test_shadow.PoisonAllocatedBlock(info);
+  EXPECT_TRUE(test_shadow.MayContainBlockStart(begin));
+  EXPECT_FALSE(test_shadow.MayContainBlockEnd(begin));
+  EXPECT_TRUE(test_shadow.MayContainBlockEnd(end - 1));
+  for (size_t i = begin + kRegionSize; i < end - kRegionSize;
+       i += kRegionSize) {
+    EXPECT_FALSE(test_shadow.MayContainBlockStart(i));
+    EXPECT_FALSE(test_shadow.MayContainBlockEnd(i));
+  }
+
+  // The block can be found from any of its addresses.
+  for (size_t i = 0; i < layout.block_size; i += kRegionSize / 2) {
+    BlockInfo info_recovered = {};
+    EXPECT_TRUE(test_shadow.BlockInfoFromShadow(block + i, &info_recovered));
+    EXPECT_EQ(info.header, info_recovered.header);
+    EXPECT_EQ(info.block_size, info_recovered.block_size);
+  }
+
+  // Marking the block as freed preserves its markers.
+  test_shadow.MarkAsFreed(block, layout.block_size);
+  EXPECT_TRUE(test_shadow.MayContainBlockStart(begin));
+  EXPECT_TRUE(test_shadow.MayContainBlockEnd(end - 1));
+
+  // Unpoisoning the block clears the regions it entirely covers.
+  test_shadow.Unpoison(block, layout.block_size);
+  EXPECT_FALSE(test_shadow.MayContainBlockStart(begin));
+  size_t location = 0;
+  EXPECT_FALSE(test_shadow.ScanLeftForBracketingBlockStart(end - 1, &location));
+}
+
 TEST_F(ShadowTest, IsLeftOrRightRedzone) {
   BlockLayout layout = {};
   const size_t kAllocSize = 15;
@@ -610,6 +783,69 @@ TEST_F(ShadowTest, MarkAsFreedPerfTest) {
   testing::EmitMetric("Syzygy.Asan.Shadow.MarkAsFreed", tnet);
 }
 
+TEST_F(ShadowTest, RangeOperationsPerfTest) {
+  static const char* kInstructionSetNames[] = { "Scalar", "Sse2", "Avx2" };
+  static_assert(arraysize(kInstructionSetNames) == simd::kInstructionSetMax,
+                "Missing instruction set names.");
+  static const size_t kMinSize = 8;
+  static const size_t kMaxSize = 1024 * 1024;
+  static const size_t kIterations = 100;
+
+  std::vector<uint8_t> buf;
+  buf.resize(kMaxSize + kShadowRatio, 0);
+  uint8_t* data = ::common::AlignUp(buf.data(), kShadowRatio);
+
+  for (size_t i = 0; i < simd::kInstructionSetMax; ++i) {
+    simd::InstructionSet instruction_set =
+        static_cast<simd::InstructionSet>(i);
+    if (!simd::IsInstructionSetSupported(instruction_set))
+      continue;
+    test_shadow.kernels_ = &simd::GetShadowKernels(instruction_set);
+
+    for (size_t size = kMinSize; size <= kMaxSize; size <<= 1) {
+      uint64_t tpoison = 0;
+      uint64_t tunpoison = 0;
+      uint64_t tfreed = 0;
+      uint64_t taccessible = 0;
+      uint64_t tfind = 0;
+      for (size_t j = 0; j < kIterations; ++j) {
+        uint64_t t0 = ::__rdtsc();
+        test_shadow.Poison(data, size, kHeapLeftPaddingMarker);
+        uint64_t t1 = ::__rdtsc();
+        test_shadow.Unpoison(data, size);
+        uint64_t t2 = ::__rdtsc();
+        EXPECT_TRUE(test_shadow.IsRangeAccessible(data, size));
+        uint64_t t3 = ::__rdtsc();
+        EXPECT_EQ(nullptr, test_shadow.FindFirstPoisonedByte(data, size));
+        uint64_t t4 = ::__rdtsc();
+        test_shadow.MarkAsFreed(data, size);
+        uint64_t t5 = ::__rdtsc();
+        test_shadow.Unpoison(data, size);
+
+        tpoison += t1 - t0;
+        tunpoison += t2 - t1;
+        taccessible += t3 - t2;
+        tfind += t4 - t3;
+        tfreed += t5 - t4;
+      }
+
+      const char* name = kInstructionSetNames[i];
+      testing::EmitMetric(base::StringPrintf(
+          "Syzygy.Asan.Shadow.%s.Poison.%i", name, size), tpoison);
+      testing::EmitMetric(base::StringPrintf(
+          "Syzygy.Asan.Shadow.%s.Unpoison.%i", name, size), tunpoison);
+      testing::EmitMetric(base::StringPrintf(
+          "Syzygy.Asan.Shadow.%s.IsRangeAccessible.%i", name, size),
+          taccessible);
+      testing::EmitMetric(base::StringPrintf(
+          "Syzygy.Asan.Shadow.%s.FindFirstPoisonedByte.%i", name, size),
+          tfind);
+      testing::EmitMetric(base::StringPrintf(
+          "Syzygy.Asan.Shadow.%s.MarkAsFreed.%i", name, size), tfreed);
+    }
+  }
+}
+
 TEST_F(ShadowTest, PageBits) {
   // Set an individual page.
   const uint8_t* addr = reinterpret_cast<const uint8_t*>(16 * 4096);
@@ -651,6 +887,108 @@ TEST_F(ShadowTest, PageBits) {
   EXPECT_FALSE(test_shadow.PageIsProtected(addr2 + 4096));
 }
 
+TEST_F(ShadowTest, UnpoisonDecommitsCleanPages) {
+  // A range of memory whose shadow spans many more pages than the decommit
+  // threshold.
+  const size_t kShadowPageCount = 4 * Shadow::kShadowDecommitMinPageCount;
+  const size_t kSize = kShadowPageCount * GetPageSize() * kShadowRatio;
+  const uint8_t* addr = reinterpret_cast<const uint8_t*>(kSize);
+
+  size_t initial_committed = test_shadow.GetCommittedSize();
+  test_shadow.Poison(addr, kSize, kAsanReservedMarker);
+  EXPECT_FALSE(test_shadow.IsAccessible(addr));
+  EXPECT_FALSE(test_shadow.IsAccessible(addr + kSize - 1));
+  size_t poisoned_committed = test_shadow.GetCommittedSize();
+  EXPECT_LE(initial_committed + kShadowPageCount * GetPageSize(),
+            poisoned_committed);
+
+  test_shadow.Unpoison(addr, kSize);
+#ifdef _WIN64
+  // The shadow of the range has been returned to the OS.
+  EXPECT_GE(initial_committed + 2 * GetPageSize(),
+            test_shadow.GetCommittedSize());
+#else
+  // The shadow is fully committed upfront.
+  EXPECT_EQ(test_shadow.length(), test_shadow.GetCommittedSize());
+#endif
+
+  // The range reads back as addressable.
+  for (size_t i = 0; i < kSize; i += GetPageSize())
+    EXPECT_TRUE(test_shadow.IsAccessible(addr + i));
+  EXPECT_TRUE(test_shadow.IsRangeAccessible(addr, kSize));
+}
+
+namespace {
+
+// Measures the latency of the shadow checks of a sparsely used shadow, and
+// how much of it is committed.
+void ShadowCheckLatencyPerfTest(Shadow* shadow,
+                                const std::vector<const uint8_t*>& addrs,
+                                const char* name) {
+  // Poison a block every 64KB, as a sparse heap would.
+  const size_t kBlockInterval = 64 * 1024;
+  uintptr_t memory_size = static_cast<uintptr_t>(shadow->memory_size());
+  for (uintptr_t i = kBlockInterval; i < memory_size; i += kBlockInterval) {
+    shadow->Poison(reinterpret_cast<const void*>(i), 64,
+                   kHeapLeftPaddingMarker);
+  }
+
+  // The first pass touches the shadow, the second one measures the steady
+  // state.
+  for (size_t pass = 0; pass < 2; ++pass) {
+    size_t accessible = 0;
+    uint64_t t0 = ::__rdtsc();
+    for (const uint8_t* addr : addrs)
+      accessible += shadow->IsAccessible(addr) ? 1 : 0;
+    uint64_t t1 = ::__rdtsc();
+    EXPECT_LT(0u, accessible);
+    testing::EmitMetric(base::StringPrintf(
+        "Syzygy.Asan.Shadow.%s.IsAccessible.%s", name,
+        pass == 0 ? "Cold" : "Warm"), t1 - t0);
+  }
+  testing::EmitMetric(base::StringPrintf(
+      "Syzygy.Asan.Shadow.%s.CommittedSize", name),
+      static_cast<uint64_t>(shadow->GetCommittedSize()));
+
+  for (uintptr_t i = kBlockInterval; i < memory_size; i += kBlockInterval)
+    shadow->Unpoison(reinterpret_cast<const void*>(i), 64);
+}
+
+}  // namespace
+
+TEST(SparseShadowTest, CheckLatencyPerfTest) {
+  // The shadow of 1GB of memory.
+  const size_t kLength = (1 << 30) >> kShadowRatioLog;
+  const size_t kAddressCount = 1 << 20;
+
+  std::vector<const uint8_t*> addrs(kAddressCount);
+  for (auto& addr : addrs) {
+    addr = reinterpret_cast<const uint8_t*>(base::RandGenerator(
+        (kLength << kShadowRatioLog) - Shadow::kAddressLowerBound) +
+        Shadow::kAddressLowerBound);
+  }
+
+  // A flat, entirely committed, shadow. The shadow objects register
+  // themselves with the exception handler, so they must not overlap.
+  {
+    void* memory = ::VirtualAlloc(nullptr, kLength, MEM_COMMIT,
+                                  PAGE_READWRITE);
+    ASSERT_NE(static_cast<void*>(nullptr), memory);
+    {
+      Shadow flat_shadow(memory, kLength);
+      ShadowCheckLatencyPerfTest(&flat_shadow, addrs, "Flat");
+    }
+    ASSERT_TRUE(::VirtualFree(memory, 0, MEM_RELEASE));
+  }
+
+  // A shadow owning its memory, which is sparse on 64-bit.
+  {
+    Shadow sparse_shadow(kLength);
+    ASSERT_NE(static_cast<const uint8_t*>(nullptr), sparse_shadow.shadow());
+    ShadowCheckLatencyPerfTest(&sparse_shadow, addrs, "Sparse");
+  }
+}
+
 namespace {
 
 // A fixture for shadow walker tests.
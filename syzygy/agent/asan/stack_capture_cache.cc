@@ -15,12 +15,14 @@
 #include "syzygy/agent/asan/stack_capture_cache.h"
 
 #include <algorithm>
+#include <intrin.h>
 
 #include "base/lazy_instance.h"
 #include "base/logging.h"
 #include "base/strings/stringprintf.h"
 #include "syzygy/agent/asan/logger.h"
 #include "syzygy/agent/asan/memory_notifier.h"
+#include "syzygy/agent/asan/runtime_stats.h"
 #include "syzygy/agent/common/stack_capture.h"
 #include "syzygy/common/align.h"
 
@@ -42,6 +44,70 @@ common::StackCapture** GetFirstFrameAsLink(
   return link;
 }
 
+class PrivateStackCapture : public common::StackCapture {
+ public:
+  // Expose the actual number of frames. We use this to make reclaimed
+  // stack captures look invalid when they're in a free list.
+  using common::StackCapture::num_frames_;
+  // Expose the reference count, which is updated atomically by the cache.
+  using common::StackCapture::ref_count_;
+};
+
+// Gives us access to the reference count of a stack capture, for use with the
+// interlocked intrinsics.
+volatile short* GetRefCount(common::StackCapture* stack_capture) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+  static_assert(sizeof(common::StackCapture::RefCount) == sizeof(short),
+                "Unexpected reference count size.");
+  return reinterpret_cast<volatile short*>(
+      &reinterpret_cast<PrivateStackCapture*>(stack_capture)->ref_count_);
+}
+
+// Atomically increments the reference count of a cached stack capture, using
+// saturation arithmetic.
+// @param stack_capture The stack capture to reference.
+// @param saturated Will be set to true if the reference count became saturated.
+// @returns false if the stack capture is unreferenced. Such a stack capture is
+//     being reclaimed, and can't be resurrected.
+bool TryAddRef(common::StackCapture* stack_capture, bool* saturated) {
+  DCHECK_NE(static_cast<bool*>(nullptr), saturated);
+  volatile short* ref_count = GetRefCount(stack_capture);
+  while (true) {
+    short old_count = *ref_count;
+    auto count = static_cast<common::StackCapture::RefCount>(old_count);
+    if (count == 0)
+      return false;
+    if (count == common::StackCapture::kMaxRefCount)
+      return true;
+    ++count;
+    if (::_InterlockedCompareExchange16(ref_count, static_cast<short>(count),
+                                        old_count) == old_count) {
+      *saturated = count == common::StackCapture::kMaxRefCount;
+      return true;
+    }
+  }
+}
+
+// Atomically decrements the reference count of a stack capture, using
+// saturation arithmetic.
+// @param stack_capture The stack capture to dereference.
+// @returns true if this was the last reference.
+bool RemoveRef(common::StackCapture* stack_capture) {
+  volatile short* ref_count = GetRefCount(stack_capture);
+  while (true) {
+    short old_count = *ref_count;
+    auto count = static_cast<common::StackCapture::RefCount>(old_count);
+    DCHECK_LT(0u, count);
+    if (count == common::StackCapture::kMaxRefCount)
+      return false;
+    --count;
+    if (::_InterlockedCompareExchange16(ref_count, static_cast<short>(count),
+                                        old_count) == old_count) {
+      return count == 0;
+    }
+  }
+}
+
 }  // namespace
 
 size_t StackCaptureCache::compression_reporting_period_ =
@@ -82,6 +148,16 @@ common::StackCapture* StackCaptureCache::CachePage::GetNextStackCapture(
   return GetNextStackCapture(max_num_frames, 0);
 }
 
+uint8_t* StackCaptureCache::CachePage::GetNextChunk(size_t size) {
+  DCHECK(::common::IsAligned(size, sizeof(void*)));
+  if (bytes_used_ + size > kDataSize)
+    return nullptr;
+
+  uint8_t* chunk = data_ + bytes_used_;
+  bytes_used_ += size;
+  return chunk;
+}
+
 bool StackCaptureCache::CachePage::ReturnStackCapture(
     common::StackCapture* stack_capture, size_t metadata_size) {
   DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
@@ -110,10 +186,13 @@ StackCaptureCache::StackCaptureCache(
     : logger_(logger),
       memory_notifier_(memory_notifier),
       max_num_frames_(common::StackCapture::kMaxNumFrames),
-      current_page_(nullptr) {
+      known_stacks_(nullptr),
+      current_page_(nullptr),
+      thread_arena_tls_(TLS_OUT_OF_INDEXES) {
   DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger);
   DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
 
+  AllocateKnownStacks();
   AllocateCachePage();
 
   ::memset(&statistics_, 0, sizeof(statistics_));
@@ -127,13 +206,16 @@ StackCaptureCache::StackCaptureCache(
     : logger_(logger),
       memory_notifier_(memory_notifier),
       max_num_frames_(0),
-      current_page_(nullptr) {
+      known_stacks_(nullptr),
+      current_page_(nullptr),
+      thread_arena_tls_(TLS_OUT_OF_INDEXES) {
   DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger);
   DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
   DCHECK_LT(0u, max_num_frames);
   max_num_frames_ = static_cast<uint8_t>(
       std::min(max_num_frames, common::StackCapture::kMaxNumFrames));
 
+  AllocateKnownStacks();
   AllocateCachePage();
   ::memset(&statistics_, 0, sizeof(statistics_));
   ::memset(reclaimed_, 0, sizeof(reclaimed_));
@@ -153,6 +235,15 @@ StackCaptureCache::~StackCaptureCache() {
     DCHECK(::common::IsAligned(page, GetPageSize()));
     CHECK_EQ(TRUE, ::VirtualFree(page, 0, MEM_RELEASE));
   }
+
+  // The thread arenas lived in the cache pages.
+  ::TlsFree(thread_arena_tls_);
+  thread_arena_tls_ = TLS_OUT_OF_INDEXES;
+
+  size_t known_stacks_size = kKnownStacksTableSize * sizeof(KnownStack);
+  memory_notifier_->NotifyReturnedToOS(known_stacks_, known_stacks_size);
+  CHECK_EQ(TRUE, ::VirtualFree(known_stacks_, 0, MEM_RELEASE));
+  known_stacks_ = nullptr;
 }
 
 void StackCaptureCache::Init() {
@@ -173,65 +264,52 @@ const common::StackCapture* StackCaptureCache::SaveStackTrace(
   if (!num_frames)
     return &g_empty_stack_capture.Get();
 
-  bool already_cached = false;
-  common::StackCapture* stack_trace = nullptr;
+  // Look for the stack in the cache, and cache it if it isn't there yet.
+  bool already_cached = true;
   bool saturated = false;
-
-  {
-    size_t known_stack_shard = absolute_stack_id % kKnownStacksSharding;
-    // Get or insert the current stack trace while under the lock for this
-    // bucket.
-    base::AutoLock auto_lock(known_stacks_locks_[known_stack_shard]);
-
-    // Check if the stack capture is already in the cache map.
-    StackMap::iterator result =
-        known_stacks_[known_stack_shard].find(absolute_stack_id);
-
-    // If this capture has not already been cached then we have to initialize
-    // the data.
-    if (result == known_stacks_[known_stack_shard].end()) {
-      stack_trace = GetStackCapture(num_frames);
-      DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_trace);
-      stack_trace->InitFromExistingStack(stack_capture);
-      auto result = known_stacks_[known_stack_shard].insert(
-          std::make_pair(absolute_stack_id, stack_trace));
-      DCHECK(result.second);
-      DCHECK(stack_trace->HasNoRefs());
-      FOR_EACH_OBSERVER(Observer, observer_list_, OnNewStack(stack_trace));
-    } else {
-      already_cached = true;
-      stack_trace = result->second;
-    }
-    // Increment the reference count for this stack trace.
-    if (!stack_trace->RefCountIsSaturated()) {
-      stack_trace->AddRef();
-    } else {
-      saturated = true;
-    }
+  bool unshared = false;
+  common::StackCapture* stack_trace =
+      FindKnownStack(absolute_stack_id, &saturated);
+  if (stack_trace == nullptr) {
+    already_cached = false;
+    stack_trace = GetStackCapture(num_frames);
+    DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_trace);
+    stack_trace->InitFromExistingStack(stack_capture);
+
+    // The stack capture must be referenced before being published, as the
+    // unreferenced stack captures can't be resurrected. This also orders the
+    // initialization before the publication.
+    DCHECK(stack_trace->HasNoRefs());
+    short old_count = ::_InterlockedCompareExchange16(
+        GetRefCount(stack_trace), 1, 0);
+    DCHECK_EQ(0, old_count);
+
+    // Two threads racing to cache the same stack may both insert it. This
+    // only costs some memory, as each copy is reference counted separately.
+    // The same goes for a stack that doesn't fit in the table.
+    if (!InsertKnownStack(stack_trace))
+      unshared = true;
+    FOR_EACH_OBSERVER(Observer, observer_list_, OnNewStack(stack_trace));
   }
   DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_trace);
+  RuntimeStats::Instance()->Increment(
+      already_cached ? RuntimeStats::kStackCacheHits
+                     : RuntimeStats::kStackCacheMisses);
 
   bool must_log = false;
   Statistics statistics = {};
   // Update the statistics.
   if (compression_reporting_period_ != 0) {
     base::AutoLock stats_lock(stats_lock_);
-    if (already_cached) {
-      // If the existing stack capture is previously unreferenced and becoming
-      // referenced again, then decrement the unreferenced counter.
-      if (stack_trace->HasNoRefs()) {
-        DCHECK_LT(0u, statistics_.unreferenced);
-        --statistics_.unreferenced;
-      }
-    } else {
+    if (!already_cached) {
       ++statistics_.cached;
       statistics_.frames_alive += num_frames;
       ++statistics_.allocated;
     }
-    if (!saturated && stack_trace->RefCountIsSaturated()) {
-      saturated = true;
+    if (saturated)
       ++statistics_.saturated;
-    }
+    if (unshared)
+      ++statistics_.unshared;
     ++statistics_.requested;
     ++statistics_.references;
     statistics_.frames_stored += num_frames;
@@ -257,48 +335,19 @@ void StackCaptureCache::ReleaseStackTrace(
     return;
   }
 
-  size_t known_stack_shard =
-      stack_capture->absolute_stack_id() % kKnownStacksSharding;
-  bool add_to_reclaimed_list = false;
-  common::StackCapture* stack = nullptr;
-  {
-    base::AutoLock auto_lock(known_stacks_locks_[known_stack_shard]);
-
-    // We own the stack so its fine to remove the const. We double check this
-    // is the case in debug builds with the DCHECK.
-    stack = const_cast<common::StackCapture*>(stack_capture);
-
-    stack->RemoveRef();
-
-    if (stack->HasNoRefs()) {
-      add_to_reclaimed_list = true;
-      // Remove this from the known stacks as we're going to reclaim it and
-      // overwrite part of its data as we insert into the reclaimed_ list.
-      size_t num_erased = known_stacks_[known_stack_shard].erase(
-          stack_capture->absolute_stack_id());
-      DCHECK_EQ(num_erased, 1u);
-    }
-  }
+  // We own the stack so its fine to remove the const.
+  DropReference(const_cast<common::StackCapture*>(stack_capture), true);
+}
 
-  // Update the statistics.
-  if (compression_reporting_period_ != 0) {
-    base::AutoLock stats_lock(stats_lock_);
-    DCHECK_LT(0u, statistics_.references);
-    --statistics_.references;
-    statistics_.frames_stored -= stack->num_frames();
-    if (add_to_reclaimed_list) {
-      --statistics_.cached;
-      ++statistics_.unreferenced;
-      // The frames in this stack capture are no longer alive.
-      statistics_.frames_alive -= stack->num_frames();
-    }
-  }
+void StackCaptureCache::ReleaseThreadArena() {
+  ThreadArena* arena =
+      reinterpret_cast<ThreadArena*>(::TlsGetValue(thread_arena_tls_));
+  if (arena == nullptr)
+    return;
 
-  // Link this stack capture into the list of reclaimed stacks. This
-  // must come after the statistics updating, as we modify the |num_frames|
-  // parameter in place.
-  if (add_to_reclaimed_list)
-    AddStackCaptureToReclaimedList(stack);
+  // The chunk itself stays in its cache page, only its end can be reused.
+  ReclaimUnusedBytes(arena->cursor, arena->end - arena->cursor);
+  ::TlsSetValue(thread_arena_tls_, nullptr);
 }
 
 bool StackCaptureCache::StackCapturePointerIsValid(
@@ -366,6 +415,161 @@ void StackCaptureCache::AllocateCachePage() {
   memory_notifier_->NotifyInternalUse(new_page, sizeof(CachePage));
 }
 
+void StackCaptureCache::AllocateKnownStacks() {
+  static_assert((kKnownStacksTableSize & (kKnownStacksTableSize - 1)) == 0,
+                "kKnownStacksTableSize must be a power of two.");
+  DCHECK_EQ(static_cast<KnownStack*>(nullptr), known_stacks_);
+
+  // The table is zero initialized by VirtualAlloc, which makes all of its
+  // entries empty. Its pages only get backed as they're touched.
+  size_t known_stacks_size = kKnownStacksTableSize * sizeof(KnownStack);
+  known_stacks_ = reinterpret_cast<KnownStack*>(::VirtualAlloc(
+      nullptr, known_stacks_size, MEM_COMMIT, PAGE_READWRITE));
+  CHECK_NE(static_cast<KnownStack*>(nullptr), known_stacks_);
+  memory_notifier_->NotifyInternalUse(known_stacks_, known_stacks_size);
+
+  thread_arena_tls_ = ::TlsAlloc();
+  CHECK_NE(TLS_OUT_OF_INDEXES, thread_arena_tls_);
+}
+
+common::StackCapture* StackCaptureCache::FindKnownStack(
+    StackId absolute_stack_id, bool* saturated) {
+  DCHECK_NE(static_cast<bool*>(nullptr), saturated);
+
+  LONG key = static_cast<LONG>(absolute_stack_id) & ~kKnownStackStateMask;
+  size_t index = absolute_stack_id & (kKnownStacksTableSize - 1);
+  size_t probes = 0;
+  while (probes < kKnownStacksMaxProbes) {
+    KnownStack* known_stack = &known_stacks_[index];
+    LONG entry_key = known_stack->key;
+    LONG state = entry_key & kKnownStackStateMask;
+
+    // The stack would have been inserted in the first empty entry.
+    if (state == kKnownStackEmpty)
+      return nullptr;
+
+    if ((entry_key & ~kKnownStackStateMask) == key) {
+      // Wait for a concurrent insertion to complete, then look at the entry
+      // again.
+      if (state == kKnownStackBusy) {
+        ::YieldProcessor();
+        continue;
+      }
+
+      if (state == kKnownStackLive) {
+        // The entry can be recycled at any point, so the stack capture is
+        // only known to be the right one once it's referenced.
+        common::StackCapture* stack_capture = known_stack->stack;
+        bool became_saturated = false;
+        if (TryAddRef(stack_capture, &became_saturated)) {
+          if (stack_capture->absolute_stack_id() == absolute_stack_id) {
+            *saturated = became_saturated;
+            return stack_capture;
+          }
+          DropReference(stack_capture, false);
+        }
+      }
+    }
+
+    index = (index + 1) & (kKnownStacksTableSize - 1);
+    ++probes;
+  }
+
+  return nullptr;
+}
+
+bool StackCaptureCache::InsertKnownStack(common::StackCapture* stack_capture) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+  DCHECK(!stack_capture->HasNoRefs());
+
+  StackId absolute_stack_id = stack_capture->absolute_stack_id();
+  LONG key = static_cast<LONG>(absolute_stack_id) & ~kKnownStackStateMask;
+  size_t index = absolute_stack_id & (kKnownStacksTableSize - 1);
+  size_t probes = 0;
+  while (probes < kKnownStacksMaxProbes) {
+    KnownStack* known_stack = &known_stacks_[index];
+    LONG entry_key = known_stack->key;
+    LONG state = entry_key & kKnownStackStateMask;
+    if (state == kKnownStackEmpty || state == kKnownStackTombstone) {
+      // Claim the entry, then publish the stack capture. The entry is looked
+      // at again if another thread claimed it first.
+      if (::_InterlockedCompareExchange(&known_stack->key,
+                                        key | kKnownStackBusy,
+                                        entry_key) != entry_key) {
+        continue;
+      }
+      known_stack->stack = stack_capture;
+      ::_InterlockedExchange(&known_stack->key, key | kKnownStackLive);
+      return true;
+    }
+
+    index = (index + 1) & (kKnownStacksTableSize - 1);
+    ++probes;
+  }
+
+  return false;
+}
+
+void StackCaptureCache::RemoveKnownStack(common::StackCapture* stack_capture) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+
+  StackId absolute_stack_id = stack_capture->absolute_stack_id();
+  LONG key = static_cast<LONG>(absolute_stack_id) & ~kKnownStackStateMask;
+  size_t index = absolute_stack_id & (kKnownStacksTableSize - 1);
+  for (size_t probes = 0; probes < kKnownStacksMaxProbes; ++probes) {
+    KnownStack* known_stack = &known_stacks_[index];
+    LONG entry_key = known_stack->key;
+    if ((entry_key & kKnownStackStateMask) == kKnownStackEmpty)
+      return;
+
+    // Only the thread that dropped the last reference to a stack capture
+    // removes it, so a live entry holding it can't change under our feet.
+    if (entry_key == (key | kKnownStackLive) &&
+        known_stack->stack == stack_capture) {
+      ::_InterlockedExchange(&known_stack->key, kKnownStackTombstone);
+      return;
+    }
+
+    index = (index + 1) & (kKnownStacksTableSize - 1);
+  }
+
+  // The stack capture didn't fit in the table.
+}
+
+void StackCaptureCache::DropReference(common::StackCapture* stack_capture,
+                                      bool counted) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+
+  // Remove this from the known stacks as we're going to reclaim it and
+  // overwrite part of its data as we insert into the reclaimed_ list.
+  bool add_to_reclaimed_list = RemoveRef(stack_capture);
+  if (add_to_reclaimed_list)
+    RemoveKnownStack(stack_capture);
+
+  // Update the statistics.
+  if (compression_reporting_period_ != 0 &&
+      (counted || add_to_reclaimed_list)) {
+    base::AutoLock stats_lock(stats_lock_);
+    if (counted) {
+      DCHECK_LT(0u, statistics_.references);
+      --statistics_.references;
+      statistics_.frames_stored -= stack_capture->num_frames();
+    }
+    if (add_to_reclaimed_list) {
+      --statistics_.cached;
+      ++statistics_.unreferenced;
+      // The frames in this stack capture are no longer alive.
+      statistics_.frames_alive -= stack_capture->num_frames();
+    }
+  }
+
+  // Link this stack capture into the list of reclaimed stacks. This
+  // must come after the statistics updating, as we modify the |num_frames|
+  // parameter in place.
+  if (add_to_reclaimed_list)
+    AddStackCaptureToReclaimedList(stack_capture);
+}
+
 void StackCaptureCache::GetStatisticsUnlocked(Statistics* statistics) const {
 #ifndef NDEBUG
   stats_lock_.AssertAcquired();
@@ -398,7 +602,8 @@ void StackCaptureCache::LogStatisticsImpl(const Statistics& statistics) const {
 
   logger_->Write(base::StringPrintf(
       "PID=%d; Stack cache size=%.2f MB; Compression=%.2f%%; "
-      "Alive=%.2f%%; Dead=%.2f%%; Overhead=%.2f%%; Saturated=%d; Entries=%d",
+      "Alive=%.2f%%; Dead=%.2f%%; Overhead=%.2f%%; Saturated=%d; Entries=%d; "
+      "Unshared=%lld",
       ::GetCurrentProcessId(),
       cache_size / 1024.0 / 1024.0,
       compression,
@@ -406,7 +611,8 @@ void StackCaptureCache::LogStatisticsImpl(const Statistics& statistics) const {
       dead,
       overhead,
       statistics.saturated,
-      statistics.cached));
+      statistics.cached,
+      statistics.unshared));
 }
 
 common::StackCapture* StackCaptureCache::GetStackCapture(size_t num_frames) {
@@ -436,64 +642,91 @@ common::StackCapture* StackCaptureCache::GetStackCapture(size_t num_frames) {
     return stack_capture;
   }
 
-  common::StackCapture* unused_stack_capture = nullptr;
+  // We didn't find a reusable stack capture. Carve one out of the arena of
+  // this thread, which doesn't require any lock.
+  size_t size = common::StackCapture::GetSize(num_frames);
+  ThreadArena* arena =
+      reinterpret_cast<ThreadArena*>(::TlsGetValue(thread_arena_tls_));
+  if (arena == nullptr ||
+      static_cast<size_t>(arena->end - arena->cursor) < size) {
+    arena = RefillThreadArena(arena, size);
+    ::TlsSetValue(thread_arena_tls_, arena);
+  }
+
+  stack_capture = new(arena->cursor) common::StackCapture(num_frames);
+  arena->cursor += size;
+  return stack_capture;
+}
+
+StackCaptureCache::ThreadArena* StackCaptureCache::RefillThreadArena(
+    ThreadArena* arena, size_t min_size) {
+  static const size_t kArenaHeaderSize = sizeof(ThreadArena);
+  static_assert(kArenaHeaderSize % sizeof(void*) == 0,
+                "The thread arenas must preserve the pointer alignment.");
+  DCHECK_LE(kArenaHeaderSize + min_size, kThreadArenaSize);
+
+  // Don't waste what is left of the current chunk.
+  if (arena != nullptr)
+    ReclaimUnusedBytes(arena->cursor, arena->end - arena->cursor);
+
+  uint8_t* chunk = nullptr;
+  size_t chunk_size = 0;
+  uint8_t* page_tail = nullptr;
+  size_t page_tail_size = 0;
   {
     base::AutoLock current_page_lock(current_page_lock_);
 
-    // We didn't find a reusable stack capture. Go to the cache page.
-    stack_capture = current_page_->GetNextStackCapture(num_frames);
-
-    if (stack_capture != nullptr)
-      return stack_capture;
-
-    // If the allocation failed we don't have enough room on the current page.
-
-    // Use the remaining bytes to create one more maximally sized stack
-    // capture. We will stuff this into the reclaimed_ structure for later
-    // use.
-    size_t bytes_left = current_page_->bytes_left();
-    size_t max_num_frames = common::StackCapture::GetMaxNumFrames(bytes_left);
-    if (max_num_frames > 0) {
-      DCHECK_LT(max_num_frames, num_frames);
-      DCHECK_LE(common::StackCapture::GetSize(max_num_frames), bytes_left);
-      unused_stack_capture =
-          current_page_->GetNextStackCapture(max_num_frames);
-      DCHECK_NE(static_cast<common::StackCapture*>(nullptr),
-                unused_stack_capture);
+    // The end of a page is handed out as a smaller chunk.
+    chunk_size = std::min(kThreadArenaSize, current_page_->bytes_left());
+    if (chunk_size < kArenaHeaderSize + min_size) {
+      // Set aside the end of the page, then allocate a new page (that links
+      // to the current page).
+      page_tail_size = current_page_->bytes_left();
+      page_tail = current_page_->GetNextChunk(page_tail_size);
+      AllocateCachePage();
+      CHECK_NE(static_cast<CachePage*>(nullptr), current_page_);
+      statistics_.size += sizeof(CachePage);
+      chunk_size = kThreadArenaSize;
     }
-
-    // Allocate a new page (that links to the current page) and use it to
-    // allocate a new stack capture.
-    AllocateCachePage();
-    CHECK_NE(static_cast<CachePage*>(nullptr), current_page_);
-    statistics_.size += sizeof(CachePage);
-    stack_capture = current_page_->GetNextStackCapture(num_frames);
+    chunk = current_page_->GetNextChunk(chunk_size);
+    DCHECK_NE(static_cast<uint8_t*>(nullptr), chunk);
   }
 
-  if (unused_stack_capture != nullptr) {
-    // We're creating an unreferenced stack capture.
-    AddStackCaptureToReclaimedList(unused_stack_capture);
-  }
-
-  // Update the statistics.
-  if (compression_reporting_period_ != 0) {
-    base::AutoLock stats_lock(stats_lock_);
-    ++statistics_.unreferenced;
-  }
+  if (page_tail != nullptr)
+    ReclaimUnusedBytes(page_tail, page_tail_size);
 
-  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
-  return stack_capture;
+  arena = reinterpret_cast<ThreadArena*>(chunk);
+  arena->cursor = chunk + kArenaHeaderSize;
+  arena->end = chunk + chunk_size;
+  return arena;
 }
 
-namespace {
+void StackCaptureCache::ReclaimUnusedBytes(uint8_t* bytes, size_t size) {
+  // Use the remaining bytes to create maximally sized stack captures. We will
+  // stuff these into the reclaimed_ structure for later use.
+  while (true) {
+    size_t max_num_frames = std::min(
+        common::StackCapture::GetMaxNumFrames(size),
+        common::StackCapture::kMaxNumFrames);
+    if (max_num_frames == 0)
+      return;
+    size_t stack_size = common::StackCapture::GetSize(max_num_frames);
+    DCHECK_LE(stack_size, size);
+    common::StackCapture* unused_stack_capture =
+        new(bytes) common::StackCapture(max_num_frames);
 
-class PrivateStackCapture : public common::StackCapture {
- public:
-  // Expose the actual number of frames. We use this to make reclaimed
-  // stack captures look invalid when they're in a free list.
-  using common::StackCapture::num_frames_;
-};
+    // We're creating an unreferenced stack capture.
+    AddStackCaptureToReclaimedList(unused_stack_capture);
+
+    // Update the statistics.
+    if (compression_reporting_period_ != 0) {
+      base::AutoLock stats_lock(stats_lock_);
+      ++statistics_.unreferenced;
+    }
 
+    bytes += stack_size;
+    size -= stack_size;
+  }
 }
 
 void StackCaptureCache::AddStackCaptureToReclaimedList(
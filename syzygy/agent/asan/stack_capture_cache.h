@@ -15,7 +15,7 @@
 #ifndef SYZYGY_AGENT_ASAN_STACK_CAPTURE_CACHE_H_
 #define SYZYGY_AGENT_ASAN_STACK_CAPTURE_CACHE_H_
 
-#include <unordered_map>
+#include <windows.h>
 
 #include "base/observer_list.h"
 #include "base/synchronization/lock.h"
@@ -31,6 +31,11 @@ class AsanLogger;
 class MemoryNotifierInterface;
 
 // A class which manages a thread-safe cache of unique stack traces, by ID.
+//
+// The known stacks are kept in a lock-free open-addressing hash table, and
+// their reference counts are updated atomically. The stack captures are
+// allocated from per-thread chunks of the cache pages, so that saving a stack
+// doesn't contend on any lock in the common case.
 class StackCaptureCache {
  public:
   // The size of a page of stack captures, in bytes. This should be in the
@@ -42,6 +47,21 @@ class StackCaptureCache {
   // The type used to uniquely identify a stack.
   typedef common::StackCapture::StackId StackId;
 
+  // The number of entries in the known stacks table. This must be a power of
+  // two. The table doesn't grow: once it is crowded, the new stacks are handed
+  // out without being shared, and are counted in the statistics as unshared.
+  static const size_t kKnownStacksTableSize = 1 << 18;
+
+  // The maximum number of entries that are probed when looking up or
+  // inserting a stack in the known stacks table. The stacks that can't be
+  // inserted within that many probes are still handed out, they simply aren't
+  // shared.
+  static const size_t kKnownStacksMaxProbes = 32;
+
+  // The size of the chunks of cache pages that are handed to the threads, in
+  // bytes.
+  static const size_t kThreadArenaSize = 8 * 1024;
+
   // Forward declaration.
   class CachePage;
 
@@ -106,6 +126,11 @@ class StackCaptureCache {
   // @param stack_capture The stack capture to be released.
   void ReleaseStackTrace(const common::StackCapture* stack_capture);
 
+  // Releases the arena of the calling thread, if it has one. Its unused bytes
+  // are made available for reuse by the other threads. This is meant to be
+  // called when a thread exits.
+  void ReleaseThreadArena();
+
   // Logs the current stack capture cache statistics. This method is thread
   // safe.
   void LogStatistics();
@@ -130,9 +155,39 @@ class StackCaptureCache {
   void RemoveObserver(Observer* obs);
 
  protected:
-  // The container type in which we store the cached stacks. This enforces
-  // uniqueness based on their hash value, nothing more.
-  typedef std::unordered_map<StackId, common::StackCapture*> StackMap;
+  // @name The states of the entries of the known stacks table. They are
+  //     stored in the lower bits of the entry keys.
+  // @{
+  enum KnownStackState : LONG {
+    // The entry has never been used. A lookup can stop at such an entry.
+    kKnownStackEmpty = 0,
+    // The entry is being filled by an insertion.
+    kKnownStackBusy = 1,
+    // The entry holds a referenced stack capture.
+    kKnownStackLive = 2,
+    // The entry used to hold a stack capture, and can be reused.
+    kKnownStackTombstone = 3,
+    kKnownStackStateMask = 3,
+  };
+  // @}
+
+  // An entry of the known stacks table.
+  struct KnownStack {
+    // The state of the entry, combined with the upper bits of the ID of the
+    // stack it holds. This is only a hint, the ID of the stack capture itself
+    // is authoritative.
+    volatile LONG key;
+    // The stack capture held by the entry. This is only meaningful for a live
+    // entry.
+    common::StackCapture* volatile stack;
+  };
+
+  // A bump allocator carving stack captures out of a chunk of a cache page.
+  // Every thread has its own, which sits at the beginning of its chunk.
+  struct ThreadArena {
+    uint8_t* cursor;
+    uint8_t* end;
+  };
 
   // Used for shuttling around statistics about this cache.
   struct Statistics {
@@ -161,6 +216,9 @@ class StackCaptureCache {
     uint64_t allocated;
     // The total number of active references to stack captures.
     uint64_t references;
+    // The total number of stacks that didn't fit in the known stacks table.
+    // These can't be shared by the identical stacks saved later.
+    uint64_t unshared;
     // @}
 
     // These count information about individual frames.
@@ -181,6 +239,33 @@ class StackCaptureCache {
   // Allocates a CachePage.
   void AllocateCachePage();
 
+  // Allocates the known stacks table and the thread arena TLS slot.
+  void AllocateKnownStacks();
+
+  // Looks up a stack in the known stacks table, and takes a reference to it.
+  // @param absolute_stack_id The ID of the stack to look up.
+  // @param saturated Will be set to true if the reference count of the stack
+  //     became saturated because of this lookup.
+  // @returns the referenced stack capture, or nullptr if it isn't cached.
+  common::StackCapture* FindKnownStack(StackId absolute_stack_id,
+                                       bool* saturated);
+
+  // Inserts a referenced stack capture in the known stacks table.
+  // @param stack_capture The stack capture to insert.
+  // @returns true on success, false if the table is too crowded.
+  bool InsertKnownStack(common::StackCapture* stack_capture);
+
+  // Removes a stack capture from the known stacks table, if it's there.
+  // @param stack_capture The stack capture to remove.
+  void RemoveKnownStack(common::StackCapture* stack_capture);
+
+  // Drops a reference to a stack capture, and reclaims it if it was the last
+  // one.
+  // @param stack_capture The stack capture to release.
+  // @param counted Indicates if the reference is accounted for in the
+  //     statistics.
+  void DropReference(common::StackCapture* stack_capture, bool counted);
+
   // Gets the current cache statistics. This must be called under lock_.
   // @param statistics Will be populated with current cache statistics.
   void GetStatisticsUnlocked(Statistics* statistics) const;
@@ -189,20 +274,30 @@ class StackCaptureCache {
   // @param report The statistics to be reported.
   void LogStatisticsImpl(const Statistics& statistics) const;
 
-  // Grabs a temporary StackCapture from reclaimed_ or the current CachePage.
-  // Must be called under lock_. Takes care of updating frames_dead.
+  // Grabs a temporary StackCapture from reclaimed_ or the arena of the
+  // calling thread. Takes care of updating frames_dead.
   // @param num_frames The minimum number of frames that are required.
   common::StackCapture* GetStackCapture(size_t num_frames);
 
+  // Provides the calling thread with a new chunk of cache page.
+  // @param arena The current arena of the calling thread, if any.
+  // @param min_size The minimum number of bytes that the new arena must be
+  //     able to serve.
+  // @returns the new arena.
+  ThreadArena* RefillThreadArena(ThreadArena* arena, size_t min_size);
+
+  // Turns a range of unused bytes into maximally sized stack captures, and
+  // links them into the reclaimed_ list.
+  // @param bytes The beginning of the range.
+  // @param size The size of the range.
+  void ReclaimUnusedBytes(uint8_t* bytes, size_t size);
+
   // Links a stack capture into the reclaimed_ list. Meant to be called by
   // ReturnStackCapture only. Must be called under lock_. Takes care of
   // updating frames_dead (on behalf of ReturnStackCapture).
   // @param stack_capture The stack capture to be linked into reclaimed_.
   void AddStackCaptureToReclaimedList(common::StackCapture* stack_capture);
 
-  // The default number of known stacks sets that we keep.
-  static const size_t kKnownStacksSharding = 16;
-
   // The number of allocations between reports of the stack trace cache
   // compression ratio. Zero (0) means do not report. Values like 1 million
   // seem to be pretty good with Chrome.
@@ -214,23 +309,24 @@ class StackCaptureCache {
   // The memory notifier that is informed of allocations made by the cache.
   MemoryNotifierInterface* memory_notifier_;
 
-  // Locks to protect the known stacks sets from concurrent access.
-  mutable base::Lock known_stacks_locks_[kKnownStacksSharding];
-
   // The max depth of the stack traces to allocate. This can change, but it
   // doesn't really make sense to do so.
   size_t max_num_frames_;
 
-  // The maps of known stacks. Accessed under known_stacks_locks_.
-  StackMap known_stacks_[kKnownStacksSharding];
+  // The table of known stacks, of kKnownStacksTableSize entries. This is
+  // lock-free.
+  KnownStack* known_stacks_;
 
   // A lock protecting access to current_page_.
   base::Lock current_page_lock_;
 
-  // The current page from which new stack captures are allocated.
-  // Accessed under current_page_lock_.
+  // The current page from which the chunks of the thread arenas are
+  // allocated. Accessed under current_page_lock_.
   CachePage* current_page_;
 
+  // Stores the ThreadArena TLS slot.
+  DWORD thread_arena_tls_;
+
   // A lock protecting access to statistics_.
   mutable base::Lock stats_lock_;
 
@@ -273,6 +369,12 @@ class StackCaptureCache::CachePage {
                                             size_t metadata_size);
   common::StackCapture* GetNextStackCapture(size_t max_num_frames);
 
+  // Allocates a chunk of raw bytes from this cache page if possible.
+  // @param size The size of the chunk. This must be a multiple of the size of
+  //     a pointer.
+  // @returns the chunk, or nullptr if the page is full.
+  uint8_t* GetNextChunk(size_t size);
+
   // Returns the most recently allocated stack capture back to the page.
   // @param stack_capture The stack capture to return.
   // @param metadata_size The number of bytes of metadata that was also
@@ -15,6 +15,9 @@
 #include "syzygy/agent/asan/stack_capture_cache.h"
 
 #include <memory>
+#include <vector>
+
+#include "base/threading/simple_thread.h"
 #include "gtest/gtest.h"
 #include "syzygy/agent/asan/logger.h"
 #include "syzygy/agent/asan/memory_notifiers/null_memory_notifier.h"
@@ -73,6 +76,42 @@ class TestStackCaptureCacheObserver : public StackCaptureCache::Observer {
   MOCK_METHOD1(OnNewStack, void(common::StackCapture* new_stack));
 };
 
+// Repeatedly saves and releases a set of stacks shared with other threads.
+class SaveAndReleaseRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  static const size_t kStackCount = 64;
+  static const size_t kIterations = 1000;
+
+  explicit SaveAndReleaseRunner(StackCaptureCache* cache) : cache_(cache) {
+    DCHECK_NE(static_cast<StackCaptureCache*>(nullptr), cache);
+    for (size_t i = 0; i < kStackCount; ++i) {
+      void* frames[] = { reinterpret_cast<void*>(i + 1),
+                         reinterpret_cast<void*>(0xDEADBEEF) };
+      stacks_[i].InitFromBuffer(frames, arraysize(frames));
+    }
+  }
+
+  void Run() override {
+    const StackCapture* saved[kStackCount] = {};
+    for (size_t i = 0; i < kIterations; ++i) {
+      for (size_t j = 0; j < kStackCount; ++j) {
+        saved[j] = cache_->SaveStackTrace(stacks_[j]);
+        EXPECT_EQ(stacks_[j].absolute_stack_id(),
+                  saved[j]->absolute_stack_id());
+        EXPECT_EQ(stacks_[j].num_frames(), saved[j]->num_frames());
+      }
+      for (size_t j = 0; j < kStackCount; ++j)
+        cache_->ReleaseStackTrace(saved[j]);
+    }
+  }
+
+ private:
+  StackCaptureCache* cache_;
+  StackCapture stacks_[kStackCount];
+
+  DISALLOW_COPY_AND_ASSIGN(SaveAndReleaseRunner);
+};
+
 }  // namespace
 
 TEST_F(StackCaptureCacheTest, CachePageTest) {
@@ -208,6 +247,49 @@ TEST_F(StackCaptureCacheTest, ReclaimedStackCapture) {
   EXPECT_EQ(s1, s3);
 }
 
+TEST_F(StackCaptureCacheTest, ReleaseThreadArena) {
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger);
+  cache.set_compression_reporting_period(1U);
+  TestStackCaptureCache::Statistics s = {};
+
+  // Releasing a thread that has no arena does nothing.
+  cache.ReleaseThreadArena();
+  cache.GetStatistics(&s);
+  EXPECT_EQ(0u, s.unreferenced);
+
+  // The first stack capture is carved out of a new arena.
+  StackCapture stack_capture;
+  stack_capture.InitFromStack();
+  const StackCapture* s1 = cache.SaveStackTrace(stack_capture);
+  ASSERT_TRUE(s1 != NULL);
+
+  // The rest of the arena is reclaimed, and only once.
+  cache.ReleaseThreadArena();
+  cache.GetStatistics(&s);
+  EXPECT_LT(0u, s.unreferenced);
+  EXPECT_LT(0u, s.frames_dead);
+  TestStackCaptureCache::Statistics released = s;
+  cache.ReleaseThreadArena();
+  cache.GetStatistics(&s);
+  EXPECT_EQ(released.unreferenced, s.unreferenced);
+  EXPECT_EQ(released.frames_dead, s.frames_dead);
+
+  // The next stack capture comes from what is left of the released arena.
+  stack_capture.InitFromStack();
+  const StackCapture* s2 = cache.SaveStackTrace(stack_capture);
+  ASSERT_TRUE(s2 != NULL);
+  cache.GetStatistics(&s);
+  EXPECT_GT(released.frames_dead, s.frames_dead);
+  const uint8_t* arena_begin = reinterpret_cast<const uint8_t*>(s1);
+  const uint8_t* stack = reinterpret_cast<const uint8_t*>(s2);
+  EXPECT_LE(arena_begin + s1->Size(), stack);
+  EXPECT_GT(arena_begin + StackCaptureCache::kThreadArenaSize, stack);
+
+  cache.ReleaseStackTrace(s1);
+  cache.ReleaseStackTrace(s2);
+}
+
 TEST_F(StackCaptureCacheTest, Statistics) {
   AsanLogger logger;
   TestStackCaptureCache cache(&logger);
@@ -421,6 +503,35 @@ TEST_F(StackCaptureCacheTest, AllocateMultiplePages) {
   EXPECT_NE(page, cache.current_page());
 }
 
+TEST_F(StackCaptureCacheTest, ConcurrentSaveAndRelease) {
+  static const size_t kThreadCount = 4;
+
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger);
+  cache.set_compression_reporting_period(1000000U);
+
+  SaveAndReleaseRunner runner(&cache);
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(&runner, "SaveAndReleaseRunner")));
+    threads.back()->Start();
+  }
+  for (auto& thread : threads)
+    thread->Join();
+
+  // Every reference has been dropped, so every stack has been reclaimed.
+  TestStackCaptureCache::Statistics s = {};
+  cache.GetStatistics(&s);
+  EXPECT_EQ(0u, s.cached);
+  EXPECT_EQ(0u, s.references);
+  EXPECT_EQ(0u, s.frames_stored);
+  EXPECT_EQ(0u, s.frames_alive);
+  EXPECT_EQ(kThreadCount * SaveAndReleaseRunner::kStackCount *
+                SaveAndReleaseRunner::kIterations,
+            s.requested);
+}
+
 TEST_F(StackCaptureCacheTest, EmptyStackCapture) {
   AsanLogger logger;
   TestStackCaptureCache cache(&logger);
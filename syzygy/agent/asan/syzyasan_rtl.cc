@@ -14,6 +14,9 @@
 
 #include <windows.h>
 
+#include <algorithm>
+#include <string>
+
 #include "base/at_exit.h"
 #include "base/bind.h"
 #include "base/command_line.h"
@@ -199,9 +202,12 @@ BOOL WINAPI DllMain(HMODULE instance, DWORD reason, LPVOID reserved) {
       break;
     }
 
-    case DLL_THREAD_DETACH:
-      // Nothing to do here.
+    case DLL_THREAD_DETACH: {
+      agent::asan::AsanRuntime* runtime = agent::asan::AsanRuntime::runtime();
+      DCHECK_NE(static_cast<agent::asan::AsanRuntime*>(nullptr), runtime);
+      runtime->ReleaseThreadResources();
       break;
+    }
 
     case DLL_PROCESS_DETACH: {
       base::CommandLine::Reset();
@@ -258,6 +264,28 @@ void WINAPI asan_EnumExperiments(AsanExperimentCallback callback) {
   DCHECK_EQ(0U, enabled_features);
 }
 
+size_t WINAPI asan_GetRuntimeStats(char* buffer, size_t buffer_size) {
+  DCHECK(buffer != nullptr || buffer_size == 0);
+
+  // The runtime is torn down when the noop probes are selected, in which case
+  // there are no statistics to report.
+  std::string json("{}");
+  if (asan_runtime != nullptr) {
+    RuntimeStats::Snapshot snapshot = {};
+    asan_runtime->GetRuntimeStats(&snapshot);
+    RuntimeStats::SnapshotToJson(snapshot, &json);
+  }
+
+  // Copy as much of the statistics as possible, always null terminating the
+  // buffer.
+  if (buffer_size != 0) {
+    size_t length = std::min(json.size(), buffer_size - 1);
+    ::memcpy(buffer, json.data(), length);
+    buffer[length] = '\0';
+  }
+  return json.size() + 1;
+}
+
 }  // extern "C"
 
 }  // namespace asan
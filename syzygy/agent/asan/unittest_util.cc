@@ -17,6 +17,7 @@
 #include "syzygy/agent/asan/unittest_util.h"
 
 #include <algorithm>
+#include <memory>
 
 #include "base/bind.h"
 #include "base/command_line.h"
@@ -56,6 +57,7 @@ static const size_t kLoggerTimeOutMs = 10000;
 namespace {
 
 FARPROC check_access_fn = NULL;
+size_t check_range_size = 0;
 bool direction_flag_forward = true;
 
 // An exception filter that grabs and sets an exception pointer, and
@@ -689,6 +691,74 @@ void SyzyAsanMemoryAccessorTester::CheckAccessAndCompareContexts(
 
 namespace {
 
+void CheckRangeAccessAndCaptureContexts(
+    CONTEXT* before, CONTEXT* after, void* location) {
+  __asm {
+    pushad
+    pushfd
+
+    // Avoid undefined behavior by forcing values.
+    mov eax, 0x01234567
+    mov ebx, 0x70123456
+    mov ecx, 0x12345678
+    mov edx, 0x56701234
+    mov esi, 0xCCAACCAA
+    mov edi, 0xAACCAACC
+
+    RTL_CAPTURE_CONTEXT(before, check_range_access_expected_eip)
+
+    // Push EDX as we're required to do by the custom calling convention.
+    push edx
+    // Push the size of the range.
+    push check_range_size
+    // Ptr is the first address of the range to check.
+    mov edx, location
+    // Call through.
+    call dword ptr[check_access_fn + 0]
+ check_range_access_expected_eip:
+
+    RTL_CAPTURE_CONTEXT(after, check_range_access_expected_eip)
+
+    popfd
+    popad
+  }
+}
+
+}  // namespace
+
+void SyzyAsanMemoryAccessorTester::CheckRangeAccessAndCompareContexts(
+    FARPROC access_fn,
+    void* ptr,
+    size_t size) {
+  memory_error_detected_ = false;
+
+  check_access_fn = access_fn;
+  check_range_size = size;
+
+  CheckRangeAccessAndCaptureContexts(
+      &context_before_hook_, &context_after_hook_, ptr);
+
+  ExpectEqualContexts(context_before_hook_, context_after_hook_, ignore_flags_);
+  if (memory_error_detected_) {
+    ExpectEqualContexts(context_before_hook_, error_context_, ignore_flags_);
+  }
+
+  check_access_fn = NULL;
+  check_range_size = 0;
+}
+
+void SyzyAsanMemoryAccessorTester::AssertRangeErrorIsDetected(
+    FARPROC access_fn,
+    void* ptr,
+    size_t size,
+    BadAccessKind bad_access_type) {
+  expected_error_type_ = bad_access_type;
+  CheckRangeAccessAndCompareContexts(access_fn, ptr, size);
+  ASSERT_TRUE(memory_error_detected_);
+}
+
+namespace {
+
 void CheckSpecialAccess(CONTEXT* before, CONTEXT* after,
                         void* dst, void* src, int len) {
   __asm {
@@ -1024,6 +1094,79 @@ void TestMemoryInterceptors::TestStringOverrunAccess(
     }
   }
 }
+
+namespace {
+
+// Creates a tester for a range probe.
+SyzyAsanMemoryAccessorTester* CreateRangeTester(bool ignore_flags) {
+  if (ignore_flags) {
+    return new SyzyAsanMemoryAccessorTester(
+        SyzyAsanMemoryAccessorTester::IGNORE_FLAGS);
+  }
+  return new SyzyAsanMemoryAccessorTester();
+}
+
+}  // namespace
+
+void TestMemoryInterceptors::TestRangeValidAccess(
+    const RangeInterceptFunction* fns, size_t num_fns) {
+  // The ranges to check, as offsets and sizes relative to src_.
+  const size_t kRanges[][2] = {
+      {0, kAllocSize}, {3, 13}, {8, 24}, {kAllocSize - 1, 1}};
+
+  for (size_t i = 0; i < num_fns; ++i) {
+    const RangeInterceptFunction& fn = fns[i];
+
+    for (size_t j = 0; j < arraysize(kRanges); ++j) {
+      std::unique_ptr<SyzyAsanMemoryAccessorTester> tester(
+          CreateRangeTester(fn.ignore_flags));
+      tester->CheckRangeAccessAndCompareContexts(
+          reinterpret_cast<FARPROC>(fn.function), src_ + kRanges[j][0],
+          kRanges[j][1]);
+
+      ASSERT_FALSE(tester->memory_error_detected());
+    }
+  }
+}
+
+void TestMemoryInterceptors::TestRangeOverrunAccess(
+    const RangeInterceptFunction* fns, size_t num_fns) {
+  // The ranges to check, as offsets and sizes relative to src_. They all
+  // start in the body of the block and end in its right redzone.
+  const size_t kRanges[][2] = {{kAllocSize - 4, 8}, {8, kAllocSize - 7}};
+
+  for (size_t i = 0; i < num_fns; ++i) {
+    const RangeInterceptFunction& fn = fns[i];
+
+    for (size_t j = 0; j < arraysize(kRanges); ++j) {
+      std::unique_ptr<SyzyAsanMemoryAccessorTester> tester(
+          CreateRangeTester(fn.ignore_flags));
+      tester->AssertRangeErrorIsDetected(
+          reinterpret_cast<FARPROC>(fn.function), src_ + kRanges[j][0],
+          kRanges[j][1],
+          MemoryAccessorTester::BadAccessKind::HEAP_BUFFER_OVERFLOW);
+
+      ASSERT_TRUE(tester->memory_error_detected());
+    }
+  }
+}
+
+void TestMemoryInterceptors::TestRangeUnderrunAccess(
+    const RangeInterceptFunction* fns, size_t num_fns) {
+  for (size_t i = 0; i < num_fns; ++i) {
+    const RangeInterceptFunction& fn = fns[i];
+
+    // Unlike the single access probes, the range probes check every shadow
+    // byte they cover.
+    std::unique_ptr<SyzyAsanMemoryAccessorTester> tester(
+        CreateRangeTester(fn.ignore_flags));
+    tester->AssertRangeErrorIsDetected(
+        reinterpret_cast<FARPROC>(fn.function), src_ - 8, 16,
+        MemoryAccessorTester::BadAccessKind::HEAP_BUFFER_UNDERFLOW);
+
+    ASSERT_TRUE(tester->memory_error_detected());
+  }
+}
 #endif
 
 void TestMemoryInterceptors::TestClangValidAccess(
@@ -668,6 +668,20 @@ class SyzyAsanMemoryAccessorTester : public MemoryAccessorTester {
                                    void* ptr,
                                    BadAccessKind bad_access_type) override;
 
+  // Checks that the range probe @p access_fn doesn't raise exceptions on
+  // checking the @p size bytes at @p ptr, and that @p access_fn doesn't modify
+  // any registers or flags when executed.
+  void CheckRangeAccessAndCompareContexts(FARPROC access_fn,
+                                          void* ptr,
+                                          size_t size);
+
+  // Checks that the range probe @p access_fn generates @p bad_access_type on
+  // checking the @p size bytes at @p ptr.
+  void AssertRangeErrorIsDetected(FARPROC access_fn,
+                                  void* ptr,
+                                  size_t size,
+                                  BadAccessKind bad_access_type);
+
   enum StringOperationDirection {
     DIRECTION_FORWARD,
     DIRECTION_BACKWARD
@@ -743,6 +757,11 @@ class TestMemoryInterceptors : public TestWithAsanLogger {
     bool uses_counter;
   };
 
+  struct RangeInterceptFunction {
+    void(*function)();
+    bool ignore_flags;
+  };
+
   static const bool kCounterInit_ecx = true;
   static const bool kCounterInit_1 = false;
 
@@ -783,6 +802,18 @@ class TestMemoryInterceptors : public TestWithAsanLogger {
   void TestStringOverrunAccess(const StringInterceptFunction (&fns)[N]) {
     TestStringOverrunAccess(fns, N);
   }
+  template <size_t N>
+  void TestRangeValidAccess(const RangeInterceptFunction (&fns)[N]) {
+    TestRangeValidAccess(fns, N);
+  }
+  template <size_t N>
+  void TestRangeOverrunAccess(const RangeInterceptFunction (&fns)[N]) {
+    TestRangeOverrunAccess(fns, N);
+  }
+  template <size_t N>
+  void TestRangeUnderrunAccess(const RangeInterceptFunction (&fns)[N]) {
+    TestRangeUnderrunAccess(fns, N);
+  }
 #endif
   template <size_t N>
   void TestValidAccess(const ClangInterceptFunction(&fns)[N]) {
@@ -812,6 +843,11 @@ class TestMemoryInterceptors : public TestWithAsanLogger {
       const StringInterceptFunction* fns, size_t num_fns);
   void TestStringOverrunAccess(
       const StringInterceptFunction* fns, size_t num_fns);
+  void TestRangeValidAccess(const RangeInterceptFunction* fns, size_t num_fns);
+  void TestRangeOverrunAccess(const RangeInterceptFunction* fns,
+                              size_t num_fns);
+  void TestRangeUnderrunAccess(const RangeInterceptFunction* fns,
+                               size_t num_fns);
 #endif
   void TestClangValidAccess(const ClangInterceptFunction* fns, size_t num_fns);
   void TestClangOverrunAccess(const ClangInterceptFunction* fns,
@@ -57,9 +57,14 @@
 //    metrics. The trace segment with be dump to a file for post-processing.
 //
 //    There are two mechanisms to collect metrics:
-//    - Basic mode: In the basic mode, the hook acquires a lock and updates a
-//      process-wide segment shared by all threads. In this mode, no events can
-//      be lost.
+//    - Basic mode: In the basic mode, the hook updates a small per-thread
+//      cache of pending counter updates, indexed by basic block id. The
+//      pending updates are merged under a lock into the process-wide segment
+//      shared by all threads when a cache entry is claimed by another basic
+//      block, and when the thread detaches or the agent is torn down. This
+//      keeps the threads running the same hot code from contending on the
+//      cache lines of the shared counters. In this mode, under a non-standard
+//      execution (crash, force exit, ...) pending updates may be lost.
 //    - Buffered mode: A per-thread buffer is used to collect execution
 //      information. A batch commit is done when the buffer is full. In this
 //      mode, under a non-standard execution (crash, force exit, ...) pending
@@ -285,6 +290,14 @@ struct BranchBufferEntry {
   uint32_t last_basic_block_id;
 };
 
+// An entry in the per-thread cache of pending counter updates. The counters
+// are laid out like a BranchFrequency, of which only the first column is used
+// by the bbentry instrumentation mode.
+struct CounterCacheEntry {
+  uint32_t basic_block_id;
+  BranchFrequency counters;
+};
+
 // All tracing runs through this object.
 base::LazyInstance<BasicBlockEntry> static_bbentry_instance =
     LAZY_INSTANCE_INITIALIZER;
@@ -296,6 +309,14 @@ inline uint32_t IncrementAndSaturate(uint32_t value) {
   return value;
 }
 
+// Add to and saturate a 32-bit value.
+inline uint32_t AddAndSaturate(uint32_t value, uint32_t delta) {
+  uint32_t sum = value + delta;
+  if (sum < value)
+    return ~0U;
+  return sum;
+}
+
 // Get the address of the module containing @p addr. We do this by querying
 // for the allocation that contains @p addr. This must lie within the
 // instrumented module, and be part of the single allocation in which the
@@ -393,7 +414,8 @@ class BasicBlockEntry::ThreadState : public agent::common::ThreadStateBase {
   // @param module_data Module information injected in the instrumented
   //     application.
   // @param lock Lock associated with the @p frequency_data.
-  // @param frequency_data Buffer to commit counters update.
+  // @param frequency_data Buffer to commit counters update. This may be
+  //     shared with the other threads.
   ThreadState(IndexedFrequencyData* module_data,
               base::Lock* lock,
               void* frequency_data);
@@ -407,6 +429,10 @@ class BasicBlockEntry::ThreadState : public agent::common::ThreadStateBase {
   // Allocate temporary space to simulate a branch predictor.
   void AllocatePredictorCache();
 
+  // Allocate the cache of pending counter updates. Until this is called, the
+  // counters are updated directly in the frequency data.
+  void AllocateCounterCache();
+
   // Saturation increment the frequency record for @p index. Note that in
   // Release mode, no range checking is performed on index.
   // @param basic_block_id the basic block index.
@@ -432,6 +458,10 @@ class BasicBlockEntry::ThreadState : public agent::common::ThreadStateBase {
   // Flush pending values in the basic block ids buffer.
   void Flush();
 
+  // Merge the pending counter updates into the frequency data, and empty the
+  // counter cache. This acquires the trace lock.
+  void MergeCounters();
+
   // Return the id of the most recent basic block executed.
   uint32_t last_basic_block_id() { return last_basic_block_id_; }
 
@@ -442,11 +472,15 @@ class BasicBlockEntry::ThreadState : public agent::common::ThreadStateBase {
   base::Lock* trace_lock() { return trace_lock_; }
 
   // For a given basic block id, returns the corresponding BBEntryFrequency.
+  // When the counter cache is allocated, this is the pending update of the
+  // basic block. It is only valid until the next lookup.
   // @param basic_block_id the basic block index.
   // @returns the bbentry frequency entry for a given basic block id.
   BBEntryFrequency& GetBBEntryFrequency(uint32_t basic_block_id);
 
   // For a given basic block id, returns the corresponding BranchFrequency.
+  // When the counter cache is allocated, this is the pending update of the
+  // basic block. It is only valid until the next lookup.
   // @param basic_block_id the basic block index.
   // @returns the branch frequency entry for a given basic block id.
   BranchFrequency& GetBranchFrequency(uint32_t basic_block_id);
@@ -459,11 +493,23 @@ class BasicBlockEntry::ThreadState : public agent::common::ThreadStateBase {
   }
 
  protected:
+  // Returns the pending counter updates of @p basic_block_id, evicting the
+  // updates of the basic block sharing its cache entry if need be.
+  // @param basic_block_id the basic block index.
+  // @returns the pending counter updates of @p basic_block_id.
+  BranchFrequency& GetCachedCounters(uint32_t basic_block_id);
+
+  // Merges the pending counter updates of @p entry into the frequency data,
+  // and clears them. This must be called under trace_lock_.
+  // @param entry the counter cache entry to merge.
+  void MergeEntryUnlocked(CounterCacheEntry* entry);
+
   // As a shortcut, this points to the beginning of the array of basic-block
   // entry frequency values. With tracing enabled, this is equivalent to:
   //     reinterpret_cast<uint32_t*>(this->trace_data->frequency_data)
   // If tracing is not enabled, this will be set to point to a static
-  // allocation of IndexedFrequencyData::frequency_data.
+  // allocation of IndexedFrequencyData::frequency_data, which is then updated
+  // directly.
   uint32_t* frequency_data_;  // Under trace_lock_.
 
   // Module information this thread state is gathering information on.
@@ -481,6 +527,10 @@ class BasicBlockEntry::ThreadState : public agent::common::ThreadStateBase {
   // The branch predictor state (2-bit saturating counter).
   std::vector<uint8_t> predictor_data_;
 
+  // The pending counter updates of this thread, direct-mapped by basic block
+  // id. Only touched by the owning thread, or once it's gone.
+  std::vector<CounterCacheEntry> counter_cache_;
+
   // The last basic block id executed.
   uint32_t last_basic_block_id_;
 
@@ -501,6 +551,7 @@ BasicBlockEntry::ThreadState::ThreadState(IndexedFrequencyData* module_data,
 BasicBlockEntry::ThreadState::~ThreadState() {
   if (!basic_block_id_buffer_.empty())
     Flush();
+  MergeCounters();
 
   uint32_t slot = GetBasicBlockData()->fs_slot;
   if (slot != 0) {
@@ -519,6 +570,12 @@ void BasicBlockEntry::ThreadState::AllocatePredictorCache() {
   predictor_data_.resize(kPredictorCacheSize);
 }
 
+void BasicBlockEntry::ThreadState::AllocateCounterCache() {
+  DCHECK(counter_cache_.empty());
+  CounterCacheEntry empty_entry = { kInvalidBasicBlockId, {} };
+  counter_cache_.resize(kCounterCacheSize, empty_entry);
+}
+
 void BasicBlockEntry::ThreadState::reset_last_basic_block_id() {
   last_basic_block_id_ = kInvalidBasicBlockId;
 }
@@ -526,6 +583,11 @@ void BasicBlockEntry::ThreadState::reset_last_basic_block_id() {
 BBEntryFrequency& BasicBlockEntry::ThreadState::GetBBEntryFrequency(
     uint32_t basic_block_id) {
   DCHECK(frequency_data_ != NULL);
+  if (!counter_cache_.empty()) {
+    // The pending frequency is the first column of the cached counters.
+    return reinterpret_cast<BBEntryFrequency&>(
+        GetCachedCounters(basic_block_id));
+  }
   BBEntryFrequency* frequencies =
       reinterpret_cast<BBEntryFrequency*>(frequency_data_);
   BBEntryFrequency& entry = frequencies[basic_block_id];
@@ -535,12 +597,51 @@ BBEntryFrequency& BasicBlockEntry::ThreadState::GetBBEntryFrequency(
 BranchFrequency& BasicBlockEntry::ThreadState::GetBranchFrequency(
     uint32_t basic_block_id) {
   DCHECK(frequency_data_ != NULL);
+  if (!counter_cache_.empty())
+    return GetCachedCounters(basic_block_id);
   BranchFrequency* frequencies =
       reinterpret_cast<BranchFrequency*>(frequency_data_);
   BranchFrequency& entry = frequencies[basic_block_id];
   return entry;
 }
 
+inline BranchFrequency& BasicBlockEntry::ThreadState::GetCachedCounters(
+    uint32_t basic_block_id) {
+  DCHECK(!counter_cache_.empty());
+  CounterCacheEntry& entry =
+      counter_cache_[basic_block_id % kCounterCacheSize];
+  if (entry.basic_block_id != basic_block_id) {
+    // Another basic block owns the entry, so its pending updates have to be
+    // committed first. This is the only place where the hooks take the lock.
+    if (entry.basic_block_id != kInvalidBasicBlockId) {
+      base::AutoLock scoped_lock(*trace_lock_);
+      MergeEntryUnlocked(&entry);
+    }
+    entry.basic_block_id = basic_block_id;
+  }
+  return entry.counters;
+}
+
+void BasicBlockEntry::ThreadState::MergeEntryUnlocked(
+    CounterCacheEntry* entry) {
+  DCHECK(entry != NULL);
+  DCHECK(module_data_ != NULL);
+  DCHECK_LT(entry->basic_block_id, module_data_->num_entries);
+  trace_lock_->AssertAcquired();
+
+  // The frequency data has one or three columns, depending on the
+  // instrumentation mode.
+  uint32_t num_columns = module_data_->num_columns;
+  DCHECK_LE(num_columns, sizeof(entry->counters) / sizeof(uint32_t));
+  const uint32_t* counters = &entry->counters.frequency;
+  uint32_t* frequencies = frequency_data_ + entry->basic_block_id * num_columns;
+  for (uint32_t i = 0; i < num_columns; ++i)
+    frequencies[i] = AddAndSaturate(frequencies[i], counters[i]);
+
+  entry->basic_block_id = kInvalidBasicBlockId;
+  ::memset(&entry->counters, 0, sizeof(entry->counters));
+}
+
 inline void BasicBlockEntry::ThreadState::Increment(uint32_t basic_block_id) {
   DCHECK(frequency_data_ != NULL);
   DCHECK(module_data_ != NULL);
@@ -640,6 +741,18 @@ void BasicBlockEntry::ThreadState::Flush() {
   basic_block_id_buffer_offset_ = 0;
 }
 
+void BasicBlockEntry::ThreadState::MergeCounters() {
+  if (counter_cache_.empty())
+    return;
+
+  base::AutoLock scoped_lock(*trace_lock_);
+  for (size_t i = 0; i < counter_cache_.size(); ++i) {
+    CounterCacheEntry* entry = &counter_cache_[i];
+    if (entry->basic_block_id != kInvalidBasicBlockId)
+      MergeEntryUnlocked(entry);
+  }
+}
+
 BasicBlockEntry* BasicBlockEntry::Instance() {
   return static_bbentry_instance.Pointer();
 }
@@ -766,6 +879,9 @@ BasicBlockEntry::ThreadState* BasicBlockEntry::CreateThreadState(
   // Allocate buffer to which basic block id are pushed before being committed.
   state->AllocateBasicBlockIdBuffer();
 
+  // Allocate the cache in which counter updates are kept before being merged.
+  state->AllocateCounterCache();
+
   return state;
 }
 
@@ -804,7 +920,6 @@ void WINAPI BasicBlockEntry::IncrementIndexedFreqDataHook(
     state = Instance()->CreateThreadState(entry_frame->module_data);
   }
 
-  base::AutoLock scoped_lock(*state->trace_lock());
   state->Increment(entry_frame->index);
 }
 
@@ -820,7 +935,6 @@ void WINAPI BasicBlockEntry::BranchEnterHook(
     state = Instance()->CreateThreadState(entry_frame->module_data);
   }
 
-  base::AutoLock scoped_lock(*state->trace_lock());
   uint32_t last_basic_block_id = state->last_basic_block_id();
   state->Enter(entry_frame->index, last_basic_block_id);
   state->reset_last_basic_block_id();
@@ -839,8 +953,8 @@ void WINAPI BasicBlockEntry::BranchEnterBufferedHook(
   }
 
   if (state->Push(entry_frame->index)) {
-    base::AutoLock scoped_lock(*state->trace_lock());
     state->Flush();
+    state->MergeCounters();
   }
   state->reset_last_basic_block_id();
 }
@@ -869,7 +983,6 @@ void __fastcall BasicBlockEntry::BranchEnterHookSlot(uint32_t index) {
   if (state == NULL)
     return;
 
-  base::AutoLock scoped_lock(*state->trace_lock());
   uint32_t last_basic_block_id = state->last_basic_block_id();
   state->Enter(index, last_basic_block_id);
   state->reset_last_basic_block_id();
@@ -882,8 +995,8 @@ void __fastcall BasicBlockEntry::BranchEnterBufferedHookSlot(uint32_t index) {
     return;
 
   if (state->Push(index)) {
-    base::AutoLock scoped_lock(*state->trace_lock());
     state->Flush();
+    state->MergeCounters();
   }
   state->reset_last_basic_block_id();
 }
@@ -1050,7 +1163,11 @@ void BasicBlockEntry::OnThreadDetach(IndexedFrequencyData* module_data) {
   if (state == NULL)
     return;
 
+  // Commit the pending updates of the thread. Those of the threads that never
+  // detach get committed when their state is deleted, at the latest when the
+  // agent is torn down.
   state->Flush();
+  state->MergeCounters();
   thread_state_manager_.MarkForDeath(state);
 }
 
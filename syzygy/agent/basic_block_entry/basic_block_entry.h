@@ -53,6 +53,8 @@ class BasicBlockEntry {
   static const size_t kBufferSize = 4096;
   // The number of entries in the simulated branch predictor cache.
   static const size_t kPredictorCacheSize = 4096;
+  // The number of entries in the per-thread cache of pending counter updates.
+  static const size_t kCounterCacheSize = 1024;
 
   // This structure describes the contents of the stack above a call to
   // BasicBlockEntry::IncrementIndexedFreqDataHook. A pointer to this structure
@@ -165,6 +167,11 @@ class BasicBlockEntry {
   // The RPC session we're logging to/through.
   trace::client::RpcSession session_;
 
+  // Global lock to avoid concurrent segment_ update. This also serializes the
+  // merging of the thread states' counters into the frequency data, so it must
+  // outlive thread_state_manager_.
+  base::Lock lock_;
+
   // A helper to manage the life-cycle of the ThreadState instances allocated
   // by this agent.
   ThreadStateManager thread_state_manager_;
@@ -173,9 +180,6 @@ class BasicBlockEntry {
   // goes to specially allocated segments that we don't explicitly keep track
   // of, but rather that we let live until the client gets torn down.
   trace::client::TraceFileSegment segment_;  // Under lock_.
-
-  // Global lock to avoid concurrent segment_ update.
-  base::Lock lock_;
 };
 
 }  // namespace basic_block_entry
@@ -82,6 +82,23 @@ MATCHER_P3(FrequencyDataMatches, module, values_count, bb_freqs, "") {
   return ::memcmp(bb_freqs, arg->frequency_data, values_count) == 0;
 }
 
+// A helper to match a column of basic-block frequency results to a value.
+MATCHER_P3(FrequencyColumnIs, module, column, value, "") {
+  if (arg->module_base_addr != module)
+    return false;
+
+  if (arg->frequency_size != sizeof(uint32_t))
+    return false;
+
+  const uint32_t* frequency_data =
+      reinterpret_cast<const uint32_t*>(arg->frequency_data);
+  for (size_t i = 0; i < arg->num_entries; ++i) {
+    if (frequency_data[i * arg->num_columns + column] != value)
+      return false;
+  }
+  return true;
+}
+
 // The test fixture for the basic-block entry agent.
 class BasicBlockEntryTest : public testing::Test {
  public:
@@ -450,19 +467,44 @@ class BasicBlockEntryTest : public testing::Test {
 
     Shutdown(main_mode);
 
-    // Validate all events have been committed.
-    const uint32_t* frequency_data =
-        reinterpret_cast<uint32_t*>(common_data_->frequency_data);
-    uint32_t num_columns = common_data_->num_columns;
-
+    // With a DllMain, the threads have committed their events when they
+    // detached.
     const uint32_t expected_frequency = kNumThreads * kNumThreadIteration;
-    for (size_t i = 0; i < kNumBasicBlocks; ++i) {
-      EXPECT_EQ(expected_frequency, frequency_data[i * num_columns]);
+    if (main_mode == kDllMain) {
+      const uint32_t* frequency_data =
+          reinterpret_cast<uint32_t*>(common_data_->frequency_data);
+      uint32_t num_columns = common_data_->num_columns;
+      for (size_t i = 0; i < kNumBasicBlocks; ++i) {
+        EXPECT_EQ(expected_frequency, frequency_data[i * num_columns]);
+      }
     }
 
-    // Unload the DLL and stop the service.
+    // Unload the DLL, which commits the events of the threads that never
+    // detached, and validate all events made it to the trace.
     ASSERT_NO_FATAL_FAILURE(UnloadDll());
-    ASSERT_NO_FATAL_FAILURE(StopService());
+    ASSERT_NO_FATAL_FAILURE(CheckTraceFrequency(expected_frequency));
+  }
+
+  // Replays the logs and checks that the first column of the frequency data
+  // of each basic block is equal to @p expected_frequency.
+  void CheckTraceFrequency(uint32_t expected_frequency) {
+    HMODULE self = ::GetModuleHandle(NULL);
+    DWORD process_id = ::GetCurrentProcessId();
+
+    EXPECT_CALL(handler_, OnProcessStarted(_, process_id, _));
+    EXPECT_CALL(handler_, OnProcessAttach(_,
+                                          process_id,
+                                          _,
+                                          ModuleAtAddress(self)));
+    EXPECT_CALL(handler_, OnIndexedFrequency(
+        _,
+        process_id,
+        _,
+        FrequencyColumnIs(self, 0, expected_frequency)));
+    EXPECT_CALL(handler_, OnProcessEnded(_, process_id));
+
+    // Replay the log.
+    ASSERT_NO_FATAL_FAILURE(ReplayLogs(1));
   }
 
   void CheckExecution(MainMode main_mode, InstrumentationMode mode) {
@@ -499,15 +541,18 @@ class BasicBlockEntryTest : public testing::Test {
     // Simulate the process detach event.
     Shutdown(main_mode);
 
-    // Validate all events have been committed.
+    // With a DllMain, the events have been committed on process detach.
     const uint32_t expected_frequency = kNumThreads * kNumThreadIteration;
-    for (size_t i = 0; i < kNumBasicBlocks; ++i) {
-      EXPECT_EQ(expected_frequency, frequency_data[i * num_columns]);
+    if (main_mode == kDllMain) {
+      for (size_t i = 0; i < kNumBasicBlocks; ++i) {
+        EXPECT_EQ(expected_frequency, frequency_data[i * num_columns]);
+      }
     }
 
-    // Unload the DLL and stop the service.
+    // Unload the DLL, which commits any pending event, and validate all events
+    // made it to the trace.
     ASSERT_NO_FATAL_FAILURE(UnloadDll());
-    ASSERT_NO_FATAL_FAILURE(StopService());
+    ASSERT_NO_FATAL_FAILURE(CheckTraceFrequency(expected_frequency));
   }
 
   // The directory where trace file output will be written.
@@ -783,6 +828,43 @@ TEST_F(BasicBlockEntryTest, SingleThreadedExeBasicBlockEvents) {
   ASSERT_NO_FATAL_FAILURE(ReplayLogs(1));
 }
 
+TEST_F(BasicBlockEntryTest, BasicBlockEventsCommittedOnThreadDetach) {
+  // Configure for BasicBlock mode.
+  ConfigureBasicBlockAgent();
+
+  ASSERT_NO_FATAL_FAILURE(StartService());
+  ASSERT_NO_FATAL_FAILURE(LoadDll());
+
+  // Simulate the process attach event.
+  SimulateModuleEvent(DLL_PROCESS_ATTACH);
+  ASSERT_NE(default_frequency_data_, common_data_->frequency_data);
+
+  // Keep a pointer to raw counters.
+  const uint32_t* frequency_data =
+      reinterpret_cast<uint32_t*>(common_data_->frequency_data);
+
+  SimulateBasicBlockEntry(0);
+  SimulateBasicBlockEntry(0);
+  SimulateBasicBlockEntry(1);
+
+  // The events are kept in the thread state until the thread detaches.
+  EXPECT_EQ(0U, frequency_data[0]);
+  EXPECT_EQ(0U, frequency_data[1]);
+
+  SimulateModuleEvent(DLL_THREAD_DETACH);
+  EXPECT_EQ(2U, frequency_data[0]);
+  EXPECT_EQ(1U, frequency_data[1]);
+
+  // Committing the events again must not count them twice.
+  SimulateModuleEvent(DLL_PROCESS_DETACH);
+  EXPECT_EQ(2U, frequency_data[0]);
+  EXPECT_EQ(1U, frequency_data[1]);
+
+  // Unload the DLL and stop the service.
+  ASSERT_NO_FATAL_FAILURE(UnloadDll());
+  ASSERT_NO_FATAL_FAILURE(StopService());
+}
+
 TEST_F(BasicBlockEntryTest, SingleThreadedExeBranchEvents) {
   // Configure for Branch mode.
   ConfigureBranchAgent();
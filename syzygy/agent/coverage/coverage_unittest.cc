@@ -16,6 +16,9 @@
 
 #include "syzygy/agent/coverage/coverage.h"
 
+#include <memory>
+
+#include "base/environment.h"
 #include "base/files/file_enumerator.h"
 #include "base/files/file_util.h"
 #include "base/files/scoped_temp_dir.h"
@@ -24,6 +27,7 @@
 #include "syzygy/common/indexed_frequency_data.h"
 #include "syzygy/trace/common/unittest_util.h"
 #include "syzygy/trace/parse/unittest_util.h"
+#include "syzygy/trace/protocol/call_trace_defs.h"
 
 namespace agent {
 namespace coverage {
@@ -92,6 +96,10 @@ class CoverageClientTest : public testing::Test {
   virtual void TearDown() override {
     UnloadDll();
 
+    // Some tests enable the asynchronous buffer exchanges.
+    std::unique_ptr<base::Environment> env(base::Environment::Create());
+    env->UnSetVar(::kSyzygyRpcSpareBuffersEnvVar);
+
     // Stop the call trace service.
     service_.Stop();
   }
@@ -261,5 +269,55 @@ TEST_F(CoverageClientTest, VisitOneBB) {
   ASSERT_NO_FATAL_FAILURE(ReplayLogs(1));
 }
 
+TEST_F(CoverageClientTest, LoadUnloadWithAsyncExchange) {
+  // The buffer exchange thread is stopped from DllMain when the agent is
+  // unloaded, and must not be waited for under the loader lock.
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+  ASSERT_TRUE(env->SetVar(::kSyzygyRpcSpareBuffersEnvVar, "2"));
+
+  ASSERT_NO_FATAL_FAILURE(StartService());
+
+  HMODULE self = ::GetModuleHandle(NULL);
+  DWORD process_id = ::GetCurrentProcessId();
+  DWORD thread_id = ::GetCurrentThreadId();
+
+  // Load and unload the agent repeatedly, so that it is also unloaded while
+  // the thread is busy pre-fetching the spare buffers.
+  const size_t kNumIterations = 3;
+  for (size_t i = 0; i < kNumIterations; ++i) {
+    ASSERT_NO_FATAL_FAILURE(LoadDll());
+
+    coverage_data.initialization_attempted = 0U;
+    coverage_data.frequency_data = bb_seen_array;
+    EXPECT_TRUE(DllMainThunk(self, DLL_PROCESS_ATTACH, NULL));
+    ASSERT_NE(static_cast<void*>(bb_seen_array),
+              coverage_data.frequency_data);
+    VisitBlock(0);
+
+    ASSERT_NO_FATAL_FAILURE(UnloadDll());
+  }
+
+  const uint8_t kExpectedCoverageData[kBasicBlockCount] = {1, 0};
+
+  // Each load has its own session, whose buffers all reach the service.
+  EXPECT_CALL(handler_, OnProcessStarted(_, process_id, _))
+      .Times(kNumIterations);
+  EXPECT_CALL(handler_, OnProcessAttach(_,
+                                        process_id,
+                                        thread_id,
+                                        ModuleAtAddress(self)))
+      .Times(kNumIterations);
+  EXPECT_CALL(handler_, OnIndexedFrequency(
+      _,
+      process_id,
+      thread_id,
+      CoverageDataMatches(self, kBasicBlockCount, kExpectedCoverageData)))
+      .Times(kNumIterations);
+  EXPECT_CALL(handler_, OnProcessEnded(_, process_id))
+      .Times(kNumIterations);
+
+  ASSERT_NO_FATAL_FAILURE(ReplayLogs(kNumIterations));
+}
+
 }  // namespace coverage
 }  // namespace agent
@@ -15,15 +15,48 @@
 #include "syzygy/agent/memprof/function_call_logger.h"
 
 #include "syzygy/agent/common/stack_capture.h"
+#include "syzygy/trace/protocol/compact_function_calls.h"
 
 namespace agent {
 namespace memprof {
 
+// The batch of compactly encoded calls that a thread is appending to.
+class FunctionCallLogger::CompactBatch
+    : public agent::common::ThreadStateBase {
+ public:
+  CompactBatch() : record(nullptr) {}
+
+  // @param segment The segment of the thread.
+  // @returns true if the batch is the last record of @p segment, and can
+  //     therefore be extended.
+  bool IsLastRecordOf(const TraceFileSegment* segment) const {
+    if (record == nullptr || segment->write_ptr == nullptr)
+      return false;
+    if (record->data + record->data_size != segment->write_ptr)
+      return false;
+    // The segment may have been exchanged for a buffer where a record of
+    // another type ends at the same address.
+    const RecordPrefix* prefix =
+        reinterpret_cast<const RecordPrefix*>(record) - 1;
+    return prefix->type == TraceBatchDetailedFunctionCalls::kTypeId;
+  }
+
+  // The record of the batch.
+  TraceBatchDetailedFunctionCalls* record;
+
+  // The state of the encoding of the batch.
+  trace::protocol::CompactFunctionCallEncoder encoder;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(CompactBatch);
+};
+
 FunctionCallLogger::FunctionCallLogger(
     trace::client::RpcSession* session)
     : session_(session),
       stack_trace_tracking_(kTrackingNone),
       serialize_timestamps_(false),
+      compact_encoding_(false),
       call_counter_(0),
       serial_(0) {
   DCHECK_NE(static_cast<trace::client::RpcSession*>(nullptr), session);
@@ -106,6 +139,55 @@ uint32_t FunctionCallLogger::GetStackTraceId(TraceFileSegment* segment) {
   return stack.absolute_stack_id();
 }
 
+void FunctionCallLogger::EmitCompactDetailedFunctionCall(
+    TraceFileSegment* segment, const TraceDetailedFunctionCall* call) {
+  DCHECK_NE(static_cast<TraceFileSegment*>(nullptr), segment);
+  DCHECK_NE(static_cast<const TraceDetailedFunctionCall*>(nullptr), call);
+
+  CompactBatch* batch = GetOrAllocateCompactBatch();
+  size_t max_size =
+      trace::protocol::CompactFunctionCallEncoder::GetMaxEncodedSize(*call);
+
+  // Start a new batch if the current one can't be extended.
+  if (!batch->IsLastRecordOf(segment) || !segment->CanAllocateRaw(max_size)) {
+    size_t header_size = FIELD_OFFSET(TraceBatchDetailedFunctionCalls, data);
+    if (!segment->CanAllocate(header_size + max_size) &&
+        !FlushSegment(segment)) {
+      return;
+    }
+    DCHECK(segment->CanAllocate(header_size + max_size));
+
+    batch->record = reinterpret_cast<TraceBatchDetailedFunctionCalls*>(
+        segment->AllocateTraceRecordImpl(
+            TraceBatchDetailedFunctionCalls::kTypeId, header_size));
+    DCHECK_NE(static_cast<TraceBatchDetailedFunctionCalls*>(nullptr),
+              batch->record);
+    batch->record->base_timestamp = call->timestamp;
+    batch->encoder.Reset(call->timestamp);
+  }
+
+  // Encode the call at the end of the segment, and grow the batch over it.
+  size_t size = batch->encoder.Encode(*call, segment->write_ptr);
+  RecordPrefix* prefix = reinterpret_cast<RecordPrefix*>(batch->record) - 1;
+  prefix->size += size;
+  batch->record->data_size += size;
+  ++batch->record->num_calls;
+  segment->write_ptr += size;
+  segment->header->segment_length += size;
+}
+
+FunctionCallLogger::CompactBatch*
+FunctionCallLogger::GetOrAllocateCompactBatch() {
+  CompactBatch* batch = compact_batch_.Get();
+  if (batch != nullptr)
+    return batch;
+
+  batch = new CompactBatch();
+  compact_batch_manager_.Register(batch);
+  compact_batch_.Set(batch);
+  return batch;
+}
+
 bool FunctionCallLogger::FlushSegment(TraceFileSegment* segment) {
   DCHECK_NE(static_cast<TraceFileSegment*>(nullptr), segment);
   return session_->ExchangeBuffer(segment);
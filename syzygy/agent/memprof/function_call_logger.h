@@ -20,6 +20,8 @@
 
 #include <set>
 
+#include "base/threading/thread_local.h"
+#include "syzygy/agent/common/thread_state.h"
 #include "syzygy/agent/memprof/parameters.h"
 #include "syzygy/trace/client/rpc_session.h"
 
@@ -90,6 +92,12 @@ class FunctionCallLogger {
   void set_serialize_timestamps(bool serialize_timestamps) {
     serialize_timestamps_ = serialize_timestamps;
   }
+  bool compact_encoding() const {
+    return compact_encoding_;
+  }
+  void set_compact_encoding(bool compact_encoding) {
+    compact_encoding_ = compact_encoding;
+  }
   // @}
 
   // @returns a unique serial number for this function call logger.
@@ -97,15 +105,37 @@ class FunctionCallLogger {
   uint32_t serial() const { return serial_; }
 
  protected:
+  // Forward declaration.
+  class CompactBatch;
+
+  // The size of the largest detailed function call record that is compactly
+  // encoded. Larger calls are emitted as TraceDetailedFunctionCall records.
+  static const size_t kMaxCompactCallSize = 256;
+
   // Flushes the provided segment, and gets a new one.
   bool FlushSegment(TraceFileSegment* segment);
 
+  // Appends a call to the batch of compactly encoded calls of the current
+  // thread. A new batch is started if the current one isn't the last record
+  // of @p segment anymore.
+  // @param segment The segment to write to.
+  // @param call The call to append.
+  void EmitCompactDetailedFunctionCall(TraceFileSegment* segment,
+                                       const TraceDetailedFunctionCall* call);
+
+  // @returns the compact batch of the current thread, allocating it if
+  //     needed.
+  CompactBatch* GetOrAllocateCompactBatch();
+
   // The stack-trace tracking mode. Default to kTrackingNone.
   StackTraceTracking stack_trace_tracking_;
 
   // Whether or not timestamps are being serialized.
   bool serialize_timestamps_;
 
+  // Whether or not detailed function calls are compactly encoded.
+  bool compact_encoding_;
+
   // The RPC session events are being written to.
   trace::client::RpcSession* session_;
 
@@ -126,6 +156,11 @@ class FunctionCallLogger {
   typedef std::set<uint32_t> StackIdSet;
   StackIdSet emitted_stack_ids_;  // Under lock_.
 
+  // The compact batches of the threads. These are only allocated if
+  // compact_encoding_ is true.
+  agent::common::ThreadStateManager compact_batch_manager_;
+  base::ThreadLocalPointer<CompactBatch> compact_batch_;
+
   // A unique serial number generated at construction time. For unittesting.
   uint32_t serial_;
 
@@ -209,12 +244,20 @@ void FunctionCallLogger::EmitDetailedFunctionCall(TraceFileSegment* segment,
   size_t data_size = FIELD_OFFSET(TraceDetailedFunctionCall, argument_data) +
       args_size;
 
-  if (!segment->CanAllocate(data_size) && !FlushSegment(segment))
-    return;
-  DCHECK(segment->CanAllocate(data_size));
+  // Calls that are compactly encoded are first written to the stack, and
+  // then appended to the batch of the thread.
+  uint64_t compact_buffer[kMaxCompactCallSize / sizeof(uint64_t)];
+  bool compact = compact_encoding_ && data_size <= sizeof(compact_buffer);
 
-  TraceDetailedFunctionCall* data =
-      segment->AllocateTraceRecord<TraceDetailedFunctionCall>(data_size);
+  TraceDetailedFunctionCall* data = nullptr;
+  if (compact) {
+    data = reinterpret_cast<TraceDetailedFunctionCall*>(compact_buffer);
+  } else {
+    if (!segment->CanAllocate(data_size) && !FlushSegment(segment))
+      return;
+    DCHECK(segment->CanAllocate(data_size));
+    data = segment->AllocateTraceRecord<TraceDetailedFunctionCall>(data_size);
+  }
   data->function_id = function_id;
   data->stack_trace_id = stack_trace_id;
   data->argument_data_size = args_size;
@@ -227,8 +270,11 @@ void FunctionCallLogger::EmitDetailedFunctionCall(TraceFileSegment* segment,
     data->timestamp = ::trace::common::GetTsc();
   }
 
-  if (args_size == 0)
+  if (args_size == 0) {
+    if (compact)
+      EmitCompactDetailedFunctionCall(segment, data);
     return;
+  }
 
   // Output the number of arguments.
   uint32_t* arg_sizes = reinterpret_cast<uint32_t*>(data->argument_data);
@@ -262,6 +308,9 @@ void FunctionCallLogger::EmitDetailedFunctionCall(TraceFileSegment* segment,
   arg_data += arg_size4;
   ArgumentSerializer<ArgType5>().serialize(arg5, arg_data);
   arg_data += arg_size5;
+
+  if (compact)
+    EmitCompactDetailedFunctionCall(segment, data);
 }
 
 // A templated helper for emitting a detailed function call record.
@@ -19,6 +19,7 @@
 #include "base/bind.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "syzygy/trace/protocol/compact_function_calls.h"
 
 namespace agent {
 namespace memprof {
@@ -316,5 +317,70 @@ TEST(FunctionCallLoggerTest, TraceDetailedFunctionCallSerializeTimestamps) {
   }
 }
 
+TEST(FunctionCallLoggerTest, TraceDetailedFunctionCallCompactEncoding) {
+  TestFunctionCallLogger fcl;
+  fcl.set_stack_trace_tracking(kTrackingNone);
+  fcl.set_serialize_timestamps(true);
+  fcl.set_compact_encoding(true);
+
+  for (size_t i = 0; i < 3; ++i)
+    TestEmitDetailedFunctionCall(&fcl);
+  // Another record ends the batch.
+  EXPECT_EQ(1u, fcl.GetFunctionId(&fcl.test_segment_, "foo"));
+  TestEmitDetailedFunctionCall(&fcl);
+
+  // 2 names, 2 batches.
+  ASSERT_EQ(4u, fcl.allocation_infos.size());
+  EXPECT_EQ(TraceFunctionNameTableEntry::kTypeId,
+            fcl.allocation_infos[0].record_type);
+  EXPECT_EQ(TraceBatchDetailedFunctionCalls::kTypeId,
+            fcl.allocation_infos[1].record_type);
+  EXPECT_EQ(TraceFunctionNameTableEntry::kTypeId,
+            fcl.allocation_infos[2].record_type);
+  EXPECT_EQ(TraceBatchDetailedFunctionCalls::kTypeId,
+            fcl.allocation_infos[3].record_type);
+
+  const TraceBatchDetailedFunctionCalls* batch0 =
+      reinterpret_cast<const TraceBatchDetailedFunctionCalls*>(
+          fcl.allocation_infos[1].record);
+  const TraceBatchDetailedFunctionCalls* batch1 =
+      reinterpret_cast<const TraceBatchDetailedFunctionCalls*>(
+          fcl.allocation_infos[3].record);
+  EXPECT_EQ(3u, batch0->num_calls);
+  EXPECT_EQ(1u, batch1->num_calls);
+
+  // The batches grew in place, so the records are consistent with the
+  // segment.
+  const RecordPrefix* prefix1 =
+      reinterpret_cast<const RecordPrefix*>(batch1) - 1;
+  EXPECT_EQ(FIELD_OFFSET(TraceBatchDetailedFunctionCalls, data) +
+                batch1->data_size,
+            prefix1->size);
+  EXPECT_EQ(fcl.test_segment_.write_ptr, batch1->data + batch1->data_size);
+
+  // The calls decode to the records that would have been emitted otherwise.
+  void* fcl_ptr = &fcl;
+  uint64_t timestamp = 0;
+  const TraceBatchDetailedFunctionCalls* batches[] = { batch0, batch1 };
+  for (const auto* batch : batches) {
+    trace::protocol::CompactFunctionCallDecoder decoder(batch);
+    while (!decoder.done()) {
+      std::vector<uint8_t> buffer;
+      ASSERT_TRUE(decoder.DecodeNext(&buffer));
+      const TraceDetailedFunctionCall* call =
+          reinterpret_cast<const TraceDetailedFunctionCall*>(buffer.data());
+      EXPECT_EQ(timestamp++, call->timestamp);
+      EXPECT_EQ(0u, call->function_id);
+      EXPECT_EQ(0u, call->stack_trace_id);
+      ASSERT_EQ(2 * sizeof(uint32_t) + sizeof(fcl_ptr),
+                call->argument_data_size);
+      EXPECT_EQ(0, ::memcmp(&fcl_ptr,
+                            call->argument_data + 2 * sizeof(uint32_t),
+                            sizeof(fcl_ptr)));
+    }
+  }
+  EXPECT_EQ(4u, timestamp);
+}
+
 }  // namespace memprof
 }  // namespace agent
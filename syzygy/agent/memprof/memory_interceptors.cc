@@ -28,6 +28,16 @@ extern "C" {
     __asm ret 4  \
   }
 
+// Range probes are called with EDX and the size of the range on the stack,
+// and the first address of the range in EDX.
+#define DEFINE_NULL_RANGE_PROBE(name)  \
+  void __declspec(naked) name() {  \
+    /* Restore the value of EDX. */  \
+    __asm mov edx, DWORD PTR[esp + 8]  \
+    /* Return and pop the size and the saved EDX value off the stack. */  \
+    __asm ret 8  \
+  }
+
 // Special instruction takes their addresses directly in some known registers,
 // so no extra information gets pushed onto the stack and there's nothing to
 // clean, we can simply return.
@@ -89,7 +99,12 @@ DEFINE_NULL_SPECIAL_PROBE(asan_check_4_byte_movs_access);
 DEFINE_NULL_SPECIAL_PROBE(asan_check_1_byte_stos_access);
 DEFINE_NULL_SPECIAL_PROBE(asan_check_2_byte_stos_access);
 DEFINE_NULL_SPECIAL_PROBE(asan_check_4_byte_stos_access);
+DEFINE_NULL_RANGE_PROBE(asan_check_range_read_access);
+DEFINE_NULL_RANGE_PROBE(asan_check_range_write_access);
+DEFINE_NULL_RANGE_PROBE(asan_check_range_read_access_no_flags);
+DEFINE_NULL_RANGE_PROBE(asan_check_range_write_access_no_flags);
 #undef DEFINE_NULL_MEMORY_PROBE
+#undef DEFINE_NULL_RANGE_PROBE
 #undef DEFINE_NULL_STRING_PROBE
 
 }  // extern "C"
@@ -97,6 +97,7 @@ void MemoryProfiler::PropagateParameters() {
       parameters_.stack_trace_tracking);
   function_call_logger_.set_serialize_timestamps(
       parameters_.serialize_timestamps);
+  function_call_logger_.set_compact_encoding(parameters_.compact_encoding);
 }
 
 MemoryProfiler::ThreadState* MemoryProfiler::GetOrAllocateThreadStateImpl() {
@@ -49,6 +49,9 @@ struct Parameters {
   // the hash value stored as an additional parameter to the heap free
   // function.
   bool hash_contents_at_free;
+  // If this is enabled then detailed function calls are emitted in per-thread
+  // batches, using a compact encoding.
+  bool compact_encoding;
 };
 
 // The environment variable that is used for extracting parameters.
@@ -61,11 +64,13 @@ extern const char* kStackTraceTrackingValues[];
 extern StackTraceTracking kDefaultStackTraceTracking;
 extern bool kDefaultSerializeTimestamps;
 extern bool kDefaultHashContentsAtFree;
+extern bool kDefaultCompactEncoding;
 
 // Parameter names for parsing.
 extern const char kParamStackTraceTracking[];
 extern const char kParamSerializeTimestamps[];
 extern const char kParamHashContentsAtFree[];
+extern const char kParamCompactEncoding[];
 
 // Initializes a Parameters struct with default values.
 // @param parameters The Parameters struct to be initialized.
@@ -26,6 +26,7 @@ TEST(ParametersTest, SetDefaults) {
   EXPECT_EQ(kDefaultStackTraceTracking, p.stack_trace_tracking);
   EXPECT_EQ(kDefaultSerializeTimestamps, p.serialize_timestamps);
   EXPECT_EQ(kDefaultHashContentsAtFree, p.hash_contents_at_free);
+  EXPECT_EQ(kDefaultCompactEncoding, p.compact_encoding);
 }
 
 TEST(ParametersTest, ParseInvalidStackTraceTracking) {
@@ -43,6 +44,7 @@ TEST(ParametersTest, ParseMinimalCommandLine) {
   EXPECT_EQ(kDefaultStackTraceTracking, p.stack_trace_tracking);
   EXPECT_EQ(kDefaultSerializeTimestamps, p.serialize_timestamps);
   EXPECT_EQ(kDefaultHashContentsAtFree, p.hash_contents_at_free);
+  EXPECT_EQ(kDefaultCompactEncoding, p.compact_encoding);
 }
 
 TEST(ParametersTest, ParseMaximalCommandLine) {
@@ -50,11 +52,13 @@ TEST(ParametersTest, ParseMaximalCommandLine) {
   SetDefaultParameters(&p);
   std::string str("--stack-trace-tracking=emit "
                   "--serialize-timestamps "
-                  "--hash-contents-at-free");
+                  "--hash-contents-at-free "
+                  "--compact-encoding");
   EXPECT_TRUE(ParseParameters(str, &p));
   EXPECT_EQ(kTrackingEmit, p.stack_trace_tracking);
   EXPECT_TRUE(p.serialize_timestamps);
   EXPECT_TRUE(p.hash_contents_at_free);
+  EXPECT_TRUE(p.compact_encoding);
 }
 
 TEST(ParametersTest, ParseNoEnvironment) {
@@ -68,6 +72,7 @@ TEST(ParametersTest, ParseNoEnvironment) {
   EXPECT_EQ(kDefaultStackTraceTracking, p.stack_trace_tracking);
   EXPECT_EQ(kDefaultSerializeTimestamps, p.serialize_timestamps);
   EXPECT_EQ(kDefaultHashContentsAtFree, p.hash_contents_at_free);
+  EXPECT_EQ(kDefaultCompactEncoding, p.compact_encoding);
 }
 
 TEST(ParametersTest, ParseEmptyEnvironment) {
@@ -81,6 +86,7 @@ TEST(ParametersTest, ParseEmptyEnvironment) {
   EXPECT_EQ(kDefaultStackTraceTracking, p.stack_trace_tracking);
   EXPECT_EQ(kDefaultSerializeTimestamps, p.serialize_timestamps);
   EXPECT_EQ(kDefaultHashContentsAtFree, p.hash_contents_at_free);
+  EXPECT_EQ(kDefaultCompactEncoding, p.compact_encoding);
 }
 
 TEST(ParametersTest, ParseInvalidEnvironment) {
@@ -44,24 +44,41 @@ using agent::common::ScopedLastErrorKeeper;
 
 typedef std::pair<RetAddr, FuncAddr> InvocationKey;
 
-class HashInvocationKey {
- public:
-  static const size_t bucket_size = 4;
-  static const size_t min_buckets = 8;
+// The number of slots of the per-thread invocation tables. This must be a
+// power of two.
+const size_t kInvocationTableSize = 1024;
+
+// The number of consecutive slots where an invocation can be stored. When
+// they're all taken, the least called of them is evicted.
+const size_t kInvocationTableMaxProbes = 8;
+
+// The interval at which the invocation tables are flushed to the trace, in
+// cycles. This is on the order of a second on current processors.
+const uint64_t kInvocationFlushIntervalCycles = 1ULL << 32;
+
+size_t HashInvocationKey(const InvocationKey& key) {
+  size_t hash = reinterpret_cast<size_t>(key.first) * 0x9E3779B1 +
+      reinterpret_cast<size_t>(key.second);
+  hash *= 0x85EBCA6B;
+  return hash ^ (hash >> 16);
+}
 
-  size_t operator()(const InvocationKey& key) const {
-    return reinterpret_cast<size_t>(key.first) ^
-        reinterpret_cast<size_t>(key.second);
-  }
+using agent::profiler::SymbolMap;
 
-  bool operator()(const InvocationKey& a, const InvocationKey& b) const {
-    return a < b;
+// An entry of the per-thread invocation tables, which aggregates the
+// invocations of a (caller, callee) pair until it's written to the trace.
+struct InvocationEntry {
+  InvocationEntry() : caller_move_count(0), function_move_count(0) {
+    ::memset(&info, 0, sizeof(info));
   }
-};
 
-using agent::profiler::SymbolMap;
+  // @returns true iff this entry is in use.
+  bool in_use() const { return key.second != NULL; }
+
+  // The caller and the callee of the invocations. The callee is NULL for the
+  // unused entries.
+  InvocationKey key;
 
-struct InvocationValue {
   // This invocation entry's caller's dynamic symbol, if any.
   scoped_refptr<SymbolMap::Symbol> caller_symbol;
   // The last observed move count for caller_symbol.
@@ -72,13 +89,10 @@ struct InvocationValue {
   // The last observed move count for function_symbol.
   int32_t function_move_count;
 
-  // Points to the trace buffer entry for the respective function.
-  InvocationInfo* info;
+  // The aggregated invocations, as they'll be written to the trace.
+  InvocationInfo info;
 };
 
-typedef std::unordered_map<InvocationKey, InvocationValue, HashInvocationKey>
-    InvocationMap;
-
 // The information on how to set the thread name comes from
 // a MSDN article: http://msdn2.microsoft.com/en-us/library/xcb2z8hs.aspx
 const DWORD kVCThreadNameException = 0x406D1388;
@@ -332,6 +346,15 @@ class Profiler::ThreadState
 
   void RecordInvocation(RetAddr caller, FuncAddr function, uint64_t cycles);
 
+  // Sets up @p entry to aggregate the invocations of @p key.
+  void InitializeInvocation(const InvocationKey& key, InvocationEntry* entry);
+
+  // Writes the invocations aggregated in @p entry to the trace, and frees it.
+  void WriteInvocation(InvocationEntry* entry);
+
+  // Writes all the invocations aggregated in the table to the trace.
+  void FlushInvocations();
+
   void UpdateOverhead(uint64_t entry_cycles);
   InvocationInfo* AllocateInvocationInfo();
   void ClearCache();
@@ -346,8 +369,15 @@ class Profiler::ThreadState
   // measures time exclusive of profiling overhead.
   uint64_t cycles_overhead_;
 
-  // The invocations we've recorded in our buffer.
-  InvocationMap invocations_;
+  // The invocations that are being aggregated, in an open-addressed hash
+  // table. They are written to the trace when they get evicted, when the
+  // table is flushed at a regular interval, and when the thread exits. This
+  // makes the size of the trace proportional to the number of distinct call
+  // edges rather than to the number of calls.
+  std::vector<InvocationEntry> invocations_;
+
+  // The cycle count after which the invocations are flushed to the trace.
+  uint64_t next_flush_cycles_;
 
   // The trace file segment we're recording to.
   trace::client::TraceFileSegment segment_;
@@ -362,17 +392,22 @@ class Profiler::ThreadState
 Profiler::ThreadState::ThreadState(Profiler* profiler)
     : profiler_(profiler),
       cycles_overhead_(0LL),
+      invocations_(kInvocationTableSize),
+      next_flush_cycles_(__rdtsc() + kInvocationFlushIntervalCycles),
       batch_(NULL) {
   Initialize();
 }
 
 Profiler::ThreadState::~ThreadState() {
-  ClearCache();
-
-  // If we have an outstanding buffer, let's deallocate it now.
+  // If we have an outstanding buffer, write out the pending invocations and
+  // deallocate it now.
+  if (segment_.write_ptr != NULL)
+    FlushInvocations();
   if (segment_.write_ptr != NULL)
     profiler_->session_.ReturnBuffer(&segment_);
 
+  ClearCache();
+
   Uninitialize();
 }
 
@@ -520,6 +555,14 @@ void Profiler::ThreadState::OnFunctionExit(const ThunkData* data,
     RecordInvocation(ret_data->function, data->function, cycles_executed);
   }
 
+  // Periodically write out the aggregated invocations, so that long running
+  // threads still make their way into the trace.
+  if (cycles_exit >= next_flush_cycles_) {
+    ScopedLastErrorKeeper keep_last_error;
+    FlushInvocations();
+    next_flush_cycles_ = cycles_exit + kInvocationFlushIntervalCycles;
+  }
+
   UpdateOverhead(cycles_exit);
 }
 
@@ -534,41 +577,75 @@ void Profiler::ThreadState::OnPageRemoved(const void* page) {
 void Profiler::ThreadState::RecordInvocation(RetAddr caller,
                                              FuncAddr function,
                                              uint64_t duration_cycles) {
-  // See whether we've already recorded an entry for this function.
+  // See whether we've already recorded an entry for this function, while
+  // keeping track of the least called entry in case we need to evict one.
   InvocationKey key(caller, function);
-  InvocationMap::iterator it = invocations_.find(key);
-  if (it != invocations_.end()) {
-    // Yup, we already have an entry, validate it.
-    InvocationValue& value = it->second;
-
-    if ((value.caller_symbol == NULL ||
-         value.caller_symbol->move_count() == value.caller_move_count) &&
-        (value.function_symbol == NULL ||
-         value.function_symbol->move_count() == value.function_move_count)) {
-      // The entry is still good, tally the new data.
-      ++(value.info->num_calls);
-      value.info->cycles_sum += duration_cycles;
-      if (duration_cycles < value.info->cycles_min) {
-        value.info->cycles_min = duration_cycles;
-      } else if (duration_cycles > value.info->cycles_max) {
-        value.info->cycles_max = duration_cycles;
-      }
+  size_t hash = HashInvocationKey(key);
+  InvocationEntry* victim = NULL;
+  for (size_t i = 0; i < kInvocationTableMaxProbes; ++i) {
+    InvocationEntry* entry =
+        &invocations_[(hash + i) & (kInvocationTableSize - 1)];
+
+    // The entries are never freed individually, so the first free one ends
+    // the search.
+    if (!entry->in_use()) {
+      victim = entry;
+      break;
+    }
 
-      // Early out on success.
-      return;
-    } else {
-      // The entry is not valid any more, discard it.
-      DCHECK(value.caller_symbol != NULL || value.function_symbol != NULL);
+    if (entry->key == key) {
+      // Yup, we already have an entry, validate it.
+      if ((entry->caller_symbol == NULL ||
+           entry->caller_symbol->move_count() == entry->caller_move_count) &&
+          (entry->function_symbol == NULL ||
+           entry->function_symbol->move_count() ==
+               entry->function_move_count)) {
+        // The entry is still good, tally the new data.
+        InvocationInfo& info = entry->info;
+        ++info.num_calls;
+        info.cycles_sum += duration_cycles;
+        if (duration_cycles < info.cycles_min) {
+          info.cycles_min = duration_cycles;
+        } else if (duration_cycles > info.cycles_max) {
+          info.cycles_max = duration_cycles;
+        }
+
+        // Early out on success.
+        return;
+      }
 
-      invocations_.erase(it);
+      // The entry is not valid any more, write it out and start over.
+      DCHECK(entry->caller_symbol != NULL || entry->function_symbol != NULL);
+      victim = entry;
+      break;
     }
+
+    if (victim == NULL || entry->info.num_calls < victim->info.num_calls)
+      victim = entry;
   }
-  DCHECK(invocations_.find(key) == invocations_.end());
+  DCHECK(victim != NULL);
 
-  // We don't have an entry, allocate a new one for this invocation.
+  // We don't have an entry, set up a new one for this invocation.
   // The code below may touch last error.
   ScopedLastErrorKeeper keep_last_error;
 
+  if (victim->in_use())
+    WriteInvocation(victim);
+  InitializeInvocation(key, victim);
+
+  InvocationInfo& info = victim->info;
+  info.num_calls = 1;
+  info.cycles_min = info.cycles_max = info.cycles_sum = duration_cycles;
+}
+
+void Profiler::ThreadState::InitializeInvocation(const InvocationKey& key,
+                                                 InvocationEntry* entry) {
+  DCHECK(entry != NULL);
+  DCHECK(!entry->in_use());
+
+  RetAddr caller = key.first;
+  FuncAddr function = key.second;
+
   scoped_refptr<SymbolMap::Symbol> caller_symbol =
       profiler_->symbol_map_.FindSymbol(caller);
 
@@ -591,51 +668,63 @@ void Profiler::ThreadState::RecordInvocation(RetAddr caller,
     LogSymbol(function_symbol.get());
   }
 
-  InvocationInfo* info = AllocateInvocationInfo();
-  if (info != NULL) {
-    InvocationValue& value = invocations_[key];
-    value.info = info;
-    value.caller_symbol = caller_symbol;
-    if (caller_symbol != NULL)
-      value.caller_move_count = caller_symbol->move_count();
-    else
-      value.caller_move_count = 0;
-
-    value.function_symbol = function_symbol;
-    if (function_symbol != NULL)
-      value.function_move_count = function_symbol->move_count();
-    else
-      value.function_move_count = 0;
-
-    if (function_symbol == NULL) {
-      // We're not in a dynamic function, record the (conventional) function.
-      info->function = function;
-      info->flags = 0;
-    } else {
-      // We're in a dynamic function symbol, record the details.
-      DCHECK_NE(function_symbol->id(), 0);
+  entry->key = key;
+  entry->caller_symbol = caller_symbol;
+  if (caller_symbol != NULL)
+    entry->caller_move_count = caller_symbol->move_count();
+  else
+    entry->caller_move_count = 0;
+
+  entry->function_symbol = function_symbol;
+  if (function_symbol != NULL)
+    entry->function_move_count = function_symbol->move_count();
+  else
+    entry->function_move_count = 0;
+
+  InvocationInfo* info = &entry->info;
+  if (function_symbol == NULL) {
+    // We're not in a dynamic function, record the (conventional) function.
+    info->function = function;
+    info->flags = 0;
+  } else {
+    // We're in a dynamic function symbol, record the details.
+    DCHECK_NE(function_symbol->id(), 0);
 
-      info->function_symbol_id = function_symbol->id();
-      info->flags = kFunctionIsSymbol;
-    }
+    info->function_symbol_id = function_symbol->id();
+    info->flags = kFunctionIsSymbol;
+  }
 
-    if (caller_symbol == NULL) {
-      // We're not in a dynamic caller_symbol, record the (conventional) caller.
-      info->caller = caller;
-      info->caller_offset = 0;
-    } else {
-      // We're in a dynamic caller_symbol, record the details.
-      DCHECK_NE(caller_symbol->id(), 0);
-
-      info->caller_symbol_id = caller_symbol->id();
-      info->flags |= kCallerIsSymbol;
-      info->caller_offset =
-          reinterpret_cast<const uint8_t*>(caller) -
-          reinterpret_cast<const uint8_t*>(caller_symbol->address());
-    }
+  if (caller_symbol == NULL) {
+    // We're not in a dynamic caller_symbol, record the (conventional) caller.
+    info->caller = caller;
+    info->caller_offset = 0;
+  } else {
+    // We're in a dynamic caller_symbol, record the details.
+    DCHECK_NE(caller_symbol->id(), 0);
+
+    info->caller_symbol_id = caller_symbol->id();
+    info->flags |= kCallerIsSymbol;
+    info->caller_offset =
+        reinterpret_cast<const uint8_t*>(caller) -
+        reinterpret_cast<const uint8_t*>(caller_symbol->address());
+  }
+}
+
+void Profiler::ThreadState::WriteInvocation(InvocationEntry* entry) {
+  DCHECK(entry != NULL);
+  DCHECK(entry->in_use());
+
+  InvocationInfo* info = AllocateInvocationInfo();
+  if (info != NULL)
+    *info = entry->info;
+
+  *entry = InvocationEntry();
+}
 
-    info->num_calls = 1;
-    info->cycles_min = info->cycles_max = info->cycles_sum = duration_cycles;
+void Profiler::ThreadState::FlushInvocations() {
+  for (size_t i = 0; i < invocations_.size(); ++i) {
+    if (invocations_[i].in_use())
+      WriteInvocation(&invocations_[i]);
   }
 }
 
@@ -686,8 +775,9 @@ bool Profiler::ThreadState::FlushSegment() {
 }
 
 void Profiler::ThreadState::ClearCache() {
+  // The invocations are aggregated outside of the segment, so only the batch
+  // being written to needs to be forgotten.
   batch_ = NULL;
-  invocations_.clear();
 }
 
 void Profiler::OnThreadDetach() {
@@ -158,6 +158,10 @@ MATCHER_P(InvocationInfoHasFunctionSymbol, symbol_id, "") {
   return false;
 }
 
+MATCHER_P(InvocationInfoHasNumCalls, num_calls, "") {
+  return arg->invocations[0].num_calls == num_calls;
+}
+
 // This needs to be declared at file scope for the benefit of __asm code.
 enum CallerAction {
   CALL_THROUGH,
@@ -565,6 +569,40 @@ TEST_F(ProfilerTest, RecordsOneEntryPerModuleAndFunction) {
   ASSERT_NO_FATAL_FAILURE(ReplayLogs());
 }
 
+TEST_F(ProfilerTest, AggregatesInvocations) {
+  const size_t kCallCount = 1000;
+
+  // Spin up the RPC service.
+  ASSERT_NO_FATAL_FAILURE(StartService());
+
+  ASSERT_NO_FATAL_FAILURE(LoadDll());
+
+  // Invoke Function A from the same call site a number of times.
+  for (size_t i = 0; i < kCallCount; ++i)
+    ASSERT_NO_FATAL_FAILURE(InvokeFunctionAThunk());
+
+  ASSERT_NO_FATAL_FAILURE(UnloadDll());
+
+  EXPECT_CALL(handler_, OnProcessStarted(_, ::GetCurrentProcessId(), _));
+  EXPECT_CALL(handler_, OnProcessAttach(_,
+                                        ::GetCurrentProcessId(),
+                                        ::GetCurrentThreadId(),
+                                        _))
+      .Times(testing::AnyNumber());
+
+  // All the calls should be aggregated in a single invocation record.
+  EXPECT_CALL(handler_, OnInvocationBatch(_,
+                                          ::GetCurrentProcessId(),
+                                          ::GetCurrentThreadId(),
+                                          1,
+                                          InvocationInfoHasNumCalls(
+                                              kCallCount)));
+  EXPECT_CALL(handler_, OnProcessEnded(_, ::GetCurrentProcessId()));
+
+  // Replay the log.
+  ASSERT_NO_FATAL_FAILURE(ReplayLogs());
+}
+
 TEST_F(ProfilerTest, RecordsThreadName) {
   if (::IsDebuggerPresent()) {
     LOG(WARNING) << "This test fails under debugging.";
@@ -14,15 +14,160 @@
 
 #include "syzygy/agent/profiler/symbol_map.h"
 
+#include <windows.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "base/threading/platform_thread.h"
+
 namespace agent {
 namespace profiler {
 
+namespace {
+
+// The number of entries of the leaves of the snapshots. Updating a snapshot
+// copies the leaves holding the modified entries, along with the array of
+// leaves, so this keeps the cost of the updates proportional to the square
+// root of the size of the map for the typical sizes.
+const size_t kLeafSize = 64;
+
+}  // namespace
+
+// The snapshots are made of leaves holding the symbols sorted by address,
+// which are shared between the consecutive versions of the map.
+class SymbolMap::Snapshot {
+ public:
+  typedef std::pair<Range, scoped_refptr<Symbol>> Entry;
+
+  Snapshot() {}
+
+  // Find the symbol covering @p addr, if any.
+  // @param addr an address to query.
+  // @returns the symbol covering @p addr, if any, or NULL otherwise.
+  scoped_refptr<Symbol> FindSymbol(const uint8_t* addr) const;
+
+  // Replaces the entries starting in [@p first, @p last] with the ones of
+  // @p addr_space. The leaves holding these entries are rebuilt, while the
+  // others are shared with the previous version.
+  // @param addr_space The up-to-date map.
+  // @param first The lowest address of the modified entries.
+  // @param last The highest address of the modified entries.
+  void Update(const SymbolAddressSpace& addr_space,
+              const uint8_t* first,
+              const uint8_t* last);
+
+ private:
+  // A leaf of the snapshot. It is never modified once built.
+  struct Leaf : public base::RefCountedThreadSafe<Leaf> {
+    std::vector<Entry> entries;
+
+   private:
+    friend class base::RefCountedThreadSafe<Leaf>;
+    ~Leaf() {}
+  };
+
+  // @returns the index of the leaf where the entry starting at @p addr
+  //     belongs.
+  // @pre The snapshot has at least one leaf.
+  size_t FindLeaf(const uint8_t* addr) const;
+
+  // The leaves, sorted by address, and the address of their first entry.
+  std::vector<scoped_refptr<Leaf>> leaves_;
+  std::vector<const uint8_t*> leaf_starts_;
+};
+
+scoped_refptr<SymbolMap::Symbol> SymbolMap::Snapshot::FindSymbol(
+    const uint8_t* addr) const {
+  if (leaves_.empty() || addr < leaf_starts_.front())
+    return NULL;
+
+  const Leaf* leaf = leaves_[FindLeaf(addr)].get();
+  DCHECK(!leaf->entries.empty());
+
+  // Find the last entry starting at or before |addr|.
+  size_t begin = 0;
+  size_t end = leaf->entries.size();
+  while (end - begin > 1) {
+    size_t middle = begin + (end - begin) / 2;
+    if (leaf->entries[middle].first.start() <= addr)
+      begin = middle;
+    else
+      end = middle;
+  }
+
+  const Entry& entry = leaf->entries[begin];
+  if (!entry.first.Contains(addr))
+    return NULL;
+  return entry.second;
+}
+
+void SymbolMap::Snapshot::Update(const SymbolAddressSpace& addr_space,
+                                 const uint8_t* first,
+                                 const uint8_t* last) {
+  DCHECK_LE(first, last);
+
+  // Find the leaves to rebuild, and the range of addresses they cover.
+  size_t first_leaf = 0;
+  size_t last_leaf = 0;
+  if (!leaves_.empty()) {
+    first_leaf = FindLeaf(first);
+    last_leaf = FindLeaf(last) + 1;
+  }
+  SymbolAddressSpace::RangeMapConstIter it = addr_space.begin();
+  if (first_leaf > 0) {
+    it = addr_space.ranges().lower_bound(
+        Range(leaf_starts_[first_leaf], 1));
+  }
+  SymbolAddressSpace::RangeMapConstIter it_end = addr_space.end();
+  if (last_leaf < leaves_.size()) {
+    it_end = addr_space.ranges().lower_bound(
+        Range(leaf_starts_[last_leaf], 1));
+  }
+
+  // Rebuild them from the up-to-date map.
+  std::vector<scoped_refptr<Leaf>> new_leaves;
+  while (it != it_end) {
+    scoped_refptr<Leaf> leaf = new Leaf();
+    leaf->entries.reserve(kLeafSize);
+    for (; it != it_end && leaf->entries.size() < kLeafSize; ++it)
+      leaf->entries.push_back(*it);
+    new_leaves.push_back(leaf);
+  }
+
+  leaves_.erase(leaves_.begin() + first_leaf, leaves_.begin() + last_leaf);
+  leaves_.insert(leaves_.begin() + first_leaf, new_leaves.begin(),
+                 new_leaves.end());
+
+  leaf_starts_.resize(leaves_.size());
+  for (size_t i = 0; i < leaves_.size(); ++i)
+    leaf_starts_[i] = leaves_[i]->entries.front().first.start();
+}
+
+size_t SymbolMap::Snapshot::FindLeaf(const uint8_t* addr) const {
+  DCHECK(!leaves_.empty());
+
+  // Find the last leaf starting at or before |addr|, if any.
+  std::vector<const uint8_t*>::const_iterator it =
+      std::upper_bound(leaf_starts_.begin(), leaf_starts_.end(), addr);
+  if (it == leaf_starts_.begin())
+    return 0;
+  return it - leaf_starts_.begin() - 1;
+}
+
 base::subtle::Atomic32 SymbolMap::Symbol::next_symbol_id_ = 0;
 
-SymbolMap::SymbolMap() {
+SymbolMap::SymbolMap() : snapshot_(0), epoch_(0) {
+  ::memset(reader_counts_, 0, sizeof(reader_counts_));
+  base::subtle::Release_Store(
+      &snapshot_, reinterpret_cast<base::subtle::AtomicWord>(new Snapshot()));
 }
 
 SymbolMap::~SymbolMap() {
+  delete reinterpret_cast<Snapshot*>(
+      base::subtle::NoBarrier_Load(&snapshot_));
 }
 
 void SymbolMap::AddSymbol(const void* start_addr,
@@ -36,11 +181,24 @@ void SymbolMap::AddSymbol(const void* start_addr,
     return;
 
   Range range(reinterpret_cast<const uint8_t*>(start_addr), length);
+
+  // The modified entries are the ones being retired and the new one.
+  const uint8_t* first = range.start();
+  SymbolAddressSpace::RangeMapIter found =
+      addr_space_.FindFirstIntersection(range);
+  if (found != addr_space_.end())
+    first = std::min(first, found->first.start());
+
   RetireRangeUnlocked(range);
 
   bool inserted = addr_space_.Insert(
       Range(reinterpret_cast<const uint8_t*>(start_addr), length), symbol);
   DCHECK(inserted);
+
+  std::unique_ptr<Snapshot> snapshot(new Snapshot(*reinterpret_cast<Snapshot*>(
+      base::subtle::NoBarrier_Load(&snapshot_))));
+  snapshot->Update(addr_space_, first, range.end() - 1);
+  PublishSnapshotUnlocked(snapshot.release());
 }
 
 void SymbolMap::MoveSymbol(const void* old_addr, const void* new_addr) {
@@ -63,24 +221,54 @@ void SymbolMap::MoveSymbol(const void* old_addr, const void* new_addr) {
   size_t length = found->first.size();
   addr_space_.Remove(found);
 
-  RetireRangeUnlocked(
-      Range(reinterpret_cast<const uint8_t*>(new_addr), length));
+  Range range(reinterpret_cast<const uint8_t*>(new_addr), length);
 
-  bool inserted = addr_space_.Insert(
-      Range(reinterpret_cast<const uint8_t*>(new_addr), length), symbol);
+  // The modified entries are the moved one, at its old address, and the ones
+  // being retired along with the moved one at its new address.
+  const uint8_t* first = range.start();
+  found = addr_space_.FindFirstIntersection(range);
+  if (found != addr_space_.end())
+    first = std::min(first, found->first.start());
+
+  RetireRangeUnlocked(range);
+
+  bool inserted = addr_space_.Insert(range, symbol);
   DCHECK(inserted);
+
+  const uint8_t* old_start = reinterpret_cast<const uint8_t*>(old_addr);
+  std::unique_ptr<Snapshot> snapshot(new Snapshot(*reinterpret_cast<Snapshot*>(
+      base::subtle::NoBarrier_Load(&snapshot_))));
+  snapshot->Update(addr_space_, old_start, old_start);
+  snapshot->Update(addr_space_, first, range.end() - 1);
+  PublishSnapshotUnlocked(snapshot.release());
 }
 
 scoped_refptr<SymbolMap::Symbol> SymbolMap::FindSymbol(const void* addr) {
-  base::AutoLock hold(lock_);
+  ReaderCounts* reader_counts =
+      &reader_counts_[::GetCurrentProcessorNumber() % kReaderStripeCount];
 
-  SymbolAddressSpace::RangeMapIter found = addr_space_.FindFirstIntersection(
-      Range(reinterpret_cast<const uint8_t*>(addr), 1));
+  // Register this lookup in the reader counts of the current epoch. If the
+  // epoch changes in the meantime, the writer may not have seen the
+  // registration, so try again.
+  base::subtle::Atomic32 epoch = 0;
+  while (true) {
+    epoch = base::subtle::Acquire_Load(&epoch_);
+    base::subtle::Barrier_AtomicIncrement(&reader_counts->counts[epoch & 1], 1);
+    if (base::subtle::Acquire_Load(&epoch_) == epoch)
+      break;
+    base::subtle::Barrier_AtomicIncrement(&reader_counts->counts[epoch & 1],
+                                          -1);
+  }
 
-  if (found == addr_space_.end())
-    return NULL;
+  // The snapshot can't be deleted until this lookup deregisters itself, and
+  // the symbol is kept alive by the reference returned to the caller.
+  const Snapshot* snapshot = reinterpret_cast<const Snapshot*>(
+      base::subtle::Acquire_Load(&snapshot_));
+  scoped_refptr<Symbol> symbol =
+      snapshot->FindSymbol(reinterpret_cast<const uint8_t*>(addr));
 
-  return found->second;
+  base::subtle::Barrier_AtomicIncrement(&reader_counts->counts[epoch & 1], -1);
+  return symbol;
 }
 
 void SymbolMap::RetireRangeUnlocked(const Range& range) {
@@ -90,11 +278,40 @@ void SymbolMap::RetireRangeUnlocked(const Range& range) {
       addr_space_.FindIntersecting(range);
   SymbolAddressSpace::iterator it = found.first;
   for (; it != found.second; ++it)
-    found.first->second->Invalidate();
+    it->second->Invalidate();
 
   addr_space_.Remove(found);
 }
 
+void SymbolMap::PublishSnapshotUnlocked(Snapshot* snapshot) {
+  DCHECK_NE(static_cast<Snapshot*>(nullptr), snapshot);
+  lock_.AssertAcquired();
+
+  Snapshot* previous = reinterpret_cast<Snapshot*>(
+      base::subtle::NoBarrier_Load(&snapshot_));
+  base::subtle::Release_Store(
+      &snapshot_, reinterpret_cast<base::subtle::AtomicWord>(snapshot));
+
+  // Start a new epoch. The lookups that can still be using the previous
+  // snapshot are the ones registered in the previous epoch, so wait for them
+  // to complete. The lookups of the epoch before were already waited for by
+  // the previous update.
+  base::subtle::Atomic32 epoch =
+      base::subtle::Barrier_AtomicIncrement(&epoch_, 1) - 1;
+  while (true) {
+    base::subtle::Atomic32 readers = 0;
+    for (size_t i = 0; i < kReaderStripeCount; ++i) {
+      readers +=
+          base::subtle::Acquire_Load(&reader_counts_[i].counts[epoch & 1]);
+    }
+    if (readers == 0)
+      break;
+    base::PlatformThread::YieldCurrentThread();
+  }
+
+  delete previous;
+}
+
 SymbolMap::Symbol::Symbol(const base::StringPiece& name, const void* address)
     : name_(name.begin(), name.end()),
       move_count_(0),
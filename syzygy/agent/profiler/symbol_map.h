@@ -29,6 +29,10 @@ namespace profiler {
 // resolving addresses of dynamically generated, garbage collected code, to
 // names in a profiler. This is geared to allow entry/exit processing in a
 // profiler to execute as quickly as possible.
+//
+// Lookups are lock-free: they go through an immutable snapshot of the map,
+// which the writers replace with a new version on every update. A snapshot
+// is deleted once no lookup can still be using it, RCU-style.
 class SymbolMap {
  public:
   class Symbol;
@@ -49,7 +53,8 @@ class SymbolMap {
   // @param new_addr the new address of the symbol.
   void MoveSymbol(const void* old_addr, const void* new_addr);
 
-  // Find the symbol covering @p addr, if any.
+  // Find the symbol covering @p addr, if any. This doesn't block, even while
+  // the map is being updated.
   // @param addr an address to query.
   // @returns the symbol covering @p addr, if any, or NULL otherwise.
   scoped_refptr<Symbol> FindSymbol(const void* addr);
@@ -59,12 +64,40 @@ class SymbolMap {
       SymbolAddressSpace;
   typedef SymbolAddressSpace::Range Range;
 
+  // An immutable version of the map, used by the lookups.
+  class Snapshot;
+
+  // The number of stripes of the reader counts. CPUs beyond that share
+  // stripes.
+  static const size_t kReaderStripeCount = 16;
+
+  // The number of lookups in progress, for each of the two last epochs. This
+  // is padded to the size of a cache line to avoid false sharing between the
+  // CPUs.
+  struct ReaderCounts {
+    base::subtle::Atomic32 counts[2];
+    uint8_t padding[64 - 2 * sizeof(base::subtle::Atomic32)];
+  };
+
   // Retire any symbols overlapping @p range.
   void RetireRangeUnlocked(const Range& range);
 
+  // Replaces the current snapshot with @p snapshot, and deletes the previous
+  // one once no lookup can be using it anymore.
+  // @param snapshot The new snapshot. Ownership is transferred.
+  void PublishSnapshotUnlocked(Snapshot* snapshot);
+
   base::Lock lock_;
   SymbolAddressSpace addr_space_;  // Under lock_.
 
+  // The current snapshot, which is only replaced under lock_.
+  base::subtle::AtomicWord snapshot_;
+
+  // The current epoch, which is only incremented under lock_. Each lookup
+  // registers itself in the reader counts of the epoch in which it started.
+  base::subtle::Atomic32 epoch_;
+  ReaderCounts reader_counts_[kReaderStripeCount];
+
  private:
   DISALLOW_COPY_AND_ASSIGN(SymbolMap);
 };
@@ -14,6 +14,11 @@
 
 #include "syzygy/agent/profiler/symbol_map.h"
 
+#include <memory>
+#include <vector>
+
+#include "base/synchronization/waitable_event.h"
+#include "base/threading/simple_thread.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -38,6 +43,32 @@ class SymbolMapTest : public testing::Test {
   TestingSymbolMap symbol_map_;
 };
 
+// Repeatedly looks up a symbol that's expected to stay in place.
+class LookupDelegate : public base::DelegateSimpleThread::Delegate {
+ public:
+  LookupDelegate(SymbolMap* symbol_map,
+                 const void* addr,
+                 base::WaitableEvent* stop_event)
+      : symbol_map_(symbol_map), addr_(addr), stop_event_(stop_event),
+        failures_(0) {
+  }
+
+  void Run() override {
+    while (!stop_event_->IsSignaled()) {
+      if (symbol_map_->FindSymbol(addr_) == NULL)
+        ++failures_;
+    }
+  }
+
+  size_t failures() const { return failures_; }
+
+ private:
+  SymbolMap* symbol_map_;
+  const void* addr_;
+  base::WaitableEvent* stop_event_;
+  size_t failures_;
+};
+
 }  // namespace
 
 TEST_F(SymbolMapTest, AddSymbol) {
@@ -175,5 +206,102 @@ TEST_F(SymbolMapTest, SymbolLifeCycle) {
   EXPECT_EQ(ToPtr(NULL), symbol->address());
 }
 
+TEST_F(SymbolMapTest, ManySymbols) {
+  // Enough symbols to span a number of leaves of the lookup snapshots.
+  const size_t kSymbolCount = 1000;
+  const intptr_t kBase = 0x10000;
+  const intptr_t kStride = 0x20;
+  const size_t kLength = 0x10;
+
+  // Add them in an interleaved order, to exercise the updates in the middle
+  // of the map.
+  for (size_t i = 0; i < kSymbolCount; i += 2)
+    symbol_map_.AddSymbol(ToPtr(kBase + i * kStride), kLength, "even");
+  for (size_t i = 1; i < kSymbolCount; i += 2)
+    symbol_map_.AddSymbol(ToPtr(kBase + i * kStride), kLength, "odd");
+  ASSERT_EQ(kSymbolCount, symbol_map_.addr_space_.size());
+
+  for (size_t i = 0; i < kSymbolCount; ++i) {
+    const uint8_t* start = ToPtr(kBase + i * kStride);
+    scoped_refptr<SymbolMap::Symbol> symbol = symbol_map_.FindSymbol(start);
+    ASSERT_TRUE(symbol != NULL);
+    EXPECT_EQ(start, symbol->address());
+    EXPECT_EQ(i % 2 ? "odd" : "even", symbol->name());
+    EXPECT_EQ(symbol, symbol_map_.FindSymbol(start + kLength - 1));
+    EXPECT_TRUE(symbol_map_.FindSymbol(start + kLength) == NULL);
+  }
+  EXPECT_TRUE(symbol_map_.FindSymbol(ToPtr(kBase - 1)) == NULL);
+
+  // Move the first half of the symbols past the end of the others.
+  const intptr_t kMovedBase = kBase + kSymbolCount * kStride;
+  for (size_t i = 0; i < kSymbolCount / 2; ++i) {
+    symbol_map_.MoveSymbol(ToPtr(kBase + i * kStride),
+                           ToPtr(kMovedBase + i * kStride));
+  }
+  for (size_t i = 0; i < kSymbolCount / 2; ++i) {
+    EXPECT_TRUE(symbol_map_.FindSymbol(ToPtr(kBase + i * kStride)) == NULL);
+    scoped_refptr<SymbolMap::Symbol> symbol =
+        symbol_map_.FindSymbol(ToPtr(kMovedBase + i * kStride));
+    ASSERT_TRUE(symbol != NULL);
+    EXPECT_EQ(1, symbol->move_count());
+  }
+
+  // A symbol covering the second half of the original symbols retires them.
+  scoped_refptr<SymbolMap::Symbol> retired =
+      symbol_map_.FindSymbol(ToPtr(kBase + (kSymbolCount - 1) * kStride));
+  ASSERT_TRUE(retired != NULL);
+  const intptr_t kCoverStart = kBase + kSymbolCount / 2 * kStride;
+  symbol_map_.AddSymbol(ToPtr(kCoverStart), kSymbolCount / 2 * kStride,
+                        "cover");
+  EXPECT_TRUE(retired->invalid());
+  EXPECT_EQ(kSymbolCount / 2 + 1, symbol_map_.addr_space_.size());
+  for (size_t i = kSymbolCount / 2; i < kSymbolCount; ++i) {
+    scoped_refptr<SymbolMap::Symbol> symbol =
+        symbol_map_.FindSymbol(ToPtr(kBase + i * kStride));
+    ASSERT_TRUE(symbol != NULL);
+    EXPECT_EQ("cover", symbol->name());
+  }
+}
+
+TEST_F(SymbolMapTest, ConcurrentLookups) {
+  const size_t kThreadCount = 4;
+  const size_t kUpdateCount = 1000;
+
+  // A symbol that stays in place while the map is being updated around it.
+  const uint8_t* const kStable = ToPtr(0x1000);
+  symbol_map_.AddSymbol(kStable, 0x10, "stable");
+
+  base::WaitableEvent stop_event(true, false);
+  std::vector<std::unique_ptr<LookupDelegate>> delegates;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    delegates.push_back(std::unique_ptr<LookupDelegate>(
+        new LookupDelegate(&symbol_map_, kStable + i, &stop_event)));
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(delegates.back().get(), "lookup")));
+    threads.back()->Start();
+  }
+
+  // Add, move and retire symbols on both sides of the stable one.
+  for (size_t i = 0; i < kUpdateCount; ++i) {
+    const uint8_t* below = ToPtr(0x100 + (i % 0x40) * 0x20);
+    const uint8_t* above = ToPtr(0x2000 + (i % 0x40) * 0x20);
+    symbol_map_.AddSymbol(below, 0x20, "below");
+    symbol_map_.AddSymbol(above, 0x20, "above");
+    symbol_map_.MoveSymbol(above, ToPtr(0x4000 + (i % 0x40) * 0x20));
+  }
+
+  stop_event.Signal();
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    threads[i]->Join();
+    EXPECT_EQ(0u, delegates[i]->failures());
+  }
+
+  scoped_refptr<SymbolMap::Symbol> symbol = symbol_map_.FindSymbol(kStable);
+  ASSERT_TRUE(symbol != NULL);
+  EXPECT_EQ("stable", symbol->name());
+  EXPECT_FALSE(symbol->invalid());
+}
+
 }  // namespace profiler
 }  // namespace agent
@@ -23,6 +23,8 @@
       'sources': [
         'control_flow_analysis.cc',
         'control_flow_analysis.h',
+        'dominator_analysis.cc',
+        'dominator_analysis.h',
         'liveness_analysis.cc',
         'liveness_analysis.h',
         'liveness_analysis_internal.h',
@@ -41,6 +43,7 @@
       'type': 'executable',
       'sources': [
         'control_flow_analysis_unittest.cc',
+        'dominator_analysis_unittest.cc',
         'liveness_analysis_unittest.cc',
         'memory_access_analysis_unittest.cc',
         '<(src)/syzygy/testing/run_all_unittests.cc',
@@ -52,6 +55,12 @@
         '<(src)/syzygy/block_graph/block_graph.gyp:block_graph_lib',
         '<(src)/syzygy/block_graph/block_graph.gyp:block_graph_unittest_lib',
         '<(src)/syzygy/core/core.gyp:core_unittest_utils',
+        '<(src)/syzygy/integration_tests/integration_tests.gyp:'
+            'integration_tests_dll',
+        '<(src)/syzygy/pe/pe.gyp:pe_lib',
+        '<(src)/syzygy/pe/pe.gyp:pe_unittest_utils',
+        '<(src)/syzygy/pe/pe.gyp:test_dll',
+        '<(src)/syzygy/testing/testing.gyp:testing_lib',
         '<(src)/testing/gmock.gyp:gmock',
         '<(src)/testing/gtest.gyp:gtest',
       ],
@@ -0,0 +1,509 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// The dominator trees are computed over a compact, integer indexed copy of the
+// control flow graph. A virtual root is added as the predecessor of every entry
+// point (resp. as the successor of every exit for the post-dominator tree) so
+// that multiple-entry subgraphs produce a single tree.
+
+#include "syzygy/block_graph/analysis/dominator_analysis.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace block_graph {
+namespace analysis {
+namespace {
+
+typedef block_graph::BasicBlockSubGraph::BasicBlock BasicBlock;
+typedef block_graph::BasicBlockSubGraph::BasicCodeBlock BasicCodeBlock;
+typedef block_graph::BasicBlockSubGraph::BasicDataBlock BasicDataBlock;
+typedef block_graph::BasicBlockSubGraph::BBCollection BBCollection;
+typedef block_graph::BasicBlockSubGraph::BlockDescriptionList
+    BlockDescriptionList;
+typedef std::vector<std::vector<size_t>> AdjacencyLists;
+
+const size_t kInvalid = std::numeric_limits<size_t>::max();
+
+// Flattens the nodes reachable from @p roots in reverse post-order, following
+// the edges in @p successors.
+// @param successors The successors of each node.
+// @param roots The nodes from which the traversal starts.
+// @param order Receives the reached nodes in reverse post-order.
+void FlattenInReversePostOrder(const AdjacencyLists& successors,
+                               const std::vector<size_t>& roots,
+                               std::vector<size_t>* order) {
+  DCHECK_NE(reinterpret_cast<std::vector<size_t>*>(NULL), order);
+
+  std::vector<bool> marked(successors.size(), false);
+  // Each entry holds a node and the index of the next successor to visit.
+  std::vector<std::pair<size_t, size_t>> working;
+  for (size_t i = 0; i < roots.size(); ++i) {
+    if (marked[roots[i]])
+      continue;
+    marked[roots[i]] = true;
+    working.push_back(std::make_pair(roots[i], 0U));
+
+    while (!working.empty()) {
+      std::pair<size_t, size_t>& top = working.back();
+      const std::vector<size_t>& succs = successors[top.first];
+      if (top.second < succs.size()) {
+        size_t next = succs[top.second++];
+        if (!marked[next]) {
+          marked[next] = true;
+          working.push_back(std::make_pair(next, 0U));
+        }
+        continue;
+      }
+      order->push_back(top.first);
+      working.pop_back();
+    }
+  }
+
+  std::reverse(order->begin(), order->end());
+}
+
+// Walks up the partially built dominator tree from @p node1 and @p node2 until
+// a common ancestor is found.
+size_t Intersect(const std::vector<size_t>& idom,
+                 const std::vector<size_t>& order_number,
+                 size_t node1,
+                 size_t node2) {
+  while (node1 != node2) {
+    while (order_number[node1] > order_number[node2])
+      node1 = idom[node1];
+    while (order_number[node2] > order_number[node1])
+      node2 = idom[node2];
+  }
+  return node1;
+}
+
+// Computes the dominator tree of a graph rooted at a virtual node whose
+// successors are @p roots.
+// @param successors The successors of each node.
+// @param predecessors The predecessors of each node.
+// @param roots The successors of the virtual root.
+// @param idom Receives the immediate dominator of each node.
+// @param pre Receives the pre-order number of each node in the tree.
+// @param post Receives the post-order number of each node in the tree.
+void ComputeDominatorTree(const AdjacencyLists& successors,
+                          const AdjacencyLists& predecessors,
+                          const std::vector<size_t>& roots,
+                          std::vector<size_t>* idom,
+                          std::vector<size_t>* pre,
+                          std::vector<size_t>* post) {
+  DCHECK_EQ(successors.size(), predecessors.size());
+  DCHECK_NE(reinterpret_cast<std::vector<size_t>*>(NULL), idom);
+  DCHECK_NE(reinterpret_cast<std::vector<size_t>*>(NULL), pre);
+  DCHECK_NE(reinterpret_cast<std::vector<size_t>*>(NULL), post);
+
+  const size_t count = successors.size();
+  const size_t virtual_root = count;
+
+  std::vector<size_t> order;
+  FlattenInReversePostOrder(successors, roots, &order);
+
+  // The virtual root comes first in reverse post-order.
+  std::vector<size_t> order_number(count + 1, kInvalid);
+  order_number[virtual_root] = 0;
+  for (size_t i = 0; i < order.size(); ++i)
+    order_number[order[i]] = i + 1;
+
+  std::vector<bool> is_root(count, false);
+  for (size_t i = 0; i < roots.size(); ++i)
+    is_root[roots[i]] = true;
+
+  // Iterate to a fixed point. For reducible graphs, this converges in two
+  // passes.
+  std::vector<size_t> doms(count + 1, kInvalid);
+  doms[virtual_root] = virtual_root;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < order.size(); ++i) {
+      size_t node = order[i];
+      size_t new_idom = is_root[node] ? virtual_root : kInvalid;
+      const std::vector<size_t>& preds = predecessors[node];
+      for (size_t j = 0; j < preds.size(); ++j) {
+        size_t pred = preds[j];
+        if (doms[pred] == kInvalid)
+          continue;
+        if (new_idom == kInvalid) {
+          new_idom = pred;
+        } else {
+          new_idom = Intersect(doms, order_number, pred, new_idom);
+        }
+      }
+      DCHECK_NE(kInvalid, new_idom);
+      if (doms[node] != new_idom) {
+        doms[node] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  // Build the children lists of the tree and number its nodes. The virtual
+  // root is not part of the exposed tree.
+  AdjacencyLists children(count + 1);
+  for (size_t i = 0; i < order.size(); ++i)
+    children[doms[order[i]]].push_back(order[i]);
+
+  idom->assign(count, kInvalid);
+  pre->assign(count, kInvalid);
+  post->assign(count, kInvalid);
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (doms[order[i]] != virtual_root)
+      (*idom)[order[i]] = doms[order[i]];
+  }
+
+  size_t pre_number = 0;
+  size_t post_number = 0;
+  std::vector<std::pair<size_t, size_t>> working;
+  working.push_back(std::make_pair(virtual_root, 0U));
+  while (!working.empty()) {
+    std::pair<size_t, size_t>& top = working.back();
+    if (top.second < children[top.first].size()) {
+      size_t child = children[top.first][top.second++];
+      (*pre)[child] = pre_number++;
+      working.push_back(std::make_pair(child, 0U));
+      continue;
+    }
+    if (top.first != virtual_root)
+      (*post)[top.first] = post_number++;
+    working.pop_back();
+  }
+}
+
+bool IsAncestor(const std::vector<size_t>& pre,
+                const std::vector<size_t>& post,
+                size_t ancestor,
+                size_t node) {
+  if (ancestor == kInvalid || node == kInvalid)
+    return false;
+  if (pre[ancestor] == kInvalid || pre[node] == kInvalid)
+    return false;
+  return pre[ancestor] <= pre[node] && post[node] <= post[ancestor];
+}
+
+bool LoopIsLarger(const DominatorAnalysis::Loop* loop1,
+                  const DominatorAnalysis::Loop* loop2) {
+  return loop1->basic_blocks().size() > loop2->basic_blocks().size();
+}
+
+}  // namespace
+
+const size_t DominatorAnalysis::kInvalidNode = kInvalid;
+
+DominatorAnalysis::DominatorAnalysis() : reachable_count_(0) {
+}
+
+DominatorAnalysis::~DominatorAnalysis() {
+}
+
+void DominatorAnalysis::Analyze(const BasicBlockSubGraph* subgraph) {
+  DCHECK_NE(reinterpret_cast<BasicBlockSubGraph*>(NULL), subgraph);
+  Clear();
+
+  // Collect the code basic blocks in a deterministic order.
+  std::vector<const BasicCodeBlock*> blocks;
+  std::unordered_map<const BasicCodeBlock*, size_t> index_of;
+  const BBCollection& basic_blocks = subgraph->basic_blocks();
+  BBCollection::const_iterator it = basic_blocks.begin();
+  for (; it != basic_blocks.end(); ++it) {
+    const BasicCodeBlock* bb = BasicCodeBlock::Cast(*it);
+    if (bb == NULL)
+      continue;
+    index_of[bb] = blocks.size();
+    blocks.push_back(bb);
+  }
+
+  // Find the entry points.
+  std::vector<size_t> roots;
+  const BlockDescriptionList& descriptions = subgraph->block_descriptions();
+  BlockDescriptionList::const_iterator description = descriptions.begin();
+  for (; description != descriptions.end(); ++description) {
+    if (description->basic_block_order.empty())
+      continue;
+    const BasicCodeBlock* bb =
+        BasicCodeBlock::Cast(description->basic_block_order.front());
+    if (bb != NULL)
+      roots.push_back(index_of[bb]);
+  }
+  for (it = basic_blocks.begin(); it != basic_blocks.end(); ++it) {
+    const BasicCodeBlock* bb = BasicCodeBlock::Cast(*it);
+    if (bb != NULL) {
+      if (!bb->referrers().empty())
+        roots.push_back(index_of[bb]);
+      continue;
+    }
+
+    // Jump tables and other data basic blocks may refer to code.
+    const BasicDataBlock* data = BasicDataBlock::Cast(*it);
+    if (data == NULL)
+      continue;
+    BasicBlock::BasicBlockReferenceMap::const_iterator ref =
+        data->references().begin();
+    for (; ref != data->references().end(); ++ref) {
+      const BasicCodeBlock* target =
+          BasicCodeBlock::Cast(ref->second.basic_block());
+      if (target != NULL && index_of.find(target) != index_of.end())
+        roots.push_back(index_of[target]);
+    }
+  }
+
+  // Build the successor lists. Successors leaving the subgraph are exits.
+  AdjacencyLists successors(blocks.size());
+  std::vector<bool> leaves_subgraph(blocks.size(), false);
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const BasicBlock::Successors& succs = blocks[i]->successors();
+    BasicBlock::Successors::const_iterator succ = succs.begin();
+    for (; succ != succs.end(); ++succ) {
+      const BasicCodeBlock* target =
+          BasicCodeBlock::Cast(succ->reference().basic_block());
+      std::unordered_map<const BasicCodeBlock*, size_t>::const_iterator
+          target_it = index_of.find(target);
+      if (target_it == index_of.end()) {
+        leaves_subgraph[i] = true;
+        continue;
+      }
+      successors[i].push_back(target_it->second);
+    }
+  }
+
+  // Renumber the nodes in reverse post-order. Unreachable nodes come last and
+  // keep no edges.
+  std::vector<size_t> order;
+  FlattenInReversePostOrder(successors, roots, &order);
+  reachable_count_ = order.size();
+
+  std::vector<size_t> renumber(blocks.size(), kInvalid);
+  for (size_t i = 0; i < order.size(); ++i)
+    renumber[order[i]] = i;
+  size_t next = order.size();
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    if (renumber[i] == kInvalid)
+      renumber[i] = next++;
+  }
+
+  nodes_.resize(blocks.size());
+  successors_.resize(blocks.size());
+  predecessors_.resize(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    size_t node = renumber[i];
+    nodes_[node] = blocks[i];
+    node_of_[blocks[i]] = node;
+    if (node >= reachable_count_)
+      continue;
+    for (size_t j = 0; j < successors[i].size(); ++j) {
+      size_t succ = renumber[successors[i][j]];
+      successors_[node].push_back(succ);
+      predecessors_[succ].push_back(node);
+    }
+  }
+
+  reverse_post_order_.assign(nodes_.begin(),
+                             nodes_.begin() + reachable_count_);
+
+  is_entry_point_.assign(blocks.size(), false);
+  for (size_t i = 0; i < roots.size(); ++i) {
+    size_t node = renumber[roots[i]];
+    if (is_entry_point_[node])
+      continue;
+    is_entry_point_[node] = true;
+    entry_points_.push_back(blocks[roots[i]]);
+  }
+
+  // Compute the dominator tree.
+  std::vector<size_t> node_roots;
+  for (size_t i = 0; i < roots.size(); ++i)
+    node_roots.push_back(renumber[roots[i]]);
+  ComputeDominatorTree(successors_, predecessors_, node_roots,
+                       &dominators_.idom, &dominators_.pre,
+                       &dominators_.post);
+
+  // Compute the post-dominator tree on the reversed graph, rooted at the exits.
+  std::vector<size_t> exits;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    size_t node = renumber[i];
+    if (node >= reachable_count_)
+      continue;
+    if (successors_[node].empty() || leaves_subgraph[i])
+      exits.push_back(node);
+  }
+  std::sort(exits.begin(), exits.end());
+  ComputeDominatorTree(predecessors_, successors_, exits,
+                       &post_dominators_.idom, &post_dominators_.pre,
+                       &post_dominators_.post);
+
+  FindLoops();
+}
+
+bool DominatorAnalysis::IsReachable(const BasicCodeBlock* bb) const {
+  size_t node = NodeOf(bb);
+  return node != kInvalidNode && node < reachable_count_;
+}
+
+const BasicCodeBlock* DominatorAnalysis::GetImmediateDominator(
+    const BasicCodeBlock* bb) const {
+  size_t node = NodeOf(bb);
+  if (node == kInvalidNode || dominators_.idom[node] == kInvalidNode)
+    return NULL;
+  return nodes_[dominators_.idom[node]];
+}
+
+const BasicCodeBlock* DominatorAnalysis::GetImmediatePostDominator(
+    const BasicCodeBlock* bb) const {
+  size_t node = NodeOf(bb);
+  if (node == kInvalidNode || post_dominators_.idom[node] == kInvalidNode)
+    return NULL;
+  return nodes_[post_dominators_.idom[node]];
+}
+
+bool DominatorAnalysis::Dominates(const BasicCodeBlock* dominator,
+                                  const BasicCodeBlock* bb) const {
+  return IsAncestor(dominators_.pre, dominators_.post,
+                    NodeOf(dominator), NodeOf(bb));
+}
+
+bool DominatorAnalysis::PostDominates(const BasicCodeBlock* post_dominator,
+                                      const BasicCodeBlock* bb) const {
+  return IsAncestor(post_dominators_.pre, post_dominators_.post,
+                    NodeOf(post_dominator), NodeOf(bb));
+}
+
+const DominatorAnalysis::Loop* DominatorAnalysis::GetInnermostLoop(
+    const BasicCodeBlock* bb) const {
+  size_t node = NodeOf(bb);
+  if (node == kInvalidNode)
+    return NULL;
+  return innermost_loop_[node];
+}
+
+size_t DominatorAnalysis::GetLoopDepth(const BasicCodeBlock* bb) const {
+  const Loop* loop = GetInnermostLoop(bb);
+  if (loop == NULL)
+    return 0;
+  return loop->depth();
+}
+
+size_t DominatorAnalysis::NodeOf(const BasicCodeBlock* bb) const {
+  std::unordered_map<const BasicCodeBlock*, size_t>::const_iterator it =
+      node_of_.find(bb);
+  if (it == node_of_.end())
+    return kInvalidNode;
+  return it->second;
+}
+
+void DominatorAnalysis::FindLoops() {
+  // Collect the natural loop of each back edge. Back edges sharing a header
+  // are merged into a single loop.
+  std::vector<Loop*> loop_of_header(nodes_.size(), NULL);
+  std::vector<Loop*> loops;
+  for (size_t node = 0; node < reachable_count_; ++node) {
+    const std::vector<size_t>& succs = successors_[node];
+    for (size_t i = 0; i < succs.size(); ++i) {
+      size_t header = succs[i];
+      if (!IsAncestor(dominators_.pre, dominators_.post, header, node))
+        continue;
+
+      Loop*& loop = loop_of_header[header];
+      if (loop == NULL) {
+        loop = new Loop(nodes_[header]);
+        owned_loops_.push_back(std::unique_ptr<Loop>(loop));
+        loop->basic_blocks_.insert(nodes_[header]);
+        loops.push_back(loop);
+      }
+      loop->latches_.insert(nodes_[node]);
+
+      // Walk backward from the latch until the header is reached.
+      std::vector<size_t> working;
+      if (loop->basic_blocks_.insert(nodes_[node]).second)
+        working.push_back(node);
+      while (!working.empty()) {
+        size_t current = working.back();
+        working.pop_back();
+        const std::vector<size_t>& preds = predecessors_[current];
+        for (size_t j = 0; j < preds.size(); ++j) {
+          if (loop->basic_blocks_.insert(nodes_[preds[j]]).second)
+            working.push_back(preds[j]);
+        }
+      }
+    }
+  }
+
+  // Natural loops with distinct headers are either disjoint or nested. Visiting
+  // them from the largest to the smallest guarantees that the enclosing loops
+  // of a loop are visited before it.
+  std::stable_sort(loops.begin(), loops.end(), LoopIsLarger);
+  std::vector<Loop*> innermost(nodes_.size(), NULL);
+  for (size_t i = 0; i < loops.size(); ++i) {
+    Loop* loop = loops[i];
+    size_t header = node_of_[loop->header_];
+
+    Loop* parent = innermost[header];
+    if (parent != NULL) {
+      loop->parent_ = parent;
+      loop->depth_ = parent->depth_ + 1;
+      parent->children_.push_back(loop);
+    } else {
+      root_loops_.push_back(loop);
+    }
+    loops_.push_back(loop);
+
+    Loop::BasicBlockSet::const_iterator bb = loop->basic_blocks_.begin();
+    for (; bb != loop->basic_blocks_.end(); ++bb)
+      innermost[node_of_[*bb]] = loop;
+
+    // Find the preheader. A header that is an entry point can be reached
+    // without going through it, and has none.
+    if (is_entry_point_[header])
+      continue;
+    size_t outside = kInvalid;
+    size_t outside_count = 0;
+    const std::vector<size_t>& preds = predecessors_[header];
+    for (size_t j = 0; j < preds.size(); ++j) {
+      if (loop->Contains(nodes_[preds[j]]))
+        continue;
+      outside = preds[j];
+      ++outside_count;
+    }
+    if (outside_count == 1 && successors_[outside].size() == 1 &&
+        nodes_[outside]->successors().size() == 1) {
+      loop->preheader_ = nodes_[outside];
+    }
+  }
+
+  innermost_loop_.assign(innermost.begin(), innermost.end());
+}
+
+void DominatorAnalysis::Clear() {
+  nodes_.clear();
+  node_of_.clear();
+  reachable_count_ = 0;
+  successors_.clear();
+  predecessors_.clear();
+  dominators_ = DominatorTree();
+  post_dominators_ = DominatorTree();
+  innermost_loop_.clear();
+  reverse_post_order_.clear();
+  entry_points_.clear();
+  is_entry_point_.clear();
+  loops_.clear();
+  root_loops_.clear();
+  owned_loops_.clear();
+}
+
+}  // namespace analysis
+}  // namespace block_graph
@@ -0,0 +1,243 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A class that computes the dominator tree, the post-dominator tree and the
+// natural loop nesting forest of a subgraph.
+//
+// A basic block A dominates a basic block B if every path from an entry point
+// to B goes through A. A post-dominates B if every path from B to an exit of
+// the subgraph goes through A. A natural loop is defined by a back edge N -> H
+// where H dominates N; its body is H plus every basic block that can reach N
+// without going through H.
+//
+// The immediate dominators are computed with the iterative algorithm described
+// in "A Simple, Fast Dominance Algorithm" by Keith D. Cooper, Timothy J.
+// Harvey and Ken Kennedy, which in practice outperforms Lengauer-Tarjan on
+// the graph sizes found in real functions.
+//
+// See: http://en.wikipedia.org/wiki/Dominator_(graph_theory)
+//      http://www.cs.rice.edu/~keith/EMBED/dom.pdf
+
+#ifndef SYZYGY_BLOCK_GRAPH_ANALYSIS_DOMINATOR_ANALYSIS_H_
+#define SYZYGY_BLOCK_GRAPH_ANALYSIS_DOMINATOR_ANALYSIS_H_
+
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "syzygy/block_graph/basic_block.h"
+#include "syzygy/block_graph/basic_block_subgraph.h"
+
+namespace block_graph {
+namespace analysis {
+
+// This class implements a dominator, post-dominator and loop nesting analysis
+// on a subgraph.
+//
+// The entry points of the subgraph are the first basic block of each block
+// description, every code basic block referenced from outside the subgraph,
+// and every code basic block referenced by a data basic block (i.e., a jump
+// table). The exits are the code basic blocks without a code basic block
+// successor in the subgraph (returns, tail calls, calls to non-returning
+// functions). Only code basic blocks participate in the analysis; basic blocks
+// that are not reachable from an entry point are neither dominated nor
+// dominating.
+//
+// Once computed, dominance queries are answered in constant time.
+//
+// Example:
+//
+//  DominatorAnalysis dominators;
+//  dominators.Analyze(subgraph);
+//
+//  if (dominators.Dominates(bb1, bb2)) {
+//    // Every path reaching bb2 goes through bb1.
+//  }
+//
+//  const DominatorAnalysis::Loop* loop = dominators.GetInnermostLoop(bb);
+//  if (loop != NULL && loop->preheader() != NULL) {
+//    // Loop invariant work can be hoisted into the preheader.
+//  }
+//
+// Only reducible loops are reported. Cycles entered through more than one basic
+// block have no dominating header, and are not part of the loop forest.
+class DominatorAnalysis {
+ public:
+  typedef block_graph::BasicBlockSubGraph BasicBlockSubGraph;
+  typedef std::vector<const BasicCodeBlock*> BasicBlockOrdering;
+
+  // Forward declaration.
+  class Loop;
+  typedef std::vector<const Loop*> LoopList;
+
+  DominatorAnalysis();
+  ~DominatorAnalysis();
+
+  // Computes the dominator trees and the loop nesting forest of @p subgraph.
+  // Any previous analysis results are discarded.
+  // @param subgraph Subgraph to apply the analysis.
+  void Analyze(const BasicBlockSubGraph* subgraph);
+
+  // @returns true if @p bb is reachable from an entry point of the analyzed
+  //     subgraph.
+  bool IsReachable(const BasicCodeBlock* bb) const;
+
+  // @returns the immediate dominator of @p bb, or NULL if @p bb is an entry
+  //     point or is unreachable.
+  const BasicCodeBlock* GetImmediateDominator(const BasicCodeBlock* bb) const;
+
+  // @returns the immediate post-dominator of @p bb, or NULL if @p bb is an
+  //     exit, can't reach an exit or is unreachable.
+  const BasicCodeBlock* GetImmediatePostDominator(
+      const BasicCodeBlock* bb) const;
+
+  // @returns true if @p dominator dominates @p bb. A basic block dominates
+  //     itself.
+  bool Dominates(const BasicCodeBlock* dominator,
+                 const BasicCodeBlock* bb) const;
+
+  // @returns true if @p post_dominator post-dominates @p bb. A basic block
+  //     post-dominates itself.
+  bool PostDominates(const BasicCodeBlock* post_dominator,
+                     const BasicCodeBlock* bb) const;
+
+  // @returns the innermost loop containing @p bb, or NULL if @p bb is not
+  //     part of a loop.
+  const Loop* GetInnermostLoop(const BasicCodeBlock* bb) const;
+
+  // @returns the number of loops containing @p bb.
+  size_t GetLoopDepth(const BasicCodeBlock* bb) const;
+
+  // @name Accessors.
+  // @{
+  // The reachable code basic blocks in reverse post-order. Every basic block
+  // appears after its immediate dominator.
+  const BasicBlockOrdering& reverse_post_order() const {
+    return reverse_post_order_;
+  }
+  // The entry points of the subgraph, without duplicates.
+  const BasicBlockOrdering& entry_points() const { return entry_points_; }
+  // Every loop of the forest, outermost loops first.
+  const LoopList& loops() const { return loops_; }
+  // The loops that are not nested in another loop.
+  const LoopList& root_loops() const { return root_loops_; }
+  // @}
+
+ protected:
+  // Sentinel value for an unknown node.
+  static const size_t kInvalidNode;
+
+  // The information kept about a dominator tree, indexed by node.
+  struct DominatorTree {
+    // The immediate dominator of each node. Roots and unreachable nodes have
+    // kInvalidNode.
+    std::vector<size_t> idom;
+    // The pre-order and post-order numbers of each node in the tree. They are
+    // used to answer ancestor queries in constant time.
+    std::vector<size_t> pre;
+    std::vector<size_t> post;
+  };
+
+  // @returns the node of @p bb, or kInvalidNode if it is not analyzed.
+  size_t NodeOf(const BasicCodeBlock* bb) const;
+
+  // Finds the natural loops and builds the loop nesting forest.
+  void FindLoops();
+
+  // Resets the analysis to an empty state.
+  void Clear();
+
+  // The code basic blocks of the analyzed subgraph, indexed by node. Nodes are
+  // numbered in reverse post-order, unreachable blocks last.
+  std::vector<const BasicCodeBlock*> nodes_;
+  std::unordered_map<const BasicCodeBlock*, size_t> node_of_;
+  size_t reachable_count_;
+
+  // The successors and the predecessors of each node.
+  std::vector<std::vector<size_t>> successors_;
+  std::vector<std::vector<size_t>> predecessors_;
+
+  // The dominator and post-dominator trees.
+  DominatorTree dominators_;
+  DominatorTree post_dominators_;
+
+  // The innermost loop of each node, or NULL.
+  std::vector<const Loop*> innermost_loop_;
+
+  BasicBlockOrdering reverse_post_order_;
+  BasicBlockOrdering entry_points_;
+
+  // Whether each node is an entry point.
+  std::vector<bool> is_entry_point_;
+
+  std::vector<std::unique_ptr<Loop>> owned_loops_;
+  LoopList loops_;
+  LoopList root_loops_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(DominatorAnalysis);
+};
+
+// A natural loop of the loop nesting forest.
+class DominatorAnalysis::Loop {
+ public:
+  typedef std::set<const BasicCodeBlock*> BasicBlockSet;
+
+  // @name Accessors.
+  // @{
+  // The single entry of the loop. It dominates every basic block of the loop.
+  const BasicCodeBlock* header() const { return header_; }
+  // The only predecessor of the header outside the loop, when it has the header
+  // as its only successor and the header isn't an entry point. NULL otherwise.
+  const BasicCodeBlock* preheader() const { return preheader_; }
+  // The innermost loop enclosing this one, or NULL.
+  const Loop* parent() const { return parent_; }
+  // The loops directly nested in this one.
+  const LoopList& children() const { return children_; }
+  // The basic blocks of the loop, including the ones of nested loops.
+  const BasicBlockSet& basic_blocks() const { return basic_blocks_; }
+  // The basic blocks of the loop having an edge back to the header.
+  const BasicBlockSet& latches() const { return latches_; }
+  // The number of loops enclosing this one, plus one.
+  size_t depth() const { return depth_; }
+  // @}
+
+  // @returns true if @p bb is part of this loop or of a nested loop.
+  bool Contains(const BasicCodeBlock* bb) const {
+    return basic_blocks_.find(bb) != basic_blocks_.end();
+  }
+
+ private:
+  friend class DominatorAnalysis;
+
+  explicit Loop(const BasicCodeBlock* header)
+      : header_(header), preheader_(NULL), parent_(NULL), depth_(1) {
+  }
+
+  const BasicCodeBlock* header_;
+  const BasicCodeBlock* preheader_;
+  const Loop* parent_;
+  LoopList children_;
+  BasicBlockSet basic_blocks_;
+  BasicBlockSet latches_;
+  size_t depth_;
+
+  DISALLOW_COPY_AND_ASSIGN(Loop);
+};
+
+}  // namespace analysis
+}  // namespace block_graph
+
+#endif  // SYZYGY_BLOCK_GRAPH_ANALYSIS_DOMINATOR_ANALYSIS_H_
@@ -0,0 +1,405 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Unittests for the dominator analysis.
+
+#include "syzygy/block_graph/analysis/dominator_analysis.h"
+
+#include "base/strings/stringprintf.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "syzygy/block_graph/basic_block_decomposer.h"
+#include "syzygy/core/unittest_util.h"
+#include "syzygy/pe/decomposer.h"
+#include "syzygy/pe/pe_file.h"
+#include "syzygy/pe/pe_transform_policy.h"
+#include "syzygy/pe/unittest_util.h"
+#include "syzygy/testing/metrics.h"
+
+namespace block_graph {
+namespace analysis {
+
+namespace {
+
+using testing::ElementsAre;
+using testing::UnorderedElementsAre;
+typedef block_graph::BasicBlockSubGraph::BasicCodeBlock BasicCodeBlock;
+typedef DominatorAnalysis::Loop Loop;
+
+class DominatorAnalysisTest : public testing::Test {
+ public:
+  DominatorAnalysisTest() {}
+
+ protected:
+  void Analyze(BasicCodeBlock* entry);
+
+  void AddSuccessorBetween(Successor::Condition condition,
+                           BasicCodeBlock* from,
+                           BasicCodeBlock* to);
+
+  void Connect(BasicCodeBlock* from, BasicCodeBlock* to);
+
+  void MakeIf(BasicCodeBlock* root,
+              BasicCodeBlock* true_stm,
+              BasicCodeBlock* false_stm);
+
+  BasicBlockSubGraph subgraph_;
+  DominatorAnalysis dominators_;
+};
+
+void DominatorAnalysisTest::Analyze(BasicCodeBlock* entry) {
+  BasicBlockSubGraph::BlockDescription* description =
+      subgraph_.AddBlockDescription("bb1", "test.obj", BlockGraph::CODE_BLOCK,
+                                    7, 2, 42);
+  description->basic_block_order.push_back(entry);
+  dominators_.Analyze(&subgraph_);
+}
+
+void DominatorAnalysisTest::AddSuccessorBetween(
+    Successor::Condition condition,
+    BasicCodeBlock* from,
+    BasicCodeBlock* to) {
+  DCHECK_NE(reinterpret_cast<BasicCodeBlock*>(NULL), from);
+  DCHECK_NE(reinterpret_cast<BasicCodeBlock*>(NULL), to);
+  DCHECK_LT(from->successors().size(), 2U);
+
+  from->successors().push_back(
+      Successor(condition,
+                BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                    BlockGraph::Reference::kMaximumSize,
+                                    to),
+                0));
+}
+
+void DominatorAnalysisTest::Connect(BasicCodeBlock* from,
+                                    BasicCodeBlock* to) {
+  DCHECK_LT(from->successors().size(), 1U);
+  AddSuccessorBetween(Successor::kConditionTrue, from, to);
+}
+
+void DominatorAnalysisTest::MakeIf(BasicCodeBlock* root,
+                                   BasicCodeBlock* true_stm,
+                                   BasicCodeBlock* false_stm) {
+  Successor::Condition condition = Successor::kConditionAbove;
+  AddSuccessorBetween(condition, root, true_stm);
+  AddSuccessorBetween(Successor::InvertCondition(condition), root, false_stm);
+}
+
+// Decomposes every basic-block decomposable function of the image at @p path,
+// and accumulates the time spent analyzing them.
+void BenchmarkImage(const base::FilePath& path, const char* metric) {
+  pe::PEFile pe_file;
+  ASSERT_TRUE(pe_file.Init(path));
+
+  BlockGraph block_graph;
+  pe::ImageLayout layout(&block_graph);
+  pe::Decomposer decomposer(pe_file);
+  ASSERT_TRUE(decomposer.Decompose(&layout));
+
+  pe::PETransformPolicy policy;
+  uint64_t tnet = 0;
+  size_t functions = 0;
+  BlockGraph::BlockMap::const_iterator it = block_graph.blocks().begin();
+  for (; it != block_graph.blocks().end(); ++it) {
+    const BlockGraph::Block* block = &it->second;
+    if (!policy.BlockIsSafeToBasicBlockDecompose(block))
+      continue;
+
+    BasicBlockSubGraph subgraph;
+    BasicBlockDecomposer bbd(block, &subgraph);
+    if (!bbd.Decompose())
+      continue;
+
+    DominatorAnalysis dominators;
+    uint64_t t0 = ::__rdtsc();
+    dominators.Analyze(&subgraph);
+    uint64_t t1 = ::__rdtsc();
+    tnet += t1 - t0;
+    ++functions;
+
+    // Every reachable basic block is dominated by itself and its immediate
+    // dominator.
+    const DominatorAnalysis::BasicBlockOrdering& order =
+        dominators.reverse_post_order();
+    for (size_t i = 0; i < order.size(); ++i) {
+      EXPECT_TRUE(dominators.Dominates(order[i], order[i]));
+      const BasicCodeBlock* idom = dominators.GetImmediateDominator(order[i]);
+      if (idom != NULL)
+        EXPECT_TRUE(dominators.Dominates(idom, order[i]));
+    }
+  }
+
+  EXPECT_LT(0U, functions);
+  testing::EmitMetric(base::StringPrintf("%s.Cycles", metric), tnet);
+  testing::EmitMetric(base::StringPrintf("%s.Functions", metric),
+                      static_cast<uint64_t>(functions));
+}
+
+}  // namespace
+
+TEST_F(DominatorAnalysisTest, StraightLine) {
+  BasicCodeBlock* bb1 = subgraph_.AddBasicCodeBlock("bb1");
+  BasicCodeBlock* bb2 = subgraph_.AddBasicCodeBlock("bb2");
+  BasicCodeBlock* bb3 = subgraph_.AddBasicCodeBlock("bb3");
+  Connect(bb1, bb2);
+  Connect(bb2, bb3);
+
+  Analyze(bb1);
+
+  EXPECT_THAT(dominators_.reverse_post_order(), ElementsAre(bb1, bb2, bb3));
+  EXPECT_EQ(NULL, dominators_.GetImmediateDominator(bb1));
+  EXPECT_EQ(bb1, dominators_.GetImmediateDominator(bb2));
+  EXPECT_EQ(bb2, dominators_.GetImmediateDominator(bb3));
+  EXPECT_EQ(bb2, dominators_.GetImmediatePostDominator(bb1));
+  EXPECT_EQ(bb3, dominators_.GetImmediatePostDominator(bb2));
+  EXPECT_EQ(NULL, dominators_.GetImmediatePostDominator(bb3));
+
+  EXPECT_TRUE(dominators_.Dominates(bb1, bb3));
+  EXPECT_FALSE(dominators_.Dominates(bb3, bb1));
+  EXPECT_TRUE(dominators_.PostDominates(bb3, bb1));
+  EXPECT_FALSE(dominators_.PostDominates(bb1, bb3));
+  EXPECT_TRUE(dominators_.loops().empty());
+}
+
+TEST_F(DominatorAnalysisTest, IfThenElse) {
+  BasicCodeBlock* if1 = subgraph_.AddBasicCodeBlock("if1");
+  BasicCodeBlock* true1 = subgraph_.AddBasicCodeBlock("true1");
+  BasicCodeBlock* false1 = subgraph_.AddBasicCodeBlock("false1");
+  BasicCodeBlock* end1 = subgraph_.AddBasicCodeBlock("end1");
+  MakeIf(if1, true1, false1);
+  Connect(true1, end1);
+  Connect(false1, end1);
+
+  Analyze(if1);
+
+  EXPECT_EQ(if1, dominators_.GetImmediateDominator(true1));
+  EXPECT_EQ(if1, dominators_.GetImmediateDominator(false1));
+  EXPECT_EQ(if1, dominators_.GetImmediateDominator(end1));
+  EXPECT_FALSE(dominators_.Dominates(true1, end1));
+  EXPECT_FALSE(dominators_.Dominates(false1, end1));
+
+  EXPECT_EQ(end1, dominators_.GetImmediatePostDominator(if1));
+  EXPECT_EQ(end1, dominators_.GetImmediatePostDominator(true1));
+  EXPECT_TRUE(dominators_.PostDominates(end1, if1));
+  EXPECT_FALSE(dominators_.PostDominates(true1, if1));
+}
+
+TEST_F(DominatorAnalysisTest, UnreachableBlock) {
+  BasicCodeBlock* bb1 = subgraph_.AddBasicCodeBlock("bb1");
+  BasicCodeBlock* bb2 = subgraph_.AddBasicCodeBlock("bb2");
+  BasicCodeBlock* dead = subgraph_.AddBasicCodeBlock("dead");
+  Connect(bb1, bb2);
+  Connect(dead, bb2);
+
+  Analyze(bb1);
+
+  EXPECT_TRUE(dominators_.IsReachable(bb2));
+  EXPECT_FALSE(dominators_.IsReachable(dead));
+  EXPECT_EQ(bb1, dominators_.GetImmediateDominator(bb2));
+  EXPECT_EQ(NULL, dominators_.GetImmediateDominator(dead));
+  EXPECT_FALSE(dominators_.Dominates(dead, dead));
+  EXPECT_FALSE(dominators_.Dominates(bb1, dead));
+  EXPECT_THAT(dominators_.reverse_post_order(), ElementsAre(bb1, bb2));
+}
+
+TEST_F(DominatorAnalysisTest, SimpleLoop) {
+  BasicCodeBlock* entry = subgraph_.AddBasicCodeBlock("entry");
+  BasicCodeBlock* if1 = subgraph_.AddBasicCodeBlock("if1");
+  BasicCodeBlock* body1 = subgraph_.AddBasicCodeBlock("body1");
+  BasicCodeBlock* end1 = subgraph_.AddBasicCodeBlock("end1");
+  Connect(entry, if1);
+  MakeIf(if1, body1, end1);
+  Connect(body1, if1);
+
+  Analyze(entry);
+
+  EXPECT_EQ(if1, dominators_.GetImmediateDominator(body1));
+  EXPECT_EQ(if1, dominators_.GetImmediateDominator(end1));
+  EXPECT_EQ(if1, dominators_.GetImmediatePostDominator(body1));
+
+  ASSERT_EQ(1U, dominators_.loops().size());
+  const Loop* loop = dominators_.loops().front();
+  EXPECT_EQ(if1, loop->header());
+  EXPECT_EQ(entry, loop->preheader());
+  EXPECT_EQ(NULL, loop->parent());
+  EXPECT_EQ(1U, loop->depth());
+  EXPECT_THAT(loop->latches(), ElementsAre(body1));
+  EXPECT_TRUE(loop->Contains(if1));
+  EXPECT_TRUE(loop->Contains(body1));
+  EXPECT_FALSE(loop->Contains(entry));
+  EXPECT_FALSE(loop->Contains(end1));
+
+  EXPECT_EQ(loop, dominators_.GetInnermostLoop(body1));
+  EXPECT_EQ(NULL, dominators_.GetInnermostLoop(end1));
+  EXPECT_EQ(1U, dominators_.GetLoopDepth(if1));
+  EXPECT_EQ(0U, dominators_.GetLoopDepth(entry));
+}
+
+TEST_F(DominatorAnalysisTest, LoopWithoutPreheader) {
+  BasicCodeBlock* if1 = subgraph_.AddBasicCodeBlock("if1");
+  BasicCodeBlock* body1 = subgraph_.AddBasicCodeBlock("body1");
+  BasicCodeBlock* end1 = subgraph_.AddBasicCodeBlock("end1");
+  MakeIf(if1, body1, end1);
+  Connect(body1, if1);
+
+  Analyze(if1);
+
+  ASSERT_EQ(1U, dominators_.loops().size());
+  EXPECT_EQ(NULL, dominators_.loops().front()->preheader());
+}
+
+TEST_F(DominatorAnalysisTest, ReferencedLoopHeaderHasNoPreheader) {
+  BasicCodeBlock* entry = subgraph_.AddBasicCodeBlock("entry");
+  BasicCodeBlock* if1 = subgraph_.AddBasicCodeBlock("if1");
+  BasicCodeBlock* body1 = subgraph_.AddBasicCodeBlock("body1");
+  BasicCodeBlock* end1 = subgraph_.AddBasicCodeBlock("end1");
+  Connect(entry, if1);
+  MakeIf(if1, body1, end1);
+  Connect(body1, if1);
+
+  // The header is also entered from outside the subgraph.
+  BlockGraph block_graph;
+  BlockGraph::Block* other =
+      block_graph.AddBlock(BlockGraph::CODE_BLOCK, 4, "other");
+  ASSERT_TRUE(if1->referrers().insert(BasicBlockReferrer(other, 0)).second);
+
+  Analyze(entry);
+
+  ASSERT_EQ(1U, dominators_.loops().size());
+  EXPECT_EQ(if1, dominators_.loops().front()->header());
+  EXPECT_EQ(NULL, dominators_.loops().front()->preheader());
+}
+
+TEST_F(DominatorAnalysisTest, JumpTableLoopHeaderHasNoPreheader) {
+  static const uint8_t kEmptyData[4] = {};
+  BasicCodeBlock* entry = subgraph_.AddBasicCodeBlock("entry");
+  BasicCodeBlock* if1 = subgraph_.AddBasicCodeBlock("if1");
+  BasicCodeBlock* body1 = subgraph_.AddBasicCodeBlock("body1");
+  BasicCodeBlock* end1 = subgraph_.AddBasicCodeBlock("end1");
+  Connect(entry, if1);
+  MakeIf(if1, body1, end1);
+  Connect(body1, if1);
+
+  // The header is also the target of a jump table.
+  BasicDataBlock* table = subgraph_.AddBasicDataBlock(
+      "table", sizeof(kEmptyData), kEmptyData);
+  ASSERT_TRUE(table->references().insert(std::make_pair(
+      0, BasicBlockReference(BlockGraph::ABSOLUTE_REF, 4, if1))).second);
+
+  Analyze(entry);
+
+  EXPECT_THAT(dominators_.entry_points(), UnorderedElementsAre(entry, if1));
+  ASSERT_EQ(1U, dominators_.loops().size());
+  EXPECT_EQ(if1, dominators_.loops().front()->header());
+  EXPECT_EQ(NULL, dominators_.loops().front()->preheader());
+}
+
+TEST_F(DominatorAnalysisTest, NestedLoops) {
+  BasicCodeBlock* entry = subgraph_.AddBasicCodeBlock("entry");
+  BasicCodeBlock* outer = subgraph_.AddBasicCodeBlock("outer");
+  BasicCodeBlock* pre = subgraph_.AddBasicCodeBlock("pre");
+  BasicCodeBlock* inner = subgraph_.AddBasicCodeBlock("inner");
+  BasicCodeBlock* body = subgraph_.AddBasicCodeBlock("body");
+  BasicCodeBlock* latch = subgraph_.AddBasicCodeBlock("latch");
+  BasicCodeBlock* end = subgraph_.AddBasicCodeBlock("end");
+
+  Connect(entry, outer);
+  MakeIf(outer, pre, end);
+  Connect(pre, inner);
+  MakeIf(inner, body, latch);
+  Connect(body, inner);
+  Connect(latch, outer);
+
+  Analyze(entry);
+
+  ASSERT_EQ(2U, dominators_.loops().size());
+  ASSERT_EQ(1U, dominators_.root_loops().size());
+  const Loop* outer_loop = dominators_.root_loops().front();
+  EXPECT_EQ(outer, outer_loop->header());
+  EXPECT_EQ(entry, outer_loop->preheader());
+  ASSERT_EQ(1U, outer_loop->children().size());
+
+  const Loop* inner_loop = outer_loop->children().front();
+  EXPECT_EQ(inner, inner_loop->header());
+  EXPECT_EQ(pre, inner_loop->preheader());
+  EXPECT_EQ(outer_loop, inner_loop->parent());
+  EXPECT_EQ(2U, inner_loop->depth());
+  EXPECT_THAT(inner_loop->basic_blocks(), testing::UnorderedElementsAre(
+      inner, body));
+  EXPECT_THAT(outer_loop->basic_blocks(), testing::UnorderedElementsAre(
+      outer, pre, inner, body, latch));
+
+  EXPECT_EQ(inner_loop, dominators_.GetInnermostLoop(body));
+  EXPECT_EQ(outer_loop, dominators_.GetInnermostLoop(latch));
+  EXPECT_EQ(2U, dominators_.GetLoopDepth(body));
+  EXPECT_EQ(1U, dominators_.GetLoopDepth(pre));
+  EXPECT_EQ(0U, dominators_.GetLoopDepth(end));
+}
+
+TEST_F(DominatorAnalysisTest, IrreducibleCycleIsNotALoop) {
+  BasicCodeBlock* if1 = subgraph_.AddBasicCodeBlock("if1");
+  BasicCodeBlock* left = subgraph_.AddBasicCodeBlock("left");
+  BasicCodeBlock* right = subgraph_.AddBasicCodeBlock("right");
+  MakeIf(if1, left, right);
+  Connect(left, right);
+  Connect(right, left);
+
+  Analyze(if1);
+
+  EXPECT_EQ(if1, dominators_.GetImmediateDominator(left));
+  EXPECT_EQ(if1, dominators_.GetImmediateDominator(right));
+  EXPECT_TRUE(dominators_.loops().empty());
+
+  // The cycle never reaches an exit.
+  EXPECT_EQ(NULL, dominators_.GetImmediatePostDominator(left));
+  EXPECT_FALSE(dominators_.PostDominates(right, left));
+}
+
+TEST_F(DominatorAnalysisTest, MultipleEntries) {
+  BasicCodeBlock* entry1 = subgraph_.AddBasicCodeBlock("entry1");
+  BasicCodeBlock* entry2 = subgraph_.AddBasicCodeBlock("entry2");
+  BasicCodeBlock* join = subgraph_.AddBasicCodeBlock("join");
+  Connect(entry1, join);
+  Connect(entry2, join);
+
+  BasicBlockSubGraph::BlockDescription* description =
+      subgraph_.AddBlockDescription("b2", "test.obj", BlockGraph::CODE_BLOCK,
+                                    7, 2, 42);
+  description->basic_block_order.push_back(entry2);
+  Analyze(entry1);
+
+  EXPECT_THAT(dominators_.entry_points(),
+              UnorderedElementsAre(entry1, entry2));
+  EXPECT_TRUE(dominators_.IsReachable(entry2));
+  EXPECT_EQ(NULL, dominators_.GetImmediateDominator(join));
+  EXPECT_FALSE(dominators_.Dominates(entry1, join));
+  EXPECT_FALSE(dominators_.Dominates(entry2, join));
+  EXPECT_TRUE(dominators_.PostDominates(join, entry1));
+  EXPECT_TRUE(dominators_.PostDominates(join, entry2));
+}
+
+TEST(DominatorAnalysisPerfTest, TestDll) {
+  ASSERT_NO_FATAL_FAILURE(BenchmarkImage(
+      testing::GetOutputRelativePath(testing::kTestDllName),
+      "Syzygy.BlockGraph.Analysis.DominatorAnalysis.TestDll"));
+}
+
+TEST(DominatorAnalysisPerfTest, IntegrationTestsDll) {
+  ASSERT_NO_FATAL_FAILURE(BenchmarkImage(
+      testing::GetOutputRelativePath(testing::kIntegrationTestsDllName),
+      "Syzygy.BlockGraph.Analysis.DominatorAnalysis.IntegrationTestsDll"));
+}
+
+}  // namespace analysis
+}  // namespace block_graph
@@ -15,7 +15,6 @@
 #include "syzygy/block_graph/analysis/liveness_analysis.h"
 
 #include <set>
-#include <stack>
 #include <vector>
 
 #include "syzygy/assm/assembler.h"
@@ -125,79 +124,115 @@ void LivenessAnalysis::GetStateAtExitOf(const BasicBlock* bb,
   }
 }
 
+void LivenessAnalysis::GetStatesOf(const BasicCodeBlock* bb,
+                                   std::vector<State>* states) const {
+  DCHECK(bb != NULL);
+  DCHECK(states != NULL);
+
+  const Instructions& instructions = bb->instructions();
+  states->resize(instructions.size());
+
+  State state;
+  GetStateAtExitOf(bb, &state);
+  std::vector<State>::reverse_iterator state_iter = states->rbegin();
+  Instructions::const_reverse_iterator instr_iter = instructions.rbegin();
+  for (; instr_iter != instructions.rend(); ++instr_iter, ++state_iter) {
+    PropagateBackward(*instr_iter, &state);
+    StateHelper::Copy(state, &(*state_iter));
+  }
+}
+
 void LivenessAnalysis::PropagateBackward(const Instruction& instr,
                                          State* state) {
   DCHECK(state != NULL);
 
-  // Skip 'nop' instructions. It's better to skip them (i.e. mov %eax, %eax).
-  if (instr.IsNop())
-    return;
-
-  // Remove 'defs' from current state.
   State defs;
-  if (StateHelper::GetDefsOf(instr, &defs))
-    StateHelper::Subtract(defs, state);
-
-  if (instr.IsCall() || instr.IsReturn()) {
-    // TODO(etienneb): Can we verify the calling convention? If so we can do
-    // better than SetAll here.
-    StateHelper::SetAll(state);
-  } else if (instr.IsBranch() ||
-             instr.IsInterrupt() ||
-             instr.IsControlFlow()) {
-    // Don't mess with these instructions.
-    StateHelper::SetAll(state);
-  }
-
-  // Add 'uses' of instruction to current state, or assume all alive when 'uses'
-  // information is not available.
   State uses;
-  if (StateHelper::GetUsesOf(instr, &uses)) {
-    StateHelper::Union(uses, state);
-  } else {
-    StateHelper::SetAll(state);
-  }
+  StateHelper::GetTransferOf(instr, &defs, &uses);
+  StateHelper::Subtract(defs, state);
+  StateHelper::Union(uses, state);
 }
 
 void LivenessAnalysis::Analyze(const BasicBlockSubGraph* subgraph) {
   DCHECK(subgraph != NULL);
   DCHECK(live_in_.empty());
 
-  // Produce a post-order basic blocks ordering.
+  // Produce a post-order basic blocks ordering. This is a reverse post-order
+  // of the reversed flow graph, which is the right visiting order for a
+  // backward problem.
   const BBCollection& basic_blocks = subgraph->basic_blocks();
-  std::vector<const BasicCodeBlock*> order;
+  BasicBlockOrdering order;
   ControlFlowAnalysis::FlattenBasicBlocksInPostOrder(basic_blocks, &order);
 
-  // Initialize liveness information of each basic block (empty set).
-  BasicBlockOrdering::const_iterator fw_iter = order.begin();
-  for (; fw_iter != order.end(); ++fw_iter)
-    StateHelper::Clear(&live_in_[*fw_iter]);
+  std::map<const BasicBlock*, size_t> index_of;
+  for (size_t i = 0; i < order.size(); ++i)
+    index_of[order[i]] = i;
+
+  // Summarize each basic block once. The flow equations are then solved on
+  // the summaries without visiting any instruction again.
+  std::vector<State> kills(order.size());
+  std::vector<State> gens(order.size());
+  std::vector<State> exit_uses(order.size());
+  std::vector<std::vector<size_t>> successors(order.size());
+  std::vector<std::vector<size_t>> predecessors(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    const BasicCodeBlock* bb = order[i];
+    StateHelper::GetSummaryOf(bb->instructions(), &kills[i], &gens[i]);
+
+    // Without successors, everything is assumed alive at exit.
+    const Successors& succs = bb->successors();
+    if (succs.empty()) {
+      StateHelper::SetAll(&exit_uses[i]);
+      continue;
+    }
 
-  // Propagate liveness information until stable (fix-point). Each set may only
-  // grow, thus we have a halting condition.
-  bool changed = true;
-  while (changed) {
-    changed = false;
-
-    BasicBlockOrdering::const_iterator  bb_iter = order.begin();
-    for (; bb_iter != order.end(); ++bb_iter) {
-      const BasicCodeBlock* bb = *bb_iter;
-
-      // Merge current liveness information with every successor information.
-      State state;
-      GetStateAtExitOf(bb, &state);
-
-      // Propagate liveness information backward until the basic block entry.
-      const Instructions& instructions = bb->instructions();
-      Instructions::const_reverse_iterator instr_iter = instructions.rbegin();
-      for (; instr_iter != instructions.rend(); ++instr_iter)
-        PropagateBackward(*instr_iter, &state);
-
-      // Commit liveness information to the global state.
-      if (StateHelper::Union(state, &live_in_[bb]))
-        changed = true;
+    StateHelper::Clear(&exit_uses[i]);
+    Successors::const_iterator succ = succs.begin();
+    for (; succ != succs.end(); ++succ) {
+      State uses;
+      StateHelper::Clear(&uses);
+      std::map<const BasicBlock*, size_t>::const_iterator look =
+          index_of.find(succ->reference().basic_block());
+      if (look == index_of.end() || !StateHelper::GetUsesOf(*succ, &uses)) {
+        StateHelper::SetAll(&exit_uses[i]);
+        continue;
+      }
+      StateHelper::Union(uses, &exit_uses[i]);
+      successors[i].push_back(look->second);
+      predecessors[look->second].push_back(i);
     }
   }
+
+  // Propagate liveness information until stable (fix-point). Each set may only
+  // grow, thus we have a halting condition. The worklist is kept ordered so
+  // that basic blocks are always revisited in post-order.
+  std::vector<State> live_in(order.size());
+  std::set<size_t> worklist;
+  for (size_t i = 0; i < order.size(); ++i) {
+    StateHelper::Clear(&live_in[i]);
+    worklist.insert(i);
+  }
+
+  while (!worklist.empty()) {
+    size_t i = *worklist.begin();
+    worklist.erase(worklist.begin());
+
+    // Merge current liveness information with every successor information.
+    State state(exit_uses[i]);
+    for (size_t j = 0; j < successors[i].size(); ++j)
+      StateHelper::Union(live_in[successors[i][j]], &state);
+
+    // Apply the summary of the basic block.
+    StateHelper::Subtract(kills[i], &state);
+    StateHelper::Union(gens[i], &state);
+
+    // Commit liveness information and revisit the predecessors on change.
+    if (StateHelper::Union(state, &live_in[i]))
+      worklist.insert(predecessors[i].begin(), predecessors[i].end());
+  }
+
+  for (size_t i = 0; i < order.size(); ++i)
+    StateHelper::Copy(live_in[i], &live_in_[order[i]]);
 }
 
 RegisterMask LivenessAnalysis::StateHelper::RegisterToRegisterMask(
@@ -703,6 +738,64 @@ bool LivenessAnalysis::StateHelper::GetUsesOf(
   NOTREACHED();
 }
 
+void LivenessAnalysis::StateHelper::GetTransferOf(const Instruction& instr,
+                                                  State* defs,
+                                                  State* uses) {
+  DCHECK(defs != NULL);
+  DCHECK(uses != NULL);
+
+  Clear(defs);
+  Clear(uses);
+
+  // Skip 'nop' instructions. It's better to skip them (i.e. mov %eax, %eax).
+  if (instr.IsNop())
+    return;
+
+  // Remove 'defs' from current state.
+  if (!GetDefsOf(instr, defs))
+    Clear(defs);
+
+  if (instr.IsCall() || instr.IsReturn()) {
+    // TODO(etienneb): Can we verify the calling convention? If so we can do
+    // better than SetAll here.
+    SetAll(uses);
+    return;
+  }
+  if (instr.IsBranch() || instr.IsInterrupt() || instr.IsControlFlow()) {
+    // Don't mess with these instructions.
+    SetAll(uses);
+    return;
+  }
+
+  // Add 'uses' of instruction to current state, or assume all alive when 'uses'
+  // information is not available.
+  if (!GetUsesOf(instr, uses))
+    SetAll(uses);
+}
+
+void LivenessAnalysis::StateHelper::GetSummaryOf(
+    const BasicBlock::Instructions& instructions, State* kills, State* gens) {
+  DCHECK(kills != NULL);
+  DCHECK(gens != NULL);
+
+  Clear(kills);
+  Clear(gens);
+
+  // Compose the transfer functions from the last instruction to the first.
+  // Prepending (defs, uses) to (kills, gens) gives
+  // (kills | defs, (gens - defs) | uses).
+  BasicBlock::Instructions::const_reverse_iterator instr_iter =
+      instructions.rbegin();
+  for (; instr_iter != instructions.rend(); ++instr_iter) {
+    State defs;
+    State uses;
+    GetTransferOf(*instr_iter, &defs, &uses);
+    Subtract(defs, gens);
+    Union(uses, gens);
+    Union(defs, kills);
+  }
+}
+
 bool LivenessAnalysis::StateHelper::GetUsesOf(
     const Successor& successor, State* state) {
   DCHECK(state != NULL);
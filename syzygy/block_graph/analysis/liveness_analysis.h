@@ -28,6 +28,7 @@
 #define SYZYGY_BLOCK_GRAPH_ANALYSIS_LIVENESS_ANALYSIS_H_
 
 #include <map>
+#include <vector>
 
 #include "syzygy/block_graph/basic_block.h"
 #include "syzygy/block_graph/basic_block_subgraph.h"
@@ -93,6 +94,11 @@ namespace analysis {
 // The analysis internally keeps track of all alive registers at the beginning
 // of each basic block.
 //
+// The pre-computation summarizes each basic block once as the registers it
+// kills and the registers it makes alive, then solves the flow equations on
+// these summaries with a worklist visited in post-order. Instructions are only
+// visited again when the per-instruction states of a basic block are requested.
+//
 // Local modifications inside a basic block do not invalidate the global
 // analysis except if a new live range escapes the scope of the basic block. In
 // that case, the whole analysis is invalid and must be recomputed.
@@ -136,6 +142,12 @@ class LivenessAnalysis {
   // @param state Receives registers alive at basic block exit.
   void GetStateAtExitOf(const BasicBlock* bb, State* state) const;
 
+  // Get the registers alive before each instruction of a basic block. Only the
+  // instructions of @p bb are visited, starting from its state at exit.
+  // @param bb Basic block to analyze.
+  // @param states Receives one state per instruction, in instruction order.
+  void GetStatesOf(const BasicCodeBlock* bb, std::vector<State>* states) const;
+
   // Simulate the backward execution of an instruction and update the liveness
   // information in @p state to reflect side effects of @p instr.
   // @param instr Instruction to analyze.
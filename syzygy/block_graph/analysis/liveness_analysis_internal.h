@@ -171,6 +171,23 @@ class LivenessAnalysis::StateHelper {
   // @returns true if we are able to analyze this instruction, false otherwise.
   static bool GetUsesOf(const Instruction& instr, State* state);
 
+  // Get the transfer function of an instruction. The registers alive before
+  // @p instr are (registers alive after - @p defs) | @p uses.
+  // @param instr Instruction to analyze.
+  // @param defs Receives the registers killed by the instruction.
+  // @param uses Receives the registers made alive by the instruction.
+  static void GetTransferOf(const Instruction& instr, State* defs, State* uses);
+
+  // Get the transfer function of a sequence of instructions. The registers
+  // alive before @p instructions are (registers alive after - @p kills) |
+  // @p gens.
+  // @param instructions Instructions to analyze.
+  // @param kills Receives the registers killed by the sequence.
+  // @param gens Receives the registers made alive by the sequence.
+  static void GetSummaryOf(const BasicBlock::Instructions& instructions,
+                           State* kills,
+                           State* gens);
+
   // Get the registers used by the execution of the successor (instruction).
   // @param successor Successor to analyze.
   // @param state On success, receives registers used by the instruction.
@@ -1751,6 +1751,95 @@ TEST_F(LivenessAnalysisTest, LivenessAnalysisOverControlFlow) {
   EXPECT_FALSE(is_live(assm::ebp));
 }
 
+TEST_F(LivenessAnalysisTest, SummaryMatchesPropagation) {
+  asm_.mov(assm::eax, assm::ebx);
+  asm_.mov(assm::ecx, Operand(assm::eax));
+  asm_.add(assm::edx, assm::esi);
+  asm_.mov(assm::esi, Immediate(1));
+  asm_.mov(assm::edi, assm::edx);
+
+  State kills;
+  State gens;
+  StateHelper::GetSummaryOf(instructions_, &kills, &gens);
+
+  // Applying the summary must be equivalent to propagating through each
+  // instruction, whatever the state at exit.
+  State exits[3];
+  StateHelper::Clear(&exits[0]);
+  StateHelper::SetAll(&exits[1]);
+  StateHelper::Clear(&exits[2]);
+  StateHelper::Set(StateHelper::REGBITS_EAX | StateHelper::REGBITS_ESI,
+                   &exits[2]);
+  for (size_t i = 0; i < arraysize(exits); ++i) {
+    State summarized(exits[i]);
+    StateHelper::Subtract(kills, &summarized);
+    StateHelper::Union(gens, &summarized);
+
+    StateHelper::Copy(exits[i], &state_);
+    AnalyzeInstructionsWithoutReset();
+
+    EXPECT_EQ(is_live(assm::eax), summarized.IsLive(assm::eax));
+    EXPECT_EQ(is_live(assm::ebx), summarized.IsLive(assm::ebx));
+    EXPECT_EQ(is_live(assm::ecx), summarized.IsLive(assm::ecx));
+    EXPECT_EQ(is_live(assm::edx), summarized.IsLive(assm::edx));
+    EXPECT_EQ(is_live(assm::esi), summarized.IsLive(assm::esi));
+    EXPECT_EQ(is_live(assm::edi), summarized.IsLive(assm::edi));
+    EXPECT_EQ(are_arithmetic_flags_live(),
+              summarized.AreArithmeticFlagsLive());
+  }
+}
+
+TEST_F(LivenessAnalysisTest, SummaryOfCallMakesEverythingLive) {
+  asm_.mov(assm::eax, Immediate(0));
+  asm_.call(Operand(assm::ebx));
+  asm_.mov(assm::ecx, Immediate(0));
+
+  State kills;
+  State gens;
+  StateHelper::GetSummaryOf(instructions_, &kills, &gens);
+  // eax is defined before the call, so the kill survives in the summary. The
+  // call uses every register, including ecx which is only defined after it.
+  EXPECT_FALSE(gens.IsLive(assm::eax));
+  EXPECT_TRUE(gens.IsLive(assm::ebx));
+  EXPECT_TRUE(gens.IsLive(assm::ecx));
+  EXPECT_TRUE(gens.IsLive(assm::edx));
+  EXPECT_TRUE(kills.IsLive(assm::eax));
+  EXPECT_TRUE(kills.IsLive(assm::ecx));
+}
+
+TEST_F(LivenessAnalysisTest, GetStatesOf) {
+  BasicBlockSubGraph subgraph;
+  BlockDescription* block = subgraph.AddBlockDescription(
+      "b1", "b1.obj", BlockGraph::CODE_BLOCK, 7, 2, 42);
+  BasicCodeBlock* bb = subgraph.AddBasicCodeBlock("bb");
+  block->basic_block_order.push_back(bb);
+
+  BasicBlockAssembler asm_bb(bb->instructions().end(), &bb->instructions());
+  asm_bb.mov(assm::eax, assm::ebx);
+  asm_bb.mov(assm::ecx, assm::eax);
+  asm_bb.ret();
+
+  liveness_.Analyze(&subgraph);
+
+  std::vector<State> states;
+  liveness_.GetStatesOf(bb, &states);
+  ASSERT_EQ(3U, states.size());
+
+  // Before 'mov eax, ebx'.
+  EXPECT_FALSE(states[0].IsLive(assm::eax));
+  EXPECT_TRUE(states[0].IsLive(assm::ebx));
+  // Before 'mov ecx, eax'.
+  EXPECT_TRUE(states[1].IsLive(assm::eax));
+  EXPECT_FALSE(states[1].IsLive(assm::ecx));
+  // Before 'ret'.
+  EXPECT_TRUE(states[2].IsLive(assm::ecx));
+
+  // The first state is the state at entry of the basic block.
+  liveness_.GetStateAtEntryOf(bb, &state_);
+  EXPECT_EQ(is_live(assm::eax), states[0].IsLive(assm::eax));
+  EXPECT_EQ(is_live(assm::ebx), states[0].IsLive(assm::ebx));
+}
+
 TEST_F(LivenessAnalysisTest, AnalyzeWithData) {
   BasicBlockSubGraph subgraph;
   const uint8_t raw_data[] = {0, 1, 2, 3, 4};
@@ -14,7 +14,8 @@
 
 #include "syzygy/block_graph/analysis/memory_access_analysis.h"
 
-#include <queue>
+#include <algorithm>
+#include <map>
 #include <set>
 #include <vector>
 
@@ -36,6 +37,56 @@ using block_graph::Operand;
 typedef assm::RegisterId RegisterId;
 typedef block_graph::BasicBlockSubGraph::BasicBlock BasicBlock;
 typedef block_graph::BasicBlockSubGraph::BasicBlock::Instructions Instructions;
+typedef DominatorAnalysis::BasicBlockOrdering BasicBlockOrdering;
+
+// Gets the index of a 32-bit general purpose register.
+// @param reg The distorm register.
+// @param index Receives the index of @p reg in assm::kRegisters32.
+// @returns false if @p reg is not a 32-bit general purpose register.
+bool GetRegister32Index(uint8_t reg, size_t* index) {
+  DCHECK(index != NULL);
+  if (reg < R_EAX || reg > R_EDI)
+    return false;
+
+  RegisterId reg_id = core::GetRegisterId(reg);
+  DCHECK_LE(assm::kRegister32Min, reg_id);
+  DCHECK_LT(reg_id, assm::kRegister32Max);
+  *index = reg_id - assm::kRegister32Min;
+  return true;
+}
+
+// Removes from @p to the elements not present in @p from.
+// @returns true if @p to was modified.
+template <typename T>
+bool IntersectInPlace(const std::set<T>& from, std::set<T>* to) {
+  DCHECK(to != NULL);
+
+  bool changed = false;
+  typename std::set<T>::iterator it1 = to->begin();
+  typename std::set<T>::const_iterator it2 = from.begin();
+  while (it1 != to->end()) {
+    if (it2 == from.end() || *it1 < *it2) {
+      typename std::set<T>::iterator old = it1;
+      ++it1;
+      to->erase(old);
+      changed = true;
+    } else if (*it2 < *it1) {
+      ++it2;
+    } else {  // *it1 == *it2
+      ++it1;
+      ++it2;
+    }
+  }
+
+  return changed;
+}
+
+// @returns true if @p instr performs a memory access that the analysis keeps
+//     track of.
+bool IsTrackedAccess(const Instruction& instr) {
+  MemoryAccessAnalysis::State empty;
+  return empty.HasNonRedundantAccess(instr);
+}
 
 }  // namespace
 
@@ -82,8 +133,8 @@ void MemoryAccessAnalysis::PropagateForward(const Instruction& instr,
 
   for (size_t r = 0; r < assm::kRegister32Count; ++r) {
     if (defs.IsLive(assm::kRegisters32[r])) {
-      // This register is modified, clear all memory accesses with this base.
-      state->active_memory_accesses_[r].clear();
+      // This register is modified, clear all memory accesses using it.
+      state->ClearRegister(r);
     }
   }
 }
@@ -100,26 +151,15 @@ bool MemoryAccessAnalysis::Intersect(const block_graph::BasicBlock* bb,
   bool changed = false;
   // Subtract non redundant memory accesses.
   for (size_t r = 0; r < assm::kRegister32Count; ++r) {
-    const std::set<int32_t>& from = state.active_memory_accesses_[r];
-    std::set<int32_t>& to = bbentry_state->second.active_memory_accesses_[r];
-
-    // In-place intersection. Remove unknown accesses of the destination set.
-    std::set<int32_t>::iterator it1 = to.begin();
-    std::set<int32_t>::const_iterator it2 = from.begin();
-    while (it1 != to.end()) {
-      if (it2 == from.end() || *it1 < *it2) {
-        std::set<int32_t>::iterator old = it1;
-        ++it1;
-        to.erase(old);
-        changed = true;
-      } else if (*it2 < *it1) {
-        ++it2;
-      } else {  // *it1 == *it2
-        ++it1;
-        ++it2;
-      }
+    if (IntersectInPlace(state.active_memory_accesses_[r],
+                         &bbentry_state->second.active_memory_accesses_[r])) {
+      changed = true;
     }
   }
+  if (IntersectInPlace(state.indexed_memory_accesses_,
+                       &bbentry_state->second.indexed_memory_accesses_)) {
+    changed = true;
+  }
 
   return changed;
 }
@@ -130,49 +170,47 @@ bool MemoryAccessAnalysis::Intersect(const block_graph::BasicBlock* bb,
 // the control flow and re-insert each modified basic block into the work-list.
 // When the end of a basic block is reached, the algorithm performs the
 // intersection of the current state with all its successors.
+//
+// The work-list is ordered by the reverse post-order of the dominator analysis:
+// a basic block is visited after its dominators, and loop bodies are revisited
+// only when a back edge removes a memory access.
 void MemoryAccessAnalysis::Analyze(const BasicBlockSubGraph* subgraph) {
-  DCHECK(subgraph != NULL);
+  Analyze(subgraph, BasicBlockSet());
+}
 
-  std::queue<const BasicBlock*> working;
-  std::set<const BasicBlock*> marked;
+void MemoryAccessAnalysis::Analyze(
+    const BasicBlockSubGraph* subgraph,
+    const BasicBlockSet& unchecked_basic_blocks) {
+  DCHECK(subgraph != NULL);
 
   states_.clear();
-
-  // Find initial basic blocks (entry-points), add them to working queue.
-  const BasicBlockSubGraph::BlockDescriptionList& descriptions =
-      subgraph->block_descriptions();
-  BasicBlockSubGraph::BlockDescriptionList::const_iterator descr_iter =
-      descriptions.begin();
-  for (; descr_iter != descriptions.end(); ++descr_iter) {
-    const BasicBlockSubGraph::BasicBlockOrdering& original_order =
-        descr_iter->basic_block_order;
-    if (original_order.empty())
-      continue;
-    const BasicBlock* head = original_order.front();
-    if (marked.insert(head).second) {
-      working.push(original_order.front());
-      State empty;
-      Intersect(head, empty);
-    }
+  unchecked_basic_blocks_ = unchecked_basic_blocks;
+  dominators_.Analyze(subgraph);
+
+  // Number the reachable basic blocks in reverse post-order.
+  const BasicBlockOrdering& order = dominators_.reverse_post_order();
+  std::map<const BasicBlock*, size_t> order_number;
+  for (size_t i = 0; i < order.size(); ++i)
+    order_number[order[i]] = i;
+
+  // The entry points may be reached from outside the subgraph, where nothing
+  // is known about the memory accesses.
+  std::set<size_t> working;
+  const BasicBlockOrdering& entry_points = dominators_.entry_points();
+  for (size_t i = 0; i < entry_points.size(); ++i) {
+    State empty;
+    Intersect(entry_points[i], empty);
+    working.insert(order_number[entry_points[i]]);
   }
 
-  DCHECK(!working.empty());
-
   // Working set algorithm until fixed point.
   while (!working.empty()) {
-    const BasicBlock* bb = working.front();
-    working.pop();
-    marked.erase(bb);
-
-    const BasicCodeBlock* bb_code = BasicCodeBlock::Cast(bb);
-    if (bb_code == NULL) {
-      // Invalidate all.
-      states_.clear();
-      return;
-    }
+    size_t number = *working.begin();
+    working.erase(working.begin());
+    const BasicCodeBlock* bb_code = order[number];
 
     State state;
-    GetStateAtEntryOf(bb, &state);
+    GetStateAtEntryOf(bb_code, &state);
 
     // Walk through this basic block to obtain an updated state.
     const Instructions& instructions = bb_code->instructions();
@@ -182,29 +220,110 @@ void MemoryAccessAnalysis::Analyze(const BasicBlockSubGraph* subgraph) {
       PropagateForward(inst, &state);
     }
 
+    // The accesses of an unchecked basic block don't make the following ones
+    // redundant.
+    if (unchecked_basic_blocks_.count(bb_code) != 0)
+      state.Clear();
+
     // Commit updated state to successors, and re-insert modified basic blocks
     // to the working queue to be processed again.
     const BasicBlock::Successors& successors = bb_code->successors();
     BasicBlock::Successors::const_iterator succ = successors.begin();
     for (; succ != successors.end(); ++succ) {
       BasicBlock* basic_block = succ->reference().basic_block();
-      if (basic_block == NULL) {
+
+      // Successors outside of the subgraph are exits.
+      if (basic_block == NULL)
+        continue;
+
+      if (BasicCodeBlock::Cast(basic_block) == NULL) {
         // Invalidate all.
         states_.clear();
         return;
       }
 
       // Intersect current state with successor 'basic_block'.
-      bool changed = Intersect(basic_block, state);
-      if (changed) {
-        // When not already in working queue, mark and add it.
-        if (marked.insert(basic_block).second)
-          working.push(basic_block);
+      if (Intersect(basic_block, state)) {
+        DCHECK(order_number.find(basic_block) != order_number.end());
+        working.insert(order_number[basic_block]);
       }
     }
   }
 }
 
+void MemoryAccessAnalysis::GetLoopInvariantAccesses(
+    HoistingMap* hoisted) const {
+  DCHECK(hoisted != NULL);
+  hoisted->clear();
+
+  // The global analysis gave up on this subgraph.
+  if (states_.empty())
+    return;
+
+  const BasicBlockOrdering& entry_points = dominators_.entry_points();
+  const DominatorAnalysis::LoopList& loops = dominators_.loops();
+  DominatorAnalysis::LoopList::const_iterator loop = loops.begin();
+  for (; loop != loops.end(); ++loop) {
+    const BasicCodeBlock* header = (*loop)->header();
+    const BasicCodeBlock* preheader = (*loop)->preheader();
+    if (preheader == NULL)
+      continue;
+
+    // A check hoisted out of a header that is an entry point would be skipped
+    // when entering the loop directly. The checks of an unchecked header are
+    // meant to be left out, and an unchecked preheader is meant to be left
+    // untouched.
+    if (std::find(entry_points.begin(), entry_points.end(), header) !=
+            entry_points.end() ||
+        unchecked_basic_blocks_.count(header) != 0 ||
+        unchecked_basic_blocks_.count(preheader) != 0) {
+      continue;
+    }
+
+    // Accumulate the registers defined anywhere in the loop. A call may free
+    // the memory, so the access must be checked at each iteration.
+    LivenessAnalysis::State defs;
+    LivenessAnalysis::StateHelper::Clear(&defs);
+    bool invariant_loop = true;
+    const DominatorAnalysis::Loop::BasicBlockSet& basic_blocks =
+        (*loop)->basic_blocks();
+    DominatorAnalysis::Loop::BasicBlockSet::const_iterator bb =
+        basic_blocks.begin();
+    for (; invariant_loop && bb != basic_blocks.end(); ++bb) {
+      const Instructions& instructions = (*bb)->instructions();
+      Instructions::const_iterator inst_iter = instructions.begin();
+      for (; inst_iter != instructions.end(); ++inst_iter) {
+        if (inst_iter->IsCall() ||
+            !LivenessAnalysis::StateHelper::GetDefsOf(*inst_iter, &defs)) {
+          invariant_loop = false;
+          break;
+        }
+      }
+    }
+    if (!invariant_loop)
+      continue;
+
+    const Instructions& instructions = header->instructions();
+    Instructions::const_iterator inst_iter = instructions.begin();
+    for (; inst_iter != instructions.end(); ++inst_iter) {
+      const Instruction& instr = *inst_iter;
+      if (!IsTrackedAccess(instr))
+        continue;
+
+      // Execute the instruction on an empty state, clobber the registers
+      // defined in the loop, and keep the instruction if it is still tracked.
+      State state;
+      state.Execute(instr);
+      for (size_t r = 0; r < assm::kRegister32Count; ++r) {
+        if (defs.IsLive(assm::kRegisters32[r]))
+          state.ClearRegister(r);
+      }
+      if (!state.HasNonRedundantAccess(instr))
+        (*hoisted)[&instr] = preheader;
+    }
+  }
+}
+
 MemoryAccessAnalysis::State::State() {
 }
 
@@ -212,6 +331,7 @@ MemoryAccessAnalysis::State::State(const State& state) {
   for (size_t r = 0; r < assm::kRegister32Count; ++r) {
     active_memory_accesses_[r] = state.active_memory_accesses_[r];
   }
+  indexed_memory_accesses_ = state.indexed_memory_accesses_;
 }
 
 bool MemoryAccessAnalysis::State::HasNonRedundantAccess(
@@ -233,17 +353,24 @@ bool MemoryAccessAnalysis::State::HasNonRedundantAccess(
     // Filter unrecognized addressing mode.
     switch (op.type) {
       case O_DISP:
-      case O_MEM:
         return true;
-      case O_SMEM: {
-        if (op.index < R_EAX || op.index > R_EDI)
+      case O_MEM: {
+        // Memory dereference through an index register.
+        IndexedAccess access = {};
+        if (!GetIndexedAccess(instr, op_id, &access))
           return true;
 
+        if (indexed_memory_accesses_.find(access) ==
+            indexed_memory_accesses_.end()) {
+          return true;
+        }
+      }
+      break;
+      case O_SMEM: {
         // Simple memory dereference with optional displacement.
-        RegisterId base_reg_id = core::GetRegisterId(op.index);
-        DCHECK_LE(assm::kRegister32Min, base_reg_id);
-        DCHECK_LT(base_reg_id, assm::kRegister32Max);
-        size_t base_reg = base_reg_id - assm::kRegister32Min;
+        size_t base_reg = 0;
+        if (!GetRegister32Index(op.index, &base_reg))
+          return true;
 
         BasicBlockReference reference;
         if (instr.FindOperandReference(op_id, &reference))
@@ -275,17 +402,21 @@ void MemoryAccessAnalysis::State::Execute(const Instruction& instr) {
   for (size_t op_id = 0; op_id < OPERANDS_NO; ++op_id) {
     const _Operand& op = repr.ops[op_id];
 
-    if (op.type != O_SMEM)
+    if (op.type == O_MEM) {
+      // Memory dereference through an index register.
+      IndexedAccess access = {};
+      if (GetIndexedAccess(instr, op_id, &access))
+        indexed_memory_accesses_.insert(access);
       continue;
+    }
 
-    if (op.index < R_EAX || op.index > R_EDI)
+    if (op.type != O_SMEM)
       continue;
 
     // Simple memory dereference with optional displacement.
-    RegisterId base_reg_id = core::GetRegisterId(op.index);
-    DCHECK_LE(assm::kRegister32Min, base_reg_id);
-    DCHECK_LT(base_reg_id, assm::kRegister32Max);
-    size_t base_reg = base_reg_id - assm::kRegister32Min;
+    size_t base_reg = 0;
+    if (!GetRegister32Index(op.index, &base_reg))
+      continue;
 
     BasicBlockReference reference;
     if (instr.FindOperandReference(op_id, &reference))
@@ -299,6 +430,57 @@ void MemoryAccessAnalysis::State::Clear() {
   for (size_t r = 0; r < assm::kRegister32Count; ++r) {
     active_memory_accesses_[r].clear();
   }
+  indexed_memory_accesses_.clear();
+}
+
+void MemoryAccessAnalysis::State::ClearRegister(size_t reg) {
+  DCHECK_LT(reg, assm::kRegister32Count);
+  active_memory_accesses_[reg].clear();
+
+  std::set<IndexedAccess>::iterator it = indexed_memory_accesses_.begin();
+  while (it != indexed_memory_accesses_.end()) {
+    if (it->base == reg || it->index == reg) {
+      std::set<IndexedAccess>::iterator old = it;
+      ++it;
+      indexed_memory_accesses_.erase(old);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool MemoryAccessAnalysis::State::GetIndexedAccess(const Instruction& instr,
+                                                   size_t op_id,
+                                                   IndexedAccess* access) {
+  DCHECK(access != NULL);
+  const _DInst& repr = instr.representation();
+  DCHECK_EQ(O_MEM, repr.ops[op_id].type);
+
+  if (!GetRegister32Index(repr.ops[op_id].index, &access->index))
+    return false;
+
+  access->base = assm::kRegister32Count;
+  if (repr.base != R_NONE && !GetRegister32Index(repr.base, &access->base))
+    return false;
+
+  BasicBlockReference reference;
+  if (instr.FindOperandReference(op_id, &reference))
+    return false;
+
+  access->scale = repr.scale;
+  access->displacement = repr.disp;
+  return true;
+}
+
+bool MemoryAccessAnalysis::State::IndexedAccess::operator<(
+    const IndexedAccess& other) const {
+  if (base != other.base)
+    return base < other.base;
+  if (index != other.index)
+    return index < other.index;
+  if (scale != other.scale)
+    return scale < other.scale;
+  return displacement < other.displacement;
 }
 
 }  // namespace analysis
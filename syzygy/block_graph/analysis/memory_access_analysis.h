@@ -30,6 +30,10 @@
 #ifndef SYZYGY_BLOCK_GRAPH_ANALYSIS_MEMORY_ACCESS_ANALYSIS_H_
 #define SYZYGY_BLOCK_GRAPH_ANALYSIS_MEMORY_ACCESS_ANALYSIS_H_
 
+#include <map>
+#include <set>
+
+#include "syzygy/block_graph/analysis/dominator_analysis.h"
 #include "syzygy/block_graph/basic_block.h"
 #include "syzygy/block_graph/basic_block_assembler.h"
 #include "syzygy/block_graph/basic_block_subgraph.h"
@@ -103,10 +107,34 @@ namespace analysis {
 //    [do something with redundancy information in state...]
 //    liveness.PropagateForward(&instr, &state);
 //  }
+//
+// As the global analysis intersects the states of every path reaching a basic
+// block, an access is redundant as soon as an equivalent access dominates it,
+// or is performed on every path leading to it, without an intervening
+// definition of its base or index registers.
+//
+// Loop invariant accesses
+// -----------------------
+//
+// After a global analysis, the memory accesses of a loop header whose address
+// does not change inside the loop can be checked once in the loop preheader
+// instead of on every iteration.
+//
+// Example:
+//
+//  MemoryAccessAnalysis::HoistingMap hoisted;
+//  memory_access.GetLoopInvariantAccesses(&hoisted);
+//  MemoryAccessAnalysis::HoistingMap::const_iterator it = hoisted.find(&instr);
+//  if (it != hoisted.end()) {
+//    // Check the memory access of instr at the end of it->second.
+//  }
 
 class MemoryAccessAnalysis {
  public:
   typedef block_graph::BasicBlockSubGraph BasicBlockSubGraph;
+  // Maps an instruction of a loop header to the preheader of the loop.
+  typedef std::map<const Instruction*, const BasicCodeBlock*> HoistingMap;
+  typedef std::set<const BasicCodeBlock*> BasicBlockSet;
 
   // Forward declarations.
   class State;
@@ -129,6 +157,28 @@ class MemoryAccessAnalysis {
   // @param subgraph Subgraph to analyze.
   void Analyze(const BasicBlockSubGraph* subgraph);
 
+  // Performs a global analysis of a subgraph where some basic blocks don't
+  // check their memory accesses. No access is known to be checked at the exit
+  // of those basic blocks.
+  // @param subgraph Subgraph to analyze.
+  // @param unchecked_basic_blocks The basic blocks that aren't checked.
+  void Analyze(const BasicBlockSubGraph* subgraph,
+               const BasicBlockSet& unchecked_basic_blocks);
+
+  // Finds the memory accesses that are performed on each iteration of a loop
+  // through registers that are not modified inside the loop. A memory access
+  // qualifies when it is done by an instruction of a loop header, the loop has
+  // a preheader and contains no call, and the base and index registers of the
+  // access are not defined anywhere in the loop. Checking such an access at
+  // the end of the preheader is equivalent to checking it on every iteration.
+  // Nothing is hoisted out of a header that is an entry point, or when the
+  // header or the preheader is unchecked. Requires a prior global analysis.
+  // @param hoisted Receives the loop invariant accesses and their preheader.
+  void GetLoopInvariantAccesses(HoistingMap* hoisted) const;
+
+  // @returns the dominator analysis computed by the last global analysis.
+  const DominatorAnalysis& dominators() const { return dominators_; }
+
  protected:
   // Perform the intersection of the set of memory accesses in @p state with the
   // the set kept by the analysis for the basic block @p bb. On the first
@@ -140,14 +190,24 @@ class MemoryAccessAnalysis {
   typedef std::map<const block_graph::BasicBlock*, State> StateMap;
   StateMap states_;
 
+  // The basic blocks of the analyzed subgraph that don't check their accesses.
+  BasicBlockSet unchecked_basic_blocks_;
+
+  // The dominator tree and loop nest of the analyzed subgraph. The basic blocks
+  // are visited in reverse post-order, so that loop bodies reach their fixed
+  // point after seeing their dominators first.
+  DominatorAnalysis dominators_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(MemoryAccessAnalysis);
 };
 
 // This class contains the memory access information at a given program point.
-// The implementation only supports memory access through a single base register
-// (e.g. [eax] or [esi+12]). For each general purpose register (eax, ebx, ecx,
-// edx, esi, edi, esp, ebp) we keep a set of offsets accessed via the base.
+// The implementation supports memory access through a single base register
+// (e.g. [eax] or [esi+12]) and through a scaled index register (e.g.
+// [eax+ebx*4+8] or [ebx*4+8]). For each general purpose register (eax, ebx,
+// ecx, edx, esi, edi, esp, ebp) we keep a set of offsets accessed via the base.
+// Indexed accesses are kept in a separate set.
 class MemoryAccessAnalysis::State {
  public:
   // On creation, a state is assumed to be empty.
@@ -171,10 +231,38 @@ class MemoryAccessAnalysis::State {
   // @param instr Instruction to analyze.
   void State::Execute(const Instruction& instr);
 
+  // An access through a scaled index register.
+  struct IndexedAccess {
+    // The base register, or kRegister32Count when the access has no base.
+    size_t base;
+    size_t index;
+    uint8_t scale;
+    int32_t displacement;
+
+    bool operator<(const IndexedAccess& other) const;
+  };
+
+  // Decodes the indexed memory access of the operand @p op_id of @p instr.
+  // @param instr The instruction performing the access.
+  // @param op_id The index of an O_MEM operand of @p instr.
+  // @param access Receives the decoded access.
+  // @returns false if the access is not through 32-bit general purpose
+  //     registers or has a reference.
+  static bool GetIndexedAccess(const Instruction& instr,
+                               size_t op_id,
+                               IndexedAccess* access);
+
+  // Removes the accesses using the register @p reg as base or as index.
+  // @param reg The index of the modified 32-bit register.
+  void ClearRegister(size_t reg);
+
   // Contains active memory accesses. For each 32-bit base register, we keep a
   // set of distances (displacements) done via the base register.
   std::set<int32_t> active_memory_accesses_[assm::kRegister32Count];
 
+  // Contains active memory accesses done through an index register.
+  std::set<IndexedAccess> indexed_memory_accesses_;
+
   friend class MemoryAccessAnalysis;
 };
 
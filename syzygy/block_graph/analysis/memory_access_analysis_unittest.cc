@@ -31,6 +31,8 @@ typedef BasicBlockSubGraph::BlockDescription BlockDescription;
 
 // _asm add eax, ecx
 const uint8_t kClearEax[] = {0x03, 0xC1};
+// _asm add ebx, ecx
+const uint8_t kClearEbx[] = {0x03, 0xD9};
 // _asm add ecx, [eax]
 const uint8_t kReadEax[] = {0x03, 0x08};
 // _asm add ecx, [eax + 42]
@@ -39,6 +41,10 @@ const uint8_t kReadEax42[] = {0x03, 0x48, 0x2A};
 const uint8_t kRegsOnly[] = {0x03, 0xC1};
 // _asm add [eax + ebx*2 + 42], ecx
 const uint8_t kWriteWithScale[] = {0x01, 0x4C, 0x58, 0x2A};
+// _asm add ecx, [eax + ebx*2 + 42]
+const uint8_t kReadWithScale[] = {0x03, 0x4C, 0x58, 0x2A};
+// _asm add ecx, [eax + ebx*4 + 42]
+const uint8_t kReadWithScale4[] = {0x03, 0x4C, 0x98, 0x2A};
 // _asm add DWORD PTR [X], ecx
 const uint8_t kWriteDispl[] = {0x01, 0x0D, 0x80, 0x1E, 0xF2, 0x00};
 // _asm add [eax + 42], ecx
@@ -77,6 +83,11 @@ void AddSuccessorBetween(Successor::Condition condition,
                 0));
 }
 
+// Returns the first instruction of @p bb.
+const Instruction* FirstInstructionOf(const BasicCodeBlock* bb) {
+  return &bb->instructions().front();
+}
+
 }  // namespace
 
 class TestMemoryAccessAnalysisState: public MemoryAccessAnalysis::State {
@@ -133,7 +144,7 @@ bool TestMemoryAccessAnalysisState::IsEmpty() const {
     if (!IsEmpty(assm::kRegisters32[r]))
       return false;
   }
-  return true;
+  return indexed_memory_accesses_.empty();
 }
 
 bool TestMemoryAccessAnalysisState::Contains(const assm::Register32& reg,
@@ -229,7 +240,9 @@ TEST(MemoryAccessAnalysisStateTest, ExecuteOperandKind) {
   EXPECT_TRUE(state.IsEmpty());
 
   state.Execute(kWriteWithScale);
-  EXPECT_TRUE(state.IsEmpty());
+  EXPECT_FALSE(state.IsEmpty());
+  EXPECT_FALSE(state.HasNonRedundantAccess(kWriteWithScale));
+  state.Clear();
 
   state.Execute(kWriteDispl);
   EXPECT_TRUE(state.IsEmpty());
@@ -294,6 +307,22 @@ TEST(MemoryAccessAnalysisStateTest, HasNonRedundantAccessOperandKind) {
   EXPECT_TRUE(state.HasNonRedundantAccess(kWriteEax42));
 }
 
+TEST(MemoryAccessAnalysisStateTest, HasNonRedundantIndexedAccess) {
+  TestMemoryAccessAnalysisState state;
+
+  state.Execute(kWriteWithScale);
+
+  // The same base, index, scale and displacement is redundant.
+  EXPECT_FALSE(state.HasNonRedundantAccess(kWriteWithScale));
+  EXPECT_FALSE(state.HasNonRedundantAccess(kReadWithScale));
+
+  // A different scale is another memory location.
+  EXPECT_TRUE(state.HasNonRedundantAccess(kReadWithScale4));
+
+  // Indexed accesses are not confused with base accesses.
+  EXPECT_TRUE(state.HasNonRedundantAccess(kReadEax42));
+}
+
 TEST(MemoryAccessAnalysisStateTest, HasNonRedundantAccessWithPrefix) {
   TestMemoryAccessAnalysisState state;
   state.Execute(kRepMovsb);
@@ -399,6 +428,21 @@ TEST_F(MemoryAccessAnalysisTest, PropagateForwardSimple) {
   EXPECT_TRUE(state_.IsEmpty());
 }
 
+TEST_F(MemoryAccessAnalysisTest, PropagateForwardIndexed) {
+  // Defining the base register kills the indexed access.
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kWriteWithScale));
+  EXPECT_FALSE(state_.HasNonRedundantAccess(kReadWithScale));
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kClearEax));
+  EXPECT_TRUE(state_.IsEmpty());
+
+  // Defining the index register kills the indexed access.
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kWriteWithScale));
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kReadEax));
+  ASSERT_NO_FATAL_FAILURE(PropagateForward(kClearEbx));
+  EXPECT_TRUE(state_.HasNonRedundantAccess(kReadWithScale));
+  EXPECT_TRUE(state_.Contains(assm::eax, 0));
+}
+
 TEST_F(MemoryAccessAnalysisTest, PropagateForwardWithCallRet) {
   ASSERT_NO_FATAL_FAILURE(PropagateForward(kReadEax10));
   EXPECT_TRUE(state_.Contains(assm::eax, 10));
@@ -526,5 +570,221 @@ TEST_F(MemoryAccessAnalysisTest, AnalyzeWithData) {
   EXPECT_TRUE(state_.IsEmpty());
 }
 
+TEST_F(MemoryAccessAnalysisTest, AnalyzeWithMultipleEntries) {
+  BasicBlockSubGraph subgraph;
+
+  BlockDescription* block1 = subgraph.AddBlockDescription(
+      "b1", "b1.obj", BlockGraph::CODE_BLOCK, 7, 2, 42);
+  BlockDescription* block2 = subgraph.AddBlockDescription(
+      "b2", "b2.obj", BlockGraph::CODE_BLOCK, 7, 2, 42);
+
+  BasicCodeBlock* bb1 = subgraph.AddBasicCodeBlock("bb1");
+  BasicCodeBlock* bb2 = subgraph.AddBasicCodeBlock("bb2");
+  block1->basic_block_order.push_back(bb1);
+  block2->basic_block_order.push_back(bb2);
+  AddSuccessorBetween(Successor::kConditionTrue, bb1, bb2);
+
+  BasicBlockAssembler asm_bb1(bb1->instructions().end(), &bb1->instructions());
+  asm_bb1.mov(assm::ecx,
+              Operand(assm::eax, Displacement(1, assm::kSize32Bit)));
+
+  // Analyze the flow graph.
+  memory_access_.Analyze(&subgraph);
+
+  // bb2 may be reached from outside the subgraph without the access of bb1.
+  GetStateAtEntryOf(bb2, &state_);
+  EXPECT_TRUE(state_.IsEmpty());
+}
+
+TEST_F(MemoryAccessAnalysisTest, AnalyzeDominatedIndexedAccess) {
+  BasicBlockSubGraph subgraph;
+
+  BlockDescription* block = subgraph.AddBlockDescription(
+      "b1", "b1.obj", BlockGraph::CODE_BLOCK, 7, 2, 42);
+
+  BasicCodeBlock* bb_if = subgraph.AddBasicCodeBlock("if");
+  BasicCodeBlock* bb_true = subgraph.AddBasicCodeBlock("true");
+  BasicCodeBlock* bb_false = subgraph.AddBasicCodeBlock("false");
+  BasicCodeBlock* bb_end = subgraph.AddBasicCodeBlock("end");
+
+  block->basic_block_order.push_back(bb_if);
+  block->basic_block_order.push_back(bb_true);
+  block->basic_block_order.push_back(bb_false);
+  block->basic_block_order.push_back(bb_end);
+
+  AddSuccessorBetween(Successor::kConditionEqual, bb_if, bb_true);
+  AddSuccessorBetween(Successor::kConditionNotEqual, bb_if, bb_false);
+  AddSuccessorBetween(Successor::kConditionTrue, bb_true, bb_end);
+  AddSuccessorBetween(Successor::kConditionTrue, bb_false, bb_end);
+
+  BasicBlockAssembler asm_if(bb_if->instructions().end(),
+                             &bb_if->instructions());
+  asm_if.mov(assm::ecx, Operand(assm::eax, assm::ebx, assm::kTimes4,
+                                Displacement(8, assm::kSize32Bit)));
+
+  // Only one side of the diamond clobbers the index register.
+  BasicBlockAssembler asm_false(bb_false->instructions().end(),
+                                &bb_false->instructions());
+  asm_false.add(assm::ebx, assm::ecx);
+
+  // Analyze the flow graph.
+  memory_access_.Analyze(&subgraph);
+
+  // The access dominates bb_true without intervening definition.
+  GetStateAtEntryOf(bb_true, &state_);
+  EXPECT_FALSE(state_.IsEmpty());
+
+  // The access does not reach bb_end on every path.
+  GetStateAtEntryOf(bb_end, &state_);
+  EXPECT_TRUE(state_.IsEmpty());
+}
+
+TEST_F(MemoryAccessAnalysisTest, GetLoopInvariantAccesses) {
+  BasicBlockSubGraph subgraph;
+
+  BlockDescription* block = subgraph.AddBlockDescription(
+      "b1", "b1.obj", BlockGraph::CODE_BLOCK, 7, 2, 42);
+
+  BasicCodeBlock* bb_preheader = subgraph.AddBasicCodeBlock("preheader");
+  BasicCodeBlock* bb_header = subgraph.AddBasicCodeBlock("header");
+  BasicCodeBlock* bb_body = subgraph.AddBasicCodeBlock("body");
+  BasicCodeBlock* bb_exit = subgraph.AddBasicCodeBlock("exit");
+
+  block->basic_block_order.push_back(bb_preheader);
+  block->basic_block_order.push_back(bb_header);
+  block->basic_block_order.push_back(bb_body);
+  block->basic_block_order.push_back(bb_exit);
+
+  AddSuccessorBetween(Successor::kConditionTrue, bb_preheader, bb_header);
+  AddSuccessorBetween(Successor::kConditionEqual, bb_header, bb_body);
+  AddSuccessorBetween(Successor::kConditionNotEqual, bb_header, bb_exit);
+  AddSuccessorBetween(Successor::kConditionTrue, bb_body, bb_header);
+
+  // The header reads [esi + 4] and [edi + 8]; the body increments edi.
+  BasicBlockAssembler asm_header(bb_header->instructions().end(),
+                                 &bb_header->instructions());
+  asm_header.mov(assm::ecx,
+                 Operand(assm::esi, Displacement(4, assm::kSize32Bit)));
+  asm_header.mov(assm::edx,
+                 Operand(assm::edi, Displacement(8, assm::kSize32Bit)));
+  BasicBlockAssembler asm_body(bb_body->instructions().end(),
+                               &bb_body->instructions());
+  asm_body.add(assm::edi, assm::ecx);
+
+  memory_access_.Analyze(&subgraph);
+
+  MemoryAccessAnalysis::HoistingMap hoisted;
+  memory_access_.GetLoopInvariantAccesses(&hoisted);
+
+  // Only the access through esi is loop invariant.
+  ASSERT_EQ(1U, hoisted.size());
+  EXPECT_EQ(FirstInstructionOf(bb_header), hoisted.begin()->first);
+  EXPECT_EQ(bb_preheader, hoisted.begin()->second);
+
+  // A call in the loop may free the memory, so nothing is hoisted.
+  asm_body.call(Operand(assm::eax));
+  memory_access_.Analyze(&subgraph);
+  memory_access_.GetLoopInvariantAccesses(&hoisted);
+  EXPECT_TRUE(hoisted.empty());
+}
+
+TEST_F(MemoryAccessAnalysisTest, DoNotHoistOutOfEntryPointHeader) {
+  static const uint8_t kEmptyData[4] = {};
+  BasicBlockSubGraph subgraph;
+
+  BlockDescription* block = subgraph.AddBlockDescription(
+      "b1", "b1.obj", BlockGraph::CODE_BLOCK, 7, 2, 42);
+
+  BasicCodeBlock* bb_preheader = subgraph.AddBasicCodeBlock("preheader");
+  BasicCodeBlock* bb_header = subgraph.AddBasicCodeBlock("header");
+  BasicCodeBlock* bb_body = subgraph.AddBasicCodeBlock("body");
+  BasicCodeBlock* bb_exit = subgraph.AddBasicCodeBlock("exit");
+
+  block->basic_block_order.push_back(bb_preheader);
+  block->basic_block_order.push_back(bb_header);
+  block->basic_block_order.push_back(bb_body);
+  block->basic_block_order.push_back(bb_exit);
+
+  AddSuccessorBetween(Successor::kConditionTrue, bb_preheader, bb_header);
+  AddSuccessorBetween(Successor::kConditionEqual, bb_header, bb_body);
+  AddSuccessorBetween(Successor::kConditionNotEqual, bb_header, bb_exit);
+  AddSuccessorBetween(Successor::kConditionTrue, bb_body, bb_header);
+
+  // The header is also the target of a jump table.
+  BasicDataBlock* table = subgraph.AddBasicDataBlock(
+      "table", sizeof(kEmptyData), kEmptyData);
+  ASSERT_TRUE(table->references().insert(std::make_pair(
+      0, BasicBlockReference(BlockGraph::ABSOLUTE_REF, 4, bb_header))).second);
+
+  BasicBlockAssembler asm_header(bb_header->instructions().end(),
+                                 &bb_header->instructions());
+  asm_header.mov(assm::ecx,
+                 Operand(assm::esi, Displacement(4, assm::kSize32Bit)));
+
+  memory_access_.Analyze(&subgraph);
+
+  MemoryAccessAnalysis::HoistingMap hoisted;
+  memory_access_.GetLoopInvariantAccesses(&hoisted);
+  EXPECT_TRUE(hoisted.empty());
+}
+
+TEST_F(MemoryAccessAnalysisTest, UncheckedBasicBlocks) {
+  BasicBlockSubGraph subgraph;
+
+  BlockDescription* block = subgraph.AddBlockDescription(
+      "b1", "b1.obj", BlockGraph::CODE_BLOCK, 7, 2, 42);
+
+  BasicCodeBlock* bb_preheader = subgraph.AddBasicCodeBlock("preheader");
+  BasicCodeBlock* bb_header = subgraph.AddBasicCodeBlock("header");
+  BasicCodeBlock* bb_body = subgraph.AddBasicCodeBlock("body");
+  BasicCodeBlock* bb_exit = subgraph.AddBasicCodeBlock("exit");
+
+  block->basic_block_order.push_back(bb_preheader);
+  block->basic_block_order.push_back(bb_header);
+  block->basic_block_order.push_back(bb_body);
+  block->basic_block_order.push_back(bb_exit);
+
+  AddSuccessorBetween(Successor::kConditionTrue, bb_preheader, bb_header);
+  AddSuccessorBetween(Successor::kConditionEqual, bb_header, bb_body);
+  AddSuccessorBetween(Successor::kConditionNotEqual, bb_header, bb_exit);
+  AddSuccessorBetween(Successor::kConditionTrue, bb_body, bb_header);
+
+  // The preheader and the header read [esi + 4].
+  BasicBlockAssembler asm_preheader(bb_preheader->instructions().end(),
+                                    &bb_preheader->instructions());
+  asm_preheader.mov(assm::ecx,
+                    Operand(assm::esi, Displacement(4, assm::kSize32Bit)));
+  BasicBlockAssembler asm_header(bb_header->instructions().end(),
+                                 &bb_header->instructions());
+  asm_header.mov(assm::edx,
+                 Operand(assm::esi, Displacement(4, assm::kSize32Bit)));
+
+  // The access of a checked preheader covers the loop.
+  memory_access_.Analyze(&subgraph);
+  GetStateAtEntryOf(bb_header, &state_);
+  EXPECT_FALSE(state_.IsEmpty());
+
+  // The access of an unchecked preheader doesn't, and no check is hoisted
+  // into it.
+  MemoryAccessAnalysis::BasicBlockSet unchecked;
+  unchecked.insert(bb_preheader);
+  memory_access_.Analyze(&subgraph, unchecked);
+  GetStateAtEntryOf(bb_header, &state_);
+  EXPECT_TRUE(state_.IsEmpty());
+  GetStateAtEntryOf(bb_exit, &state_);
+  EXPECT_FALSE(state_.IsEmpty());
+
+  MemoryAccessAnalysis::HoistingMap hoisted;
+  memory_access_.GetLoopInvariantAccesses(&hoisted);
+  EXPECT_TRUE(hoisted.empty());
+
+  // The checks of an unchecked header aren't hoisted either.
+  unchecked.clear();
+  unchecked.insert(bb_header);
+  memory_access_.Analyze(&subgraph, unchecked);
+  memory_access_.GetLoopInvariantAccesses(&hoisted);
+  EXPECT_TRUE(hoisted.empty());
+}
+
 }  // namespace analysis
 }  // namespace block_graph
@@ -125,6 +125,43 @@ bool ReadIgnoredStackIdsFromCommandLine(const base::CommandLine& cmd_line,
   return true;
 }
 
+// The names of the quarantine checksum strategies on the command-line,
+// indexed by QuarantineChecksumStrategy.
+const char* const kQuarantineChecksumStrategyNames[] = {
+    "full", "sampled", "header",
+};
+static_assert(arraysize(kQuarantineChecksumStrategyNames) ==
+                  kQuarantineChecksumStrategyMax,
+              "Quarantine checksum strategy names out of date.");
+
+// Try to update a quarantine checksum strategy from a command-line. The
+// strategy is expected to be given by name.
+// @param cmd_line The command line to parse.
+// @param param_name The parameter that we want to read.
+// @param value Will receive the parsed value.
+// @returns true on success, false otherwise.
+bool ReadQuarantineChecksumStrategyFromCommandLine(
+    const base::CommandLine& cmd_line,
+    const std::string& param_name,
+    uint32_t* value) {
+  DCHECK(value != NULL);
+  if (!cmd_line.HasSwitch(param_name))
+    return true;
+
+  std::string value_str = cmd_line.GetSwitchValueASCII(param_name);
+  for (uint32_t i = 0; i < kQuarantineChecksumStrategyMax; ++i) {
+    if (value_str == kQuarantineChecksumStrategyNames[i]) {
+      VLOG(1) << "Set \"" << param_name << "\" to " << value_str << ".";
+      *value = i;
+      return true;
+    }
+  }
+
+  LOG(ERROR) << "Failed to parse \"" << param_name << "\" value of \""
+             << value_str << "\".";
+  return false;
+}
+
 }  // namespace
 
 // SYZYgy Asan Runtime Options.
@@ -154,6 +191,8 @@ const bool kDefaultDisableBreakpadReporting = false;
 const bool kDefaultFeatureRandomization = false;
 const bool kDefaultReportInvalidAccesses = false;
 const bool kDefaultDeferCrashReporterInitialization = false;
+const uint32_t kDefaultStatsReportingPeriod = 0;
+const uint32_t kDefaultBackgroundHeapCheckPeriod = 0;
 
 // Default values of AsanLogger parameters.
 const bool kDefaultMiniDumpOnFailure = false;
@@ -169,6 +208,9 @@ const bool kDefaultEnableZebraBlockHeap = false;
 const bool kDefaultEnableAllocationFilter = false;
 const float kDefaultQuarantineFloodFillRate = 0.5f;
 const bool kDefaultPreventDuplicateCorruptionCrashes = false;
+const bool kDefaultEnableThreadCaches = false;
+const QuarantineChecksumStrategy kDefaultQuarantineChecksumStrategy =
+    kQuarantineChecksumFullBody;
 
 // Default values of LargeBlockHeap parameters.
 extern const bool kDefaultEnableLargeBlockHeap = true;
@@ -201,6 +243,8 @@ const char kParamFeatureRandomization[] = "feature_randomization";
 const char kParamReportInvalidAccesses[] = "report_invalid_accesses";
 const char kParamDeferCrashReporterInitialization[] =
     "defer_crash_reporter_initialization";
+const char kParamStatsReportingPeriod[] = "stats_reporting_period";
+const char kParamBackgroundHeapCheckPeriod[] = "background_heap_check_period";
 
 // String names of AsanLogger parameters.
 const char kParamMiniDumpOnFailure[] = "minidump_on_failure";
@@ -218,6 +262,8 @@ const char kParamEnableAllocationFilter[] = "enable_allocation_filter";
 const char kParamQuarantineFloodFillRate[] = "quarantine_flood_fill_rate";
 const char kParamPreventDuplicateCorruptionCrashes[] =
     "prevent_duplicate_corruption_crashes";
+const char kParamThreadCaches[] = "thread_caches";
+const char kParamQuarantineChecksumStrategy[] = "quarantine_checksum";
 
 // String names of LargeBlockHeap parameters.
 const char kParamDisableLargeBlockHeap[] = "disable_large_block_heap";
@@ -307,13 +353,20 @@ void SetDefaultAsanParameters(AsanParameters* asan_parameters) {
   asan_parameters->report_invalid_accesses = kDefaultReportInvalidAccesses;
   asan_parameters->defer_crash_reporter_initialization =
       kDefaultDeferCrashReporterInitialization;
+  asan_parameters->enable_thread_caches = kDefaultEnableThreadCaches;
+  asan_parameters->quarantine_checksum_strategy =
+      kDefaultQuarantineChecksumStrategy;
+  asan_parameters->stats_reporting_period = kDefaultStatsReportingPeriod;
+  asan_parameters->background_heap_check_period =
+      kDefaultBackgroundHeapCheckPeriod;
 }
 
 bool InflateAsanParameters(const AsanParameters* pod_params,
                            InflatedAsanParameters* inflated_params) {
   // This must be kept up to date with AsanParameters as it evolves.
   static const size_t kSizeOfAsanParametersByVersion[] = {
-      40, 44, 48, 52, 52, 52, 56, 56, 56, 56, 60, 60, 60, 60, 60, 60};
+      40, 44, 48, 52, 52, 52, 56, 56, 56, 56, 60, 60, 60, 60, 60, 60, 60,
+      64, 68, 72};
   static_assert(
       arraysize(kSizeOfAsanParametersByVersion) == kAsanParametersVersion + 1,
       "Size of parameters version out of date.");
@@ -448,6 +501,18 @@ bool ParseAsanParameters(const base::StringPiece16& param_string,
     return false;
   }
 
+  // Parse the stats reporting period flag.
+  if (UpdateUint32FromCommandLine::Do(cmd_line, kParamStatsReportingPeriod,
+          &asan_parameters->stats_reporting_period) == kFlagError) {
+    return false;
+  }
+
+  // Parse the background heap check period flag.
+  if (UpdateUint32FromCommandLine::Do(cmd_line, kParamBackgroundHeapCheckPeriod,
+          &asan_parameters->background_heap_check_period) == kFlagError) {
+    return false;
+  }
+
   // Parse the bottom frames to skip flag.
   if (UpdateUint32FromCommandLine::Do(cmd_line, kParamBottomFramesToSkip,
           &asan_parameters->bottom_frames_to_skip) == kFlagError) {
@@ -493,6 +558,13 @@ bool ParseAsanParameters(const base::StringPiece16& param_string,
     return false;
   }
 
+  // Parse the quarantine checksum strategy.
+  if (!ReadQuarantineChecksumStrategyFromCommandLine(cmd_line,
+           kParamQuarantineChecksumStrategy,
+           &asan_parameters->quarantine_checksum_strategy)) {
+    return false;
+  }
+
   // Parse the other (boolean) flags.
   // TODO(chrisha): Transition these all to new style flags.
   if (cmd_line.HasSwitch(kParamMiniDumpOnFailure))
@@ -526,6 +598,8 @@ bool ParseAsanParameters(const base::StringPiece16& param_string,
   bool value = false;
   if (ParseBooleanFlag(kParamFeatureRandomization, cmd_line, &value))
     asan_parameters->feature_randomization = value;
+  if (ParseBooleanFlag(kParamThreadCaches, cmd_line, &value))
+    asan_parameters->enable_thread_caches = value;
 
   return true;
 }
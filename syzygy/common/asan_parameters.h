@@ -36,7 +36,20 @@ namespace common {
 // the StackCaptureCache.
 typedef uint32_t AsanStackId;
 
-static const size_t kAsanParametersReserved1Bits = 19;
+static const size_t kAsanParametersReserved1Bits = 18;
+
+// The ways in which the blocks in the quarantine can be checksummed. These
+// trade the detection of write-after-frees for speed.
+enum QuarantineChecksumStrategy : uint32_t {
+  // The whole block is checksummed.
+  kQuarantineChecksumFullBody,
+  // The header and trailer are checksummed, along with regularly spaced
+  // samples of the body.
+  kQuarantineChecksumSampledBody,
+  // Only the header and trailer are checksummed.
+  kQuarantineChecksumHeaderOnly,
+  kQuarantineChecksumStrategyMax,
+};
 
 // This data structure is injected into an instrumented image in a read-only
 // section. It is initialized by the instrumenter, and will be looked up at
@@ -119,6 +132,9 @@ struct AsanParameters {
       // Runtime: Defer the crash reporter initialization, the client has to
       // manually call the crash reporter initialization function.
       unsigned defer_crash_reporter_initialization : 1;
+      // BlockHeapManager: Indicates if the small allocations and frees should
+      // go through per-thread caches.
+      unsigned enable_thread_caches : 1;
 
       // Add new flags here!
 
@@ -148,27 +164,41 @@ struct AsanParameters {
   // 0.0 corresponds to this being disabled entirely.
   float quarantine_flood_fill_rate;
 
+  // BlockHeapManager: The QuarantineChecksumStrategy used for the blocks in
+  // the quarantine.
+  uint32_t quarantine_checksum_strategy;
+
+  // AsanRuntime: The number of seconds between two reports of the runtime
+  // statistics to the logger. A value of zero means no periodic reports are
+  // generated.
+  uint32_t stats_reporting_period;
+
+  // AsanRuntime: The number of milliseconds between two slices of the heap
+  // checked by the background heap checker. A value of zero means the heap
+  // isn't checked in the background.
+  uint32_t background_heap_check_period;
+
   // Add new parameters here!
 
   // When laid out in memory the ignored_stack_ids are present here as a NULL
   // terminated vector.
 };
 #ifndef _WIN64
-COMPILE_ASSERT_IS_POD_OF_SIZE(AsanParameters, 60);
+COMPILE_ASSERT_IS_POD_OF_SIZE(AsanParameters, 72);
 #else
-COMPILE_ASSERT_IS_POD_OF_SIZE(AsanParameters, 64);
+COMPILE_ASSERT_IS_POD_OF_SIZE(AsanParameters, 76);
 #endif
 
 // The current version of the Asan parameters structure. This must be updated
 // if any changes are made to the above structure! This is defined in the header
 // file to allow compile time assertions against this version number.
-const uint32_t kAsanParametersVersion = 15;
+const uint32_t kAsanParametersVersion = 19;
 
 // If the number of free bits in the parameters struct changes, then the
 // version has to change as well. This is simply here to make sure that
 // everything changes in lockstep.
-static_assert(kAsanParametersReserved1Bits == 19 &&
-                  kAsanParametersVersion == 15,
+static_assert(kAsanParametersReserved1Bits == 18 &&
+                  kAsanParametersVersion == 19,
               "Version must change if reserved bits changes.");
 
 // The name of the section that will be injected into an instrumented image,
@@ -241,6 +271,8 @@ extern const bool kDefaultDisableBreakpadReporting;
 extern const bool kDefaultFeatureRandomization;
 extern const bool kDefaultReportInvalidAccesses;
 extern const bool kDefaultDeferCrashReporterInitialization;
+extern const uint32_t kDefaultStatsReportingPeriod;
+extern const uint32_t kDefaultBackgroundHeapCheckPeriod;
 // Default values of AsanLogger parameters.
 extern const bool kDefaultMiniDumpOnFailure;
 extern const bool kDefaultLogAsText;
@@ -252,6 +284,8 @@ extern const bool kDefaultEnableZebraBlockHeap;
 extern const bool kDefaultEnableAllocationFilter;
 extern const float kDefaultQuarantineFloodFillRate;
 extern const bool kDefaultPreventDuplicateCorruptionCrashes;
+extern const bool kDefaultEnableThreadCaches;
+extern const QuarantineChecksumStrategy kDefaultQuarantineChecksumStrategy;
 // Default values of LargeBlockHeap parameters.
 extern const bool kDefaultEnableLargeBlockHeap;
 extern const size_t kDefaultLargeAllocationThreshold;
@@ -277,6 +311,8 @@ extern const char kParamDisableBreakpadReporting[];
 extern const char kParamFeatureRandomization[];
 extern const char kParamReportInvalidAccesses[];
 extern const char kParamDeferCrashReporterInitialization[];
+extern const char kParamStatsReportingPeriod[];
+extern const char kParamBackgroundHeapCheckPeriod[];
 // String names of AsanLogger parameters.
 extern const char kParamMiniDumpOnFailure[];
 extern const char kParamLogAsText[];
@@ -289,6 +325,8 @@ extern const char kParamEnableZebraBlockHeap[];
 extern const char kParamEnableAllocationFilter[];
 extern const char kParamQuarantineFloodFillRate[];
 extern const char kParamPreventDuplicateCorruptionCrashes[];
+extern const char kParamThreadCaches[];
+extern const char kParamQuarantineChecksumStrategy[];
 // String names of LargeBlockHeap parameters.
 extern const char kParamDisableLargeBlockHeap[];
 extern const char kParamLargeAllocationThreshold[];
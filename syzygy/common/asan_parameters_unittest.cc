@@ -98,6 +98,13 @@ TEST(AsanParametersTest, SetDefaultAsanParameters) {
             static_cast<bool>(aparams.report_invalid_accesses));
   EXPECT_EQ(kDefaultDeferCrashReporterInitialization,
             static_cast<bool>(aparams.defer_crash_reporter_initialization));
+  EXPECT_EQ(kDefaultEnableThreadCaches,
+            static_cast<bool>(aparams.enable_thread_caches));
+  EXPECT_EQ(kDefaultQuarantineChecksumStrategy,
+            aparams.quarantine_checksum_strategy);
+  EXPECT_EQ(kDefaultStatsReportingPeriod, aparams.stats_reporting_period);
+  EXPECT_EQ(kDefaultBackgroundHeapCheckPeriod,
+            aparams.background_heap_check_period);
 }
 
 TEST(AsanParametersTest, InflateAsanParametersStackIdsPastEnd) {
@@ -206,6 +213,12 @@ TEST(AsanParametersTest, ParseAsanParametersInvalidStackId) {
   EXPECT_FALSE(ParseAsanParameters(kParams, &iparams));
 }
 
+TEST(AsanParametersTest, ParseAsanParametersInvalidChecksumStrategy) {
+  static const wchar_t kParams[] = L"--quarantine_checksum=foo";
+  InflatedAsanParameters iparams;
+  EXPECT_FALSE(ParseAsanParameters(kParams, &iparams));
+}
+
 TEST(AsanParametersTest, ParseAsanParametersMinimal) {
   static const wchar_t kParams[] = L"";
 
@@ -255,6 +268,13 @@ TEST(AsanParametersTest, ParseAsanParametersMinimal) {
             static_cast<bool>(iparams.report_invalid_accesses));
   EXPECT_EQ(kDefaultDeferCrashReporterInitialization,
             static_cast<bool>(iparams.defer_crash_reporter_initialization));
+  EXPECT_EQ(kDefaultEnableThreadCaches,
+            static_cast<bool>(iparams.enable_thread_caches));
+  EXPECT_EQ(kDefaultQuarantineChecksumStrategy,
+            iparams.quarantine_checksum_strategy);
+  EXPECT_EQ(kDefaultStatsReportingPeriod, iparams.stats_reporting_period);
+  EXPECT_EQ(kDefaultBackgroundHeapCheckPeriod,
+            iparams.background_heap_check_period);
 }
 
 TEST(AsanParametersTest, ParseAsanParametersMaximal) {
@@ -283,7 +303,11 @@ TEST(AsanParametersTest, ParseAsanParametersMaximal) {
       L"--enable_feature_randomization "
       L"--prevent_duplicate_corruption_crashes "
       L"--report_invalid_accesses "
-      L"--defer_crash_reporter_initialization";
+      L"--defer_crash_reporter_initialization "
+      L"--enable_thread_caches "
+      L"--quarantine_checksum=sampled "
+      L"--stats_reporting_period=60 "
+      L"--background_heap_check_period=100";
 
   InflatedAsanParameters iparams;
   SetDefaultAsanParameters(&iparams);
@@ -320,6 +344,11 @@ TEST(AsanParametersTest, ParseAsanParametersMaximal) {
   EXPECT_EQ(true, static_cast<bool>(iparams.report_invalid_accesses));
   EXPECT_EQ(true,
             static_cast<bool>(iparams.defer_crash_reporter_initialization));
+  EXPECT_EQ(true, static_cast<bool>(iparams.enable_thread_caches));
+  EXPECT_EQ(kQuarantineChecksumSampledBody,
+            iparams.quarantine_checksum_strategy);
+  EXPECT_EQ(60, iparams.stats_reporting_period);
+  EXPECT_EQ(100, iparams.background_heap_check_period);
 }
 
 }  // namespace common
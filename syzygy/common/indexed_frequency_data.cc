@@ -29,6 +29,8 @@ const uint32_t kBranchFrequencyDataVersion = 1;
 const uint32_t kJumpTableFrequencyDataVersion = 1;
 
 const char kBasicBlockRangesStreamName[] = "/Syzygy/BasicBlockRanges";
+const char kBasicBlockCoverageMapStreamName[] =
+    "/Syzygy/BasicBlockCoverageMap";
 
 // This must be kept in sync with IndexedFrequencyDataType::DataType.
 const char* IndexedFrequencyDataTypeName[] = {
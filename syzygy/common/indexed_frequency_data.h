@@ -133,6 +133,12 @@ extern const uint32_t kJumpTableFrequencyDataVersion;
 // any instrumentation employing basic-block trace data.
 extern const char kBasicBlockRangesStreamName[];
 
+// The name of the stream added to the PDB by the coverage instrumentation when
+// only a subset of the basic blocks is probed. It holds, for each basic block,
+// a uint32_t count followed by the uint32_t indices of that many probed basic
+// blocks. The basic block was visited iff any of them was.
+extern const char kBasicBlockCoverageMapStreamName[];
+
 // A string table mapping from DataType to text representation.
 // This array must be maintained if enum DataType is changed.
 extern const char* IndexedFrequencyDataTypeName[];
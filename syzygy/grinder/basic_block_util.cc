@@ -31,62 +31,6 @@
 namespace grinder {
 namespace basic_block_util {
 
-bool ModuleIdentityComparator::operator()(const ModuleInformation& lhs,
-                                          const ModuleInformation& rhs) const {
-  if (lhs.module_size < rhs.module_size)
-    return true;
-  if (lhs.module_size > rhs.module_size)
-    return false;
-
-  if (lhs.module_time_date_stamp < rhs.module_time_date_stamp)
-    return true;
-  if (lhs.module_time_date_stamp > rhs.module_time_date_stamp)
-    return false;
-
-  return lhs.path < rhs.path;
-}
-
-bool operator==(const IndexedFrequencyInformation& lhs,
-                const IndexedFrequencyInformation& rhs) {
-  return lhs.num_entries == rhs.num_entries &&
-      lhs.num_columns == rhs.num_columns &&
-      lhs.data_type == rhs.data_type &&
-      lhs.frequency_map == rhs.frequency_map;
-}
-
-bool FindIndexedFrequencyInfo(
-    const pe::PEFile::Signature& signature,
-    const ModuleIndexedFrequencyMap& module_entry_map,
-    const IndexedFrequencyInformation** information) {
-  DCHECK(information != NULL);
-  *information = NULL;
-
-  // Find exactly one consistent entry count vector in the map.
-  const IndexedFrequencyInformation* result = NULL;
-  ModuleIndexedFrequencyMap::const_iterator it = module_entry_map.begin();
-  for (; it != module_entry_map.end(); ++it) {
-    const pe::PEFile::Signature candidate(it->first);
-    if (candidate.IsConsistent(signature)) {
-      if (result != NULL) {
-        LOG(ERROR) << "Found multiple module instances in the "
-                   << "indexed frequency map.";
-        return false;
-      }
-      result = &it->second;
-    }
-  }
-
-  // Handle the case where there is no consistent module found.
-  if (result == NULL) {
-    LOG(ERROR) << "Did not find module in the entry count map.";
-    return false;
-  }
-
-  // Return the entry counts that were found.
-  *information = result;
-  return true;
-}
-
 bool LoadBranchStatisticsFromFile(const base::FilePath& file,
                                   const pe::PEFile::Signature& signature,
                                   IndexedFrequencyMap* frequencies) {
@@ -173,6 +117,86 @@ bool LoadBasicBlockRanges(const base::FilePath& pdb_path,
   return true;
 }
 
+bool LoadBasicBlockCoverageMap(const base::FilePath& pdb_path,
+                               std::vector<uint32_t>* encoded_bb_coverage_map) {
+  DCHECK(!pdb_path.empty());
+  DCHECK(encoded_bb_coverage_map != NULL);
+
+  encoded_bb_coverage_map->clear();
+
+  // Read the PDB file.
+  pdb::PdbReader pdb_reader;
+  pdb::PdbFile pdb_file;
+  if (!pdb_reader.Read(pdb_path, &pdb_file)) {
+    LOG(ERROR) << "Failed to read PDB: " << pdb_path.value();
+    return false;
+  }
+
+  // Get the name-stream map from the PDB.
+  pdb::PdbInfoHeader70 pdb_header = {};
+  pdb::NameStreamMap name_stream_map;
+  if (!pdb::ReadHeaderInfoStream(pdb_file, &pdb_header, &name_stream_map)) {
+    LOG(ERROR) << "Failed to read PDB header info stream: " << pdb_path.value();
+    return false;
+  }
+
+  // The stream is only present if a subset of the basic blocks was probed.
+  pdb::NameStreamMap::const_iterator name_it = name_stream_map.find(
+      common::kBasicBlockCoverageMapStreamName);
+  if (name_it == name_stream_map.end())
+    return true;
+  scoped_refptr<pdb::PdbStream> bb_coverage_map_stream;
+  bb_coverage_map_stream = pdb_file.GetStream(name_it->second);
+  if (bb_coverage_map_stream.get() == NULL) {
+    LOG(ERROR) << "PDB basic block coverage map stream has invalid index: "
+               << name_it->second;
+    return false;
+  }
+
+  pdb::PdbStreamReaderWithPosition reader(bb_coverage_map_stream.get());
+  common::BinaryStreamParser parser(&reader);
+  size_t num_elements = bb_coverage_map_stream->length() / sizeof(uint32_t);
+  if (!parser.ReadMultiple(num_elements, encoded_bb_coverage_map) ||
+      !reader.AtEnd()) {
+    LOG(ERROR) << "Failed to read basic block coverage map stream from PDB: "
+               << pdb_path.value();
+    return false;
+  }
+
+  return true;
+}
+
+bool DecodeBasicBlockCoverageMap(
+    const std::vector<uint32_t>& encoded_bb_coverage_map,
+    size_t num_basic_blocks,
+    BasicBlockCoverageMap* bb_coverage_map) {
+  DCHECK(bb_coverage_map != NULL);
+
+  bb_coverage_map->clear();
+  bb_coverage_map->reserve(num_basic_blocks);
+
+  // Each basic block has a non-empty list of probes, given by a count followed
+  // by the probe indices.
+  size_t pos = 0;
+  while (pos < encoded_bb_coverage_map.size()) {
+    size_t count = encoded_bb_coverage_map[pos++];
+    if (count == 0 || count > encoded_bb_coverage_map.size() - pos)
+      return false;
+    std::vector<uint32_t> probes(encoded_bb_coverage_map.begin() + pos,
+                                 encoded_bb_coverage_map.begin() + pos + count);
+    pos += count;
+    if (std::any_of(probes.begin(), probes.end(),
+                    [num_basic_blocks](uint32_t probe) {
+                      return probe >= num_basic_blocks;
+                    })) {
+      return false;
+    }
+    bb_coverage_map->push_back(probes);
+  }
+
+  return bb_coverage_map->size() == num_basic_blocks;
+}
+
 bool LoadPdbInfo(PdbInfoMap* pdb_info_cache,
                  const ModuleInformation& module_info,
                  PdbInfo** pdb_info) {
@@ -214,6 +238,17 @@ bool LoadPdbInfo(PdbInfoMap* pdb_info_cache,
   if (!LoadBasicBlockRanges(pdb_path, &pdb_info_ref.bb_ranges)) {
     return false;
   }
+  std::vector<uint32_t> encoded_bb_coverage_map;
+  if (!LoadBasicBlockCoverageMap(pdb_path, &encoded_bb_coverage_map))
+    return false;
+  if (!encoded_bb_coverage_map.empty() &&
+      !DecodeBasicBlockCoverageMap(encoded_bb_coverage_map,
+                                   pdb_info_ref.bb_ranges.size(),
+                                   &pdb_info_ref.bb_coverage_map)) {
+    LOG(ERROR) << "Invalid basic block coverage map in PDB file: "
+               << pdb_path.value();
+    return false;
+  }
 
   // Populate the pdb_path field of pdb_info_ref, which marks the cached
   // entry as valid.
@@ -256,5 +291,20 @@ uint32_t GetFrequency(const TraceIndexedFrequencyData* data,
   return 0;
 }
 
+uint32_t GetCoverageFrequency(const TraceIndexedFrequencyData* data,
+                              const BasicBlockCoverageMap& bb_coverage_map,
+                              size_t bb_id) {
+  DCHECK(data != NULL);
+
+  if (bb_coverage_map.empty())
+    return GetFrequency(data, bb_id, 0);
+
+  DCHECK_LT(bb_id, bb_coverage_map.size());
+  uint32_t frequency = 0;
+  for (uint32_t probe : bb_coverage_map[bb_id])
+    frequency = std::max(frequency, GetFrequency(data, probe, 0));
+  return frequency;
+}
+
 }  // namespace basic_block_util
 }  // namespace grinder
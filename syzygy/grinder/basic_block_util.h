@@ -23,6 +23,7 @@
 
 #include "base/files/file_path.h"
 #include "syzygy/common/indexed_frequency_data.h"
+#include "syzygy/grinder/indexed_frequency_map.h"
 #include "syzygy/grinder/line_info.h"
 #include "syzygy/pe/pe_file.h"
 #include "syzygy/trace/protocol/call_trace_defs.h"
@@ -31,46 +32,18 @@ namespace grinder {
 namespace basic_block_util {
 
 // Address related types.
-typedef core::RelativeAddress RelativeAddress;
 typedef core::AddressRange<RelativeAddress, size_t> RelativeAddressRange;
 typedef std::vector<RelativeAddressRange> RelativeAddressRangeVector;
 
-// Module information.
-typedef pe::ModuleInformation ModuleInformation;
-
-// Compares module information on identity properties alone.
-struct ModuleIdentityComparator {
-  bool operator()(const ModuleInformation& lhs,
-                  const ModuleInformation& rhs) const;
-};
-
 // Type definitions for the basic block entry count data.
-typedef int32_t EntryCountType;
 typedef int32_t BasicBlockOffset;
 // An entry count map maps from the relative virtual address of the first
 // instruction or data byte in the basic block, to its entry count.
 typedef std::map<BasicBlockOffset, EntryCountType> EntryCountMap;
 
-// Type definitions for the indexed frequency data.
-typedef std::pair<RelativeAddress, size_t> IndexedFrequencyOffset;
-typedef std::map<IndexedFrequencyOffset, EntryCountType> IndexedFrequencyMap;
-// The information kept for each module.
-struct IndexedFrequencyInformation {
-  uint32_t num_entries;
-  uint32_t num_columns;
-  common::IndexedFrequencyData::DataType data_type;
-  uint8_t frequency_size;
-  IndexedFrequencyMap frequency_map;
-};
-
-bool operator==(const IndexedFrequencyInformation& lhs,
-                const IndexedFrequencyInformation& rhs);
-
-// An indexed frequency map maps from the relative virtual address of the first
-// instruction or data byte in the basic block, to its frequencies.
-typedef std::map<ModuleInformation,
-                 IndexedFrequencyInformation,
-                 ModuleIdentityComparator> ModuleIndexedFrequencyMap;
+// For each basic block, the indices of the probed basic blocks whose visits
+// imply its visit. A basic block was visited iff any of them was.
+typedef std::vector<std::vector<uint32_t>> BasicBlockCoverageMap;
 
 // This structure holds the information extracted from a PDB file for a
 // given module.
@@ -85,17 +58,16 @@ struct PdbInfo {
   // Basic-block addresses for the module associated with a particular PDB.
   // Used to transform basic-block frequency data to line visits via line_info.
   RelativeAddressRangeVector bb_ranges;
+
+  // The probes implying the visit of each basic block. This is empty if every
+  // basic block was probed.
+  BasicBlockCoverageMap bb_coverage_map;
 };
 
 typedef std::map<ModuleInformation,
                  PdbInfo,
                  ModuleIdentityComparator> PdbInfoMap;
 
-bool FindIndexedFrequencyInfo(
-    const pe::PEFile::Signature& signature,
-    const ModuleIndexedFrequencyMap& module_entry_map,
-    const IndexedFrequencyInformation** information);
-
 // A helper function to populate @p frequencies from a branching file for a
 // given module signature.
 // @param file the file containing branching information.
@@ -112,6 +84,24 @@ bool LoadBranchStatisticsFromFile(const base::FilePath& file,
 bool LoadBasicBlockRanges(const base::FilePath& pdb_path,
                           RelativeAddressRangeVector* bb_ranges);
 
+// A helper function to populate @p encoded_bb_coverage_map from the PDB file
+// given by @p pdb_path. The map is left empty if the PDB has no coverage map
+// stream.
+// @returns true on success, false otherwise.
+bool LoadBasicBlockCoverageMap(const base::FilePath& pdb_path,
+                               std::vector<uint32_t>* encoded_bb_coverage_map);
+
+// Decodes a basic block coverage map, as stored in the PDB stream named
+// common::kBasicBlockCoverageMapStreamName.
+// @param encoded_bb_coverage_map The contents of the stream.
+// @param num_basic_blocks The number of basic blocks of the module.
+// @param bb_coverage_map Receives the decoded map.
+// @returns true on success, false if the map is malformed.
+bool DecodeBasicBlockCoverageMap(
+    const std::vector<uint32_t>& encoded_bb_coverage_map,
+    size_t num_basic_blocks,
+    BasicBlockCoverageMap* bb_coverage_map);
+
 // Loads a new or retrieves the cached PDB info for the given module. This
 // also caches failures; it will not re-attempt to look up PDB information
 // if a previous attempt for the same module failed.
@@ -132,6 +122,14 @@ uint32_t GetFrequency(const TraceIndexedFrequencyData* data,
                       size_t bb_id,
                       size_t column);
 
+// @returns the coverage frequency contained in @p data for the basic block
+//     given by @p bb_id. This is the largest frequency of the probes implying
+//     its visit, as given by @p bb_coverage_map, or its own frequency if
+//     @p bb_coverage_map is empty.
+uint32_t GetCoverageFrequency(const TraceIndexedFrequencyData* data,
+                              const BasicBlockCoverageMap& bb_coverage_map,
+                              size_t bb_id);
+
 }  // namespace basic_block_util
 }  // namespace grinder
 
@@ -252,6 +252,52 @@ TEST(GrinderBasicBlockUtilTest, LoadBasicBlockRanges) {
   EXPECT_TRUE(LoadBasicBlockRanges(right_pdb, &bb_ranges));
 }
 
+TEST(GrinderBasicBlockUtilTest, LoadBasicBlockCoverageMap) {
+  std::vector<uint32_t> bb_coverage_map(1, 0);
+
+  base::FilePath wrong_file_type(GetExeTestDataRelativePath(
+      testing::kCoverageTraceFiles[0]));
+  EXPECT_FALSE(LoadBasicBlockCoverageMap(wrong_file_type, &bb_coverage_map));
+
+  // The map is optional, and is left empty when every basic block is probed.
+  base::FilePath right_pdb(GetExeTestDataRelativePath(
+      testing::kCoverageInstrumentedTestDllPdbName));
+  EXPECT_TRUE(LoadBasicBlockCoverageMap(right_pdb, &bb_coverage_map));
+  EXPECT_TRUE(bb_coverage_map.empty());
+}
+
+TEST(GrinderBasicBlockUtilTest, DecodeBasicBlockCoverageMap) {
+  BasicBlockCoverageMap bb_coverage_map;
+
+  // Basic block 0 is implied by probes 1 and 2, which imply themselves.
+  static const uint32_t kValid[] = { 2, 1, 2, 1, 1, 1, 2 };
+  std::vector<uint32_t> encoded(kValid, kValid + arraysize(kValid));
+  ASSERT_TRUE(DecodeBasicBlockCoverageMap(encoded, 3, &bb_coverage_map));
+  ASSERT_EQ(3U, bb_coverage_map.size());
+  EXPECT_THAT(bb_coverage_map[0], testing::ElementsAre(1, 2));
+  EXPECT_THAT(bb_coverage_map[1], testing::ElementsAre(1));
+  EXPECT_THAT(bb_coverage_map[2], testing::ElementsAre(2));
+
+  // Too few or too many basic blocks.
+  EXPECT_FALSE(DecodeBasicBlockCoverageMap(encoded, 4, &bb_coverage_map));
+  EXPECT_FALSE(DecodeBasicBlockCoverageMap(encoded, 2, &bb_coverage_map));
+
+  // A basic block without probes.
+  static const uint32_t kNoProbe[] = { 0, 1, 1 };
+  encoded.assign(kNoProbe, kNoProbe + arraysize(kNoProbe));
+  EXPECT_FALSE(DecodeBasicBlockCoverageMap(encoded, 2, &bb_coverage_map));
+
+  // A probe out of range.
+  static const uint32_t kOutOfRange[] = { 1, 2, 1, 1 };
+  encoded.assign(kOutOfRange, kOutOfRange + arraysize(kOutOfRange));
+  EXPECT_FALSE(DecodeBasicBlockCoverageMap(encoded, 2, &bb_coverage_map));
+
+  // A truncated list of probes.
+  static const uint32_t kTruncated[] = { 1, 0, 2, 1 };
+  encoded.assign(kTruncated, kTruncated + arraysize(kTruncated));
+  EXPECT_FALSE(DecodeBasicBlockCoverageMap(encoded, 2, &bb_coverage_map));
+}
+
 TEST(GrinderBasicBlockUtilTest, LoadPdbInfo) {
   // TODO(rogerm): Rewrite me! This test doesn't directly test LoadPdbInfo.
   Parser parser;
@@ -354,5 +400,35 @@ TEST(GrinderBasicBlockUtilTest, GetFrequencyWithColumns) {
   EXPECT_EQ(0x77665544, GetFrequency(data, 0x0, 1));
 }
 
+TEST(GrinderBasicBlockUtilTest, GetCoverageFrequency) {
+  // Coverage data for 4 basic blocks, of which 1 and 2 were probed and only 2
+  // was visited.
+  static const uint8_t kData[] = { 0, 0, 1, 0 };
+
+  // A buffer over which we'll overlay a TraceIndexedFrequencyData struct.
+  uint8_t buffer[sizeof(TraceIndexedFrequencyData) + sizeof(kData) - 1] = {};
+  TraceIndexedFrequencyData* data =
+      reinterpret_cast<TraceIndexedFrequencyData*>(buffer);
+  ::memcpy(data->frequency_data, kData, sizeof(kData));
+  data->num_columns = 1;
+  data->data_type = common::IndexedFrequencyData::COVERAGE;
+  data->frequency_size = 1;
+  data->num_entries = sizeof(kData);
+
+  // Without a map, every basic block reports its own frequency.
+  BasicBlockCoverageMap bb_coverage_map;
+  EXPECT_EQ(0U, GetCoverageFrequency(data, bb_coverage_map, 0));
+  EXPECT_EQ(1U, GetCoverageFrequency(data, bb_coverage_map, 2));
+
+  // Basic blocks 0 and 3 are visited if either probe is.
+  static const uint32_t kEncoded[] = { 2, 1, 2, 1, 1, 1, 2, 2, 1, 2 };
+  std::vector<uint32_t> encoded(kEncoded, kEncoded + arraysize(kEncoded));
+  ASSERT_TRUE(DecodeBasicBlockCoverageMap(encoded, 4, &bb_coverage_map));
+  EXPECT_EQ(1U, GetCoverageFrequency(data, bb_coverage_map, 0));
+  EXPECT_EQ(0U, GetCoverageFrequency(data, bb_coverage_map, 1));
+  EXPECT_EQ(1U, GetCoverageFrequency(data, bb_coverage_map, 2));
+  EXPECT_EQ(1U, GetCoverageFrequency(data, bb_coverage_map, 3));
+}
+
 }  // namespace basic_block_util
 }  // namespace grinder
@@ -17,6 +17,23 @@
     'chromium_code': 1,
   },
   'targets': [
+    {
+      'target_name': 'grinder_indexed_frequency_lib',
+      'type': 'static_library',
+      'sources': [
+        'indexed_frequency_data_serializer.cc',
+        'indexed_frequency_data_serializer.h',
+        'indexed_frequency_map.cc',
+        'indexed_frequency_map.h',
+      ],
+      'dependencies': [
+        '<(src)/base/base.gyp:base',
+        '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/syzygy/core/core.gyp:core_lib',
+        '<(src)/syzygy/pdb/pdb.gyp:pdb_lib',
+        '<(src)/syzygy/pe/pe.gyp:pe_lib',
+      ],
+    },
     {
       'target_name': 'grinder_lib',
       'type': 'static_library',
@@ -34,8 +51,6 @@
         'grinder_util.cc',
         'grinder_util.h',
         'grinder.h',
-        'indexed_frequency_data_serializer.cc',
-        'indexed_frequency_data_serializer.h',
         'lcov_writer.cc',
         'lcov_writer.h',
         'line_info.cc',
@@ -52,6 +67,7 @@
         'grinders/sample_grinder.h',
       ],
       'dependencies': [
+        'grinder_indexed_frequency_lib',
         '<(src)/syzygy/application/application.gyp:application_lib',
         '<(src)/syzygy/bard/bard.gyp:bard_lib',
         '<(src)/syzygy/common/common.gyp:common_lib',
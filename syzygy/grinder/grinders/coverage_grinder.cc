@@ -30,7 +30,7 @@ namespace {
 
 using basic_block_util::ModuleInformation;
 using basic_block_util::RelativeAddressRange;
-using basic_block_util::GetFrequency;
+using basic_block_util::GetCoverageFrequency;
 using basic_block_util::LoadPdbInfo;
 using basic_block_util::IsValidFrequencySize;
 using basic_block_util::PdbInfo;
@@ -178,9 +178,11 @@ void CoverageGrinder::OnIndexedFrequency(
   }
 
   // Run over the BB frequency data and mark non-zero frequency BBs as having
-  // been visited.
+  // been visited. If only a subset of the BBs was probed, each BB is visited
+  // if any of the probes implying it is.
   for (size_t bb_index = 0; bb_index < data->num_entries; ++bb_index) {
-    uint32_t bb_freq = GetFrequency(data, bb_index, 0);
+    uint32_t bb_freq =
+        GetCoverageFrequency(data, pdb_info->bb_coverage_map, bb_index);
 
     if (bb_freq == 0)
       continue;
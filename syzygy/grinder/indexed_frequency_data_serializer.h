@@ -17,12 +17,13 @@
 #ifndef SYZYGY_GRINDER_INDEXED_FREQUENCY_DATA_SERIALIZER_H_
 #define SYZYGY_GRINDER_INDEXED_FREQUENCY_DATA_SERIALIZER_H_
 
+#include <stdio.h>
 #include <map>
 #include <vector>
 
+#include "base/files/file_path.h"
 #include "base/values.h"
-#include "syzygy/grinder/basic_block_util.h"
-#include "syzygy/grinder/grinder.h"
+#include "syzygy/grinder/indexed_frequency_map.h"
 
 namespace grinder {
 
@@ -0,0 +1,81 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Implements the indexed frequency map utility functions.
+
+#include "syzygy/grinder/indexed_frequency_map.h"
+
+#include "base/logging.h"
+
+namespace grinder {
+namespace basic_block_util {
+
+bool ModuleIdentityComparator::operator()(const ModuleInformation& lhs,
+                                          const ModuleInformation& rhs) const {
+  if (lhs.module_size < rhs.module_size)
+    return true;
+  if (lhs.module_size > rhs.module_size)
+    return false;
+
+  if (lhs.module_time_date_stamp < rhs.module_time_date_stamp)
+    return true;
+  if (lhs.module_time_date_stamp > rhs.module_time_date_stamp)
+    return false;
+
+  return lhs.path < rhs.path;
+}
+
+bool operator==(const IndexedFrequencyInformation& lhs,
+                const IndexedFrequencyInformation& rhs) {
+  return lhs.num_entries == rhs.num_entries &&
+      lhs.num_columns == rhs.num_columns &&
+      lhs.data_type == rhs.data_type &&
+      lhs.frequency_map == rhs.frequency_map;
+}
+
+bool FindIndexedFrequencyInfo(
+    const pe::PEFile::Signature& signature,
+    const ModuleIndexedFrequencyMap& module_entry_map,
+    const IndexedFrequencyInformation** information) {
+  DCHECK(information != NULL);
+  *information = NULL;
+
+  // Find exactly one consistent entry count vector in the map.
+  const IndexedFrequencyInformation* result = NULL;
+  ModuleIndexedFrequencyMap::const_iterator it = module_entry_map.begin();
+  for (; it != module_entry_map.end(); ++it) {
+    const pe::PEFile::Signature candidate(it->first);
+    if (candidate.IsConsistent(signature)) {
+      if (result != NULL) {
+        LOG(ERROR) << "Found multiple module instances in the "
+                   << "indexed frequency map.";
+        return false;
+      }
+      result = &it->second;
+    }
+  }
+
+  // Handle the case where there is no consistent module found.
+  if (result == NULL) {
+    LOG(ERROR) << "Did not find module in the entry count map.";
+    return false;
+  }
+
+  // Return the entry counts that were found.
+  *information = result;
+  return true;
+}
+
+}  // namespace basic_block_util
+}  // namespace grinder
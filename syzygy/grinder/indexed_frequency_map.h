@@ -0,0 +1,74 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the indexed frequency maps loaded from the JSON profiles, apart
+// from the rest of the grinder so that the instrumenters can use them.
+
+#ifndef SYZYGY_GRINDER_INDEXED_FREQUENCY_MAP_H_
+#define SYZYGY_GRINDER_INDEXED_FREQUENCY_MAP_H_
+
+#include <map>
+#include <utility>
+
+#include "syzygy/common/indexed_frequency_data.h"
+#include "syzygy/core/address.h"
+#include "syzygy/pe/pe_file.h"
+
+namespace grinder {
+namespace basic_block_util {
+
+typedef core::RelativeAddress RelativeAddress;
+
+// Module information.
+typedef pe::ModuleInformation ModuleInformation;
+
+// Compares module information on identity properties alone.
+struct ModuleIdentityComparator {
+  bool operator()(const ModuleInformation& lhs,
+                  const ModuleInformation& rhs) const;
+};
+
+// The type of the basic block entry counts.
+typedef int32_t EntryCountType;
+
+// Type definitions for the indexed frequency data.
+typedef std::pair<RelativeAddress, size_t> IndexedFrequencyOffset;
+typedef std::map<IndexedFrequencyOffset, EntryCountType> IndexedFrequencyMap;
+// The information kept for each module.
+struct IndexedFrequencyInformation {
+  uint32_t num_entries;
+  uint32_t num_columns;
+  common::IndexedFrequencyData::DataType data_type;
+  uint8_t frequency_size;
+  IndexedFrequencyMap frequency_map;
+};
+
+bool operator==(const IndexedFrequencyInformation& lhs,
+                const IndexedFrequencyInformation& rhs);
+
+// An indexed frequency map maps from the relative virtual address of the first
+// instruction or data byte in the basic block, to its frequencies.
+typedef std::map<ModuleInformation,
+                 IndexedFrequencyInformation,
+                 ModuleIdentityComparator> ModuleIndexedFrequencyMap;
+
+bool FindIndexedFrequencyInfo(
+    const pe::PEFile::Signature& signature,
+    const ModuleIndexedFrequencyMap& module_entry_map,
+    const IndexedFrequencyInformation** information);
+
+}  // namespace basic_block_util
+}  // namespace grinder
+
+#endif  // SYZYGY_GRINDER_INDEXED_FREQUENCY_MAP_H_
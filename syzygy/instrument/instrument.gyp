@@ -44,6 +44,8 @@
         'instrumenters/instrumenter_with_agent.h',
         'instrumenters/instrumenter_with_relinker.cc',
         'instrumenters/instrumenter_with_relinker.h',
+        'mutators/add_indexed_data_map_stream.cc',
+        'mutators/add_indexed_data_map_stream.h',
         'mutators/add_indexed_data_ranges_stream.cc',
         'mutators/add_indexed_data_ranges_stream.h',
         'transforms/add_indexed_frequency_data_transform.cc',
@@ -82,6 +84,7 @@
             'block_graph_transforms_lib',
         '<(src)/syzygy/ar/ar.gyp:ar_lib',
         '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/syzygy/grinder/grinder.gyp:grinder_indexed_frequency_lib',
         '<(src)/syzygy/pe/orderers/pe_orderers.gyp:pe_orderers_lib',
         '<(src)/syzygy/pe/pe.gyp:pe_lib',
         '<(src)/syzygy/pe/transforms/pe_transforms.gyp:pe_transforms_lib',
@@ -123,6 +126,7 @@
         'instrumenters/flummox_instrumenter_unittest.cc',
         'instrumenters/instrumenter_with_agent_unittest.cc',
         'instrumenters/instrumenter_with_relinker_unittest.cc',
+        'mutators/add_indexed_data_map_stream_unittest.cc',
         'mutators/add_indexed_data_ranges_stream_unittest.cc',
         'transforms/add_indexed_frequency_data_transform_unittest.cc',
         'transforms/allocation_filter_transform_unittest.cc',
@@ -148,6 +152,7 @@
         '<(src)/testing/gtest.gyp:gtest',
         '<(src)/syzygy/ar/ar.gyp:ar_unittest_utils',
         '<(src)/syzygy/core/core.gyp:core_unittest_utils',
+        '<(src)/syzygy/grinder/grinder.gyp:grinder_lib',
         '<(src)/syzygy/integration_tests/integration_tests.gyp:'
             'integration_tests_dll',
         '<(src)/syzygy/pdb/pdb.gyp:pdb_unittest_utils',
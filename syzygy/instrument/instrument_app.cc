@@ -91,6 +91,9 @@ static const char kUsageFormatStr[] =
     "                            these options see common/asan_parameters. If\n"
     "                            not specified then the defaults of the RTL\n"
     "                            will be used.\n"
+    "    --coalesce-checks       Check the adjacent memory accesses of a basic\n"
+    "                            block at once with a range check. Requires\n"
+    "                            a runtime exporting the range probes.\n"
     "    --hot-patching          Use hot patching Asan instrumentation.\n"
     "    --instrumentation-rate=DOUBLE\n"
     "                            Specifies the fraction of instructions to\n"
@@ -103,6 +106,19 @@ static const char kUsageFormatStr[] =
     "                            analysis.\n"
     "    --no-redundancy-analysis\n"
     "                            Disables redundant memory access analysis.\n"
+    "    --profile-budget=DOUBLE\n"
+    "                            Specifies the fraction of the profiled basic\n"
+    "                            block executions that may run instrumented\n"
+    "                            code, as a value in the range 0..1,\n"
+    "                            inclusive. Defaults to 1.\n"
+    "    --profile-guided=<path> The bbentry or branch profile of the input\n"
+    "                            image, as produced by the grinder. The\n"
+    "                            hottest basic blocks are left uninstrumented\n"
+    "                            to respect the profile budget.\n"
+    "  bbentry mode options:\n"
+    "    --inline-counters       Increment the basic block counters inline\n"
+    "                            rather than calling the agent. The counters\n"
+    "                            are neither atomic nor saturating.\n"
     "  branch mode options:\n"
     "    --buffering             Enable per-thread buffering of events.\n"
     "    --fs-slot=<slot>        Specify which FS slot to use for thread\n"
@@ -115,6 +131,13 @@ static const char kUsageFormatStr[] =
     "    --no-unsafe-refs        Perform no instrumentation of references\n"
     "                            between code blocks that contain anything\n"
     "                            but C/C++.\n"
+    "  coverage mode options:\n"
+    "    --minimal-probes        Only probe the basic blocks whose visit does\n"
+    "                            not follow from the visits of the probed\n"
+    "                            ones. The other basic blocks are reported as\n"
+    "                            visited if they dominate or post-dominate a\n"
+    "                            visited one, which may be imprecise when a\n"
+    "                            function does not return normally.\n"
     "  profile mode options:\n"
     "    --instrument-imports    Also instrument calls to imports.\n"
     "\n";
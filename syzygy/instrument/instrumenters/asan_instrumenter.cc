@@ -19,7 +19,10 @@
 #include "base/logging.h"
 #include "base/files/file_util.h"
 #include "syzygy/application/application.h"
+#include "syzygy/grinder/indexed_frequency_data_serializer.h"
+#include "syzygy/grinder/indexed_frequency_map.h"
 #include "syzygy/instrument/transforms/allocation_filter_transform.h"
+#include "syzygy/pe/pe_file.h"
 
 namespace {
   using instrument::transforms::AllocationFilterTransform;
@@ -34,7 +37,9 @@ AsanInstrumenter::AsanInstrumenter()
       use_liveness_analysis_(true),
       instrumentation_rate_(1.0),
       asan_rtl_options_(false),
-      hot_patching_(false) {
+      hot_patching_(false),
+      coalesce_checks_(false),
+      profile_budget_(1.0) {
 }
 
 bool AsanInstrumenter::ImageFormatIsSupported(ImageFormat image_format) {
@@ -66,6 +71,17 @@ bool AsanInstrumenter::InstrumentImpl() {
     }
   }
 
+  // Load the execution profile if one was provided. It is only meaningful for
+  // PE images, as it refers to the addresses of the original image.
+  if (!profile_path_.empty()) {
+    if (image_format_ != BlockGraph::PE_IMAGE) {
+      LOG(ERROR) << "Profile guided instrumentation requires a PE image.";
+      return false;
+    }
+    if (!LoadProfile())
+      return false;
+  }
+
   asan_transform_.reset(new instrument::transforms::AsanTransform());
   asan_transform_->set_instrument_dll_name(agent_dll_);
   asan_transform_->set_use_interceptors(use_interceptors_);
@@ -73,6 +89,11 @@ bool AsanInstrumenter::InstrumentImpl() {
   asan_transform_->set_remove_redundant_checks(remove_redundant_checks_);
   asan_transform_->set_instrumentation_rate(instrumentation_rate_);
   asan_transform_->set_hot_patching(hot_patching_);
+  asan_transform_->set_coalesce_checks(coalesce_checks_);
+  if (!profile_path_.empty()) {
+    asan_transform_->set_profile(&profile_);
+    asan_transform_->set_profile_budget(profile_budget_);
+  }
 
   // Set up the filter if one was provided.
   if (filter.get()) {
@@ -101,6 +122,45 @@ bool AsanInstrumenter::InstrumentImpl() {
   return true;
 }
 
+bool AsanInstrumenter::LoadProfile() {
+  DCHECK(!profile_path_.empty());
+
+  pe::PEFile pe_file;
+  pe::PEFile::Signature signature;
+  if (!pe_file.Init(input_image_path_)) {
+    LOG(ERROR) << "Unable to read the input image: "
+               << input_image_path_.value();
+    return false;
+  }
+  pe_file.GetSignature(&signature);
+
+  grinder::basic_block_util::ModuleIndexedFrequencyMap module_frequencies;
+  grinder::IndexedFrequencyDataSerializer serializer;
+  if (!serializer.LoadFromJson(profile_path_, &module_frequencies)) {
+    LOG(ERROR) << "Failed to load profile: " << profile_path_.value();
+    return false;
+  }
+
+  const grinder::basic_block_util::IndexedFrequencyInformation* info = NULL;
+  if (!grinder::basic_block_util::FindIndexedFrequencyInfo(
+          signature, module_frequencies, &info)) {
+    LOG(ERROR) << "The profile doesn't contain the input module.";
+    return false;
+  }
+  DCHECK(info != NULL);
+
+  // Both the basic block entry and the branch profiles have the entry counts
+  // in their first column.
+  if (info->data_type != common::IndexedFrequencyData::BASIC_BLOCK_ENTRY &&
+      info->data_type != common::IndexedFrequencyData::BRANCH) {
+    LOG(ERROR) << "The profile must contain basic block entry counts.";
+    return false;
+  }
+
+  profile_ = info->frequency_map;
+  return true;
+}
+
 bool AsanInstrumenter::DoCommandLineParse(
     const base::CommandLine* command_line) {
   if (!Super::DoCommandLineParse(command_line))
@@ -112,6 +172,9 @@ bool AsanInstrumenter::DoCommandLineParse(
   remove_redundant_checks_ = !command_line->HasSwitch("no-redundancy-analysis");
   use_interceptors_ = !command_line->HasSwitch("no-interceptors");
   hot_patching_ = command_line->HasSwitch("hot-patching");
+  coalesce_checks_ = command_line->HasSwitch("coalesce-checks");
+  profile_path_ = application::AppImplBase::AbsolutePath(
+      command_line->GetSwitchValuePath("profile-guided"));
 
   // Parse the instrumentation rate if one has been provided.
   static const char kInstrumentationRate[] = "instrumentation-rate";
@@ -126,6 +189,23 @@ bool AsanInstrumenter::DoCommandLineParse(
     instrumentation_rate_ = std::max(0.0, std::min(1.0, d));
   }
 
+  // Parse the profile budget if one has been provided.
+  static const char kProfileBudget[] = "profile-budget";
+  if (command_line->HasSwitch(kProfileBudget)) {
+    if (profile_path_.empty()) {
+      LOG(ERROR) << "--" << kProfileBudget << " requires --profile-guided.";
+      return false;
+    }
+    std::string s = command_line->GetSwitchValueASCII(kProfileBudget);
+    double d = 0;
+    if (!base::StringToDouble(s, &d)) {
+      LOG(ERROR) << "Failed to parse floating point value: " << s;
+      return false;
+    }
+    // Cap the budget to the range of valid values [0, 1].
+    profile_budget_ = std::max(0.0, std::min(1.0, d));
+  }
+
   // Parse Asan RTL options if present.
   static const char kAsanRtlOptions[] = "asan-rtl-options";
   asan_rtl_options_ = command_line->HasSwitch(kAsanRtlOptions);
@@ -50,6 +50,11 @@ class AsanInstrumenter : public InstrumenterWithAgent {
   bool DoCommandLineParse(const base::CommandLine* command_line) override;
   // @}
 
+  // Loads the basic block execution profile of the input image from
+  // profile_path_ into profile_.
+  // @returns true on success, false otherwise.
+  bool LoadProfile();
+
   // @name Command-line parameters.
   // @{
   base::FilePath filter_path_;
@@ -59,8 +64,14 @@ class AsanInstrumenter : public InstrumenterWithAgent {
   double instrumentation_rate_;
   bool asan_rtl_options_;
   bool hot_patching_;
+  bool coalesce_checks_;
+  base::FilePath profile_path_;
+  double profile_budget_;
   // @}
 
+  // The basic block execution profile. Valid if profile_path_ is not empty.
+  instrument::transforms::AsanTransform::IndexedFrequencyMap profile_;
+
   // Valid if asan_rtl_options_ is true.
   common::InflatedAsanParameters asan_params_;
 
@@ -38,6 +38,7 @@ class TestAsanInstrumenter : public AsanInstrumenter {
   using AsanInstrumenter::allow_overwrite_;
   using AsanInstrumenter::asan_params_;
   using AsanInstrumenter::asan_rtl_options_;
+  using AsanInstrumenter::coalesce_checks_;
   using AsanInstrumenter::debug_friendly_;
   using AsanInstrumenter::filter_path_;
   using AsanInstrumenter::hot_patching_;
@@ -48,6 +49,8 @@ class TestAsanInstrumenter : public AsanInstrumenter {
   using AsanInstrumenter::no_strip_strings_;
   using AsanInstrumenter::output_image_path_;
   using AsanInstrumenter::output_pdb_path_;
+  using AsanInstrumenter::profile_budget_;
+  using AsanInstrumenter::profile_path_;
   using AsanInstrumenter::remove_redundant_checks_;
   using AsanInstrumenter::use_interceptors_;
   using AsanInstrumenter::use_liveness_analysis_;
@@ -87,6 +90,7 @@ class AsanInstrumenterTest : public testing::PELibUnitTest {
     output_pdb_path_ = temp_dir_.Append(input_pdb_path_.BaseName());
     test_dll_filter_path_ = temp_dir_.Append(L"test_dll_filter.json");
     dummy_filter_path_ = temp_dir_.Append(L"dummy_filter.json");
+    test_dll_profile_path_ = temp_dir_.Append(L"test_dll_profile.json");
   }
 
   void SetUpValidCommandLine() {
@@ -127,6 +131,7 @@ class AsanInstrumenterTest : public testing::PELibUnitTest {
   base::FilePath output_pdb_path_;
   base::FilePath test_dll_filter_path_;
   base::FilePath dummy_filter_path_;
+  base::FilePath test_dll_profile_path_;
   // @}
 
   // @name Expected final values of input parameters.
@@ -160,12 +165,16 @@ TEST_F(AsanInstrumenterTest, ParseMinimalAsan) {
   EXPECT_EQ(1.0, instrumenter_.instrumentation_rate_);
   EXPECT_FALSE(instrumenter_.asan_rtl_options_);
   EXPECT_FALSE(instrumenter_.hot_patching_);
+  EXPECT_FALSE(instrumenter_.coalesce_checks_);
+  EXPECT_TRUE(instrumenter_.profile_path_.empty());
+  EXPECT_EQ(1.0, instrumenter_.profile_budget_);
 }
 
 TEST_F(AsanInstrumenterTest, ParseFullAsan) {
   SetUpValidCommandLine();
   cmd_line_.AppendSwitchPath("filter", test_dll_filter_path_);
   cmd_line_.AppendSwitchASCII("agent", "foo.dll");
+  cmd_line_.AppendSwitch("coalesce-checks");
   cmd_line_.AppendSwitch("debug-friendly");
   cmd_line_.AppendSwitch("hot-patching");
   cmd_line_.AppendSwitchPath("input-pdb", input_pdb_path_);
@@ -177,6 +186,8 @@ TEST_F(AsanInstrumenterTest, ParseFullAsan) {
   cmd_line_.AppendSwitch("no-liveness-analysis");
   cmd_line_.AppendSwitch("no-redundancy-analysis");
   cmd_line_.AppendSwitchASCII("instrumentation-rate", "0.5");
+  cmd_line_.AppendSwitchPath("profile-guided", test_dll_profile_path_);
+  cmd_line_.AppendSwitchASCII("profile-budget", "0.25");
   cmd_line_.AppendSwitchASCII("asan-rtl-options",
       "\"--quarantine_size=1024 --quarantine_block_size=512 --ignored\"");
 
@@ -198,6 +209,9 @@ TEST_F(AsanInstrumenterTest, ParseFullAsan) {
   EXPECT_EQ(0.5, instrumenter_.instrumentation_rate_);
   EXPECT_TRUE(instrumenter_.asan_rtl_options_);
   EXPECT_TRUE(instrumenter_.hot_patching_);
+  EXPECT_TRUE(instrumenter_.coalesce_checks_);
+  EXPECT_EQ(test_dll_profile_path_, instrumenter_.profile_path_);
+  EXPECT_EQ(0.25, instrumenter_.profile_budget_);
 
   // We check that the requested RTL options were parsed, and that others are
   // left to their defaults. We don't check all the parameters as other
@@ -252,6 +266,23 @@ TEST_F(AsanInstrumenterTest, FailsWithInvalidInstrumentationRate) {
   EXPECT_FALSE(instrumenter_.ParseCommandLine(&cmd_line_));
 }
 
+TEST_F(AsanInstrumenterTest, FailsWithProfileBudgetWithoutProfile) {
+  SetUpValidCommandLine();
+  cmd_line_.AppendSwitchASCII("profile-budget", "0.5");
+
+  EXPECT_FALSE(instrumenter_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(AsanInstrumenterTest, FailsWithMissingProfile) {
+  SetUpValidCommandLine();
+  cmd_line_.AppendSwitchPath("profile-guided", test_dll_profile_path_);
+
+  EXPECT_TRUE(instrumenter_.ParseCommandLine(&cmd_line_));
+  EXPECT_TRUE(instrumenter_.InstrumentPrepare());
+  EXPECT_TRUE(instrumenter_.CreateRelinker());
+  EXPECT_FALSE(instrumenter_.InstrumentImpl());
+}
+
 TEST_F(AsanInstrumenterTest, FailsWithInvalidAsanRtlOptions) {
   cmd_line_.AppendSwitchPath("input-image", input_image_path_);
   cmd_line_.AppendSwitchPath("output-image", output_image_path_);
@@ -26,7 +26,7 @@ const char BasicBlockEntryInstrumenter::kAgentDllBasicBlockEntry[] =
     "basic_block_entry_client.dll";
 
 BasicBlockEntryInstrumenter::BasicBlockEntryInstrumenter()
-    : inline_fast_path_(false) {
+    : inline_fast_path_(false), inline_counters_(false) {
   agent_dll_ = kAgentDllBasicBlockEntry;
 }
 
@@ -39,6 +39,7 @@ bool BasicBlockEntryInstrumenter::InstrumentImpl() {
       new instrument::transforms::BasicBlockEntryHookTransform());
   bbentry_transform_->set_instrument_dll_name(agent_dll_);
   bbentry_transform_->set_inline_fast_path(inline_fast_path_);
+  bbentry_transform_->set_inline_counters(inline_counters_);
   bbentry_transform_->set_src_ranges_for_thunks(debug_friendly_);
   if (!relinker_->AppendTransform(bbentry_transform_.get()))
     return false;
@@ -60,6 +61,7 @@ bool BasicBlockEntryInstrumenter::DoCommandLineParse(
 
   // Parse the additional command line arguments.
   inline_fast_path_ = command_line->HasSwitch("inline-fast-path");
+  inline_counters_ = command_line->HasSwitch("inline-counters");
 
   return true;
 }
@@ -24,7 +24,7 @@ namespace instrumenters {
 
 const char CoverageInstrumenter::kAgentDllCoverage[] = "coverage_client.dll";
 
-CoverageInstrumenter::CoverageInstrumenter() {
+CoverageInstrumenter::CoverageInstrumenter() : minimal_probes_(false) {
   agent_dll_ = kAgentDllCoverage;
 }
 
@@ -37,6 +37,7 @@ bool CoverageInstrumenter::InstrumentImpl() {
       new instrument::transforms::CoverageInstrumentationTransform());
   coverage_transform_->set_instrument_dll_name(agent_dll_);
   coverage_transform_->set_src_ranges_for_thunks(debug_friendly_);
+  coverage_transform_->set_minimal_probes(minimal_probes_);
   if (!relinker_->AppendTransform(coverage_transform_.get()))
     return false;
 
@@ -47,6 +48,26 @@ bool CoverageInstrumenter::InstrumentImpl() {
   if (!relinker_->AppendPdbMutator(add_bb_addr_stream_mutator_.get()))
     return false;
 
+  // The coverage map is empty, and no stream is added, unless minimal probes
+  // are requested.
+  add_bb_coverage_map_stream_mutator_.reset(
+      new instrument::mutators::AddIndexedDataMapStreamPdbMutator(
+          coverage_transform_->bb_coverage_map(),
+          common::kBasicBlockCoverageMapStreamName));
+  if (!relinker_->AppendPdbMutator(add_bb_coverage_map_stream_mutator_.get()))
+    return false;
+
+  return true;
+}
+
+bool CoverageInstrumenter::DoCommandLineParse(
+    const base::CommandLine* command_line) {
+  if (!Super::DoCommandLineParse(command_line))
+    return false;
+
+  // Parse the additional command line arguments.
+  minimal_probes_ = command_line->HasSwitch("minimal-probes");
+
   return true;
 }
 
@@ -20,6 +20,7 @@
 
 #include "base/command_line.h"
 #include "syzygy/instrument/instrumenters/instrumenter_with_agent.h"
+#include "syzygy/instrument/mutators/add_indexed_data_map_stream.h"
 #include "syzygy/instrument/mutators/add_indexed_data_ranges_stream.h"
 #include "syzygy/instrument/transforms/coverage_transform.h"
 
@@ -44,6 +45,16 @@ class CoverageInstrumenter : public InstrumenterWithAgent {
   const char* InstrumentationMode() override { return "coverage"; }
   // @}
 
+  // @name Super overrides.
+  // @{
+  bool DoCommandLineParse(const base::CommandLine* command_line) override;
+  // @}
+
+  // @name Command-line parameters.
+  // @{
+  bool minimal_probes_;
+  // @}
+
   // The transform for this agent.
   std::unique_ptr<instrument::transforms::CoverageInstrumentationTransform>
       coverage_transform_;
@@ -51,6 +62,8 @@ class CoverageInstrumenter : public InstrumenterWithAgent {
   // The PDB mutator transform for this agent.
   std::unique_ptr<instrument::mutators::AddIndexedDataRangesStreamPdbMutator>
       add_bb_addr_stream_mutator_;
+  std::unique_ptr<instrument::mutators::AddIndexedDataMapStreamPdbMutator>
+      add_bb_coverage_map_stream_mutator_;
 };
 
 }  // namespace instrumenters
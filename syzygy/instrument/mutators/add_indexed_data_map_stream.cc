@@ -0,0 +1,48 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/instrument/mutators/add_indexed_data_map_stream.h"
+
+#include "syzygy/pdb/pdb_byte_stream.h"
+
+namespace instrument {
+namespace mutators {
+
+const char AddIndexedDataMapStreamPdbMutator::kMutatorName[] =
+    "AddIndexedDataMapStreamPdbMutator";
+
+bool AddIndexedDataMapStreamPdbMutator::AddNamedStreams(
+    const pdb::PdbFile& pdb_file) {
+  if (indexed_data_map_.empty()) {
+    LOG(INFO) << "Indexed data map is empty. Not adding stream.";
+    return true;
+  }
+
+  // Create the stream.
+  scoped_refptr<pdb::PdbByteStream> stream(new pdb::PdbByteStream);
+  CHECK(stream->Init(
+      reinterpret_cast<const uint8_t*>(indexed_data_map_.data()),
+      indexed_data_map_.size() * sizeof(indexed_data_map_[0])));
+
+  // Add the stream to the PDB.
+  if (!SetNamedStream(stream_name_.c_str(), stream.get())) {
+    LOG(ERROR) << "Indexed data map stream already exists.";
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace mutators
+}  // namespace instrument
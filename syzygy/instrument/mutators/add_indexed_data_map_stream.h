@@ -0,0 +1,67 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a PDB mutator for adding a map over indexed data, stored as a
+// vector of uint32_t whose layout is defined by its producer, to a named PDB
+// stream.
+
+#ifndef SYZYGY_INSTRUMENT_MUTATORS_ADD_INDEXED_DATA_MAP_STREAM_H_
+#define SYZYGY_INSTRUMENT_MUTATORS_ADD_INDEXED_DATA_MAP_STREAM_H_
+
+#include <string>
+#include <vector>
+
+#include "syzygy/pdb/mutators/add_named_stream_mutator.h"
+
+namespace instrument {
+namespace mutators {
+
+class AddIndexedDataMapStreamPdbMutator
+    : public pdb::mutators::AddNamedStreamMutatorImpl<
+          AddIndexedDataMapStreamPdbMutator> {
+ public:
+  typedef std::vector<uint32_t> IndexedDataMap;
+
+  // Constructor.
+  // @param indexed_data_map A reference to the vector that contains the map.
+  //     This need not be populated at the time of construction, so long as it
+  //     exists before MutatePdb is called. No stream is added if it is empty.
+  // @param stream_name The name to give to the stream we're adding.
+  AddIndexedDataMapStreamPdbMutator(const IndexedDataMap& indexed_data_map,
+                                    std::string stream_name)
+      : indexed_data_map_(indexed_data_map),
+        stream_name_(stream_name) {
+  }
+
+ protected:
+  friend pdb::mutators::AddNamedStreamMutatorImpl<
+      AddIndexedDataMapStreamPdbMutator>;
+  friend pdb::mutators::NamedPdbMutatorImpl<
+      AddIndexedDataMapStreamPdbMutator>;
+
+  // Implementation of AddNamedStreamMutatorImpl.
+  bool AddNamedStreams(const pdb::PdbFile& pdb_file);
+
+  // Implementation of NamedPdbMutatorImpl.
+  static const char kMutatorName[];
+
+  const IndexedDataMap& indexed_data_map_;
+
+  std::string stream_name_;
+};
+
+}  // namespace mutators
+}  // namespace instrument
+
+#endif  // SYZYGY_INSTRUMENT_MUTATORS_ADD_INDEXED_DATA_MAP_STREAM_H_
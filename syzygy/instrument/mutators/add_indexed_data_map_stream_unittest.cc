@@ -0,0 +1,86 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/instrument/mutators/add_indexed_data_map_stream.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "syzygy/pdb/pdb_byte_stream.h"
+#include "syzygy/pdb/unittest_util.h"
+
+namespace instrument {
+namespace mutators {
+
+namespace {
+
+typedef AddIndexedDataMapStreamPdbMutator::IndexedDataMap IndexedDataMap;
+
+const char stream_name[] = "IndexedDataMapStream";
+
+}  // namespace
+
+TEST(AddIndexedDataMapStreamPdbMutatorTest, DoesNotAddEmptyStream) {
+  IndexedDataMap indexed_data_map;
+  AddIndexedDataMapStreamPdbMutator mutator(indexed_data_map, stream_name);
+
+  pdb::PdbFile pdb_file;
+  ASSERT_NO_FATAL_FAILURE(testing::InitMockPdbFile(&pdb_file));
+
+  EXPECT_TRUE(mutator.MutatePdb(&pdb_file));
+
+  pdb::PdbInfoHeader70 pdb_header = {};
+  pdb::NameStreamMap name_stream_map;
+  EXPECT_TRUE(pdb::ReadHeaderInfoStream(pdb_file, &pdb_header,
+                                        &name_stream_map));
+  EXPECT_EQ(0u, name_stream_map.count(stream_name));
+}
+
+TEST(AddIndexedDataMapStreamPdbMutatorTest, AddsStream) {
+  IndexedDataMap indexed_data_map;
+  AddIndexedDataMapStreamPdbMutator mutator(indexed_data_map, stream_name);
+
+  // The map is populated after the construction of the mutator.
+  indexed_data_map.push_back(1);
+  indexed_data_map.push_back(1);
+  indexed_data_map.push_back(2);
+
+  pdb::PdbFile pdb_file;
+  ASSERT_NO_FATAL_FAILURE(testing::InitMockPdbFile(&pdb_file));
+
+  EXPECT_TRUE(mutator.MutatePdb(&pdb_file));
+
+  pdb::PdbInfoHeader70 pdb_header = {};
+  pdb::NameStreamMap name_stream_map;
+  EXPECT_TRUE(pdb::ReadHeaderInfoStream(pdb_file, &pdb_header,
+                                        &name_stream_map));
+  ASSERT_EQ(1u, name_stream_map.count(stream_name));
+
+  scoped_refptr<pdb::PdbStream> stream =
+      pdb_file.GetStream(name_stream_map[stream_name]);
+  ASSERT_TRUE(stream.get() != NULL);
+
+  // Validate the stream contents.
+  IndexedDataMap indexed_data_map2(indexed_data_map.size());
+  EXPECT_EQ(sizeof(uint32_t) * indexed_data_map2.size(), stream->length());
+  EXPECT_TRUE(stream->ReadBytesAt(
+      0, sizeof(uint32_t) * indexed_data_map2.size(),
+      indexed_data_map2.data()));
+  EXPECT_THAT(indexed_data_map, testing::ContainerEq(indexed_data_map2));
+
+  // Adding the stream a second time fails.
+  EXPECT_FALSE(mutator.MutatePdb(&pdb_file));
+}
+
+}  // namespace mutators
+}  // namespace instrument
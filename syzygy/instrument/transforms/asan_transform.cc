@@ -15,7 +15,9 @@
 #include "syzygy/instrument/transforms/asan_transform.h"
 
 #include <algorithm>
+#include <functional>
 #include <list>
+#include <map>
 #include <vector>
 
 #include "base/logging.h"
@@ -26,6 +28,7 @@
 #include "base/strings/stringprintf.h"
 #include "syzygy/block_graph/basic_block.h"
 #include "syzygy/block_graph/basic_block_assembler.h"
+#include "syzygy/block_graph/analysis/liveness_analysis_internal.h"
 #include "syzygy/block_graph/block_builder.h"
 #include "syzygy/block_graph/block_util.h"
 #include "syzygy/block_graph/typed_block.h"
@@ -278,11 +281,19 @@ bool DecodeMemoryAccess(const Instruction& instr,
   return true;
 }
 
+// Returns true if @p mode is the mode of a range access.
+bool IsRangeAccess(AsanMemoryAccessMode mode) {
+  return mode == AsanBasicBlockTransform::kRangeReadAccess ||
+         mode == AsanBasicBlockTransform::kRangeWriteAccess;
+}
+
 // Use @p bb_asm to inject a hook to @p hook to instrument the access to the
-// address stored in the operand @p op.
+// address stored in the operand @p op. For range accesses @p range_size is the
+// size of the range starting at this address.
 void InjectAsanHook(BasicBlockAssembler* bb_asm,
                     const AsanBasicBlockTransform::MemoryAccessInfo& info,
                     const BasicBlockAssembler::Operand& op,
+                    uint32_t range_size,
                     BlockGraph::Reference* hook,
                     const LivenessAnalysis::State& state,
                     BlockGraph::ImageFormat image_format) {
@@ -291,6 +302,8 @@ void InjectAsanHook(BasicBlockAssembler* bb_asm,
   // Determine which kind of probe to inject.
   //   - The standard load/store probe assume the address is in EDX.
   //     It restore the original version of EDX and cleanup the stack.
+  //   - The range probe also expects the size of the range on the stack, and
+  //     cleans it up too.
   //   - The special instruction probe take addresses directly in registers.
   //     The probe doesn't have any effects on stack, registers and flags.
   if (info.mode == AsanBasicBlockTransform::kReadAccess ||
@@ -298,6 +311,12 @@ void InjectAsanHook(BasicBlockAssembler* bb_asm,
     // Load/store probe.
     bb_asm->push(assm::edx);
     bb_asm->lea(assm::edx, op);
+  } else if (IsRangeAccess(info.mode)) {
+    // Range probe.
+    DCHECK_NE(0U, range_size);
+    bb_asm->push(assm::edx);
+    bb_asm->lea(assm::edx, op);
+    bb_asm->push(Immediate(range_size, assm::kSize32Bit));
   }
 
   // Call the hook.
@@ -313,6 +332,188 @@ void InjectAsanHook(BasicBlockAssembler* bb_asm,
   }
 }
 
+// A memory access check waiting to be injected in a basic block.
+struct PendingCheck {
+  // The instruction before which the check is injected.
+  BasicBlock::Instructions::iterator position;
+  AsanBasicBlockTransform::MemoryAccessInfo info;
+  BasicBlockAssembler::Operand operand;
+  // The size of the checked range, for the range accesses.
+  uint32_t range_size;
+  LivenessAnalysis::State state;
+  Instruction::SourceRange source_range;
+};
+typedef std::vector<PendingCheck> PendingChecks;
+
+// The registers and the scale factor of a memory operand. The accesses sharing
+// them only differ by their displacement.
+struct OperandRegisters {
+  assm::RegisterId base;
+  assm::RegisterId index;
+  assm::ScaleFactor scale;
+
+  bool operator<(const OperandRegisters& other) const {
+    if (base != other.base)
+      return base < other.base;
+    if (index != other.index)
+      return index < other.index;
+    return scale < other.scale;
+  }
+};
+
+// A group of checks of adjacent memory accesses sharing their registers.
+struct CheckGroup {
+  // The index of the check of the first access of the group.
+  size_t leader;
+  // The displacements covered by the group, [begin, end).
+  int32_t begin;
+  int32_t end;
+  // The number of accesses in the group.
+  size_t count;
+  // True iff any access of the group is a write.
+  bool is_write;
+};
+
+// Returns true if the register @p reg_id is defined in @p defs.
+bool IsDefined(const LivenessAnalysis::State& defs, assm::RegisterId reg_id) {
+  if (reg_id == assm::kRegisterNone)
+    return false;
+  return defs.IsLive(assm::Register::Get(reg_id));
+}
+
+// @returns a copy of the operand @p op with the displacement @p displacement.
+// @note The displacement of @p op must not carry a reference.
+BasicBlockAssembler::Operand ReplaceDisplacement(
+    const BasicBlockAssembler::Operand& op, int32_t displacement) {
+  DCHECK(!op.displacement().reference().IsValid());
+  auto displ = Displacement(static_cast<uint32_t>(displacement));
+  if (op.base() == assm::kRegisterNone && op.index() == assm::kRegisterNone)
+    return Operand(displ);
+
+  if (op.index() == assm::kRegisterNone) {
+    const Register32& base_reg =
+        assm::CastAsRegister32(assm::Register::Get(op.base()));
+    return Operand(base_reg, displ);
+  }
+
+  const Register32& index_reg =
+      assm::CastAsRegister32(assm::Register::Get(op.index()));
+  if (op.base() == assm::kRegisterNone)
+    return Operand(index_reg, op.scale(), displ);
+
+  const Register32& base_reg =
+      assm::CastAsRegister32(assm::Register::Get(op.base()));
+  return Operand(base_reg, index_reg, op.scale(), displ);
+}
+
+// Coalesces the checks pending in a basic block into range checks. The
+// read/write accesses made through the same registers to adjacent or
+// overlapping memory locations are checked at once, before the first of them.
+// As the range is the union of the accessed bytes this doesn't introduce any
+// false positive. A group of accesses is closed as soon as the value of its
+// registers may change, and every group is closed by a call as it may change
+// the accessibility of the memory.
+// @param instructions The instructions of the basic block.
+// @param checks The checks pending in @p instructions, in order. On return,
+//     contains the checks to inject.
+void CoalesceChecks(const BasicBlock::Instructions& instructions,
+                    PendingChecks* checks) {
+  DCHECK_NE(reinterpret_cast<PendingChecks*>(NULL), checks);
+
+  static const size_t kNoGroup = SIZE_MAX;
+  std::vector<CheckGroup> groups;
+  std::vector<size_t> group_of(checks->size(), kNoGroup);
+  std::map<OperandRegisters, size_t> open_groups;
+
+  size_t check_index = 0;
+  BasicBlock::Instructions::const_iterator inst = instructions.begin();
+  for (; inst != instructions.end(); ++inst) {
+    if (check_index < checks->size() &&
+        &*(*checks)[check_index].position == &*inst) {
+      const PendingCheck& check = (*checks)[check_index];
+      // The accesses whose displacement refers to a block or a basic block
+      // aren't coalesced, as the registers don't identify the accessed
+      // location and the range check would have to carry the reference.
+      if ((check.info.mode == AsanBasicBlockTransform::kReadAccess ||
+           check.info.mode == AsanBasicBlockTransform::kWriteAccess) &&
+          !check.operand.displacement().reference().IsValid()) {
+        bool is_write =
+            check.info.mode == AsanBasicBlockTransform::kWriteAccess;
+        OperandRegisters registers = { check.operand.base(),
+                                       check.operand.index(),
+                                       check.operand.scale() };
+
+        // The displacement of the operand refers to the last accessed byte.
+        int32_t end =
+            static_cast<int32_t>(check.operand.displacement().value()) + 1;
+        int32_t begin = end - check.info.size;
+
+        std::map<OperandRegisters, size_t>::iterator open =
+            open_groups.find(registers);
+        if (open != open_groups.end() &&
+            begin <= groups[open->second].end &&
+            end >= groups[open->second].begin) {
+          CheckGroup& group = groups[open->second];
+          group.begin = std::min(group.begin, begin);
+          group.end = std::max(group.end, end);
+          group.is_write |= is_write;
+          ++group.count;
+          group_of[check_index] = open->second;
+        } else {
+          CheckGroup group = { check_index, begin, end, 1, is_write };
+          open_groups[registers] = groups.size();
+          group_of[check_index] = groups.size();
+          groups.push_back(group);
+        }
+      }
+      ++check_index;
+    }
+
+    // Close the groups whose registers are modified by this instruction.
+    LivenessAnalysis::State defs;
+    LivenessAnalysis::StateHelper::Clear(&defs);
+    if (inst->IsCall() ||
+        !LivenessAnalysis::StateHelper::GetDefsOf(*inst, &defs)) {
+      open_groups.clear();
+      continue;
+    }
+    std::map<OperandRegisters, size_t>::iterator open = open_groups.begin();
+    while (open != open_groups.end()) {
+      if (IsDefined(defs, open->first.base) ||
+          IsDefined(defs, open->first.index)) {
+        open = open_groups.erase(open);
+      } else {
+        ++open;
+      }
+    }
+  }
+  DCHECK_EQ(checks->size(), check_index);
+
+  // Replace the checks of the groups of several accesses by a range check.
+  PendingChecks coalesced;
+  for (size_t i = 0; i < checks->size(); ++i) {
+    const PendingCheck& check = (*checks)[i];
+    if (group_of[i] == kNoGroup || groups[group_of[i]].count == 1) {
+      coalesced.push_back(check);
+      continue;
+    }
+
+    const CheckGroup& group = groups[group_of[i]];
+    if (group.leader != i)
+      continue;
+
+    PendingCheck range_check = check;
+    range_check.info.mode = group.is_write ?
+        AsanBasicBlockTransform::kRangeWriteAccess :
+        AsanBasicBlockTransform::kRangeReadAccess;
+    range_check.info.size = 0;
+    range_check.operand = ReplaceDisplacement(check.operand, group.begin);
+    range_check.range_size = group.end - group.begin;
+    coalesced.push_back(range_check);
+  }
+  checks->swap(coalesced);
+}
+
 // Get the name of an asan check access function for an @p access_mode access.
 // @param info The memory access information, e.g. the size on a load/store,
 //     the instruction opcode and the kind of access.
@@ -320,6 +521,21 @@ std::string GetAsanCheckAccessFunctionName(
     AsanBasicBlockTransform::MemoryAccessInfo info,
     BlockGraph::ImageFormat image_format) {
   DCHECK(info.mode != AsanBasicBlockTransform::kNoAccess);
+
+  // For COFF images we use the decorated function name, which contains a
+  // leading underscore.
+  const char* prefix_str = image_format == BlockGraph::PE_IMAGE ? "" : "_";
+  const char* flags_str = info.save_flags ? "" : "_no_flags";
+
+  // The range probes don't depend on the access size.
+  if (IsRangeAccess(info.mode)) {
+    return base::StringPrintf(
+        "%sasan_check_range_%s_access%s", prefix_str,
+        info.mode == AsanBasicBlockTransform::kRangeReadAccess ? "read"
+                                                               : "write",
+        flags_str);
+  }
+
   DCHECK_NE(0U, info.size);
   DCHECK(info.mode == AsanBasicBlockTransform::kReadAccess ||
          info.mode == AsanBasicBlockTransform::kWriteAccess ||
@@ -341,15 +557,13 @@ std::string GetAsanCheckAccessFunctionName(
   else
     access_mode_str = reinterpret_cast<char*>(GET_MNEMONIC_NAME(info.opcode));
 
-  // For COFF images we use the decorated function name, which contains a
-  // leading underscore.
   std::string function_name =
       base::StringPrintf("%sasan_check%s_%d_byte_%s_access%s",
-                         image_format == BlockGraph::PE_IMAGE ? "" : "_",
+                         prefix_str,
                          rep_str,
                          info.size,
                          access_mode_str,
-                         info.save_flags ? "" : "_no_flags");
+                         flags_str);
   function_name = base::ToLowerASCII(function_name);
   return function_name;
 }
@@ -477,7 +691,8 @@ bool AddAsanCheckAccessHooks(
 
 // Create a stub for the asan_check_access functions. For load/store, the stub
 // consists of a small block of code that restores the value of EDX and returns
-// to the caller. Otherwise, the stub do return.
+// to the caller. For ranges, it also cleans the size of the range off the
+// stack. Otherwise, the stub do return.
 // @param block_graph The block-graph to populate with the stub.
 // @param stub_name The stub's name.
 // @param mode The kind of memory access.
@@ -521,6 +736,11 @@ bool CreateHooksStub(BlockGraph* block_graph,
     // return.
     assm.mov(assm::edx, Operand(assm::esp, Displacement(4)));
     assm.ret(4);
+  } else if (IsRangeAccess(mode)) {
+    // The thunk body restores the original value of EDX and cleans the size of
+    // the range and EDX off the stack on return.
+    assm.mov(assm::edx, Operand(assm::esp, Displacement(8)));
+    assm.ret(8);
   } else {
     assm.ret();
   }
@@ -546,6 +766,7 @@ bool CreateHooksStub(BlockGraph* block_graph,
 // @param asan_hook_stub_name Name prefix of the stubs for the asan check access
 //     functions.
 // @param use_liveness_analysis true iff we use liveness analysis.
+// @param use_range_checks true iff the range check hooks should be imported.
 // @param import_module The module for which the import should be added.
 // @param check_access_hooks_ref The map where the reference to the imports
 //     should be stored.
@@ -557,6 +778,7 @@ bool CreateHooksStub(BlockGraph* block_graph,
 bool ImportAsanCheckAccessHooks(
     const char* asan_hook_stub_name,
     bool use_liveness_analysis,
+    bool use_range_checks,
     ImportedModule* import_module,
     AsanBasicBlockTransform::AsanHookMap* check_access_hooks_ref,
     const TransformPolicyInterface* policy,
@@ -594,6 +816,19 @@ bool ImportAsanCheckAccessHooks(
     default_stub_map[AsanBasicBlockTransform::kInstrAccess] = instr_hook;
     default_stub_map[AsanBasicBlockTransform::kRepzAccess] = instr_hook;
     default_stub_map[AsanBasicBlockTransform::kRepnzAccess] = instr_hook;
+
+    // Create the hook stub for the range checks.
+    if (use_range_checks) {
+      BlockGraph::Reference range_hook;
+      if (!CreateHooksStub(block_graph, asan_hook_stub_name,
+                           AsanBasicBlockTransform::kRangeReadAccess,
+                           &range_hook)) {
+        return false;
+      }
+      default_stub_map[AsanBasicBlockTransform::kRangeReadAccess] = range_hook;
+      default_stub_map[AsanBasicBlockTransform::kRangeWriteAccess] =
+          range_hook;
+    }
   }
 
   // Import the hooks for the read/write accesses.
@@ -632,6 +867,26 @@ bool ImportAsanCheckAccessHooks(
     access_hook_param_vec.push_back(write_info_10);
   }
 
+  // Import the hooks for the range accesses. Their key has no size, as the
+  // size of the range is passed to the probe.
+  if (use_range_checks) {
+    MemoryAccessInfo range_read_info =
+        { AsanBasicBlockTransform::kRangeReadAccess, 0, 0, true };
+    access_hook_param_vec.push_back(range_read_info);
+    if (use_liveness_analysis) {
+      range_read_info.save_flags = false;
+      access_hook_param_vec.push_back(range_read_info);
+    }
+
+    MemoryAccessInfo range_write_info =
+        { AsanBasicBlockTransform::kRangeWriteAccess, 0, 0, true };
+    access_hook_param_vec.push_back(range_write_info);
+    if (use_liveness_analysis) {
+      range_write_info.save_flags = false;
+      access_hook_param_vec.push_back(range_write_info);
+    }
+  }
+
   // Import the hooks for string/prefix memory accesses.
   const _InstructionType strings[] = {I_CMPS, I_LODS, I_MOVS, I_STOS};
   int strings_length = sizeof(strings)/sizeof(_InstructionType);
@@ -1072,21 +1327,10 @@ bool AsanBasicBlockTransform::InstrumentBasicBlock(
     return true;
 
   // Pre-compute liveness information for each instruction.
-  std::list<LivenessAnalysis::State> states;
+  std::vector<LivenessAnalysis::State> states;
   LivenessAnalysis::State state;
   if (use_liveness_analysis_) {
-    liveness_.GetStateAtExitOf(basic_block, &state);
-
-    BasicBlock::Instructions::reverse_iterator rev_iter_inst =
-        basic_block->instructions().rbegin();
-    BasicBlock::Instructions::const_reverse_iterator rev_iter_inst_end =
-        basic_block->instructions().rend();
-    for (; rev_iter_inst != rev_iter_inst_end; ++rev_iter_inst) {
-      const Instruction& instr = *rev_iter_inst;
-      liveness_.PropagateBackward(instr, &state);
-      states.push_front(state);
-    }
-
+    liveness_.GetStatesOf(basic_block, &states);
     DCHECK_EQ(states.size(), basic_block->instructions().size());
   }
 
@@ -1095,11 +1339,12 @@ bool AsanBasicBlockTransform::InstrumentBasicBlock(
   if (remove_redundant_checks_)
     memory_accesses_.GetStateAtEntryOf(basic_block, &memory_state);
 
-  // Process each instruction and inject a call to Asan when we find an
-  // instrumentable memory access.
+  // Process each instruction and collect the checks of the instrumentable
+  // memory accesses. They are injected once the whole basic block is processed.
+  PendingChecks checks;
   BasicBlock::Instructions::iterator iter_inst =
       basic_block->instructions().begin();
-  std::list<LivenessAnalysis::State>::iterator iter_state = states.begin();
+  std::vector<LivenessAnalysis::State>::iterator iter_state = states.begin();
   for (; iter_inst != basic_block->instructions().end(); ++iter_inst) {
     auto operand(Operand(assm::eax));
     const Instruction& instr = *iter_inst;
@@ -1184,42 +1429,110 @@ bool AsanBasicBlockTransform::InstrumentBasicBlock(
       continue;
     }
 
+    // Loop invariant accesses are checked once, at the end of the loop
+    // preheader, instead of on every iteration.
+    MemoryAccessAnalysis::HoistingMap::const_iterator hoisted =
+        hoisted_accesses_.find(&instr);
+    if (hoisted != hoisted_accesses_.end()) {
+      HoistedCheck check = { info, operand, instr.source_range() };
+      hoisted_checks_[hoisted->second].push_back(check);
+      instrumentation_happened_ = true;
+      continue;
+    }
+
+    if (use_liveness_analysis_ &&
+        (info.mode == kReadAccess || info.mode == kWriteAccess)) {
+      // Use the liveness information to skip saving the flags if possible.
+      info.save_flags = state.AreArithmeticFlagsLive();
+    }
+
+    // Mark that an instrumentation will happen. Do this before selecting a
+    // hook so we can call a dry run without hooks present.
+    instrumentation_happened_ = true;
+
+    PendingCheck check = { iter_inst, info, operand, 0, state,
+                           instr.source_range() };
+    checks.push_back(check);
+  }
+
+  DCHECK(iter_state == states.end());
+
+  // Check the adjacent accesses at once.
+  if (coalesce_checks_)
+    CoalesceChecks(basic_block->instructions(), &checks);
+
+  if (dry_run_)
+    return true;
+
+  PendingChecks::const_iterator check = checks.begin();
+  for (; check != checks.end(); ++check) {
+    // Insert hook for standard instructions.
+    AsanHookMap::iterator hook = check_access_hooks_->find(check->info);
+    if (hook == check_access_hooks_->end()) {
+      LOG(ERROR) << "Invalid access : "
+                 << GetAsanCheckAccessFunctionName(check->info, image_format);
+      return false;
+    }
+
     // Create a BasicBlockAssembler to insert new instruction.
-    BasicBlockAssembler bb_asm(iter_inst, &basic_block->instructions());
+    BasicBlockAssembler bb_asm(check->position, &basic_block->instructions());
 
     // Configure the assembler to copy the SourceRange information of the
     // current instrumented instruction into newly created instructions. This is
     // a hack to allow valid stack walking and better error reporting, but
     // breaks the 1:1 OMAP mapping and may confuse some debuggers.
     if (debug_friendly_)
-      bb_asm.set_source_range(instr.source_range());
+      bb_asm.set_source_range(check->source_range);
+
+    // Instrument this instruction.
+    InjectAsanHook(&bb_asm, check->info, check->operand, check->range_size,
+                   &hook->second, check->state, image_format);
+  }
+
+  return true;
+}
+
+bool AsanBasicBlockTransform::InstrumentPreheader(
+    BasicCodeBlock* preheader,
+    BlockGraph::ImageFormat image_format) {
+  DCHECK_NE(reinterpret_cast<BasicCodeBlock*>(NULL), preheader);
 
+  HoistedCheckMap::iterator checks = hoisted_checks_.find(preheader);
+  if (checks == hoisted_checks_.end())
+    return true;
+
+  // The checks are done when leaving the preheader. The registers used by the
+  // accesses are not modified until the header executes them.
+  LivenessAnalysis::State state;
+  if (use_liveness_analysis_)
+    liveness_.GetStateAtExitOf(preheader, &state);
+
+  BasicBlockAssembler bb_asm(preheader->instructions().end(),
+                             &preheader->instructions());
+  std::vector<HoistedCheck>::iterator check = checks->second.begin();
+  for (; check != checks->second.end(); ++check) {
+    MemoryAccessInfo info = check->info;
     if (use_liveness_analysis_ &&
         (info.mode == kReadAccess || info.mode == kWriteAccess)) {
-      // Use the liveness information to skip saving the flags if possible.
       info.save_flags = state.AreArithmeticFlagsLive();
     }
 
-    // Mark that an instrumentation will happen. Do this before selecting a
-    // hook so we can call a dry run without hooks present.
-    instrumentation_happened_ = true;
-
-    if (!dry_run_) {
-      // Insert hook for standard instructions.
-      AsanHookMap::iterator hook = check_access_hooks_->find(info);
-      if (hook == check_access_hooks_->end()) {
-        LOG(ERROR) << "Invalid access : "
-                   << GetAsanCheckAccessFunctionName(info, image_format);
-        return false;
-      }
+    if (dry_run_)
+      continue;
 
-      // Instrument this instruction.
-      InjectAsanHook(
-          &bb_asm, info, operand, &hook->second, state, image_format);
+    AsanHookMap::iterator hook = check_access_hooks_->find(info);
+    if (hook == check_access_hooks_->end()) {
+      LOG(ERROR) << "Invalid access : "
+                 << GetAsanCheckAccessFunctionName(info, image_format);
+      return false;
     }
-  }
 
-  DCHECK(iter_state == states.end());
+    if (debug_friendly_)
+      bb_asm.set_source_range(check->source_range);
+
+    InjectAsanHook(
+        &bb_asm, info, check->operand, 0, &hook->second, state, image_format);
+  }
 
   return true;
 }
@@ -1242,9 +1555,29 @@ bool AsanBasicBlockTransform::TransformBasicBlockSubGraph(
   if (use_liveness_analysis_)
     liveness_.Analyze(subgraph);
 
-  // Perform a redundant memory access analysis.
-  if (remove_redundant_checks_)
-    memory_accesses_.Analyze(subgraph);
+  // Find the basic blocks that are too hot to be instrumented.
+  const BlockGraph::Block* original_block = subgraph->original_block();
+  block_graph::analysis::MemoryAccessAnalysis::BasicBlockSet hot_basic_blocks;
+  BasicBlockSubGraph::BBCollection::iterator it =
+      subgraph->basic_blocks().begin();
+  for (; it != subgraph->basic_blocks().end(); ++it) {
+    BasicCodeBlock* bb = BasicCodeBlock::Cast(*it);
+    if (bb != NULL && hot_basic_blocks_ != NULL && original_block != NULL &&
+        bb->offset() != BasicBlock::kNoOffset &&
+        hot_basic_blocks_->count(original_block->addr() + bb->offset())) {
+      hot_basic_blocks.insert(bb);
+    }
+  }
+
+  // Perform a redundant memory access analysis, and find the checks that can
+  // be hoisted out of loops. The accesses of the hot basic blocks aren't
+  // checked, so they don't make any other access redundant.
+  hoisted_accesses_.clear();
+  hoisted_checks_.clear();
+  if (remove_redundant_checks_) {
+    memory_accesses_.Analyze(subgraph, hot_basic_blocks);
+    memory_accesses_.GetLoopInvariantAccesses(&hoisted_accesses_);
+  }
 
   // Determines if this subgraph uses unconventional stack pointer
   // manipulations.
@@ -1252,16 +1585,30 @@ bool AsanBasicBlockTransform::TransformBasicBlockSubGraph(
   if (!block_graph::HasUnexpectedStackFrameManipulation(subgraph))
     stack_mode = kSafeStackAccess;
 
-  // Iterates through each basic block and instruments it.
-  BasicBlockSubGraph::BBCollection::iterator it =
-      subgraph->basic_blocks().begin();
-  for (; it != subgraph->basic_blocks().end(); ++it) {
+  // Iterates through each basic block and instruments it. The basic blocks
+  // that are too hot are left uninstrumented.
+  for (it = subgraph->basic_blocks().begin();
+       it != subgraph->basic_blocks().end(); ++it) {
     BasicCodeBlock* bb = BasicCodeBlock::Cast(*it);
-    if (bb != NULL &&
-        !InstrumentBasicBlock(bb, stack_mode, block_graph->image_format())) {
+    if (bb == NULL || hot_basic_blocks.count(bb) != 0)
+      continue;
+    if (!InstrumentBasicBlock(bb, stack_mode, block_graph->image_format()))
       return false;
+  }
+
+  // Inject the hoisted checks once every basic block is instrumented, as the
+  // instrumentation walks the instructions in lockstep with their liveness.
+  if (!hoisted_checks_.empty()) {
+    for (it = subgraph->basic_blocks().begin();
+         it != subgraph->basic_blocks().end(); ++it) {
+      BasicCodeBlock* bb = BasicCodeBlock::Cast(*it);
+      if (bb != NULL &&
+          !InstrumentPreheader(bb, block_graph->image_format())) {
+        return false;
+      }
     }
   }
+
   return true;
 }
 
@@ -1313,8 +1660,11 @@ AsanTransform::AsanTransform()
     : debug_friendly_(false),
       use_liveness_analysis_(false),
       remove_redundant_checks_(false),
+      coalesce_checks_(false),
       use_interceptors_(false),
       instrumentation_rate_(1.0),
+      profile_(nullptr),
+      profile_budget_(1.0),
       asan_parameters_(nullptr),
       check_access_hooks_ref_(),
       asan_parameters_block_(nullptr),
@@ -1328,6 +1678,11 @@ void AsanTransform::set_instrumentation_rate(double instrumentation_rate) {
   instrumentation_rate_ = std::max(0.0, std::min(1.0, instrumentation_rate));
 }
 
+void AsanTransform::set_profile_budget(double profile_budget) {
+  // Set the profile budget, capping it between 0 and 1.
+  profile_budget_ = std::max(0.0, std::min(1.0, profile_budget));
+}
+
 bool AsanTransform::PreBlockGraphIteration(
     const TransformPolicyInterface* policy,
     BlockGraph* block_graph,
@@ -1355,10 +1710,21 @@ bool AsanTransform::PreBlockGraphIteration(
   if (block_graph->image_format() == BlockGraph::PE_IMAGE)
     PeFindStaticallyLinkedFunctionsToIntercept(kAsanIntercepts, block_graph);
 
+  // The profiles refer to the addresses of the original image, which are only
+  // known for PE images.
+  if (profile_ != nullptr) {
+    if (block_graph->image_format() != BlockGraph::PE_IMAGE) {
+      LOG(ERROR) << "Profile guided instrumentation requires a PE image.";
+      return false;
+    }
+    SelectHotBasicBlocks();
+  }
+
   // We don't need to import any hooks in hot patching mode.
   if (!hot_patching_) {
     if (!ImportAsanCheckAccessHooks(kAsanHookStubName,
                                     use_liveness_analysis(),
+                                    coalesce_checks(),
                                     &import_module,
                                     &check_access_hooks_ref_,
                                     policy,
@@ -1401,8 +1767,11 @@ bool AsanTransform::OnBlock(const TransformPolicyInterface* policy,
   transform.set_debug_friendly(debug_friendly());
   transform.set_use_liveness_analysis(use_liveness_analysis());
   transform.set_remove_redundant_checks(remove_redundant_checks());
+  transform.set_coalesce_checks(coalesce_checks());
   transform.set_filter(filter());
   transform.set_instrumentation_rate(instrumentation_rate_);
+  if (profile_ != nullptr)
+    transform.set_hot_basic_blocks(&hot_basic_blocks_);
 
   if (!hot_patching_) {
     if (!ApplyBasicBlockSubGraphTransform(
@@ -1538,6 +1907,36 @@ bool AsanTransform::ShouldSkipBlock(const TransformPolicyInterface* policy,
   return false;
 }
 
+void AsanTransform::SelectHotBasicBlocks() {
+  DCHECK_NE(static_cast<const IndexedFrequencyMap*>(nullptr), profile_);
+
+  // Gather the entry counts of the executed basic blocks.
+  typedef std::pair<uint64_t, core::RelativeAddress> CountAndAddress;
+  std::vector<CountAndAddress> counts;
+  uint64_t total_count = 0;
+  IndexedFrequencyMap::const_iterator freq = profile_->begin();
+  for (; freq != profile_->end(); ++freq) {
+    if (freq->first.second != 0 || freq->second == 0)
+      continue;
+    counts.push_back(std::make_pair(freq->second, freq->first.first));
+    total_count += freq->second;
+  }
+
+  // Leave the hottest basic blocks uninstrumented until the executions of the
+  // other ones fit in the budget.
+  std::sort(counts.begin(), counts.end(), std::greater<CountAndAddress>());
+  uint64_t budget = static_cast<uint64_t>(total_count * profile_budget_);
+  uint64_t instrumented_count = total_count;
+  hot_basic_blocks_.clear();
+  for (size_t i = 0; i < counts.size() && instrumented_count > budget; ++i) {
+    hot_basic_blocks_.insert(counts[i].second);
+    instrumented_count -= counts[i].first;
+  }
+
+  VLOG(1) << "Leaving " << hot_basic_blocks_.size() << " of "
+          << counts.size() << " executed basic blocks uninstrumented.";
+}
+
 void AsanTransform::PeFindStaticallyLinkedFunctionsToIntercept(
     const AsanIntercept* intercepts,
     BlockGraph* block_graph) {
@@ -1678,7 +2077,7 @@ bool AsanTransform::PeInjectAsanParameters(
   params_block->CopyData(fparams.data().size(), fparams.data().data());
 
   // Wire up any references that are required.
-  static_assert(15 == common::kAsanParametersVersion,
+  static_assert(19 == common::kAsanParametersVersion,
                 "Pointers in the params must be linked up here.");
   block_graph::TypedBlock<common::AsanParameters> params;
   CHECK(params.Init(0, params_block));
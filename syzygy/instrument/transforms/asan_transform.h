@@ -24,6 +24,7 @@
 #include <vector>
 
 #include "base/strings/string_piece.h"
+#include "syzygy/block_graph/basic_block_assembler.h"
 #include "syzygy/block_graph/filterable.h"
 #include "syzygy/block_graph/iterate.h"
 #include "syzygy/block_graph/analysis/liveness_analysis.h"
@@ -31,6 +32,8 @@
 #include "syzygy/block_graph/transforms/iterative_transform.h"
 #include "syzygy/block_graph/transforms/named_transform.h"
 #include "syzygy/common/asan_parameters.h"
+#include "syzygy/core/address.h"
+#include "syzygy/grinder/indexed_frequency_map.h"
 #include "syzygy/instrument/transforms/asan_interceptor_filter.h"
 #include "syzygy/instrument/transforms/asan_intercepts.h"
 #include "syzygy/pe/transforms/pe_add_imports_transform.h"
@@ -52,6 +55,9 @@ class AsanBasicBlockTransform
     kInstrAccess,
     kRepzAccess,
     kRepnzAccess,
+    // A range of memory covered by several read or write accesses.
+    kRangeReadAccess,
+    kRangeWriteAccess,
   };
 
   enum StackAccessMode {
@@ -75,6 +81,8 @@ class AsanBasicBlockTransform
   // Map of hooks to Asan check access functions.
   typedef std::map<AsanHookMapEntryKey, BlockGraph::Reference> AsanHookMap;
   typedef std::map<MemoryAccessMode, BlockGraph::Reference> AsanDefaultHookMap;
+  // A set of basic blocks, identified by their address in the original image.
+  typedef std::set<core::RelativeAddress> BasicBlockAddressSet;
 
   // Constructor.
   // @param check_access_hooks References to the various check access functions.
@@ -87,7 +95,9 @@ class AsanBasicBlockTransform
       instrumentation_happened_(false),
       instrumentation_rate_(1.0),
       remove_redundant_checks_(false),
-      use_liveness_analysis_(false) {
+      coalesce_checks_(false),
+      use_liveness_analysis_(false),
+      hot_basic_blocks_(NULL) {
     DCHECK(check_access_hooks != NULL);
   }
 
@@ -106,10 +116,24 @@ class AsanBasicBlockTransform
     remove_redundant_checks_ = remove_redundant_checks;
   }
 
+  bool coalesce_checks() const { return coalesce_checks_; }
+  void set_coalesce_checks(bool coalesce_checks) {
+    coalesce_checks_ = coalesce_checks;
+  }
+
   // The instrumentation rate must be in the range [0, 1], inclusive.
   double instrumentation_rate() const { return instrumentation_rate_; }
   void set_instrumentation_rate(double instrumentation_rate);
 
+  // The basic blocks that are too hot to be instrumented, identified by their
+  // address in the original image. May be NULL.
+  const BasicBlockAddressSet* hot_basic_blocks() const {
+    return hot_basic_blocks_;
+  }
+  void set_hot_basic_blocks(const BasicBlockAddressSet* hot_basic_blocks) {
+    hot_basic_blocks_ = hot_basic_blocks;
+  }
+
   // Instead of instrumenting the basic blocks, in dry run mode the instrumenter
   // only signals if any instrumentation would have happened on the block.
   // @returns true iff the instrumenter is in dry run mode.
@@ -150,13 +174,34 @@ class AsanBasicBlockTransform
                             StackAccessMode stack_mode,
                             BlockGraph::ImageFormat image_format);
 
+  // Injects the checks hoisted out of a loop at the end of its preheader.
+  // @param preheader The loop preheader receiving the checks.
+  // @param image_format The format of the image being instrumented.
+  // @returns true on success, false otherwise.
+  bool InstrumentPreheader(block_graph::BasicCodeBlock* preheader,
+                           BlockGraph::ImageFormat image_format);
+
  private:
+  // A memory access check moved from a loop header to the loop preheader.
+  struct HoistedCheck {
+    MemoryAccessInfo info;
+    block_graph::BasicBlockAssembler::Operand operand;
+    block_graph::Instruction::SourceRange source_range;
+  };
+  typedef std::map<const block_graph::BasicCodeBlock*,
+                   std::vector<HoistedCheck>> HoistedCheckMap;
+
   // Liveness analysis and liveness information for this subgraph.
   block_graph::analysis::LivenessAnalysis liveness_;
 
   // Memory accesses value numbering.
   block_graph::analysis::MemoryAccessAnalysis memory_accesses_;
 
+  // The loop invariant memory accesses of the current subgraph, and the checks
+  // waiting to be injected in the loop preheaders.
+  block_graph::analysis::MemoryAccessAnalysis::HoistingMap hoisted_accesses_;
+  HoistedCheckMap hoisted_checks_;
+
   // The references to the Asan access check import entries.
   AsanHookMap* check_access_hooks_;
 
@@ -176,12 +221,22 @@ class AsanBasicBlockTransform
   bool instrumentation_happened_;
 
   // When activated, a redundancy elimination is performed to minimize the
-  // memory checks added by this transform.
+  // memory checks added by this transform. Checks that are redundant on every
+  // path are removed, and loop invariant checks are hoisted to the preheaders.
   bool remove_redundant_checks_;
 
+  // When activated, the accesses of a basic block made through the same base
+  // and index registers to adjacent memory locations are checked at once by a
+  // single range check.
+  bool coalesce_checks_;
+
   // Set iff we should use the liveness analysis to do smarter instrumentation.
   bool use_liveness_analysis_;
 
+  // The basic blocks left uninstrumented because they are too hot. This is
+  // computed by the AsanTransform from an execution profile.
+  const BasicBlockAddressSet* hot_basic_blocks_;
+
   DISALLOW_COPY_AND_ASSIGN(AsanBasicBlockTransform);
 };
 
@@ -234,6 +289,7 @@ class AsanTransform
   typedef block_graph::TransformPolicyInterface TransformPolicyInterface;
   typedef AsanBasicBlockTransform::MemoryAccessMode MemoryAccessMode;
   typedef std::set<BlockGraph::Block*, BlockGraph::BlockIdLess> BlockSet;
+  typedef grinder::basic_block_util::IndexedFrequencyMap IndexedFrequencyMap;
 
   // Initialize a new AsanTransform instance.
   AsanTransform();
@@ -283,10 +339,30 @@ class AsanTransform
     remove_redundant_checks_ = remove_redundant_checks;
   }
 
+  // Coalescing the checks requires a runtime library exporting the range
+  // probes, so this is disabled by default.
+  bool coalesce_checks() const { return coalesce_checks_; }
+  void set_coalesce_checks(bool coalesce_checks) {
+    coalesce_checks_ = coalesce_checks;
+  }
+
   // The instrumentation rate must be in the range [0, 1], inclusive.
   double instrumentation_rate() const { return instrumentation_rate_; }
   void set_instrumentation_rate(double instrumentation_rate);
 
+  // The basic block execution profile of the image, as produced by the bbentry
+  // or branch instrumentation and the grinder. The entry count of a basic
+  // block is in the first column. When set, the hottest basic blocks are left
+  // uninstrumented to respect the profile budget. May be NULL.
+  // @note The profile must outlive the transform.
+  const IndexedFrequencyMap* profile() const { return profile_; }
+  void set_profile(const IndexedFrequencyMap* profile) { profile_ = profile; }
+
+  // The fraction of the profiled basic block executions that may run
+  // instrumented code. It must be in the range [0, 1], inclusive.
+  double profile_budget() const { return profile_budget_; }
+  void set_profile_budget(double profile_budget);
+
   // Asan RTL parameters.
   const common::InflatedAsanParameters* asan_parameters() const {
     return asan_parameters_;
@@ -346,6 +422,12 @@ class AsanTransform
   bool ShouldSkipBlock(const TransformPolicyInterface* policy,
                        BlockGraph::Block* block);
 
+  // Selects the hottest basic blocks of the profile so that the executions of
+  // the remaining basic blocks fit in the profile budget. Fills the
+  // hot_basic_blocks_ set.
+  // @pre profile_ must not be NULL.
+  void SelectHotBasicBlocks();
+
   // @name PE-specific methods.
   // @{
   // Finds statically linked functions that need to be intercepted. Called in
@@ -397,6 +479,10 @@ class AsanTransform
   // memory checks added by this transform.
   bool remove_redundant_checks_;
 
+  // When activated, the checks of adjacent memory accesses are coalesced into
+  // range checks.
+  bool coalesce_checks_;
+
   // Set iff we should use the functions interceptors.
   bool use_interceptors_;
 
@@ -404,6 +490,13 @@ class AsanTransform
   // implemented using random sampling.
   double instrumentation_rate_;
 
+  // The execution profile used to leave the hottest basic blocks
+  // uninstrumented, the budget of instrumented executions, and the basic
+  // blocks selected from them by SelectHotBasicBlocks.
+  const IndexedFrequencyMap* profile_;
+  double profile_budget_;
+  AsanBasicBlockTransform::BasicBlockAddressSet hot_basic_blocks_;
+
   // Asan RTL parameters that will be injected into the instrumented image.
   // These will be found by the RTL and used to control its behaviour. Allows
   // for setting parameters at instrumentation time that vary from the defaults.
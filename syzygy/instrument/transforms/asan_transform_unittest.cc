@@ -81,12 +81,14 @@ class TestAsanTransform : public AsanTransform {
  public:
   using AsanTransform::asan_parameters_block_;
   using AsanTransform::heap_init_blocks_;
+  using AsanTransform::hot_basic_blocks_;
   using AsanTransform::hot_patched_blocks_;
   using AsanTransform::static_intercepted_blocks_;
   using AsanTransform::use_interceptors_;
   using AsanTransform::use_liveness_analysis_;
   using AsanTransform::CoffInterceptFunctions;
   using AsanTransform::FindHeapInitAndCrtHeapBlocks;
+  using AsanTransform::SelectHotBasicBlocks;
   using AsanTransform::ShouldSkipBlock;
   using AsanTransform::PeFindStaticallyLinkedFunctionsToIntercept;
   using AsanTransform::PeInterceptFunctions;
@@ -169,6 +171,16 @@ class AsanTransformTest : public testing::TestDllTransformTest {
                  false);
     }
 
+    // Initialize the range access hooks.
+    AddHookRef("asan_check_range_read_access",
+               AsanBasicBlockTransform::kRangeReadAccess, 0, 0, true);
+    AddHookRef("asan_check_range_read_access_no_flags",
+               AsanBasicBlockTransform::kRangeReadAccess, 0, 0, false);
+    AddHookRef("asan_check_range_write_access",
+               AsanBasicBlockTransform::kRangeWriteAccess, 0, 0, true);
+    AddHookRef("asan_check_range_write_access_no_flags",
+               AsanBasicBlockTransform::kRangeWriteAccess, 0, 0, false);
+
     const _InstructionType strings[] = {I_CMPS, I_LODS, I_MOVS, I_STOS};
     int strings_length = arraysize(strings);
 
@@ -317,6 +329,48 @@ TEST_F(AsanTransformTest, SetInstrumentationRate) {
   EXPECT_EQ(0.5, bb_transform.instrumentation_rate());
 }
 
+TEST_F(AsanTransformTest, SetProfileBudget) {
+  EXPECT_EQ(1.0, asan_transform_.profile_budget());
+  asan_transform_.set_profile_budget(0.5);
+  EXPECT_EQ(0.5, asan_transform_.profile_budget());
+  asan_transform_.set_profile_budget(-1.0);
+  EXPECT_EQ(0.0, asan_transform_.profile_budget());
+  asan_transform_.set_profile_budget(2.0);
+  EXPECT_EQ(1.0, asan_transform_.profile_budget());
+}
+
+TEST_F(AsanTransformTest, SelectHotBasicBlocks) {
+  // A profile of 4 basic blocks, one of them never executed. The other columns
+  // of the profile are ignored.
+  AsanTransform::IndexedFrequencyMap profile;
+  profile[std::make_pair(RelativeAddress(0x1000), 0)] = 100;
+  profile[std::make_pair(RelativeAddress(0x1000), 1)] = 1000;
+  profile[std::make_pair(RelativeAddress(0x2000), 0)] = 50;
+  profile[std::make_pair(RelativeAddress(0x3000), 0)] = 10;
+  profile[std::make_pair(RelativeAddress(0x4000), 0)] = 0;
+  asan_transform_.set_profile(&profile);
+
+  asan_transform_.set_profile_budget(1.0);
+  asan_transform_.SelectHotBasicBlocks();
+  EXPECT_TRUE(asan_transform_.hot_basic_blocks_.empty());
+
+  asan_transform_.set_profile_budget(0.5);
+  asan_transform_.SelectHotBasicBlocks();
+  AsanBasicBlockTransform::BasicBlockAddressSet expected;
+  expected.insert(RelativeAddress(0x1000));
+  EXPECT_THAT(asan_transform_.hot_basic_blocks_, ContainerEq(expected));
+
+  asan_transform_.set_profile_budget(0.1);
+  asan_transform_.SelectHotBasicBlocks();
+  expected.insert(RelativeAddress(0x2000));
+  EXPECT_THAT(asan_transform_.hot_basic_blocks_, ContainerEq(expected));
+
+  asan_transform_.set_profile_budget(0.0);
+  asan_transform_.SelectHotBasicBlocks();
+  expected.insert(RelativeAddress(0x3000));
+  EXPECT_THAT(asan_transform_.hot_basic_blocks_, ContainerEq(expected));
+}
+
 TEST_F(AsanTransformTest, SetInterceptCRTFuntionsFlag) {
   EXPECT_FALSE(asan_transform_.use_interceptors());
   asan_transform_.set_use_interceptors(true);
@@ -340,6 +394,21 @@ TEST_F(AsanTransformTest, SetRemoveRedundantChecksFlag) {
   EXPECT_FALSE(bb_transform.remove_redundant_checks());
 }
 
+TEST_F(AsanTransformTest, SetCoalesceChecksFlag) {
+  EXPECT_FALSE(asan_transform_.coalesce_checks());
+  asan_transform_.set_coalesce_checks(true);
+  EXPECT_TRUE(asan_transform_.coalesce_checks());
+  asan_transform_.set_coalesce_checks(false);
+  EXPECT_FALSE(asan_transform_.coalesce_checks());
+
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  EXPECT_FALSE(bb_transform.coalesce_checks());
+  bb_transform.set_coalesce_checks(true);
+  EXPECT_TRUE(bb_transform.coalesce_checks());
+  bb_transform.set_coalesce_checks(false);
+  EXPECT_FALSE(bb_transform.coalesce_checks());
+}
+
 TEST_F(AsanTransformTest, SetUseLivenessFlag) {
   EXPECT_FALSE(asan_transform_.use_liveness_analysis());
   asan_transform_.set_use_liveness_analysis(true);
@@ -634,6 +703,219 @@ TEST_F(AsanTransformTest, InstrumentAndRemoveRedundantChecks) {
   ASSERT_EQ(basic_block_->instructions().size(), expected_instructions_count);
 }
 
+TEST_F(AsanTransformTest, InstrumentAndCoalesceAdjacentChecks) {
+  // Three adjacent accesses through eax, then an access through eax once it
+  // has been modified.
+  bb_asm_->mov(assm::ecx, block_graph::Operand(assm::eax));
+  bb_asm_->mov(assm::edx, block_graph::Operand(
+      assm::eax, block_graph::Displacement(4, assm::kSize8Bit)));
+  bb_asm_->mov(block_graph::Operand(
+      assm::eax, block_graph::Displacement(8, assm::kSize8Bit)), assm::ecx);
+  bb_asm_->add(assm::eax, assm::edx);
+  bb_asm_->mov(assm::ecx, block_graph::Operand(
+      assm::eax, block_graph::Displacement(4, assm::kSize8Bit)));
+
+  // The first three accesses are checked with a single range check, and the
+  // last one with a regular check.
+  uint32_t expected_instructions_count =
+      basic_block_->instructions().size() + 4 + 3;
+  InitHooksRefs();
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_coalesce_checks(true);
+  ASSERT_TRUE(bb_transform.InstrumentBasicBlock(
+      basic_block_,
+      AsanBasicBlockTransform::kSafeStackAccess,
+      BlockGraph::PE_IMAGE));
+  EXPECT_TRUE(bb_transform.instrumentation_happened());
+  ASSERT_EQ(expected_instructions_count, basic_block_->instructions().size());
+
+  // The range check covers [eax, eax + 12) and reports a write.
+  BasicBlock::Instructions::const_iterator iter_inst =
+      basic_block_->instructions().begin();
+  EXPECT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  EXPECT_EQ(I_LEA, iter_inst->representation().opcode);
+  EXPECT_EQ(0U, iter_inst->representation().disp);
+  ++iter_inst;
+  EXPECT_EQ(I_PUSH, iter_inst->representation().opcode);
+  EXPECT_EQ(12U, iter_inst->representation().imm.dword);
+  ++iter_inst;
+  ASSERT_EQ(I_CALL, iter_inst->representation().opcode);
+  HookMapEntryKey range_key = {
+      AsanBasicBlockTransform::kRangeWriteAccess, 0, 0, true };
+  EXPECT_EQ(hooks_check_access_[range_key],
+            iter_inst->references().begin()->second.block());
+}
+
+TEST_F(AsanTransformTest, DoNotCoalesceChecksOfReferencedDisplacements) {
+  // Two adjacent accesses through eax whose displacements refer to different
+  // blocks.
+  BlockGraph::Block* data1 =
+      block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 8, "data1");
+  BlockGraph::Block* data2 =
+      block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 8, "data2");
+  bb_asm_->mov(assm::ecx, block_graph::Operand(
+      assm::eax, block_graph::Displacement(data1, 0)));
+  bb_asm_->mov(assm::edx, block_graph::Operand(
+      assm::eax, block_graph::Displacement(data2, 4)));
+
+  // Each access keeps its own check, with its own reference.
+  uint32_t expected_instructions_count =
+      basic_block_->instructions().size() + 2 * 3;
+  InitHooksRefs();
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_coalesce_checks(true);
+  ASSERT_TRUE(bb_transform.InstrumentBasicBlock(
+      basic_block_,
+      AsanBasicBlockTransform::kSafeStackAccess,
+      BlockGraph::PE_IMAGE));
+  EXPECT_TRUE(bb_transform.instrumentation_happened());
+  ASSERT_EQ(expected_instructions_count, basic_block_->instructions().size());
+
+  BasicBlock::Instructions::const_iterator iter_inst =
+      basic_block_->instructions().begin();
+  const BlockGraph::Block* expected_blocks[] = { data1, data2 };
+  for (size_t i = 0; i < arraysize(expected_blocks); ++i) {
+    EXPECT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+    ASSERT_EQ(I_LEA, iter_inst->representation().opcode);
+    ASSERT_EQ(1U, iter_inst->references().size());
+    EXPECT_EQ(expected_blocks[i],
+              iter_inst->references().begin()->second.block());
+    ++iter_inst;
+    ASSERT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+    EXPECT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+  }
+}
+
+TEST_F(AsanTransformTest, HotBasicBlocksNotInstrumented) {
+  // Give the dummy basic block an address in the original image.
+  BlockGraph::Block* block =
+      block_graph_.AddBlock(BlockGraph::CODE_BLOCK, 16, "original");
+  block->set_addr(RelativeAddress(0x1000));
+  subgraph_.set_original_block(block);
+  basic_block_->set_offset(4);
+
+  bb_asm_->mov(assm::eax, block_graph::Operand(assm::ebx));
+  size_t instructions_count = basic_block_->instructions().size();
+
+  InitHooksRefs();
+  AsanBasicBlockTransform::BasicBlockAddressSet hot_basic_blocks;
+  hot_basic_blocks.insert(RelativeAddress(0x1004));
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_hot_basic_blocks(&hot_basic_blocks);
+  ASSERT_TRUE(bb_transform.TransformBasicBlockSubGraph(
+      &pe_policy_, &block_graph_, &subgraph_));
+  EXPECT_FALSE(bb_transform.instrumentation_happened());
+  EXPECT_EQ(instructions_count, basic_block_->instructions().size());
+
+  // The basic block is instrumented once it's no longer hot.
+  hot_basic_blocks.clear();
+  ASSERT_TRUE(bb_transform.TransformBasicBlockSubGraph(
+      &pe_policy_, &block_graph_, &subgraph_));
+  EXPECT_TRUE(bb_transform.instrumentation_happened());
+  EXPECT_EQ(instructions_count + 3, basic_block_->instructions().size());
+}
+
+TEST_F(AsanTransformTest, HotBasicBlocksDontMakeChecksRedundant) {
+  // The dummy basic block is hot, and dominates a cold basic block accessing
+  // the same operand.
+  BlockGraph::Block* block =
+      block_graph_.AddBlock(BlockGraph::CODE_BLOCK, 16, "original");
+  block->set_addr(RelativeAddress(0x1000));
+  subgraph_.set_original_block(block);
+  basic_block_->set_offset(4);
+  BasicCodeBlock* cold = subgraph_.AddBasicCodeBlock("cold");
+  cold->set_offset(8);
+  subgraph_.block_descriptions().front().basic_block_order.push_back(cold);
+  basic_block_->successors().push_back(block_graph::Successor(
+      block_graph::Successor::kConditionTrue,
+      block_graph::BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                       BlockGraph::Reference::kMaximumSize,
+                                       cold),
+      0));
+
+  bb_asm_->mov(assm::eax, block_graph::Operand(assm::ebx));
+  block_graph::BasicBlockAssembler cold_asm(cold->instructions().end(),
+                                            &cold->instructions());
+  cold_asm.mov(assm::ecx, block_graph::Operand(assm::ebx));
+  size_t instructions_count = basic_block_->instructions().size();
+
+  InitHooksRefs();
+  AsanBasicBlockTransform::BasicBlockAddressSet hot_basic_blocks;
+  hot_basic_blocks.insert(RelativeAddress(0x1004));
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_remove_redundant_checks(true);
+  bb_transform.set_hot_basic_blocks(&hot_basic_blocks);
+  ASSERT_TRUE(bb_transform.TransformBasicBlockSubGraph(
+      &pe_policy_, &block_graph_, &subgraph_));
+  EXPECT_TRUE(bb_transform.instrumentation_happened());
+
+  // The unchecked access of the hot basic block doesn't cover the cold one.
+  EXPECT_EQ(instructions_count, basic_block_->instructions().size());
+  ASSERT_EQ(4U, cold->instructions().size());
+  BasicBlock::Instructions::const_iterator iter_inst =
+      cold->instructions().begin();
+  EXPECT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  EXPECT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+  EXPECT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+  EXPECT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+}
+
+TEST_F(AsanTransformTest, InstrumentAndHoistLoopInvariantChecks) {
+  // Build a loop whose header reads [esi + 4], with the dummy basic block as
+  // its preheader. The body only modifies edi.
+  BasicCodeBlock* header = subgraph_.AddBasicCodeBlock("header");
+  BasicCodeBlock* body = subgraph_.AddBasicCodeBlock("body");
+  BasicCodeBlock* loop_exit = subgraph_.AddBasicCodeBlock("loop_exit");
+  BasicBlockSubGraph::BlockDescription& description =
+      subgraph_.block_descriptions().front();
+  description.basic_block_order.push_back(header);
+  description.basic_block_order.push_back(body);
+  description.basic_block_order.push_back(loop_exit);
+
+  struct {
+    block_graph::Successor::Condition condition;
+    BasicCodeBlock* from;
+    BasicCodeBlock* to;
+  } edges[] = {
+    { block_graph::Successor::kConditionTrue, basic_block_, header },
+    { block_graph::Successor::kConditionEqual, header, body },
+    { block_graph::Successor::kConditionNotEqual, header, loop_exit },
+    { block_graph::Successor::kConditionTrue, body, header },
+  };
+  for (size_t i = 0; i < arraysize(edges); ++i) {
+    edges[i].from->successors().push_back(block_graph::Successor(
+        edges[i].condition,
+        block_graph::BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                         BlockGraph::Reference::kMaximumSize,
+                                         edges[i].to),
+        0));
+  }
+
+  block_graph::BasicBlockAssembler header_asm(header->instructions().end(),
+                                              &header->instructions());
+  header_asm.mov(assm::ecx, block_graph::Operand(
+      assm::esi, block_graph::Displacement(4, assm::kSize32Bit)));
+  block_graph::BasicBlockAssembler body_asm(body->instructions().end(),
+                                            &body->instructions());
+  body_asm.add(assm::edi, assm::ecx);
+
+  InitHooksRefs();
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_remove_redundant_checks(true);
+  ASSERT_TRUE(bb_transform.TransformBasicBlockSubGraph(
+      &pe_policy_, &block_graph_, &subgraph_));
+  EXPECT_TRUE(bb_transform.instrumentation_happened());
+
+  // The header is left untouched, and the check is done in the preheader.
+  EXPECT_EQ(1U, header->instructions().size());
+  ASSERT_EQ(3U, basic_block_->instructions().size());
+  BasicBlock::Instructions::const_iterator iter_inst =
+      basic_block_->instructions().begin();
+  EXPECT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  EXPECT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+  EXPECT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+}
+
 TEST_F(AsanTransformTest, NonInstrumentableStackBasedInstructions) {
   // DEC DWORD [EBP - 0x2830]
   static const uint8_t kDec1[6] = {0xff, 0x8d, 0xd0, 0xd7, 0xff, 0xff};
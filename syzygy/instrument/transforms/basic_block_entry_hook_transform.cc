@@ -32,6 +32,7 @@ namespace transforms {
 
 namespace {
 
+using assm::eax;
 using block_graph::BasicBlock;
 using block_graph::BasicBlockAssembler;
 using block_graph::BasicBlockReference;
@@ -43,6 +44,8 @@ using block_graph::Immediate;
 using block_graph::Operand;
 using block_graph::Successor;
 using block_graph::TransformPolicyInterface;
+using block_graph::analysis::LivenessAnalysis;
+using common::IndexedFrequencyData;
 using common::kBasicBlockEntryAgentId;
 using common::ThreadLocalIndexedFrequencyData;
 using pe::transforms::PEAddImportsTransform;
@@ -53,6 +56,15 @@ typedef pe::transforms::ImportedModule ImportedModule;
 const char kDefaultModuleName[] = "basic_block_entry_client.dll";
 const char kBasicBlockEnter[] = "_increment_indexed_freq_data";
 
+const BlockGraph::Offset kFrequencyDataOffset =
+    offsetof(IndexedFrequencyData, frequency_data);
+
+// The registers that may hold the frequency data pointer in the inline
+// counters, in order of preference.
+const assm::RegisterId kScratchRegisters[] = {
+    assm::kRegisterEax, assm::kRegisterEcx, assm::kRegisterEdx,
+    assm::kRegisterEbx, assm::kRegisterEsi, assm::kRegisterEdi };
+
 // Compares two relative address ranges to see if they overlap. Assumes they
 // are already sorted. This is used to validate basic-block ranges.
 struct RelativeAddressRangesOverlapFunctor {
@@ -128,7 +140,8 @@ BasicBlockEntryHookTransform::BasicBlockEntryHookTransform()
     thunk_section_(NULL),
     instrument_dll_name_(kDefaultModuleName),
     set_src_ranges_for_thunks_(false),
-    set_inline_fast_path_(false) {
+    set_inline_fast_path_(false),
+    inline_counters_(false) {
 }
 
 bool BasicBlockEntryHookTransform::PreBlockGraphIteration(
@@ -206,8 +219,13 @@ bool BasicBlockEntryHookTransform::TransformBasicBlockSubGraph(
   DCHECK(bb_entry_hook_ref_.IsValid());
   DCHECK(add_frequency_data_.frequency_data_block() != NULL);
 
-  // Insert a call to the basic-block entry hook at the top of each code
-  // basic-block.
+  // The inline counters restore any register or flag they clobber that may be
+  // live at the top of a basic-block, so they don't invalidate the analysis.
+  if (inline_counters_)
+    liveness_.Analyze(subgraph);
+
+  // Insert a call to the basic-block entry hook, or an inline counter
+  // increment, at the top of each code basic-block.
   BasicBlockSubGraph::BBCollection::iterator it =
       subgraph->basic_blocks().begin();
   for (; it != subgraph->basic_blocks().end(); ++it) {
@@ -223,6 +241,12 @@ bool BasicBlockEntryHookTransform::TransformBasicBlockSubGraph(
       return false;
     }
 
+    if (inline_counters_) {
+      InsertInlineCounter(bb_ranges_.size(), bb);
+      bb_ranges_.push_back(source_range);
+      continue;
+    }
+
     // We use the location/index in the bb_ranges vector of the current
     // basic-block range as the basic_block_id, and we pass a pointer to
     // the frequency data block as the module_data parameter. We then make
@@ -245,6 +269,51 @@ bool BasicBlockEntryHookTransform::TransformBasicBlockSubGraph(
   return true;
 }
 
+void BasicBlockEntryHookTransform::InsertInlineCounter(
+    size_t basic_block_id, BasicCodeBlock* bb) {
+  DCHECK(bb != NULL);
+
+  LivenessAnalysis::State state;
+  liveness_.GetStateAtEntryOf(bb, &state);
+
+  // Look for a register that is dead at the top of the basic-block, or fall
+  // back to saving eax.
+  const assm::Register32* scratch = NULL;
+  for (size_t i = 0; i < arraysize(kScratchRegisters); ++i) {
+    const assm::Register& reg = assm::Register::Get(kScratchRegisters[i]);
+    if (!state.IsLive(reg)) {
+      scratch = &assm::CastAsRegister32(reg);
+      break;
+    }
+  }
+  bool save_scratch = (scratch == NULL);
+  if (save_scratch)
+    scratch = &eax;
+  bool save_flags = state.AreArithmeticFlagsLive();
+
+  // We prepend the basic-block with the following instructions:
+  //   pushfd                     (if the flags may be live)
+  //   push eax                   (if no register is dead)
+  //   mov reg, dword ptr [data.frequency_data]
+  //   add dword ptr [reg + 4 * basic_block_id], 1
+  //   pop eax                    (if no register is dead)
+  //   popfd                      (if the flags may be live)
+  BasicBlockAssembler bb_asm(bb->instructions().begin(), &bb->instructions());
+  if (save_flags)
+    bb_asm.pushfd();
+  if (save_scratch)
+    bb_asm.push(*scratch);
+  bb_asm.mov(*scratch,
+             Operand(Displacement(add_frequency_data_.frequency_data_block(),
+                                  kFrequencyDataOffset)));
+  bb_asm.add(Operand(*scratch, Displacement(basic_block_id * sizeof(uint32_t))),
+             Immediate(1, assm::kSize8Bit));
+  if (save_scratch)
+    bb_asm.pop(*scratch);
+  if (save_flags)
+    bb_asm.popfd();
+}
+
 bool BasicBlockEntryHookTransform::PostBlockGraphIteration(
     const TransformPolicyInterface* policy,
     BlockGraph* block_graph,
@@ -21,6 +21,7 @@
 #include <vector>
 
 #include "base/strings/string_piece.h"
+#include "syzygy/block_graph/analysis/liveness_analysis.h"
 #include "syzygy/block_graph/basic_block_assembler.h"
 #include "syzygy/block_graph/iterate.h"
 #include "syzygy/block_graph/transforms/iterative_transform.h"
@@ -36,6 +37,15 @@ namespace transforms {
 // The entry-hook function is responsible for being non-disruptive to the
 // calling environment. I.e., it must preserve all volatile registers, any
 // registers it uses, and the processor flags.
+//
+// In inline counters mode, the decomposable basic-blocks are instead prepended
+// with an inline increment of their counter in the frequency data, which spares
+// the call to the agent:
+//     mov reg, dword ptr [module_data.frequency_data]
+//     add dword ptr [reg + 4 * basic_block_id], 1
+// The scratch register and the flags are only saved and restored if they may
+// be live at the start of the basic-block. The counters are not updated
+// atomically, nor saturated.
 class BasicBlockEntryHookTransform
     : public block_graph::transforms::IterativeTransformImpl<
           BasicBlockEntryHookTransform>,
@@ -81,6 +91,14 @@ class BasicBlockEntryHookTransform
     set_inline_fast_path_ = value;
   }
 
+  // @returns true if the decomposable basic-blocks increment their counter
+  //     inline rather than calling the agent.
+  bool inline_counters() const { return inline_counters_; }
+
+  // Set a flag denoting whether or not the decomposable basic-blocks should
+  // increment their counter inline rather than calling the agent.
+  void set_inline_counters(bool value) { inline_counters_ = value; }
+
  protected:
   typedef std::map<BlockGraph::Offset, BlockGraph::Block*> ThunkBlockMap;
 
@@ -154,6 +172,12 @@ class BasicBlockEntryHookTransform
   bool CreateBasicBlockEntryThunk(BlockGraph* block_graph,
                                   BlockGraph::Block** fast_path_block);
 
+  // Prepends an inline increment of the counter of a basic-block.
+  // @param basic_block_id The ID of the basic-block.
+  // @param bb The basic-block to instrument.
+  void InsertInlineCounter(size_t basic_block_id,
+                           block_graph::BasicCodeBlock* bb);
+
   // Adds the basic-block frequency data referenced by the coverage agent.
   AddIndexedFrequencyDataTransform add_frequency_data_;
 
@@ -179,6 +203,13 @@ class BasicBlockEntryHookTransform
   // falling back to the hook in the agent.
   bool set_inline_fast_path_;
 
+  // If true, the decomposable basic-blocks increment their counter inline.
+  bool inline_counters_;
+
+  // The liveness analysis of the subgraph being transformed, used to avoid
+  // saving the registers and flags clobbered by the inline counters.
+  block_graph::analysis::LivenessAnalysis liveness_;
+
   // The name of this transform.
   static const char kTransformName[];
 
@@ -64,7 +64,8 @@ class BasicBlockEntryHookTransformTest : public testing::TestDllTransformTest {
  public:
   enum InstrumentationKind {
     kAgentInstrumentation,
-    kFastPathInstrumentation
+    kFastPathInstrumentation,
+    kInlineCounterInstrumentation
   };
 
   void CheckBasicBlockInstrumentation(InstrumentationKind kind);
@@ -156,6 +157,32 @@ void BasicBlockEntryHookTransformTest::CheckBasicBlockInstrumentation(
         ASSERT_EQ(1U, inst3.references().size());
         EXPECT_EQ(tx_.bb_entry_hook_ref_.referenced(),
                   inst3.references().begin()->second.block());
+      } else if (kind == kInlineCounterInstrumentation) {
+        BasicBlock::Instructions::const_iterator inst_iter =
+            bb->instructions().begin();
+
+        // The flags and the scratch register may be saved first.
+        if (inst_iter != bb->instructions().end() &&
+            inst_iter->representation().opcode == I_PUSHF) {
+          ++inst_iter;
+        }
+        if (inst_iter != bb->instructions().end() &&
+            inst_iter->representation().opcode == I_PUSH) {
+          ++inst_iter;
+        }
+
+        // Then the frequency data pointer should be loaded.
+        ASSERT_TRUE(inst_iter != bb->instructions().end());
+        const Instruction& load = *inst_iter;
+        EXPECT_EQ(I_MOV, load.representation().opcode);
+        ASSERT_EQ(1U, load.references().size());
+        EXPECT_EQ(tx_.frequency_data_block(),
+                  load.references().begin()->second.block());
+
+        // And the counter incremented.
+        ASSERT_TRUE(++inst_iter != bb->instructions().end());
+        EXPECT_EQ(I_ADD, inst_iter->representation().opcode);
+        EXPECT_TRUE(inst_iter->references().empty());
       } else {
         DCHECK(kind == kFastPathInstrumentation);
         ASSERT_LE(2U, bb->instructions().size());
@@ -223,5 +250,36 @@ TEST_F(BasicBlockEntryHookTransformTest, ApplyAgentInstrumentation) {
   CheckBasicBlockInstrumentation(kAgentInstrumentation);
 }
 
+TEST_F(BasicBlockEntryHookTransformTest, SetInlineCountersFlag) {
+  EXPECT_FALSE(tx_.inline_counters());
+  tx_.set_inline_counters(true);
+  EXPECT_TRUE(tx_.inline_counters());
+  tx_.set_inline_counters(false);
+  EXPECT_FALSE(tx_.inline_counters());
+}
+
+TEST_F(BasicBlockEntryHookTransformTest, ApplyInlineCounterInstrumentation) {
+  ASSERT_NO_FATAL_FAILURE(DecomposeTestDll());
+
+  // Apply the transform.
+  tx_.set_inline_counters(true);
+  ASSERT_TRUE(block_graph::ApplyBlockGraphTransform(
+      &tx_, policy_, &block_graph_, header_block_));
+  ASSERT_TRUE(tx_.frequency_data_block() != NULL);
+  ASSERT_TRUE(tx_.thunk_section_ != NULL);
+  ASSERT_LT(0u, tx_.bb_ranges().size());
+
+  // The frequency data is laid out as with the agent instrumentation.
+  block_graph::ConstTypedBlock<IndexedFrequencyData> frequency_data;
+  ASSERT_TRUE(frequency_data.Init(0, tx_.frequency_data_block()));
+  EXPECT_EQ(IndexedFrequencyData::BASIC_BLOCK_ENTRY, frequency_data->data_type);
+  EXPECT_EQ(tx_.bb_ranges().size(), frequency_data->num_entries);
+  EXPECT_EQ(1U, frequency_data->num_columns);
+  EXPECT_EQ(sizeof(uint32_t), frequency_data->frequency_size);
+
+  // Validate that all basic block have been instrumented.
+  CheckBasicBlockInstrumentation(kInlineCounterInstrumentation);
+}
+
 }  // namespace transforms
 }  // namespace instrument
@@ -14,6 +14,9 @@
 
 #include "syzygy/instrument/transforms/coverage_transform.h"
 
+#include <unordered_map>
+
+#include "syzygy/block_graph/analysis/dominator_analysis.h"
 #include "syzygy/block_graph/basic_block_assembler.h"
 #include "syzygy/block_graph/block_util.h"
 #include "syzygy/common/indexed_frequency_data.h"
@@ -39,6 +42,7 @@ using block_graph::Displacement;
 using block_graph::Immediate;
 using block_graph::Operand;
 using block_graph::TransformPolicyInterface;
+using block_graph::analysis::DominatorAnalysis;
 
 typedef CoverageInstrumentationTransform::RelativeAddressRange
     RelativeAddressRange;
@@ -60,6 +64,185 @@ struct RelativeAddressRangesOverlapFunctor {
   }
 };
 
+typedef std::vector<std::vector<size_t>> AdjacencyLists;
+
+// @returns true if a node flagged in @p is_target can be reached from one of
+//     @p sources without going through a node flagged in @p is_blocked.
+bool CanReach(const AdjacencyLists& successors,
+              const std::vector<size_t>& sources,
+              const std::vector<bool>& is_target,
+              const std::vector<bool>& is_blocked) {
+  std::vector<bool> marked(successors.size(), false);
+  std::vector<size_t> working;
+  for (size_t source : sources) {
+    if (!is_blocked[source] && !marked[source]) {
+      marked[source] = true;
+      working.push_back(source);
+    }
+  }
+  while (!working.empty()) {
+    size_t node = working.back();
+    working.pop_back();
+    if (is_target[node])
+      return true;
+    for (size_t succ : successors[node]) {
+      if (!is_blocked[succ] && !marked[succ]) {
+        marked[succ] = true;
+        working.push_back(succ);
+      }
+    }
+  }
+  return false;
+}
+
+// Selects the basic blocks of a subgraph to probe, such that the visit of every
+// basic block can be derived from the visits of the probed ones.
+//
+// The visit of a probed basic block P implies the visit of every basic block
+// that dominates or post-dominates P. A basic block X is visited iff one of
+// these probes is, unless an execution can go through X while avoiding all of
+// them, i.e., unless X can be reached from an entry point and can itself reach
+// an exit, or a basic block that has no path to an exit, in the graph where
+// these probes are removed. Such a basic block is probed.
+//
+// The leaves of the dominator tree that don't post-dominate another leaf are
+// probed first, as every other basic block is usually derived from them. The
+// other basic blocks are then checked bottom-up. Adding a probe never
+// invalidates a basic block that was already checked. This is quadratic in the
+// number of basic blocks, which is fine for the size of functions.
+// @param dominators The dominator analysis of the subgraph.
+// @param bbs The code basic blocks of the subgraph.
+// @param probes Receives, for each basic block of @p bbs, the indices of the
+//     probed basic blocks whose visits imply its visit. A probed basic block is
+//     only implied by itself.
+void SelectProbes(const DominatorAnalysis& dominators,
+                  const std::vector<BasicCodeBlock*>& bbs,
+                  std::vector<std::vector<size_t>>* probes) {
+  DCHECK_NE(static_cast<std::vector<std::vector<size_t>>*>(nullptr), probes);
+
+  std::unordered_map<const BasicCodeBlock*, size_t> index_of;
+  for (size_t i = 0; i < bbs.size(); ++i)
+    index_of[bbs[i]] = i;
+  probes->assign(bbs.size(), std::vector<size_t>());
+
+  // Build the control flow graph of the code basic blocks. As for the dominator
+  // analysis, a basic block with no successor in the subgraph, or with one
+  // leaving it, is an exit.
+  AdjacencyLists successors(bbs.size());
+  AdjacencyLists predecessors(bbs.size());
+  std::vector<bool> is_exit(bbs.size(), false);
+  for (size_t i = 0; i < bbs.size(); ++i) {
+    for (const auto& succ : bbs[i]->successors()) {
+      auto target = index_of.find(
+          BasicCodeBlock::Cast(succ.reference().basic_block()));
+      if (target == index_of.end()) {
+        is_exit[i] = true;
+        continue;
+      }
+      successors[i].push_back(target->second);
+      predecessors[target->second].push_back(i);
+    }
+    if (successors[i].empty())
+      is_exit[i] = true;
+  }
+  std::vector<size_t> entries;
+  for (const BasicCodeBlock* entry : dominators.entry_points())
+    entries.push_back(index_of[entry]);
+
+  // The executions through a basic block end at an exit, or loop forever in
+  // basic blocks that have no path to an exit. The latter are found by walking
+  // back from the exits.
+  std::vector<bool> is_end(bbs.size(), true);
+  std::vector<size_t> working;
+  for (size_t i = 0; i < bbs.size(); ++i) {
+    if (is_exit[i])
+      working.push_back(i);
+  }
+  std::vector<bool> reaches_exit(is_exit);
+  while (!working.empty()) {
+    size_t node = working.back();
+    working.pop_back();
+    for (size_t pred : predecessors[node]) {
+      if (!reaches_exit[pred]) {
+        reaches_exit[pred] = true;
+        is_end[pred] = false;
+        working.push_back(pred);
+      }
+    }
+  }
+
+  // Unreachable basic blocks are not part of the dominator tree, so they are
+  // always probed. The reachable ones are leaves until proven otherwise.
+  std::vector<bool> is_probed(bbs.size(), false);
+  std::vector<bool> is_leaf(bbs.size(), false);
+  for (size_t i = 0; i < bbs.size(); ++i) {
+    if (dominators.IsReachable(bbs[i]))
+      is_leaf[i] = true;
+    else
+      is_probed[i] = true;
+  }
+  for (size_t i = 0; i < bbs.size(); ++i) {
+    const BasicCodeBlock* idom = dominators.GetImmediateDominator(bbs[i]);
+    if (idom != NULL)
+      is_leaf[index_of[idom]] = false;
+  }
+  std::vector<size_t> leaves;
+  for (size_t i = 0; i < bbs.size(); ++i) {
+    if (is_leaf[i])
+      leaves.push_back(i);
+  }
+  for (size_t leaf : leaves) {
+    bool is_minimal = true;
+    for (size_t other : leaves) {
+      if (other != leaf &&
+          dominators.PostDominates(bbs[leaf], bbs[other])) {
+        is_minimal = false;
+        break;
+      }
+    }
+    if (is_minimal)
+      is_probed[leaf] = true;
+  }
+
+  // Check the basic blocks bottom-up, so that the children in the dominator
+  // tree are settled before their parents.
+  const DominatorAnalysis::BasicBlockOrdering& order =
+      dominators.reverse_post_order();
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    size_t bb = index_of[*it];
+    if (is_probed[bb])
+      continue;
+
+    std::vector<bool> is_implying(bbs.size(), false);
+    std::vector<size_t>& implying = (*probes)[bb];
+    for (size_t i = 0; i < bbs.size(); ++i) {
+      if (is_probed[i] && dominators.IsReachable(bbs[i]) &&
+          (dominators.Dominates(bbs[bb], bbs[i]) ||
+           dominators.PostDominates(bbs[bb], bbs[i]))) {
+        is_implying[i] = true;
+        implying.push_back(i);
+      }
+    }
+
+    std::vector<bool> is_bb(bbs.size(), false);
+    is_bb[bb] = true;
+    if (CanReach(successors, entries, is_bb, is_implying) &&
+        CanReach(successors, std::vector<size_t>(1, bb), is_end,
+                 is_implying)) {
+      is_probed[bb] = true;
+      implying.clear();
+    }
+  }
+
+  for (size_t i = 0; i < bbs.size(); ++i) {
+    if (is_probed[i]) {
+      DCHECK((*probes)[i].empty());
+      (*probes)[i].push_back(i);
+    }
+    DCHECK(!(*probes)[i].empty());
+  }
+}
+
 }  // namespace
 
 const char CoverageInstrumentationTransform::kTransformName[] =
@@ -70,7 +253,8 @@ CoverageInstrumentationTransform::CoverageInstrumentationTransform()
                            "Basic-Block Frequency Data",
                            common::kBasicBlockFrequencyDataVersion,
                            common::IndexedFrequencyData::COVERAGE,
-                           sizeof(common::IndexedFrequencyData)) {
+                           sizeof(common::IndexedFrequencyData)),
+      minimal_probes_(false) {
   // Initialize the EntryThunkTransform.
   entry_thunk_tx_.set_instrument_unsafe_references(false);
   entry_thunk_tx_.set_only_instrument_module_entry(true);
@@ -88,14 +272,29 @@ bool CoverageInstrumentationTransform::TransformBasicBlockSubGraph(
   DCHECK(data_block != NULL);
   DCHECK_EQ(sizeof(IndexedFrequencyData), data_block->data_size());
 
-  // Iterate over the basic blocks.
+  // Collect the code basic blocks. They are assigned consecutive IDs in this
+  // order.
+  std::vector<BasicCodeBlock*> bbs;
   BasicBlockSubGraph::BBCollection::iterator it =
       basic_block_subgraph->basic_blocks().begin();
   for (; it != basic_block_subgraph->basic_blocks().end(); ++it) {
     // We're only interested in code blocks.
     BasicCodeBlock* bb = BasicCodeBlock::Cast(*it);
-    if (bb == NULL)
-      continue;
+    if (bb != NULL)
+      bbs.push_back(bb);
+  }
+
+  // Find the basic blocks that need a probe.
+  std::vector<std::vector<size_t>> probes;
+  if (minimal_probes_) {
+    DominatorAnalysis dominators;
+    dominators.Analyze(basic_block_subgraph);
+    SelectProbes(dominators, bbs, &probes);
+  }
+
+  size_t first_bb_id = bb_ranges_.size();
+  for (size_t i = 0; i < bbs.size(); ++i) {
+    BasicCodeBlock* bb = bbs[i];
 
     // Find the source range associated with this basic-block.
     BlockGraph::Block::SourceRange source_range;
@@ -105,7 +304,17 @@ bool CoverageInstrumentationTransform::TransformBasicBlockSubGraph(
       return false;
     }
 
-    // We prepend each basic code block with the following instructions:
+    bb_ranges_.push_back(source_range);
+    if (minimal_probes_) {
+      bb_coverage_map_.push_back(static_cast<uint32_t>(probes[i].size()));
+      for (size_t probe : probes[i])
+        bb_coverage_map_.push_back(static_cast<uint32_t>(first_bb_id + probe));
+      if (probes[i].size() != 1 || probes[i].front() != i)
+        continue;
+    }
+
+    // We prepend each probed basic code block with the following
+    // instructions:
     //   0. push eax
     //   1. mov eax, dword ptr[data.frequency_data]
     //   2. mov byte ptr[eax + basic_block_index], 1
@@ -115,10 +324,8 @@ bool CoverageInstrumentationTransform::TransformBasicBlockSubGraph(
     // Prepend the instrumentation instructions.
     assm.push(eax);
     assm.mov(eax, Operand(Displacement(data_block, kFrequencyDataOffset)));
-    assm.mov_b(Operand(eax, Displacement(bb_ranges_.size())), Immediate(1));
+    assm.mov_b(Operand(eax, Displacement(first_bb_id + i)), Immediate(1));
     assm.pop(eax);
-
-    bb_ranges_.push_back(source_range);
   }
 
   return true;
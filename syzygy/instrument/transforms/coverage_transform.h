@@ -19,6 +19,13 @@
 // (2) Grabs an entry hook and wires it up the run-time library.
 // (3) Adds a read/write data section containing code coverage information.
 // (4) Instruments each basic block to gather basic block visit information.
+//
+// Optionally, only a subset of the basic blocks is instrumented. A basic block
+// that dominates or post-dominates a probed basic block is visited whenever the
+// probed one is, as long as the function returns normally. A basic block that
+// can't be executed without visiting one of these probes needs no probe of its
+// own: it was visited iff one of them was. The coverage map then gives, for
+// each basic block, the probed basic blocks whose visits imply its own.
 
 #ifndef SYZYGY_INSTRUMENT_TRANSFORMS_COVERAGE_TRANSFORM_H_
 #define SYZYGY_INSTRUMENT_TRANSFORMS_COVERAGE_TRANSFORM_H_
@@ -67,6 +74,18 @@ class CoverageInstrumentationTransform
   //      as its unique ID.
   const RelativeAddressRangeVector& bb_ranges() const { return bb_ranges_; }
 
+  // @returns for each basic block in order, the number of probed basic blocks
+  //     whose visits imply its visit, followed by their IDs. The basic block
+  //     was visited iff any of them was. This is empty unless minimal_probes
+  //     is set.
+  const std::vector<uint32_t>& bb_coverage_map() const {
+    return bb_coverage_map_;
+  }
+
+  // If true, only a minimal set of basic blocks is probed. Defaults to false.
+  bool minimal_probes() const { return minimal_probes_; }
+  void set_minimal_probes(bool value) { minimal_probes_ = value; }
+
   // @}
 
   // @name Pass-throughs to EntryThunkTransform.
@@ -127,6 +146,13 @@ class CoverageInstrumentationTransform
   // Stores the RVAs in the original image for each instrumented basic block.
   RelativeAddressRangeVector bb_ranges_;
 
+  // Stores the IDs of the probes implying the visit of each basic block, when
+  // minimal_probes_ is set. See bb_coverage_map().
+  std::vector<uint32_t> bb_coverage_map_;
+
+  // Indicates whether only a minimal set of basic blocks is probed.
+  bool minimal_probes_;
+
   DISALLOW_COPY_AND_ASSIGN(CoverageInstrumentationTransform);
 };
 
@@ -16,11 +16,16 @@
 
 #include "syzygy/instrument/transforms/coverage_transform.h"
 
+#include <algorithm>
+
+#include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "syzygy/block_graph/basic_block_assembler.h"
 #include "syzygy/block_graph/transform.h"
 #include "syzygy/block_graph/typed_block.h"
 #include "syzygy/common/indexed_frequency_data.h"
 #include "syzygy/core/unittest_util.h"
+#include "syzygy/grinder/basic_block_util.h"
 #include "syzygy/instrument/transforms/unittest_util.h"
 #include "syzygy/pe/decomposer.h"
 #include "syzygy/pe/unittest_util.h"
@@ -31,12 +36,33 @@ namespace transforms {
 namespace {
 
 using common::IndexedFrequencyData;
+using block_graph::BasicBlockSubGraph;
+using block_graph::BasicCodeBlock;
 using block_graph::BlockGraph;
+using grinder::basic_block_util::BasicBlockCoverageMap;
+
+class TestCoverageInstrumentationTransform
+    : public CoverageInstrumentationTransform {
+ public:
+  using CoverageInstrumentationTransform::PreBlockGraphIteration;
+};
 
 class CoverageInstrumentationTransformTest
     : public testing::TestDllTransformTest {
  public:
   virtual void SetUp() override { ASSERT_NO_FATAL_FAILURE(DecomposeTestDll()); }
+
+  // @returns the number of probes referring to @p frequency_data_block.
+  size_t CountProbes(const BlockGraph::Block* frequency_data_block) {
+    size_t probes = 0;
+    for (const auto& referrer : frequency_data_block->referrers()) {
+      BlockGraph::Reference ref;
+      EXPECT_TRUE(referrer.first->GetReference(referrer.second, &ref));
+      if (ref.offset() == offsetof(IndexedFrequencyData, frequency_data))
+        ++probes;
+    }
+    return probes;
+  }
 };
 
 }  // namespace
@@ -63,6 +89,147 @@ TEST_F(CoverageInstrumentationTransformTest, Apply) {
   EXPECT_EQ(tx.bb_ranges().size(), coverage_data->num_entries);
   EXPECT_TRUE(coverage_data.HasReferenceAt(
       coverage_data.OffsetOf(coverage_data->frequency_data)));
+
+  // Every basic block is probed.
+  EXPECT_TRUE(tx.bb_coverage_map().empty());
+  EXPECT_EQ(tx.bb_ranges().size(), CountProbes(frequency_data_block));
+}
+
+TEST_F(CoverageInstrumentationTransformTest, ApplyMinimalProbes) {
+  CoverageInstrumentationTransform tx;
+  EXPECT_FALSE(tx.minimal_probes());
+  tx.set_minimal_probes(true);
+  EXPECT_TRUE(tx.minimal_probes());
+  ASSERT_TRUE(block_graph::ApplyBlockGraphTransform(
+      &tx, policy_, &block_graph_, header_block_));
+
+  block_graph::ConstTypedBlock<IndexedFrequencyData> coverage_data;
+  ASSERT_TRUE(coverage_data.Init(0, tx.frequency_data_block()));
+  EXPECT_EQ(tx.bb_ranges().size(), coverage_data->num_entries);
+
+  // Every basic block maps to probed basic blocks, which map to themselves.
+  BasicBlockCoverageMap bb_coverage_map;
+  ASSERT_TRUE(grinder::basic_block_util::DecodeBasicBlockCoverageMap(
+      tx.bb_coverage_map(), tx.bb_ranges().size(), &bb_coverage_map));
+  size_t probed_bbs = 0;
+  for (size_t i = 0; i < bb_coverage_map.size(); ++i) {
+    for (uint32_t probe : bb_coverage_map[i])
+      EXPECT_THAT(bb_coverage_map[probe], testing::ElementsAre(probe));
+    if (bb_coverage_map[i].size() == 1 && bb_coverage_map[i].front() == i)
+      ++probed_bbs;
+  }
+
+  // Only the probed basic blocks are instrumented, and they are a strict
+  // subset of the basic blocks.
+  EXPECT_EQ(probed_bbs, CountProbes(tx.frequency_data_block()));
+  EXPECT_LT(probed_bbs, tx.bb_ranges().size());
+}
+
+TEST_F(CoverageInstrumentationTransformTest, MinimalProbesOnDiamond) {
+  TestCoverageInstrumentationTransform tx;
+  tx.set_minimal_probes(true);
+  ASSERT_TRUE(tx.PreBlockGraphIteration(policy_, &block_graph_,
+                                        header_block_));
+
+  // Build the subgraph entry -> {on_true, on_false} -> join.
+  BasicBlockSubGraph subgraph;
+  BasicBlockSubGraph::BlockDescription* description =
+      subgraph.AddBlockDescription("diamond", "diamond.obj",
+                                   BlockGraph::CODE_BLOCK, 0, 1, 0);
+  BasicCodeBlock* entry = subgraph.AddBasicCodeBlock("entry");
+  BasicCodeBlock* on_true = subgraph.AddBasicCodeBlock("on_true");
+  BasicCodeBlock* on_false = subgraph.AddBasicCodeBlock("on_false");
+  BasicCodeBlock* join = subgraph.AddBasicCodeBlock("join");
+  BasicCodeBlock* bbs[] = { entry, on_true, on_false, join };
+  for (size_t i = 0; i < arraysize(bbs); ++i) {
+    description->basic_block_order.push_back(bbs[i]);
+    block_graph::BasicBlockAssembler bb_asm(bbs[i]->instructions().end(),
+                                            &bbs[i]->instructions());
+    if (bbs[i] == join)
+      bb_asm.ret();
+    else
+      bb_asm.mov(assm::eax, assm::ecx);
+    bbs[i]->instructions().back().set_source_range(
+        BlockGraph::Block::SourceRange(core::RelativeAddress(0x1000 + i), 1));
+  }
+
+  struct {
+    block_graph::Successor::Condition condition;
+    BasicCodeBlock* from;
+    BasicCodeBlock* to;
+  } edges[] = {
+    { block_graph::Successor::kConditionEqual, entry, on_true },
+    { block_graph::Successor::kConditionNotEqual, entry, on_false },
+    { block_graph::Successor::kConditionTrue, on_true, join },
+    { block_graph::Successor::kConditionTrue, on_false, join },
+  };
+  for (size_t i = 0; i < arraysize(edges); ++i) {
+    edges[i].from->successors().push_back(block_graph::Successor(
+        edges[i].condition,
+        block_graph::BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                         BlockGraph::Reference::kMaximumSize,
+                                         edges[i].to),
+        0));
+  }
+
+  ASSERT_TRUE(tx.TransformBasicBlockSubGraph(policy_, &block_graph_,
+                                             &subgraph));
+
+  // Only the two branches are probed. The entry and the join dominate or
+  // post-dominate both of them.
+  ASSERT_EQ(arraysize(bbs), tx.bb_ranges().size());
+  size_t ids[arraysize(bbs)] = {};
+  for (size_t i = 0; i < arraysize(bbs); ++i) {
+    ids[i] = tx.bb_ranges().size();
+    for (size_t j = 0; j < tx.bb_ranges().size(); ++j) {
+      if (tx.bb_ranges()[j].start() == core::RelativeAddress(0x1000 + i))
+        ids[i] = j;
+    }
+    ASSERT_GT(tx.bb_ranges().size(), ids[i]);
+  }
+  EXPECT_EQ(1U, entry->instructions().size());
+  EXPECT_EQ(5U, on_true->instructions().size());
+  EXPECT_EQ(5U, on_false->instructions().size());
+  EXPECT_EQ(1U, join->instructions().size());
+
+  BasicBlockCoverageMap bb_coverage_map;
+  ASSERT_TRUE(grinder::basic_block_util::DecodeBasicBlockCoverageMap(
+      tx.bb_coverage_map(), tx.bb_ranges().size(), &bb_coverage_map));
+
+  // Simulate the execution of each path, and check that the grinder reports
+  // exactly the basic blocks of that path as visited.
+  const BasicCodeBlock* paths[][3] = {
+    { entry, on_true, join },
+    { entry, on_false, join },
+  };
+  static const size_t kBufferSize =
+      sizeof(TraceIndexedFrequencyData) + arraysize(bbs) - 1;
+  for (size_t path = 0; path < arraysize(paths); ++path) {
+    uint8_t buffer[kBufferSize] = {};
+    TraceIndexedFrequencyData* data =
+        reinterpret_cast<TraceIndexedFrequencyData*>(buffer);
+    data->num_entries = arraysize(bbs);
+    data->num_columns = 1;
+    data->data_type = IndexedFrequencyData::COVERAGE;
+    data->frequency_size = 1;
+
+    // The probes on the path set the byte of their basic block.
+    const BasicCodeBlock* const* path_end =
+        paths[path] + arraysize(paths[path]);
+    for (size_t i = 0; i < arraysize(bbs); ++i) {
+      if (std::find(paths[path], path_end, bbs[i]) != path_end &&
+          bbs[i]->instructions().size() > 1) {
+        data->frequency_data[ids[i]] = 1;
+      }
+    }
+
+    for (size_t i = 0; i < arraysize(bbs); ++i) {
+      bool on_path = std::find(paths[path], path_end, bbs[i]) != path_end;
+      EXPECT_EQ(on_path, grinder::basic_block_util::GetCoverageFrequency(
+                             data, bb_coverage_map, ids[i]) != 0)
+          << "path " << path << ", basic block " << bbs[i]->name();
+    }
+  }
 }
 
 }  // namespace transforms
@@ -38,6 +38,7 @@
       'type': 'executable',
       'sources': [
         'client_utils_unittest.cc',
+        'rpc_session_unittest.cc',
         '<(src)/syzygy/testing/run_all_unittests.cc',
       ],
       'dependencies': [
@@ -47,7 +48,9 @@
         '<(src)/syzygy/common/common.gyp:common_lib',
         '<(src)/syzygy/core/core.gyp:core_unittest_utils',
         '<(src)/syzygy/trace/common/common.gyp:trace_unittest_utils',
+        '<(src)/syzygy/trace/parse/parse.gyp:parse_lib',
         '<(src)/syzygy/trace/protocol/protocol.gyp:protocol_lib',
+        '<(src)/syzygy/trace/service/service.gyp:call_trace_service_exe',
         '<(src)/testing/gtest.gyp:gtest',
         '<(src)/testing/gmock.gyp:gmock',
       ],
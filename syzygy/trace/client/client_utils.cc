@@ -354,13 +354,41 @@ bool IsRpcSessionMandatoryForThisModule() {
   return false;
 }
 
+size_t GetRpcSpareBufferCount(const base::FilePath& module_path) {
+  int value = 0;
+  if (!GetModuleValueFromEnvVar(kSyzygyRpcSpareBuffersEnvVar, module_path,
+                                value, ToInt(), &value)) {
+    return 0;
+  }
+
+  if (value < 0)
+    return 0;
+
+  return static_cast<size_t>(value);
+}
+
+size_t GetRpcSpareBufferCountForThisModule() {
+  base::FilePath module_path;
+  CHECK(GetModulePath(&__ImageBase, &module_path));
+
+  return GetRpcSpareBufferCount(module_path);
+}
+
 bool InitializeRpcSession(RpcSession* rpc_session, TraceFileSegment* segment) {
   DCHECK(rpc_session != NULL);
 
   std::string id = trace::client::GetInstanceIdForThisModule();
   rpc_session->set_instance_id(base::UTF8ToWide(id));
-  if (rpc_session->CreateSession(segment))
+  if (rpc_session->CreateSession(segment)) {
+    // Asynchronous exchanges are an optimization, the session remains usable
+    // if they can't be enabled.
+    size_t num_spare_buffers = GetRpcSpareBufferCountForThisModule();
+    if (num_spare_buffers > 0 &&
+        !rpc_session->EnableAsyncExchange(num_spare_buffers)) {
+      LOG(WARNING) << "Failed to enable asynchronous buffer exchanges.";
+    }
     return true;
+  }
 
   // If the session is not mandatory then return and indicate that we failed
   // to initialize properly.
@@ -184,10 +184,28 @@ bool IsRpcSessionMandatory(const base::FilePath& module_path);
 //     function is found.
 bool IsRpcSessionMandatoryForThisModule();
 
+// Determines the number of spare buffers the RPC session of a module keeps
+// for asynchronous buffer exchanges. This works by looking at the
+// SYZYGY_RPC_SPARE_BUFFERS environment variable, which is parsed in the same
+// manner as SYZYGY_RPC_INSTANCE_ID as described in GetInstanceIdForModule.
+// Rather than an ID, the value is a non-negative integer. Buffers are exchanged
+// synchronously if it is 0.
+//
+// @param module_path the path to the module for which we wish to determine
+//     the number of spare buffers.
+// @returns the number of spare buffers, or 0 if none is requested.
+size_t GetRpcSpareBufferCount(const base::FilePath& module_path);
+
+// Encapsulates calls to GetModulePath and GetRpcSpareBufferCount.
+// @returns the number of spare buffers for the module in which this function
+//     is found.
+size_t GetRpcSpareBufferCountForThisModule();
+
 // Initializes an RPC session, automatically getting the instance ID and
 // determining if the session is mandatory. If the session is mandatory and it
 // is unable to be connected this will raise an exception and cause the process
-// to abort.
+// to abort. Asynchronous buffer exchanges are enabled if spare buffers are
+// requested for this module.
 // @param rpc_session the session to initialize.
 // @param segment will receive the first allocated segment upon successful
 //     initialization.
@@ -74,6 +74,29 @@ class IsRpcSessionMandatoryTest : public testing::Test {
   std::unique_ptr<base::Environment> env_;
 };
 
+class GetRpcSpareBufferCountTest : public testing::Test {
+ public:
+  GetRpcSpareBufferCountTest() : path_(L"C:\\path\\foo.exe") { }
+
+  virtual void SetUp() override {
+    testing::Test::SetUp();
+    env_.reset(base::Environment::Create());
+  }
+
+  virtual void TearDown() override {
+    env_->UnSetVar(::kSyzygyRpcSpareBuffersEnvVar);
+    testing::Test::TearDown();
+  }
+
+  void SetEnvVar(const base::StringPiece& string) {
+    ASSERT_TRUE(env_->SetVar(::kSyzygyRpcSpareBuffersEnvVar,
+                             string.as_string()));
+  }
+
+  base::FilePath path_;
+  std::unique_ptr<base::Environment> env_;
+};
+
 }  // namespace
 
 TEST(GetModuleBaseAddressTest, WorksOnSelf) {
@@ -174,6 +197,28 @@ TEST_F(IsRpcSessionMandatoryTest, NonNumericIgnored) {
   EXPECT_FALSE(IsRpcSessionMandatory(path_));
 }
 
+TEST_F(GetRpcSpareBufferCountTest, ReturnsZeroForNoEnvVar) {
+  env_->UnSetVar(::kSyzygyRpcSpareBuffersEnvVar);
+  EXPECT_EQ(0u, GetRpcSpareBufferCount(path_));
+}
+
+TEST_F(GetRpcSpareBufferCountTest, ReturnsGlobalValueWhenNoPathMatches) {
+  ASSERT_NO_FATAL_FAILURE(SetEnvVar("4 ; bar.exe,2"));
+  EXPECT_EQ(4u, GetRpcSpareBufferCount(path_));
+}
+
+TEST_F(GetRpcSpareBufferCountTest, ReturnsExactPathValue) {
+  ASSERT_NO_FATAL_FAILURE(SetEnvVar("4;foo.exe,3;C:\\path\\foo.exe, 2 "));
+  EXPECT_EQ(2u, GetRpcSpareBufferCount(path_));
+}
+
+TEST_F(GetRpcSpareBufferCountTest, InvalidValuesIgnored) {
+  ASSERT_NO_FATAL_FAILURE(SetEnvVar("foo.exe,baz"));
+  EXPECT_EQ(0u, GetRpcSpareBufferCount(path_));
+  ASSERT_NO_FATAL_FAILURE(SetEnvVar("foo.exe,-2"));
+  EXPECT_EQ(0u, GetRpcSpareBufferCount(path_));
+}
+
 TEST(IsRpcSessionMandatoryThisModuleTest, WorksAsExpected) {
   base::FilePath self_path =
       ::testing::GetExeRelativePath(L"rpc_client_lib_unittests.exe");
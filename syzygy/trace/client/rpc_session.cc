@@ -15,6 +15,13 @@
 // A utility class to manage the RPC session and the associated memory mappings.
 #include "syzygy/trace/client/rpc_session.h"
 
+#include <deque>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/memory/ref_counted.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/threading/platform_thread.h"
 #include "syzygy/common/com_utils.h"
 #include "syzygy/common/rpc/helpers.h"
 #include "syzygy/trace/client/client_utils.h"
@@ -27,6 +34,293 @@ extern "C" IMAGE_DOS_HEADER __ImageBase;
 namespace trace {
 namespace client {
 
+// The background thread of the asynchronous buffer exchanges. It returns the
+// queued buffers to the call trace service, in order, and keeps the pool of
+// spare buffers full. It must be stopped before the session is closed.
+//
+// The session is closed, and so the thread stopped, from DllMain when the
+// agents are unloaded. The thread can't exit while the loader lock is held, so
+// stopping it never joins it: it only waits for the session call in flight, if
+// any, after which the thread no longer touches the session. The thread holds
+// a reference to this object, which it releases as it exits.
+class RpcSession::BufferExchangeThread
+    : public base::RefCountedThreadSafe<BufferExchangeThread>,
+      public base::PlatformThread::Delegate {
+ public:
+  // @param session The session whose buffers are exchanged.
+  // @param num_spare_buffers The number of spare buffers to keep.
+  BufferExchangeThread(RpcSession* session, size_t num_spare_buffers);
+
+  // Starts the thread, which immediately fills the pool of spare buffers.
+  // @returns true if successful, false if the thread failed to be launched.
+  bool Start();
+
+  // Stops the thread, then takes over the queued buffers and the spare buffers
+  // and returns them from the calling thread. This doesn't wait for the thread
+  // to exit, and is safe to call under the loader lock.
+  void Stop();
+
+  // Queues the full buffer of @p segment, and maps a spare buffer in its
+  // place. A buffer is allocated synchronously if the pool is empty.
+  // @param segment The segment whose buffer is exchanged.
+  // @returns true on success, false otherwise.
+  bool Exchange(TraceFileSegment* segment);
+
+  // Queues the buffer of @p segment.
+  // @param segment The segment whose buffer is returned.
+  void Return(TraceFileSegment* segment);
+
+ private:
+  friend class base::RefCountedThreadSafe<BufferExchangeThread>;
+  ~BufferExchangeThread() override;
+
+  // Implementation of PlatformThread::Delegate:
+  void ThreadMain() override;
+
+  // Returns the queued buffers to the call trace service, in order.
+  void ReturnQueuedBuffers();
+
+  // Allocates spare buffers until the pool is full, or the thread is stopping.
+  void RefillSpareBuffers();
+
+  // Marks the start and the end of a call into the session from the thread.
+  // @pre lock_ is held.
+  // @{
+  void BeginSessionCall();
+  void EndSessionCall();
+  // @}
+
+  // The session whose buffers are exchanged.
+  RpcSession* session_;
+
+  // The number of spare buffers to keep.
+  size_t num_spare_buffers_;
+
+  // Protects the queued buffers, the spare buffers and the flags.
+  base::Lock lock_;
+
+  // The full buffers waiting to be returned. Under lock_.
+  std::deque<CallTraceBuffer> queued_buffers_;
+
+  // The spare buffers. They are mapped, and have an empty segment header.
+  // Under lock_.
+  std::vector<CallTraceBuffer> spare_buffers_;
+
+  // Set to stop the thread. The thread doesn't call into the session once
+  // this is set. Under lock_.
+  bool stopping_;
+
+  // Set while the thread calls into the session. Under lock_.
+  bool in_session_call_;
+
+  // Signaled when there is work for the thread.
+  base::WaitableEvent work_event_;
+
+  // Signaled while the thread isn't calling into the session.
+  base::WaitableEvent idle_event_;
+
+  // Handle to the thread, used to find out whether it was terminated when
+  // stopping. This is null while the thread isn't running.
+  base::PlatformThreadHandle thread_handle_;
+
+  DISALLOW_COPY_AND_ASSIGN(BufferExchangeThread);
+};
+
+RpcSession::BufferExchangeThread::BufferExchangeThread(
+    RpcSession* session, size_t num_spare_buffers)
+    : session_(session),
+      num_spare_buffers_(num_spare_buffers),
+      stopping_(false),
+      in_session_call_(false),
+      work_event_(false, false),
+      idle_event_(true, true) {
+  DCHECK_NE(static_cast<RpcSession*>(nullptr), session);
+  spare_buffers_.reserve(num_spare_buffers);
+}
+
+RpcSession::BufferExchangeThread::~BufferExchangeThread() {
+  DCHECK(thread_handle_.is_null());
+  DCHECK(queued_buffers_.empty());
+  DCHECK(spare_buffers_.empty());
+}
+
+bool RpcSession::BufferExchangeThread::Start() {
+  DCHECK(thread_handle_.is_null());
+
+  // This reference is released by the thread as it exits.
+  AddRef();
+  if (!base::PlatformThread::Create(0, this, &thread_handle_)) {
+    Release();
+    return false;
+  }
+  work_event_.Signal();
+  return true;
+}
+
+void RpcSession::BufferExchangeThread::Stop() {
+  DCHECK(!thread_handle_.is_null());
+  HANDLE thread = thread_handle_.platform_handle();
+
+  {
+    base::AutoLock auto_lock(lock_);
+    stopping_ = true;
+  }
+  work_event_.Signal();
+
+  // Wait for the session call in flight to complete, so that the buffer it
+  // returns stays ahead of the queued ones. This waits on the thread handle
+  // as well, as the thread is terminated without completing it when the
+  // process exits.
+  HANDLE handles[] = { idle_event_.handle(), thread };
+  ::WaitForMultipleObjects(arraysize(handles), handles, FALSE, INFINITE);
+
+  // A terminated thread may have died holding the lock, in which case the
+  // buffers are left to the call trace service, which flushes them when the
+  // session is closed. The state it protects may then be inconsistent, so
+  // this object is leaked rather than destroyed.
+  bool terminated = ::WaitForSingleObject(thread, 0) == WAIT_OBJECT_0;
+  if (terminated && !lock_.Try()) {
+    LOG(WARNING) << "The buffer exchange thread was terminated while holding "
+                 << "its lock, not returning its buffers.";
+    ::CloseHandle(thread);
+    thread_handle_ = base::PlatformThreadHandle();
+    AddRef();
+    return;
+  }
+  if (!terminated)
+    lock_.Acquire();
+
+  // The remaining buffers are returned from here. The queued ones go first to
+  // preserve their order.
+  std::deque<CallTraceBuffer> queued_buffers;
+  std::vector<CallTraceBuffer> spare_buffers;
+  queued_buffers.swap(queued_buffers_);
+  spare_buffers.swap(spare_buffers_);
+  lock_.Release();
+
+  ::CloseHandle(thread);
+  thread_handle_ = base::PlatformThreadHandle();
+
+  for (CallTraceBuffer& buffer_info : queued_buffers) {
+    if (!session_->ReturnBufferImpl(&buffer_info))
+      LOG(ERROR) << "Failed to return a buffer to the call trace service.";
+  }
+  for (CallTraceBuffer& buffer_info : spare_buffers) {
+    if (!session_->ReturnBufferImpl(&buffer_info))
+      LOG(WARNING) << "Failed to return a spare buffer.";
+  }
+}
+
+bool RpcSession::BufferExchangeThread::Exchange(TraceFileSegment* segment) {
+  DCHECK_NE(static_cast<TraceFileSegment*>(nullptr), segment);
+
+  CallTraceBuffer spare_buffer = {};
+  bool has_spare_buffer = false;
+  {
+    base::AutoLock auto_lock(lock_);
+    queued_buffers_.push_back(segment->buffer_info);
+    if (!spare_buffers_.empty()) {
+      spare_buffer = spare_buffers_.back();
+      spare_buffers_.pop_back();
+      has_spare_buffer = true;
+    }
+  }
+  work_event_.Signal();
+
+  // The allocation only waits for the call trace service when the pool ran
+  // dry, and doesn't affect the order of the returned buffers.
+  if (!has_spare_buffer)
+    return session_->AllocateBuffer(segment);
+
+  // Mapping the spare buffer again rewrites its segment header, with the ID
+  // of this thread.
+  segment->buffer_info = spare_buffer;
+  return session_->MapSegmentBuffer(segment);
+}
+
+void RpcSession::BufferExchangeThread::Return(TraceFileSegment* segment) {
+  DCHECK_NE(static_cast<TraceFileSegment*>(nullptr), segment);
+  {
+    base::AutoLock auto_lock(lock_);
+    queued_buffers_.push_back(segment->buffer_info);
+  }
+  work_event_.Signal();
+}
+
+void RpcSession::BufferExchangeThread::ThreadMain() {
+  base::PlatformThread::SetName("Syzygy RPC Buffer Exchange Thread");
+  while (true) {
+    work_event_.Wait();
+    {
+      base::AutoLock auto_lock(lock_);
+      if (stopping_)
+        break;
+    }
+    ReturnQueuedBuffers();
+    RefillSpareBuffers();
+  }
+
+  // This may destroy this object, so it must come last.
+  Release();
+}
+
+void RpcSession::BufferExchangeThread::ReturnQueuedBuffers() {
+  while (true) {
+    CallTraceBuffer buffer_info = {};
+    {
+      base::AutoLock auto_lock(lock_);
+      if (stopping_ || queued_buffers_.empty())
+        return;
+      buffer_info = queued_buffers_.front();
+      queued_buffers_.pop_front();
+      BeginSessionCall();
+    }
+    if (!session_->ReturnBufferImpl(&buffer_info))
+      LOG(ERROR) << "Failed to return a buffer to the call trace service.";
+
+    base::AutoLock auto_lock(lock_);
+    EndSessionCall();
+  }
+}
+
+void RpcSession::BufferExchangeThread::RefillSpareBuffers() {
+  while (true) {
+    {
+      base::AutoLock auto_lock(lock_);
+      if (stopping_ || spare_buffers_.size() >= num_spare_buffers_)
+        return;
+      BeginSessionCall();
+    }
+
+    // Give up until the next exchange on failure, rather than spinning.
+    TraceFileSegment segment;
+    bool succeeded = session_->AllocateBuffer(&segment);
+
+    base::AutoLock auto_lock(lock_);
+    EndSessionCall();
+    if (!succeeded) {
+      LOG(ERROR) << "Failed to allocate a spare buffer.";
+      return;
+    }
+    spare_buffers_.push_back(segment.buffer_info);
+  }
+}
+
+void RpcSession::BufferExchangeThread::BeginSessionCall() {
+  lock_.AssertAcquired();
+  DCHECK(!stopping_);
+  DCHECK(!in_session_call_);
+  in_session_call_ = true;
+  idle_event_.Reset();
+}
+
+void RpcSession::BufferExchangeThread::EndSessionCall() {
+  lock_.AssertAcquired();
+  DCHECK(in_session_call_);
+  in_session_call_ = false;
+  idle_event_.Signal();
+}
+
 RpcSession::RpcSession()
     : rpc_binding_(NULL),
       session_handle_(NULL),
@@ -35,6 +329,7 @@ RpcSession::RpcSession()
 }
 
 RpcSession::~RpcSession() {
+  DisableAsyncExchange();
   FreeSharedMemory();
 }
 
@@ -47,9 +342,10 @@ bool RpcSession::MapSegmentBuffer(TraceFileSegment* segment) {
   // Get (or set) the mapping between the handle we've received and the
   // corresponding mapped base pointer. Note that the shared_memory_handles_
   // map is shared across threads, so we need to hold the shared_memory_lock_
-  // when we access/update it. This should be the only synchronization point
-  // in the call trace client library (other than the initial creation of the
-  // RpcSession object, of course).
+  // when we access/update it. Other than the initial creation of the
+  // RpcSession object, this and the queues of the asynchronous buffer
+  // exchanges should be the only synchronization points in the call trace
+  // client library.
   {
     base::AutoLock scoped_lock(shared_memory_lock_);
 
@@ -171,6 +467,9 @@ bool RpcSession::ExchangeBuffer(TraceFileSegment* segment) {
   DCHECK(IsTracing());
   DCHECK(segment != NULL);
 
+  if (exchange_thread_.get() != NULL)
+    return exchange_thread_->Exchange(segment);
+
   bool succeeded =
       ::common::rpc::InvokeRpc(CallTraceClient_ExchangeBuffer, session_handle_,
                                &segment->buffer_info).succeeded();
@@ -182,13 +481,54 @@ bool RpcSession::ReturnBuffer(TraceFileSegment* segment) {
   DCHECK(IsTracing());
   DCHECK(segment != NULL);
 
+  // The buffer goes through the queue so that it is returned after the
+  // buffers exchanged before it.
+  if (exchange_thread_.get() != NULL) {
+    exchange_thread_->Return(segment);
+    return true;
+  }
+
+  return ReturnBufferImpl(&segment->buffer_info);
+}
+
+bool RpcSession::ReturnBufferImpl(CallTraceBuffer* buffer_info) {
+  DCHECK(IsTracing());
+  DCHECK(buffer_info != NULL);
+
   return ::common::rpc::InvokeRpc(CallTraceClient_ReturnBuffer, session_handle_,
-                                  &segment->buffer_info).succeeded();
+                                  buffer_info).succeeded();
+}
+
+bool RpcSession::EnableAsyncExchange(size_t num_spare_buffers) {
+  DCHECK(IsTracing());
+  DCHECK_LT(0u, num_spare_buffers);
+  DCHECK(exchange_thread_.get() == NULL);
+
+  scoped_refptr<BufferExchangeThread> exchange_thread(
+      new BufferExchangeThread(this, num_spare_buffers));
+  if (!exchange_thread->Start()) {
+    LOG(ERROR) << "Failed to start the buffer exchange thread.";
+    return false;
+  }
+
+  exchange_thread_.swap(exchange_thread);
+  return true;
+}
+
+void RpcSession::DisableAsyncExchange() {
+  if (exchange_thread_.get() == NULL)
+    return;
+
+  exchange_thread_->Stop();
+  exchange_thread_ = nullptr;
 }
 
 bool RpcSession::CloseSession() {
   DCHECK(IsTracing());
 
+  // Hand the pending buffers to the call trace service before closing.
+  DisableAsyncExchange();
+
   bool succeeded = ::common::rpc::InvokeRpc(CallTraceClient_CloseSession,
                                             &session_handle_).succeeded();
 
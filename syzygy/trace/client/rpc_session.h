@@ -13,6 +13,14 @@
 // limitations under the License.
 //
 // A utility class to manage the RPC session and the associated memory mappings.
+//
+// By default, full buffers are exchanged through a synchronous RPC, and the
+// calling thread waits for the call trace service. Once asynchronous exchanges
+// are enabled, a background thread keeps a pool of spare buffers pre-fetched
+// from the service and returns the full buffers to it. A thread exchanging a
+// full buffer then queues it and picks a spare one, without any RPC unless the
+// pool ran dry. The buffers are returned in the order they were queued, so the
+// buffers of a thread reach the service in order.
 
 #ifndef SYZYGY_TRACE_CLIENT_RPC_SESSION_H_
 #define SYZYGY_TRACE_CLIENT_RPC_SESSION_H_
@@ -20,6 +28,7 @@
 #include <map>
 
 #include "base/logging.h"
+#include "base/memory/ref_counted.h"
 #include "base/synchronization/lock.h"
 #include "syzygy/trace/client/client_utils.h"
 #include "syzygy/trace/protocol/call_trace_defs.h"
@@ -57,6 +66,27 @@ class RpcSession {
   virtual void FreeSharedMemory();
   // @}
 
+  // @name Asynchronous buffer exchanges.
+  // @{
+  // Enables asynchronous buffer exchanges. ExchangeBuffer and ReturnBuffer
+  // then hand the buffers to a background thread, and return without waiting
+  // for the call trace service.
+  // @param num_spare_buffers The number of spare buffers to keep pre-fetched.
+  //     This must be greater than 0.
+  // @returns true on success, false if the background thread can't be started.
+  // @pre IsTracing() and asynchronous exchanges are disabled.
+  bool EnableAsyncExchange(size_t num_spare_buffers);
+
+  // Returns the queued buffers and the spare buffers to the call trace service,
+  // and stops the background thread. This doesn't wait for the thread to exit,
+  // so it is safe to call from DllMain. This does nothing if asynchronous
+  // exchanges are disabled. This is called by CloseSession.
+  void DisableAsyncExchange();
+
+  // @returns true if asynchronous buffer exchanges are enabled.
+  bool IsAsyncExchangeEnabled() const { return exchange_thread_.get() != NULL; }
+  // @}
+
   inline bool IsEnabled(unsigned long bit_mask) const {
     return (flags_ & bit_mask) != 0;
   }
@@ -72,9 +102,15 @@ class RpcSession {
   unsigned long flags() const { return flags_; }
 
  protected:
+  // The background thread of the asynchronous buffer exchanges.
+  class BufferExchangeThread;
+
   // Map a tracefile segment buffer into local memory.
   bool MapSegmentBuffer(TraceFileSegment* segment);
 
+  // Returns a buffer to the call trace service through a synchronous RPC.
+  bool ReturnBufferImpl(CallTraceBuffer* buffer_info);
+
   // The call trace RPC binding.
   handle_t rpc_binding_;
 
@@ -103,6 +139,10 @@ class RpcSession {
   // The (optional) unique id used to differentiate concurrent instances of the
   // RPC call-trace logging service.
   std::wstring instance_id_;
+
+  // The background thread of the asynchronous buffer exchanges. This is NULL
+  // while they are disabled.
+  scoped_refptr<BufferExchangeThread> exchange_thread_;
 };
 
 }  // namespace client
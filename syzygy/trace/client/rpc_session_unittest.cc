@@ -0,0 +1,142 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/client/rpc_session.h"
+
+#include "base/files/file_enumerator.h"
+#include "base/files/scoped_temp_dir.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/utf_string_conversions.h"
+#include "gtest/gtest.h"
+#include "syzygy/trace/client/client_utils.h"
+#include "syzygy/trace/common/unittest_util.h"
+#include "syzygy/trace/parse/unittest_util.h"
+
+namespace trace {
+namespace client {
+
+namespace {
+
+using testing::_;
+using testing::StrictMockParseEventHandler;
+using trace::parser::Parser;
+
+MATCHER_P(CommentIs, comment, "") {
+  return std::string(arg->comment, arg->comment_size) == comment;
+}
+
+class RpcSessionTest : public testing::Test {
+ public:
+  virtual void SetUp() override {
+    testing::Test::SetUp();
+
+    // Call trace files will be stuffed here.
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+
+    service_.SetEnvironment();
+  }
+
+  virtual void TearDown() override { service_.Stop(); }
+
+  void ReplayLogs(size_t files_expected) {
+    // Stop the service if it's running.
+    service_.Stop();
+
+    Parser parser;
+    ASSERT_TRUE(parser.Init(&handler_));
+
+    // Queue up the trace file(s) we engendered.
+    base::FileEnumerator enumerator(temp_dir_.path(),
+                                    false,
+                                    base::FileEnumerator::FILES);
+    size_t num_files = 0;
+    while (true) {
+      base::FilePath trace_file = enumerator.Next();
+      if (trace_file.empty())
+        break;
+      ASSERT_TRUE(parser.OpenTraceFile(trace_file));
+      ++num_files;
+    }
+
+    EXPECT_EQ(files_expected, num_files);
+
+    if (num_files > 0)
+      ASSERT_TRUE(parser.Consume());
+  }
+
+  // Writes a comment record to @p segment.
+  void WriteComment(const std::string& comment, TraceFileSegment* segment) {
+    size_t size = FIELD_OFFSET(TraceComment, comment) + comment.size();
+    ASSERT_TRUE(segment->CanAllocate(size));
+    TraceComment* record = reinterpret_cast<TraceComment*>(
+        segment->AllocateTraceRecordImpl(TRACE_COMMENT, size));
+    record->comment_size = comment.size();
+    ::memcpy(record->comment, comment.data(), comment.size());
+  }
+
+ protected:
+  // The directory where trace file output will be written.
+  base::ScopedTempDir temp_dir_;
+
+  // The handler to which the trace file parser will delegate events.
+  StrictMockParseEventHandler handler_;
+
+  // Our call trace service process instance.
+  testing::CallTraceService service_;
+};
+
+}  // namespace
+
+TEST_F(RpcSessionTest, AsyncExchangePreservesOrder) {
+  service_.Start(temp_dir_.path());
+
+  RpcSession session;
+  TraceFileSegment segment;
+  session.set_instance_id(base::UTF8ToWide(GetInstanceIdForThisModule()));
+  ASSERT_TRUE(session.CreateSession(&segment));
+
+  ASSERT_TRUE(session.EnableAsyncExchange(2));
+  EXPECT_TRUE(session.IsAsyncExchangeEnabled());
+
+  // Exchange more buffers than there are spare ones, so that some of the
+  // exchanges also fall back to synchronous allocations.
+  const size_t kNumComments = 10;
+  for (size_t i = 0; i < kNumComments; ++i) {
+    ASSERT_NO_FATAL_FAILURE(WriteComment(base::SizeTToString(i), &segment));
+    ASSERT_TRUE(session.ExchangeBuffer(&segment));
+  }
+  ASSERT_NO_FATAL_FAILURE(WriteComment("last", &segment));
+  ASSERT_TRUE(session.ReturnBuffer(&segment));
+
+  // Closing the session returns the queued buffers first.
+  ASSERT_TRUE(session.CloseSession());
+  EXPECT_FALSE(session.IsAsyncExchangeEnabled());
+
+  DWORD process_id = ::GetCurrentProcessId();
+  EXPECT_CALL(handler_, OnProcessStarted(_, process_id, _));
+  testing::Sequence comments;
+  for (size_t i = 0; i < kNumComments; ++i) {
+    EXPECT_CALL(handler_, OnComment(_, process_id,
+                                    CommentIs(base::SizeTToString(i))))
+        .InSequence(comments);
+  }
+  EXPECT_CALL(handler_, OnComment(_, process_id, CommentIs("last")))
+      .InSequence(comments);
+  EXPECT_CALL(handler_, OnProcessEnded(_, process_id));
+
+  ASSERT_NO_FATAL_FAILURE(ReplayLogs(1));
+}
+
+}  // namespace client
+}  // namespace trace
@@ -23,6 +23,7 @@
 #include "syzygy/common/buffer_parser.h"
 #include "syzygy/common/com_utils.h"
 #include "syzygy/trace/parse/parser.h"
+#include "syzygy/trace/protocol/compact_function_calls.h"
 
 namespace trace {
 namespace parser {
@@ -271,6 +272,10 @@ bool ParseEngine::DispatchEvent(EVENT_TRACE* event) {
       success = DispatchProcessHeap(event);
       break;
 
+    case TRACE_BATCH_DETAILED_FUNCTION_CALLS:
+      success = DispatchBatchDetailedFunctionCalls(event);
+      break;
+
     default:
       LOG(ERROR) << "Unknown event type encountered.";
       break;
@@ -616,6 +621,50 @@ bool ParseEngine::DispatchDetailedFunctionCall(EVENT_TRACE* event) {
   return true;
 }
 
+bool ParseEngine::DispatchBatchDetailedFunctionCalls(EVENT_TRACE* event) {
+  DCHECK_NE(static_cast<EVENT_TRACE*>(nullptr), event);
+  DCHECK_NE(static_cast<ParseEventHandler*>(nullptr), event_handler_);
+  DCHECK(!error_occurred_);
+
+  BinaryBufferReader reader(event->MofData, event->MofLength);
+  const TraceBatchDetailedFunctionCalls* data = nullptr;
+  if (!reader.Read(&data)) {
+    LOG(ERROR) << "Short or empty TraceBatchDetailedFunctionCalls event.";
+    return false;
+  }
+  DCHECK(data != nullptr);
+
+  // Calculate the expected size of the payload and ensure there's
+  // enough data.
+  size_t expected_length =
+      FIELD_OFFSET(TraceBatchDetailedFunctionCalls, data) + data->data_size;
+  if (event->MofLength < expected_length) {
+    LOG(ERROR) << "Payload smaller than size implied by "
+               << "TraceBatchDetailedFunctionCalls header.";
+    return false;
+  }
+
+  base::Time time(base::Time::FromFileTime(
+      reinterpret_cast<FILETIME&>(event->Header.TimeStamp)));
+  DWORD process_id = event->Header.ProcessId;
+  DWORD thread_id = event->Header.ThreadId;
+
+  // Dispatch the calls as if they had been logged as individual
+  // TraceDetailedFunctionCall records, so that the handlers don't have to
+  // know about the compact encoding.
+  trace::protocol::CompactFunctionCallDecoder decoder(data);
+  std::vector<uint8_t> call;
+  while (!decoder.done()) {
+    if (!decoder.DecodeNext(&call))
+      return false;
+    event_handler_->OnDetailedFunctionCall(
+        time, process_id, thread_id,
+        reinterpret_cast<const TraceDetailedFunctionCall*>(call.data()));
+  }
+
+  return true;
+}
+
 bool ParseEngine::DispatchComment(EVENT_TRACE* event) {
   DCHECK_NE(static_cast<EVENT_TRACE*>(nullptr), event);
   DCHECK_NE(static_cast<ParseEventHandler*>(nullptr), event_handler_);
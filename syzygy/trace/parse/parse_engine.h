@@ -233,6 +233,13 @@ class ParseEngine {
   //     Does not explicitly set error occurred.
   bool DispatchDetailedFunctionCall(EVENT_TRACE* event);
 
+  // Parses a batch of compactly encoded detailed function calls, and
+  // dispatches each of them as a detailed function call.
+  // @param event the event to dispatch.
+  // @returns true if the event was successfully dispatched, false otherwise.
+  //     Does not explicitly set error occurred.
+  bool DispatchBatchDetailedFunctionCalls(EVENT_TRACE* event);
+
   // Parses and dispatches a call-trace comment.
   // @param event the event to dispatch.
   // @returns true if the event was successfully dispatched, false otherwise.
@@ -27,6 +27,7 @@
 #include "gtest/gtest.h"
 #include "syzygy/common/indexed_frequency_data.h"
 #include "syzygy/trace/parse/parser.h"
+#include "syzygy/trace/protocol/compact_function_calls.h"
 
 namespace {
 
@@ -36,6 +37,10 @@ using trace::parser::ParseEngine;
 using trace::parser::ParseEventHandler;
 using trace::parser::ModuleInformation;
 
+MATCHER_P2(DetailedFunctionCallIs, timestamp, function_id, "") {
+  return arg->timestamp == timestamp && arg->function_id == function_id;
+}
+
 typedef std::multiset<FuncAddr> FunctionSet;
 typedef std::vector<TraceModuleData> ModuleSet;
 
@@ -756,6 +761,58 @@ TEST_F(ParseEngineUnitTest, DetailedFunctionCall) {
   ASSERT_TRUE(error_occurred());
 }
 
+TEST_F(ParseEngineUnitTest, BatchDetailedFunctionCalls) {
+  const uint8_t kArguments[] = {
+      0x01, 0x00, 0x00, 0x00,  // 1 argument...
+      0x04, 0x00, 0x00, 0x00,  // ...of length 4.
+      0xDE, 0xAD, 0xBE, 0xEF,  // Argument 0: 0xDEADBEEF.
+  };
+  char call_buffer[FIELD_OFFSET(TraceDetailedFunctionCall, argument_data) +
+      arraysize(kArguments)] = {};
+  TraceDetailedFunctionCall* call =
+      reinterpret_cast<TraceDetailedFunctionCall*>(call_buffer);
+  call->function_id = 37;
+  call->argument_data_size = arraysize(kArguments);
+  ::memcpy(call->argument_data, kArguments, arraysize(kArguments));
+
+  // Encode the same call twice, 10 cycles apart.
+  char buffer[256] = {};
+  TraceBatchDetailedFunctionCalls* data =
+      reinterpret_cast<TraceBatchDetailedFunctionCalls*>(buffer);
+  data->base_timestamp = 0x0102030405060708;
+  trace::protocol::CompactFunctionCallEncoder encoder;
+  encoder.Reset(data->base_timestamp);
+  for (size_t i = 0; i < 2; ++i) {
+    call->timestamp = data->base_timestamp + 10 * i;
+    ASSERT_GE(sizeof(buffer) - FIELD_OFFSET(TraceBatchDetailedFunctionCalls,
+                                            data) - data->data_size,
+              trace::protocol::CompactFunctionCallEncoder::GetMaxEncodedSize(
+                  *call));
+    data->data_size += encoder.Encode(*call, data->data + data->data_size);
+    ++data->num_calls;
+  }
+  size_t size =
+      FIELD_OFFSET(TraceBatchDetailedFunctionCalls, data) + data->data_size;
+
+  {
+    testing::InSequence in_sequence;
+    EXPECT_CALL(*this, OnDetailedFunctionCall(
+        _, kProcessId, kThreadId,
+        DetailedFunctionCallIs(data->base_timestamp, 37u)));
+    EXPECT_CALL(*this, OnDetailedFunctionCall(
+        _, kProcessId, kThreadId,
+        DetailedFunctionCallIs(data->base_timestamp + 10, 37u)));
+  }
+  ASSERT_NO_FATAL_FAILURE(DispatchEventData(
+      TRACE_BATCH_DETAILED_FUNCTION_CALLS, data, size));
+  ASSERT_FALSE(error_occurred());
+
+  // Dispatch a malformed record and make sure the parser errors.
+  ASSERT_NO_FATAL_FAILURE(DispatchEventData(
+      TRACE_BATCH_DETAILED_FUNCTION_CALLS, data, size - 1));
+  ASSERT_TRUE(error_occurred());
+}
+
 TEST_F(ParseEngineUnitTest, Comment) {
   const char kDummyComment[] = "This is a comment!";
   char buffer[FIELD_OFFSET(TraceComment, comment) +
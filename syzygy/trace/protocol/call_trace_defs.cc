@@ -53,6 +53,8 @@ const char kSyzygyRpcInstanceIdEnvVar[] = "SYZYGY_RPC_INSTANCE_ID";
 // Environment variable used to indicate that an RPC session is mandatory.
 const char kSyzygyRpcSessionMandatoryEnvVar[] =
     "SYZYGY_RPC_SESSION_MANDATORY";
+// Environment variable used to request asynchronous buffer exchanges.
+const char kSyzygyRpcSpareBuffersEnvVar[] = "SYZYGY_RPC_SPARE_BUFFERS";
 
 namespace {
 
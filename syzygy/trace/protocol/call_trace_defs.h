@@ -63,6 +63,10 @@ void GetSyzygyCallTraceRpcEventName(const base::StringPiece16& id,
 // Environment variable used to indicate that an RPC session is mandatory.
 extern const char kSyzygyRpcSessionMandatoryEnvVar[];
 
+// Environment variable used to request asynchronous buffer exchanges, and the
+// number of spare buffers to keep.
+extern const char kSyzygyRpcSpareBuffersEnvVar[];
+
 // This must be bumped anytime the file format is changed.
 enum {
   TRACE_VERSION_HI = 1,
@@ -93,6 +97,7 @@ enum TraceEventType {
   TRACE_DETAILED_FUNCTION_CALL,
   TRACE_COMMENT,
   TRACE_PROCESS_HEAP,
+  TRACE_BATCH_DETAILED_FUNCTION_CALLS,
 };
 
 // All traces are emitted at this trace level.
@@ -499,6 +504,28 @@ struct TraceDetailedFunctionCall {
 };
 COMPILE_ASSERT_IS_POD(TraceDetailedFunctionCall);
 
+// Records a batch of detailed function calls made by a single thread, in a
+// compact encoding. Each call is equivalent to a TraceDetailedFunctionCall
+// record, and is encoded relative to the calls that precede it in the batch.
+// See syzygy/trace/protocol/compact_function_calls.h for the details of the
+// encoding.
+struct TraceBatchDetailedFunctionCalls {
+  enum { kTypeId = TRACE_BATCH_DETAILED_FUNCTION_CALLS };
+
+  // The timestamp that the timestamp of the first call is relative to.
+  uint64_t base_timestamp;
+
+  // The number of calls in the batch.
+  uint32_t num_calls;
+
+  // The size of the encoded calls.
+  uint32_t data_size;
+
+  // The encoded calls. This is actually of size |data_size|.
+  uint8_t data[1];
+};
+COMPILE_ASSERT_IS_POD(TraceBatchDetailedFunctionCalls);
+
 // Records a comment in a trace file. These are output via the call-trace
 // service and act as delimiters in a call-trace log.
 struct TraceComment {
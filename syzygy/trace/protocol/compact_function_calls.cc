@@ -0,0 +1,295 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/protocol/compact_function_calls.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace trace {
+namespace protocol {
+
+namespace {
+
+// The maximum size of a varint holding a 64-bit value.
+const size_t kMaxVarintSize = 10;
+
+// The maximum size of the fields of an encoded call that don't depend on its
+// arguments: the timestamp delta, the function ID, the stack trace ID and the
+// argument count.
+const size_t kMaxFixedSize = 4 * kMaxVarintSize;
+
+uint64_t ZigZagEncode(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t ZigZagDecode(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+uint8_t* WriteVarint(uint64_t value, uint8_t* out) {
+  while (value >= 0x80) {
+    *(out++) = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  *(out++) = static_cast<uint8_t>(value);
+  return out;
+}
+
+bool ReadVarint(const uint8_t** data, const uint8_t* data_end,
+                uint64_t* value) {
+  DCHECK_NE(static_cast<const uint8_t**>(nullptr), data);
+  DCHECK_NE(static_cast<uint64_t*>(nullptr), value);
+
+  *value = 0;
+  for (size_t i = 0; i < kMaxVarintSize; ++i) {
+    if (*data == data_end)
+      return false;
+    uint8_t byte = *((*data)++);
+    *value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+bool ReadVarint32(const uint8_t** data, const uint8_t* data_end,
+                  uint32_t* value) {
+  DCHECK_NE(static_cast<uint32_t*>(nullptr), value);
+  uint64_t value64 = 0;
+  if (!ReadVarint(data, data_end, &value64) || value64 > UINT32_MAX)
+    return false;
+  *value = static_cast<uint32_t>(value64);
+  return true;
+}
+
+}  // namespace
+
+CompactFunctionCallState::CompactFunctionCallState() {
+  Reset(0);
+}
+
+void CompactFunctionCallState::Reset(uint64_t base_timestamp) {
+  previous_timestamp_ = base_timestamp;
+  previous_stack_trace_id_ = 0;
+  ::memset(previous_arguments_, 0, sizeof(previous_arguments_));
+  argument_patterns_.clear();
+}
+
+size_t CompactFunctionCallEncoder::GetMaxEncodedSize(
+    const TraceDetailedFunctionCall& call) {
+  // The argument count and sizes take at most 5 bytes per 4 bytes, and the
+  // delta encoded arguments at most 10 bytes per 8 bytes.
+  return kMaxFixedSize + 2 * call.argument_data_size;
+}
+
+size_t CompactFunctionCallEncoder::Encode(
+    const TraceDetailedFunctionCall& call, uint8_t* buffer) {
+  DCHECK_NE(static_cast<uint8_t*>(nullptr), buffer);
+
+  uint32_t arg_count = 0;
+  const uint32_t* arg_sizes = nullptr;
+  if (call.argument_data_size > 0) {
+    arg_count = *reinterpret_cast<const uint32_t*>(call.argument_data);
+    arg_sizes = reinterpret_cast<const uint32_t*>(call.argument_data) + 1;
+    DCHECK_LE((arg_count + 1) * sizeof(uint32_t), call.argument_data_size);
+  }
+  const uint8_t* arg_data =
+      reinterpret_cast<const uint8_t*>(arg_sizes + arg_count);
+
+  // Look up the argument pattern of the function, and intern it if this is
+  // the first call of the function in the batch.
+  uint64_t flags = 0;
+  ArgumentPattern& pattern = argument_patterns_[call.function_id];
+  if (pattern.empty() || pattern.size() - 1 != arg_count ||
+      !std::equal(pattern.begin() + 1, pattern.end(), arg_sizes)) {
+    pattern.assign(1, arg_count);
+    pattern.insert(pattern.end(), arg_sizes, arg_sizes + arg_count);
+    flags |= kArgumentPattern;
+  }
+  if (call.stack_trace_id != previous_stack_trace_id_)
+    flags |= kNewStackTraceId;
+
+  uint8_t* out = buffer;
+  out = WriteVarint(ZigZagEncode(
+      static_cast<int64_t>(call.timestamp - previous_timestamp_)), out);
+  previous_timestamp_ = call.timestamp;
+
+  out = WriteVarint(
+      (static_cast<uint64_t>(call.function_id) << kFlagBits) | flags, out);
+
+  if (flags & kNewStackTraceId) {
+    out = WriteVarint(call.stack_trace_id, out);
+    previous_stack_trace_id_ = call.stack_trace_id;
+  }
+
+  if (flags & kArgumentPattern) {
+    out = WriteVarint(arg_count, out);
+    for (size_t i = 0; i < arg_count; ++i)
+      out = WriteVarint(arg_sizes[i], out);
+  }
+
+  for (size_t i = 0; i < arg_count; ++i) {
+    uint32_t arg_size = arg_sizes[i];
+    DCHECK_LE(arg_data + arg_size,
+              call.argument_data + call.argument_data_size);
+
+    if (i < kMaxDeltaArguments && arg_size == sizeof(uint32_t)) {
+      uint32_t value = 0;
+      ::memcpy(&value, arg_data, sizeof(value));
+      int32_t delta = static_cast<int32_t>(
+          value - static_cast<uint32_t>(previous_arguments_[i]));
+      out = WriteVarint(ZigZagEncode(delta), out);
+      previous_arguments_[i] = value;
+    } else if (i < kMaxDeltaArguments && arg_size == sizeof(uint64_t)) {
+      uint64_t value = 0;
+      ::memcpy(&value, arg_data, sizeof(value));
+      int64_t delta = static_cast<int64_t>(value - previous_arguments_[i]);
+      out = WriteVarint(ZigZagEncode(delta), out);
+      previous_arguments_[i] = value;
+    } else {
+      ::memcpy(out, arg_data, arg_size);
+      out += arg_size;
+    }
+    arg_data += arg_size;
+  }
+
+  DCHECK_GE(GetMaxEncodedSize(call), static_cast<size_t>(out - buffer));
+  return out - buffer;
+}
+
+CompactFunctionCallDecoder::CompactFunctionCallDecoder(
+    const TraceBatchDetailedFunctionCalls* batch)
+    : data_(batch->data),
+      data_end_(batch->data + batch->data_size),
+      num_calls_(batch->num_calls),
+      decoded_calls_(0) {
+  DCHECK_NE(static_cast<const TraceBatchDetailedFunctionCalls*>(nullptr),
+            batch);
+  Reset(batch->base_timestamp);
+}
+
+bool CompactFunctionCallDecoder::DecodeNext(std::vector<uint8_t>* call) {
+  DCHECK_NE(static_cast<std::vector<uint8_t>*>(nullptr), call);
+  DCHECK(!done());
+
+  uint64_t timestamp_delta = 0;
+  uint64_t encoded_id = 0;
+  if (!ReadVarint(&data_, data_end_, &timestamp_delta) ||
+      !ReadVarint(&data_, data_end_, &encoded_id) ||
+      (encoded_id >> kFlagBits) > UINT32_MAX) {
+    LOG(ERROR) << "Truncated compact detailed function call.";
+    return false;
+  }
+  previous_timestamp_ += static_cast<uint64_t>(ZigZagDecode(timestamp_delta));
+  uint32_t function_id = static_cast<uint32_t>(encoded_id >> kFlagBits);
+
+  if (encoded_id & kNewStackTraceId) {
+    if (!ReadVarint32(&data_, data_end_, &previous_stack_trace_id_)) {
+      LOG(ERROR) << "Truncated compact detailed function call.";
+      return false;
+    }
+  }
+
+  ArgumentPattern* pattern = nullptr;
+  if (encoded_id & kArgumentPattern) {
+    uint32_t arg_count = 0;
+    if (!ReadVarint32(&data_, data_end_, &arg_count) ||
+        arg_count > static_cast<size_t>(data_end_ - data_)) {
+      LOG(ERROR) << "Invalid argument pattern in compact detailed function "
+                 << "call.";
+      return false;
+    }
+    pattern = &argument_patterns_[function_id];
+    pattern->assign(1, arg_count);
+    for (size_t i = 0; i < arg_count; ++i) {
+      uint32_t arg_size = 0;
+      if (!ReadVarint32(&data_, data_end_, &arg_size)) {
+        LOG(ERROR) << "Invalid argument pattern in compact detailed function "
+                   << "call.";
+        return false;
+      }
+      pattern->push_back(arg_size);
+    }
+  } else {
+    ArgumentPatternMap::iterator it = argument_patterns_.find(function_id);
+    if (it == argument_patterns_.end()) {
+      LOG(ERROR) << "Compact detailed function call refers to an unknown "
+                 << "argument pattern.";
+      return false;
+    }
+    pattern = &it->second;
+  }
+
+  // Write the fixed part of the record, and the argument count and sizes.
+  uint32_t arg_count = pattern->front();
+  size_t header_size = FIELD_OFFSET(TraceDetailedFunctionCall, argument_data);
+  call->assign(header_size, 0);
+  if (arg_count > 0) {
+    call->insert(call->end(),
+                 reinterpret_cast<const uint8_t*>(pattern->data()),
+                 reinterpret_cast<const uint8_t*>(pattern->data() +
+                                                  pattern->size()));
+  }
+
+  // Decode the arguments.
+  for (size_t i = 0; i < arg_count; ++i) {
+    uint32_t arg_size = (*pattern)[i + 1];
+    bool is_delta = i < kMaxDeltaArguments &&
+        (arg_size == sizeof(uint32_t) || arg_size == sizeof(uint64_t));
+    if (!is_delta) {
+      if (arg_size > static_cast<size_t>(data_end_ - data_)) {
+        LOG(ERROR) << "Truncated compact detailed function call argument.";
+        return false;
+      }
+      call->insert(call->end(), data_, data_ + arg_size);
+      data_ += arg_size;
+      continue;
+    }
+
+    uint64_t delta = 0;
+    if (!ReadVarint(&data_, data_end_, &delta)) {
+      LOG(ERROR) << "Truncated compact detailed function call argument.";
+      return false;
+    }
+    // Both sizes wrap around the same way, so only the low bytes of the
+    // 64-bit sum are kept for 4-byte arguments.
+    uint64_t value =
+        previous_arguments_[i] + static_cast<uint64_t>(ZigZagDecode(delta));
+    if (arg_size == sizeof(uint32_t))
+      value = static_cast<uint32_t>(value);
+    previous_arguments_[i] = value;
+    const uint8_t* value_bytes = reinterpret_cast<const uint8_t*>(&value);
+    call->insert(call->end(), value_bytes, value_bytes + arg_size);
+  }
+
+  size_t argument_data_size = call->size() - header_size;
+  if (call->size() < sizeof(TraceDetailedFunctionCall))
+    call->resize(sizeof(TraceDetailedFunctionCall), 0);
+
+  TraceDetailedFunctionCall* data =
+      reinterpret_cast<TraceDetailedFunctionCall*>(call->data());
+  data->timestamp = previous_timestamp_;
+  data->function_id = function_id;
+  data->stack_trace_id = previous_stack_trace_id_;
+  data->argument_data_size = static_cast<uint32_t>(argument_data_size);
+
+  ++decoded_calls_;
+  return true;
+}
+
+}  // namespace protocol
+}  // namespace trace
@@ -0,0 +1,131 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the encoder and the decoder of the detailed function calls stored
+// in TraceBatchDetailedFunctionCalls records. Varints are LEB128 encoded, and
+// signed values are zigzag encoded first. Each call of a batch is laid out as
+// follows:
+//   varint timestamp delta, signed, relative to the previous call of the
+//          batch, or to the base timestamp of the batch for the first call.
+//   varint (function_id << 2) | kNewStackTraceId | kArgumentPattern
+//   varint stack_trace_id, only if kNewStackTraceId is set. Otherwise the
+//          call has the stack trace ID of the previous call of the batch, or
+//          0 for the first call.
+//   varint argument count, followed by a varint size per argument. This is
+//          only present if kArgumentPattern is set, which is the case on the
+//          first call of a function in a batch. Later calls of the function
+//          reuse that pattern.
+//   ...    the arguments. The arguments of 4 or 8 bytes among the first
+//          kMaxDeltaArguments are encoded as a signed varint holding their
+//          difference to the previous argument of the same index in the
+//          batch. The other arguments are copied verbatim.
+
+#ifndef SYZYGY_TRACE_PROTOCOL_COMPACT_FUNCTION_CALLS_H_
+#define SYZYGY_TRACE_PROTOCOL_COMPACT_FUNCTION_CALLS_H_
+
+#include <map>
+#include <vector>
+
+#include "base/macros.h"
+#include "syzygy/trace/protocol/call_trace_defs.h"
+
+namespace trace {
+namespace protocol {
+
+// The state of a batch that is shared by the encoder and the decoder.
+class CompactFunctionCallState {
+ public:
+  // Flags stored in the low bits of the encoded function ID.
+  enum Flags {
+    kNewStackTraceId = 1 << 0,
+    kArgumentPattern = 1 << 1,
+  };
+  static const size_t kFlagBits = 2;
+
+  // The number of leading arguments that are delta encoded.
+  static const size_t kMaxDeltaArguments = 6;
+
+  CompactFunctionCallState();
+
+  // Starts a new batch.
+  // @param base_timestamp The base timestamp of the batch.
+  void Reset(uint64_t base_timestamp);
+
+ protected:
+  // The argument sizes of a function.
+  typedef std::vector<uint32_t> ArgumentPattern;
+  typedef std::map<uint32_t, ArgumentPattern> ArgumentPatternMap;
+
+  uint64_t previous_timestamp_;
+  uint32_t previous_stack_trace_id_;
+  uint64_t previous_arguments_[kMaxDeltaArguments];
+
+  // The argument patterns of the functions seen in the batch.
+  ArgumentPatternMap argument_patterns_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(CompactFunctionCallState);
+};
+
+// Encodes the calls of a batch.
+class CompactFunctionCallEncoder : public CompactFunctionCallState {
+ public:
+  CompactFunctionCallEncoder() {}
+
+  // @param call The call to be encoded.
+  // @returns an upper bound of the encoded size of @p call.
+  static size_t GetMaxEncodedSize(const TraceDetailedFunctionCall& call);
+
+  // Encodes a call, and updates the state of the batch.
+  // @param call The call to encode. Its argument data must be well formed.
+  // @param buffer The buffer receiving the encoded call. This must be at
+  //     least GetMaxEncodedSize(call) bytes long.
+  // @returns the number of bytes written to @p buffer.
+  size_t Encode(const TraceDetailedFunctionCall& call, uint8_t* buffer);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(CompactFunctionCallEncoder);
+};
+
+// Decodes the calls of a batch, back to TraceDetailedFunctionCall records.
+class CompactFunctionCallDecoder : public CompactFunctionCallState {
+ public:
+  // @param batch The batch to decode. Its data must be |data_size| bytes
+  //     long.
+  explicit CompactFunctionCallDecoder(
+      const TraceBatchDetailedFunctionCalls* batch);
+
+  // @returns true if all the calls of the batch have been decoded.
+  bool done() const { return decoded_calls_ == num_calls_; }
+
+  // Decodes the next call of the batch.
+  // @param call Receives the call, as a TraceDetailedFunctionCall record.
+  // @returns true on success, false if the batch is malformed.
+  bool DecodeNext(std::vector<uint8_t>* call);
+
+ private:
+  // The encoded calls that are left to decode.
+  const uint8_t* data_;
+  const uint8_t* data_end_;
+
+  uint32_t num_calls_;
+  uint32_t decoded_calls_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompactFunctionCallDecoder);
+};
+
+}  // namespace protocol
+}  // namespace trace
+
+#endif  // SYZYGY_TRACE_PROTOCOL_COMPACT_FUNCTION_CALLS_H_
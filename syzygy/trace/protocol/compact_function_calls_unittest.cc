@@ -0,0 +1,157 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/protocol/compact_function_calls.h"
+
+#include "gtest/gtest.h"
+
+namespace trace {
+namespace protocol {
+
+namespace {
+
+// Builds a detailed function call record with 3 arguments: a 4-byte one, an
+// 8-byte one and a 3-byte one.
+void MakeCall(uint64_t timestamp,
+              uint32_t function_id,
+              uint32_t stack_trace_id,
+              uint32_t arg0,
+              uint64_t arg1,
+              std::vector<uint8_t>* call) {
+  const uint32_t kArgSizes[] = { 3, sizeof(arg0), sizeof(arg1), 3 };
+  const uint8_t kArg2[] = { 0xAB, 0xCD, 0xEF };
+  size_t argument_data_size = sizeof(kArgSizes) + sizeof(arg0) +
+      sizeof(arg1) + sizeof(kArg2);
+  call->assign(FIELD_OFFSET(TraceDetailedFunctionCall, argument_data) +
+                   argument_data_size, 0);
+
+  TraceDetailedFunctionCall* data =
+      reinterpret_cast<TraceDetailedFunctionCall*>(call->data());
+  data->timestamp = timestamp;
+  data->function_id = function_id;
+  data->stack_trace_id = stack_trace_id;
+  data->argument_data_size = argument_data_size;
+  uint8_t* arg_data = data->argument_data;
+  ::memcpy(arg_data, kArgSizes, sizeof(kArgSizes));
+  arg_data += sizeof(kArgSizes);
+  ::memcpy(arg_data, &arg0, sizeof(arg0));
+  arg_data += sizeof(arg0);
+  ::memcpy(arg_data, &arg1, sizeof(arg1));
+  arg_data += sizeof(arg1);
+  ::memcpy(arg_data, kArg2, sizeof(kArg2));
+}
+
+// Encodes @p calls in a batch record.
+void EncodeBatch(const std::vector<std::vector<uint8_t>>& calls,
+                 std::vector<uint8_t>* batch) {
+  const uint64_t kBaseTimestamp = 1000;
+  batch->assign(FIELD_OFFSET(TraceBatchDetailedFunctionCalls, data), 0);
+
+  CompactFunctionCallEncoder encoder;
+  encoder.Reset(kBaseTimestamp);
+  for (const auto& call : calls) {
+    const TraceDetailedFunctionCall* data =
+        reinterpret_cast<const TraceDetailedFunctionCall*>(call.data());
+    size_t offset = batch->size();
+    batch->resize(offset + CompactFunctionCallEncoder::GetMaxEncodedSize(
+        *data));
+    batch->resize(offset + encoder.Encode(*data, batch->data() + offset));
+  }
+
+  size_t data_size =
+      batch->size() - FIELD_OFFSET(TraceBatchDetailedFunctionCalls, data);
+  if (batch->size() < sizeof(TraceBatchDetailedFunctionCalls))
+    batch->resize(sizeof(TraceBatchDetailedFunctionCalls));
+  TraceBatchDetailedFunctionCalls* record =
+      reinterpret_cast<TraceBatchDetailedFunctionCalls*>(batch->data());
+  record->base_timestamp = kBaseTimestamp;
+  record->num_calls = calls.size();
+  record->data_size = data_size;
+}
+
+}  // namespace
+
+TEST(CompactFunctionCallsTest, RoundTrip) {
+  std::vector<std::vector<uint8_t>> calls(5);
+  MakeCall(1010, 0, 0, 0x10000000, 0x123456789ull, &calls[0]);
+  MakeCall(1020, 1, 0, 0x10000010, 0x123456789ull, &calls[1]);
+  MakeCall(1020, 0, 0xDEADBEEF, 0x0FFFFFF0, 0, &calls[2]);
+  // Timestamps are allowed to go backwards, and arguments to wrap around.
+  MakeCall(1015, 1, 0xDEADBEEF, 0xFFFFFFFF, ~0ull, &calls[3]);
+  MakeCall(1030, 0, 42, 0, 1, &calls[4]);
+
+  std::vector<uint8_t> batch;
+  EncodeBatch(calls, &batch);
+  const TraceBatchDetailedFunctionCalls* record =
+      reinterpret_cast<const TraceBatchDetailedFunctionCalls*>(batch.data());
+
+  // The encoding is worth it.
+  size_t raw_size = 0;
+  for (const auto& call : calls)
+    raw_size += call.size();
+  EXPECT_GT(raw_size / 2, record->data_size);
+
+  CompactFunctionCallDecoder decoder(record);
+  for (const auto& call : calls) {
+    ASSERT_FALSE(decoder.done());
+    std::vector<uint8_t> decoded;
+    ASSERT_TRUE(decoder.DecodeNext(&decoded));
+    ASSERT_LE(call.size(), decoded.size());
+    EXPECT_EQ(0, ::memcmp(call.data(), decoded.data(), call.size()));
+  }
+  EXPECT_TRUE(decoder.done());
+}
+
+TEST(CompactFunctionCallsTest, NoArguments) {
+  std::vector<std::vector<uint8_t>> calls(2);
+  for (size_t i = 0; i < calls.size(); ++i) {
+    calls[i].assign(sizeof(TraceDetailedFunctionCall), 0);
+    TraceDetailedFunctionCall* data =
+        reinterpret_cast<TraceDetailedFunctionCall*>(calls[i].data());
+    data->timestamp = 2000 + i;
+    data->function_id = 7;
+  }
+
+  std::vector<uint8_t> batch;
+  EncodeBatch(calls, &batch);
+  CompactFunctionCallDecoder decoder(
+      reinterpret_cast<const TraceBatchDetailedFunctionCalls*>(batch.data()));
+  for (const auto& call : calls) {
+    std::vector<uint8_t> decoded;
+    ASSERT_TRUE(decoder.DecodeNext(&decoded));
+    ASSERT_EQ(call.size(), decoded.size());
+    EXPECT_EQ(0, ::memcmp(call.data(), decoded.data(), call.size()));
+  }
+  EXPECT_TRUE(decoder.done());
+}
+
+TEST(CompactFunctionCallsTest, TruncatedBatchFails) {
+  std::vector<std::vector<uint8_t>> calls(2);
+  MakeCall(1010, 0, 0, 0x10000000, 0x123456789ull, &calls[0]);
+  MakeCall(1020, 0, 0, 0x10000010, 0x123456789ull, &calls[1]);
+
+  std::vector<uint8_t> batch;
+  EncodeBatch(calls, &batch);
+  TraceBatchDetailedFunctionCalls* record =
+      reinterpret_cast<TraceBatchDetailedFunctionCalls*>(batch.data());
+  record->data_size -= 2;
+
+  CompactFunctionCallDecoder decoder(record);
+  std::vector<uint8_t> decoded;
+  EXPECT_TRUE(decoder.DecodeNext(&decoded));
+  EXPECT_FALSE(decoder.DecodeNext(&decoded));
+}
+
+}  // namespace protocol
+}  // namespace trace
@@ -23,6 +23,8 @@
       'sources': [
         'call_trace_defs.cc',
         'call_trace_defs.h',
+        'compact_function_calls.cc',
+        'compact_function_calls.h',
       ],
       'dependencies': [
         '<(src)/base/base.gyp:base',
@@ -33,6 +35,7 @@
       'type': 'executable',
       'sources': [
         'call_trace_defs_unittest.cc',
+        'compact_function_calls_unittest.cc',
         '<(src)/syzygy/testing/run_all_unittests.cc',
       ],
       'dependencies': [